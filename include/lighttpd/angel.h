@@ -3,6 +3,9 @@
 
 typedef void (*liAngelListenCB)(liServer *srv, int fd, gpointer data);
 
+/* fds: one socket per worker (index = worker ndx), NULL on error; steal the fds with g_array_set_size(fds, 0) */
+typedef void (*liAngelListenUdpCB)(liServer *srv, GArray *fds, gpointer data);
+
 typedef void (*liAngelLogOpen)(liServer *srv, int fd, gpointer data);
 
 /* interface to the angel; implementation needs to work without angel too */
@@ -11,6 +14,12 @@ LI_API void li_angel_setup(liServer *srv);
 /* listen to a socket (mainloop context) */
 LI_API void li_angel_listen(liServer *srv, GString *str, liAngelListenCB cb, gpointer data);
 
+/* listen with one SO_REUSEPORT socket per worker; each worker accepts on its own socket (mainloop context, workers must exist) */
+LI_API void li_angel_listen_reuseport(liServer *srv, GString *str, gboolean cpu_steering);
+
+/* bind one SO_REUSEPORT UDP socket per worker (mainloop context, workers must exist) */
+LI_API void li_angel_listen_udp(liServer *srv, GString *str, liAngelListenUdpCB cb, gpointer data);
+
 /* send log messages during startup to angel, frees the string */
 LI_API void li_angel_log(liServer *srv, GString *str);
 
@@ -18,6 +27,8 @@ LI_API void li_angel_log_open_file(liServer *srv, liEventLoop *loop, GString *fi
 
 /* angle_fake definitions, only for internal use */
 int li_angel_fake_listen(liServer *srv, GString *str);
+int li_angel_fake_listen_reuseport(liServer *srv, GString *str);
+int li_angel_fake_listen_udp(liServer *srv, GString *str);
 gboolean li_angel_fake_log(liServer *srv, GString *str);
 int li_angel_fake_log_open_file(liServer *srv, GString *filename);
 
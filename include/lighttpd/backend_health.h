@@ -0,0 +1,44 @@
+#ifndef _LIGHTTPD_BACKEND_HEALTH_H_
+#define _LIGHTTPD_BACKEND_HEALTH_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * backend health - results of active backend health checks (run by mod_balance), shared between all workers
+ *
+ * Modules register an entry per checked backend and report the check results; mod_status lists all entries.
+ */
+
+typedef enum {
+	LI_BACKEND_HEALTH_UNKNOWN, /* no check finished yet */
+	LI_BACKEND_HEALTH_UP,
+	LI_BACKEND_HEALTH_DOWN
+} liBackendHealthState;
+
+struct liBackendHealthEntry {
+	GString *name; /* check target */
+	liBackendHealthState state;
+	li_tstamp since; /* last state change */
+	guint64 checks, failed_checks;
+	GString *last_error; /* of the last failed check */
+};
+
+typedef void (*liBackendHealthForeachCB)(liBackendHealthEntry *entry, gpointer data);
+
+LI_API liBackendHealth* li_backend_health_new(void);
+LI_API void li_backend_health_free(liBackendHealth *bh);
+
+LI_API liBackendHealthEntry* li_backend_health_register(liBackendHealth *bh, const gchar *name);
+LI_API void li_backend_health_unregister(liBackendHealth *bh, liBackendHealthEntry *entry);
+
+/* records a check result and the (possibly unchanged) state; error is only used if check_ok is FALSE */
+LI_API void li_backend_health_report(liBackendHealth *bh, liBackendHealthEntry *entry, liBackendHealthState state, gboolean check_ok, const gchar *error, li_tstamp now);
+
+/* calls cb for all entries while holding the lock; don't keep references to the entries */
+LI_API void li_backend_health_foreach(liBackendHealth *bh, liBackendHealthForeachCB cb, gpointer data);
+
+LI_API const gchar* li_backend_health_state_string(liBackendHealthState state);
+
+#endif
@@ -96,6 +96,9 @@ LI_API void li_backend_wait_stop(liVRequest *vr, liBackendPool *bpool, liBackend
 /* set bcon->fd = -1 if you closed the connection after an error */
 LI_API void li_backend_put(liWorker *wrk, liBackendPool *bpool, liBackendConnection *bcon, gboolean closecon); /* if closecon == TRUE or bcon->watcher.fd == -1 the connection gets removed */
 
+/* how often the connection was put back into the pool, i.e. 0 for a new connection and > 0 for a keep-alive connection */
+LI_API gint li_backend_connection_requests(liBackendConnection *bcon);
+
 /* if an idle connections gets closed; bcon must be INACTIVE (i.e. not detached and not active).
  * call in worker that bcon is attached to.
  */
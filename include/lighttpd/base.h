@@ -44,9 +44,15 @@
 #include <lighttpd/environment.h>
 #include <lighttpd/virtualrequest.h>
 #include <lighttpd/stat_cache.h>
+#include <lighttpd/fd_cache.h>
+#include <lighttpd/mem_cache.h>
+#include <lighttpd/backend_health.h>
 #include <lighttpd/mimetype.h>
 
 #include <lighttpd/connection.h>
+#include <lighttpd/hpack.h>
+#include <lighttpd/http2.h>
+#include <lighttpd/http3.h>
 
 #include <lighttpd/collect.h>
 #include <lighttpd/network.h>
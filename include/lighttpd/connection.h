@@ -28,9 +28,12 @@ typedef enum {
 	LI_CON_STATE_WRITE,
 
 	/** connection was upgraded */
-	LI_CON_STATE_UPGRADED
+	LI_CON_STATE_UPGRADED,
+
+	/** HTTP/2 connection; the streams have their own vrequests */
+	LI_CON_STATE_HTTP2
 } liConnectionState;
-#define LI_CON_STATE_LAST LI_CON_STATE_UPGRADED
+#define LI_CON_STATE_LAST LI_CON_STATE_HTTP2
 /* update mod_status too */
 
 typedef struct liConnectionSocketCallbacks liConnectionSocketCallbacks;
@@ -69,6 +72,8 @@ struct liConnection {
 	liVRequest *mainvr;
 	liHttpRequestCtx req_parser_ctx;
 
+	liHttp2Connection *http2; /* only in LI_CON_STATE_HTTP2 */
+
 	li_tstamp ts_started; /* when connection was started, not a (v)request */
 
 	/* Keep alive timeout data */
@@ -13,4 +13,10 @@ LI_API gboolean li_http_response_handle_cachable(liVRequest *vr);
 LI_API void li_etag_mutate(GString *mut, GString *etag);
 LI_API void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable);
 
+/* building blocks of li_etag_set_header, to precompute the header values */
+LI_API void li_etag_create(GString *dest, const struct stat *st, guint flags);
+LI_API gboolean li_etag_last_modified(GString *dest, time_t mtime);
+/* etag == NULL removes the ETag header; last_modified may be NULL */
+LI_API void li_etag_set_header_strings(liVRequest *vr, GString *etag, GString *last_modified, gboolean *cachable);
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef _LIGHTTPD_FD_CACHE_H_
+#define _LIGHTTPD_FD_CACHE_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * fd cache - keeps static files open across requests and workers
+ *
+ * Entries are liChunkFile references keyed on the path, and are only returned if device, inode, size and mtime
+ * still match the struct stat the caller got from the stat cache; with stat_cache.shared, changes reported by
+ * inotify also close the cached fds right away.
+ * The number of entries is limited by stat_cache.fd_cache (and at most a quarter of the fd limit);
+ * the least recently used entry is dropped first.
+ */
+
+/* max_limit: upper bound for li_fd_cache_set_limit */
+LI_API liFdCache* li_fd_cache_new(guint max_limit);
+LI_API void li_fd_cache_free(liFdCache *fdc);
+
+/* 0 disables the cache; returns the limit actually used */
+LI_API guint li_fd_cache_set_limit(liFdCache *fdc, guint limit);
+LI_API gboolean li_fd_cache_enabled(liFdCache *fdc);
+
+/* returns a new reference or NULL if there is no matching entry */
+LI_API liChunkFile* li_fd_cache_get(liFdCache *fdc, GString *path, const struct stat *st);
+/* acquires a new reference to cf (cf->fd must be a regular file matching st) */
+LI_API void li_fd_cache_put(liFdCache *fdc, GString *path, liChunkFile *cf, const struct stat *st);
+
+/* drops the entry for path, or all entries below path if prefix is TRUE */
+LI_API void li_fd_cache_invalidate(liFdCache *fdc, GString *path, gboolean prefix);
+/* drop half of the entries; used if open() failed with EMFILE/ENFILE */
+LI_API void li_fd_cache_shrink(liFdCache *fdc);
+
+LI_API void li_fd_cache_counters(liFdCache *fdc, guint *entries, guint64 *evictions);
+
+#endif
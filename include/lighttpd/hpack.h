@@ -0,0 +1,55 @@
+#ifndef _LIGHTTPD_HPACK_H_
+#define _LIGHTTPD_HPACK_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * HPACK (RFC 7541): header compression for HTTP/2
+ *
+ * Each direction of a HTTP/2 connection has its own dynamic table; the decoder table is updated by
+ * li_hpack_decode, the encoder table by li_hpack_encode. Header names are always lowercase in HTTP/2.
+ */
+
+/* default SETTINGS_HEADER_TABLE_SIZE */
+#define LI_HPACK_DEFAULT_TABLE_SIZE 4096
+
+typedef struct liHPackEntry liHPackEntry;
+struct liHPackEntry {
+	GString *name, *value;
+};
+
+struct liHPackTable {
+	liHPackEntry *entries; /* ring buffer, newest entry at entries[head] */
+	guint alloc, head, used;
+
+	gsize size; /* sum of name + value + 32 over all entries */
+	gsize max_size; /* current limit */
+	gsize max_size_limit; /* decoder: max_size may not exceed this; encoder: limit requested by the peer */
+	gboolean size_update_pending; /* encoder: next header block has to start with a size update */
+};
+
+/* called for each decoded header; name and value are not 0-terminated and only valid during the call */
+typedef void (*liHPackHeaderCB)(gpointer data, const gchar *name, gsize namelen, const gchar *value, gsize valuelen);
+
+LI_API void li_hpack_table_init(liHPackTable *table, gsize max_size);
+LI_API void li_hpack_table_clear(liHPackTable *table);
+
+/* encoder: SETTINGS_HEADER_TABLE_SIZE from the peer; the table doesn't grow beyond LI_HPACK_DEFAULT_TABLE_SIZE */
+LI_API void li_hpack_table_set_max_size(liHPackTable *table, gsize max_size);
+
+/* decodes a complete header block; returns FALSE on a compression error (the connection has to be closed then) */
+LI_API gboolean li_hpack_decode(liHPackTable *table, const guchar *data, gsize len, liHPackHeaderCB cb, gpointer cb_data);
+
+/* call before the first li_hpack_encode of each header block */
+LI_API void li_hpack_encode_start(liHPackTable *table, GByteArray *out);
+/* name has to be lowercase */
+LI_API void li_hpack_encode(liHPackTable *table, GByteArray *out, const gchar *name, gsize namelen, const gchar *value, gsize valuelen);
+
+/* huffman coding, exported for the unit tests */
+LI_API gsize li_hpack_huffman_encoded_length(const guchar *data, gsize len);
+LI_API void li_hpack_huffman_encode(GByteArray *out, const guchar *data, gsize len);
+LI_API gboolean li_hpack_huffman_decode(GString *out, const guchar *data, gsize len);
+
+#endif
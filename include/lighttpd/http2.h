@@ -0,0 +1,57 @@
+#ifndef _LIGHTTPD_HTTP2_H_
+#define _LIGHTTPD_HTTP2_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * HTTP/2 (RFC 9113) on top of a liConnection
+ *
+ * The connection is switched to LI_CON_STATE_HTTP2 after ALPN negotiated "h2" or when a cleartext connection
+ * starts with the connection preface ("http2.cleartext"); it stays in that state until it is closed.
+ * Every stream gets its own liVRequest, with the request body and response body as liStreams (so the normal
+ * filters and backends work unchanged). Flow control windows of the request bodies follow the liCQLimit of
+ * the stream; response DATA frames are scheduled by urgency (RFC 9218 "priority" header, PRIORITY_UPDATE frames).
+ */
+
+#define LI_HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/* TRUE if cq starts with the connection preface, MAYBE if cq is too short to decide */
+LI_API liTristate li_connection_http2_check_preface(liChunkQueue *cq);
+
+/* switch to HTTP/2 and handle already received input; con has to be in the REQUEST_START state */
+LI_API void li_connection_http2_start(liConnection *con);
+
+/* called by the connection in/out stream callbacks in LI_CON_STATE_HTTP2 */
+LI_API void li_connection_http2_handle_input(liConnection *con);
+LI_API void li_connection_http2_handle_output(liConnection *con);
+
+/* number of open streams; the connection is in the io timeout queue while streams are open */
+LI_API guint li_connection_http2_open_streams(liConnection *con);
+
+/* send GOAWAY, close the connection after the active streams are finished */
+LI_API void li_connection_http2_shutdown(liConnection *con);
+
+/* abort all streams; called when the connection gets closed */
+LI_API void li_connection_http2_reset(liConnection *con);
+LI_API void li_connection_http2_free(liConnection *con);
+
+/* state while parsing the request header fields of a stream; also used for HTTP/3 streams, which have the same
+ * rules for pseudo-header and connection-specific fields */
+struct liHttp2HeaderCtx {
+	liRequest *req;
+	GString *authority; /* value of :authority, becomes the Host header */
+	gsize list_size;
+	gboolean trailers;
+	gboolean regular_seen, malformed, too_large;
+	gboolean have_method, have_scheme, have_path, have_authority;
+};
+
+/* add a decoded header field to ctx->req; sets ctx->malformed/too_large instead of failing */
+LI_API void li_http2_request_header(liHttp2HeaderCtx *ctx, const gchar *name, gsize namelen, const gchar *value, gsize valuelen);
+
+/* the connection a vrequest of a HTTP/2 stream belongs to, NULL for other vrequests */
+LI_API liConnection* li_connection_http2_from_vrequest(liVRequest *vr);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _LIGHTTPD_HTTP3_H_
+#define _LIGHTTPD_HTTP3_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * Experimental HTTP/3 (RFC 9114) listener; QUIC is handled by ngtcp2 (with gnutls), HTTP/3 framing and QPACK by nghttp3.
+ *
+ * Each worker gets its own SO_REUSEPORT UDP socket per listener from the angel; datagrams are received with
+ * recvmmsg()/UDP_GRO and sent with UDP_SEGMENT (GSO) or sendmmsg() batches. Every request stream gets its own
+ * liVRequest like an HTTP/2 stream, so all actions and backends work unchanged. Issued connection ids carry the
+ * index of the owning worker, so packets of migrated connections received by another worker are passed on to it;
+ * packets for unknown connections get a stateless reset.
+ * Only available if compiled with ngtcp2/nghttp3 (HAVE_HTTP3).
+ */
+
+/* "http3" setup: key-value list with "listen" (address) and "pemfile" (certificate and key, PEM) */
+LI_API gboolean li_http3_setup(liServer *srv, liValue *val);
+
+/* request the UDP sockets from the angel; called from the (async) prepare hook */
+LI_API void li_http3_prepare(liServer *srv);
+
+/* closes sockets not taken by a worker; called after the workers are freed */
+LI_API void li_http3_server_free(liServer *srv);
+
+/* worker context; NULL if no listener is configured */
+LI_API liHttp3Worker* li_http3_worker_new(liWorker *wrk);
+
+/* send GOAWAY; active streams are finished */
+LI_API void li_http3_worker_shutdown(liHttp3Worker *h3w);
+
+/* close all connections and stop the sockets */
+LI_API void li_http3_worker_stop(liHttp3Worker *h3w);
+
+LI_API void li_http3_worker_free(liHttp3Worker *h3w);
+
+#endif
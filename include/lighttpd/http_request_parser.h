@@ -19,5 +19,28 @@ LI_API void li_http_request_parser_clear(liHttpRequestCtx *ctx);
 
 LI_API liHandlerResult li_http_request_parse(liVRequest *vr, liHttpRequestCtx *ctx);
 
+/* Fast path (http_request_scan.c): if the complete request header is in the first chunk, it is parsed directly
+ * from the buffer, using SSE4.2/AVX2 (if the cpu supports it) to find line ends and separators. Everything the
+ * fast path doesn't handle (fragmented or incomplete input, continuation lines, invalid requests) goes through
+ * the ragel parser.
+ */
+typedef enum {
+	LI_HTTP_REQUEST_SCAN_AUTO,   /* best implementation the cpu supports */
+	LI_HTTP_REQUEST_SCAN_NONE,   /* disable the fast path, always use the ragel parser */
+	LI_HTTP_REQUEST_SCAN_SCALAR,
+	LI_HTTP_REQUEST_SCAN_SSE42,
+	LI_HTTP_REQUEST_SCAN_AVX2
+} liHttpRequestScanImpl;
+
+/* for tests and benchmarks; not thread-safe. returns FALSE if impl isn't available (selection is not changed then) */
+LI_API gboolean li_http_request_scan_select(liHttpRequestScanImpl impl);
+LI_API liHttpRequestScanImpl li_http_request_scan_selected(void);
+LI_API const gchar* li_http_request_scan_name(liHttpRequestScanImpl impl);
+
+/* returns the length of the request header (including the empty line) in [data..data+len), or 0 if the fast
+ * path can't handle it; req is left unmodified in that case.
+ */
+LI_API gsize li_http_request_parse_contiguous(liRequest *req, const gchar *data, gsize len);
+
 
 #endif
@@ -0,0 +1,66 @@
+#ifndef _LIGHTTPD_MEM_CACHE_H_
+#define _LIGHTTPD_MEM_CACHE_H_
+
+#ifndef _LIGHTTPD_BASE_H_
+#error Please include <lighttpd/base.h> instead of this file
+#endif
+
+/*
+ * memory cache - content of small hot static files, shared between all workers
+ *
+ * Entries are keyed on the path and only returned while device, inode, size and mtime match the stat cache result.
+ * The content is kept in a liBuffer (appended to the response without copying), together with the ETag,
+ * Last-Modified and Content-Type values.
+ * New files are only admitted if they were requested more often than the entries they would evict (TinyLFU:
+ * request frequencies are estimated by a count-min sketch which is halved periodically), so a scan over many
+ * files doesn't flush the cache.
+ */
+
+/* only files up to this size are cached */
+#define LI_MEM_CACHE_MAX_FILE_SIZE (64*1024)
+
+struct liMemCacheEntry {
+	gint refcount;
+
+	GString *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec; /* 0 if the platform doesn't have it */
+
+	liBuffer *content;
+
+	guint etag_flags; /* ETag was built with these flags */
+	GString *etag; /* NULL if etag_flags == 0 */
+	GString *last_modified; /* NULL if mtime couldn't be formatted */
+	gpointer mime_types; /* mimetype table the Content-Type was looked up in */
+	GString *mime_type; /* NULL: not found in mime_types */
+
+	/* internal */
+	guint hash; /* of path */
+	GList lru_link; /* protected by the cache lock */
+};
+
+LI_API liMemCache* li_mem_cache_new(void);
+LI_API void li_mem_cache_free(liMemCache *mc);
+
+/* size: memory limit for cached content in bytes, 0 disables the cache */
+LI_API void li_mem_cache_set_limit(liMemCache *mc, goffset size);
+LI_API gboolean li_mem_cache_enabled(liMemCache *mc);
+
+/* counts the request for the admission policy; returns a new reference or NULL if there is no matching entry */
+LI_API liMemCacheEntry* li_mem_cache_get(liMemCache *mc, GString *path, const struct stat *st);
+
+/* if the admission policy accepts the file, reads it from cf in the tasklet pool of the worker and inserts
+ * the entry when done; the current request has to be served from cf */
+LI_API void li_mem_cache_fill(liVRequest *vr, liMemCache *mc, GString *path, const struct stat *st, liChunkFile *cf);
+
+LI_API void li_mem_cache_entry_release(liMemCacheEntry *mce);
+
+/* drops the entry for path, or all entries below path if prefix is TRUE */
+LI_API void li_mem_cache_invalidate(liMemCache *mc, GString *path, gboolean prefix);
+
+LI_API void li_mem_cache_counters(liMemCache *mc, guint *entries, goffset *size, guint64 *rejected, guint64 *evictions);
+
+#endif
@@ -6,6 +6,7 @@
 #include <lighttpd/buffer.h>
 
 typedef struct liMemcachedCon liMemcachedCon;
+typedef struct liMemcachedCluster liMemcachedCluster;
 typedef struct liMemcachedItem liMemcachedItem;
 typedef struct liMemcachedRequest liMemcachedRequest;
 typedef enum {
@@ -50,6 +51,32 @@ LI_API void li_memcached_con_release(liMemcachedCon* con); /* thread-safe */
 LI_API liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err);
 LI_API liMemcachedRequest* li_memcached_set(liMemcachedCon *con, GString *key, guint32 flags, li_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
 
+/* one "get" for up to LI_MEMCACHED_MAX_MULTI_KEYS keys; the callback is called once for every key (in order):
+ * LI_MEMCACHED_OK with the item, or LI_MEMCACHED_NOT_FOUND / LI_MEMCACHED_RESULT_ERROR with an item containing only the key */
+#define LI_MEMCACHED_MAX_MULTI_KEYS 100
+LI_API liMemcachedRequest* li_memcached_get_multi(liMemcachedCon *con, GString * const *keys, guint count, liMemcachedCB callback, gpointer cb_data, GError **err);
+
+/* cluster: keys are mapped to the servers with consistent hashing (160 points per server on a hash ring, positions
+ * depend only on the server address); each server gets a pool of up to pool_size connections (another connection
+ * is only opened if all are busy). Servers which fail are skipped (their keys move to the next server on the ring)
+ * and retried after 1, 2, 4, ... (max 60) seconds; requests which were queued on a connection that failed before
+ * they got an answer are sent again to the next server.
+ * Like liMemcachedCon not thread-safe (apart from _free if it isn't used anymore) */
+LI_API liMemcachedCluster* li_memcached_cluster_new(liEventLoop *loop, const liSocketAddress *addrs, guint count, guint pool_size);
+LI_API void li_memcached_cluster_free(liMemcachedCluster *cluster);
+
+/* ring lookup without any io: index (into the addrs passed to li_memcached_cluster_new) of the server for key;
+ * servers with down[ndx] set are skipped like failed servers (down may be NULL) */
+LI_API guint li_memcached_cluster_lookup(liMemcachedCluster *cluster, GString *key, const gboolean *down);
+
+LI_API liMemcachedRequest* li_memcached_cluster_get(liMemcachedCluster *cluster, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_cluster_set(liMemcachedCluster *cluster, GString *key, guint32 flags, li_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
+
+/* fan-out lookup: one multi-get per server. returns FALSE (without calling the callback) if a key is invalid;
+ * otherwise the callback is called once for every key like for li_memcached_get_multi (possibly before this returns,
+ * for keys which couldn't be sent). the key order is only kept per server */
+LI_API gboolean li_memcached_cluster_get_multi(liMemcachedCluster *cluster, GString * const *keys, guint count, liMemcachedCB callback, gpointer cb_data, GError **err);
+
 /* if length(key) <= 250 and all chars x: 0x20 < x < 0x7f the key
  * remains untouched; otherwise it gets replaced with its sha1hex hash
  * so in most cases the key stays readable, and we have a good fallback
@@ -18,7 +18,8 @@ LI_API ssize_t li_net_write(int fd, void *buf, ssize_t nbyte);
 /** repeats read after EINTR */
 LI_API ssize_t li_net_read(int fd, void *buf, ssize_t nbyte);
 
-LI_API liNetworkStatus li_network_write(int fd, liChunkQueue *cq, goffset write_max, GError **err);
+/* doesn't touch TCP_CORK; the caller decides how to coalesce (see stream_simple_socket.c) */
+LI_API liNetworkStatus li_network_write(int fd, liChunkQueue *cq, goffset write_max, liNetworkBackend backend, GError **err);
 LI_API liNetworkStatus li_network_read(int fd, liChunkQueue *cq, goffset read_max, liBuffer **buffer, GError **err);
 
 /* use writev for mem chunks, buffered read/write for files */
@@ -33,6 +34,43 @@ LI_API liNetworkStatus li_network_write_sendfile(int fd, liChunkQueue *cq, goffs
 LI_API liNetworkStatus li_network_backend_write(int fd, liChunkQueue *cq, goffset *write_max, GError **err);
 LI_API liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *write_max, GError **err);
 
+/* io_uring backend (per worker ring)
+ * only small queues (up to LI_NETWORK_URING_SLOT_SIZE bytes) are handled: the data is copied into a
+ * registered buffer slot and the write gets submitted with all other pending writes of the worker
+ * once per event loop iteration. while a write is in flight (stream->uring_op != NULL) the stream
+ * has can_write = FALSE and doesn't wait for LI_EV_WRITE; the completion sets can_write again.
+ */
+#define LI_NETWORK_URING_SLOTS 64
+#define LI_NETWORK_URING_SLOT_SIZE (16*1024)
+
+LI_API liNetworkUring* li_network_uring_new(liWorker *wrk, GError **err);
+LI_API void li_network_uring_free(liNetworkUring *ring);
+/* submit all queued writes; called from the worker prepare watcher */
+LI_API void li_network_uring_submit(liNetworkUring *ring);
+/* returns FALSE if the write has to be done synchronously; otherwise the data got removed from cq */
+LI_API gboolean li_network_uring_write(liNetworkUring *ring, liIOStream *stream, liChunkQueue *cq, goffset write_max);
+/* forget the stream of an in-flight write; the data still gets sent, but the stream won't be notified.
+ * if fd != -1 the ring takes over the fd and closes it (gracefully) after the write finished
+ * returns FALSE if there was no in-flight write (fd is not taken over in that case)
+ */
+LI_API gboolean li_network_uring_detach(liIOStream *stream, int fd);
+
+/* MSG_ZEROCOPY (linux) for large BUFFER_CHUNKs (network.zerocopy_threshold); the liBuffer is kept
+ * referenced until the kernel reports the completion on the socket error queue.
+ */
+LI_API void li_network_zerocopy_worker_init(liWorker *wrk);
+LI_API void li_network_zerocopy_worker_clear(liWorker *wrk);
+/* whether the first chunk of cq should be sent with li_network_write_zerocopy */
+LI_API gboolean li_network_zerocopy_applies(liWorker *wrk, liIOStream *stream, liChunkQueue *cq);
+/* sends (part of) the first chunk only */
+LI_API liNetworkStatus li_network_write_zerocopy(liIOStream *stream, liChunkQueue *cq, goffset *write_max, GError **err);
+/* read pending completions; pending completions raise EPOLLERR (reported as LI_EV_READ), so this
+ * has to be called whenever the io watcher fires, otherwise an idle connection spins.
+ */
+LI_API void li_network_zerocopy_reap(liIOStream *stream);
+/* call before the fd of the stream gets closed; keeps the socket open until all pinned buffers are released */
+LI_API void li_network_zerocopy_release(liIOStream *stream);
+
 #define LI_NETWORK_FALLBACK(f, write_max) do { \
 	liNetworkStatus res; \
 	switch(res = f(fd, cq, write_max, err)) { \
@@ -24,6 +24,8 @@ enum liCoreOptions {
 	LI_CORE_OPTION_PROXY_PROTOCOL_TLV_MAX_LENGTH,
 
 	LI_CORE_OPTION_CGI_MANGLE_ENV_NAMES,
+
+	LI_CORE_OPTION_HTTP2_CLEARTEXT,
 };
 
 enum liCoreOptionPtrs {
@@ -32,6 +34,8 @@ enum liCoreOptionPtrs {
 	LI_CORE_OPTION_SERVER_NAME,
 	LI_CORE_OPTION_SERVER_TAG,
 
+	LI_CORE_OPTION_ALT_SVC,
+
 	LI_CORE_OPTION_MIME_TYPES,
 };
 
@@ -42,6 +42,8 @@ LI_API void li_request_clear(liRequest *req);
 LI_API void li_request_copy(liRequest *dest, const liRequest *src);
 
 LI_API gboolean li_request_validate_header(liConnection *con);
+/* validates the request of a vrequest which doesn't belong to a HTTP/1 connection (sets vr->response.http_status on error) */
+LI_API gboolean li_request_validate_header_vr(liVRequest *vr, gboolean *expect_100_cont);
 
 LI_API void li_physical_init(liPhysical *phys);
 LI_API void li_physical_reset(liPhysical *phys);
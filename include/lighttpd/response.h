@@ -16,5 +16,7 @@ LI_API void li_response_reset(liResponse *resp);
 LI_API void li_response_clear(liResponse *resp);
 
 LI_API void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueue *response_body, gboolean upgraded);
+/* appends the default error page for vr->response.http_status and sets Content-Type */
+LI_API void li_response_send_error_page(liVRequest *vr, liChunkQueue *response_body);
 
 #endif
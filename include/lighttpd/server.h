@@ -32,6 +32,10 @@ struct liServerSocket {
 	liServer *srv;
 	liEventIO watcher;
 
+	/* NULL: accepted in the main worker and dispatched to the least loaded worker;
+	 * otherwise a SO_REUSEPORT socket accepted directly in this worker */
+	liWorker *wrk;
+
 	liSocketAddress local_addr;
 
 	/* Custom sockets (ssl) */
@@ -76,6 +80,8 @@ struct liServer {
 	liEventTimer srv_1sec_timer;
 
 	GPtrArray *sockets;          /** array of (server_socket*) */
+	gboolean listening;          /** atomic access; whether worker (SO_REUSEPORT) sockets should accept */
+	gboolean listen_cpu_steering; /** steer new connections to the worker socket of the receiving cpu */
 
 	liModules *modules;
 
@@ -121,7 +127,15 @@ struct liServer {
 	gdouble io_timeout;
 
 	gdouble stat_cache_ttl;
+	gboolean stat_cache_shared_enabled;
+	liStatCacheShared *stat_cache_shared; /** created by the main worker */
+	liFdCache *fd_cache;
+	liMemCache *mem_cache;
+	liBackendHealth *backend_health;
 	gint tasklet_pool_threads;
+	liNetworkBackend network_backend;
+	goffset network_zerocopy_threshold; /** 0: MSG_ZEROCOPY disabled */
+	liHttp3Server *http3; /** "http3" listeners, NULL if none configured */
 };
 
 
@@ -130,6 +144,8 @@ LI_API void li_server_free(liServer* srv);
 LI_API void li_server_loop_init(liServer *srv);
 
 LI_API liServerSocket* li_server_listen(liServer *srv, int fd);
+/* main worker only; connections on fd are accepted in wrk directly (SO_REUSEPORT) */
+LI_API liServerSocket* li_server_listen_worker(liServer *srv, liWorker *wrk, int fd);
 
 /* exit asap with cleanup */
 LI_API void li_server_exit(liServer *srv);
@@ -9,10 +9,14 @@
  *
  * Entries are removed after 10 seconds (adjustable through stat_cache.ttl setup)
  *
+ * With stat_cache.shared the results are also put into a server-wide cache (split into lock-protected shards), so
+ * other workers don't need to stat() the same file again. Shared results are dropped when inotify reports a change
+ * in the directory of the file (or in the directory itself for listings), which allows much longer TTLs.
+ * Worker entries with a shared result return the cached struct stat directly instead of calling stat() again.
+ *
  * TODO:
  *     - create ETAGs
  *     - get content type from xattr
- *     - add support for inotify (linux). TTL for entries can be increased to 60s
  *
  * Technical details:
  * If a stat is requested, the following procedure takes place:
@@ -72,6 +76,9 @@ struct liStatCacheEntry {
 	guint refcount;
 	liWaitQueueElem queue_elem;       /* queue element for the delete_queue */
 	gboolean cached;
+
+	liStatCacheRecord *record;        /* result shared with the other workers (stat_cache.shared), owns the dirlist */
+	gboolean unwatched;               /* symlink: changes won't be reported */
 };
 
 struct liStatCache {
@@ -83,14 +90,21 @@ struct liStatCache {
 	liWaitQueue delete_queue;
 	gdouble ttl;
 
-	guint64 hits;
-	guint64 misses;
-	guint64 errors;
+	liWorker *wrk;
+	liStatCacheShared *shared;        /* srv->stat_cache_shared */
 };
 
 LI_API liStatCache* li_stat_cache_new(liWorker *wrk, gdouble ttl);
 LI_API void li_stat_cache_free(liStatCache *sc);
 
+/* the inotify watcher and the sweep timer run in loop (the main worker) */
+LI_API liStatCacheShared* li_stat_cache_shared_new(liServer *srv, liEventLoop *loop, gdouble ttl);
+/* clear the watchers; call before the loop is destroyed */
+LI_API void li_stat_cache_shared_stop(liStatCacheShared *shared);
+/* call after all worker caches are freed */
+LI_API void li_stat_cache_shared_free(liStatCacheShared *shared);
+LI_API void li_stat_cache_shared_counters(liStatCacheShared *shared, guint64 *invalidations, guint *watches);
+
 /*
  gets a stat_cache_entry for a specified path
  if fd is set, a new fd is acquired via open() and stat info via fstat(), otherwise only a stat() is performed
@@ -101,6 +115,12 @@ LI_API liHandlerResult li_stat_cache_get(liVRequest *vr, GString *path, struct s
 /* doesn't return HANDLER_WAIT_FOR_EVENT, blocks instead of async lookup */
 LI_API liHandlerResult li_stat_cache_get_sync(liVRequest *vr, GString *path, struct stat *st, int *err, int *fd);
 
+/*
+ like li_stat_cache_get with fd, but returns a (new reference to a) liChunkFile for regular files (NULL otherwise),
+ which may come from the server-wide fd cache (see fd_cache.h) instead of a new open()
+*/
+LI_API liHandlerResult li_stat_cache_get_file(liVRequest *vr, GString *path, struct stat *st, int *err, liChunkFile **cf);
+
 /*
  sce->dirlist will contain a list of stat_cache_entry_data upon success
  returns HANDLER_WAIT_FOR_EVENT in case of a cache MISS, HANDLER_GO_ON in case of a hit and HANDLER_ERROR in case of an error
@@ -71,6 +71,10 @@ struct liIOStream {
 	/* whether we want to read/write */
 	guint in_closed:1, out_closed:1;
 	guint can_read:1, can_write:1; /* set to FALSE if you got EAGAIN */
+	guint corked:1; /* TCP_CORK set; stays set while a write leaves data behind or (cork_until_flush) until the queue is closed or flushed */
+	guint cork_until_flush:1; /* owner calls li_stream_simple_socket_flush when a response is complete: an empty queue doesn't mean no more data is coming */
+	guint pushed:1; /* last write removed the cork after draining the queue: nothing to flush */
+	guint ktls_tx:1; /* kernel TLS encrypts outgoing data: no MSG_ZEROCOPY */
 	guint throttled_in:1, throttled_out:1;
 
 	/* throttle needs to be handled by the liIOStreamCB cb */
@@ -80,6 +84,9 @@ struct liIOStream {
 	liIOStreamCB cb;
 
 	gpointer data; /* data for the callback */
+
+	liNetworkUringOp *uring_op; /* in-flight io_uring write (see network_uring.c) */
+	liNetworkZeroCopy *zerocopy; /* buffers pinned by MSG_ZEROCOPY sends (see network_zerocopy.c) */
 };
 
 LI_API const gchar* li_iostream_event_string(liIOStreamEvent event);
@@ -106,6 +113,9 @@ LI_API void li_stream_simple_socket_io_cb(liIOStream *stream, liIOStreamEvent ev
 LI_API void li_stream_simple_socket_io_cb_with_buffer(liIOStream *stream, liIOStreamEvent event, liBuffer **buffer);
 /* tries to flush TCP sockets by disabling nagle */
 LI_API void li_stream_simple_socket_flush(liIOStream *stream);
+/* whether the owner calls li_stream_simple_socket_flush at the end of each response; only then
+ * TCP_CORK is kept while the queue is empty but not closed. turning it off uncorks an empty queue */
+LI_API void li_stream_simple_socket_cork_until_flush(liIOStream *stream, gboolean until_flush);
 
 
 /* inline implementations */
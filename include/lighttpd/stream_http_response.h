@@ -5,4 +5,10 @@
 
 LI_API liStream* li_stream_http_response_handle(liStream *http_in, liVRequest *vr, gboolean accept_cgi, gboolean accept_nph, gboolean keepalive);
 
+/* whether the response was read completely (content-length or chunked framing) and the backend didn't ask to close
+ * the connection, i.e. it can be used for another request. only meaningful after the stream got disconnected from
+ * http_in; stream must be a stream returned by li_stream_http_response_handle.
+ */
+LI_API gboolean li_stream_http_response_reusable(liStream *stream);
+
 #endif
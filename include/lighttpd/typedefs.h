@@ -85,6 +85,22 @@ typedef struct liConnection liConnection;
 
 typedef struct liFilter liFilter;
 
+/* hpack.h */
+
+typedef struct liHPackTable liHPackTable;
+
+/* http2.h */
+
+typedef struct liHttp2Connection liHttp2Connection;
+
+typedef struct liHttp2HeaderCtx liHttp2HeaderCtx;
+
+/* http3.h */
+
+typedef struct liHttp3Server liHttp3Server;
+
+typedef struct liHttp3Worker liHttp3Worker;
+
 /* http_headers.h */
 
 typedef struct liHttpHeader liHttpHeader;
@@ -136,6 +152,16 @@ typedef enum {
 	LI_NETWORK_STATUS_WAIT_FOR_EVENT       /**< read/write returned -1 with errno=EAGAIN/EWOULDBLOCK */
 } liNetworkStatus;
 
+typedef enum {
+	LI_NETWORK_BACKEND_SENDFILE,           /**< sendfile for files, writev for mem chunks (writev if sendfile isn't available) */
+	LI_NETWORK_BACKEND_WRITEV,             /**< writev for mem chunks, buffered read/write for files */
+	LI_NETWORK_BACKEND_IO_URING            /**< small writes are batched through a per-worker io_uring, everything else like SENDFILE */
+} liNetworkBackend;
+
+typedef struct liNetworkUring liNetworkUring;
+typedef struct liNetworkUringOp liNetworkUringOp;
+typedef struct liNetworkZeroCopy liNetworkZeroCopy;
+
 /* options.h */
 
 typedef union liOptionValue liOptionValue;
@@ -198,7 +224,9 @@ typedef enum {
 typedef enum {
 	LI_HTTP_VERSION_UNSET = -1,
 	LI_HTTP_VERSION_1_0,
-	LI_HTTP_VERSION_1_1
+	LI_HTTP_VERSION_1_1,
+	LI_HTTP_VERSION_2,
+	LI_HTTP_VERSION_3
 } liHttpVersion;
 
 typedef struct liRequest liRequest;
@@ -264,5 +292,21 @@ typedef struct liWorker liWorker;
 typedef struct liStatCacheEntryData liStatCacheEntryData;
 typedef struct liStatCacheEntry liStatCacheEntry;
 typedef struct liStatCache liStatCache;
+typedef struct liStatCacheShared liStatCacheShared;
+typedef struct liStatCacheRecord liStatCacheRecord;
+
+/* fd_cache.h */
+
+typedef struct liFdCache liFdCache;
+
+/* mem_cache.h */
+
+typedef struct liMemCache liMemCache;
+typedef struct liMemCacheEntry liMemCacheEntry;
+
+/* backend_health.h */
+
+typedef struct liBackendHealth liBackendHealth;
+typedef struct liBackendHealthEntry liBackendHealthEntry;
 
 #endif
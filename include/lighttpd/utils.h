@@ -23,6 +23,10 @@ LI_API void li_fd_no_block(int fd);
 LI_API void li_fd_block(int fd);
 LI_API void li_fd_close_on_exec(int fd);
 
+/* attach a classic BPF program to the SO_REUSEPORT group of fd, selecting socket (cpu % count)
+ * for new connections. returns FALSE (with errno set) if not supported */
+LI_API gboolean li_fd_reuseport_cpu_steering(int fd, guint count);
+
 #ifndef LIGHTY_OS_WINDOWS
 /* return -2 for EAGAIN, -1 for some other error, 0 for success */
 LI_API int li_send_fd(int s, int fd); /* write fd to unix socket s */
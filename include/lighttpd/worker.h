@@ -10,6 +10,9 @@
 
 struct lua_State;
 
+/* log2 histograms: bucket i counts values in [2^i, 2^(i+1)), bucket 0 includes 0, last bucket everything above */
+#define LI_STATS_HIST_SIZE 16
+
 typedef struct liStatistics liStatistics;
 struct liStatistics {
 	guint64 bytes_out;        /** bytes transferred, outgoing */
@@ -42,6 +45,39 @@ struct liStatistics {
 	guint64 last_requests;
 	double requests_per_sec;
 	li_tstamp last_update;
+
+	/* accept engine; counted by the worker calling accept() */
+	guint64 accept_wakeups;   /** listen callbacks which accepted at least one connection */
+	guint64 accepted;         /** accepted connections */
+	guint64 accept_batch_max; /** most connections accepted in one wakeup */
+	guint64 accept_batch_hist[LI_STATS_HIST_SIZE]; /** connections accepted per wakeup */
+	/* counted by the worker handling the connection */
+	guint64 dispatch_latency_hist[LI_STATS_HIST_SIZE]; /** microseconds from accept() until connection start */
+
+	/* write coalescing */
+	guint64 cork_syscalls; /** setsockopt() calls for TCP_CORK/TCP_NODELAY */
+	guint64 cork_syscalls_baseline; /** calls a cork/uncork pair around every multi-chunk write plus a flush would have needed */
+
+	/* stat cache */
+	guint64 stat_cache_hits;
+	guint64 stat_cache_shared_hits;   /** misses in the worker cache found in the shared cache */
+	guint64 stat_cache_misses;
+	guint64 stat_cache_errors;        /** failed stat() calls */
+	guint64 stat_cache_invalidated;   /** entries dropped because the file changed */
+	guint64 fd_cache_hits;            /** open() calls saved by the fd cache */
+	guint64 fd_cache_misses;
+	guint64 mem_cache_hits;           /** static files served from the memory cache */
+	guint64 mem_cache_misses;         /** small static files not in the memory cache */
+	guint64 disk_cache_hits;          /** mod_cache_disk_etag */
+	guint64 disk_cache_misses;
+	guint64 disk_cache_evictions;     /** files removed to stay within the cache directory limits */
+};
+
+typedef struct liWorkerNewCon liWorkerNewCon;
+struct liWorkerNewCon {
+	liSocketAddress remote_addr;
+	int s;
+	liServerSocket *srv_sock;
 };
 
 typedef struct liWorkerTS liWorkerTS;
@@ -90,6 +126,13 @@ struct liWorker {
 	/*  - new connections (after accept) */
 	liEventAsync new_con_watcher;
 	GAsyncQueue *new_con_queue;
+	/*  - new (SO_REUSEPORT) listening sockets accepted in this worker */
+	liEventAsync listen_watcher;
+	GAsyncQueue *listen_queue;
+
+	GPtrArray *listen_sockets; /** array of (liServerSocket*) accepted in this worker, use only from local worker context */
+	gboolean listen_limit_hit; /** true if the connection limit was hit and listen_sockets are disabled */
+	liEventTimer listen_limit_timer;
 
 	liServerStateWait wait_for_stop_connections;
 
@@ -105,6 +148,10 @@ struct liWorker {
 	liStatCache *stat_cache;
 
 	liBuffer *network_read_buf; /** available buffer - steal it if you need it, can be NULL. refcount must be 1, no other references. */
+	liNetworkUring *network_uring; /** only set with network.backend "io_uring" */
+	liHttp3Worker *http3; /** only set with a "http3" listener */
+	GPtrArray *network_zerocopy_orphans; /** MSG_ZEROCOPY buffers of closed streams waiting for their completions */
+	liEventTimer network_zerocopy_timer;
 };
 
 LI_API liWorker* li_worker_new(liServer *srv, struct ev_loop *loop);
@@ -122,6 +169,16 @@ LI_API void li_worker_suspend(liWorker *context, liWorker *wrk);
 LI_API void li_worker_exit(liWorker *context, liWorker *wrk);
 
 LI_API void li_worker_new_con(liWorker *ctx, liWorker *wrk, liSocketAddress remote_addr, int s, liServerSocket *srv_sock);
+/* hand over a batch of connections with a single queue operation; takes ownership of cons (array of liWorkerNewCon).
+ * ts_accepted is used for the dispatch latency statistics */
+LI_API void li_worker_new_cons(liWorker *ctx, liWorker *wrk, GArray *cons, li_tstamp ts_accepted);
+
+/* takes ownership of the socket watcher; sock->watcher must not be attached to a loop */
+LI_API void li_worker_listen_add(liWorker *ctx, liWorker *wrk, liServerSocket *sock);
+/* (re)start or stop the worker sockets depending on srv->listening */
+LI_API void li_worker_listen_update(liWorker *ctx, liWorker *wrk);
+/* local worker context only: disable the worker sockets until the load drops again */
+LI_API void li_worker_listen_limit_hit(liWorker *wrk);
 
 LI_API void li_worker_check_keepalive(liWorker *wrk);
 
@@ -135,6 +192,8 @@ LI_API void li_worker_con_put(liConnection *con);
 
 INLINE li_tstamp li_cur_ts(liWorker *wrk);
 
+INLINE void li_stats_hist_add(guint64 *hist, guint64 value);
+
 INLINE liWorker* li_worker_from_iostream(liIOStream *stream);
 INLINE liWorker* li_worker_from_stream(liStream *stream);
 
@@ -146,6 +205,15 @@ INLINE li_tstamp li_cur_ts(liWorker *wrk) {
 	return li_event_now(&wrk->loop);
 }
 
+INLINE void li_stats_hist_add(guint64 *hist, guint64 value) {
+	guint i = 0;
+	while (value > 1 && i < LI_STATS_HIST_SIZE - 1) {
+		value >>= 1;
+		i++;
+	}
+	hist[i]++;
+}
+
 INLINE liWorker* li_worker_from_stream(liStream *stream) {
 	if (NULL == stream->loop) return NULL;
 	return LI_CONTAINER_OF(stream->loop, liWorker, loop);
@@ -50,6 +50,8 @@ struct plugin_config {
 
 	liInstance *inst;
 	GHashTable *listen_sockets;
+	GHashTable *listen_reuseport_sockets; /* SO_REUSEPORT groups, fd count may differ from listen_sockets */
+	GHashTable *listen_udp_sockets; /* SO_REUSEPORT groups of UDP sockets (same address as a TCP socket is fine) */
 
 	liEventSignal sig_hup;
 };
@@ -84,6 +86,9 @@ struct listen_socket {
 
 	liSocketAddress addr;
 	int fd;
+
+	GArray *reuseport_fds; /* (int) all sockets of a SO_REUSEPORT group (fd is the first one), NULL otherwise */
+	gboolean udp; /* group in listen_udp_sockets */
 };
 
 struct listen_ref_resource {
@@ -570,7 +575,22 @@ static void listen_ref_release(liServer *srv, liInstance *i, liPlugin *p, liInst
 		 * address) and b) it doesn't matter - it just means the next
 		 * `core_listen` will try to bind a new one (and fail...).
 		 */
-		g_hash_table_remove(config->listen_sockets, &sock->addr);
+		if (NULL != sock->reuseport_fds) {
+			GHashTable *groups = sock->udp ? config->listen_udp_sockets : config->listen_reuseport_sockets;
+			guint j;
+
+			/* a new group with a different size may have replaced this one already */
+			if (sock == g_hash_table_lookup(groups, &sock->addr)) {
+				g_hash_table_remove(groups, &sock->addr);
+			}
+
+			for (j = 1; j < sock->reuseport_fds->len; j++) {
+				close(g_array_index(sock->reuseport_fds, int, j));
+			}
+			g_array_free(sock->reuseport_fds, TRUE);
+		} else {
+			g_hash_table_remove(config->listen_sockets, &sock->addr);
+		}
 
 		li_sockaddr_clear(&sock->addr);
 		close(sock->fd);
@@ -669,13 +689,14 @@ static gboolean listen_check_acl(liServer *srv, plugin_config *config, liSocketA
 	return FALSE;
 }
 
-static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
+/* udp: bind a datagram socket (no listen()) */
+static int do_listen(liServer *srv, liSocketAddress *addr, GString *str, gboolean reuseport, gboolean udp) {
 	int s, v;
 	GString *ipv6_str;
 
 	switch (addr->addr_up.plain->sa_family) {
 	case AF_INET:
-		if (-1 == (s = socket(AF_INET, SOCK_STREAM, 0))) {
+		if (-1 == (s = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0))) {
 			ERROR(srv, "Couldn't open socket: %s", g_strerror(errno));
 			return -1;
 		}
@@ -685,11 +706,28 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 			ERROR(srv, "Couldn't setsockopt(SO_REUSEADDR): %s", g_strerror(errno));
 			return -1;
 		}
+#ifdef SO_REUSEPORT
+		if (reuseport && -1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v))) {
+			close(s);
+			ERROR(srv, "Couldn't setsockopt(SO_REUSEPORT): %s", g_strerror(errno));
+			return -1;
+		}
+#else
+		if (reuseport) {
+			close(s);
+			ERROR(srv, "SO_REUSEPORT not supported on this platform, can't listen on '%s'", str->str);
+			return -1;
+		}
+#endif
 		if (-1 == bind(s, addr->addr_up.plain, addr->len)) {
 			close(s);
 			ERROR(srv, "Couldn't bind socket to '%s': %s", str->str, g_strerror(errno));
 			return -1;
 		}
+		if (udp) {
+			DEBUG(srv, "listen to ipv4 (udp): '%s' (port: %d)", str->str, ntohs(addr->addr_up.ipv4->sin_port));
+			return s;
+		}
 #ifdef TCP_FASTOPEN
 		v = 1000;
 		setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, &v, sizeof(v));
@@ -706,7 +744,7 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 		ipv6_str = g_string_sized_new(0);
 		li_ipv6_tostring(ipv6_str, addr->addr_up.ipv6->sin6_addr.s6_addr);
 
-		if (-1 == (s = socket(AF_INET6, SOCK_STREAM, 0))) {
+		if (-1 == (s = socket(AF_INET6, udp ? SOCK_DGRAM : SOCK_STREAM, 0))) {
 			ERROR(srv, "Couldn't open socket: %s", g_strerror(errno));
 			g_string_free(ipv6_str, TRUE);
 			return -1;
@@ -724,12 +762,32 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 			g_string_free(ipv6_str, TRUE);
 			return -1;
 		}
+#ifdef SO_REUSEPORT
+		if (reuseport && -1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v))) {
+			close(s);
+			ERROR(srv, "Couldn't setsockopt(SO_REUSEPORT): %s", g_strerror(errno));
+			g_string_free(ipv6_str, TRUE);
+			return -1;
+		}
+#else
+		if (reuseport) {
+			close(s);
+			ERROR(srv, "SO_REUSEPORT not supported on this platform, can't listen on '%s'", ipv6_str->str);
+			g_string_free(ipv6_str, TRUE);
+			return -1;
+		}
+#endif
 		if (-1 == bind(s, addr->addr_up.plain, addr->len)) {
 			close(s);
 			ERROR(srv, "Couldn't bind socket to '%s': %s", ipv6_str->str, g_strerror(errno));
 			g_string_free(ipv6_str, TRUE);
 			return -1;
 		}
+		if (udp) {
+			DEBUG(srv, "listen to ipv6 (udp): '%s' (port: %d)", ipv6_str->str, ntohs(addr->addr_up.ipv6->sin6_port));
+			g_string_free(ipv6_str, TRUE);
+			return s;
+		}
 #ifdef TCP_FASTOPEN
 		v = 1000;
 		setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, &v, sizeof(v));
@@ -746,6 +804,10 @@ static int do_listen(liServer *srv, liSocketAddress *addr, GString *str) {
 #endif
 #ifdef HAVE_SYS_UN_H
 	case AF_UNIX:
+		if (reuseport || udp) {
+			ERROR(srv, "SO_REUSEPORT/udp not supported for unix socket '%s'", str->str);
+			return -1;
+		}
 		if (-1 == unlink(addr->addr_up.un->sun_path)) {
 			switch (errno) {
 			case ENOENT:
@@ -814,7 +876,7 @@ static void core_listen(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GS
 	}
 
 	if (NULL == (sock = g_hash_table_lookup(config->listen_sockets, &addr))) {
-		fd = do_listen(srv, &addr, data);
+		fd = do_listen(srv, &addr, data, FALSE, FALSE);
 
 		if (-1 == fd) {
 			GString *error = g_string_sized_new(0);
@@ -859,6 +921,136 @@ static void core_listen(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GS
 	}
 }
 
+static void core_listen_reuseport_error(liServer *srv, liInstance *i, gint32 id, GString *error) {
+	GError *err = NULL;
+
+	if (!li_angel_send_result(i->acon, id, error, NULL, NULL, &err)) {
+		ERROR(srv, "Couldn't send result: %s", err->message);
+		g_error_free(err);
+	}
+}
+
+/* data: "<count> <cpu-steering 0/1> <socket address>" */
+static void core_listen_group(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data, gboolean udp) {
+	GError *err = NULL;
+	GArray *fds;
+	plugin_config *config = (plugin_config*) p->data;
+	GHashTable *groups = udp ? config->listen_udp_sockets : config->listen_reuseport_sockets;
+	liSocketAddress addr;
+	listen_socket *sock;
+	guint64 count, steering;
+	gchar *endp;
+	GString *addr_str;
+	guint j;
+
+	if (-1 == id) return; /* ignore simple calls */
+
+	count = g_ascii_strtoull(data->str, &endp, 10);
+	if (' ' != *endp || 0 == count || count > 1024) goto invalid;
+	steering = g_ascii_strtoull(endp + 1, &endp, 10);
+	if (' ' != *endp || steering > 1) goto invalid;
+	addr_str = g_string_new(endp + 1);
+
+	addr = li_sockaddr_from_string(addr_str, 80);
+	if (!addr.addr_up.raw) {
+		GString *error = g_string_sized_new(0);
+		g_string_printf(error, "Invalid socket address: '%s'", addr_str->str);
+		g_string_free(addr_str, TRUE);
+		core_listen_reuseport_error(srv, i, id, error);
+		return;
+	}
+
+	if (!listen_check_acl(srv, config, &addr)) {
+		GString *error = g_string_sized_new(0);
+		li_sockaddr_clear(&addr);
+		g_string_printf(error, "Socket address not allowed: '%s'", addr_str->str);
+		g_string_free(addr_str, TRUE);
+		core_listen_reuseport_error(srv, i, id, error);
+		return;
+	}
+
+	sock = g_hash_table_lookup(groups, &addr);
+	if (NULL != sock && sock->reuseport_fds->len != count) {
+		/* different worker count: bind a new group; the old one gets closed with the old instance */
+		g_hash_table_steal(groups, &sock->addr);
+		sock = NULL;
+	}
+
+	if (NULL == sock) {
+		GArray *group = g_array_sized_new(FALSE, FALSE, sizeof(int), count);
+
+		for (j = 0; j < count; j++) {
+			int fd = do_listen(srv, &addr, addr_str, TRUE, udp);
+
+			if (-1 == fd) {
+				GString *error = g_string_sized_new(0);
+				for (j = 0; j < group->len; j++) close(g_array_index(group, int, j));
+				g_array_free(group, TRUE);
+				li_sockaddr_clear(&addr);
+				g_string_printf(error, "Couldn't listen to '%s'", addr_str->str);
+				g_string_free(addr_str, TRUE);
+				core_listen_reuseport_error(srv, i, id, error);
+				return;
+			}
+
+			li_fd_init(fd);
+			g_array_append_val(group, fd);
+		}
+
+		if (steering && !li_fd_reuseport_cpu_steering(g_array_index(group, int, 0), count)) {
+			WARNING(srv, "Couldn't attach cpu steering program to '%s': %s", addr_str->str, g_strerror(errno));
+		}
+
+		sock = listen_new_socket(&addr, g_array_index(group, int, 0));
+		sock->reuseport_fds = group;
+		sock->udp = udp;
+		g_hash_table_insert(groups, &sock->addr, sock);
+	} else {
+		li_sockaddr_clear(&addr);
+	}
+	g_string_free(addr_str, TRUE);
+
+	listen_socket_add(i, p, sock);
+
+	fds = g_array_sized_new(FALSE, FALSE, sizeof(int), count);
+	for (j = 0; j < sock->reuseport_fds->len; j++) {
+		int fd = dup(g_array_index(sock->reuseport_fds, int, j));
+
+		if (-1 == fd) {
+			/* socket ref will be released when instance is released */
+			GString *error = g_string_sized_new(0);
+			for (j = 0; j < fds->len; j++) close(g_array_index(fds, int, j));
+			g_array_free(fds, TRUE);
+			g_string_printf(error, "Couldn't duplicate fd");
+			core_listen_reuseport_error(srv, i, id, error);
+			return;
+		}
+		g_array_append_val(fds, fd);
+	}
+
+	if (!li_angel_send_result(i->acon, id, NULL, NULL, fds, &err)) {
+		ERROR(srv, "Couldn't send result: %s", err->message);
+		g_error_free(err);
+	}
+	return;
+
+invalid:
+	{
+		GString *error = g_string_sized_new(0);
+		g_string_printf(error, "Invalid reuseport listen request: '%s'", data->str);
+		core_listen_reuseport_error(srv, i, id, error);
+	}
+}
+
+static void core_listen_reuseport(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	core_listen_group(srv, p, i, id, data, FALSE);
+}
+
+/* one SO_REUSEPORT UDP socket per worker (HTTP/3); same request format as listen-reuseport */
+static void core_listen_udp(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
+	core_listen_group(srv, p, i, id, data, TRUE);
+}
+
 static void core_reached_state(liServer *srv, liPlugin *p, liInstance *i, gint32 id, GString *data) {
 	UNUSED(srv);
 	UNUSED(p);
@@ -958,6 +1150,8 @@ static void core_free(liServer *srv, liPlugin *p) {
 	}
 	g_ptr_array_free(config->listen_masks, TRUE);
 	g_hash_table_destroy(config->listen_sockets);
+	g_hash_table_destroy(config->listen_reuseport_sockets);
+	g_hash_table_destroy(config->listen_udp_sockets);
 	config->listen_masks = NULL;
 
 	g_slice_free(plugin_config, config);
@@ -1047,9 +1241,13 @@ static gboolean core_init(liServer *srv, liPlugin *p) {
 
 	core_parse_init(srv, p);
 	config->listen_sockets = g_hash_table_new_full(li_hash_sockaddr, li_equal_sockaddr, NULL, NULL);
+	config->listen_reuseport_sockets = g_hash_table_new_full(li_hash_sockaddr, li_equal_sockaddr, NULL, NULL);
+	config->listen_udp_sockets = g_hash_table_new_full(li_hash_sockaddr, li_equal_sockaddr, NULL, NULL);
 	config->listen_masks = g_ptr_array_new();
 
 	li_angel_plugin_add_angel_cb(p, "listen", core_listen);
+	li_angel_plugin_add_angel_cb(p, "listen-reuseport", core_listen_reuseport);
+	li_angel_plugin_add_angel_cb(p, "listen-udp", core_listen_udp);
 	li_angel_plugin_add_angel_cb(p, "reached-state", core_reached_state);
 	li_angel_plugin_add_angel_cb(p, "log-open-file", core_log_open_file);
 
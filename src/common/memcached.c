@@ -3,6 +3,8 @@
 
 #include <lighttpd/utils.h>
 
+#include <sys/uio.h>
+
 /* IMPORTANT
  * In order to keep _release thread-safe the io watcher keeps a
  * reference too while active; when the last reference is dropped
@@ -19,6 +21,14 @@
  *
  * TODO: retry connect() once (per second?) if we have a request
  *   before we drop all requests
+ *
+ * Requests are pipelined: they are queued (and sent) while earlier
+ * requests are still waiting for their responses, also while the
+ * connect() is still in progress; the send queue is written with
+ * writev() in batches.
+ *
+ * liMemcachedCluster (see below) maps keys to servers with
+ * consistent hashing and keeps a small pool of connections per server.
  */
 
 GQuark li_memcached_error_quark(void) {
@@ -26,10 +36,12 @@ GQuark li_memcached_error_quark(void) {
 }
 
 #define BUFFER_CHUNK_SIZE 4*1024
+/* max send_items per writev() */
+#define SEND_BATCH_SIZE 16
 
 typedef struct int_request int_request;
 typedef enum {
-	REQ_GET, REQ_SET
+	REQ_GET, REQ_SET, REQ_GET_MULTI
 } req_type;
 
 struct liMemcachedCon {
@@ -69,6 +81,10 @@ struct int_request {
 	li_tstamp ttl;
 	liBuffer *data;
 
+	/* REQ_GET_MULTI */
+	GPtrArray *keys; /* GString*, key is NULL */
+	guint next_key; /* first key without result */
+
 	GList iter;
 };
 
@@ -165,6 +181,19 @@ static void send_request(liMemcachedCon *con, int_request *req) {
 		g_string_assign(con->tmpstr, "\r\n");
 		send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
 		break;
+	case REQ_GET_MULTI:
+		{
+			guint i;
+			g_string_assign(con->tmpstr, "get");
+			for (i = 0; i < req->keys->len; i++) {
+				GString *key = g_ptr_array_index(req->keys, i);
+				g_string_append_c(con->tmpstr, ' ');
+				g_string_append_len(con->tmpstr, GSTR_LEN(key));
+			}
+			g_string_append_len(con->tmpstr, CONST_STR_LEN("\r\n"));
+			send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
+		}
+		break;
 	}
 }
 
@@ -201,10 +230,20 @@ static void free_request(liMemcachedCon *con, int_request *req) {
 		li_buffer_release(req->data);
 		req->data = NULL;
 		break;
+	case REQ_GET_MULTI:
+		{
+			guint i;
+			for (i = 0; i < req->keys->len; i++) g_string_free(g_ptr_array_index(req->keys, i), TRUE);
+			g_ptr_array_free(req->keys, TRUE);
+			req->keys = NULL;
+		}
+		break;
 	}
 
-	g_string_free(req->key, TRUE);
-	req->key = NULL;
+	if (NULL != req->key) {
+		g_string_free(req->key, TRUE);
+		req->key = NULL;
+	}
 
 	g_slice_free(int_request, req);
 }
@@ -221,11 +260,26 @@ static void cancel_all_requests(liMemcachedCon *con) {
 	}
 
 	while (NULL != (req = g_queue_peek_head(&con->req_queue))) {
-		if (NULL == err) {
-			err = g_error_copy(err1);
-		}
+		if (REQ_GET_MULTI == req->type) {
+			/* one result for every key */
+			while (req->next_key < req->keys->len) {
+				liMemcachedItem item;
+				memset(&item, 0, sizeof(item));
+				item.key = g_ptr_array_index(req->keys, req->next_key++);
+
+				if (NULL == err) {
+					err = g_error_copy(err1);
+				}
+
+				if (req->req.callback) req->req.callback(&req->req, LI_MEMCACHED_RESULT_ERROR, &item, &err);
+			}
+		} else {
+			if (NULL == err) {
+				err = g_error_copy(err1);
+			}
 
-		if (req->req.callback) req->req.callback(&req->req, LI_MEMCACHED_RESULT_ERROR, NULL, &err);
+			if (req->req.callback) req->req.callback(&req->req, LI_MEMCACHED_RESULT_ERROR, NULL, &err);
+		}
 
 		free_request(con, req);
 
@@ -341,6 +395,11 @@ static void memcached_connect(liMemcachedCon *con) {
 			err = errno;
 		}
 #endif
+		if (0 == err || EINPROGRESS == err || EALREADY == err) {
+			/* still connecting */
+			return;
+		}
+
 		g_clear_error(&con->err);
 		g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Couldn't connect socket to '%s': %s",
 			li_sockaddr_to_string(con->addr, con->tmpstr, TRUE)->str,
@@ -349,6 +408,10 @@ static void memcached_connect(liMemcachedCon *con) {
 		close(s);
 		memcached_stop_io(con);
 		li_event_io_set_fd(&con->con_watcher, -1);
+
+		/* drop requests queued while connecting */
+		send_queue_reset(&con->out);
+		cancel_all_requests(con);
 	} else {
 		/* connect succeeded */
 		con->fd = s;
@@ -576,6 +639,83 @@ static gboolean try_read_data(liMemcachedCon *con, gsize datalen) {
 }
 
 
+/* VALUE <key> <flags> <bytes> [<cas unique>]; closes the connection on errors */
+static gboolean parse_value_header(liMemcachedCon *con) {
+	char *pos, *next;
+
+	/* con->line is 0 terminated */
+
+	if (0 != strncmp("VALUE ", con->line->addr, 6)) {
+		g_clear_error(&con->err);
+		g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: Unexpected response for GET: '%s'", con->line->addr);
+		close_con(con);
+		return FALSE;
+	}
+
+	/* <key> */
+	pos = con->line->addr + 6;
+	next = strchr(pos, ' ');
+	if (NULL == next) goto error;
+
+	con->curitem.key = g_string_new_len(pos, next - pos);
+
+	/* <flags> */
+	pos = next + 1;
+	con->curitem.flags = strtoul(pos, &next, 10);
+	if (' ' != *next || pos == next) goto error;
+
+	/* <bytes> */
+	pos = next + 1;
+	con->get_data_size = g_ascii_strtoll(pos, &next, 10);
+	if (pos == next) goto error;
+
+	/* [<cas unique>] */
+	if (' ' == *next) {
+		pos = next + 1;
+		con->curitem.cas = g_ascii_strtoll(pos, &next, 10);
+		if (pos == next) goto error;
+	}
+
+	if ('\0' != *next) goto error;
+
+	con->line->used = 0;
+
+	return TRUE;
+
+error:
+	g_clear_error(&con->err);
+	g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: Couldn't parse VALUE response: '%s'", con->line->addr);
+	close_con(con);
+	return FALSE;
+}
+
+/* results for the keys up to (excluding) item->key are NOT_FOUND; the values are returned in the order of the keys */
+static gboolean multi_get_result(liMemcachedCon *con, int_request *req, liMemcachedResult result, liMemcachedItem *item) {
+	liMemcachedItem missing;
+
+	memset(&missing, 0, sizeof(missing));
+
+	while (req->next_key < req->keys->len) {
+		missing.key = g_ptr_array_index(req->keys, req->next_key++);
+
+		if (NULL != item && g_string_equal(missing.key, item->key)) {
+			if (req->req.callback) req->req.callback(&req->req, result, item, NULL);
+			return TRUE;
+		}
+
+		if (req->req.callback) req->req.callback(&req->req, LI_MEMCACHED_NOT_FOUND, &missing, NULL);
+	}
+
+	if (NULL != item) {
+		g_clear_error(&con->err);
+		g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: unexpected key '%s' in GET response", item->key->str);
+		close_con(con);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void handle_read(liMemcachedCon *con) {
 	int_request *cur;
 
@@ -597,6 +737,7 @@ static void handle_read(liMemcachedCon *con) {
 		/* init read state */
 		switch (cur->type) {
 		case REQ_GET:
+		case REQ_GET_MULTI:
 			con->get_data_size = 0;
 			con->get_have_header = FALSE;
 			break;
@@ -608,8 +749,6 @@ static void handle_read(liMemcachedCon *con) {
 	switch (cur->type) {
 	case REQ_GET:
 		if (!con->get_have_header) {
-			char *pos, *next;
-
 			/* wait for header line */
 			if (!try_read_line(con)) return;
 
@@ -625,56 +764,7 @@ static void handle_read(liMemcachedCon *con) {
 				return;
 			}
 
-			/* con->line is 0 terminated */
-
-			if (0 != strncmp("VALUE ", con->line->addr, 6)) {
-				g_clear_error(&con->err);
-				g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: Unexpected response for GET: '%s'", con->line->addr);
-				close_con(con);
-				return;
-			}
-
-			/* VALUE <key> <flags> <bytes> [<cas unique>]\r\n */
-
-			/* <key> */
-			pos = con->line->addr + 6;
-			next = strchr(pos, ' ');
-			if (NULL == next) goto req_get_header_error;
-
-			con->curitem.key = g_string_new_len(pos, next - pos);
-
-			/* <flags> */
-			pos = next + 1;
-			con->curitem.flags = strtoul(pos, &next, 10);
-			if (' ' != *next || pos == next) goto req_get_header_error;
-
-			/* <bytes> */
-			pos = next + 1;
-			con->get_data_size = g_ascii_strtoll(pos, &next, 10);
-			if (pos == next) goto req_get_header_error;
-
-			/* [<cas unique>] */
-			if (' ' == *next) {
-				pos = next + 1;
-				con->curitem.cas = g_ascii_strtoll(pos, &next, 10);
-				if (pos == next) goto req_get_header_error;
-			}
-
-			if ('\0' != *next) {
-				goto req_get_header_error;
-			}
-
-			con->line->used = 0;
-
-			goto req_get_header_done;
-
-req_get_header_error:
-			g_clear_error(&con->err);
-			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: Couldn't parse VALUE response: '%s'", con->line->addr);
-			close_con(con);
-			return;
-
-req_get_header_done: ;
+			if (!parse_value_header(con)) return;
 		}
 		if (NULL == con->data || con->data->used < con->get_data_size) {
 			/* wait for data */
@@ -702,6 +792,37 @@ req_get_header_done: ;
 		free_request(con, cur);
 		return;
 
+	case REQ_GET_MULTI:
+		for (;;) {
+			if (!con->get_have_header) {
+				/* wait for VALUE or END line */
+				if (!try_read_line(con)) return;
+
+				if (3 == con->line->used && 0 == memcmp("END", con->line->addr, 3)) {
+					/* remaining keys not found */
+					multi_get_result(con, cur, LI_MEMCACHED_NOT_FOUND, NULL);
+					con->cur_req = NULL;
+					free_request(con, cur);
+					return;
+				}
+
+				if (!parse_value_header(con)) return;
+				con->get_have_header = TRUE;
+			}
+
+			/* wait for data */
+			if (!try_read_data(con, con->get_data_size)) return;
+
+			/* Move data to item */
+			con->curitem.data = con->data;
+			con->data = NULL;
+			if (!multi_get_result(con, cur, LI_MEMCACHED_OK, &con->curitem)) return;
+			reset_item(&con->curitem);
+
+			con->get_have_header = FALSE;
+			con->get_data_size = 0;
+		}
+
 	case REQ_SET:
 		if (!try_read_line(con)) return;
 
@@ -730,25 +851,30 @@ static void memcached_io_cb(liEventBase *watcher, int events) {
 		return;
 	}
 
+	li_memcached_con_acquire(con); /* make sure con isn't freed in the middle of something */
+
 	if (-1 == con->fd) {
 		memcached_connect(con);
+		li_memcached_con_release(con);
 		return;
 	}
 
-	li_memcached_con_acquire(con); /* make sure con isn't freed in the middle of something */
-
 	if (events & LI_EV_WRITE) {
-		int i;
-		ssize_t written, len;
-		gchar *data;
+		int i, rounds;
+		ssize_t written;
 		send_item *si;
+		GList *l;
+		struct iovec iov[SEND_BATCH_SIZE];
+
+		for (rounds = 0; rounds < 10 && NULL != con->out.head; rounds++) { /* don't send too much at once */
+			/* batch: all pipelined requests in one syscall */
+			for (i = 0, l = con->out.head; NULL != l && i < SEND_BATCH_SIZE; l = l->next, i++) {
+				si = l->data;
+				iov[i].iov_base = si->buf->addr + si->pos;
+				iov[i].iov_len = si->len;
+			}
 
-		si = g_queue_peek_head(&con->out);
-
-		for (i = 0; si && (i < 10); i++) { /* don't send more than 10 chunks */
-			data = si->buf->addr + si->pos;
-			len = si->len;
-			written = write(li_event_io_fd(&con->con_watcher), data, len);
+			written = writev(li_event_io_fd(&con->con_watcher), iov, i);
 			if (written < 0) {
 				switch (errno) {
 				case EINTR:
@@ -766,14 +892,18 @@ static void memcached_io_cb(liEventBase *watcher, int events) {
 					close_con(con);
 					goto out;
 				}
-			} else {
-				si->pos += written;
-				si->len -= written;
-				if (0 == si->len) {
-					send_queue_item_free(si);
-					g_queue_pop_head(&con->out);
-					si = g_queue_peek_head(&con->out);
+			}
+
+			while (written > 0) {
+				si = g_queue_peek_head(&con->out);
+				if ((gsize) written < si->len) {
+					si->pos += written;
+					si->len -= written;
+					goto write_eagain; /* short write */
 				}
+				written -= si->len;
+				send_queue_item_free(si);
+				g_queue_pop_head(&con->out);
 			}
 		}
 
@@ -849,24 +979,30 @@ void li_memcached_con_acquire(liMemcachedCon* con) {
 }
 
 
-liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
-	int_request* req;
-
-	if (!li_memcached_is_key_valid(key)) {
-		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
-		return NULL;
-	}
-
+/* requests are accepted while connected or connecting */
+static gboolean memcached_check_con(liMemcachedCon *con, GError **err) {
 	if (-1 == con->fd) memcached_connect(con);
-	if (-1 == con->fd) {
+	if (-1 == con->fd && -1 == li_event_io_fd(&con->con_watcher)) {
 		if (NULL == con->err) {
 			g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_DISABLED, "Not connected");
 		} else if (err) {
 			*err = g_error_copy(con->err);
 		}
+		return FALSE;
+	}
+	return TRUE;
+}
+
+liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	int_request* req;
+
+	if (!li_memcached_is_key_valid(key)) {
+		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
 		return NULL;
 	}
 
+	if (!memcached_check_con(con, err)) return NULL;
+
 	req = g_slice_new0(int_request);
 	req->req.callback = callback;
 	req->req.cb_data = cb_data;
@@ -890,15 +1026,7 @@ liMemcachedRequest* li_memcached_set(liMemcachedCon *con, GString *key, guint32
 		return NULL;
 	}
 
-	if (-1 == con->fd) memcached_connect(con);
-	if (-1 == con->fd) {
-		if (NULL == con->err) {
-			g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_DISABLED, "Not connected");
-		} else if (err) {
-			*err = g_error_copy(con->err);
-		}
-		return NULL;
-	}
+	if (!memcached_check_con(con, err)) return NULL;
 
 	req = g_slice_new0(int_request);
 	req->req.callback = callback;
@@ -921,6 +1049,42 @@ liMemcachedRequest* li_memcached_set(liMemcachedCon *con, GString *key, guint32
 	return &req->req;
 }
 
+liMemcachedRequest* li_memcached_get_multi(liMemcachedCon *con, GString * const *keys, guint count, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	int_request* req;
+	guint i;
+
+	if (0 == count || count > LI_MEMCACHED_MAX_MULTI_KEYS) {
+		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid number of keys: %u", count);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!li_memcached_is_key_valid(keys[i])) {
+			g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", keys[i]->str);
+			return NULL;
+		}
+	}
+
+	if (!memcached_check_con(con, err)) return NULL;
+
+	req = g_slice_new0(int_request);
+	req->req.callback = callback;
+	req->req.cb_data = cb_data;
+
+	req->type = REQ_GET_MULTI;
+	req->keys = g_ptr_array_sized_new(count);
+	for (i = 0; i < count; i++) {
+		g_ptr_array_add(req->keys, g_string_new_len(GSTR_LEN(keys[i])));
+	}
+
+	if (!push_request(con, req, err)) {
+		free_request(con, req);
+		return NULL;
+	}
+
+	return &req->req;
+}
+
 /* if length(key) <= 250 and all chars x: 0x20 < x < 0x7f the key
  * remains untouched; otherwise it gets replaced with its sha1hex hash
  * so in most cases the key stays readable, and we have a good fallback
@@ -950,3 +1114,492 @@ gboolean li_memcached_is_key_valid(GString *key) {
 
 	return TRUE;
 }
+
+/* cluster */
+
+/* virtual nodes per server on the hash ring */
+#define CLUSTER_RING_POINTS 160
+/* retry failed servers after 1, 2, 4, ... seconds */
+#define CLUSTER_MAX_BACKOFF 60
+
+typedef struct cluster_server cluster_server;
+typedef struct cluster_ring_point cluster_ring_point;
+
+struct cluster_server {
+	liSocketAddress addr;
+	liMemcachedCon **cons; /* pool, created on demand */
+
+	guint failures; /* consecutive */
+	li_tstamp retry_at;
+};
+
+struct cluster_ring_point {
+	guint32 point;
+	guint ndx; /* server */
+};
+
+struct liMemcachedCluster {
+	liEventLoop *loop;
+
+	cluster_server *servers;
+	guint server_count, pool_size;
+
+	GArray *ring; /* cluster_ring_point entries sorted by point */
+
+	/* pending requests; detached on free */
+	GQueue requests; /* cluster_request */
+	GQueue multi_requests; /* cluster_multi_request */
+};
+
+/* wraps a get/set, so it can be sent to the next server if the connection fails after it was queued */
+typedef struct cluster_request cluster_request;
+struct cluster_request {
+	liMemcachedRequest req; /* returned to the caller */
+	liMemcachedCluster *cluster; /* NULL after li_memcached_cluster_free */
+	GList link; /* in cluster->requests */
+
+	gboolean is_set;
+	GString *key;
+	guint32 flags;
+	li_tstamp ttl;
+	liBuffer *data;
+
+	cluster_server *server; /* of the current attempt */
+	guint attempts;
+};
+
+/* one multi-get sent to a server; keys failing with a connection error are retried as single gets */
+typedef struct cluster_multi_request cluster_multi_request;
+struct cluster_multi_request {
+	liMemcachedCluster *cluster; /* NULL after li_memcached_cluster_free */
+	GList link; /* in cluster->multi_requests */
+
+	liMemcachedCB callback;
+	gpointer cb_data;
+
+	cluster_server *server;
+	guint pending; /* keys without result */
+};
+
+/* FNV-1a with the murmur3 finalizer */
+static guint32 cluster_hash(const gchar *s, gsize len) {
+	guint32 h = 2166136261u;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (guchar) s[i];
+		h *= 16777619u;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static gint cluster_ring_point_cmp(gconstpointer a, gconstpointer b) {
+	const cluster_ring_point *pa = a, *pb = b;
+	if (pa->point != pb->point) return pa->point < pb->point ? -1 : 1;
+	return (gint) pa->ndx - (gint) pb->ndx;
+}
+
+liMemcachedCluster* li_memcached_cluster_new(liEventLoop *loop, const liSocketAddress *addrs, guint count, guint pool_size) {
+	liMemcachedCluster *cluster;
+	GString *tmp;
+	guint i, j;
+
+	LI_FORCE_ASSERT(count > 0);
+
+	cluster = g_slice_new0(liMemcachedCluster);
+	cluster->loop = loop;
+	cluster->server_count = count;
+	cluster->pool_size = MAX(pool_size, 1);
+	cluster->servers = g_new0(cluster_server, count);
+	cluster->ring = g_array_sized_new(FALSE, FALSE, sizeof(cluster_ring_point), count * CLUSTER_RING_POINTS);
+
+	tmp = g_string_sized_new(63);
+	for (i = 0; i < count; i++) {
+		GString *name;
+		cluster_server *s = &cluster->servers[i];
+		s->addr = li_sockaddr_dup(addrs[i]);
+		s->cons = g_new0(liMemcachedCon*, cluster->pool_size);
+
+		/* the points only depend on the server address, so adding or removing a server
+		 * only moves the keys of its points, independent of the order in the config */
+		name = li_sockaddr_to_string(s->addr, NULL, TRUE);
+		for (j = 0; j < CLUSTER_RING_POINTS; j++) {
+			cluster_ring_point rp;
+			g_string_printf(tmp, "%s-%u", name->str, j);
+			rp.point = cluster_hash(GSTR_LEN(tmp));
+			rp.ndx = i;
+			g_array_append_val(cluster->ring, rp);
+		}
+		g_string_free(name, TRUE);
+	}
+	g_string_free(tmp, TRUE);
+	g_array_sort(cluster->ring, cluster_ring_point_cmp);
+
+	return cluster;
+}
+
+void li_memcached_cluster_free(liMemcachedCluster *cluster) {
+	guint i, j;
+	GList *l;
+
+	if (NULL == cluster) return;
+
+	/* pending requests still get their results, but aren't retried anymore */
+	while (NULL != (l = g_queue_pop_head_link(&cluster->requests))) {
+		((cluster_request*) l->data)->cluster = NULL;
+	}
+	while (NULL != (l = g_queue_pop_head_link(&cluster->multi_requests))) {
+		((cluster_multi_request*) l->data)->cluster = NULL;
+	}
+
+	for (i = 0; i < cluster->server_count; i++) {
+		cluster_server *s = &cluster->servers[i];
+		for (j = 0; j < cluster->pool_size; j++) {
+			li_memcached_con_release(s->cons[j]);
+		}
+		g_free(s->cons);
+		li_sockaddr_clear(&s->addr);
+	}
+	g_free(cluster->servers);
+	g_array_free(cluster->ring, TRUE);
+
+	g_slice_free(liMemcachedCluster, cluster);
+}
+
+/* index of the first server on the ring for key which isn't skipped; the owner of the key if all are */
+static guint cluster_ring_lookup(liMemcachedCluster *cluster, GString *key, gboolean (*skip)(liMemcachedCluster *cluster, guint ndx, gconstpointer data), gconstpointer data) {
+	guint32 h = cluster_hash(GSTR_LEN(key));
+	guint lo = 0, hi = cluster->ring->len, i;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		if (g_array_index(cluster->ring, cluster_ring_point, mid).point < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (i = 0; i < cluster->ring->len; i++) {
+		guint ndx = g_array_index(cluster->ring, cluster_ring_point, (lo + i) % cluster->ring->len).ndx;
+		if (NULL == skip || !skip(cluster, ndx, data)) return ndx;
+	}
+
+	return g_array_index(cluster->ring, cluster_ring_point, lo % cluster->ring->len).ndx;
+}
+
+static gboolean cluster_skip_down(liMemcachedCluster *cluster, guint ndx, gconstpointer data) {
+	const gboolean *down = data;
+	UNUSED(cluster);
+	return down[ndx];
+}
+
+guint li_memcached_cluster_lookup(liMemcachedCluster *cluster, GString *key, const gboolean *down) {
+	return cluster_ring_lookup(cluster, key, NULL != down ? cluster_skip_down : NULL, down);
+}
+
+static gboolean cluster_skip_backoff(liMemcachedCluster *cluster, guint ndx, gconstpointer data) {
+	const li_tstamp *now = data;
+	return *now < cluster->servers[ndx].retry_at;
+}
+
+/* first server on the ring for key which isn't waiting for a retry; the owner of the key if all are */
+static cluster_server* cluster_server_for_key(liMemcachedCluster *cluster, GString *key) {
+	li_tstamp now = li_event_now(cluster->loop);
+	return &cluster->servers[cluster_ring_lookup(cluster, key, cluster_skip_backoff, &now)];
+}
+
+/* the connection with the fewest pending requests; another connection is only opened if all are busy */
+static liMemcachedCon* cluster_server_con(liMemcachedCluster *cluster, cluster_server *s) {
+	liMemcachedCon *best = NULL;
+	guint i;
+
+	for (i = 0; i < cluster->pool_size; i++) {
+		liMemcachedCon *con = s->cons[i];
+
+		if (NULL == con) {
+			if (NULL == best || best->req_queue.length > 0) {
+				best = s->cons[i] = li_memcached_con_new(cluster->loop, s->addr);
+			}
+			break;
+		}
+
+		if (NULL == best || con->req_queue.length < best->req_queue.length) best = con;
+		if (0 == best->req_queue.length) break;
+	}
+
+	return best;
+}
+
+/* returns TRUE (and skips the server for a while) if err is a connect or io error */
+static gboolean cluster_server_failed(liMemcachedCluster *cluster, cluster_server *s, GError *err) {
+	li_tstamp now = li_event_now(cluster->loop);
+
+	if (NULL == err || LI_MEMCACHED_ERROR != err->domain
+			|| (LI_MEMCACHED_CONNECTION != err->code && LI_MEMCACHED_DISABLED != err->code)) {
+		return FALSE;
+	}
+
+	/* all requests queued on a connection fail together: count that as one failure */
+	if (now >= s->retry_at) {
+		s->retry_at = now + MIN(1u << MIN(s->failures, 6u), CLUSTER_MAX_BACKOFF);
+		s->failures++;
+	}
+	return TRUE;
+}
+
+/* only reset the backoff once a server actually answered */
+static void cluster_server_answered(cluster_server *s) {
+	s->failures = 0;
+	s->retry_at = 0;
+}
+
+static void cluster_request_free(cluster_request *creq) {
+	if (NULL != creq->cluster) g_queue_unlink(&creq->cluster->requests, &creq->link);
+	g_string_free(creq->key, TRUE);
+	li_buffer_release(creq->data);
+	g_slice_free(cluster_request, creq);
+}
+
+static void cluster_request_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err);
+
+/* sends creq to the first usable server for its key; tries the next server on synchronous connection errors */
+static gboolean cluster_request_dispatch(cluster_request *creq, GError **err) {
+	liMemcachedCluster *cluster = creq->cluster;
+	GError *last_err = NULL;
+
+	while (creq->attempts < cluster->server_count) {
+		cluster_server *s = cluster_server_for_key(cluster, creq->key);
+		liMemcachedCon *con = cluster_server_con(cluster, s);
+		liMemcachedRequest *req;
+
+		creq->attempts++;
+		creq->server = s;
+
+		g_clear_error(&last_err);
+		if (creq->is_set) {
+			req = li_memcached_set(con, creq->key, creq->flags, creq->ttl, creq->data, cluster_request_cb, creq, &last_err);
+		} else {
+			req = li_memcached_get(con, creq->key, cluster_request_cb, creq, &last_err);
+		}
+		if (NULL != req) return TRUE;
+		if (!cluster_server_failed(cluster, s, last_err)) break;
+	}
+
+	g_propagate_error(err, last_err);
+	return FALSE;
+}
+
+static void cluster_request_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
+	cluster_request *creq = request->cb_data;
+	liMemcachedCluster *cluster = creq->cluster;
+
+	if (NULL != cluster) {
+		if (LI_MEMCACHED_RESULT_ERROR != result) {
+			cluster_server_answered(creq->server);
+		} else if (NULL != err && cluster_server_failed(cluster, creq->server, *err)
+				&& (creq->is_set || NULL != creq->req.callback) /* nobody waits for a cancelled get */
+				&& cluster_server_for_key(cluster, creq->key) != creq->server) {
+			/* the connection failed before we got an answer: the next server on the ring takes over */
+			GError *retry_err = NULL;
+
+			if (cluster_request_dispatch(creq, &retry_err)) return;
+
+			if (NULL != retry_err) {
+				g_clear_error(err);
+				*err = retry_err;
+			}
+		}
+	}
+
+	if (NULL != creq->req.callback) creq->req.callback(&creq->req, result, item, err);
+	cluster_request_free(creq);
+}
+
+static liMemcachedRequest* cluster_request_start(liMemcachedCluster *cluster, cluster_request *creq, GError **err) {
+	creq->cluster = cluster;
+	creq->link.data = creq;
+	g_queue_push_tail_link(&cluster->requests, &creq->link);
+
+	if (!cluster_request_dispatch(creq, err)) {
+		cluster_request_free(creq);
+		return NULL;
+	}
+
+	return &creq->req;
+}
+
+liMemcachedRequest* li_memcached_cluster_get(liMemcachedCluster *cluster, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	cluster_request *creq;
+
+	if (!li_memcached_is_key_valid(key)) {
+		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
+		return NULL;
+	}
+
+	creq = g_slice_new0(cluster_request);
+	creq->req.callback = callback;
+	creq->req.cb_data = cb_data;
+	creq->key = g_string_new_len(GSTR_LEN(key));
+
+	return cluster_request_start(cluster, creq, err);
+}
+
+liMemcachedRequest* li_memcached_cluster_set(liMemcachedCluster *cluster, GString *key, guint32 flags, li_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	cluster_request *creq;
+
+	if (!li_memcached_is_key_valid(key)) {
+		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
+		return NULL;
+	}
+
+	creq = g_slice_new0(cluster_request);
+	creq->req.callback = callback;
+	creq->req.cb_data = cb_data;
+	creq->is_set = TRUE;
+	creq->key = g_string_new_len(GSTR_LEN(key));
+	creq->flags = flags;
+	creq->ttl = ttl;
+	if (NULL != data) li_buffer_acquire(data);
+	creq->data = data;
+
+	return cluster_request_start(cluster, creq, err);
+}
+
+static void cluster_multi_request_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
+	cluster_multi_request *mreq = request->cb_data;
+	liMemcachedCluster *cluster = mreq->cluster;
+	liMemcachedRequest req;
+
+	req.callback = mreq->callback;
+	req.cb_data = mreq->cb_data;
+
+	if (NULL != cluster) {
+		if (LI_MEMCACHED_RESULT_ERROR != result) {
+			cluster_server_answered(mreq->server);
+		} else if (NULL != err && cluster_server_failed(cluster, mreq->server, *err)
+				&& cluster_server_for_key(cluster, item->key) != mreq->server) {
+			/* retry the key alone on the next server; it has its own result callback then */
+			cluster_request *creq = g_slice_new0(cluster_request);
+			GError *retry_err = NULL;
+
+			creq->req.callback = mreq->callback;
+			creq->req.cb_data = mreq->cb_data;
+			creq->key = g_string_new_len(GSTR_LEN(item->key));
+			creq->attempts = 1;
+
+			if (NULL != cluster_request_start(cluster, creq, &retry_err)) goto done;
+
+			if (NULL != retry_err) {
+				g_clear_error(err);
+				*err = retry_err;
+			}
+		}
+	}
+
+	if (NULL != req.callback) req.callback(&req, result, item, err);
+
+done:
+	if (0 == --mreq->pending) {
+		if (NULL != cluster) g_queue_unlink(&cluster->multi_requests, &mreq->link);
+		g_slice_free(cluster_multi_request, mreq);
+	}
+}
+
+/* "exactly one result per key", also for keys which couldn't be sent */
+static void cluster_multi_error(GPtrArray *keys, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	liMemcachedRequest req;
+	guint i;
+
+	if (NULL == callback) return;
+
+	req.callback = callback;
+	req.cb_data = cb_data;
+
+	for (i = 0; i < keys->len; i++) {
+		liMemcachedItem item;
+		memset(&item, 0, sizeof(item));
+		item.key = g_ptr_array_index(keys, i);
+		if (NULL == *err) g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "No memcached server available");
+		callback(&req, LI_MEMCACHED_RESULT_ERROR, &item, err);
+	}
+}
+
+gboolean li_memcached_cluster_get_multi(liMemcachedCluster *cluster, GString * const *keys, guint count, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	GPtrArray *pending, *retry, *batch, *tmp;
+	guint i, attempt;
+	GError *last_err = NULL;
+
+	for (i = 0; i < count; i++) {
+		if (!li_memcached_is_key_valid(keys[i])) {
+			g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", keys[i]->str);
+			return FALSE;
+		}
+	}
+
+	pending = g_ptr_array_sized_new(count);
+	retry = g_ptr_array_new();
+	batch = g_ptr_array_new();
+	for (i = 0; i < count; i++) g_ptr_array_add(pending, keys[i]);
+
+	for (attempt = 0; attempt < cluster->server_count && pending->len > 0; attempt++) {
+		while (pending->len > 0) {
+			/* one request for the keys on the server of the first pending key */
+			cluster_server *s = cluster_server_for_key(cluster, g_ptr_array_index(pending, 0));
+			cluster_multi_request *mreq;
+			liMemcachedCon *con;
+			liMemcachedRequest *req;
+
+			g_ptr_array_set_size(batch, 0);
+			for (i = 0; i < pending->len && batch->len < LI_MEMCACHED_MAX_MULTI_KEYS; ) {
+				if (cluster_server_for_key(cluster, g_ptr_array_index(pending, i)) == s) {
+					g_ptr_array_add(batch, g_ptr_array_remove_index(pending, i));
+				} else {
+					i++;
+				}
+			}
+
+			con = cluster_server_con(cluster, s);
+			mreq = g_slice_new0(cluster_multi_request);
+			mreq->cluster = cluster;
+			mreq->link.data = mreq;
+			mreq->callback = callback;
+			mreq->cb_data = cb_data;
+			mreq->server = s;
+			mreq->pending = batch->len;
+
+			g_clear_error(&last_err);
+			req = li_memcached_get_multi(con, (GString * const *) batch->pdata, batch->len, cluster_multi_request_cb, mreq, &last_err);
+
+			if (NULL != req) {
+				g_queue_push_tail_link(&cluster->multi_requests, &mreq->link);
+				continue;
+			}
+			g_slice_free(cluster_multi_request, mreq);
+
+			if (cluster_server_failed(cluster, s, last_err)) {
+				/* s is skipped now, the keys map to other servers in the next attempt */
+				for (i = 0; i < batch->len; i++) g_ptr_array_add(retry, g_ptr_array_index(batch, i));
+			} else {
+				cluster_multi_error(batch, callback, cb_data, &last_err);
+			}
+		}
+
+		tmp = pending; pending = retry; retry = tmp;
+	}
+
+	cluster_multi_error(pending, callback, cb_data, &last_err);
+
+	g_clear_error(&last_err);
+	g_ptr_array_free(pending, TRUE);
+	g_ptr_array_free(retry, TRUE);
+	g_ptr_array_free(batch, TRUE);
+
+	return TRUE;
+}
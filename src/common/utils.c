@@ -9,6 +9,10 @@
 # include <crypt.h>
 #endif
 
+#ifdef LIGHTY_OS_LINUX
+# include <linux/filter.h>
+#endif
+
 /* for send/li_receive_fd */
 union fdmsg {
   struct cmsghdr h;
@@ -124,6 +128,34 @@ void li_fd_init(int fd) {
 	li_fd_no_block(fd);
 }
 
+gboolean li_fd_reuseport_cpu_steering(int fd, guint count) {
+#if defined(LIGHTY_OS_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	/* A = current cpu; A = A % count; return A */
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, 0 },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	if (0 == count) {
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	code[1].k = count;
+	prog.len = G_N_ELEMENTS(code);
+	prog.filter = code;
+
+	return 0 == setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#else
+	UNUSED(fd);
+	UNUSED(count);
+	errno = ENOSYS;
+	return FALSE;
+#endif
+}
+
 #if 0
 #ifndef _WIN32
 int li_send_fd(int s, int fd) { /* write fd to unix socket s */
@@ -112,6 +112,143 @@ void li_angel_listen(liServer *srv, GString *str, liAngelListenCB cb, gpointer d
 	}
 }
 
+static void li_angel_listen_reuseport_cb(gpointer pctx, gboolean timeout, GString *error, GString *data, GArray *fds) {
+	liServer *srv = pctx;
+	guint i;
+	UNUSED(data);
+
+	if (timeout) {
+		ERROR(srv, "listen failed: %s", "time out");
+		return;
+	}
+
+	if (error->len > 0) {
+		ERROR(srv, "listen failed: %s", error->str);
+		return;
+	}
+
+	if (fds && fds->len > 0) {
+		for (i = 0; i < fds->len; i++) {
+			int fd = g_array_index(fds, int, i);
+			liWorker *wrk = g_array_index(srv->workers, liWorker*, i % srv->worker_count);
+			li_server_listen_worker(srv, wrk, fd);
+		}
+		g_array_set_size(fds, 0);
+	} else {
+		ERROR(srv, "listen failed: %s", "received no filedescriptors");
+	}
+}
+
+void li_angel_listen_reuseport(liServer *srv, GString *str, gboolean cpu_steering) {
+	if (srv->acon) {
+		liAngelCall *acall = li_angel_call_new(&srv->main_worker->loop, li_angel_listen_reuseport_cb, 20.0);
+		GString *data = g_string_sized_new(str->len + 16);
+		GError *err = NULL;
+
+		g_string_printf(data, "%u %u %s", srv->worker_count, cpu_steering ? 1 : 0, str->str);
+		acall->context = srv;
+		if (!li_angel_send_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("listen-reuseport"), acall, data, &err)) {
+			ERROR(srv, "couldn't send call: %s", err->message);
+			g_error_free(err);
+		}
+	} else {
+		guint i;
+		int first_fd = -1;
+
+		for (i = 0; i < srv->worker_count; i++) {
+			liWorker *wrk = g_array_index(srv->workers, liWorker*, i);
+			int fd = li_angel_fake_listen_reuseport(srv, str);
+			if (-1 == fd) {
+				ERROR(srv, "listen('%s') failed", str->str);
+				return;
+			}
+			if (-1 == first_fd) first_fd = fd;
+			li_server_listen_worker(srv, wrk, fd);
+		}
+
+		if (cpu_steering && !li_fd_reuseport_cpu_steering(first_fd, srv->worker_count)) {
+			WARNING(srv, "Couldn't attach cpu steering program to '%s': %s", str->str, g_strerror(errno));
+		}
+	}
+}
+
+typedef struct angel_listen_udp_cb_ctx angel_listen_udp_cb_ctx;
+struct angel_listen_udp_cb_ctx {
+	liServer *srv;
+	liAngelListenUdpCB cb;
+	gpointer data;
+};
+
+static void li_angel_listen_udp_cb(gpointer pctx, gboolean timeout, GString *error, GString *data, GArray *fds) {
+	angel_listen_udp_cb_ctx ctx = * (angel_listen_udp_cb_ctx*) pctx;
+	liServer *srv = ctx.srv;
+	UNUSED(data);
+
+	g_slice_free(angel_listen_udp_cb_ctx, pctx);
+
+	if (timeout) {
+		ERROR(srv, "listen failed: %s", "time out");
+		ctx.cb(srv, NULL, ctx.data);
+		return;
+	}
+
+	if (error->len > 0) {
+		ERROR(srv, "listen failed: %s", error->str);
+		ctx.cb(srv, NULL, ctx.data);
+		return;
+	}
+
+	if (NULL == fds || fds->len != srv->worker_count) {
+		ERROR(srv, "listen failed: %s", "received wrong number of filedescriptors");
+		ctx.cb(srv, NULL, ctx.data);
+		return;
+	}
+
+	ctx.cb(srv, fds, ctx.data);
+}
+
+void li_angel_listen_udp(liServer *srv, GString *str, liAngelListenUdpCB cb, gpointer data) {
+	if (srv->acon) {
+		liAngelCall *acall = li_angel_call_new(&srv->main_worker->loop, li_angel_listen_udp_cb, 20.0);
+		angel_listen_udp_cb_ctx *ctx = g_slice_new0(angel_listen_udp_cb_ctx);
+		GString *call_data = g_string_sized_new(str->len + 16);
+		GError *err = NULL;
+
+		ctx->srv = srv;
+		ctx->cb = cb;
+		ctx->data = data;
+		acall->context = ctx;
+
+		g_string_printf(call_data, "%u 0 %s", srv->worker_count, str->str);
+		if (!li_angel_send_call(srv->acon, CONST_STR_LEN("core"), CONST_STR_LEN("listen-udp"), acall, call_data, &err)) {
+			ERROR(srv, "couldn't send call: %s", err->message);
+			g_error_free(err);
+			li_angel_call_free(acall);
+			g_slice_free(angel_listen_udp_cb_ctx, ctx);
+			cb(srv, NULL, data);
+		}
+	} else {
+		GArray *fds = g_array_sized_new(FALSE, FALSE, sizeof(int), srv->worker_count);
+		guint i;
+
+		for (i = 0; i < srv->worker_count; i++) {
+			int fd = li_angel_fake_listen_udp(srv, str);
+			if (-1 == fd) {
+				ERROR(srv, "listen('%s') failed", str->str);
+				for (i = 0; i < fds->len; i++) close(g_array_index(fds, int, i));
+				g_array_free(fds, TRUE);
+				cb(srv, NULL, data);
+				return;
+			}
+			g_array_append_val(fds, fd);
+		}
+
+		cb(srv, fds, data);
+		for (i = 0; i < fds->len; i++) close(g_array_index(fds, int, i));
+		g_array_free(fds, TRUE);
+	}
+}
+
 /* send log messages while startup to angel */
 void li_angel_log(liServer *srv, GString *str) {
 	li_angel_fake_log(srv, str);
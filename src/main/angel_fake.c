@@ -5,8 +5,7 @@
 
 #include <fcntl.h>
 
-/* listen to a socket */
-int li_angel_fake_listen(liServer *srv, GString *str) {
+static int angel_fake_listen(liServer *srv, GString *str, gboolean reuseport, gboolean udp) {
 	liSocketAddress addr = li_sockaddr_from_string(str, 80);
 	liSockAddrPtr saddr_up = addr.addr_up;
 	GString *tmpstr;
@@ -22,6 +21,10 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 	switch (saddr_up.plain->sa_family) {
 #ifdef HAVE_SYS_UN_H
 	case AF_UNIX:
+		if (reuseport || udp) {
+			ERROR(srv, "SO_REUSEPORT/udp not supported for unix socket '%s'", tmpstr->str);
+			goto error;
+		}
 		if (-1 == unlink(saddr_up.un->sun_path)) {
 			switch (errno) {
 			case ENOENT:
@@ -52,7 +55,7 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 #ifdef HAVE_IPV6
 	case AF_INET6:
 #endif
-		if (-1 == (s = socket(saddr_up.plain->sa_family, SOCK_STREAM, 0))) {
+		if (-1 == (s = socket(saddr_up.plain->sa_family, udp ? SOCK_DGRAM : SOCK_STREAM, 0))) {
 			ERROR(srv, "Couldn't open socket: %s", g_strerror(errno));
 			goto error;
 		}
@@ -62,6 +65,19 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 			close(s);
 			goto error;
 		}
+#ifdef SO_REUSEPORT
+		if (reuseport && -1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v))) {
+			ERROR(srv, "Couldn't setsockopt(SO_REUSEPORT): %s", g_strerror(errno));
+			close(s);
+			goto error;
+		}
+#else
+		if (reuseport) {
+			ERROR(srv, "SO_REUSEPORT not supported on this platform, can't listen on '%s'", tmpstr->str);
+			close(s);
+			goto error;
+		}
+#endif
 #ifdef HAVE_IPV6
 		if (AF_INET6 == saddr_up.plain->sa_family && -1 == setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &v, sizeof(v))) {
 			ERROR(srv, "Couldn't setsockopt(IPV6_V6ONLY): %s", g_strerror(errno));
@@ -74,6 +90,10 @@ int li_angel_fake_listen(liServer *srv, GString *str) {
 			close(s);
 			goto error;
 		}
+		if (udp) {
+			DEBUG(srv, "listen to udp: '%s'", tmpstr->str);
+			break;
+		}
 #ifdef TCP_FASTOPEN
 		v = 1000;
 		setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, &v, sizeof(v));
@@ -107,6 +127,21 @@ error:
 	return -1;
 }
 
+/* listen to a socket */
+int li_angel_fake_listen(liServer *srv, GString *str) {
+	return angel_fake_listen(srv, str, FALSE, FALSE);
+}
+
+/* listen to a socket with SO_REUSEPORT; can be called multiple times for the same address */
+int li_angel_fake_listen_reuseport(liServer *srv, GString *str) {
+	return angel_fake_listen(srv, str, TRUE, FALSE);
+}
+
+/* bind a SO_REUSEPORT UDP socket; can be called multiple times for the same address */
+int li_angel_fake_listen_udp(liServer *srv, GString *str) {
+	return angel_fake_listen(srv, str, TRUE, TRUE);
+}
+
 /* print log messages during startup to stderr */
 gboolean li_angel_fake_log(liServer *srv, GString *str) {
 	const char *buf;
@@ -0,0 +1,89 @@
+#include <lighttpd/base.h>
+
+struct liBackendHealth {
+	GMutex *lock;
+	GQueue entries;
+};
+
+static void backend_health_entry_free(liBackendHealthEntry *entry) {
+	g_string_free(entry->name, TRUE);
+	g_string_free(entry->last_error, TRUE);
+	g_slice_free(liBackendHealthEntry, entry);
+}
+
+liBackendHealth* li_backend_health_new(void) {
+	liBackendHealth *bh = g_slice_new0(liBackendHealth);
+
+	bh->lock = g_mutex_new();
+	g_queue_init(&bh->entries);
+
+	return bh;
+}
+
+void li_backend_health_free(liBackendHealth *bh) {
+	liBackendHealthEntry *entry;
+
+	if (NULL == bh) return;
+
+	while (NULL != (entry = g_queue_pop_head(&bh->entries))) backend_health_entry_free(entry);
+	g_mutex_free(bh->lock);
+	g_slice_free(liBackendHealth, bh);
+}
+
+liBackendHealthEntry* li_backend_health_register(liBackendHealth *bh, const gchar *name) {
+	liBackendHealthEntry *entry = g_slice_new0(liBackendHealthEntry);
+
+	entry->name = g_string_new(name);
+	entry->state = LI_BACKEND_HEALTH_UNKNOWN;
+	entry->last_error = g_string_sized_new(0);
+
+	g_mutex_lock(bh->lock);
+	g_queue_push_tail(&bh->entries, entry);
+	g_mutex_unlock(bh->lock);
+
+	return entry;
+}
+
+void li_backend_health_unregister(liBackendHealth *bh, liBackendHealthEntry *entry) {
+	g_mutex_lock(bh->lock);
+	g_queue_remove(&bh->entries, entry);
+	g_mutex_unlock(bh->lock);
+
+	backend_health_entry_free(entry);
+}
+
+void li_backend_health_report(liBackendHealth *bh, liBackendHealthEntry *entry, liBackendHealthState state, gboolean check_ok, const gchar *error, li_tstamp now) {
+	g_mutex_lock(bh->lock);
+	entry->checks++;
+	if (!check_ok) {
+		entry->failed_checks++;
+		g_string_assign(entry->last_error, NULL != error ? error : "");
+	}
+	if (entry->state != state) {
+		entry->state = state;
+		entry->since = now;
+	}
+	g_mutex_unlock(bh->lock);
+}
+
+void li_backend_health_foreach(liBackendHealth *bh, liBackendHealthForeachCB cb, gpointer data) {
+	GList *l;
+
+	g_mutex_lock(bh->lock);
+	for (l = bh->entries.head; NULL != l; l = l->next) {
+		cb(l->data, data);
+	}
+	g_mutex_unlock(bh->lock);
+}
+
+const gchar* li_backend_health_state_string(liBackendHealthState state) {
+	switch (state) {
+	case LI_BACKEND_HEALTH_UNKNOWN:
+		return "unknown";
+	case LI_BACKEND_HEALTH_UP:
+		return "up";
+	case LI_BACKEND_HEALTH_DOWN:
+		return "down";
+	}
+	return "invalid";
+}
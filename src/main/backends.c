@@ -1087,6 +1087,12 @@ void li_backend_put(liWorker *wrk, liBackendPool *bpool, liBackendConnection *bc
 	}
 }
 
+gint li_backend_connection_requests(liBackendConnection *bcon) {
+	liBackendConnection_p *con = LI_CONTAINER_OF(bcon, liBackendConnection_p, public);
+
+	return con->requests;
+}
+
 void li_backend_connection_closed(liBackendPool *bpool, liBackendConnection *bcon) {
 	liBackendPool_p *pool = LI_CONTAINER_OF(bpool, liBackendPool_p, public);
 	liBackendConnection_p *con = LI_CONTAINER_OF(bcon, liBackendConnection_p, public);
@@ -77,6 +77,11 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 
 	if (0 == raw_in->length) return; /* no (new) data */
 
+	if (LI_CON_STATE_HTTP2 == con->state) {
+		li_connection_http2_handle_input(con);
+		return;
+	}
+
 	if (LI_CON_STATE_UPGRADED == con->state) {
 		li_chunkqueue_steal_all(in, raw_in);
 		li_stream_notify(stream);
@@ -107,6 +112,18 @@ static void _connection_http_in_cb(liStream *stream, liStreamEvent event) {
 		/* put back in io timeout queue */
 		li_connection_update_io_wait(con);
 	} else if (con->state == LI_CON_STATE_REQUEST_START) {
+		/* HTTP/2 with prior knowledge (h2c); TLS connections negotiate "h2" with ALPN instead */
+		if (!con->info.is_ssl && CORE_OPTION(LI_CORE_OPTION_HTTP2_CLEARTEXT).boolean) {
+			switch (li_connection_http2_check_preface(raw_in)) {
+			case LI_TRITRUE:
+				li_connection_http2_start(con);
+				return;
+			case LI_TRIMAYBE:
+				return; /* wait for more data */
+			case LI_TRIFALSE:
+				break;
+			}
+		}
 		con->state = LI_CON_STATE_READ_REQUEST_HEADER;
 		li_connection_update_io_wait(con);
 	}
@@ -259,6 +276,11 @@ static void _connection_http_out_cb(liStream *stream, liStreamEvent event) {
 		return;
 	}
 
+	if (LI_CON_STATE_HTTP2 == con->state) {
+		li_connection_http2_handle_output(con);
+		return;
+	}
+
 	out = (NULL != stream->source) ? stream->source->out : NULL;
 
 	/* keep raw_out->is_closed = FALSE for keep-alive requests; instead set con->out_has_all_data = TRUE */
@@ -346,6 +368,11 @@ void li_connection_update_io_wait(liConnection *con) {
 	case LI_CON_STATE_UPGRADED:
 		want_timeout = stopping;
 		break;
+	case LI_CON_STATE_HTTP2:
+		/* open streams have to make progress (stream frames refresh the timeout, see connection_http2.c),
+		 * and flushing the final frames has to finish; idle connections use the keep-alive timeout */
+		want_timeout = stopping || con->out_has_all_data || 0 != li_connection_http2_open_streams(con);
+		break;
 	}
 
 	if (want_timeout == con->io_timeout_elem.queued) return;
@@ -464,6 +491,12 @@ static void connection_keepalive_cb(liEventBase *watcher, int events) {
 	liConnection *con = LI_CONTAINER_OF(li_event_timer_from(watcher), liConnection, keep_alive_data.watcher);
 	UNUSED(events);
 
+	if (LI_CON_STATE_HTTP2 == con->state) {
+		/* no streams open for too long: send GOAWAY */
+		li_connection_http2_shutdown(con);
+		return;
+	}
+
 	li_connection_reset(con);
 }
 
@@ -552,6 +585,7 @@ liConnection* li_connection_new(liWorker *wrk) {
 	con->info.callbacks = &con_callbacks;
 
 	con->mainvr = li_vrequest_new(wrk, &con->info);
+	con->http2 = NULL;
 
 	li_http_request_parser_init(&con->req_parser_ctx, &con->mainvr->request, NULL); /* chunkqueue is created in _start */
 
@@ -572,6 +606,7 @@ void li_connection_reset(liConnection *con) {
 		con->state = LI_CON_STATE_DEAD;
 
 		con_iostream_close(con, TRUE);
+		li_connection_http2_reset(con);
 		li_stream_reset(&con->in);
 		li_stream_reset(&con->out);
 		li_stream_reset(&con->proxy_protocol_filter.stream);
@@ -615,6 +650,8 @@ static void li_connection_reset2(liConnection *con) {
 	li_stream_reset(&con->in);
 	li_stream_reset(&con->out);
 
+	li_connection_http2_free(con);
+
 	con->info.proxy_prot_used = FALSE;
 	li_proxy_protocol_data_clear(&con->info.proxy_prot_data);
 
@@ -741,6 +778,7 @@ void li_connection_free(liConnection *con) {
 	g_string_free(con->info.local_addr_str, TRUE);
 	li_sockaddr_clear(&con->info.local_addr);
 
+	li_connection_http2_free(con);
 	li_vrequest_free(con->mainvr);
 	li_http_request_parser_clear(&con->req_parser_ctx);
 
@@ -779,6 +817,8 @@ gchar *li_connection_state_str(liConnectionState state) {
 		return "write";
 	case LI_CON_STATE_UPGRADED:
 		return "upgraded";
+	case LI_CON_STATE_HTTP2:
+		return "http2";
 	}
 
 	return "undefined";
@@ -787,7 +827,7 @@ gchar *li_connection_state_str(liConnectionState state) {
 liConnection* li_connection_from_vrequest(liVRequest *vr) {
 	liConnection *con;
 
-	if (vr->coninfo->callbacks != &con_callbacks) return NULL;
+	if (vr->coninfo->callbacks != &con_callbacks) return li_connection_http2_from_vrequest(vr);
 
 	con = LI_CONTAINER_OF(vr->coninfo, liConnection, info);
 
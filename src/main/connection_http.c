@@ -18,6 +18,9 @@ static void simple_tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 
 	li_connection_simple_tcp(&data->con, stream, &data->simple_tcp_state, event);
 
+	/* HTTP/1 responses get flushed below; upgraded and HTTP/2 connections don't know where a response ends */
+	li_stream_simple_socket_cork_until_flush(stream, NULL != data->con && data->con->state < LI_CON_STATE_UPGRADED);
+
 	if (NULL != data->con && data->con->out_has_all_data
 	    && (NULL == stream->stream_out.out || 0 == stream->stream_out.out->length)) {
 		li_stream_simple_socket_flush(stream);
@@ -0,0 +1,1715 @@
+/* HTTP/2 (RFC 9113) connections */
+
+#include <lighttpd/base.h>
+#include <lighttpd/plugin_core.h>
+
+#include <lighttpd/lighttpd-glue.h>
+
+#define HTTP2_FRAME_HEADER_SIZE 9
+
+#define HTTP2_DEFAULT_FRAME_SIZE 16384
+#define HTTP2_MAX_FRAME_SIZE ((1 << 24) - 1)
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_MAX_WINDOW 0x7fffffff
+
+/* our SETTINGS */
+#define HTTP2_MAX_CONCURRENT_STREAMS 100
+#define HTTP2_MAX_HEADER_LIST_SIZE (64*1024)
+/* initial window for request bodies; also the liCQLimit of the request body queue */
+#define HTTP2_STREAM_WINDOW (64*1024)
+#define HTTP2_CONNECTION_WINDOW (1024*1024)
+
+/* compressed header blocks (HEADERS + CONTINUATION) may not get larger than this */
+#define HTTP2_MAX_HEADER_BLOCK (2*HTTP2_MAX_HEADER_LIST_SIZE)
+/* response body buffered per stream */
+#define HTTP2_STREAM_OUT_LIMIT (64*1024)
+/* stop scheduling DATA frames while this much is waiting to be written to the socket */
+#define HTTP2_OUT_QUEUE_LIMIT (64*1024)
+/* streams the peer may reset (or open beyond the concurrency limit) within HTTP2_RESET_INTERVAL seconds before the
+ * connection is closed ("rapid reset") */
+#define HTTP2_RESET_LIMIT 200
+#define HTTP2_RESET_INTERVAL 10.0
+
+#define HTTP2_URGENCY_LEVELS 8
+#define HTTP2_DEFAULT_URGENCY 3
+
+enum {
+	HTTP2_FRAME_DATA = 0x0,
+	HTTP2_FRAME_HEADERS = 0x1,
+	HTTP2_FRAME_PRIORITY = 0x2,
+	HTTP2_FRAME_RST_STREAM = 0x3,
+	HTTP2_FRAME_SETTINGS = 0x4,
+	HTTP2_FRAME_PUSH_PROMISE = 0x5,
+	HTTP2_FRAME_PING = 0x6,
+	HTTP2_FRAME_GOAWAY = 0x7,
+	HTTP2_FRAME_WINDOW_UPDATE = 0x8,
+	HTTP2_FRAME_CONTINUATION = 0x9,
+	HTTP2_FRAME_PRIORITY_UPDATE = 0x10 /* RFC 9218 */
+};
+
+enum {
+	HTTP2_FLAG_END_STREAM = 0x1,
+	HTTP2_FLAG_ACK = 0x1,
+	HTTP2_FLAG_END_HEADERS = 0x4,
+	HTTP2_FLAG_PADDED = 0x8,
+	HTTP2_FLAG_PRIORITY = 0x20
+};
+
+enum {
+	HTTP2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+	HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+	HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+	HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+	HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+	HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+typedef enum {
+	HTTP2_NO_ERROR = 0x0,
+	HTTP2_PROTOCOL_ERROR = 0x1,
+	HTTP2_INTERNAL_ERROR = 0x2,
+	HTTP2_FLOW_CONTROL_ERROR = 0x3,
+	HTTP2_STREAM_CLOSED = 0x5,
+	HTTP2_FRAME_SIZE_ERROR = 0x6,
+	HTTP2_REFUSED_STREAM = 0x7,
+	HTTP2_CANCEL = 0x8,
+	HTTP2_COMPRESSION_ERROR = 0x9,
+	HTTP2_ENHANCE_YOUR_CALM = 0xb
+} http2_error;
+
+typedef struct http2_stream http2_stream;
+
+struct http2_stream {
+	liHttp2Connection *h2;
+	guint32 id;
+
+	liConInfo coninfo;
+	liVRequest *vr;
+
+	/* in: request body (coninfo.req), out: response body (coninfo.resp) */
+	liStream in, out;
+	guint destroyed; /* DESTROY events received from in/out; free after both */
+
+	/* flow control: what we may send, what the peer may send, and what we owe the peer (recv_window + recv_owed
+	 * always equals HTTP2_STREAM_WINDOW) */
+	gint64 send_window;
+	gint64 recv_window, recv_owed;
+
+	guint urgency;
+	gboolean incremental;
+
+	GList sched_link; /* in h2->ready[urgency] or h2->closed */
+	GList wu_link; /* in h2->window_updates */
+	gboolean queued, wu_queued;
+
+	gboolean vr_started; /* vrequest handles the request */
+	gboolean remote_closed; /* END_STREAM received */
+	gboolean discard_body; /* nobody reads the request body */
+	gboolean response_ready, headers_sent, skip_body;
+	gboolean closed;
+};
+
+struct liHttp2Connection {
+	liConnection *con;
+
+	GHashTable *streams; /* GUINT_TO_POINTER(id) -> http2_stream* (open streams only) */
+	guint32 last_stream_id; /* highest stream id the client opened */
+
+	liHPackTable decoder, encoder;
+
+	/* peer settings */
+	guint32 peer_max_frame_size;
+	gint64 peer_initial_window;
+
+	/* connection flow control */
+	gint64 send_window;
+	gint64 recv_window, recv_owed;
+
+	/* header block spanning HEADERS + CONTINUATION frames */
+	guint32 header_stream_id;
+	guint8 header_flags;
+	GByteArray *header_block;
+
+	GByteArray *frame; /* payload of the current frame */
+	GByteArray *block; /* encoded response headers */
+	GString *tmp;
+
+	/* streams reset by the peer (or refused) since reset_ts */
+	guint resets;
+	li_tstamp reset_ts;
+
+	gboolean preface_received, settings_received;
+	gboolean goaway_sent;
+	gboolean closing; /* connection error: ignore further input */
+
+	GQueue ready[HTTP2_URGENCY_LEVELS]; /* streams with something to send */
+	GQueue window_updates; /* streams which owe the peer a WINDOW_UPDATE */
+	GQueue closed; /* closed streams, freed in cleanup_job */
+	liJob cleanup_job;
+};
+
+static void http2_stream_close(http2_stream *s);
+static void http2_stream_schedule(http2_stream *s);
+static const liConCallbacks http2_stream_callbacks;
+
+#define HTTP2_DEBUG(h2, fmt, ...) do { \
+	if (_CORE_OPTION((h2)->con->mainvr, LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) { \
+		_VR_DEBUG((h2)->con->srv, (h2)->con->mainvr, "http2: " fmt, __VA_ARGS__); \
+	} \
+} while (0)
+
+static guint32 http2_get_u32(const guint8 *p) {
+	return ((guint32) p[0] << 24) | ((guint32) p[1] << 16) | ((guint32) p[2] << 8) | (guint32) p[3];
+}
+
+static void http2_put_u32(guint8 *p, guint32 v) {
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+/**********
+ * output *
+ **********/
+
+static void http2_frame_header(liHttp2Connection *h2, guint32 len, guint8 type, guint8 flags, guint32 stream_id) {
+	guint8 hdr[HTTP2_FRAME_HEADER_SIZE];
+
+	hdr[0] = (len >> 16) & 0xff;
+	hdr[1] = (len >> 8) & 0xff;
+	hdr[2] = len & 0xff;
+	hdr[3] = type;
+	hdr[4] = flags;
+	http2_put_u32(hdr + 5, stream_id & 0x7fffffff);
+	li_chunkqueue_append_mem(h2->con->out.out, hdr, sizeof(hdr));
+}
+
+/* small control frames */
+static void http2_send_frame(liHttp2Connection *h2, guint8 type, guint8 flags, guint32 stream_id, const guint8 *payload, guint32 len) {
+	guint8 buf[HTTP2_FRAME_HEADER_SIZE + 32];
+
+	LI_FORCE_ASSERT(len <= sizeof(buf) - HTTP2_FRAME_HEADER_SIZE);
+
+	buf[0] = 0;
+	buf[1] = 0;
+	buf[2] = len;
+	buf[3] = type;
+	buf[4] = flags;
+	http2_put_u32(buf + 5, stream_id & 0x7fffffff);
+	if (len > 0) memcpy(buf + HTTP2_FRAME_HEADER_SIZE, payload, len);
+	li_chunkqueue_append_mem(h2->con->out.out, buf, HTTP2_FRAME_HEADER_SIZE + len);
+}
+
+static void http2_send_rst_stream(liHttp2Connection *h2, guint32 stream_id, http2_error error) {
+	guint8 payload[4];
+	http2_put_u32(payload, error);
+	http2_send_frame(h2, HTTP2_FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static void http2_send_window_update(liHttp2Connection *h2, guint32 stream_id, guint32 increment) {
+	guint8 payload[4];
+	http2_put_u32(payload, increment);
+	http2_send_frame(h2, HTTP2_FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+static void http2_send_goaway(liHttp2Connection *h2, http2_error error) {
+	guint8 payload[8];
+
+	if (h2->goaway_sent && HTTP2_NO_ERROR == error) return;
+	h2->goaway_sent = TRUE;
+
+	http2_put_u32(payload, h2->last_stream_id);
+	http2_put_u32(payload + 4, error);
+	http2_send_frame(h2, HTTP2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/* HEADERS + CONTINUATION frames, split at the peers max frame size */
+static void http2_send_header_block(liHttp2Connection *h2, guint32 stream_id, GByteArray *block, gboolean end_stream) {
+	guint8 type = HTTP2_FRAME_HEADERS, flags = end_stream ? HTTP2_FLAG_END_STREAM : 0;
+	guint pos = 0;
+
+	do {
+		guint len = MIN(h2->peer_max_frame_size, block->len - pos);
+		if (pos + len == block->len) flags |= HTTP2_FLAG_END_HEADERS;
+		http2_frame_header(h2, len, type, flags, stream_id);
+		li_chunkqueue_append_mem(h2->con->out.out, block->data + pos, len);
+		pos += len;
+		type = HTTP2_FRAME_CONTINUATION;
+		flags = 0;
+	} while (pos < block->len);
+}
+
+/* flush queued frames; the connection is closed after everything was sent */
+static void http2_finish(liHttp2Connection *h2) {
+	liConnection *con = h2->con;
+
+	con->info.keep_alive = FALSE;
+	con->out_has_all_data = TRUE;
+	li_event_stop(&con->keep_alive_data.watcher);
+	li_connection_update_io_wait(con);
+	li_stream_again_later(&con->out);
+}
+
+static void http2_close_all_streams(liHttp2Connection *h2) {
+	GList *streams = g_hash_table_get_values(h2->streams), *l;
+
+	for (l = streams; NULL != l; l = l->next) {
+		http2_stream *s = l->data;
+		s->coninfo.aborted = TRUE;
+		http2_stream_close(s);
+	}
+	g_list_free(streams);
+}
+
+static void http2_connection_error(liHttp2Connection *h2, http2_error error, const gchar *reason) {
+	if (h2->closing) return;
+
+	HTTP2_DEBUG(h2, "connection error %u: %s", (guint) error, reason);
+
+	h2->closing = TRUE;
+	h2->goaway_sent = FALSE; /* always send a GOAWAY with the error code */
+	http2_send_goaway(h2, error);
+	http2_close_all_streams(h2);
+	http2_finish(h2);
+}
+
+/* opening a stream and resetting it right away is cheap for the peer, but not for us (CVE-2023-44487) */
+static void http2_count_reset(liHttp2Connection *h2) {
+	li_tstamp now = li_cur_ts(h2->con->wrk);
+
+	if (now - h2->reset_ts > HTTP2_RESET_INTERVAL) {
+		h2->reset_ts = now;
+		h2->resets = 0;
+	}
+
+	if (++h2->resets > HTTP2_RESET_LIMIT) {
+		VR_ERROR(h2->con->mainvr, "http2: more than %u streams reset by %s, closing connection", (guint) HTTP2_RESET_LIMIT, h2->con->info.remote_addr_str->str);
+		http2_connection_error(h2, HTTP2_ENHANCE_YOUR_CALM, "too many streams reset by peer");
+	}
+}
+
+/* keep-alive timeout while no streams are open; the io timeout applies while streams are open */
+static void http2_check_idle(liHttp2Connection *h2) {
+	liConnection *con = h2->con;
+	liVRequest *vr = con->mainvr;
+
+	if (h2->closing) return;
+
+	li_connection_update_io_wait(con);
+
+	if (0 != g_hash_table_size(h2->streams)) {
+		li_event_stop(&con->keep_alive_data.watcher);
+		return;
+	}
+
+	if (h2->goaway_sent) {
+		/* shutdown: all streams are done */
+		http2_finish(h2);
+		return;
+	}
+
+	con->keep_alive_data.max_idle = CORE_OPTION(LI_CORE_OPTION_MAX_KEEP_ALIVE_IDLE).number;
+	if (0 == con->keep_alive_data.max_idle) {
+		li_connection_http2_shutdown(con);
+		return;
+	}
+	li_event_timer_once(&con->keep_alive_data.watcher, con->keep_alive_data.max_idle);
+}
+
+/***********
+ * streams *
+ ***********/
+
+static void http2_stream_in_limit_cb(gpointer context, gboolean locked);
+
+static void http2_stream_destroyed(http2_stream *s) {
+	if (++s->destroyed < 2) return;
+
+	li_sockaddr_clear(&s->coninfo.remote_addr);
+	li_sockaddr_clear(&s->coninfo.local_addr);
+	g_string_free(s->coninfo.remote_addr_str, TRUE);
+	g_string_free(s->coninfo.local_addr_str, TRUE);
+
+	g_slice_free(http2_stream, s);
+}
+
+static void http2_stream_want_window_update(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+
+	if (s->closed || s->remote_closed || s->wu_queued || 0 == s->recv_owed) return;
+
+	s->wu_queued = TRUE;
+	g_queue_push_tail_link(&h2->window_updates, &s->wu_link);
+	li_stream_again_later(&h2->con->out);
+}
+
+/* the request body queue was unlocked: give the peer its window back */
+static void http2_stream_in_limit_cb(gpointer context, gboolean locked) {
+	http2_stream *s = context;
+
+	if (!locked) http2_stream_want_window_update(s);
+}
+
+static void http2_stream_in_cb(liStream *stream, liStreamEvent event) {
+	http2_stream *s = LI_CONTAINER_OF(stream, http2_stream, in);
+
+	switch (event) {
+	case LI_STREAM_DISCONNECTED_DEST:
+		if (s->closed) return;
+		/* nobody wants the (rest of the) request body */
+		s->discard_body = TRUE;
+		li_chunkqueue_skip_all(stream->out);
+		http2_stream_want_window_update(s);
+		break;
+	case LI_STREAM_DESTROY:
+		http2_stream_destroyed(s);
+		break;
+	default:
+		break;
+	}
+}
+
+static void http2_stream_out_cb(liStream *stream, liStreamEvent event) {
+	http2_stream *s = LI_CONTAINER_OF(stream, http2_stream, out);
+
+	switch (event) {
+	case LI_STREAM_NEW_DATA:
+		break;
+	case LI_STREAM_CONNECTED_SOURCE:
+		/* the vrequest connects the response stream as signal that the headers are ready */
+		if (s->closed) return;
+		s->response_ready = TRUE;
+		break;
+	case LI_STREAM_DISCONNECTED_SOURCE:
+		if (s->closed || stream->out->is_closed) return;
+		/* li_vrequest_error: handle_response_error follows */
+		if (LI_VRS_ERROR == s->vr->state) return;
+		HTTP2_DEBUG(s->h2, "stream %u: response aborted", s->id);
+		http2_send_rst_stream(s->h2, s->id, HTTP2_INTERNAL_ERROR);
+		http2_stream_close(s);
+		return;
+	case LI_STREAM_DESTROY:
+		http2_stream_destroyed(s);
+		return;
+	default:
+		return;
+	}
+
+	if (s->closed) return;
+
+	if (NULL != stream->source && !stream->out->is_closed) {
+		liChunkQueue *source = stream->source->out;
+
+		if (s->skip_body) {
+			li_chunkqueue_skip_all(source);
+		} else {
+			li_chunkqueue_steal_all(stream->out, source);
+		}
+		if (source->is_closed) {
+			stream->out->is_closed = TRUE;
+			li_stream_disconnect(stream);
+		}
+	}
+	s->coninfo.out_queue_length = stream->out->length;
+
+	http2_stream_schedule(s);
+}
+
+static http2_stream* http2_stream_new(liHttp2Connection *h2, guint32 id) {
+	liConnection *con = h2->con;
+	http2_stream *s = g_slice_new0(http2_stream);
+
+	s->h2 = h2;
+	s->id = id;
+
+	s->coninfo.callbacks = &http2_stream_callbacks;
+	s->coninfo.remote_addr = li_sockaddr_dup(con->info.remote_addr);
+	s->coninfo.local_addr = li_sockaddr_dup(con->info.local_addr);
+	s->coninfo.remote_addr_str = g_string_new_len(GSTR_LEN(con->info.remote_addr_str));
+	s->coninfo.local_addr_str = g_string_new_len(GSTR_LEN(con->info.local_addr_str));
+	s->coninfo.is_ssl = con->info.is_ssl;
+	s->coninfo.keep_alive = FALSE; /* connection handling is not up to the vrequest */
+
+	li_stream_init(&s->in, &con->wrk->loop, http2_stream_in_cb);
+	li_stream_init(&s->out, &con->wrk->loop, http2_stream_out_cb);
+	s->coninfo.req = &s->in;
+	s->coninfo.resp = &s->out;
+
+	li_chunkqueue_use_limit(s->in.out, HTTP2_STREAM_WINDOW);
+	s->in.out->limit->notify = http2_stream_in_limit_cb;
+	s->in.out->limit->context = s;
+	li_chunkqueue_use_limit(s->out.out, HTTP2_STREAM_OUT_LIMIT);
+
+	s->send_window = h2->peer_initial_window;
+	s->recv_window = HTTP2_STREAM_WINDOW;
+	s->recv_owed = 0;
+
+	s->urgency = HTTP2_DEFAULT_URGENCY;
+	s->incremental = FALSE;
+	s->sched_link.data = s;
+	s->wu_link.data = s;
+
+	s->vr = li_vrequest_new(con->wrk, &s->coninfo);
+	li_vrequest_start(s->vr);
+
+	g_hash_table_insert(h2->streams, GUINT_TO_POINTER(id), s);
+	li_event_stop(&con->keep_alive_data.watcher);
+	li_connection_update_io_wait(con);
+
+	return s;
+}
+
+/* stream is done: disconnect it now, free it in the cleanup job (we might be in a callback of the vrequest) */
+static void http2_stream_close(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+
+	if (s->closed) return;
+	s->closed = TRUE;
+
+	g_hash_table_remove(h2->streams, GUINT_TO_POINTER(s->id));
+	if (s->queued) {
+		g_queue_unlink(&h2->ready[s->urgency], &s->sched_link);
+		s->queued = FALSE;
+	}
+	if (s->wu_queued) {
+		g_queue_unlink(&h2->window_updates, &s->wu_link);
+		s->wu_queued = FALSE;
+	}
+
+	li_stream_reset(&s->in);
+	li_stream_reset(&s->out);
+
+	g_queue_push_tail_link(&h2->closed, &s->sched_link);
+	li_job_later(&h2->con->wrk->loop.jobqueue, &h2->cleanup_job);
+
+	http2_check_idle(h2);
+}
+
+static void http2_free_closed_streams(liHttp2Connection *h2) {
+	GList *l;
+
+	while (NULL != (l = g_queue_pop_head_link(&h2->closed))) {
+		http2_stream *s = l->data;
+
+		li_vrequest_free(s->vr);
+		s->vr = NULL;
+
+		if (NULL != s->in.out->limit) {
+			s->in.out->limit->notify = NULL;
+			s->in.out->limit->context = NULL;
+		}
+
+		li_stream_reset(&s->in);
+		li_stream_reset(&s->out);
+		li_stream_release(&s->in);
+		li_stream_release(&s->out);
+	}
+}
+
+static void http2_cleanup_cb(liJob *job) {
+	liHttp2Connection *h2 = LI_CONTAINER_OF(job, liHttp2Connection, cleanup_job);
+	http2_free_closed_streams(h2);
+}
+
+static void http2_stream_reset(http2_stream *s, http2_error error) {
+	HTTP2_DEBUG(s->h2, "stream %u: reset with error %u", s->id, (guint) error);
+	http2_send_rst_stream(s->h2, s->id, error);
+	http2_stream_close(s);
+	li_stream_again_later(&s->h2->con->out);
+}
+
+static gboolean http2_stream_can_send(http2_stream *s) {
+	if (s->closed) return FALSE;
+	if (!s->headers_sent) return s->response_ready;
+	if (s->out.out->length > 0) return s->send_window > 0 && s->h2->send_window > 0;
+	return s->out.out->is_closed;
+}
+
+static void http2_stream_schedule(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+
+	if (s->queued || !http2_stream_can_send(s)) return;
+
+	s->queued = TRUE;
+	g_queue_push_tail_link(&h2->ready[s->urgency], &s->sched_link);
+	li_stream_again_later(&h2->con->out);
+}
+
+static void http2_stream_set_priority(http2_stream *s, guint urgency, gboolean incremental) {
+	liHttp2Connection *h2 = s->h2;
+
+	if (s->queued && urgency != s->urgency) {
+		g_queue_unlink(&h2->ready[s->urgency], &s->sched_link);
+		g_queue_push_tail_link(&h2->ready[urgency], &s->sched_link);
+	}
+	s->urgency = urgency;
+	s->incremental = incremental;
+}
+
+/* RFC 9218 priority field value: "u=<0-7>" and "i" (or "i=?1"/"i=?0"); everything else is ignored */
+static void http2_parse_priority(const gchar *str, gsize len, guint *urgency, gboolean *incremental) {
+	gsize i = 0;
+
+	while (i < len) {
+		gsize start, end;
+
+		while (i < len && (' ' == str[i] || '\t' == str[i] || ',' == str[i])) i++;
+		start = i;
+		while (i < len && ',' != str[i] && ';' != str[i]) i++;
+		end = i;
+		while (i < len && ',' != str[i]) i++; /* skip parameters */
+		while (end > start && (' ' == str[end-1] || '\t' == str[end-1])) end--;
+
+		if (3 == end - start && 'u' == str[start] && '=' == str[start+1] && str[start+2] >= '0' && str[start+2] <= '7') {
+			*urgency = str[start+2] - '0';
+		} else if (1 == end - start && 'i' == str[start]) {
+			*incremental = TRUE;
+		} else if (4 == end - start && 0 == memcmp(str + start, "i=?1", 4)) {
+			*incremental = TRUE;
+		} else if (4 == end - start && 0 == memcmp(str + start, "i=?0", 4)) {
+			*incremental = FALSE;
+		}
+	}
+}
+
+/* the peer finished the request body */
+static gboolean http2_stream_end_of_body(http2_stream *s) {
+	liVRequest *vr = s->vr;
+	liChunkQueue *in = s->in.out;
+
+	s->remote_closed = TRUE;
+	if (s->wu_queued) {
+		g_queue_unlink(&s->h2->window_updates, &s->wu_link);
+		s->wu_queued = FALSE;
+	}
+
+	if (!s->vr_started) return TRUE;
+
+	if (-1 == vr->request.content_length) {
+		vr->request.content_length = in->bytes_in;
+	} else if (vr->request.content_length != in->bytes_in) {
+		return FALSE; /* content-length mismatch */
+	}
+	if (!in->is_closed) {
+		in->is_closed = TRUE;
+		li_stream_notify(&s->in);
+	}
+	return TRUE;
+}
+
+/* respond with vr->response.http_status without handling the request */
+static void http2_stream_respond_error(http2_stream *s) {
+	liVRequest *vr = s->vr;
+
+	if (0 == vr->response.http_status) vr->response.http_status = 500;
+
+	s->discard_body = TRUE;
+	li_chunkqueue_skip_all(s->in.out);
+	http2_stream_want_window_update(s);
+
+	/* close before disconnecting, otherwise http2_stream_out_cb aborts the stream */
+	li_chunkqueue_skip_all(s->out.out);
+	s->out.out->is_closed = TRUE;
+	li_stream_disconnect(&s->out);
+	s->response_ready = TRUE;
+	http2_stream_schedule(s);
+}
+
+static void http2_stream_send_100_continue(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+
+	g_byte_array_set_size(h2->block, 0);
+	li_hpack_encode_start(&h2->encoder, h2->block);
+	li_hpack_encode(&h2->encoder, h2->block, CONST_STR_LEN(":status"), CONST_STR_LEN("100"));
+	http2_send_header_block(h2, s->id, h2->block, FALSE);
+	li_stream_again_later(&h2->con->out);
+}
+
+static void http2_stream_send_headers(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+	liVRequest *vr = s->vr;
+	liChunkQueue *body = s->out.out;
+	gboolean have_real_body, end_stream;
+	gchar status_str[3];
+
+	s->headers_sent = TRUE;
+
+	if (vr->response.http_status < 200 || vr->response.http_status > 999) {
+		VR_ERROR(vr, "wrong status: %i, internal error", vr->response.http_status);
+		vr->response.http_status = 500;
+		li_http_headers_reset(vr->response.headers);
+		li_chunkqueue_skip_all(body);
+		body->is_closed = TRUE;
+		li_stream_disconnect(&s->out);
+	}
+
+	have_real_body = (body->length > 0) || !body->is_closed;
+
+	if (!have_real_body && vr->response.http_status >= 400 && vr->response.http_status < 600) {
+		li_response_send_error_page(vr, body);
+	}
+
+	if (vr->response.http_status == 204 || vr->response.http_status == 205 || vr->response.http_status == 304) {
+		/* They never have a content-body/length */
+		s->skip_body = TRUE;
+	} else if (body->is_closed) {
+		if (vr->request.http_method != LI_HTTP_METHOD_HEAD || body->length > 0) {
+			/* do not send content-length: 0 if backend already skipped content generation for HEAD */
+			g_string_printf(vr->wrk->tmp_str, "%"LI_GOFFSET_FORMAT, body->length);
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Length"), GSTR_LEN(vr->wrk->tmp_str));
+		}
+	}
+	if (vr->request.http_method == LI_HTTP_METHOD_HEAD) s->skip_body = TRUE;
+
+	if (s->skip_body) li_chunkqueue_skip_all(body);
+
+	g_byte_array_set_size(h2->block, 0);
+	li_hpack_encode_start(&h2->encoder, h2->block);
+
+	li_http_status_to_str(vr->response.http_status, status_str);
+	li_hpack_encode(&h2->encoder, h2->block, CONST_STR_LEN(":status"), status_str, 3);
+
+	{
+		liHttpHeader *header;
+		GList *iter;
+		gboolean have_date = FALSE, have_server = FALSE, have_alt_svc = FALSE;
+
+		for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
+			header = (liHttpHeader*) iter->data;
+			/* connection-specific header fields are not allowed in HTTP/2 */
+			if (li_http_header_key_is(header, CONST_STR_LEN("connection"))
+			    || li_http_header_key_is(header, CONST_STR_LEN("keep-alive"))
+			    || li_http_header_key_is(header, CONST_STR_LEN("proxy-connection"))
+			    || li_http_header_key_is(header, CONST_STR_LEN("transfer-encoding"))
+			    || li_http_header_key_is(header, CONST_STR_LEN("upgrade"))) continue;
+
+			g_string_truncate(h2->tmp, 0);
+			li_g_string_append_len(h2->tmp, LI_HEADER_KEY_LEN(header));
+			g_ascii_strdown(h2->tmp->str, h2->tmp->len);
+			li_hpack_encode(&h2->encoder, h2->block, GSTR_LEN(h2->tmp), LI_HEADER_VALUE_LEN(header));
+
+			if (!have_date && li_http_header_key_is(header, CONST_STR_LEN("date"))) have_date = TRUE;
+			if (!have_server && li_http_header_key_is(header, CONST_STR_LEN("server"))) have_server = TRUE;
+			if (!have_alt_svc && li_http_header_key_is(header, CONST_STR_LEN("alt-svc"))) have_alt_svc = TRUE;
+		}
+
+		if (!have_date) {
+			GString *d = li_worker_current_timestamp(vr->wrk, LI_GMTIME, LI_TS_FORMAT_HEADER);
+			li_hpack_encode(&h2->encoder, h2->block, CONST_STR_LEN("date"), GSTR_LEN(d));
+		}
+
+		if (!have_server) {
+			GString *tag = CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string;
+
+			if (tag->len) {
+				li_hpack_encode(&h2->encoder, h2->block, CONST_STR_LEN("server"), GSTR_LEN(tag));
+			}
+		}
+
+		if (!have_alt_svc) {
+			GString *alt_svc = CORE_OPTIONPTR(LI_CORE_OPTION_ALT_SVC).string;
+
+			if (NULL != alt_svc && alt_svc->len) {
+				li_hpack_encode(&h2->encoder, h2->block, CONST_STR_LEN("alt-svc"), GSTR_LEN(alt_svc));
+			}
+		}
+	}
+
+	end_stream = s->skip_body || (body->is_closed && 0 == body->length);
+	http2_send_header_block(h2, s->id, h2->block, end_stream);
+
+	if (end_stream) {
+		if (!s->remote_closed) http2_send_rst_stream(h2, s->id, HTTP2_NO_ERROR);
+		http2_stream_close(s);
+	}
+}
+
+/* HEADERS or a single DATA frame */
+static void http2_stream_send(http2_stream *s) {
+	liHttp2Connection *h2 = s->h2;
+	liChunkQueue *body = s->out.out;
+	goffset len;
+	gboolean end_stream;
+
+	if (!s->headers_sent) {
+		http2_stream_send_headers(s);
+		return;
+	}
+
+	len = MIN(body->length, (goffset) h2->peer_max_frame_size);
+	len = MIN(len, s->send_window);
+	len = MIN(len, h2->send_window);
+	if (len < 0) len = 0;
+	if (0 == len && (body->length > 0 || !body->is_closed)) return;
+
+	end_stream = body->is_closed && len == body->length;
+
+	http2_frame_header(h2, len, HTTP2_FRAME_DATA, end_stream ? HTTP2_FLAG_END_STREAM : 0, s->id);
+	li_chunkqueue_steal_len(h2->con->out.out, body, len);
+	s->send_window -= len;
+	h2->send_window -= len;
+	s->coninfo.stats.bytes_out += len + HTTP2_FRAME_HEADER_SIZE;
+	s->coninfo.out_queue_length = body->length;
+
+	if (end_stream) {
+		/* the response is complete; tell the peer we don't need the rest of the request */
+		if (!s->remote_closed) http2_send_rst_stream(h2, s->id, HTTP2_NO_ERROR);
+		http2_stream_close(s);
+	}
+}
+
+static goffset http2_out_queue_length(liConnection *con) {
+	goffset len = con->out.out->length;
+	if (NULL != con->con_sock.raw_out && NULL != con->con_sock.raw_out->out) len += con->con_sock.raw_out->out->length;
+	return len;
+}
+
+static void http2_send_window_updates(liHttp2Connection *h2) {
+	GList *l;
+
+	while (NULL != (l = g_queue_pop_head_link(&h2->window_updates))) {
+		http2_stream *s = l->data;
+		s->wu_queued = FALSE;
+
+		/* while the body queue is locked the update gets sent by http2_stream_in_limit_cb */
+		if (!s->discard_body && 0 == li_chunkqueue_limit_available(s->in.out)) continue;
+
+		http2_send_window_update(h2, s->id, s->recv_owed);
+		s->recv_window += s->recv_owed;
+		s->recv_owed = 0;
+	}
+}
+
+void li_connection_http2_handle_output(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+	gboolean progress = FALSE;
+
+	if (NULL == h2) return;
+
+	if (!h2->closing) {
+		http2_send_window_updates(h2);
+
+		/* lower urgency values first; non-incremental streams are sent one after the other,
+		 * incremental streams of the same urgency share the bandwidth (RFC 9218) */
+		while (http2_out_queue_length(con) < HTTP2_OUT_QUEUE_LIMIT) {
+			http2_stream *s = NULL;
+			guint u;
+			GList *l;
+
+			for (u = 0; u < HTTP2_URGENCY_LEVELS; u++) {
+				if (NULL != (l = g_queue_pop_head_link(&h2->ready[u]))) {
+					s = l->data;
+					break;
+				}
+			}
+			if (NULL == s) break;
+			s->queued = FALSE;
+
+			http2_stream_send(s);
+			progress = TRUE;
+
+			if (http2_stream_can_send(s)) {
+				s->queued = TRUE;
+				if (s->incremental) {
+					g_queue_push_tail_link(&h2->ready[s->urgency], &s->sched_link);
+				} else {
+					g_queue_push_head_link(&h2->ready[s->urgency], &s->sched_link);
+				}
+			}
+		}
+	}
+
+	/* only stream data counts: PING or SETTINGS frames don't keep stalled streams alive */
+	if (progress) li_connection_update_io_timeout(con);
+
+	con->info.out_queue_length = con->out.out->length;
+	li_stream_notify(&con->out);
+}
+
+/*********
+ * input *
+ *********/
+
+static gboolean http2_header_name_valid(const gchar *name, gsize len) {
+	gsize i;
+
+	if (0 == len) return FALSE;
+	for (i = 0; i < len; i++) {
+		guchar c = name[i];
+		if (c <= 0x20 || c >= 0x7f || (c >= 'A' && c <= 'Z')) return FALSE;
+		if (':' == c && i > 0) return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean http2_header_value_valid(const gchar *value, gsize len) {
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		if ('\0' == value[i] || '\r' == value[i] || '\n' == value[i]) return FALSE;
+	}
+	return TRUE;
+}
+
+#define NAME_IS(s) (sizeof(s) - 1 == namelen && 0 == memcmp(name, s, namelen))
+
+void li_http2_request_header(liHttp2HeaderCtx *ctx, const gchar *name, gsize namelen, const gchar *value, gsize valuelen) {
+	liRequest *req = ctx->req;
+
+	if (ctx->malformed || ctx->too_large) return;
+
+	ctx->list_size += namelen + valuelen + 32;
+	if (ctx->list_size > HTTP2_MAX_HEADER_LIST_SIZE) {
+		ctx->too_large = TRUE;
+		return;
+	}
+
+	if (!http2_header_name_valid(name, namelen) || !http2_header_value_valid(value, valuelen)) {
+		ctx->malformed = TRUE;
+		return;
+	}
+
+	if (':' == name[0]) {
+		if (ctx->trailers || ctx->regular_seen) {
+			ctx->malformed = TRUE;
+		} else if (NAME_IS(":method")) {
+			if (ctx->have_method) { ctx->malformed = TRUE; return; }
+			ctx->have_method = TRUE;
+			g_string_truncate(req->http_method_str, 0);
+			li_g_string_append_len(req->http_method_str, value, valuelen);
+			req->http_method = li_http_method_from_string(value, valuelen);
+		} else if (NAME_IS(":scheme")) {
+			/* the scheme is taken from the connection */
+			if (ctx->have_scheme) { ctx->malformed = TRUE; return; }
+			ctx->have_scheme = TRUE;
+		} else if (NAME_IS(":path")) {
+			if (ctx->have_path || 0 == valuelen) { ctx->malformed = TRUE; return; }
+			ctx->have_path = TRUE;
+			g_string_truncate(req->uri.raw, 0);
+			li_g_string_append_len(req->uri.raw, value, valuelen);
+		} else if (NAME_IS(":authority")) {
+			if (ctx->have_authority) { ctx->malformed = TRUE; return; }
+			ctx->have_authority = TRUE;
+			g_string_truncate(ctx->authority, 0);
+			li_g_string_append_len(ctx->authority, value, valuelen);
+		} else {
+			ctx->malformed = TRUE;
+		}
+		return;
+	}
+
+	ctx->regular_seen = TRUE;
+
+	if (ctx->trailers) return; /* trailers are not passed on */
+
+	if (NAME_IS("connection") || NAME_IS("keep-alive") || NAME_IS("proxy-connection")
+	    || NAME_IS("transfer-encoding") || NAME_IS("upgrade")) {
+		ctx->malformed = TRUE;
+		return;
+	}
+	if (NAME_IS("te") && !(sizeof("trailers") - 1 == valuelen && 0 == memcmp(value, "trailers", valuelen))) {
+		ctx->malformed = TRUE;
+		return;
+	}
+
+	if (NAME_IS("cookie")) {
+		/* cookie crumbs are joined with "; " (RFC 9113, 8.2.3; RFC 9114, 4.2.1) */
+		liHttpHeader *hh = li_http_header_lookup(req->headers, CONST_STR_LEN("cookie"));
+		if (NULL != hh) {
+			li_g_string_append_len(hh->data, CONST_STR_LEN("; "));
+			li_g_string_append_len(hh->data, value, valuelen);
+			return;
+		}
+	}
+
+	li_http_header_insert(req->headers, name, namelen, value, valuelen);
+}
+
+#undef NAME_IS
+
+static void http2_request_header_cb(gpointer data, const gchar *name, gsize namelen, const gchar *value, gsize valuelen) {
+	li_http2_request_header(data, name, namelen, value, valuelen);
+}
+
+static void http2_ignore_header_cb(gpointer data, const gchar *name, gsize namelen, const gchar *value, gsize valuelen) {
+	UNUSED(data); UNUSED(name); UNUSED(namelen); UNUSED(value); UNUSED(valuelen);
+}
+
+/* request headers complete: validate and start the vrequest */
+static void http2_stream_start(http2_stream *s, liHttp2HeaderCtx *ctx, gboolean end_stream) {
+	liHttp2Connection *h2 = s->h2;
+	liConnection *con = h2->con;
+	liVRequest *vr = s->vr;
+	liRequest *req = &vr->request;
+	gboolean expect_100_cont = FALSE;
+	liHttpHeader *hh;
+
+	req->http_version = LI_HTTP_VERSION_2;
+
+	if (ctx->malformed || !ctx->have_method || (LI_HTTP_METHOD_CONNECT != req->http_method && (!ctx->have_scheme || !ctx->have_path))) {
+		http2_stream_reset(s, HTTP2_PROTOCOL_ERROR);
+		return;
+	}
+
+	con->wrk->stats.requests++;
+	con->keep_alive_requests++;
+	if (con->keep_alive_requests == _CORE_OPTION(con->mainvr, LI_CORE_OPTION_MAX_KEEP_ALIVE_REQUESTS).number) {
+		/* no new streams after this one */
+		li_connection_http2_shutdown(con);
+	}
+
+	if (end_stream) s->remote_closed = TRUE;
+
+	if (ctx->too_large) {
+		VR_INFO(vr, "request headers too large. limit: %u bytes", (guint) HTTP2_MAX_HEADER_LIST_SIZE);
+		vr->response.http_status = 431; /* Request Header Fields Too Large */
+		http2_stream_respond_error(s);
+		return;
+	}
+
+	if (ctx->have_authority) {
+		li_http_header_overwrite(req->headers, CONST_STR_LEN("Host"), GSTR_LEN(ctx->authority));
+	}
+
+	if (NULL != (hh = li_http_header_lookup(req->headers, CONST_STR_LEN("priority")))) {
+		guint urgency = s->urgency;
+		gboolean incremental = s->incremental;
+		http2_parse_priority(LI_HEADER_VALUE_LEN(hh), &urgency, &incremental);
+		http2_stream_set_priority(s, urgency, incremental);
+	}
+
+	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+		VR_DEBUG(vr, "http2: stream %u: validating request header", s->id);
+	}
+
+	if (!li_request_validate_header_vr(vr, &expect_100_cont)) {
+		/* set status 400 if not already set */
+		if (0 == vr->response.http_status) vr->response.http_status = 400;
+		http2_stream_respond_error(s);
+		return;
+	}
+
+	if (end_stream) {
+		if (req->content_length > 0) {
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR); /* content-length mismatch */
+			return;
+		}
+		req->content_length = 0;
+	}
+	if (0 == req->content_length) {
+		s->in.out->is_closed = TRUE;
+	} else if (expect_100_cont) {
+		http2_stream_send_100_continue(s);
+	}
+
+	s->vr_started = TRUE;
+	li_action_enter(vr, con->srv->mainaction);
+	li_vrequest_handle_request_headers(vr);
+}
+
+static void http2_handle_header_block(liHttp2Connection *h2, guint32 stream_id, guint8 flags, const guint8 *data, gsize len) {
+	gboolean end_stream = (0 != (flags & HTTP2_FLAG_END_STREAM));
+	http2_stream *s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(stream_id));
+	liHttp2HeaderCtx ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (NULL != s) {
+		/* trailers */
+		ctx.req = &s->vr->request;
+		ctx.trailers = TRUE;
+		if (!li_hpack_decode(&h2->decoder, data, len, http2_request_header_cb, &ctx)) {
+			http2_connection_error(h2, HTTP2_COMPRESSION_ERROR, "invalid header block");
+			return;
+		}
+		if (s->remote_closed) {
+			http2_stream_reset(s, HTTP2_STREAM_CLOSED);
+		} else if (!end_stream || ctx.malformed) {
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR);
+		} else if (!http2_stream_end_of_body(s)) {
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR);
+		}
+		return;
+	}
+
+	if (stream_id <= h2->last_stream_id || h2->goaway_sent
+	    || g_hash_table_size(h2->streams) >= HTTP2_MAX_CONCURRENT_STREAMS) {
+		/* closed stream, new stream after GOAWAY or too many streams: keep the decoder state in sync */
+		if (!li_hpack_decode(&h2->decoder, data, len, http2_ignore_header_cb, NULL)) {
+			http2_connection_error(h2, HTTP2_COMPRESSION_ERROR, "invalid header block");
+			return;
+		}
+		if (stream_id > h2->last_stream_id && !h2->goaway_sent) {
+			h2->last_stream_id = stream_id;
+			http2_send_rst_stream(h2, stream_id, HTTP2_REFUSED_STREAM);
+			http2_count_reset(h2);
+		}
+		return;
+	}
+
+	h2->last_stream_id = stream_id;
+	s = http2_stream_new(h2, stream_id);
+
+	ctx.req = &s->vr->request;
+	ctx.authority = h2->tmp;
+	if (!li_hpack_decode(&h2->decoder, data, len, http2_request_header_cb, &ctx)) {
+		http2_connection_error(h2, HTTP2_COMPRESSION_ERROR, "invalid header block");
+		return;
+	}
+
+	http2_stream_start(s, &ctx, end_stream);
+}
+
+static void http2_handle_headers(liHttp2Connection *h2, guint32 stream_id, guint8 flags) {
+	GByteArray *frame = h2->frame;
+	guint pad = 0, offset = 0;
+
+	if (0 == stream_id || 0 == (stream_id & 1)) {
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "HEADERS with invalid stream id");
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_PADDED) {
+		if (frame->len < 1) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "HEADERS too short");
+			return;
+		}
+		pad = frame->data[0];
+		offset = 1;
+	}
+	if (flags & HTTP2_FLAG_PRIORITY) {
+		/* the RFC 7540 priority tree is deprecated; RFC 9218 priorities are used instead */
+		offset += 5;
+	}
+	if (offset + pad > frame->len) {
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "HEADERS padding too long");
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_END_HEADERS) {
+		http2_handle_header_block(h2, stream_id, flags, frame->data + offset, frame->len - offset - pad);
+	} else {
+		h2->header_stream_id = stream_id;
+		h2->header_flags = flags;
+		g_byte_array_set_size(h2->header_block, 0);
+		g_byte_array_append(h2->header_block, frame->data + offset, frame->len - offset - pad);
+	}
+}
+
+static void http2_handle_continuation(liHttp2Connection *h2, guint32 stream_id, guint8 flags) {
+	if (0 == h2->header_stream_id || stream_id != h2->header_stream_id) {
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+		return;
+	}
+	if (h2->header_block->len + h2->frame->len > HTTP2_MAX_HEADER_BLOCK) {
+		http2_connection_error(h2, HTTP2_ENHANCE_YOUR_CALM, "header block too large");
+		return;
+	}
+
+	g_byte_array_append(h2->header_block, h2->frame->data, h2->frame->len);
+
+	if (flags & HTTP2_FLAG_END_HEADERS) {
+		h2->header_stream_id = 0;
+		http2_handle_header_block(h2, stream_id, h2->header_flags, h2->header_block->data, h2->header_block->len);
+		g_byte_array_set_size(h2->header_block, 0);
+	}
+}
+
+/* DATA payload is moved directly from raw_in into the request body queue */
+static void http2_handle_data(liHttp2Connection *h2, liChunkQueue *raw_in, guint32 stream_id, guint8 flags, guint32 len) {
+	http2_stream *s;
+	guint32 pad = 0, datalen = len;
+
+	if (0 == stream_id) {
+		li_chunkqueue_skip(raw_in, len);
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "DATA on stream 0");
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_PADDED) {
+		guint8 padlen;
+		if (0 == len || !li_chunkqueue_extract_to_memory(raw_in, 1, &padlen, NULL)) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "DATA too short");
+			return;
+		}
+		li_chunkqueue_skip(raw_in, 1);
+		pad = padlen;
+		datalen = len - 1;
+		if (pad > datalen) {
+			li_chunkqueue_skip(raw_in, datalen);
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "DATA padding too long");
+			return;
+		}
+		datalen -= pad;
+	}
+
+	/* the whole frame counts for flow control */
+	if ((gint64) len > h2->recv_window) {
+		li_chunkqueue_skip(raw_in, datalen + pad);
+		http2_connection_error(h2, HTTP2_FLOW_CONTROL_ERROR, "connection window exceeded");
+		return;
+	}
+	h2->recv_window -= len;
+	h2->recv_owed += len;
+
+	s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(stream_id));
+	if (NULL == s) {
+		li_chunkqueue_skip(raw_in, datalen + pad);
+		if (stream_id > h2->last_stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "DATA on idle stream");
+		} else {
+			http2_send_rst_stream(h2, stream_id, HTTP2_STREAM_CLOSED);
+		}
+		return;
+	}
+
+	if (s->remote_closed) {
+		li_chunkqueue_skip(raw_in, datalen + pad);
+		http2_stream_reset(s, HTTP2_STREAM_CLOSED);
+		return;
+	}
+	if ((gint64) len > s->recv_window) {
+		li_chunkqueue_skip(raw_in, datalen + pad);
+		http2_stream_reset(s, HTTP2_FLOW_CONTROL_ERROR);
+		return;
+	}
+	s->recv_window -= len;
+	s->recv_owed += len;
+	s->coninfo.stats.bytes_in += len + HTTP2_FRAME_HEADER_SIZE;
+
+	if (s->discard_body) {
+		li_chunkqueue_skip(raw_in, datalen + pad);
+	} else {
+		liChunkQueue *in = s->in.out;
+		goffset content_length = s->vr->request.content_length;
+
+		if (datalen > 0 && (in->is_closed || (content_length >= 0 && in->bytes_in + datalen > content_length))) {
+			li_chunkqueue_skip(raw_in, datalen + pad);
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR); /* more data than announced */
+			return;
+		}
+
+		li_chunkqueue_steal_len(in, raw_in, datalen);
+		li_chunkqueue_skip(raw_in, pad);
+
+		if (content_length >= 0 && in->bytes_in == content_length) in->is_closed = TRUE;
+		if (datalen > 0 || in->is_closed) li_stream_notify(&s->in);
+		if (s->closed) return;
+	}
+
+	if (flags & HTTP2_FLAG_END_STREAM) {
+		if (!http2_stream_end_of_body(s)) {
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR);
+		}
+		return;
+	}
+
+	if (s->discard_body || s->recv_owed >= HTTP2_STREAM_WINDOW / 4) {
+		http2_stream_want_window_update(s);
+	}
+}
+
+static void http2_handle_settings(liHttp2Connection *h2, guint32 stream_id, guint8 flags) {
+	GByteArray *frame = h2->frame;
+	guint i;
+
+	if (0 != stream_id) {
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "SETTINGS on a stream");
+		return;
+	}
+	if (flags & HTTP2_FLAG_ACK) {
+		if (0 != frame->len) http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "SETTINGS ACK with payload");
+		return;
+	}
+	if (0 != frame->len % 6) {
+		http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "invalid SETTINGS length");
+		return;
+	}
+
+	for (i = 0; i < frame->len; i += 6) {
+		guint16 id = (frame->data[i] << 8) | frame->data[i+1];
+		guint32 value = http2_get_u32(frame->data + i + 2);
+
+		switch (id) {
+		case HTTP2_SETTINGS_HEADER_TABLE_SIZE:
+			li_hpack_table_set_max_size(&h2->encoder, value);
+			break;
+		case HTTP2_SETTINGS_ENABLE_PUSH:
+			/* we never push */
+			if (value > 1) {
+				http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "invalid SETTINGS_ENABLE_PUSH");
+				return;
+			}
+			break;
+		case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE: {
+				GHashTableIter iter;
+				gpointer val;
+				gint64 delta;
+
+				if (value > HTTP2_MAX_WINDOW) {
+					http2_connection_error(h2, HTTP2_FLOW_CONTROL_ERROR, "invalid SETTINGS_INITIAL_WINDOW_SIZE");
+					return;
+				}
+				delta = (gint64) value - h2->peer_initial_window;
+				h2->peer_initial_window = value;
+
+				g_hash_table_iter_init(&iter, h2->streams);
+				while (g_hash_table_iter_next(&iter, NULL, &val)) {
+					http2_stream *s = val;
+					s->send_window += delta;
+					if (s->send_window > HTTP2_MAX_WINDOW) {
+						http2_connection_error(h2, HTTP2_FLOW_CONTROL_ERROR, "stream window too large");
+						return;
+					}
+					if (delta > 0) http2_stream_schedule(s);
+				}
+			}
+			break;
+		case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+			if (value < HTTP2_DEFAULT_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE) {
+				http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "invalid SETTINGS_MAX_FRAME_SIZE");
+				return;
+			}
+			h2->peer_max_frame_size = value;
+			break;
+		default:
+			/* MAX_CONCURRENT_STREAMS (we don't open streams), MAX_HEADER_LIST_SIZE (advisory), unknown settings */
+			break;
+		}
+	}
+
+	http2_send_frame(h2, HTTP2_FRAME_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0);
+}
+
+static void http2_handle_window_update(liHttp2Connection *h2, guint32 stream_id) {
+	guint32 increment;
+
+	if (4 != h2->frame->len) {
+		http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "invalid WINDOW_UPDATE length");
+		return;
+	}
+	increment = http2_get_u32(h2->frame->data) & 0x7fffffff;
+
+	if (0 == stream_id) {
+		GHashTableIter iter;
+		gpointer val;
+
+		if (0 == increment) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "WINDOW_UPDATE with increment 0");
+			return;
+		}
+		h2->send_window += increment;
+		if (h2->send_window > HTTP2_MAX_WINDOW) {
+			http2_connection_error(h2, HTTP2_FLOW_CONTROL_ERROR, "connection window too large");
+			return;
+		}
+
+		g_hash_table_iter_init(&iter, h2->streams);
+		while (g_hash_table_iter_next(&iter, NULL, &val)) {
+			http2_stream_schedule(val);
+		}
+	} else {
+		http2_stream *s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(stream_id));
+
+		if (NULL == s) {
+			if (stream_id > h2->last_stream_id) {
+				http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream");
+			}
+			return;
+		}
+		if (0 == increment) {
+			http2_stream_reset(s, HTTP2_PROTOCOL_ERROR);
+			return;
+		}
+		s->send_window += increment;
+		if (s->send_window > HTTP2_MAX_WINDOW) {
+			http2_stream_reset(s, HTTP2_FLOW_CONTROL_ERROR);
+			return;
+		}
+		http2_stream_schedule(s);
+	}
+}
+
+static void http2_handle_priority_update(liHttp2Connection *h2, guint32 stream_id) {
+	GByteArray *frame = h2->frame;
+	http2_stream *s;
+	guint32 prioritized_id;
+	guint urgency;
+	gboolean incremental;
+
+	if (0 != stream_id) {
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "PRIORITY_UPDATE on a stream");
+		return;
+	}
+	if (frame->len < 4) {
+		http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "PRIORITY_UPDATE too short");
+		return;
+	}
+	prioritized_id = http2_get_u32(frame->data) & 0x7fffffff;
+
+	/* updates for streams which are not open (yet) are ignored */
+	s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(prioritized_id));
+	if (NULL == s) return;
+
+	urgency = HTTP2_DEFAULT_URGENCY;
+	incremental = FALSE;
+	http2_parse_priority((const gchar*) frame->data + 4, frame->len - 4, &urgency, &incremental);
+	http2_stream_set_priority(s, urgency, incremental);
+}
+
+static void http2_handle_frame(liHttp2Connection *h2, guint8 type, guint8 flags, guint32 stream_id) {
+	GByteArray *frame = h2->frame;
+	http2_stream *s;
+
+	switch (type) {
+	case HTTP2_FRAME_HEADERS:
+		http2_handle_headers(h2, stream_id, flags);
+		break;
+	case HTTP2_FRAME_CONTINUATION:
+		http2_handle_continuation(h2, stream_id, flags);
+		break;
+	case HTTP2_FRAME_PRIORITY:
+		if (0 == stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+		} else if (5 != frame->len) {
+			if (NULL != (s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(stream_id)))) {
+				http2_stream_reset(s, HTTP2_FRAME_SIZE_ERROR);
+			} else {
+				http2_send_rst_stream(h2, stream_id, HTTP2_FRAME_SIZE_ERROR);
+			}
+		}
+		/* otherwise ignored, see http2_handle_headers */
+		break;
+	case HTTP2_FRAME_RST_STREAM:
+		if (0 == stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "RST_STREAM on stream 0");
+		} else if (4 != frame->len) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "invalid RST_STREAM length");
+		} else if (NULL != (s = g_hash_table_lookup(h2->streams, GUINT_TO_POINTER(stream_id)))) {
+			HTTP2_DEBUG(h2, "stream %u: reset by peer (%u)", stream_id, http2_get_u32(frame->data));
+			s->coninfo.aborted = TRUE;
+			http2_stream_close(s);
+			http2_count_reset(h2);
+		} else if (stream_id > h2->last_stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "RST_STREAM on idle stream");
+		}
+		break;
+	case HTTP2_FRAME_SETTINGS:
+		http2_handle_settings(h2, stream_id, flags);
+		break;
+	case HTTP2_FRAME_PUSH_PROMISE:
+		http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "PUSH_PROMISE from client");
+		break;
+	case HTTP2_FRAME_PING:
+		if (0 != stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "PING on a stream");
+		} else if (8 != frame->len) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "invalid PING length");
+		} else if (0 == (flags & HTTP2_FLAG_ACK)) {
+			http2_send_frame(h2, HTTP2_FRAME_PING, HTTP2_FLAG_ACK, 0, frame->data, 8);
+		}
+		break;
+	case HTTP2_FRAME_GOAWAY:
+		if (0 != stream_id) {
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "GOAWAY on a stream");
+		} else if (frame->len < 8) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "GOAWAY too short");
+		} else {
+			/* finish the open streams, then close */
+			HTTP2_DEBUG(h2, "GOAWAY from peer (%u)", http2_get_u32(frame->data + 4));
+			li_connection_http2_shutdown(h2->con);
+		}
+		break;
+	case HTTP2_FRAME_WINDOW_UPDATE:
+		http2_handle_window_update(h2, stream_id);
+		break;
+	case HTTP2_FRAME_PRIORITY_UPDATE:
+		http2_handle_priority_update(h2, stream_id);
+		break;
+	default:
+		/* unknown frame types are ignored */
+		break;
+	}
+}
+
+liTristate li_connection_http2_check_preface(liChunkQueue *cq) {
+	gchar buf[sizeof(LI_HTTP2_PREFACE) - 1];
+	goffset len = MIN(cq->length, (goffset) sizeof(buf));
+
+	if (0 == len) return LI_TRIMAYBE;
+	if (!li_chunkqueue_extract_to_memory(cq, len, buf, NULL)) return LI_TRIFALSE;
+	if (0 != memcmp(buf, LI_HTTP2_PREFACE, len)) return LI_TRIFALSE;
+
+	return (len == (goffset) sizeof(buf)) ? LI_TRITRUE : LI_TRIMAYBE;
+}
+
+void li_connection_http2_handle_input(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+	liChunkQueue *raw_in;
+	gboolean progress = FALSE;
+
+	if (NULL == h2 || NULL == con->in.source) return;
+	raw_in = con->in.source->out;
+
+	if (h2->closing) {
+		li_chunkqueue_skip_all(raw_in);
+		return;
+	}
+
+	if (!h2->preface_received) {
+		switch (li_connection_http2_check_preface(raw_in)) {
+		case LI_TRIFALSE:
+			HTTP2_DEBUG(h2, "%s", "invalid connection preface");
+			li_connection_error(con);
+			return;
+		case LI_TRIMAYBE:
+			return;
+		case LI_TRITRUE:
+			break;
+		}
+		li_chunkqueue_skip(raw_in, sizeof(LI_HTTP2_PREFACE) - 1);
+		h2->preface_received = TRUE;
+	}
+
+	while (!h2->closing && raw_in->length >= HTTP2_FRAME_HEADER_SIZE) {
+		guint8 hdr[HTTP2_FRAME_HEADER_SIZE];
+		guint32 len, stream_id;
+		guint8 type, flags;
+		GError *err = NULL;
+
+		if (!li_chunkqueue_extract_to_memory(raw_in, HTTP2_FRAME_HEADER_SIZE, hdr, &err)) {
+			VR_ERROR(con->mainvr, "Couldn't read HTTP/2 frame header: %s", NULL != err ? err->message : "unknown error");
+			if (NULL != err) g_error_free(err);
+			li_connection_error(con);
+			return;
+		}
+
+		len = ((guint32) hdr[0] << 16) | ((guint32) hdr[1] << 8) | hdr[2];
+		type = hdr[3];
+		flags = hdr[4];
+		stream_id = http2_get_u32(hdr + 5) & 0x7fffffff;
+
+		if (len > HTTP2_DEFAULT_FRAME_SIZE) {
+			http2_connection_error(h2, HTTP2_FRAME_SIZE_ERROR, "frame too large");
+			break;
+		}
+		if (raw_in->length < HTTP2_FRAME_HEADER_SIZE + (goffset) len) break; /* wait for the complete frame */
+
+		li_chunkqueue_skip(raw_in, HTTP2_FRAME_HEADER_SIZE);
+
+		if (!h2->settings_received) {
+			if (HTTP2_FRAME_SETTINGS != type || (flags & HTTP2_FLAG_ACK)) {
+				li_chunkqueue_skip(raw_in, len);
+				http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "connection preface without SETTINGS");
+				break;
+			}
+			h2->settings_received = TRUE;
+		}
+
+		if (0 != h2->header_stream_id && HTTP2_FRAME_CONTINUATION != type) {
+			li_chunkqueue_skip(raw_in, len);
+			http2_connection_error(h2, HTTP2_PROTOCOL_ERROR, "header block interrupted");
+			break;
+		}
+
+		if ((HTTP2_FRAME_DATA == type && len > 0) || HTTP2_FRAME_HEADERS == type || HTTP2_FRAME_CONTINUATION == type) {
+			progress = TRUE;
+		}
+
+		if (HTTP2_FRAME_DATA == type) {
+			http2_handle_data(h2, raw_in, stream_id, flags, len);
+		} else {
+			if (!li_chunkqueue_extract_to_bytearr(raw_in, len, h2->frame, &err)) {
+				VR_ERROR(con->mainvr, "Couldn't read HTTP/2 frame: %s", NULL != err ? err->message : "unknown error");
+				if (NULL != err) g_error_free(err);
+				li_connection_error(con);
+				return;
+			}
+			li_chunkqueue_skip(raw_in, len);
+			http2_handle_frame(h2, type, flags, stream_id);
+		}
+
+		if (LI_CON_STATE_HTTP2 != con->state) return;
+	}
+
+	if (h2->closing) {
+		li_chunkqueue_skip_all(raw_in);
+	} else if (h2->recv_owed >= HTTP2_CONNECTION_WINDOW / 2) {
+		/* connection level credit is returned right away; the streams limit the buffered data */
+		http2_send_window_update(h2, 0, h2->recv_owed);
+		h2->recv_window += h2->recv_owed;
+		h2->recv_owed = 0;
+	}
+
+	if (progress) li_connection_update_io_timeout(con);
+
+	li_stream_again_later(&con->out);
+}
+
+/**************
+ * connection *
+ **************/
+
+void li_connection_http2_start(liConnection *con) {
+	liHttp2Connection *h2;
+	guint i;
+	guint8 settings[4*6], *p = settings;
+
+	LI_FORCE_ASSERT(NULL == con->http2);
+	LI_FORCE_ASSERT(LI_CON_STATE_REQUEST_START == con->state);
+
+	h2 = g_slice_new0(liHttp2Connection);
+	h2->con = con;
+	h2->streams = g_hash_table_new(NULL, NULL);
+	li_hpack_table_init(&h2->decoder, LI_HPACK_DEFAULT_TABLE_SIZE);
+	li_hpack_table_init(&h2->encoder, LI_HPACK_DEFAULT_TABLE_SIZE);
+
+	h2->peer_max_frame_size = HTTP2_DEFAULT_FRAME_SIZE;
+	h2->peer_initial_window = HTTP2_DEFAULT_WINDOW;
+	h2->send_window = HTTP2_DEFAULT_WINDOW;
+	h2->recv_window = HTTP2_CONNECTION_WINDOW;
+
+	h2->header_block = g_byte_array_new();
+	h2->frame = g_byte_array_sized_new(HTTP2_DEFAULT_FRAME_SIZE);
+	h2->block = g_byte_array_sized_new(1024);
+	h2->tmp = g_string_sized_new(63);
+
+	for (i = 0; i < HTTP2_URGENCY_LEVELS; i++) g_queue_init(&h2->ready[i]);
+	g_queue_init(&h2->window_updates);
+	g_queue_init(&h2->closed);
+	li_job_init(&h2->cleanup_job, http2_cleanup_cb);
+
+	con->http2 = h2;
+	con->state = LI_CON_STATE_HTTP2;
+	li_connection_update_io_wait(con);
+
+	HTTP2_DEBUG(h2, "%s", "start");
+
+#define SETTING(id, value) do { p[0] = 0; p[1] = id; http2_put_u32(p + 2, value); p += 6; } while (0)
+	SETTING(HTTP2_SETTINGS_ENABLE_PUSH, 0);
+	SETTING(HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_CONCURRENT_STREAMS);
+	SETTING(HTTP2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_STREAM_WINDOW);
+	SETTING(HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, HTTP2_MAX_HEADER_LIST_SIZE);
+#undef SETTING
+	http2_send_frame(h2, HTTP2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+	http2_send_window_update(h2, 0, HTTP2_CONNECTION_WINDOW - HTTP2_DEFAULT_WINDOW);
+
+	http2_check_idle(h2);
+
+	li_stream_again_later(&con->out);
+	li_stream_again_later(&con->in);
+}
+
+guint li_connection_http2_open_streams(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+
+	if (NULL == h2 || h2->closing) return 0;
+
+	return g_hash_table_size(h2->streams);
+}
+
+void li_connection_http2_shutdown(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+
+	if (NULL == h2 || h2->closing || h2->goaway_sent) return;
+
+	HTTP2_DEBUG(h2, "shutdown, %u streams open", g_hash_table_size(h2->streams));
+
+	http2_send_goaway(h2, HTTP2_NO_ERROR);
+	http2_check_idle(h2);
+	li_stream_again_later(&con->out);
+}
+
+void li_connection_http2_reset(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+
+	if (NULL == h2) return;
+
+	h2->closing = TRUE;
+	http2_close_all_streams(h2);
+}
+
+void li_connection_http2_free(liConnection *con) {
+	liHttp2Connection *h2 = con->http2;
+	guint i;
+
+	if (NULL == h2) return;
+
+	li_connection_http2_reset(con);
+	http2_free_closed_streams(h2);
+	con->http2 = NULL;
+
+	li_job_clear(&h2->cleanup_job);
+	g_hash_table_destroy(h2->streams);
+	for (i = 0; i < HTTP2_URGENCY_LEVELS; i++) g_queue_clear(&h2->ready[i]);
+	li_hpack_table_clear(&h2->decoder);
+	li_hpack_table_clear(&h2->encoder);
+
+	g_byte_array_free(h2->header_block, TRUE);
+	g_byte_array_free(h2->frame, TRUE);
+	g_byte_array_free(h2->block, TRUE);
+	g_string_free(h2->tmp, TRUE);
+
+	g_slice_free(liHttp2Connection, h2);
+}
+
+/**********************
+ * vrequest callbacks *
+ **********************/
+
+static void http2_vr_handle_response_error(liVRequest *vr) {
+	http2_stream *s = LI_CONTAINER_OF(vr->coninfo, http2_stream, coninfo);
+
+	if (s->closed) return;
+
+	if (s->headers_sent) {
+		http2_stream_reset(s, HTTP2_INTERNAL_ERROR);
+		return;
+	}
+
+	/* the connection survives, so we can still send an error page */
+	li_http_headers_reset(vr->response.headers);
+	http2_stream_respond_error(s);
+}
+
+static liThrottleState* http2_vr_throttle_out(liVRequest *vr) {
+	http2_stream *s = LI_CONTAINER_OF(vr->coninfo, http2_stream, coninfo);
+	liConnection *con = s->h2->con;
+
+	if (NULL == con->con_sock.callbacks) return NULL;
+	return con->con_sock.callbacks->throttle_out(con);
+}
+
+static liThrottleState* http2_vr_throttle_in(liVRequest *vr) {
+	http2_stream *s = LI_CONTAINER_OF(vr->coninfo, http2_stream, coninfo);
+	liConnection *con = s->h2->con;
+
+	if (NULL == con->con_sock.callbacks) return NULL;
+	return con->con_sock.callbacks->throttle_in(con);
+}
+
+static void http2_vr_connection_upgrade(liVRequest *vr, liStream *backend_drain, liStream *backend_source) {
+	http2_stream *s = LI_CONTAINER_OF(vr->coninfo, http2_stream, coninfo);
+	UNUSED(backend_drain); UNUSED(backend_source);
+
+	/* "upgrade" is rejected in HTTP/2 requests, and extended CONNECT is not offered */
+	if (s->closed) return;
+	http2_stream_reset(s, HTTP2_INTERNAL_ERROR);
+}
+
+static const liConCallbacks http2_stream_callbacks = {
+	http2_vr_handle_response_error,
+	http2_vr_throttle_out,
+	http2_vr_throttle_in,
+	http2_vr_connection_upgrade
+};
+
+liConnection* li_connection_http2_from_vrequest(liVRequest *vr) {
+	http2_stream *s;
+
+	if (vr->coninfo->callbacks != &http2_stream_callbacks) return NULL;
+
+	s = LI_CONTAINER_OF(vr->coninfo, http2_stream, coninfo);
+	return s->h2->con;
+}
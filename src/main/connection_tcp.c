@@ -17,15 +17,18 @@ void li_connection_simple_tcp(liConnection **pcon, liIOStream *stream, liConnect
 		if (NULL != stream->stream_in.out) {
 			transfer_in = stream->stream_in.out->bytes_in - transfer_in;
 			if (transfer_in > 0) {
-				li_connection_update_io_timeout(con);
+				/* HTTP/2 refreshes the timeout only for stream frames */
+				if (LI_CON_STATE_HTTP2 != con->state) li_connection_update_io_timeout(con);
 				li_vrequest_update_stats_in(con->mainvr, transfer_in);
 			}
 		}
 		if (NULL != stream->stream_out.out) {
 			transfer_out = stream->stream_out.out->bytes_out - transfer_out;
 			if (transfer_out > 0) {
-				li_connection_update_io_timeout(con);
+				if (LI_CON_STATE_HTTP2 != con->state || con->out_has_all_data) li_connection_update_io_timeout(con);
 				li_vrequest_update_stats_out(con->mainvr, transfer_out);
+				/* schedule the next HTTP/2 frames */
+				if (LI_CON_STATE_HTTP2 == con->state) li_stream_again_later(&con->out);
 			}
 		}
 	}
@@ -128,33 +128,79 @@ void li_etag_mutate(GString *mut, GString *etag) {
 	li_g_string_append_len(mut, CONST_STR_LEN("\""));
 }
 
+void li_etag_create(GString *dest, const struct stat *st, guint flags) {
+	g_string_truncate(dest, 0);
+
+	if (flags & LI_ETAG_USE_INODE) {
+		li_string_append_int(dest, st->st_ino);
+	}
+
+	if (flags & LI_ETAG_USE_SIZE) {
+		if (dest->len != 0) li_g_string_append_len(dest, CONST_STR_LEN("-"));
+		li_string_append_int(dest, st->st_size);
+	}
+
+	if (flags & LI_ETAG_USE_MTIME) {
+		if (dest->len != 0) li_g_string_append_len(dest, CONST_STR_LEN("-"));
+		li_string_append_int(dest, st->st_mtime);
+	}
+
+	li_etag_mutate(dest, dest);
+}
+
+gboolean li_etag_last_modified(GString *dest, time_t mtime) {
+	struct tm tm;
+
+	if (!gmtime_r(&mtime, &tm)) return FALSE;
+
+	g_string_set_size(dest, 256);
+	g_string_set_size(dest, strftime(dest->str, dest->len-1,
+		"%a, %d %b %Y %H:%M:%S GMT", &tm));
+	return TRUE;
+}
+
+void li_etag_set_header_strings(liVRequest *vr, GString *etag, GString *last_modified, gboolean *cachable) {
+	liTristate c_able = cachable ? LI_TRIMAYBE : LI_TRIFALSE;
+
+	if (NULL == etag) {
+		li_http_header_remove(vr->response.headers, CONST_STR_LEN("etag"));
+	} else {
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("ETag"), GSTR_LEN(etag));
+
+		if (c_able != LI_TRIFALSE) {
+			switch (li_http_response_handle_cachable_etag(vr, etag)) {
+			case LI_TRIFALSE: c_able = LI_TRIFALSE; break;
+			case LI_TRIMAYBE: break;
+			case LI_TRITRUE : c_able = LI_TRITRUE; break;
+			}
+		}
+	}
+
+	if (NULL != last_modified) {
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Last-Modified"), GSTR_LEN(last_modified));
+
+		if (c_able != LI_TRIFALSE) {
+			switch (li_http_response_handle_cachable_modified(vr, last_modified)) {
+			case LI_TRIFALSE: c_able = LI_TRIFALSE; break;
+			case LI_TRIMAYBE: break;
+			case LI_TRITRUE : c_able = LI_TRITRUE; break;
+			}
+		}
+	}
+
+	if (cachable) *cachable = (c_able == LI_TRITRUE);
+}
+
 void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable) {
 	guint flags = CORE_OPTION(LI_CORE_OPTION_ETAG_FLAGS).number;
 	GString *tmp_str = vr->wrk->tmp_str;
-	struct tm tm;
 	liTristate c_able = cachable ? LI_TRIMAYBE : LI_TRIFALSE;
 
 	if (0 == flags) {
 		li_http_header_remove(vr->response.headers, CONST_STR_LEN("etag"));
 	} else {
-		g_string_truncate(tmp_str, 0);
-	
-		if (flags & LI_ETAG_USE_INODE) {
-			li_string_append_int(tmp_str, st->st_ino);
-		}
-		
-		if (flags & LI_ETAG_USE_SIZE) {
-			if (tmp_str->len != 0) li_g_string_append_len(tmp_str, CONST_STR_LEN("-"));
-			li_string_append_int(tmp_str, st->st_size);
-		}
-		
-		if (flags & LI_ETAG_USE_MTIME) {
-			if (tmp_str->len != 0) li_g_string_append_len(tmp_str, CONST_STR_LEN("-"));
-			li_string_append_int(tmp_str, st->st_mtime);
-		}
-	
-		li_etag_mutate(tmp_str, tmp_str);
-	
+		li_etag_create(tmp_str, st, flags);
+
 		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("ETag"), GSTR_LEN(tmp_str));
 
 		if (c_able != LI_TRIFALSE) {
@@ -166,10 +212,7 @@ void li_etag_set_header(liVRequest *vr, struct stat *st, gboolean *cachable) {
 		}
 	}
 
-	if (gmtime_r(&st->st_mtime, &tm)) {
-		g_string_set_size(tmp_str, 256);
-		g_string_set_size(tmp_str, strftime(tmp_str->str, tmp_str->len-1,
-			"%a, %d %b %Y %H:%M:%S GMT", &tm));
+	if (li_etag_last_modified(tmp_str, st->st_mtime)) {
 		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Last-Modified"), GSTR_LEN(tmp_str));
 
 		if (c_able != LI_TRIFALSE) {
@@ -0,0 +1,178 @@
+#include <lighttpd/base.h>
+#include <sys/stat.h>
+
+typedef struct fd_cache_entry fd_cache_entry;
+struct fd_cache_entry {
+	GString *path;
+	liChunkFile *cf;
+
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+
+	GList lru_link; /* head: most recently used */
+};
+
+struct liFdCache {
+	GMutex *lock;
+	GHashTable *entries; /* GString* path (entry->path) -> fd_cache_entry* */
+	GQueue lru;
+
+	gint limit; /* atomic access */
+	guint max_limit;
+
+	guint64 evictions;
+};
+
+static void fd_cache_entry_free(fd_cache_entry *e) {
+	li_chunkfile_release(e->cf);
+	g_string_free(e->path, TRUE);
+	g_slice_free(fd_cache_entry, e);
+}
+
+/* needs fdc->lock */
+static void fd_cache_remove(liFdCache *fdc, fd_cache_entry *e) {
+	g_queue_unlink(&fdc->lru, &e->lru_link);
+	g_hash_table_remove(fdc->entries, e->path);
+	fd_cache_entry_free(e);
+}
+
+/* needs fdc->lock */
+static void fd_cache_evict(liFdCache *fdc, guint keep) {
+	while (fdc->lru.length > keep) {
+		fd_cache_remove(fdc, fdc->lru.tail->data);
+		fdc->evictions++;
+	}
+}
+
+static gboolean fd_cache_matches(fd_cache_entry *e, const struct stat *st) {
+	return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size && e->mtime == st->st_mtime;
+}
+
+liFdCache* li_fd_cache_new(guint max_limit) {
+	liFdCache *fdc = g_slice_new0(liFdCache);
+
+	fdc->lock = g_mutex_new();
+	fdc->entries = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&fdc->lru);
+	fdc->max_limit = MIN(max_limit, (guint) G_MAXINT);
+
+	return fdc;
+}
+
+void li_fd_cache_free(liFdCache *fdc) {
+	if (NULL == fdc) return;
+
+	fd_cache_evict(fdc, 0);
+	g_hash_table_destroy(fdc->entries);
+	g_mutex_free(fdc->lock);
+	g_slice_free(liFdCache, fdc);
+}
+
+guint li_fd_cache_set_limit(liFdCache *fdc, guint limit) {
+	if (limit > fdc->max_limit) limit = fdc->max_limit;
+
+	g_mutex_lock(fdc->lock);
+	g_atomic_int_set(&fdc->limit, limit);
+	fd_cache_evict(fdc, limit);
+	g_mutex_unlock(fdc->lock);
+
+	return limit;
+}
+
+gboolean li_fd_cache_enabled(liFdCache *fdc) {
+	return NULL != fdc && g_atomic_int_get(&fdc->limit) > 0;
+}
+
+liChunkFile* li_fd_cache_get(liFdCache *fdc, GString *path, const struct stat *st) {
+	fd_cache_entry *e;
+	liChunkFile *cf = NULL;
+
+	g_mutex_lock(fdc->lock);
+	if (NULL != (e = g_hash_table_lookup(fdc->entries, path))) {
+		if (fd_cache_matches(e, st)) {
+			cf = e->cf;
+			li_chunkfile_acquire(cf);
+			g_queue_unlink(&fdc->lru, &e->lru_link);
+			g_queue_push_head_link(&fdc->lru, &e->lru_link);
+		} else {
+			/* replaced or modified */
+			fd_cache_remove(fdc, e);
+		}
+	}
+	g_mutex_unlock(fdc->lock);
+
+	return cf;
+}
+
+void li_fd_cache_put(liFdCache *fdc, GString *path, liChunkFile *cf, const struct stat *st) {
+	fd_cache_entry *e;
+	guint limit;
+
+	g_mutex_lock(fdc->lock);
+
+	limit = g_atomic_int_get(&fdc->limit);
+	if (0 == limit) goto out;
+
+	if (NULL != (e = g_hash_table_lookup(fdc->entries, path))) {
+		/* another worker was faster */
+		if (fd_cache_matches(e, st)) goto out;
+		fd_cache_remove(fdc, e);
+	}
+
+	fd_cache_evict(fdc, limit - 1);
+
+	e = g_slice_new0(fd_cache_entry);
+	e->path = g_string_new_len(GSTR_LEN(path));
+	li_chunkfile_acquire(cf);
+	e->cf = cf;
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = st->st_mtime;
+	e->lru_link.data = e;
+	g_queue_push_head_link(&fdc->lru, &e->lru_link);
+	g_hash_table_insert(fdc->entries, e->path, e);
+
+out:
+	g_mutex_unlock(fdc->lock);
+}
+
+void li_fd_cache_invalidate(liFdCache *fdc, GString *path, gboolean prefix) {
+	fd_cache_entry *e;
+
+	if (!li_fd_cache_enabled(fdc)) return;
+
+	g_mutex_lock(fdc->lock);
+	if (!prefix) {
+		if (NULL != (e = g_hash_table_lookup(fdc->entries, path))) fd_cache_remove(fdc, e);
+	} else {
+		GList *l = fdc->lru.head;
+		while (NULL != l) {
+			GList *next = l->next;
+			e = l->data;
+			if (li_string_prefix(e->path, GSTR_LEN(path))
+			    && (e->path->len == path->len || G_DIR_SEPARATOR == e->path->str[path->len])) {
+				fd_cache_remove(fdc, e);
+			}
+			l = next;
+		}
+	}
+	g_mutex_unlock(fdc->lock);
+}
+
+void li_fd_cache_shrink(liFdCache *fdc) {
+	if (!li_fd_cache_enabled(fdc)) return;
+
+	g_mutex_lock(fdc->lock);
+	fd_cache_evict(fdc, fdc->lru.length / 2);
+	g_mutex_unlock(fdc->lock);
+}
+
+void li_fd_cache_counters(liFdCache *fdc, guint *entries, guint64 *evictions) {
+	g_mutex_lock(fdc->lock);
+	*entries = fdc->lru.length;
+	*evictions = fdc->evictions;
+	g_mutex_unlock(fdc->lock);
+}
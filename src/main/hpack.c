@@ -0,0 +1,521 @@
+#include <lighttpd/base.h>
+
+/* RFC 7541, appendix A */
+typedef struct {
+	const gchar *name, *value;
+	guint namelen, valuelen;
+} hpack_static_entry;
+
+#define E(name, value) { name, value, sizeof(name) - 1, sizeof(value) - 1 }
+static const hpack_static_entry hpack_static_table[] = {
+	E(":authority", ""),
+	E(":method", "GET"),
+	E(":method", "POST"),
+	E(":path", "/"),
+	E(":path", "/index.html"),
+	E(":scheme", "http"),
+	E(":scheme", "https"),
+	E(":status", "200"),
+	E(":status", "204"),
+	E(":status", "206"),
+	E(":status", "304"),
+	E(":status", "400"),
+	E(":status", "404"),
+	E(":status", "500"),
+	E("accept-charset", ""),
+	E("accept-encoding", "gzip, deflate"),
+	E("accept-language", ""),
+	E("accept-ranges", ""),
+	E("accept", ""),
+	E("access-control-allow-origin", ""),
+	E("age", ""),
+	E("allow", ""),
+	E("authorization", ""),
+	E("cache-control", ""),
+	E("content-disposition", ""),
+	E("content-encoding", ""),
+	E("content-language", ""),
+	E("content-length", ""),
+	E("content-location", ""),
+	E("content-range", ""),
+	E("content-type", ""),
+	E("cookie", ""),
+	E("date", ""),
+	E("etag", ""),
+	E("expect", ""),
+	E("expires", ""),
+	E("from", ""),
+	E("host", ""),
+	E("if-match", ""),
+	E("if-modified-since", ""),
+	E("if-none-match", ""),
+	E("if-range", ""),
+	E("if-unmodified-since", ""),
+	E("last-modified", ""),
+	E("link", ""),
+	E("location", ""),
+	E("max-forwards", ""),
+	E("proxy-authenticate", ""),
+	E("proxy-authorization", ""),
+	E("range", ""),
+	E("referer", ""),
+	E("refresh", ""),
+	E("retry-after", ""),
+	E("server", ""),
+	E("set-cookie", ""),
+	E("strict-transport-security", ""),
+	E("transfer-encoding", ""),
+	E("user-agent", ""),
+	E("vary", ""),
+	E("via", ""),
+	E("www-authenticate", "")
+};
+#undef E
+#define HPACK_STATIC_TABLE_SIZE (G_N_ELEMENTS(hpack_static_table))
+
+/* RFC 7541, appendix B; symbol 256 is EOS */
+static const guint32 hpack_huffman_codes[257] = {
+	0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+	0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+	0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+	0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+	0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+	0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+	0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+	0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+	0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+	0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+	0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+	0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+	0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+	0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+	0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+	0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+	0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+	0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+	0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+	0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+	0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+	0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+	0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+	0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+	0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+	0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+	0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+	0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+	0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+	0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+	0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+	0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+	0x3fffffff
+};
+
+static const guint8 hpack_huffman_lengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+/* number of codes per length */
+static const guint16 hpack_huffman_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+	0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+/* symbols ordered by code */
+static const guint16 hpack_huffman_symbols[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+	52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+	110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+	119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+	43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+	179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+	163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+	158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+	144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+	212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+	2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+	256
+};
+
+/* values which change with (nearly) every response only pollute the dynamic table */
+static gboolean hpack_never_index(const gchar *name, gsize namelen) {
+	static const struct { const gchar *name; gsize len; } names[] = {
+		{ CONST_STR_LEN("age") },
+		{ CONST_STR_LEN("content-length") },
+		{ CONST_STR_LEN("content-range") },
+		{ CONST_STR_LEN("date") },
+		{ CONST_STR_LEN("etag") },
+		{ CONST_STR_LEN("expires") },
+		{ CONST_STR_LEN("last-modified") },
+		{ CONST_STR_LEN("location") },
+		{ CONST_STR_LEN("set-cookie") },
+	};
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(names); i++) {
+		if (names[i].len == namelen && 0 == memcmp(names[i].name, name, namelen)) return TRUE;
+	}
+	return FALSE;
+}
+
+/* dynamic table */
+
+static liHPackEntry* hpack_table_get(liHPackTable *table, guint i) {
+	/* i = 0: newest entry */
+	return &table->entries[(table->head + table->alloc - i) % table->alloc];
+}
+
+static void hpack_table_evict_oldest(liHPackTable *table) {
+	liHPackEntry *e = hpack_table_get(table, table->used - 1);
+
+	table->size -= e->name->len + e->value->len + 32;
+	g_string_free(e->name, TRUE);
+	g_string_free(e->value, TRUE);
+	e->name = e->value = NULL;
+	table->used--;
+}
+
+static void hpack_table_shrink(liHPackTable *table, gsize needed) {
+	while (table->used > 0 && table->size + needed > table->max_size) {
+		hpack_table_evict_oldest(table);
+	}
+}
+
+static void hpack_table_add(liHPackTable *table, GString *name, GString *value) {
+	gsize entry_size = name->len + value->len + 32;
+
+	hpack_table_shrink(table, entry_size);
+	if (entry_size > table->max_size) {
+		/* not an error: the table is empty now and the entry isn't added */
+		g_string_free(name, TRUE);
+		g_string_free(value, TRUE);
+		return;
+	}
+
+	if (table->used == table->alloc) {
+		guint i, alloc = MAX(16, 2 * table->alloc);
+		liHPackEntry *entries = g_new(liHPackEntry, alloc);
+		for (i = 0; i < table->used; i++) {
+			entries[table->used - 1 - i] = *hpack_table_get(table, i);
+		}
+		g_free(table->entries);
+		table->entries = entries;
+		table->alloc = alloc;
+		table->head = (table->used + alloc - 1) % alloc;
+	}
+
+	table->head = (table->head + 1) % table->alloc;
+	table->entries[table->head].name = name;
+	table->entries[table->head].value = value;
+	table->used++;
+	table->size += entry_size;
+}
+
+void li_hpack_table_init(liHPackTable *table, gsize max_size) {
+	memset(table, 0, sizeof(*table));
+	table->max_size = table->max_size_limit = max_size;
+}
+
+void li_hpack_table_clear(liHPackTable *table) {
+	while (table->used > 0) hpack_table_evict_oldest(table);
+	g_free(table->entries);
+	table->entries = NULL;
+	table->alloc = table->head = 0;
+}
+
+void li_hpack_table_set_max_size(liHPackTable *table, gsize max_size) {
+	/* the peer allows a bigger table; we don't need more than the default */
+	gsize new_size = MIN(max_size, LI_HPACK_DEFAULT_TABLE_SIZE);
+
+	table->max_size_limit = max_size;
+	if (new_size == table->max_size) return;
+	table->max_size = new_size;
+	table->size_update_pending = TRUE;
+	hpack_table_shrink(table, 0);
+}
+
+/* huffman */
+
+gsize li_hpack_huffman_encoded_length(const guchar *data, gsize len) {
+	gsize i, bits = 0;
+
+	for (i = 0; i < len; i++) bits += hpack_huffman_lengths[data[i]];
+	return (bits + 7) / 8;
+}
+
+void li_hpack_huffman_encode(GByteArray *out, const guchar *data, gsize len) {
+	guint64 bits = 0;
+	guint nbits = 0;
+	gsize i;
+	guint8 c;
+
+	for (i = 0; i < len; i++) {
+		bits = (bits << hpack_huffman_lengths[data[i]]) | hpack_huffman_codes[data[i]];
+		nbits += hpack_huffman_lengths[data[i]];
+		while (nbits >= 8) {
+			nbits -= 8;
+			c = (bits >> nbits) & 0xff;
+			g_byte_array_append(out, &c, 1);
+		}
+	}
+	if (nbits > 0) {
+		/* pad with the most significant bits of EOS */
+		c = ((bits << (8 - nbits)) | (0xff >> nbits)) & 0xff;
+		g_byte_array_append(out, &c, 1);
+	}
+}
+
+gboolean li_hpack_huffman_decode(GString *out, const guchar *data, gsize len) {
+	/* canonical code: walk the code lengths, counting codes of each length (like zlib's "puff") */
+	guint32 code = 0, first = 0, index = 0;
+	guint codelen = 0, bit;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		for (bit = 8; bit-- > 0; ) {
+			guint32 count;
+
+			code |= (data[i] >> bit) & 1;
+			codelen++;
+			count = hpack_huffman_count[codelen];
+			if (code < first + count) {
+				guint16 sym = hpack_huffman_symbols[index + (code - first)];
+				if (256 == sym) return FALSE; /* EOS must not be encoded */
+				g_string_append_c(out, (gchar) sym);
+				code = first = index = 0;
+				codelen = 0;
+				continue;
+			}
+			if (codelen >= 30) return FALSE;
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+	}
+
+	/* padding: at most 7 bits, all ones */
+	if (codelen > 7) return FALSE;
+	if ((code >> 1) != (1u << codelen) - 1) return FALSE;
+
+	return TRUE;
+}
+
+/* primitives */
+
+static gboolean hpack_decode_int(const guchar **pos, const guchar *end, guint prefix_bits, guint32 *value) {
+	const guchar *p = *pos;
+	guint32 prefix_max = (1u << prefix_bits) - 1, v, shift = 0;
+
+	if (p >= end) return FALSE;
+	v = *p++ & prefix_max;
+	if (v == prefix_max) {
+		guchar b;
+		do {
+			/* nothing we accept needs more than 28 bits */
+			if (p >= end || shift > 21) return FALSE;
+			b = *p++;
+			v += (guint32) (b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+
+	*pos = p;
+	*value = v;
+	return TRUE;
+}
+
+static gboolean hpack_decode_string(const guchar **pos, const guchar *end, GString *out) {
+	const guchar *p = *pos;
+	gboolean huffman;
+	guint32 len;
+
+	if (p >= end) return FALSE;
+	huffman = 0 != (*p & 0x80);
+	if (!hpack_decode_int(&p, end, 7, &len)) return FALSE;
+	if (len > (gsize) (end - p)) return FALSE;
+
+	g_string_truncate(out, 0);
+	if (huffman) {
+		if (!li_hpack_huffman_decode(out, p, len)) return FALSE;
+	} else {
+		g_string_append_len(out, (const gchar*) p, len);
+	}
+
+	*pos = p + len;
+	return TRUE;
+}
+
+static void hpack_encode_int(GByteArray *out, guint8 flags, guint prefix_bits, guint32 value) {
+	guint32 prefix_max = (1u << prefix_bits) - 1;
+	guint8 c;
+
+	if (value < prefix_max) {
+		c = flags | value;
+		g_byte_array_append(out, &c, 1);
+		return;
+	}
+
+	c = flags | prefix_max;
+	g_byte_array_append(out, &c, 1);
+	value -= prefix_max;
+	while (value >= 0x80) {
+		c = 0x80 | (value & 0x7f);
+		g_byte_array_append(out, &c, 1);
+		value >>= 7;
+	}
+	c = value;
+	g_byte_array_append(out, &c, 1);
+}
+
+static void hpack_encode_string(GByteArray *out, const gchar *s, gsize len) {
+	gsize hlen = li_hpack_huffman_encoded_length((const guchar*) s, len);
+
+	if (hlen < len) {
+		hpack_encode_int(out, 0x80, 7, hlen);
+		li_hpack_huffman_encode(out, (const guchar*) s, len);
+	} else {
+		hpack_encode_int(out, 0x00, 7, len);
+		g_byte_array_append(out, (const guint8*) s, len);
+	}
+}
+
+/* decoder */
+
+/* index is 1-based, static table first */
+static gboolean hpack_lookup(liHPackTable *table, guint32 index, const gchar **name, gsize *namelen, const gchar **value, gsize *valuelen) {
+	if (0 == index) return FALSE;
+	if (index <= HPACK_STATIC_TABLE_SIZE) {
+		const hpack_static_entry *e = &hpack_static_table[index - 1];
+		*name = e->name; *namelen = e->namelen;
+		*value = e->value; *valuelen = e->valuelen;
+		return TRUE;
+	}
+	index -= HPACK_STATIC_TABLE_SIZE + 1;
+	if (index >= table->used) return FALSE;
+	{
+		liHPackEntry *e = hpack_table_get(table, index);
+		*name = e->name->str; *namelen = e->name->len;
+		*value = e->value->str; *valuelen = e->value->len;
+	}
+	return TRUE;
+}
+
+gboolean li_hpack_decode(liHPackTable *table, const guchar *data, gsize len, liHPackHeaderCB cb, gpointer cb_data) {
+	const guchar *p = data, *end = data + len;
+	GString *name = g_string_sized_new(31), *value = g_string_sized_new(63);
+	gboolean size_update_allowed = TRUE;
+	gboolean result = FALSE;
+
+	while (p < end) {
+		const gchar *n, *v;
+		gsize nlen, vlen;
+		guint32 index;
+
+		if (*p & 0x80) {
+			/* indexed header field */
+			if (!hpack_decode_int(&p, end, 7, &index)) goto out;
+			if (!hpack_lookup(table, index, &n, &nlen, &v, &vlen)) goto out;
+			cb(cb_data, n, nlen, v, vlen);
+		} else if ((*p & 0xe0) == 0x20) {
+			/* dynamic table size update, only at the beginning of a header block */
+			if (!size_update_allowed) goto out;
+			if (!hpack_decode_int(&p, end, 5, &index)) goto out;
+			if (index > table->max_size_limit) goto out;
+			table->max_size = index;
+			hpack_table_shrink(table, 0);
+			continue;
+		} else {
+			/* literals: 0x40 with incremental indexing, 0x00 without and 0x10 never indexed */
+			gboolean incremental = 0 != (*p & 0x40);
+			if (!hpack_decode_int(&p, end, incremental ? 6 : 4, &index)) goto out;
+			if (0 == index) {
+				if (!hpack_decode_string(&p, end, name)) goto out;
+			} else {
+				if (!hpack_lookup(table, index, &n, &nlen, &v, &vlen)) goto out;
+				g_string_truncate(name, 0);
+				g_string_append_len(name, n, nlen);
+			}
+			if (!hpack_decode_string(&p, end, value)) goto out;
+
+			cb(cb_data, GSTR_LEN(name), GSTR_LEN(value));
+			if (incremental) {
+				hpack_table_add(table, g_string_new_len(GSTR_LEN(name)), g_string_new_len(GSTR_LEN(value)));
+			}
+		}
+		size_update_allowed = FALSE;
+	}
+
+	result = TRUE;
+
+out:
+	g_string_free(name, TRUE);
+	g_string_free(value, TRUE);
+	return result;
+}
+
+/* encoder */
+
+void li_hpack_encode_start(liHPackTable *table, GByteArray *out) {
+	if (table->size_update_pending) {
+		hpack_encode_int(out, 0x20, 5, table->max_size);
+		table->size_update_pending = FALSE;
+	}
+}
+
+void li_hpack_encode(liHPackTable *table, GByteArray *out, const gchar *name, gsize namelen, const gchar *value, gsize valuelen) {
+	guint32 name_index = 0;
+	guint i;
+
+	for (i = 0; i < HPACK_STATIC_TABLE_SIZE; i++) {
+		const hpack_static_entry *e = &hpack_static_table[i];
+		if (e->namelen != namelen || 0 != memcmp(e->name, name, namelen)) continue;
+		if (e->valuelen == valuelen && 0 == memcmp(e->value, value, valuelen)) {
+			hpack_encode_int(out, 0x80, 7, i + 1);
+			return;
+		}
+		if (0 == name_index) name_index = i + 1;
+	}
+
+	for (i = 0; i < table->used; i++) {
+		liHPackEntry *e = hpack_table_get(table, i);
+		if (e->name->len != namelen || 0 != memcmp(e->name->str, name, namelen)) continue;
+		if (e->value->len == valuelen && 0 == memcmp(e->value->str, value, valuelen)) {
+			hpack_encode_int(out, 0x80, 7, HPACK_STATIC_TABLE_SIZE + 1 + i);
+			return;
+		}
+		if (0 == name_index) name_index = HPACK_STATIC_TABLE_SIZE + 1 + i;
+	}
+
+	if (hpack_never_index(name, namelen) || namelen + valuelen + 32 > table->max_size) {
+		/* literal without indexing */
+		hpack_encode_int(out, 0x00, 4, name_index);
+		if (0 == name_index) hpack_encode_string(out, name, namelen);
+		hpack_encode_string(out, value, valuelen);
+	} else {
+		/* literal with incremental indexing */
+		hpack_encode_int(out, 0x40, 6, name_index);
+		if (0 == name_index) hpack_encode_string(out, name, namelen);
+		hpack_encode_string(out, value, valuelen);
+		hpack_table_add(table, g_string_new_len(name, namelen), g_string_new_len(value, valuelen));
+	}
+}
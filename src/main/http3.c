@@ -0,0 +1,2203 @@
+/* experimental HTTP/3 (RFC 9114) listener: QUIC by ngtcp2 (gnutls crypto backend), HTTP/3 and QPACK by nghttp3 */
+
+#include <lighttpd/base.h>
+#include <lighttpd/plugin_core.h>
+
+#ifdef HAVE_HTTP3
+
+#include <ngtcp2/ngtcp2.h>
+#include <ngtcp2/ngtcp2_crypto.h>
+#include <ngtcp2/ngtcp2_crypto_gnutls.h>
+#include <nghttp3/nghttp3.h>
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+#include <netinet/udp.h>
+
+/* length of the connection ids we issue; short header packets are routed by it. the first 2 bytes are the index of
+ * the worker owning the connection: after a migration the kernel may hash the new path to another worker's socket */
+#define HTTP3_SCID_LEN 18
+
+/* datagrams waiting to be handled by the owning worker; more are dropped */
+#define HTTP3_FORWARD_QUEUE_MAX 1024
+
+/* stateless resets (RFC 9000 10.3) for short header packets with an unknown connection id: smaller packets can't be
+ * protected packets with our connection ids (header protection samples 16 bytes, 4 bytes after the packet number).
+ * the reset is always shorter than the packet triggering it, so two endpoints can't loop, and at most 43 bytes */
+#define HTTP3_STATELESS_RESET_MIN_TRIGGER (1 + HTTP3_SCID_LEN + 4 + 16)
+#define HTTP3_STATELESS_RESET_MAX_LEN 43
+/* per worker and second */
+#define HTTP3_STATELESS_RESET_RATE 100
+
+/* we never send larger datagrams (ngtcp2 default, fits a 1500 bytes MTU) */
+#define HTTP3_MAX_PKT_SIZE 1452
+/* packets per sendmsg(UDP_SEGMENT)/sendmmsg(); GSO allows at most 64KB per call */
+#define HTTP3_SEND_BATCH 32
+
+/* datagrams per recvmmsg(); with UDP_GRO a single "datagram" can hold up to 64KB of coalesced packets */
+#define HTTP3_RECV_BATCH 8
+#define HTTP3_RECV_BUF_SIZE 65536
+/* recvmmsg() calls per wakeup before giving the other watchers a chance */
+#define HTTP3_RECV_ROUNDS 16
+
+/* transport parameters; the stream window is also the liCQLimit of the request body queue */
+#define HTTP3_MAX_CONCURRENT_STREAMS 100
+#define HTTP3_STREAM_WINDOW (64*1024)
+#define HTTP3_CONNECTION_WINDOW (1024*1024)
+#define HTTP3_MAX_HEADER_LIST_SIZE (64*1024)
+/* response body buffered per stream */
+#define HTTP3_STREAM_OUT_LIMIT (64*1024)
+/* response body handed to nghttp3 per read_data call (kept until acknowledged) */
+#define HTTP3_READ_CHUNK (16*1024)
+
+/* same "rapid reset" protection as HTTP/2 */
+#define HTTP3_RESET_LIMIT 200
+#define HTTP3_RESET_INTERVAL 10.0
+
+#define HTTP3_PRIORITY "NORMAL:-VERS-ALL:+VERS-TLS1.3:-CIPHER-ALL:+AES-128-GCM:+AES-256-GCM:+CHACHA20-POLY1305:+AES-128-CCM:" \
+	"-GROUP-ALL:+GROUP-X25519:+GROUP-SECP256R1:+GROUP-SECP384R1:+GROUP-SECP521R1:%DISABLE_TLS13_COMPAT_MODE"
+
+typedef struct http3_listener http3_listener;
+typedef struct http3_socket http3_socket;
+typedef struct http3_connection http3_connection;
+typedef struct http3_stream http3_stream;
+
+struct http3_listener {
+	liServer *srv;
+	GString *addr_str;
+	gnutls_certificate_credentials_t creds;
+
+	GArray *fds; /* one socket per worker (index = worker ndx); -1 after the worker took it */
+	liServerStateWait sw;
+};
+
+struct liHttp3Server {
+	GPtrArray *listeners; /* http3_listener* */
+	guint8 secret[32]; /* for stateless reset tokens */
+};
+
+struct http3_socket {
+	liHttp3Worker *h3w;
+	http3_listener *listener;
+	liEventIO watcher;
+	liSocketAddress local_addr;
+	GString *local_addr_str;
+};
+
+struct liHttp3Worker {
+	liWorker *wrk;
+	GPtrArray *sockets; /* http3_socket* */
+	GHashTable *cids; /* GBytes* (connection id we issued) -> http3_connection* */
+	GQueue connections;
+
+	guint8 *recv_buf; /* HTTP3_RECV_BATCH * HTTP3_RECV_BUF_SIZE */
+	guint8 *send_buf; /* HTTP3_SEND_BATCH * HTTP3_MAX_PKT_SIZE */
+	gboolean gso_disabled; /* sendmsg(UDP_SEGMENT) failed once */
+
+	/* datagrams for our connections received by other workers */
+	GAsyncQueue *forwarded; /* http3_forwarded* */
+	liEventAsync forward_watcher;
+
+	guint resets_sent; /* stateless resets since resets_ts */
+	li_tstamp resets_ts;
+};
+
+typedef struct http3_forwarded http3_forwarded;
+struct http3_forwarded {
+	http3_listener *listener;
+	liSockAddrStorage remote;
+	socklen_t remote_len;
+	guint8 *data;
+	gsize len;
+};
+
+struct http3_connection {
+	liHttp3Worker *h3w;
+	http3_socket *sock;
+	GList link; /* in h3w->connections */
+
+	ngtcp2_conn *qconn;
+	nghttp3_conn *hconn; /* set up when the first stream data arrives */
+	gnutls_session_t session;
+	ngtcp2_conn_ref conn_ref;
+	ngtcp2_ccerr last_error;
+	gboolean error_set;
+
+	liSocketAddress remote_addr;
+	GString *remote_addr_str;
+
+	GPtrArray *cids; /* GBytes* registered in h3w->cids */
+
+	GQueue streams; /* all request streams nghttp3 knows about */
+	GQueue ready; /* streams with something to submit */
+	GQueue closed; /* streams finished on our side, vrequests freed in cleanup_job */
+	liJob write_job, cleanup_job;
+	liEventTimer timer; /* ngtcp2 expiry; frees the connection after the closing/draining period */
+
+	/* streams reset by the peer since reset_ts */
+	guint resets;
+	li_tstamp reset_ts;
+
+	gboolean closing, draining;
+	GByteArray *close_pkt; /* CONNECTION_CLOSE; sent again for packets arriving in the closing period */
+};
+
+struct http3_stream {
+	http3_connection *c;
+	gint64 id;
+	GList link; /* in c->streams */
+
+	liConInfo coninfo;
+	liVRequest *vr;
+
+	/* in: request body (coninfo.req), out: response body (coninfo.resp) */
+	liStream in, out;
+	guint released; /* DESTROY events from in/out and nghttp3 stream close; free after all three */
+
+	liHttp2HeaderCtx hctx;
+
+	guint64 recv_owed; /* request body bytes not yet returned to the peer's stream window */
+
+	GQueue sent; /* GByteArray* handed to nghttp3; kept until acknowledged */
+	gsize sent_acked; /* acknowledged bytes of the head buffer */
+
+	GList sched_link; /* in c->ready or c->closed */
+	gboolean queued;
+
+	gboolean vr_started; /* vrequest handles the request */
+	gboolean remote_closed; /* request stream finished */
+	gboolean discard_body; /* nobody reads the request body */
+	gboolean send_100_continue;
+	gboolean response_ready, headers_sent, skip_body, eof_submitted;
+	gboolean closed; /* finished on our side */
+	gboolean h3_closed; /* nghttp3 closed the stream */
+};
+
+static void http3_stream_close(http3_stream *s);
+static void http3_connection_close(http3_connection *c);
+static const liConCallbacks http3_stream_callbacks;
+
+static ngtcp2_tstamp http3_timestamp(void) {
+	return (ngtcp2_tstamp) g_get_monotonic_time() * NGTCP2_MICROSECONDS;
+}
+
+static void http3_set_app_error(http3_connection *c, guint64 code) {
+	if (c->error_set) return;
+	c->error_set = TRUE;
+	ngtcp2_ccerr_set_application_error(&c->last_error, code, NULL, 0);
+}
+
+static void http3_write_later(http3_connection *c) {
+	li_job_later(&c->h3w->wrk->loop.jobqueue, &c->write_job);
+}
+
+/***********
+ * sending *
+ ***********/
+
+/* buf holds packets of pktlen bytes, the last one may be shorter. datagrams lost in the kernel (EAGAIN) are
+ * handled by QUIC loss recovery */
+static void http3_send_packets(http3_socket *sock, const ngtcp2_addr *remote, const guint8 *buf, gsize len, gsize pktlen) {
+	liHttp3Worker *h3w = sock->h3w;
+	int fd = li_event_io_fd(&sock->watcher);
+	guint npkts = (len + pktlen - 1) / pktlen, i;
+
+#ifdef UDP_SEGMENT
+	if (npkts > 1 && !h3w->gso_disabled) {
+		struct msghdr msg;
+		struct iovec iov;
+		union {
+			char buf[CMSG_SPACE(sizeof(guint16))];
+			struct cmsghdr align;
+		} cmsg_buf;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		memset(&cmsg_buf, 0, sizeof(cmsg_buf));
+		iov.iov_base = (void*) buf;
+		iov.iov_len = len;
+		msg.msg_name = remote->addr;
+		msg.msg_namelen = remote->addrlen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsg_buf.buf;
+		msg.msg_controllen = sizeof(cmsg_buf.buf);
+
+		cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_UDP;
+		cm->cmsg_type = UDP_SEGMENT;
+		cm->cmsg_len = CMSG_LEN(sizeof(guint16));
+		*(guint16*) CMSG_DATA(cm) = (guint16) pktlen;
+
+		if (-1 != sendmsg(fd, &msg, 0)) return;
+
+		switch (errno) {
+		case EIO:
+		case EINVAL:
+			/* no GSO support (driver, or kernel too old) */
+			h3w->gso_disabled = TRUE;
+			break;
+		case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+		case EWOULDBLOCK:
+#endif
+		case EINTR:
+			return;
+		default:
+			ERROR(h3w->wrk->srv, "http3: sendmsg failed: %s", g_strerror(errno));
+			return;
+		}
+	}
+#endif
+
+#ifdef HAVE_SENDMMSG
+	{
+		struct mmsghdr msgs[HTTP3_SEND_BATCH];
+		struct iovec iovs[HTTP3_SEND_BATCH];
+		guint sent = 0;
+
+		memset(msgs, 0, sizeof(msgs[0]) * npkts);
+		for (i = 0; i < npkts; i++) {
+			iovs[i].iov_base = (void*) (buf + i * pktlen);
+			iovs[i].iov_len = MIN(pktlen, len - i * pktlen);
+			msgs[i].msg_hdr.msg_name = remote->addr;
+			msgs[i].msg_hdr.msg_namelen = remote->addrlen;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		while (sent < npkts) {
+			int r = sendmmsg(fd, msgs + sent, npkts - sent, 0);
+			if (-1 == r) {
+				if (EINTR == errno) continue;
+				if (EAGAIN != errno && EWOULDBLOCK != errno) {
+					ERROR(h3w->wrk->srv, "http3: sendmmsg failed: %s", g_strerror(errno));
+				}
+				return;
+			}
+			sent += r;
+		}
+	}
+#else
+	for (i = 0; i < npkts; i++) {
+		if (-1 == sendto(fd, buf + i * pktlen, MIN(pktlen, len - i * pktlen), 0, remote->addr, remote->addrlen)) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+				ERROR(h3w->wrk->srv, "http3: sendto failed: %s", g_strerror(errno));
+			}
+			return;
+		}
+	}
+#endif
+}
+
+static void http3_update_timer(http3_connection *c) {
+	ngtcp2_tstamp expiry = ngtcp2_conn_get_expiry(c->qconn), now = http3_timestamp();
+
+	if (UINT64_MAX == expiry) {
+		li_event_stop(&c->timer);
+	} else if (expiry <= now) {
+		li_event_timer_once(&c->timer, 0);
+	} else {
+		li_event_timer_once(&c->timer, (li_tstamp) (expiry - now) / NGTCP2_SECONDS);
+	}
+}
+
+/***********
+ * streams *
+ ***********/
+
+static void http3_stream_release(http3_stream *s) {
+	if (++s->released < 3) return;
+
+	li_sockaddr_clear(&s->coninfo.remote_addr);
+	li_sockaddr_clear(&s->coninfo.local_addr);
+	g_string_free(s->coninfo.remote_addr_str, TRUE);
+	g_string_free(s->coninfo.local_addr_str, TRUE);
+	g_string_free(s->hctx.authority, TRUE);
+
+	g_slice_free(http3_stream, s);
+}
+
+static void http3_stream_free_sent(http3_stream *s) {
+	GByteArray *buf;
+
+	while (NULL != (buf = g_queue_pop_head(&s->sent))) {
+		g_byte_array_free(buf, TRUE);
+	}
+	s->sent_acked = 0;
+}
+
+/* return consumed request body bytes to the peer's stream window */
+static void http3_stream_extend(http3_stream *s) {
+	http3_connection *c = s->c;
+
+	if (0 == s->recv_owed || s->h3_closed || s->remote_closed) return;
+
+	ngtcp2_conn_extend_max_stream_offset(c->qconn, s->id, s->recv_owed);
+	s->recv_owed = 0;
+	http3_write_later(c);
+}
+
+static void http3_stream_schedule(http3_stream *s) {
+	http3_connection *c = s->c;
+
+	if (s->queued || s->closed) return;
+
+	s->queued = TRUE;
+	g_queue_push_tail_link(&c->ready, &s->sched_link);
+	http3_write_later(c);
+}
+
+/* the request body queue was unlocked: give the peer its window back */
+static void http3_stream_in_limit_cb(gpointer context, gboolean locked) {
+	http3_stream *s = context;
+
+	if (!locked && !s->closed) http3_stream_extend(s);
+}
+
+static void http3_stream_in_cb(liStream *stream, liStreamEvent event) {
+	http3_stream *s = LI_CONTAINER_OF(stream, http3_stream, in);
+
+	switch (event) {
+	case LI_STREAM_DISCONNECTED_DEST:
+		if (s->closed) return;
+		/* nobody wants the (rest of the) request body */
+		s->discard_body = TRUE;
+		li_chunkqueue_skip_all(stream->out);
+		http3_stream_extend(s);
+		break;
+	case LI_STREAM_DESTROY:
+		http3_stream_release(s);
+		break;
+	default:
+		break;
+	}
+}
+
+static void http3_stream_reset(http3_stream *s, guint64 code);
+
+static void http3_stream_out_cb(liStream *stream, liStreamEvent event) {
+	http3_stream *s = LI_CONTAINER_OF(stream, http3_stream, out);
+
+	switch (event) {
+	case LI_STREAM_NEW_DATA:
+		break;
+	case LI_STREAM_CONNECTED_SOURCE:
+		/* the vrequest connects the response stream as signal that the headers are ready */
+		if (s->closed) return;
+		s->response_ready = TRUE;
+		break;
+	case LI_STREAM_DISCONNECTED_SOURCE:
+		if (s->closed || stream->out->is_closed) return;
+		/* li_vrequest_error: handle_response_error follows */
+		if (LI_VRS_ERROR == s->vr->state) return;
+		http3_stream_reset(s, NGHTTP3_H3_INTERNAL_ERROR);
+		return;
+	case LI_STREAM_DESTROY:
+		http3_stream_release(s);
+		return;
+	default:
+		return;
+	}
+
+	if (s->closed) return;
+
+	if (NULL != stream->source && !stream->out->is_closed) {
+		liChunkQueue *source = stream->source->out;
+
+		if (s->skip_body) {
+			li_chunkqueue_skip_all(source);
+		} else {
+			li_chunkqueue_steal_all(stream->out, source);
+		}
+		if (source->is_closed) {
+			stream->out->is_closed = TRUE;
+			li_stream_disconnect(stream);
+		}
+	}
+	s->coninfo.out_queue_length = stream->out->length;
+
+	if (s->response_ready) http3_stream_schedule(s);
+}
+
+static http3_stream* http3_stream_new(http3_connection *c, gint64 id) {
+	liWorker *wrk = c->h3w->wrk;
+	http3_stream *s = g_slice_new0(http3_stream);
+
+	s->c = c;
+	s->id = id;
+	s->link.data = s;
+	s->sched_link.data = s;
+
+	s->coninfo.callbacks = &http3_stream_callbacks;
+	s->coninfo.remote_addr = li_sockaddr_dup(c->remote_addr);
+	s->coninfo.local_addr = li_sockaddr_dup(c->sock->local_addr);
+	s->coninfo.remote_addr_str = g_string_new_len(GSTR_LEN(c->remote_addr_str));
+	s->coninfo.local_addr_str = g_string_new_len(GSTR_LEN(c->sock->local_addr_str));
+	s->coninfo.is_ssl = TRUE;
+	s->coninfo.keep_alive = FALSE; /* connection handling is not up to the vrequest */
+
+	li_stream_init(&s->in, &wrk->loop, http3_stream_in_cb);
+	li_stream_init(&s->out, &wrk->loop, http3_stream_out_cb);
+	s->coninfo.req = &s->in;
+	s->coninfo.resp = &s->out;
+
+	li_chunkqueue_use_limit(s->in.out, HTTP3_STREAM_WINDOW);
+	s->in.out->limit->notify = http3_stream_in_limit_cb;
+	s->in.out->limit->context = s;
+	li_chunkqueue_use_limit(s->out.out, HTTP3_STREAM_OUT_LIMIT);
+
+	g_queue_init(&s->sent);
+
+	s->vr = li_vrequest_new(wrk, &s->coninfo);
+	li_vrequest_start(s->vr);
+
+	s->hctx.req = &s->vr->request;
+	s->hctx.authority = g_string_sized_new(0);
+
+	g_queue_push_tail_link(&c->streams, &s->link);
+
+	return s;
+}
+
+/* stream is done on our side: disconnect it now, free the vrequest in the cleanup job (we might be in one of its
+ * callbacks); the struct stays until nghttp3 closes the stream */
+static void http3_stream_close(http3_stream *s) {
+	http3_connection *c = s->c;
+
+	if (s->closed) return;
+	s->closed = TRUE;
+
+	if (s->queued) {
+		g_queue_unlink(&c->ready, &s->sched_link);
+		s->queued = FALSE;
+	}
+
+	if (!s->remote_closed && !s->h3_closed) {
+		/* we don't need the rest of the request (RFC 9114, 4.1.2) */
+		ngtcp2_conn_shutdown_stream_read(c->qconn, 0, s->id, NGHTTP3_H3_NO_ERROR);
+		if (NULL != c->hconn) nghttp3_conn_shutdown_stream_read(c->hconn, s->id);
+	}
+
+	li_stream_reset(&s->in);
+	li_stream_reset(&s->out);
+
+	g_queue_push_tail_link(&c->closed, &s->sched_link);
+	li_job_later(&c->h3w->wrk->loop.jobqueue, &c->cleanup_job);
+}
+
+static void http3_free_closed_streams(http3_connection *c) {
+	GList *l;
+
+	while (NULL != (l = g_queue_pop_head_link(&c->closed))) {
+		http3_stream *s = l->data;
+
+		li_vrequest_free(s->vr);
+		s->vr = NULL;
+
+		if (NULL != s->in.out->limit) {
+			s->in.out->limit->notify = NULL;
+			s->in.out->limit->context = NULL;
+		}
+
+		li_stream_reset(&s->in);
+		li_stream_reset(&s->out);
+		li_stream_release(&s->in);
+		li_stream_release(&s->out);
+	}
+}
+
+static void http3_cleanup_cb(liJob *job) {
+	http3_connection *c = LI_CONTAINER_OF(job, http3_connection, cleanup_job);
+	http3_free_closed_streams(c);
+}
+
+static void http3_stream_reset(http3_stream *s, guint64 code) {
+	http3_connection *c = s->c;
+
+	if (!s->h3_closed) {
+		ngtcp2_conn_shutdown_stream(c->qconn, 0, s->id, code);
+	}
+	http3_stream_close(s);
+	http3_write_later(c);
+}
+
+/* the peer finished the request body */
+static gboolean http3_stream_end_of_body(http3_stream *s) {
+	liVRequest *vr = s->vr;
+	liChunkQueue *in = s->in.out;
+
+	s->remote_closed = TRUE;
+
+	if (!s->vr_started || s->closed) return TRUE;
+
+	if (-1 == vr->request.content_length) {
+		vr->request.content_length = in->bytes_in;
+	} else if (vr->request.content_length != in->bytes_in) {
+		return FALSE; /* content-length mismatch */
+	}
+	if (!in->is_closed) {
+		in->is_closed = TRUE;
+		li_stream_notify_later(&s->in);
+	}
+	return TRUE;
+}
+
+static void http3_stream_recv_data(http3_stream *s, const guint8 *data, gsize len) {
+	liChunkQueue *in = s->in.out;
+	goffset content_length;
+
+	s->recv_owed += len;
+	s->coninfo.stats.bytes_in += len;
+
+	if (s->closed || s->discard_body) {
+		http3_stream_extend(s);
+		return;
+	}
+
+	content_length = s->vr->request.content_length;
+	if (in->is_closed || (content_length >= 0 && in->bytes_in + (goffset) len > content_length)) {
+		http3_stream_reset(s, NGHTTP3_H3_MESSAGE_ERROR); /* more data than announced */
+		return;
+	}
+
+	li_chunkqueue_append_mem(in, data, len);
+	if (content_length >= 0 && in->bytes_in == content_length) in->is_closed = TRUE;
+	li_stream_notify_later(&s->in);
+
+	if (!in->limit->locked) http3_stream_extend(s);
+}
+
+/* respond with vr->response.http_status without handling the request */
+static void http3_stream_respond_error(http3_stream *s) {
+	liVRequest *vr = s->vr;
+
+	if (0 == vr->response.http_status) vr->response.http_status = 500;
+
+	s->discard_body = TRUE;
+	li_chunkqueue_skip_all(s->in.out);
+	http3_stream_extend(s);
+
+	/* close before disconnecting, otherwise http3_stream_out_cb aborts the stream */
+	li_chunkqueue_skip_all(s->out.out);
+	s->out.out->is_closed = TRUE;
+	li_stream_disconnect(&s->out);
+	s->response_ready = TRUE;
+	http3_stream_schedule(s);
+}
+
+/* request headers complete: validate and start the vrequest */
+static void http3_stream_start(http3_stream *s, gboolean end_stream) {
+	liHttp2HeaderCtx *ctx = &s->hctx;
+	liVRequest *vr = s->vr;
+	liRequest *req = &vr->request;
+	gboolean expect_100_cont = FALSE;
+
+	req->http_version = LI_HTTP_VERSION_3;
+
+	if (ctx->malformed || !ctx->have_method || (LI_HTTP_METHOD_CONNECT != req->http_method && (!ctx->have_scheme || !ctx->have_path))) {
+		http3_stream_reset(s, NGHTTP3_H3_MESSAGE_ERROR);
+		return;
+	}
+
+	s->c->h3w->wrk->stats.requests++;
+
+	if (end_stream) s->remote_closed = TRUE;
+
+	if (ctx->too_large) {
+		VR_INFO(vr, "request headers too large. limit: %u bytes", (guint) HTTP3_MAX_HEADER_LIST_SIZE);
+		vr->response.http_status = 431; /* Request Header Fields Too Large */
+		http3_stream_respond_error(s);
+		return;
+	}
+
+	if (ctx->have_authority) {
+		li_http_header_overwrite(req->headers, CONST_STR_LEN("Host"), GSTR_LEN(ctx->authority));
+	}
+
+	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+		VR_DEBUG(vr, "http3: stream %" G_GINT64_FORMAT ": validating request header", s->id);
+	}
+
+	if (!li_request_validate_header_vr(vr, &expect_100_cont)) {
+		/* set status 400 if not already set */
+		if (0 == vr->response.http_status) vr->response.http_status = 400;
+		http3_stream_respond_error(s);
+		return;
+	}
+
+	if (end_stream) {
+		if (req->content_length > 0) {
+			http3_stream_reset(s, NGHTTP3_H3_MESSAGE_ERROR); /* content-length mismatch */
+			return;
+		}
+		req->content_length = 0;
+	}
+	if (0 == req->content_length) {
+		s->in.out->is_closed = TRUE;
+	} else if (expect_100_cont) {
+		s->send_100_continue = TRUE;
+		http3_stream_schedule(s);
+	}
+
+	s->vr_started = TRUE;
+	li_action_enter(vr, vr->wrk->srv->mainaction);
+	li_vrequest_handle_request_headers(vr);
+}
+
+/* nghttp3 pulls the response body; the buffers are kept until acknowledged */
+static nghttp3_ssize http3_read_data(nghttp3_conn *hconn, int64_t stream_id, nghttp3_vec *vec, size_t veccnt,
+		uint32_t *pflags, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	liChunkQueue *body;
+	GByteArray *buf;
+	goffset len;
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(veccnt); UNUSED(conn_user_data);
+
+	if (NULL == s || s->closed) {
+		/* reset by us; ngtcp2 drops whatever is left */
+		*pflags |= NGHTTP3_DATA_FLAG_EOF;
+		return 0;
+	}
+
+	body = s->out.out;
+	if (0 == body->length) {
+		if (!body->is_closed) return NGHTTP3_ERR_WOULDBLOCK;
+		*pflags |= NGHTTP3_DATA_FLAG_EOF;
+		s->eof_submitted = TRUE;
+		http3_stream_schedule(s);
+		return 0;
+	}
+
+	len = MIN(body->length, HTTP3_READ_CHUNK);
+	buf = g_byte_array_sized_new(len);
+	if (!li_chunkqueue_extract_to_bytearr(body, len, buf, NULL)) {
+		g_byte_array_free(buf, TRUE);
+		return NGHTTP3_ERR_CALLBACK_FAILURE;
+	}
+	li_chunkqueue_skip(body, len);
+	g_queue_push_tail(&s->sent, buf);
+
+	vec[0].base = buf->data;
+	vec[0].len = buf->len;
+
+	s->coninfo.stats.bytes_out += len;
+	s->coninfo.out_queue_length = body->length;
+
+	if (body->is_closed && 0 == body->length) {
+		*pflags |= NGHTTP3_DATA_FLAG_EOF;
+		s->eof_submitted = TRUE;
+		http3_stream_schedule(s);
+	}
+
+	return 1;
+}
+
+static void http3_stream_send_headers(http3_stream *s) {
+	http3_connection *c = s->c;
+	liVRequest *vr = s->vr;
+	liChunkQueue *body = s->out.out;
+	gboolean have_real_body, end_stream;
+	gchar status_str[3];
+	GArray *nva = g_array_sized_new(FALSE, FALSE, sizeof(nghttp3_nv), 16);
+	GString *names;
+	nghttp3_nv nv;
+	gsize names_len = 0, pos = 0;
+	liHttpHeader *header;
+	GList *iter;
+	gboolean have_date = FALSE, have_server = FALSE;
+	int rv;
+
+	s->headers_sent = TRUE;
+
+	if (vr->response.http_status < 200 || vr->response.http_status > 999) {
+		VR_ERROR(vr, "wrong status: %i, internal error", vr->response.http_status);
+		vr->response.http_status = 500;
+		li_http_headers_reset(vr->response.headers);
+		li_chunkqueue_skip_all(body);
+		body->is_closed = TRUE;
+		li_stream_disconnect(&s->out);
+	}
+
+	have_real_body = (body->length > 0) || !body->is_closed;
+
+	if (!have_real_body && vr->response.http_status >= 400 && vr->response.http_status < 600) {
+		li_response_send_error_page(vr, body);
+	}
+
+	if (vr->response.http_status == 204 || vr->response.http_status == 205 || vr->response.http_status == 304) {
+		/* They never have a content-body/length */
+		s->skip_body = TRUE;
+	} else if (body->is_closed) {
+		if (vr->request.http_method != LI_HTTP_METHOD_HEAD || body->length > 0) {
+			/* do not send content-length: 0 if backend already skipped content generation for HEAD */
+			g_string_printf(vr->wrk->tmp_str, "%"LI_GOFFSET_FORMAT, body->length);
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Length"), GSTR_LEN(vr->wrk->tmp_str));
+		}
+	}
+	if (vr->request.http_method == LI_HTTP_METHOD_HEAD) s->skip_body = TRUE;
+
+	if (s->skip_body) li_chunkqueue_skip_all(body);
+
+	li_http_status_to_str(vr->response.http_status, status_str);
+	nv.name = (uint8_t*) ":status";
+	nv.namelen = sizeof(":status") - 1;
+	nv.value = (uint8_t*) status_str;
+	nv.valuelen = 3;
+	nv.flags = NGHTTP3_NV_FLAG_NONE;
+	g_array_append_val(nva, nv);
+
+	/* field names have to be lowercase; reserve all of them first so the buffer doesn't move */
+	for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
+		header = (liHttpHeader*) iter->data;
+		names_len += header->keylen;
+	}
+	names = g_string_sized_new(names_len);
+	g_string_set_size(names, names_len);
+
+	for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
+		gsize i;
+		header = (liHttpHeader*) iter->data;
+		/* connection-specific header fields are not allowed in HTTP/3 */
+		if (li_http_header_key_is(header, CONST_STR_LEN("connection"))
+		    || li_http_header_key_is(header, CONST_STR_LEN("keep-alive"))
+		    || li_http_header_key_is(header, CONST_STR_LEN("proxy-connection"))
+		    || li_http_header_key_is(header, CONST_STR_LEN("transfer-encoding"))
+		    || li_http_header_key_is(header, CONST_STR_LEN("upgrade"))) continue;
+
+		for (i = 0; i < header->keylen; i++) names->str[pos + i] = g_ascii_tolower(header->data->str[i]);
+
+		nv.name = (uint8_t*) names->str + pos;
+		nv.namelen = header->keylen;
+		nv.value = (uint8_t*) LI_HEADER_VALUE(header);
+		nv.valuelen = header->data->len - header->keylen - 2;
+		g_array_append_val(nva, nv);
+		pos += header->keylen;
+
+		if (!have_date && li_http_header_key_is(header, CONST_STR_LEN("date"))) have_date = TRUE;
+		if (!have_server && li_http_header_key_is(header, CONST_STR_LEN("server"))) have_server = TRUE;
+	}
+
+	if (!have_date) {
+		GString *d = li_worker_current_timestamp(vr->wrk, LI_GMTIME, LI_TS_FORMAT_HEADER);
+		nv.name = (uint8_t*) "date";
+		nv.namelen = sizeof("date") - 1;
+		nv.value = (uint8_t*) d->str;
+		nv.valuelen = d->len;
+		g_array_append_val(nva, nv);
+	}
+
+	if (!have_server) {
+		GString *tag = CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_TAG).string;
+
+		if (tag->len) {
+			nv.name = (uint8_t*) "server";
+			nv.namelen = sizeof("server") - 1;
+			nv.value = (uint8_t*) tag->str;
+			nv.valuelen = tag->len;
+			g_array_append_val(nva, nv);
+		}
+	}
+
+	end_stream = s->skip_body || (body->is_closed && 0 == body->length);
+
+	if (end_stream) {
+		rv = nghttp3_conn_submit_response(c->hconn, s->id, (nghttp3_nv*) nva->data, nva->len, NULL);
+	} else {
+		nghttp3_data_reader dr;
+		dr.read_data = http3_read_data;
+		rv = nghttp3_conn_submit_response(c->hconn, s->id, (nghttp3_nv*) nva->data, nva->len, &dr);
+	}
+	g_array_free(nva, TRUE);
+	g_string_free(names, TRUE); /* nghttp3 copies the fields */
+
+	if (0 != rv) {
+		VR_ERROR(vr, "http3: submitting response failed: %s", nghttp3_strerror(rv));
+		http3_stream_reset(s, NGHTTP3_H3_INTERNAL_ERROR);
+		return;
+	}
+
+	if (end_stream) http3_stream_close(s);
+}
+
+/* submit what the streams have ready; runs in the write job, never from ngtcp2/nghttp3 callbacks */
+static void http3_handle_ready(http3_connection *c) {
+	GList *l;
+
+	while (NULL != (l = g_queue_pop_head_link(&c->ready))) {
+		http3_stream *s = l->data;
+		s->queued = FALSE;
+
+		if (s->h3_closed || NULL == c->hconn) {
+			http3_stream_close(s);
+		} else if (s->eof_submitted) {
+			http3_stream_close(s);
+		} else if (!s->headers_sent) {
+			if (s->send_100_continue) {
+				nghttp3_nv nv;
+				s->send_100_continue = FALSE;
+				nv.name = (uint8_t*) ":status";
+				nv.namelen = sizeof(":status") - 1;
+				nv.value = (uint8_t*) "100";
+				nv.valuelen = 3;
+				nv.flags = NGHTTP3_NV_FLAG_NONE;
+				nghttp3_conn_submit_info(c->hconn, s->id, &nv, 1);
+			}
+			if (s->response_ready) http3_stream_send_headers(s);
+		} else {
+			nghttp3_conn_resume_stream(c->hconn, s->id);
+		}
+	}
+}
+
+/**********************
+ * nghttp3 callbacks *
+ **********************/
+
+static int http3_h3_acked_stream_data(nghttp3_conn *hconn, int64_t stream_id, uint64_t datalen, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(conn_user_data);
+
+	if (NULL == s) return 0;
+
+	while (datalen > 0) {
+		GByteArray *buf = g_queue_peek_head(&s->sent);
+		gsize n;
+
+		if (NULL == buf) break;
+		n = MIN(datalen, buf->len - s->sent_acked);
+		s->sent_acked += n;
+		datalen -= n;
+		if (s->sent_acked == buf->len) {
+			g_byte_array_free(g_queue_pop_head(&s->sent), TRUE);
+			s->sent_acked = 0;
+		}
+	}
+
+	return 0;
+}
+
+static int http3_h3_stream_close(nghttp3_conn *hconn, int64_t stream_id, uint64_t app_error_code, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn); UNUSED(stream_id);
+
+	if (NULL == s) return 0;
+
+	s->h3_closed = TRUE;
+	http3_stream_free_sent(s);
+	g_queue_unlink(&c->streams, &s->link);
+
+	if (!s->closed) {
+		/* aborted by the peer */
+		li_tstamp now = li_cur_ts(c->h3w->wrk);
+
+		s->coninfo.aborted = TRUE;
+		http3_stream_close(s);
+
+		if (NGHTTP3_H3_NO_ERROR != app_error_code) {
+			if (now - c->reset_ts > HTTP3_RESET_INTERVAL) {
+				c->reset_ts = now;
+				c->resets = 0;
+			}
+			if (++c->resets > HTTP3_RESET_LIMIT) {
+				http3_set_app_error(c, NGHTTP3_H3_EXCESSIVE_LOAD);
+				http3_stream_release(s);
+				return NGHTTP3_ERR_CALLBACK_FAILURE;
+			}
+		}
+	}
+
+	http3_stream_release(s);
+	return 0;
+}
+
+static int http3_h3_recv_data(nghttp3_conn *hconn, int64_t stream_id, const uint8_t *data, size_t datalen, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn);
+
+	/* the connection window is returned right away; the stream windows limit what can be buffered */
+	ngtcp2_conn_extend_max_offset(c->qconn, datalen);
+
+	if (NULL == s) {
+		ngtcp2_conn_extend_max_stream_offset(c->qconn, stream_id, datalen);
+		return 0;
+	}
+
+	http3_stream_recv_data(s, data, datalen);
+	return 0;
+}
+
+static int http3_h3_deferred_consume(nghttp3_conn *hconn, int64_t stream_id, size_t consumed, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	UNUSED(hconn); UNUSED(stream_user_data);
+
+	ngtcp2_conn_extend_max_stream_offset(c->qconn, stream_id, consumed);
+	ngtcp2_conn_extend_max_offset(c->qconn, consumed);
+	return 0;
+}
+
+static int http3_h3_begin_headers(nghttp3_conn *hconn, int64_t stream_id, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	http3_stream *s;
+	UNUSED(stream_user_data);
+
+	s = http3_stream_new(c, stream_id);
+	nghttp3_conn_set_stream_user_data(hconn, stream_id, s);
+	return 0;
+}
+
+static int http3_h3_recv_header(nghttp3_conn *hconn, int64_t stream_id, int32_t token, nghttp3_rcbuf *name, nghttp3_rcbuf *value,
+		uint8_t flags, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	nghttp3_vec n = nghttp3_rcbuf_get_buf(name), v = nghttp3_rcbuf_get_buf(value);
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(token); UNUSED(flags); UNUSED(conn_user_data);
+
+	if (NULL == s || s->closed) return 0;
+
+	li_http2_request_header(&s->hctx, (const gchar*) n.base, n.len, (const gchar*) v.base, v.len);
+	return 0;
+}
+
+static int http3_h3_end_headers(nghttp3_conn *hconn, int64_t stream_id, int fin, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(conn_user_data);
+
+	if (NULL == s || s->closed) return 0;
+
+	http3_stream_start(s, fin);
+	return 0;
+}
+
+static int http3_h3_begin_trailers(nghttp3_conn *hconn, int64_t stream_id, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(conn_user_data);
+
+	if (NULL != s) s->hctx.trailers = TRUE;
+	return 0;
+}
+
+static int http3_h3_end_stream(nghttp3_conn *hconn, int64_t stream_id, void *conn_user_data, void *stream_user_data) {
+	http3_stream *s = stream_user_data;
+	UNUSED(hconn); UNUSED(stream_id); UNUSED(conn_user_data);
+
+	if (NULL == s) return 0;
+
+	if (!http3_stream_end_of_body(s)) {
+		http3_stream_reset(s, NGHTTP3_H3_MESSAGE_ERROR);
+	}
+	return 0;
+}
+
+static int http3_h3_stop_sending(nghttp3_conn *hconn, int64_t stream_id, uint64_t app_error_code, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	UNUSED(hconn); UNUSED(stream_user_data);
+
+	ngtcp2_conn_shutdown_stream_read(c->qconn, 0, stream_id, app_error_code);
+	return 0;
+}
+
+static int http3_h3_reset_stream(nghttp3_conn *hconn, int64_t stream_id, uint64_t app_error_code, void *conn_user_data, void *stream_user_data) {
+	http3_connection *c = conn_user_data;
+	UNUSED(hconn); UNUSED(stream_user_data);
+
+	ngtcp2_conn_shutdown_stream_write(c->qconn, 0, stream_id, app_error_code);
+	return 0;
+}
+
+/* control stream and QPACK streams */
+static gboolean http3_setup_h3(http3_connection *c) {
+	nghttp3_callbacks callbacks;
+	nghttp3_settings settings;
+	const ngtcp2_transport_params *params;
+	int64_t ctrl_id, enc_id, dec_id;
+
+	if (ngtcp2_conn_get_streams_uni_left(c->qconn) < 3) return FALSE;
+
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.acked_stream_data = http3_h3_acked_stream_data;
+	callbacks.stream_close = http3_h3_stream_close;
+	callbacks.recv_data = http3_h3_recv_data;
+	callbacks.deferred_consume = http3_h3_deferred_consume;
+	callbacks.begin_headers = http3_h3_begin_headers;
+	callbacks.recv_header = http3_h3_recv_header;
+	callbacks.end_headers = http3_h3_end_headers;
+	callbacks.begin_trailers = http3_h3_begin_trailers;
+	callbacks.recv_trailer = http3_h3_recv_header;
+	callbacks.end_stream = http3_h3_end_stream;
+	callbacks.stop_sending = http3_h3_stop_sending;
+	callbacks.reset_stream = http3_h3_reset_stream;
+
+	nghttp3_settings_default(&settings);
+	settings.qpack_max_dtable_capacity = 4096;
+	settings.qpack_blocked_streams = 100;
+	settings.max_field_section_size = HTTP3_MAX_HEADER_LIST_SIZE;
+
+	if (0 != nghttp3_conn_server_new(&c->hconn, &callbacks, &settings, NULL, c)) return FALSE;
+
+	params = ngtcp2_conn_get_local_transport_params(c->qconn);
+	nghttp3_conn_set_max_client_streams_bidi(c->hconn, params->initial_max_streams_bidi);
+
+	if (0 != ngtcp2_conn_open_uni_stream(c->qconn, &ctrl_id, NULL)) return FALSE;
+	if (0 != nghttp3_conn_bind_control_stream(c->hconn, ctrl_id)) return FALSE;
+	if (0 != ngtcp2_conn_open_uni_stream(c->qconn, &enc_id, NULL)) return FALSE;
+	if (0 != ngtcp2_conn_open_uni_stream(c->qconn, &dec_id, NULL)) return FALSE;
+	if (0 != nghttp3_conn_bind_qpack_streams(c->hconn, enc_id, dec_id)) return FALSE;
+
+	return TRUE;
+}
+
+/********************
+ * ngtcp2 callbacks *
+ ********************/
+
+static ngtcp2_conn* http3_get_conn(ngtcp2_conn_ref *conn_ref) {
+	http3_connection *c = conn_ref->user_data;
+	return c->qconn;
+}
+
+static void http3_quic_rand(uint8_t *dest, size_t destlen, const ngtcp2_rand_ctx *rand_ctx) {
+	UNUSED(rand_ctx);
+	gnutls_rnd(GNUTLS_RND_RANDOM, dest, destlen);
+}
+
+/* random, apart from the worker index in the first 2 bytes */
+static void http3_new_cid(liHttp3Worker *h3w, guint8 *data, gsize len) {
+	LI_FORCE_ASSERT(len >= 2);
+	gnutls_rnd(GNUTLS_RND_RANDOM, data, len);
+	data[0] = (h3w->wrk->ndx >> 8) & 0xff;
+	data[1] = h3w->wrk->ndx & 0xff;
+}
+
+static void http3_register_cid(http3_connection *c, const guint8 *data, gsize len) {
+	GBytes *cid = g_bytes_new(data, len);
+
+	g_hash_table_insert(c->h3w->cids, g_bytes_ref(cid), c);
+	g_ptr_array_add(c->cids, cid);
+}
+
+static int http3_quic_get_new_connection_id(ngtcp2_conn *qconn, ngtcp2_cid *cid, uint8_t *token, size_t cidlen, void *user_data) {
+	http3_connection *c = user_data;
+	liHttp3Server *h3s = c->h3w->wrk->srv->http3;
+	UNUSED(qconn);
+
+	http3_new_cid(c->h3w, cid->data, cidlen);
+	cid->datalen = cidlen;
+	if (0 != ngtcp2_crypto_generate_stateless_reset_token(token, h3s->secret, sizeof(h3s->secret), cid)) {
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+
+	http3_register_cid(c, cid->data, cid->datalen);
+	return 0;
+}
+
+static int http3_quic_remove_connection_id(ngtcp2_conn *qconn, const ngtcp2_cid *cid, void *user_data) {
+	http3_connection *c = user_data;
+	GBytes *key = g_bytes_new_static(cid->data, cid->datalen);
+	guint i;
+	UNUSED(qconn);
+
+	g_hash_table_remove(c->h3w->cids, key);
+	for (i = 0; i < c->cids->len; i++) {
+		if (g_bytes_equal(g_ptr_array_index(c->cids, i), key)) {
+			g_ptr_array_remove_index_fast(c->cids, i);
+			break;
+		}
+	}
+	g_bytes_unref(key);
+	return 0;
+}
+
+static int http3_quic_recv_stream_data(ngtcp2_conn *qconn, uint32_t flags, int64_t stream_id, uint64_t offset,
+		const uint8_t *data, size_t datalen, void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	nghttp3_ssize consumed;
+	UNUSED(offset); UNUSED(stream_user_data);
+
+	if (NULL == c->hconn && !http3_setup_h3(c)) {
+		http3_set_app_error(c, NGHTTP3_H3_INTERNAL_ERROR);
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+
+	consumed = nghttp3_conn_read_stream(c->hconn, stream_id, data, datalen, flags & NGTCP2_STREAM_DATA_FLAG_FIN);
+	if (consumed < 0) {
+		http3_set_app_error(c, nghttp3_err_infer_quic_app_error_code((int) consumed));
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+
+	/* request body bytes are not included: they are returned when the vrequest consumed them */
+	ngtcp2_conn_extend_max_stream_offset(qconn, stream_id, consumed);
+	ngtcp2_conn_extend_max_offset(qconn, consumed);
+	return 0;
+}
+
+static int http3_quic_acked_stream_data_offset(ngtcp2_conn *qconn, int64_t stream_id, uint64_t offset, uint64_t datalen,
+		void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	UNUSED(qconn); UNUSED(offset); UNUSED(stream_user_data);
+
+	if (NULL != c->hconn && 0 != nghttp3_conn_add_ack_offset(c->hconn, stream_id, datalen)) {
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+	return 0;
+}
+
+static int http3_quic_stream_close(ngtcp2_conn *qconn, uint32_t flags, int64_t stream_id, uint64_t app_error_code,
+		void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	UNUSED(stream_user_data);
+
+	if (!(flags & NGTCP2_STREAM_CLOSE_FLAG_APP_ERROR_CODE_SET)) app_error_code = NGHTTP3_H3_NO_ERROR;
+
+	if (NULL != c->hconn) {
+		int rv = nghttp3_conn_close_stream(c->hconn, stream_id, app_error_code);
+		if (0 != rv && NGHTTP3_ERR_STREAM_NOT_FOUND != rv) {
+			http3_set_app_error(c, nghttp3_err_infer_quic_app_error_code(rv));
+			return NGTCP2_ERR_CALLBACK_FAILURE;
+		}
+	}
+
+	if (ngtcp2_is_bidi_stream(stream_id)) ngtcp2_conn_extend_max_streams_bidi(qconn, 1);
+	return 0;
+}
+
+static int http3_quic_stream_reset(ngtcp2_conn *qconn, int64_t stream_id, uint64_t final_size, uint64_t app_error_code,
+		void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	UNUSED(qconn); UNUSED(final_size); UNUSED(app_error_code); UNUSED(stream_user_data);
+
+	if (NULL != c->hconn && 0 != nghttp3_conn_shutdown_stream_read(c->hconn, stream_id)) {
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+	return 0;
+}
+
+static int http3_quic_stream_stop_sending(ngtcp2_conn *qconn, int64_t stream_id, uint64_t app_error_code,
+		void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	UNUSED(qconn); UNUSED(app_error_code); UNUSED(stream_user_data);
+
+	if (NULL != c->hconn && 0 != nghttp3_conn_shutdown_stream_read(c->hconn, stream_id)) {
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+	return 0;
+}
+
+static int http3_quic_extend_max_remote_streams_bidi(ngtcp2_conn *qconn, uint64_t max_streams, void *user_data) {
+	http3_connection *c = user_data;
+	UNUSED(qconn);
+
+	if (NULL != c->hconn) nghttp3_conn_set_max_client_streams_bidi(c->hconn, max_streams);
+	return 0;
+}
+
+static int http3_quic_extend_max_stream_data(ngtcp2_conn *qconn, int64_t stream_id, uint64_t max_data,
+		void *user_data, void *stream_user_data) {
+	http3_connection *c = user_data;
+	UNUSED(qconn); UNUSED(max_data); UNUSED(stream_user_data);
+
+	if (NULL != c->hconn && 0 != nghttp3_conn_unblock_stream(c->hconn, stream_id)) {
+		return NGTCP2_ERR_CALLBACK_FAILURE;
+	}
+	return 0;
+}
+
+/***************
+ * connections *
+ ***************/
+
+static void http3_connection_free(http3_connection *c) {
+	liHttp3Worker *h3w = c->h3w;
+	GList *l;
+	guint i;
+
+	g_queue_unlink(&h3w->connections, &c->link);
+
+	for (i = 0; i < c->cids->len; i++) {
+		g_hash_table_remove(h3w->cids, g_ptr_array_index(c->cids, i));
+	}
+	g_ptr_array_free(c->cids, TRUE);
+
+	while (NULL != (l = g_queue_pop_head_link(&c->streams))) {
+		http3_stream *s = l->data;
+
+		s->coninfo.aborted = !s->closed;
+		http3_stream_close(s);
+		s->h3_closed = TRUE;
+		http3_stream_free_sent(s);
+		http3_stream_release(s);
+	}
+	http3_free_closed_streams(c);
+
+	li_job_clear(&c->write_job);
+	li_job_clear(&c->cleanup_job);
+	li_event_clear(&c->timer);
+
+	if (NULL != c->hconn) nghttp3_conn_del(c->hconn);
+	ngtcp2_conn_del(c->qconn);
+	gnutls_deinit(c->session);
+
+	if (NULL != c->close_pkt) g_byte_array_free(c->close_pkt, TRUE);
+	li_sockaddr_clear(&c->remote_addr);
+	g_string_free(c->remote_addr_str, TRUE);
+
+	g_slice_free(http3_connection, c);
+}
+
+/* start the closing period: send CONNECTION_CLOSE, free the connection after 3*PTO (RFC 9000, 10.2) */
+static void http3_connection_close(http3_connection *c) {
+	ngtcp2_path_storage ps;
+	ngtcp2_pkt_info pi;
+	guint8 *buf = c->h3w->send_buf;
+	ngtcp2_ssize n;
+
+	if (c->closing || c->draining) return;
+	c->closing = TRUE;
+
+	if (!ngtcp2_conn_in_closing_period(c->qconn) && !ngtcp2_conn_in_draining_period(c->qconn)) {
+		ngtcp2_path_storage_zero(&ps);
+		n = ngtcp2_conn_write_connection_close(c->qconn, &ps.path, &pi, buf, HTTP3_MAX_PKT_SIZE, &c->last_error, http3_timestamp());
+		if (n > 0) {
+			c->close_pkt = g_byte_array_sized_new(n);
+			g_byte_array_append(c->close_pkt, buf, n);
+			http3_send_packets(c->sock, &ps.path.remote, buf, n, n);
+		}
+	}
+
+	li_event_timer_once(&c->timer, 3.0 * ngtcp2_conn_get_pto(c->qconn) / NGTCP2_SECONDS);
+}
+
+static void http3_connection_start_draining(http3_connection *c) {
+	if (c->closing || c->draining) return;
+	c->draining = TRUE;
+
+	li_event_timer_once(&c->timer, 3.0 * ngtcp2_conn_get_pto(c->qconn) / NGTCP2_SECONDS);
+}
+
+static void http3_connection_write(http3_connection *c) {
+	liHttp3Worker *h3w = c->h3w;
+	guint8 *buf = h3w->send_buf;
+	ngtcp2_path_storage ps;
+	ngtcp2_pkt_info pi;
+	ngtcp2_tstamp ts = http3_timestamp();
+	gsize max_pkt = ngtcp2_conn_get_path_max_tx_udp_payload_size(c->qconn);
+	gsize max_pkts, buflen = 0, pktlen = 0;
+	guint npkts = 0;
+
+	if (c->closing || c->draining) return;
+
+	http3_handle_ready(c);
+
+	max_pkts = ngtcp2_conn_get_send_quantum(c->qconn) / MAX(max_pkt, 1);
+	max_pkts = CLAMP(max_pkts, 1, HTTP3_SEND_BATCH);
+
+	ngtcp2_path_storage_zero(&ps);
+
+	for (;;) {
+		int64_t stream_id = -1;
+		int fin = 0;
+		nghttp3_vec vec[16];
+		nghttp3_ssize sveccnt = 0;
+		ngtcp2_ssize nwrite, ndatalen = -1;
+		uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
+
+		if (NULL != c->hconn && ngtcp2_conn_get_max_data_left(c->qconn)) {
+			sveccnt = nghttp3_conn_writev_stream(c->hconn, &stream_id, &fin, vec, G_N_ELEMENTS(vec));
+			if (sveccnt < 0) {
+				http3_set_app_error(c, nghttp3_err_infer_quic_app_error_code((int) sveccnt));
+				goto error;
+			}
+		}
+		if (fin) flags |= NGTCP2_WRITE_STREAM_FLAG_FIN;
+
+		nwrite = ngtcp2_conn_writev_stream(c->qconn, &ps.path, &pi, buf + buflen, max_pkt, &ndatalen, flags,
+			stream_id, (const ngtcp2_vec*) vec, (size_t) sveccnt, ts);
+
+		if (nwrite < 0) {
+			switch (nwrite) {
+			case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+				nghttp3_conn_block_stream(c->hconn, stream_id);
+				continue;
+			case NGTCP2_ERR_STREAM_SHUT_WR:
+				nghttp3_conn_shutdown_stream_write(c->hconn, stream_id);
+				continue;
+			case NGTCP2_ERR_WRITE_MORE:
+				if (0 != nghttp3_conn_add_write_offset(c->hconn, stream_id, ndatalen)) goto error;
+				continue;
+			default:
+				if (!c->error_set) {
+					c->error_set = TRUE;
+					ngtcp2_ccerr_set_liberr(&c->last_error, (int) nwrite, NULL, 0);
+				}
+				goto error;
+			}
+		}
+
+		if (ndatalen >= 0 && 0 != nghttp3_conn_add_write_offset(c->hconn, stream_id, ndatalen)) goto error;
+
+		if (0 == nwrite) break;
+
+		/* GSO: all packets but the last one of a batch have the same size */
+		if (npkts > 0 && (gsize) nwrite > pktlen) {
+			http3_send_packets(c->sock, &ps.path.remote, buf, buflen, pktlen);
+			memmove(buf, buf + buflen, nwrite);
+			buflen = 0;
+			npkts = 0;
+		}
+		if (0 == npkts) pktlen = nwrite;
+		buflen += nwrite;
+		npkts++;
+
+		if ((gsize) nwrite < pktlen || npkts >= max_pkts) {
+			gboolean full = (npkts >= max_pkts);
+			http3_send_packets(c->sock, &ps.path.remote, buf, buflen, pktlen);
+			buflen = 0;
+			npkts = 0;
+			/* send quantum reached; the timer continues after the pacing delay */
+			if (full) break;
+		}
+	}
+
+	if (npkts > 0) http3_send_packets(c->sock, &ps.path.remote, buf, buflen, pktlen);
+
+	ngtcp2_conn_update_pkt_tx_time(c->qconn, ts);
+	http3_update_timer(c);
+	return;
+
+error:
+	http3_connection_close(c);
+}
+
+static void http3_write_cb(liJob *job) {
+	http3_connection *c = LI_CONTAINER_OF(job, http3_connection, write_job);
+	http3_connection_write(c);
+}
+
+static void http3_timer_cb(liEventBase *watcher, int events) {
+	http3_connection *c = LI_CONTAINER_OF(li_event_timer_from(watcher), http3_connection, timer);
+	int rv;
+	UNUSED(events);
+
+	if (c->closing || c->draining) {
+		http3_connection_free(c);
+		return;
+	}
+
+	rv = ngtcp2_conn_handle_expiry(c->qconn, http3_timestamp());
+	if (0 != rv) {
+		if (NGTCP2_ERR_IDLE_CLOSE == rv) {
+			/* silently (RFC 9000, 10.1) */
+			http3_connection_free(c);
+			return;
+		}
+		if (!c->error_set) {
+			c->error_set = TRUE;
+			ngtcp2_ccerr_set_liberr(&c->last_error, rv, NULL, 0);
+		}
+		http3_connection_close(c);
+		return;
+	}
+
+	http3_connection_write(c);
+}
+
+static void http3_connection_read(http3_connection *c, const liSockAddrStorage *remote, socklen_t remote_len, const guint8 *data, gsize len) {
+	ngtcp2_path path;
+	ngtcp2_pkt_info pi;
+	int rv;
+
+	if (c->draining) return;
+	if (c->closing) {
+		/* the peer didn't get our CONNECTION_CLOSE yet */
+		if (NULL != c->close_pkt) {
+			ngtcp2_addr remote_ngaddr;
+			remote_ngaddr.addr = (ngtcp2_sockaddr*) &remote->plain;
+			remote_ngaddr.addrlen = remote_len;
+			http3_send_packets(c->sock, &remote_ngaddr, c->close_pkt->data, c->close_pkt->len, c->close_pkt->len);
+		}
+		return;
+	}
+
+	memset(&path, 0, sizeof(path));
+	path.local.addr = c->sock->local_addr.addr_up.plain;
+	path.local.addrlen = c->sock->local_addr.len;
+	path.remote.addr = (ngtcp2_sockaddr*) &remote->plain;
+	path.remote.addrlen = remote_len;
+	memset(&pi, 0, sizeof(pi));
+
+	rv = ngtcp2_conn_read_pkt(c->qconn, &path, &pi, data, len, http3_timestamp());
+	if (0 != rv) {
+		switch (rv) {
+		case NGTCP2_ERR_DRAINING:
+			http3_connection_start_draining(c);
+			return;
+		case NGTCP2_ERR_DROP_CONN:
+			http3_connection_free(c);
+			return;
+		case NGTCP2_ERR_CRYPTO:
+			if (!c->error_set) {
+				c->error_set = TRUE;
+				ngtcp2_ccerr_set_tls_alert(&c->last_error, ngtcp2_conn_get_tls_alert(c->qconn), NULL, 0);
+			}
+			break;
+		default:
+			if (!c->error_set) {
+				c->error_set = TRUE;
+				ngtcp2_ccerr_set_liberr(&c->last_error, rv, NULL, 0);
+			}
+			break;
+		}
+		http3_connection_close(c);
+		return;
+	}
+
+	http3_write_later(c);
+}
+
+static http3_connection* http3_connection_accept(http3_socket *sock, const liSockAddrStorage *remote, socklen_t remote_len, const guint8 *data, gsize len) {
+	liHttp3Worker *h3w = sock->h3w;
+	liServer *srv = h3w->wrk->srv;
+	http3_connection *c;
+	ngtcp2_pkt_hd hd;
+	ngtcp2_cid scid;
+	ngtcp2_callbacks callbacks;
+	ngtcp2_settings settings;
+	ngtcp2_transport_params params;
+	ngtcp2_path path;
+	gnutls_datum_t alpn = { (unsigned char*) "h3", 2 };
+	liSocketAddress remote_addr;
+	int rv;
+
+	if (!g_atomic_int_get(&srv->listening)) return NULL;
+	if (0 != ngtcp2_accept(&hd, data, len)) return NULL;
+
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.recv_client_initial = ngtcp2_crypto_recv_client_initial_cb;
+	callbacks.recv_crypto_data = ngtcp2_crypto_recv_crypto_data_cb;
+	callbacks.encrypt = ngtcp2_crypto_encrypt_cb;
+	callbacks.decrypt = ngtcp2_crypto_decrypt_cb;
+	callbacks.hp_mask = ngtcp2_crypto_hp_mask_cb;
+	callbacks.update_key = ngtcp2_crypto_update_key_cb;
+	callbacks.delete_crypto_aead_ctx = ngtcp2_crypto_delete_crypto_aead_ctx_cb;
+	callbacks.delete_crypto_cipher_ctx = ngtcp2_crypto_delete_crypto_cipher_ctx_cb;
+	callbacks.get_path_challenge_data = ngtcp2_crypto_get_path_challenge_data_cb;
+	callbacks.version_negotiation = ngtcp2_crypto_version_negotiation_cb;
+	callbacks.rand = http3_quic_rand;
+	callbacks.get_new_connection_id = http3_quic_get_new_connection_id;
+	callbacks.remove_connection_id = http3_quic_remove_connection_id;
+	callbacks.recv_stream_data = http3_quic_recv_stream_data;
+	callbacks.acked_stream_data_offset = http3_quic_acked_stream_data_offset;
+	callbacks.stream_close = http3_quic_stream_close;
+	callbacks.stream_reset = http3_quic_stream_reset;
+	callbacks.stream_stop_sending = http3_quic_stream_stop_sending;
+	callbacks.extend_max_remote_streams_bidi = http3_quic_extend_max_remote_streams_bidi;
+	callbacks.extend_max_stream_data = http3_quic_extend_max_stream_data;
+
+	ngtcp2_settings_default(&settings);
+	settings.initial_ts = http3_timestamp();
+	settings.max_tx_udp_payload_size = HTTP3_MAX_PKT_SIZE;
+
+	ngtcp2_transport_params_default(&params);
+	params.initial_max_stream_data_bidi_remote = HTTP3_STREAM_WINDOW;
+	params.initial_max_stream_data_uni = HTTP3_STREAM_WINDOW;
+	params.initial_max_data = HTTP3_CONNECTION_WINDOW;
+	params.initial_max_streams_bidi = HTTP3_MAX_CONCURRENT_STREAMS;
+	params.initial_max_streams_uni = 3;
+	params.max_idle_timeout = (ngtcp2_duration) (srv->io_timeout * NGTCP2_SECONDS);
+	params.original_dcid = hd.dcid;
+	params.original_dcid_present = 1;
+
+	scid.datalen = HTTP3_SCID_LEN;
+	http3_new_cid(h3w, scid.data, scid.datalen);
+	params.stateless_reset_token_present = 1;
+	if (0 != ngtcp2_crypto_generate_stateless_reset_token(params.stateless_reset_token, srv->http3->secret, sizeof(srv->http3->secret), &scid)) {
+		return NULL;
+	}
+
+	memset(&path, 0, sizeof(path));
+	path.local.addr = sock->local_addr.addr_up.plain;
+	path.local.addrlen = sock->local_addr.len;
+	path.remote.addr = (ngtcp2_sockaddr*) &remote->plain;
+	path.remote.addrlen = remote_len;
+
+	c = g_slice_new0(http3_connection);
+	c->h3w = h3w;
+	c->sock = sock;
+	c->link.data = c;
+	ngtcp2_ccerr_default(&c->last_error);
+	c->cids = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+	g_queue_init(&c->streams);
+	g_queue_init(&c->ready);
+	g_queue_init(&c->closed);
+	c->conn_ref.get_conn = http3_get_conn;
+	c->conn_ref.user_data = c;
+
+	if (0 != (rv = ngtcp2_conn_server_new(&c->qconn, &hd.scid, &scid, &path, hd.version, &callbacks, &settings, &params, NULL, c))) {
+		ERROR(srv, "http3: ngtcp2_conn_server_new failed: %s", ngtcp2_strerror(rv));
+		g_ptr_array_free(c->cids, TRUE);
+		g_slice_free(http3_connection, c);
+		return NULL;
+	}
+
+	if (GNUTLS_E_SUCCESS != (rv = gnutls_init(&c->session, GNUTLS_SERVER | GNUTLS_NO_END_OF_EARLY_DATA))) {
+		ERROR(srv, "http3: gnutls_init failed: %s", gnutls_strerror(rv));
+		ngtcp2_conn_del(c->qconn);
+		g_ptr_array_free(c->cids, TRUE);
+		g_slice_free(http3_connection, c);
+		return NULL;
+	}
+	if (GNUTLS_E_SUCCESS != (rv = gnutls_priority_set_direct(c->session, HTTP3_PRIORITY, NULL))
+	    || 0 != (rv = ngtcp2_crypto_gnutls_configure_server_session(c->session))
+	    || GNUTLS_E_SUCCESS != (rv = gnutls_credentials_set(c->session, GNUTLS_CRD_CERTIFICATE, sock->listener->creds))
+	    || GNUTLS_E_SUCCESS != (rv = gnutls_alpn_set_protocols(c->session, &alpn, 1, GNUTLS_ALPN_MANDATORY))) {
+		ERROR(srv, "http3: setting up tls session failed: %s", gnutls_strerror(rv));
+		gnutls_deinit(c->session);
+		ngtcp2_conn_del(c->qconn);
+		g_ptr_array_free(c->cids, TRUE);
+		g_slice_free(http3_connection, c);
+		return NULL;
+	}
+	gnutls_session_set_ptr(c->session, &c->conn_ref);
+	ngtcp2_conn_set_tls_native_handle(c->qconn, c->session);
+
+	remote_addr.len = remote_len;
+	remote_addr.addr_up.raw = (char*) remote;
+	c->remote_addr = li_sockaddr_dup(remote_addr);
+	c->remote_addr_str = li_sockaddr_to_string(c->remote_addr, NULL, TRUE);
+
+	/* retransmitted Initial packets still use the client's dcid */
+	http3_register_cid(c, hd.dcid.data, hd.dcid.datalen);
+	http3_register_cid(c, scid.data, scid.datalen);
+
+	li_job_init(&c->write_job, http3_write_cb);
+	li_job_init(&c->cleanup_job, http3_cleanup_cb);
+	li_event_timer_init(&h3w->wrk->loop, "http3 connection timer", &c->timer, http3_timer_cb);
+
+	g_queue_push_tail_link(&h3w->connections, &c->link);
+
+	return c;
+}
+
+/***********
+ * sockets *
+ ***********/
+
+static void http3_send_version_negotiation(http3_socket *sock, const liSockAddrStorage *remote, socklen_t remote_len, const ngtcp2_version_cid *vc) {
+	guint8 buf[NGTCP2_MAX_UDP_PAYLOAD_SIZE];
+	guint8 unused_random;
+	uint32_t versions[] = { NGTCP2_PROTO_VER_V1 };
+	ngtcp2_ssize n;
+
+	gnutls_rnd(GNUTLS_RND_NONCE, &unused_random, 1);
+	n = ngtcp2_pkt_write_version_negotiation(buf, sizeof(buf), unused_random, vc->scid, vc->scidlen, vc->dcid, vc->dcidlen,
+		versions, G_N_ELEMENTS(versions));
+	if (n > 0) {
+		sendto(li_event_io_fd(&sock->watcher), buf, n, 0, &remote->plain, remote_len);
+	}
+}
+
+static void http3_send_stateless_reset(http3_socket *sock, const liSockAddrStorage *remote, socklen_t remote_len, const ngtcp2_version_cid *vc, gsize len) {
+	liHttp3Worker *h3w = sock->h3w;
+	liHttp3Server *h3s = h3w->wrk->srv->http3;
+	guint8 buf[HTTP3_STATELESS_RESET_MAX_LEN], unpredictable[HTTP3_STATELESS_RESET_MAX_LEN];
+	guint8 token[NGTCP2_STATELESS_RESET_TOKENLEN];
+	li_tstamp now = li_cur_ts(h3w->wrk);
+	ngtcp2_cid cid;
+	gsize randlen;
+	ngtcp2_ssize n;
+
+	if (len < HTTP3_STATELESS_RESET_MIN_TRIGGER) return;
+
+	if (now - h3w->resets_ts >= 1.0) {
+		h3w->resets_ts = now;
+		h3w->resets_sent = 0;
+	}
+	if (h3w->resets_sent >= HTTP3_STATELESS_RESET_RATE) return;
+	h3w->resets_sent++;
+
+	/* the token we announced for the connection id (same secret in all workers) */
+	ngtcp2_cid_init(&cid, vc->dcid, vc->dcidlen);
+	if (0 != ngtcp2_crypto_generate_stateless_reset_token(token, h3s->secret, sizeof(h3s->secret), &cid)) return;
+
+	randlen = MIN(len - 1, HTTP3_STATELESS_RESET_MAX_LEN) - 1 - NGTCP2_STATELESS_RESET_TOKENLEN;
+	gnutls_rnd(GNUTLS_RND_NONCE, unpredictable, randlen);
+	n = ngtcp2_pkt_write_stateless_reset(buf, sizeof(buf), token, unpredictable, randlen);
+	if (n > 0) {
+		sendto(li_event_io_fd(&sock->watcher), buf, n, 0, &remote->plain, remote_len);
+	}
+}
+
+static void http3_forwarded_free(http3_forwarded *fwd) {
+	g_free(fwd->data);
+	g_slice_free(http3_forwarded, fwd);
+}
+
+/* returns FALSE if the worker doesn't exist (or has no http3 context) */
+static gboolean http3_forward(http3_socket *sock, guint ndx, const liSockAddrStorage *remote, socklen_t remote_len, const guint8 *data, gsize len) {
+	liServer *srv = sock->h3w->wrk->srv;
+	liHttp3Worker *target;
+	http3_forwarded *fwd;
+
+	if (ndx >= srv->workers->len) return FALSE;
+	if (NULL == (target = g_array_index(srv->workers, liWorker*, ndx)->http3)) return FALSE;
+
+	/* let loss recovery handle an overloaded worker */
+	if (g_async_queue_length(target->forwarded) >= HTTP3_FORWARD_QUEUE_MAX) return TRUE;
+
+	fwd = g_slice_new(http3_forwarded);
+	fwd->listener = sock->listener;
+	memcpy(&fwd->remote, remote, remote_len);
+	fwd->remote_len = remote_len;
+	fwd->data = g_malloc(len);
+	memcpy(fwd->data, data, len);
+	fwd->len = len;
+
+	g_async_queue_push(target->forwarded, fwd);
+	li_event_async_send(&target->forward_watcher);
+	return TRUE;
+}
+
+/* forwarded: received by another worker, which routed it here by the worker index in the connection id */
+static void http3_handle_datagram(http3_socket *sock, const liSockAddrStorage *remote, socklen_t remote_len, const guint8 *data, gsize len, gboolean forwarded) {
+	liHttp3Worker *h3w = sock->h3w;
+	ngtcp2_version_cid vc;
+	http3_connection *c;
+	GBytes *key;
+	int rv;
+
+	rv = ngtcp2_pkt_decode_version_cid(&vc, data, len, HTTP3_SCID_LEN);
+	if (NGTCP2_ERR_VERSION_NEGOTIATION == rv) {
+		/* only answer packets that could be an Initial: don't amplify anything smaller */
+		if (len >= NGTCP2_MAX_UDP_PAYLOAD_SIZE) http3_send_version_negotiation(sock, remote, remote_len, &vc);
+		return;
+	}
+	if (0 != rv) return;
+
+	key = g_bytes_new_static(vc.dcid, vc.dcidlen);
+	c = g_hash_table_lookup(h3w->cids, key);
+	g_bytes_unref(key);
+
+	if (NULL == c) {
+		if (!(data[0] & 0x80)) {
+			/* short header packet: only for existing connections, which might be owned by another worker */
+			if (!forwarded && HTTP3_SCID_LEN == vc.dcidlen) {
+				guint ndx = ((guint) vc.dcid[0] << 8) | vc.dcid[1];
+				if (ndx != h3w->wrk->ndx && http3_forward(sock, ndx, remote, remote_len, data, len)) return;
+			}
+			/* the connection is gone (or never existed): tell the peer to stop */
+			http3_send_stateless_reset(sock, remote, remote_len, &vc, len);
+			return;
+		}
+		/* only long header packets can start a connection */
+		if (NULL == (c = http3_connection_accept(sock, remote, remote_len, data, len))) return;
+	} else if (c->sock != sock) {
+		return; /* connection ids are issued per listener */
+	}
+
+	http3_connection_read(c, remote, remote_len, data, len);
+}
+
+static void http3_forward_cb(liEventBase *watcher, int events) {
+	liHttp3Worker *h3w = LI_CONTAINER_OF(li_event_async_from(watcher), liHttp3Worker, forward_watcher);
+	http3_forwarded *fwd;
+	UNUSED(events);
+
+	while (NULL != (fwd = g_async_queue_try_pop(h3w->forwarded))) {
+		guint i;
+
+		/* our socket for the listener it was received on */
+		for (i = 0; i < h3w->sockets->len; i++) {
+			http3_socket *sock = g_ptr_array_index(h3w->sockets, i);
+			if (sock->listener == fwd->listener) {
+				http3_handle_datagram(sock, &fwd->remote, fwd->remote_len, fwd->data, fwd->len, TRUE);
+				break;
+			}
+		}
+		http3_forwarded_free(fwd);
+	}
+}
+
+static void http3_socket_cb(liEventBase *watcher, int events) {
+	http3_socket *sock = LI_CONTAINER_OF(li_event_io_from(watcher), http3_socket, watcher);
+	liHttp3Worker *h3w = sock->h3w;
+	int fd = li_event_io_fd(&sock->watcher);
+	liSockAddrStorage addrs[HTTP3_RECV_BATCH];
+	struct iovec iovs[HTTP3_RECV_BATCH];
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cmsgs[HTTP3_RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[HTTP3_RECV_BATCH];
+#else
+	struct msghdr msg;
+	gssize nread;
+#endif
+	guint rounds, i;
+	UNUSED(events);
+
+	for (rounds = 0; rounds < HTTP3_RECV_ROUNDS; rounds++) {
+		int r;
+
+		for (i = 0; i < HTTP3_RECV_BATCH; i++) {
+			iovs[i].iov_base = h3w->recv_buf + i * HTTP3_RECV_BUF_SIZE;
+			iovs[i].iov_len = HTTP3_RECV_BUF_SIZE;
+		}
+
+#ifdef HAVE_RECVMMSG
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < HTTP3_RECV_BATCH; i++) {
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = cmsgs[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i].buf);
+		}
+		r = recvmmsg(fd, msgs, HTTP3_RECV_BATCH, 0, NULL);
+#else
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &addrs[0];
+		msg.msg_namelen = sizeof(addrs[0]);
+		msg.msg_iov = &iovs[0];
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgs[0].buf;
+		msg.msg_controllen = sizeof(cmsgs[0].buf);
+		nread = recvmsg(fd, &msg, 0);
+		r = (-1 == nread) ? -1 : 1;
+#endif
+
+		if (-1 == r) {
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+			case EWOULDBLOCK:
+#endif
+				return;
+			default:
+				ERROR(h3w->wrk->srv, "http3: recvmmsg failed: %s", g_strerror(errno));
+				return;
+			}
+		}
+
+		for (i = 0; i < (guint) r; i++) {
+#ifdef HAVE_RECVMMSG
+			struct msghdr *hdr = &msgs[i].msg_hdr;
+			gsize len = msgs[i].msg_len;
+#else
+			struct msghdr *hdr = &msg;
+			gsize len = nread;
+#endif
+			const guint8 *data = iovs[i].iov_base;
+			gsize segment = 0, offset;
+			struct cmsghdr *cm;
+
+#ifdef UDP_GRO
+			/* coalesced datagrams of the same size (the last one may be shorter) */
+			for (cm = CMSG_FIRSTHDR(hdr); NULL != cm; cm = CMSG_NXTHDR(hdr, cm)) {
+				if (SOL_UDP == cm->cmsg_level && UDP_GRO == cm->cmsg_type) {
+					int gso_size;
+					memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+					segment = gso_size;
+				}
+			}
+#else
+			UNUSED(cm);
+#endif
+			if (0 == segment) segment = len;
+
+			for (offset = 0; offset < len; offset += segment) {
+				http3_handle_datagram(sock, &addrs[i], hdr->msg_namelen, data + offset, MIN(segment, len - offset), FALSE);
+			}
+		}
+
+		if (r < HTTP3_RECV_BATCH) return;
+	}
+}
+
+/**********
+ * public *
+ **********/
+
+gboolean li_http3_setup(liServer *srv, liValue *val) {
+	liHttp3Server *h3s;
+	http3_listener *l;
+	const char *pemfile = NULL;
+	GString *listen = NULL;
+	liSocketAddress addr;
+	guint port = 0;
+	int r;
+
+	val = li_value_get_single_argument(val);
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "http3 expects a hash/key-value list as parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *entryKeyStr;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "http3 doesn't take default keys");
+			return FALSE;
+		}
+		entryKeyStr = entryKey->data.string; /* keys are either NONE or STRING */
+
+		if (g_str_equal(entryKeyStr->str, "listen")) {
+			if (LI_VALUE_STRING != li_value_type(entryValue)) {
+				ERROR(srv, "%s", "http3 listen expects a string as parameter");
+				return FALSE;
+			}
+			if (NULL != listen) {
+				ERROR(srv, "http3 unexpected duplicate parameter %s", entryKeyStr->str);
+				return FALSE;
+			}
+			listen = entryValue->data.string;
+		} else if (g_str_equal(entryKeyStr->str, "pemfile")) {
+			if (LI_VALUE_STRING != li_value_type(entryValue)) {
+				ERROR(srv, "%s", "http3 pemfile expects a string as parameter");
+				return FALSE;
+			}
+			if (NULL != pemfile) {
+				ERROR(srv, "http3 unexpected duplicate parameter %s", entryKeyStr->str);
+				return FALSE;
+			}
+			pemfile = entryValue->data.string->str;
+		} else {
+			ERROR(srv, "invalid parameter for http3: %s", entryKeyStr->str);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	if (NULL == listen || NULL == pemfile) {
+		ERROR(srv, "%s", "http3 needs \"listen\" and \"pemfile\" parameters");
+		return FALSE;
+	}
+
+	addr = li_sockaddr_from_string(listen, 443);
+	if (NULL == addr.addr_up.raw) {
+		ERROR(srv, "http3: invalid listen address '%s'", listen->str);
+		return FALSE;
+	}
+	switch (addr.addr_up.plain->sa_family) {
+	case AF_INET:
+		port = ntohs(addr.addr_up.ipv4->sin_port);
+		break;
+#ifdef HAVE_IPV6
+	case AF_INET6:
+		port = ntohs(addr.addr_up.ipv6->sin6_port);
+		break;
+#endif
+	default:
+		break;
+	}
+	if (0 == port) {
+		li_sockaddr_clear(&addr);
+		ERROR(srv, "http3: listen address '%s' has to be an ip address with port", listen->str);
+		return FALSE;
+	}
+
+	l = g_slice_new0(http3_listener);
+	l->srv = srv;
+	/* with explicit port: the angel defaults to 80 */
+	l->addr_str = li_sockaddr_to_string(addr, NULL, TRUE);
+	li_sockaddr_clear(&addr);
+
+	if (GNUTLS_E_SUCCESS > (r = gnutls_certificate_allocate_credentials(&l->creds))) {
+		ERROR(srv, "gnutls_certificate_allocate_credentials failed(%s): %s", gnutls_strerror_name(r), gnutls_strerror(r));
+		g_string_free(l->addr_str, TRUE);
+		g_slice_free(http3_listener, l);
+		return FALSE;
+	}
+	if (GNUTLS_E_SUCCESS > (r = gnutls_certificate_set_x509_key_file(l->creds, pemfile, pemfile, GNUTLS_X509_FMT_PEM))) {
+		ERROR(srv, "gnutls_certificate_set_x509_key_file failed(certfile '%s', keyfile '%s', PEM) (%s): %s",
+			pemfile, pemfile, gnutls_strerror_name(r), gnutls_strerror(r));
+		gnutls_certificate_free_credentials(l->creds);
+		g_string_free(l->addr_str, TRUE);
+		g_slice_free(http3_listener, l);
+		return FALSE;
+	}
+
+	if (NULL == (h3s = srv->http3)) {
+		h3s = srv->http3 = g_slice_new0(liHttp3Server);
+		h3s->listeners = g_ptr_array_new();
+		gnutls_rnd(GNUTLS_RND_KEY, h3s->secret, sizeof(h3s->secret));
+	}
+	g_ptr_array_add(h3s->listeners, l);
+
+	/* advertise the first listener on the HTTP/1 and HTTP/2 responses, unless alt_svc was already set */
+	if (NULL == g_array_index(srv->optionptr_def_values, liOptionPtrValue*, LI_CORE_OPTION_ALT_SVC)) {
+		GString *alt_svc = g_string_sized_new(31);
+		g_string_printf(alt_svc, "h3=\":%u\"; ma=86400", port);
+		if (!li_plugin_config_setup(srv, "alt_svc", li_value_new_string(alt_svc))) return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void http3_listen_cb(liServer *srv, GArray *fds, gpointer data) {
+	http3_listener *l = data;
+
+	if (NULL != fds) {
+		l->fds = g_array_sized_new(FALSE, FALSE, sizeof(int), fds->len);
+		g_array_append_vals(l->fds, fds->data, fds->len);
+		g_array_set_size(fds, 0);
+	} else {
+		ERROR(srv, "http3: not listening on '%s'", l->addr_str->str);
+	}
+
+	li_server_state_ready(srv, &l->sw);
+}
+
+void li_http3_prepare(liServer *srv) {
+	liHttp3Server *h3s = srv->http3;
+	guint i;
+
+	if (NULL == h3s) return;
+
+	for (i = 0; i < h3s->listeners->len; i++) {
+		http3_listener *l = g_ptr_array_index(h3s->listeners, i);
+
+		memset(&l->sw, 0, sizeof(l->sw));
+		li_server_state_wait(srv, &l->sw);
+		li_angel_listen_udp(srv, l->addr_str, http3_listen_cb, l);
+	}
+}
+
+void li_http3_server_free(liServer *srv) {
+	liHttp3Server *h3s = srv->http3;
+	guint i, j;
+
+	if (NULL == h3s) return;
+
+	for (i = 0; i < h3s->listeners->len; i++) {
+		http3_listener *l = g_ptr_array_index(h3s->listeners, i);
+
+		if (NULL != l->fds) {
+			for (j = 0; j < l->fds->len; j++) {
+				int fd = g_array_index(l->fds, int, j);
+				if (-1 != fd) close(fd);
+			}
+			g_array_free(l->fds, TRUE);
+		}
+		gnutls_certificate_free_credentials(l->creds);
+		g_string_free(l->addr_str, TRUE);
+		g_slice_free(http3_listener, l);
+	}
+	g_ptr_array_free(h3s->listeners, TRUE);
+
+	g_slice_free(liHttp3Server, h3s);
+	srv->http3 = NULL;
+}
+
+liHttp3Worker* li_http3_worker_new(liWorker *wrk) {
+	liHttp3Server *h3s = wrk->srv->http3;
+	liHttp3Worker *h3w;
+	guint i;
+
+	if (NULL == h3s) return NULL;
+
+	h3w = g_slice_new0(liHttp3Worker);
+	h3w->wrk = wrk;
+	h3w->sockets = g_ptr_array_new();
+	h3w->cids = g_hash_table_new_full(g_bytes_hash, g_bytes_equal, (GDestroyNotify) g_bytes_unref, NULL);
+	g_queue_init(&h3w->connections);
+	h3w->recv_buf = g_malloc(HTTP3_RECV_BATCH * HTTP3_RECV_BUF_SIZE);
+	h3w->send_buf = g_malloc(HTTP3_SEND_BATCH * HTTP3_MAX_PKT_SIZE);
+	h3w->forwarded = g_async_queue_new();
+	li_event_async_init(&wrk->loop, "http3 forwarded datagrams", &h3w->forward_watcher, http3_forward_cb);
+
+	for (i = 0; i < h3s->listeners->len; i++) {
+		http3_listener *l = g_ptr_array_index(h3s->listeners, i);
+		http3_socket *sock;
+		int fd;
+
+		if (NULL == l->fds || wrk->ndx >= l->fds->len) continue;
+		fd = g_array_index(l->fds, int, wrk->ndx);
+		g_array_index(l->fds, int, wrk->ndx) = -1;
+		if (-1 == fd) continue;
+
+		li_fd_init(fd);
+#ifdef UDP_GRO
+		{
+			int v = 1;
+			/* optional: without it every datagram is received on its own */
+			setsockopt(fd, IPPROTO_UDP, UDP_GRO, &v, sizeof(v));
+		}
+#endif
+
+		sock = g_slice_new0(http3_socket);
+		sock->h3w = h3w;
+		sock->listener = l;
+		sock->local_addr = li_sockaddr_local_from_socket(fd);
+		sock->local_addr_str = li_sockaddr_to_string(sock->local_addr, NULL, TRUE);
+		li_event_io_init(&wrk->loop, "http3 socket", &sock->watcher, http3_socket_cb, fd, LI_EV_READ);
+		li_event_start(&sock->watcher);
+		g_ptr_array_add(h3w->sockets, sock);
+	}
+
+	return h3w;
+}
+
+void li_http3_worker_shutdown(liHttp3Worker *h3w) {
+	GList *l, *next;
+
+	if (NULL == h3w) return;
+
+	for (l = h3w->connections.head; NULL != l; l = next) {
+		http3_connection *c = l->data;
+		next = l->next;
+
+		if (c->closing || c->draining) continue;
+
+		if (NULL == c->hconn || 0 == c->streams.length) {
+			http3_set_app_error(c, NGHTTP3_H3_NO_ERROR);
+			http3_connection_close(c);
+		} else {
+			/* GOAWAY; finish active streams */
+			nghttp3_conn_shutdown(c->hconn);
+			http3_write_later(c);
+		}
+	}
+}
+
+void li_http3_worker_stop(liHttp3Worker *h3w) {
+	http3_connection *c;
+	guint i;
+
+	if (NULL == h3w) return;
+
+	while (NULL != (c = g_queue_peek_head(&h3w->connections))) {
+		http3_set_app_error(c, NGHTTP3_H3_NO_ERROR);
+		http3_connection_close(c);
+		http3_connection_free(c);
+	}
+
+	for (i = 0; i < h3w->sockets->len; i++) {
+		http3_socket *sock = g_ptr_array_index(h3w->sockets, i);
+		li_event_stop(&sock->watcher);
+	}
+	li_event_stop(&h3w->forward_watcher);
+}
+
+void li_http3_worker_free(liHttp3Worker *h3w) {
+	guint i;
+
+	if (NULL == h3w) return;
+
+	li_http3_worker_stop(h3w);
+
+	for (i = 0; i < h3w->sockets->len; i++) {
+		http3_socket *sock = g_ptr_array_index(h3w->sockets, i);
+
+		close(li_event_io_fd(&sock->watcher));
+		li_event_clear(&sock->watcher);
+		li_sockaddr_clear(&sock->local_addr);
+		g_string_free(sock->local_addr_str, TRUE);
+		g_slice_free(http3_socket, sock);
+	}
+	g_ptr_array_free(h3w->sockets, TRUE);
+
+	/* other workers are stopped too: nothing gets forwarded anymore */
+	{
+		http3_forwarded *fwd;
+		while (NULL != (fwd = g_async_queue_try_pop(h3w->forwarded))) {
+			http3_forwarded_free(fwd);
+		}
+	}
+	g_async_queue_unref(h3w->forwarded);
+	li_event_clear(&h3w->forward_watcher);
+
+	g_hash_table_destroy(h3w->cids);
+	g_free(h3w->recv_buf);
+	g_free(h3w->send_buf);
+
+	g_slice_free(liHttp3Worker, h3w);
+}
+
+/**********************
+ * vrequest callbacks *
+ **********************/
+
+static void http3_vr_handle_response_error(liVRequest *vr) {
+	http3_stream *s = LI_CONTAINER_OF(vr->coninfo, http3_stream, coninfo);
+
+	if (s->closed) return;
+
+	if (s->headers_sent) {
+		http3_stream_reset(s, NGHTTP3_H3_INTERNAL_ERROR);
+		return;
+	}
+
+	/* the connection survives, so we can still send an error page */
+	li_http_headers_reset(vr->response.headers);
+	http3_stream_respond_error(s);
+}
+
+static liThrottleState* http3_vr_throttle_out(liVRequest *vr) {
+	UNUSED(vr);
+	return NULL;
+}
+
+static liThrottleState* http3_vr_throttle_in(liVRequest *vr) {
+	UNUSED(vr);
+	return NULL;
+}
+
+static void http3_vr_connection_upgrade(liVRequest *vr, liStream *backend_drain, liStream *backend_source) {
+	http3_stream *s = LI_CONTAINER_OF(vr->coninfo, http3_stream, coninfo);
+	UNUSED(backend_drain); UNUSED(backend_source);
+
+	/* "upgrade" is rejected in HTTP/3 requests, and extended CONNECT is not offered */
+	if (s->closed) return;
+	http3_stream_reset(s, NGHTTP3_H3_INTERNAL_ERROR);
+}
+
+static const liConCallbacks http3_stream_callbacks = {
+	http3_vr_handle_response_error,
+	http3_vr_throttle_out,
+	http3_vr_throttle_in,
+	http3_vr_connection_upgrade
+};
+
+#else
+
+gboolean li_http3_setup(liServer *srv, liValue *val) {
+	UNUSED(val);
+	ERROR(srv, "%s", "http3: not supported (compiled without ngtcp2/nghttp3)");
+	return FALSE;
+}
+
+void li_http3_prepare(liServer *srv) {
+	UNUSED(srv);
+}
+
+void li_http3_server_free(liServer *srv) {
+	UNUSED(srv);
+}
+
+liHttp3Worker* li_http3_worker_new(liWorker *wrk) {
+	UNUSED(wrk);
+	return NULL;
+}
+
+void li_http3_worker_shutdown(liHttp3Worker *h3w) {
+	UNUSED(h3w);
+}
+
+void li_http3_worker_stop(liHttp3Worker *h3w) {
+	UNUSED(h3w);
+}
+
+void li_http3_worker_free(liHttp3Worker *h3w) {
+	UNUSED(h3w);
+}
+
+#endif
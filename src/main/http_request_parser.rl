@@ -151,6 +151,18 @@ liHandlerResult li_http_request_parse(liVRequest *vr, liHttpRequestCtx *ctx) {
 
 	if (LI_HANDLER_GO_ON != (res = li_chunk_parser_prepare(&ctx->chunk_ctx))) return res;
 
+	if (0 == ctx->chunk_ctx.bytes_in && li_http_request_parser_start == ctx->chunk_ctx.cs) {
+		/* fast path: complete header in the first chunk */
+		char *p, *pe;
+		gsize len;
+
+		if (LI_HANDLER_GO_ON == li_chunk_parser_next(&ctx->chunk_ctx, &p, &pe, NULL)
+				&& 0 != (len = li_http_request_parse_contiguous(ctx->request, p, pe - p))) {
+			li_chunk_parser_done(&ctx->chunk_ctx, len);
+			ctx->chunk_ctx.cs = li_http_request_parser_first_final;
+		}
+	}
+
 	while (!li_http_request_parser_has_error(ctx) && !li_http_request_parser_is_finished(ctx)) {
 		char *p, *pe;
 		GError *err = NULL;
@@ -0,0 +1,328 @@
+
+#include <lighttpd/base.h>
+#include <lighttpd/lighttpd-glue.h>
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+# include <immintrin.h>
+#endif
+
+/* Fast path for request headers which are completely available in one buffer (see http_request_parser.h).
+ *
+ * It accepts a subset of what the ragel machine in http_request_parser.rl accepts and has to produce the same
+ * result for it; everything else is left to the ragel parser. The scanners search for the first byte in a
+ * set of up to 4 byte ranges.
+ */
+
+typedef struct scan_set scan_set;
+struct scan_set {
+	guint8 ranges[16]; /* 4 [lo, hi] pairs (padded for the sse load); unused pairs repeat the first one */
+	guint8 table[256]; /* scalar version: != 0 for bytes in one of the ranges */
+};
+
+typedef const gchar* (*scan_fn)(const gchar *p, const gchar *pe, const scan_set *set);
+
+/* SP, CTL: end of method and uri, line end after the http version */
+static scan_set set_request_line = { { 0x00, 0x20, 0x7f, 0x7f }, { 0 } };
+/* SP, CTL, ':': end of header key */
+static scan_set set_header_key = { { 0x00, 0x20, ':', ':', 0x7f, 0x7f }, { 0 } };
+/* CTL except HT, DQUOTE: line end or start of a quoted string in a header value */
+static scan_set set_header_value = { { 0x00, 0x08, 0x0a, 0x1f, '"', '"', 0x7f, 0x7f }, { 0 } };
+
+/* RFC 2616 token: OCTET - Separators - CTL */
+static guint8 token_table[256];
+
+static liHttpRequestScanImpl scan_impl = LI_HTTP_REQUEST_SCAN_NONE;
+static scan_fn scan = NULL;
+static gsize scan_initialized = 0;
+
+static const gchar* scan_scalar(const gchar *p, const gchar *pe, const scan_set *set) {
+	for ( ; p < pe; p++) {
+		if (set->table[(guint8) *p]) return p;
+	}
+	return pe;
+}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+
+__attribute__((target("sse4.2")))
+static const gchar* scan_sse42(const gchar *p, const gchar *pe, const scan_set *set) {
+	const __m128i ranges = _mm_loadu_si128((const __m128i*) set->ranges);
+
+	while (pe - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) p);
+		int i = _mm_cmpestri(ranges, 8, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (i < 16) return p + i;
+		p += 16;
+	}
+
+	return scan_scalar(p, pe, set);
+}
+
+__attribute__((target("avx2")))
+static const gchar* scan_avx2(const gchar *p, const gchar *pe, const scan_set *set) {
+	__m256i lo[4], span[4];
+	guint i;
+
+	for (i = 0; i < 4; i++) {
+		lo[i] = _mm256_set1_epi8((char) set->ranges[2*i]);
+		span[i] = _mm256_set1_epi8((char) (set->ranges[2*i+1] - set->ranges[2*i]));
+	}
+
+	while (pe - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) p);
+		__m256i match = _mm256_setzero_si256();
+		guint32 mask;
+
+		/* (v - lo) <= (hi - lo), unsigned */
+		for (i = 0; i < 4; i++) {
+			__m256i d = _mm256_sub_epi8(v, lo[i]);
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi8(_mm256_min_epu8(d, span[i]), d));
+		}
+
+		mask = (guint32) _mm256_movemask_epi8(match);
+		if (0 != mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+
+	return scan_sse42(p, pe, set);
+}
+
+#endif
+
+static void scan_set_init(scan_set *set) {
+	guint i, c;
+
+	for (i = 1; i < 4; i++) {
+		if (0 == set->ranges[2*i] && 0 == set->ranges[2*i+1]) {
+			set->ranges[2*i] = set->ranges[0];
+			set->ranges[2*i+1] = set->ranges[1];
+		}
+	}
+
+	memset(set->table, 0, sizeof(set->table));
+	for (i = 0; i < 4; i++) {
+		for (c = set->ranges[2*i]; c <= set->ranges[2*i+1]; c++) set->table[c] = 1;
+	}
+}
+
+static void scan_select_auto(void) {
+	scan_impl = LI_HTTP_REQUEST_SCAN_SCALAR;
+	scan = scan_scalar;
+#ifdef HAVE_X86_SIMD_DISPATCH
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+		scan_impl = LI_HTTP_REQUEST_SCAN_AVX2;
+		scan = scan_avx2;
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		scan_impl = LI_HTTP_REQUEST_SCAN_SSE42;
+		scan = scan_sse42;
+	}
+#endif
+}
+
+static void scan_init(void) {
+	guint c;
+
+	if (!g_once_init_enter(&scan_initialized)) return;
+
+	scan_set_init(&set_request_line);
+	scan_set_init(&set_header_key);
+	scan_set_init(&set_header_value);
+
+	for (c = 0; c < 256; c++) {
+		token_table[c] = (c > 32 && c != 127 && NULL == strchr("()<>@,;:\\\"/[]?={}", (int) c));
+	}
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+	__builtin_cpu_init();
+#endif
+	scan_select_auto();
+
+	g_once_init_leave(&scan_initialized, 1);
+}
+
+gboolean li_http_request_scan_select(liHttpRequestScanImpl impl) {
+	scan_init();
+
+	switch (impl) {
+	case LI_HTTP_REQUEST_SCAN_AUTO:
+		scan_select_auto();
+		return TRUE;
+	case LI_HTTP_REQUEST_SCAN_NONE:
+		scan_impl = impl;
+		scan = NULL;
+		return TRUE;
+	case LI_HTTP_REQUEST_SCAN_SCALAR:
+		scan_impl = impl;
+		scan = scan_scalar;
+		return TRUE;
+	case LI_HTTP_REQUEST_SCAN_SSE42:
+#ifdef HAVE_X86_SIMD_DISPATCH
+		if (!__builtin_cpu_supports("sse4.2")) return FALSE;
+		scan_impl = impl;
+		scan = scan_sse42;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case LI_HTTP_REQUEST_SCAN_AVX2:
+#ifdef HAVE_X86_SIMD_DISPATCH
+		/* the avx2 scanner uses the sse4.2 scanner for the tail */
+		if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("sse4.2")) return FALSE;
+		scan_impl = impl;
+		scan = scan_avx2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+
+	return FALSE;
+}
+
+liHttpRequestScanImpl li_http_request_scan_selected(void) {
+	scan_init();
+	return scan_impl;
+}
+
+const gchar* li_http_request_scan_name(liHttpRequestScanImpl impl) {
+	switch (impl) {
+	case LI_HTTP_REQUEST_SCAN_AUTO: return "auto";
+	case LI_HTTP_REQUEST_SCAN_NONE: return "none";
+	case LI_HTTP_REQUEST_SCAN_SCALAR: return "scalar";
+	case LI_HTTP_REQUEST_SCAN_SSE42: return "sse4.2";
+	case LI_HTTP_REQUEST_SCAN_AVX2: return "avx2";
+	}
+	return "unknown";
+}
+
+static gboolean is_token(const gchar *s, const gchar *e) {
+	if (s == e) return FALSE;
+	for ( ; s < e; s++) {
+		if (!token_table[(guint8) *s]) return FALSE;
+	}
+	return TRUE;
+}
+
+/* "HTTP" "/" DIGIT+ "." DIGIT+ */
+static gboolean is_http_version(const gchar *s, const gchar *e) {
+	const gchar *d;
+
+	if (e - s < 8 || 0 != memcmp(s, "HTTP/", 5)) return FALSE;
+	s += 5;
+	for (d = s; s < e && g_ascii_isdigit(*s); s++) ;
+	if (s == d || s == e || '.' != *s) return FALSE;
+	for (d = ++s; s < e && g_ascii_isdigit(*s); s++) ;
+	return s != d && s == e;
+}
+
+/* skip a quoted string (p points after the opening DQUOTE); NULL if it doesn't end on this line or contains
+ * anything ragel has to look at (LWS, escaped CTL)
+ */
+static const gchar* skip_quoted_string(const gchar *p, const gchar *pe) {
+	for ( ; p < pe; p++) {
+		guint8 c = (guint8) *p;
+
+		if ('"' == c) return p + 1;
+		if ('\\' == c) {
+			if (++p == pe) return NULL;
+			c = (guint8) *p;
+			if (c < 32 || c >= 127) return NULL;
+		} else if ((c < 32 && '\t' != c) || 127 == c) {
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+/* CRLF = (CR LF | LF); returns position after the line end or NULL */
+static const gchar* skip_line_end(const gchar *p, const gchar *pe) {
+	if (p < pe && '\n' == *p) return p + 1;
+	if (pe - p >= 2 && '\r' == p[0] && '\n' == p[1]) return p + 2;
+	return NULL;
+}
+
+gsize li_http_request_parse_contiguous(liRequest *req, const gchar *data, gsize len) {
+	const gchar *p = data, *pe = data + len, *next;
+	const gchar *method, *method_end, *uri, *uri_end, *version, *version_end;
+	GList *last_header;
+
+	scan_init();
+	if (NULL == scan) return 0;
+
+	last_header = g_queue_peek_tail_link(&req->headers->entries);
+
+	/* (CRLF)* Request_Line */
+	while (NULL != (next = skip_line_end(p, pe))) p = next;
+
+	method = p;
+	method_end = p = scan(p, pe, &set_request_line);
+	if (p == pe || ' ' != *p || !is_token(method, method_end)) goto fallback;
+
+	uri = ++p;
+	uri_end = p = scan(p, pe, &set_request_line);
+	if (p == pe || ' ' != *p || uri == uri_end) goto fallback;
+
+	version = ++p;
+	version_end = p = scan(p, pe, &set_request_line);
+	if (NULL == (p = skip_line_end(p, pe)) || !is_http_version(version, version_end)) goto fallback;
+
+	/* (Message_Header)* CRLF */
+	for (;;) {
+		const gchar *key, *key_end, *value, *value_end;
+
+		if (NULL != (next = skip_line_end(p, pe))) {
+			p = next;
+			break;
+		}
+
+		key = p;
+		key_end = p = scan(p, pe, &set_header_key);
+		if (p == pe || ':' != *p || !is_token(key, key_end)) goto fallback;
+
+		for (++p; p < pe && (' ' == *p || '\t' == *p); p++) ;
+		value = p;
+
+		for (;;) {
+			p = scan(p, pe, &set_header_value);
+			if (p == pe) goto fallback;
+			if ('"' != *p) break;
+			if (NULL == (p = skip_quoted_string(p + 1, pe))) goto fallback;
+		}
+
+		value_end = p;
+		if (NULL == (p = skip_line_end(p, pe))) goto fallback;
+		/* continuation lines (LWS) are left to ragel */
+		if (p < pe && (' ' == *p || '\t' == *p)) goto fallback;
+
+		/* same whitespace stripping as the ragel machine */
+		while (value_end > value && ' ' == value_end[-1]) value_end--;
+
+		li_http_header_insert(req->headers, key, key_end - key, value, value_end - value);
+	}
+
+	g_string_truncate(req->http_method_str, 0);
+	li_g_string_append_len(req->http_method_str, method, method_end - method);
+	req->http_method = li_http_method_from_string(GSTR_LEN(req->http_method_str));
+
+	g_string_truncate(req->uri.raw, 0);
+	li_g_string_append_len(req->uri.raw, uri, uri_end - uri);
+
+	if (8 == version_end - version && 0 == memcmp(version, "HTTP/1.1", 8)) {
+		req->http_version = LI_HTTP_VERSION_1_1;
+	} else if (8 == version_end - version && 0 == memcmp(version, "HTTP/1.0", 8)) {
+		req->http_version = LI_HTTP_VERSION_1_0;
+	} else {
+		req->http_version = LI_HTTP_VERSION_UNSET;
+	}
+
+	return p - data;
+
+fallback:
+	/* remove the headers inserted so far */
+	for (;;) {
+		GList *l = g_queue_peek_tail_link(&req->headers->entries);
+		if (l == last_header) break;
+		li_http_header_remove_link(req->headers, l);
+	}
+	return 0;
+}
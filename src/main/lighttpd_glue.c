@@ -163,6 +163,8 @@ liHttpMethod li_http_method_from_string(const gchar* method_str, gssize len) {
 
 gchar *li_http_version_string(liHttpVersion method, guint *len) {
 	switch (method) {
+	case LI_HTTP_VERSION_3: SET_LEN_AND_RETURN_STR("HTTP/3.0");
+	case LI_HTTP_VERSION_2: SET_LEN_AND_RETURN_STR("HTTP/2.0");
 	case LI_HTTP_VERSION_1_1: SET_LEN_AND_RETURN_STR("HTTP/1.1");
 	case LI_HTTP_VERSION_1_0: SET_LEN_AND_RETURN_STR("HTTP/1.0");
 	case LI_HTTP_VERSION_UNSET: SET_LEN_AND_RETURN_STR("HTTP/??");
@@ -0,0 +1,383 @@
+#include <lighttpd/base.h>
+#include <lighttpd/plugin_core.h>
+#include <sys/stat.h>
+
+/* count-min sketch: rows of 4-bit counters (stored in bytes) */
+#define MEM_CACHE_SKETCH_DEPTH 4
+#define MEM_CACHE_COUNTER_MAX 15
+#define MEM_CACHE_SKETCH_MIN_WIDTH 1024
+#define MEM_CACHE_SKETCH_MAX_WIDTH (1024*1024)
+/* expected average file size, used to size the sketch */
+#define MEM_CACHE_AVG_FILE_SIZE 4096
+
+struct liMemCache {
+	GMutex *lock;
+	GHashTable *entries; /* GString* path (entry->path) -> liMemCacheEntry*, holding a reference */
+	GQueue lru; /* head: most recently used */
+
+	gint enabled; /* atomic access */
+	goffset limit, used;
+
+	/* frequency sketch for the admission policy */
+	guint8 *sketch;
+	guint sketch_mask; /* width - 1 */
+	guint sketch_additions, sketch_sample_size;
+
+	guint64 rejected, evictions;
+
+	GHashTable *filling; /* GString* path (job->mce->path) -> mem_cache_fill_job*: read in the tasklet pool right now */
+};
+
+typedef struct mem_cache_fill_job mem_cache_fill_job;
+struct mem_cache_fill_job {
+	liMemCache *mc;
+	liMemCacheEntry *mce; /* content is read by the tasklet */
+	liChunkFile *cf;
+	gboolean failed; /* only accessed by the tasklet until it is finished */
+	gboolean invalidated; /* protected by mc->lock */
+};
+
+static guint mem_cache_sketch_index(liMemCache *mc, guint hash, guint row) {
+	/* double hashing: derive the row hashes from one string hash */
+	guint h2 = (hash * 0x9E3779B1u) | 1;
+	return row * (mc->sketch_mask + 1) + ((hash + row * h2) & mc->sketch_mask);
+}
+
+static guint mem_cache_sketch_estimate(liMemCache *mc, guint hash) {
+	guint row, freq = MEM_CACHE_COUNTER_MAX;
+
+	for (row = 0; row < MEM_CACHE_SKETCH_DEPTH; row++) {
+		freq = MIN(freq, mc->sketch[mem_cache_sketch_index(mc, hash, row)]);
+	}
+
+	return freq;
+}
+
+static void mem_cache_sketch_increment(liMemCache *mc, guint hash) {
+	guint row, i, width = mc->sketch_mask + 1;
+
+	for (row = 0; row < MEM_CACHE_SKETCH_DEPTH; row++) {
+		guint8 *c = &mc->sketch[mem_cache_sketch_index(mc, hash, row)];
+		if (*c < MEM_CACHE_COUNTER_MAX) (*c)++;
+	}
+
+	if (++mc->sketch_additions >= mc->sketch_sample_size) {
+		/* aging: old popularity fades, so the cache can adapt */
+		for (i = 0; i < MEM_CACHE_SKETCH_DEPTH * width; i++) mc->sketch[i] >>= 1;
+		mc->sketch_additions /= 2;
+	}
+}
+
+static void mem_cache_sketch_resize(liMemCache *mc) {
+	guint width = MEM_CACHE_SKETCH_MIN_WIDTH;
+	goffset expected = mc->limit / MEM_CACHE_AVG_FILE_SIZE;
+
+	while (width < MEM_CACHE_SKETCH_MAX_WIDTH && (goffset) width < 4 * expected) width *= 2;
+
+	g_free(mc->sketch);
+	mc->sketch = g_new0(guint8, MEM_CACHE_SKETCH_DEPTH * width);
+	mc->sketch_mask = width - 1;
+	mc->sketch_additions = 0;
+	mc->sketch_sample_size = 10 * width;
+}
+
+static long mem_cache_mtime_nsec(const struct stat *st) {
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	return st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	return st->st_mtimespec.tv_nsec;
+#else
+	UNUSED(st);
+	return 0;
+#endif
+}
+
+/* a file rewritten within the same second (keeping its size) still differs in the nanoseconds */
+static gboolean mem_cache_matches(liMemCacheEntry *mce, const struct stat *st) {
+	return mce->dev == st->st_dev && mce->ino == st->st_ino && mce->size == st->st_size
+		&& mce->mtime == st->st_mtime && mce->mtime_nsec == mem_cache_mtime_nsec(st);
+}
+
+static void mem_cache_entry_acquire(liMemCacheEntry *mce) {
+	LI_FORCE_ASSERT(g_atomic_int_get(&mce->refcount) > 0);
+	g_atomic_int_inc(&mce->refcount);
+}
+
+void li_mem_cache_entry_release(liMemCacheEntry *mce) {
+	if (NULL == mce) return;
+	LI_FORCE_ASSERT(g_atomic_int_get(&mce->refcount) > 0);
+	if (g_atomic_int_dec_and_test(&mce->refcount)) {
+		li_buffer_release(mce->content);
+		g_string_free(mce->path, TRUE);
+		if (NULL != mce->etag) g_string_free(mce->etag, TRUE);
+		if (NULL != mce->last_modified) g_string_free(mce->last_modified, TRUE);
+		if (NULL != mce->mime_type) g_string_free(mce->mime_type, TRUE);
+		g_slice_free(liMemCacheEntry, mce);
+	}
+}
+
+/* needs mc->lock */
+static void mem_cache_remove(liMemCache *mc, liMemCacheEntry *mce) {
+	g_queue_unlink(&mc->lru, &mce->lru_link);
+	g_hash_table_remove(mc->entries, mce->path);
+	mc->used -= mce->size;
+	li_mem_cache_entry_release(mce);
+}
+
+/* needs mc->lock. checks whether size bytes can be made available by evicting entries which are
+ * requested less frequently than freq (TinyLFU admission), and evicts them if evict is TRUE */
+static gboolean mem_cache_make_room(liMemCache *mc, guint freq, goffset size, gboolean evict) {
+	GList *l = mc->lru.tail;
+	goffset room = mc->limit - mc->used;
+
+	if (size > mc->limit) return FALSE;
+
+	while (room < size) {
+		liMemCacheEntry *victim;
+		if (NULL == l) return FALSE;
+		victim = l->data;
+		if (mem_cache_sketch_estimate(mc, victim->hash) >= freq) return FALSE;
+		room += victim->size;
+		l = l->prev;
+	}
+
+	if (evict) {
+		while (mc->limit - mc->used < size) {
+			mem_cache_remove(mc, mc->lru.tail->data);
+			mc->evictions++;
+		}
+	}
+
+	return TRUE;
+}
+
+liMemCache* li_mem_cache_new(void) {
+	liMemCache *mc = g_slice_new0(liMemCache);
+
+	mc->lock = g_mutex_new();
+	mc->entries = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	mc->filling = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&mc->lru);
+
+	return mc;
+}
+
+void li_mem_cache_free(liMemCache *mc) {
+	if (NULL == mc) return;
+
+	while (NULL != mc->lru.tail) mem_cache_remove(mc, mc->lru.tail->data);
+	g_hash_table_destroy(mc->entries);
+	/* workers (and their tasklet pools) are gone already */
+	LI_FORCE_ASSERT(0 == g_hash_table_size(mc->filling));
+	g_hash_table_destroy(mc->filling);
+	g_free(mc->sketch);
+	g_mutex_free(mc->lock);
+	g_slice_free(liMemCache, mc);
+}
+
+void li_mem_cache_set_limit(liMemCache *mc, goffset size) {
+	g_mutex_lock(mc->lock);
+	mc->limit = MAX(size, 0);
+	while (mc->used > mc->limit) {
+		mem_cache_remove(mc, mc->lru.tail->data);
+		mc->evictions++;
+	}
+	if (mc->limit > 0) mem_cache_sketch_resize(mc);
+	g_atomic_int_set(&mc->enabled, mc->limit > 0);
+	g_mutex_unlock(mc->lock);
+}
+
+gboolean li_mem_cache_enabled(liMemCache *mc) {
+	return NULL != mc && g_atomic_int_get(&mc->enabled);
+}
+
+liMemCacheEntry* li_mem_cache_get(liMemCache *mc, GString *path, const struct stat *st) {
+	liMemCacheEntry *mce;
+	guint hash;
+
+	if (!li_mem_cache_enabled(mc) || st->st_size > LI_MEM_CACHE_MAX_FILE_SIZE) return NULL;
+
+	hash = g_string_hash(path);
+
+	g_mutex_lock(mc->lock);
+	mem_cache_sketch_increment(mc, hash);
+	if (NULL != (mce = g_hash_table_lookup(mc->entries, path))) {
+		if (mem_cache_matches(mce, st)) {
+			mem_cache_entry_acquire(mce);
+			g_queue_unlink(&mc->lru, &mce->lru_link);
+			g_queue_push_head_link(&mc->lru, &mce->lru_link);
+		} else {
+			/* replaced or modified */
+			mem_cache_remove(mc, mce);
+			mce = NULL;
+		}
+	}
+	g_mutex_unlock(mc->lock);
+
+	return mce;
+}
+
+/* runs in the tasklet pool: don't block the worker with the read */
+static void mem_cache_fill_run(gpointer data) {
+	mem_cache_fill_job *job = data;
+	liBuffer *content = job->mce->content;
+	gsize done = 0, size = job->mce->size;
+
+	while (done < size) {
+		ssize_t r = pread(job->cf->fd, content->addr + done, size - done, done);
+		if (-1 == r && EINTR == errno) continue;
+		if (r <= 0) {
+			/* error or truncated since the stat(): not cached */
+			job->failed = TRUE;
+			return;
+		}
+		done += r;
+	}
+	content->used = done;
+}
+
+static void mem_cache_fill_finished(gpointer data) {
+	mem_cache_fill_job *job = data;
+	liMemCache *mc = job->mc;
+	liMemCacheEntry *mce = job->mce, *old;
+	guint freq;
+
+	g_mutex_lock(mc->lock);
+	g_hash_table_remove(mc->filling, mce->path);
+
+	if (job->failed || job->invalidated) goto drop;
+
+	if (NULL != (old = g_hash_table_lookup(mc->entries, mce->path))) {
+		if (old->dev == mce->dev && old->ino == mce->ino && old->size == mce->size
+				&& old->mtime == mce->mtime && old->mtime_nsec == mce->mtime_nsec) {
+			goto drop; /* filled by another worker in the meantime */
+		}
+		mem_cache_remove(mc, old);
+	}
+
+	freq = mem_cache_sketch_estimate(mc, mce->hash);
+	if (!li_mem_cache_enabled(mc) || !mem_cache_make_room(mc, freq, mce->size, TRUE)) {
+		mc->rejected++;
+		goto drop;
+	}
+
+	/* the cache takes the reference of the job */
+	g_hash_table_insert(mc->entries, mce->path, mce);
+	g_queue_push_head_link(&mc->lru, &mce->lru_link);
+	mc->used += mce->size;
+	mce = NULL;
+
+drop:
+	g_mutex_unlock(mc->lock);
+	li_mem_cache_entry_release(mce);
+	li_chunkfile_release(job->cf);
+	g_slice_free(mem_cache_fill_job, job);
+}
+
+void li_mem_cache_fill(liVRequest *vr, liMemCache *mc, GString *path, const struct stat *st, liChunkFile *cf) {
+	liMemCacheEntry *mce;
+	mem_cache_fill_job *job;
+	GString *mime_type;
+	guint hash;
+	gboolean admit;
+
+	if (!li_mem_cache_enabled(mc) || st->st_size <= 0 || st->st_size > LI_MEM_CACHE_MAX_FILE_SIZE) return;
+	if (NULL == cf || -1 == cf->fd) return;
+
+	hash = g_string_hash(path);
+
+	/* check before reading the file; checked again when inserting */
+	g_mutex_lock(mc->lock);
+	if (NULL != g_hash_table_lookup(mc->filling, path)) {
+		g_mutex_unlock(mc->lock);
+		return;
+	}
+	admit = mem_cache_make_room(mc, mem_cache_sketch_estimate(mc, hash), st->st_size, FALSE);
+	if (!admit) mc->rejected++;
+	g_mutex_unlock(mc->lock);
+	if (!admit) return;
+
+	mce = g_slice_new0(liMemCacheEntry);
+	mce->refcount = 1;
+	mce->path = g_string_new_len(GSTR_LEN(path));
+	mce->hash = hash;
+	mce->dev = st->st_dev;
+	mce->ino = st->st_ino;
+	mce->size = st->st_size;
+	mce->mtime = st->st_mtime;
+	mce->mtime_nsec = mem_cache_mtime_nsec(st);
+	mce->content = li_buffer_new_slice(st->st_size);
+	mce->lru_link.data = mce;
+
+	mce->etag_flags = CORE_OPTION(LI_CORE_OPTION_ETAG_FLAGS).number;
+	if (0 != mce->etag_flags) {
+		mce->etag = g_string_sized_new(15);
+		li_etag_create(mce->etag, st, mce->etag_flags);
+	}
+	mce->last_modified = g_string_sized_new(31);
+	if (!li_etag_last_modified(mce->last_modified, st->st_mtime)) {
+		g_string_free(mce->last_modified, TRUE);
+		mce->last_modified = NULL;
+	}
+	mce->mime_types = CORE_OPTIONPTR(LI_CORE_OPTION_MIME_TYPES).ptr;
+	if (NULL != (mime_type = li_mimetype_get(vr, path))) {
+		mce->mime_type = g_string_new_len(GSTR_LEN(mime_type));
+	}
+
+	job = g_slice_new0(mem_cache_fill_job);
+	job->mc = mc;
+	job->mce = mce;
+	li_chunkfile_acquire(cf);
+	job->cf = cf;
+
+	g_mutex_lock(mc->lock);
+	g_hash_table_insert(mc->filling, mce->path, job);
+	g_mutex_unlock(mc->lock);
+
+	li_tasklet_push(vr->wrk->tasklets, mem_cache_fill_run, mem_cache_fill_finished, job);
+}
+
+void li_mem_cache_invalidate(liMemCache *mc, GString *path, gboolean prefix) {
+	liMemCacheEntry *mce;
+
+	if (!li_mem_cache_enabled(mc)) return;
+
+	g_mutex_lock(mc->lock);
+	if (!prefix) {
+		mem_cache_fill_job *job;
+		if (NULL != (mce = g_hash_table_lookup(mc->entries, path))) mem_cache_remove(mc, mce);
+		/* the content being read might be from before the change */
+		if (NULL != (job = g_hash_table_lookup(mc->filling, path))) job->invalidated = TRUE;
+	} else {
+		GHashTableIter it;
+		gpointer key, value;
+		GList *l = mc->lru.head;
+		while (NULL != l) {
+			GList *next = l->next;
+			mce = l->data;
+			if (li_string_prefix(mce->path, GSTR_LEN(path))
+			    && (mce->path->len == path->len || G_DIR_SEPARATOR == mce->path->str[path->len])) {
+				mem_cache_remove(mc, mce);
+			}
+			l = next;
+		}
+		g_hash_table_iter_init(&it, mc->filling);
+		while (g_hash_table_iter_next(&it, &key, &value)) {
+			GString *fpath = key;
+			if (li_string_prefix(fpath, GSTR_LEN(path))
+			    && (fpath->len == path->len || G_DIR_SEPARATOR == fpath->str[path->len])) {
+				((mem_cache_fill_job*) value)->invalidated = TRUE;
+			}
+		}
+	}
+	g_mutex_unlock(mc->lock);
+}
+
+void li_mem_cache_counters(liMemCache *mc, guint *entries, goffset *size, guint64 *rejected, guint64 *evictions) {
+	g_mutex_lock(mc->lock);
+	*entries = mc->lru.length;
+	*size = mc->used;
+	*rejected = mc->rejected;
+	*evictions = mc->evictions;
+	g_mutex_unlock(mc->lock);
+}
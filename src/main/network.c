@@ -40,37 +40,19 @@ ssize_t li_net_read(int fd, void *buf, ssize_t nbyte) {
 	return r;
 }
 
-liNetworkStatus li_network_write(int fd, liChunkQueue *cq, goffset write_max, GError **err) {
-	liNetworkStatus res;
-#ifdef TCP_CORK
-	int corked = 0;
-#endif
-
-#ifdef TCP_CORK
-	/* Linux: put a cork into the socket as we want to combine the write() calls
-	 * but only if we really have multiple chunks
-	 */
-	if (cq->queue.length > 1) {
-		corked = 1;
-		setsockopt(fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
-	}
-#endif
-
-	/* TODO: add setup-option to select the backend */
+liNetworkStatus li_network_write(int fd, liChunkQueue *cq, goffset write_max, liNetworkBackend backend, GError **err) {
+	switch (backend) {
+	case LI_NETWORK_BACKEND_WRITEV:
+		return li_network_write_writev(fd, cq, &write_max, err);
+	case LI_NETWORK_BACKEND_SENDFILE:
+	case LI_NETWORK_BACKEND_IO_URING: /* handled by the caller for small writes */
+	default:
 #ifdef USE_SENDFILE
-	res = li_network_write_sendfile(fd, cq, &write_max, err);
+		return li_network_write_sendfile(fd, cq, &write_max, err);
 #else
-	res = li_network_write_writev(fd, cq, &write_max, err);
+		return li_network_write_writev(fd, cq, &write_max, err);
 #endif
-
-#ifdef TCP_CORK
-	if (corked) {
-		corked = 0;
-		setsockopt(fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
 	}
-#endif
-
-	return res;
 }
 
 liNetworkStatus li_network_read(int fd, liChunkQueue *cq, goffset read_max, liBuffer **buffer, GError **err) {
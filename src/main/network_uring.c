@@ -0,0 +1,342 @@
+#include <lighttpd/base.h>
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* one op per buffer slot; ops[i] always uses slot i */
+struct liNetworkUringOp {
+	liNetworkUring *ring;
+	liIOStream *stream; /* NULL after li_network_uring_detach */
+	int fd;
+	gboolean own_fd; /* close fd after write finished */
+	guint slot;
+	gsize offset, length;
+};
+
+struct liNetworkUring {
+	liWorker *wrk;
+	struct io_uring ring;
+	gboolean fixed_buffers; /* whether the slots are registered with the ring */
+	int event_fd;
+	liEventIO completion_watcher;
+
+	gchar *slots_mem;
+	liNetworkUringOp ops[LI_NETWORK_URING_SLOTS];
+	guint free_slots[LI_NETWORK_URING_SLOTS];
+	guint free_slots_len;
+
+	guint queued; /* sqes not submitted yet */
+};
+
+static gchar* uring_slot(liNetworkUring *ring, guint slot) {
+	return ring->slots_mem + (gsize) slot * LI_NETWORK_URING_SLOT_SIZE;
+}
+
+static gboolean uring_queue_write(liNetworkUringOp *op, gboolean wait_writable) {
+	liNetworkUring *ring = op->ring;
+	struct io_uring_sqe *sqe;
+	guint needed = wait_writable ? 2 : 1;
+
+	/* reserve all sqes up front: a linked poll must never get submitted without its write */
+	if (io_uring_sq_space_left(&ring->ring) < needed) {
+		li_network_uring_submit(ring);
+		if (io_uring_sq_space_left(&ring->ring) < needed) return FALSE;
+	}
+
+	if (wait_writable) {
+		/* socket returned EAGAIN: link a poll in front of the write */
+		sqe = io_uring_get_sqe(&ring->ring);
+		io_uring_prep_poll_add(sqe, op->fd, POLLOUT);
+		io_uring_sqe_set_data(sqe, NULL);
+		sqe->flags |= IOSQE_IO_LINK;
+		ring->queued++;
+	}
+
+	sqe = io_uring_get_sqe(&ring->ring);
+	if (ring->fixed_buffers) {
+		io_uring_prep_write_fixed(sqe, op->fd, uring_slot(ring, op->slot) + op->offset, op->length - op->offset, 0, op->slot);
+	} else {
+		io_uring_prep_write(sqe, op->fd, uring_slot(ring, op->slot) + op->offset, op->length - op->offset, 0);
+	}
+	io_uring_sqe_set_data(sqe, op);
+	ring->queued++;
+
+	return TRUE;
+}
+
+static void uring_op_release(liNetworkUringOp *op) {
+	liNetworkUring *ring = op->ring;
+
+	if (NULL != op->stream) {
+		op->stream->uring_op = NULL;
+		op->stream = NULL;
+	}
+	op->fd = -1;
+	op->own_fd = FALSE;
+	op->offset = op->length = 0;
+
+	ring->free_slots[ring->free_slots_len++] = op->slot;
+}
+
+static void uring_op_done(liNetworkUringOp *op, int res) {
+	liNetworkUring *ring = op->ring;
+	liWorker *wrk = ring->wrk;
+	liIOStream *stream = op->stream;
+
+	if (-EAGAIN == res || -EINTR == res || 0 == res || (res > 0 && op->offset + res < op->length)) {
+		if (res > 0) op->offset += res;
+
+		/* a detached stream doesn't own its fd anymore - it might have been reused already */
+		if ((NULL != stream || op->own_fd) && uring_queue_write(op, res <= 0)) return;
+
+		res = -EIO;
+	}
+
+	if (op->own_fd) {
+		if (res > 0) {
+			shutdown(op->fd, SHUT_WR);
+			li_worker_add_closing_socket(wrk, op->fd);
+		} else {
+			close(op->fd);
+		}
+	}
+
+	uring_op_release(op);
+
+	if (NULL == stream) return;
+
+	if (res < 0) {
+		switch (-res) {
+		case ECONNRESET:
+		case EPIPE:
+		case ETIMEDOUT:
+			break;
+		default:
+			ERROR(wrk->srv, "network write fatal error: io_uring write to fd=%d failed: %s", li_event_io_fd(&stream->io_watcher), g_strerror(-res));
+			break;
+		}
+		li_stream_simple_socket_close(stream, TRUE);
+		return;
+	}
+
+	/* only undo what li_network_uring_write did; throttling is handled by the stream itself */
+	stream->can_write = TRUE;
+	li_stream_again(&stream->stream_out);
+}
+
+static void uring_completion_cb(liEventBase *watcher, int events) {
+	liNetworkUring *ring = LI_CONTAINER_OF(li_event_io_from(watcher), liNetworkUring, completion_watcher);
+	struct io_uring_cqe *cqe;
+	eventfd_t value;
+	UNUSED(events);
+
+	eventfd_read(ring->event_fd, &value);
+
+	while (0 == io_uring_peek_cqe(&ring->ring, &cqe)) {
+		liNetworkUringOp *op = io_uring_cqe_get_data(cqe);
+		int res = cqe->res;
+
+		io_uring_cqe_seen(&ring->ring, cqe);
+
+		/* linked polls don't carry an op */
+		if (NULL != op) uring_op_done(op, res);
+	}
+
+	li_network_uring_submit(ring);
+}
+
+liNetworkUring* li_network_uring_new(liWorker *wrk, GError **err) {
+	liNetworkUring *ring = g_slice_new0(liNetworkUring);
+	int r;
+	guint i;
+
+	ring->wrk = wrk;
+
+	if (0 > (r = io_uring_queue_init(2 * LI_NETWORK_URING_SLOTS, &ring->ring, 0))) {
+		g_set_error(err, LI_NETWORK_ERROR, 0, "io_uring_queue_init failed: %s", g_strerror(-r));
+		g_slice_free(liNetworkUring, ring);
+		return NULL;
+	}
+
+	if (-1 == (ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+		g_set_error(err, LI_NETWORK_ERROR, 0, "eventfd failed: %s", g_strerror(errno));
+		io_uring_queue_exit(&ring->ring);
+		g_slice_free(liNetworkUring, ring);
+		return NULL;
+	}
+
+	if (0 > (r = io_uring_register_eventfd(&ring->ring, ring->event_fd))) {
+		g_set_error(err, LI_NETWORK_ERROR, 0, "io_uring_register_eventfd failed: %s", g_strerror(-r));
+		close(ring->event_fd);
+		io_uring_queue_exit(&ring->ring);
+		g_slice_free(liNetworkUring, ring);
+		return NULL;
+	}
+
+	ring->slots_mem = g_malloc((gsize) LI_NETWORK_URING_SLOTS * LI_NETWORK_URING_SLOT_SIZE);
+	for (i = 0; i < LI_NETWORK_URING_SLOTS; i++) {
+		ring->ops[i].ring = ring;
+		ring->ops[i].fd = -1;
+		ring->ops[i].slot = i;
+		ring->free_slots[i] = LI_NETWORK_URING_SLOTS - 1 - i;
+	}
+	ring->free_slots_len = LI_NETWORK_URING_SLOTS;
+
+	/* one registered buffer per slot; registering may fail due to RLIMIT_MEMLOCK, plain writes work too */
+	{
+		struct iovec iovs[LI_NETWORK_URING_SLOTS];
+		for (i = 0; i < LI_NETWORK_URING_SLOTS; i++) {
+			iovs[i].iov_base = uring_slot(ring, i);
+			iovs[i].iov_len = LI_NETWORK_URING_SLOT_SIZE;
+		}
+		r = io_uring_register_buffers(&ring->ring, iovs, LI_NETWORK_URING_SLOTS);
+		ring->fixed_buffers = (0 == r);
+		if (0 != r) {
+			WARNING(wrk->srv, "io_uring_register_buffers failed, using unregistered buffers: %s", g_strerror(-r));
+		}
+	}
+
+	li_event_io_init(&wrk->loop, "io_uring completions", &ring->completion_watcher, uring_completion_cb, ring->event_fd, LI_EV_READ);
+	li_event_set_keep_loop_alive(&ring->completion_watcher, FALSE);
+	li_event_start(&ring->completion_watcher);
+
+	return ring;
+}
+
+void li_network_uring_free(liNetworkUring *ring) {
+	guint i;
+
+	if (NULL == ring) return;
+
+	li_event_clear(&ring->completion_watcher);
+
+	/* drops all in-flight writes */
+	io_uring_queue_exit(&ring->ring);
+	close(ring->event_fd);
+
+	for (i = 0; i < LI_NETWORK_URING_SLOTS; i++) {
+		liNetworkUringOp *op = &ring->ops[i];
+		if (NULL != op->stream) op->stream->uring_op = NULL;
+		if (op->own_fd) close(op->fd);
+	}
+
+	g_free(ring->slots_mem);
+	g_slice_free(liNetworkUring, ring);
+}
+
+void li_network_uring_submit(liNetworkUring *ring) {
+	int r;
+
+	if (0 == ring->queued) return;
+
+	while (0 > (r = io_uring_submit(&ring->ring)) && -EINTR == r) ;
+
+	if (r < 0) {
+		ERROR(ring->wrk->srv, "io_uring_submit failed: %s", g_strerror(-r));
+		return;
+	}
+
+	ring->queued = 0;
+}
+
+gboolean li_network_uring_write(liNetworkUring *ring, liIOStream *stream, liChunkQueue *cq, goffset write_max) {
+	liNetworkUringOp *op;
+	liChunkIter ci;
+	gchar *dest;
+	gsize len = 0;
+
+	if (NULL != stream->uring_op) return TRUE; /* still busy */
+
+	/* large queues (most likely files) are better handled by sendfile() */
+	if (0 == cq->length || cq->length > LI_NETWORK_URING_SLOT_SIZE || cq->length > write_max) return FALSE;
+	if (0 == ring->free_slots_len) return FALSE;
+
+	op = &ring->ops[ring->free_slots[ring->free_slots_len - 1]];
+	dest = uring_slot(ring, op->slot);
+
+	ci = li_chunkqueue_iter(cq);
+	do {
+		goffset chunk_len = li_chunkiter_length(ci), chunk_off = 0;
+
+		while (chunk_off < chunk_len) {
+			char *data;
+			off_t data_len;
+			GError *err = NULL;
+
+			if (LI_HANDLER_GO_ON != li_chunkiter_read(ci, chunk_off, chunk_len - chunk_off, &data, &data_len, &err)) {
+				/* let the synchronous backend report the error */
+				if (NULL != err) g_error_free(err);
+				return FALSE;
+			}
+			memcpy(dest + len, data, data_len);
+			len += data_len;
+			chunk_off += data_len;
+		}
+	} while (li_chunkiter_next(&ci));
+
+	op->stream = stream;
+	op->fd = li_event_io_fd(&stream->io_watcher);
+	op->offset = 0;
+	op->length = len;
+
+	if (!uring_queue_write(op, FALSE)) {
+		op->stream = NULL;
+		op->fd = -1;
+		return FALSE;
+	}
+
+	ring->free_slots_len--;
+	stream->uring_op = op;
+	li_chunkqueue_skip(cq, len);
+
+	return TRUE;
+}
+
+gboolean li_network_uring_detach(liIOStream *stream, int fd) {
+	liNetworkUringOp *op = stream->uring_op;
+
+	if (NULL == op) return FALSE;
+
+	/* make sure the kernel got its reference to the fd before the caller closes it */
+	li_network_uring_submit(op->ring);
+
+	stream->uring_op = NULL;
+	op->stream = NULL;
+	if (-1 != fd) {
+		op->own_fd = TRUE;
+		op->fd = fd;
+	}
+
+	return TRUE;
+}
+
+#else
+
+liNetworkUring* li_network_uring_new(liWorker *wrk, GError **err) {
+	UNUSED(wrk);
+	g_set_error(err, LI_NETWORK_ERROR, 0, "io_uring support not available (compiled without liburing)");
+	return NULL;
+}
+
+void li_network_uring_free(liNetworkUring *ring) {
+	UNUSED(ring);
+}
+
+void li_network_uring_submit(liNetworkUring *ring) {
+	UNUSED(ring);
+}
+
+gboolean li_network_uring_write(liNetworkUring *ring, liIOStream *stream, liChunkQueue *cq, goffset write_max) {
+	UNUSED(ring); UNUSED(stream); UNUSED(cq); UNUSED(write_max);
+	return FALSE;
+}
+
+gboolean li_network_uring_detach(liIOStream *stream, int fd) {
+	UNUSED(stream); UNUSED(fd);
+	return FALSE;
+}
+
+#endif
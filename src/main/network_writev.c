@@ -24,6 +24,13 @@
 # endif
 #endif
 
+/* iovecs live on the stack: no allocation per call (UIO_MAXIOV is 1024 on linux -> 16kB) */
+#if UIO_MAXIOV > 1024
+# define LI_WRITEV_MAX_IOV 1024
+#else
+# define LI_WRITEV_MAX_IOV UIO_MAXIOV
+#endif
+
 /* first chunk must be a STRING_CHUNK ! */
 liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *write_max, GError **err) {
 	off_t we_have;
@@ -32,8 +39,8 @@ liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *wri
 	liChunkIter ci;
 	liChunk *c;
 	liNetworkStatus res = LI_NETWORK_STATUS_FATAL_ERROR;
-
-	GArray *chunks = g_array_sized_new(FALSE, TRUE, sizeof(struct iovec), UIO_MAXIOV);
+	struct iovec chunks[LI_WRITEV_MAX_IOV];
+	guint chunks_len = 0;
 
 	if (0 == cq->length) goto cleanup; /* FATAL ERROR */
 
@@ -47,11 +54,8 @@ liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *wri
 
 		we_have = 0;
 		do {
-			guint i = chunks->len;
 			off_t len = li_chunk_length(c);
-			struct iovec *v;
-			g_array_set_size(chunks, i + 1);
-			v = &g_array_index(chunks, struct iovec, i);
+			struct iovec *v = &chunks[chunks_len++];
 			if (c->type == STRING_CHUNK) {
 				v->iov_base = c->data.str->str + c->offset;
 			} else if (c->type == MEM_CHUNK) {
@@ -65,9 +69,9 @@ liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *wri
 		} while (we_have < *write_max &&
 		         li_chunkiter_next(&ci) &&
 		         (STRING_CHUNK == (c = li_chunkiter_chunk(ci))->type || MEM_CHUNK == c->type || BUFFER_CHUNK == c->type) &&
-		         chunks->len < UIO_MAXIOV);
+		         chunks_len < LI_WRITEV_MAX_IOV);
 
-		while (-1 == (r = writev(fd, &g_array_index(chunks, struct iovec, 0), chunks->len))) {
+		while (-1 == (r = writev(fd, chunks, chunks_len))) {
 			switch (errno) {
 			case EAGAIN:
 #if EWOULDBLOCK != EAGAIN
@@ -105,13 +109,12 @@ liNetworkStatus li_network_backend_writev(int fd, liChunkQueue *cq, goffset *wri
 		}
 
 		did_write_something = TRUE;
-		g_array_set_size(chunks, 0);
+		chunks_len = 0;
 	} while (*write_max > 0);
 
 	res = LI_NETWORK_STATUS_SUCCESS;
 
 cleanup:
-	g_array_free(chunks, TRUE);
 	return res;
 }
 
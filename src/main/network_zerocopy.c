@@ -0,0 +1,271 @@
+#include <lighttpd/base.h>
+
+#if defined(LIGHTY_OS_LINUX) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# define USE_ZEROCOPY
+#endif
+
+#ifdef USE_ZEROCOPY
+
+#include <linux/errqueue.h>
+
+/* the kernel numbers successful MSG_ZEROCOPY sends per socket, starting with 0,
+ * and reports finished ranges [lo, hi] on the error queue */
+typedef struct zerocopy_ref zerocopy_ref;
+struct zerocopy_ref {
+	guint32 seq;
+	liBuffer *buffer;
+};
+
+struct liNetworkZeroCopy {
+	GQueue pending; /* zerocopy_ref, ordered by seq */
+	guint32 next_seq;
+	gboolean disabled; /* SO_ZEROCOPY not supported by the socket */
+
+	/* orphaned (stream gone, fd is a dup waiting for the completions) */
+	int fd;
+	li_tstamp orphaned_ts;
+};
+
+static void zerocopy_complete(liNetworkZeroCopy *zc, guint32 lo, guint32 hi) {
+	GList *l = zc->pending.head;
+
+	while (NULL != l) {
+		zerocopy_ref *ref = l->data;
+		GList *next = l->next;
+
+		/* unsigned arithmetic handles wrap around */
+		if (ref->seq - lo <= hi - lo) {
+			li_buffer_release(ref->buffer);
+			g_slice_free(zerocopy_ref, ref);
+			g_queue_delete_link(&zc->pending, l);
+		}
+
+		l = next;
+	}
+}
+
+static void zerocopy_reap(liNetworkZeroCopy *zc, int fd) {
+	while (!g_queue_is_empty(&zc->pending)) {
+		gchar control[128];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT)) {
+			if (EINTR == errno) continue;
+			return; /* EAGAIN: nothing (more) finished yet */
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); NULL != cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr;
+
+			if (!(SOL_IP == cm->cmsg_level && IP_RECVERR == cm->cmsg_type)
+#ifdef HAVE_IPV6
+				&& !(SOL_IPV6 == cm->cmsg_level && IPV6_RECVERR == cm->cmsg_type)
+#endif
+				) continue;
+
+			serr = (struct sock_extended_err*) CMSG_DATA(cm);
+			if (SO_EE_ORIGIN_ZEROCOPY != serr->ee_origin || 0 != serr->ee_errno) continue;
+
+			zerocopy_complete(zc, serr->ee_info, serr->ee_data);
+		}
+	}
+}
+
+static void zerocopy_free(liNetworkZeroCopy *zc) {
+	zerocopy_ref *ref;
+
+	while (NULL != (ref = g_queue_pop_head(&zc->pending))) {
+		li_buffer_release(ref->buffer);
+		g_slice_free(zerocopy_ref, ref);
+	}
+
+	if (-1 != zc->fd) close(zc->fd);
+
+	g_slice_free(liNetworkZeroCopy, zc);
+}
+
+static void zerocopy_orphans_cb(liEventBase *watcher, int events) {
+	liWorker *wrk = LI_CONTAINER_OF(li_event_timer_from(watcher), liWorker, network_zerocopy_timer);
+	li_tstamp now = li_cur_ts(wrk);
+	guint i;
+	UNUSED(events);
+
+	for (i = wrk->network_zerocopy_orphans->len; i-- > 0; ) {
+		liNetworkZeroCopy *zc = g_ptr_array_index(wrk->network_zerocopy_orphans, i);
+
+		zerocopy_reap(zc, zc->fd);
+
+		/* after io.timeout the peer isn't reading anymore anyway */
+		if (g_queue_is_empty(&zc->pending) || zc->orphaned_ts + wrk->srv->io_timeout < now) {
+			g_ptr_array_remove_index_fast(wrk->network_zerocopy_orphans, i);
+			zerocopy_free(zc);
+		}
+	}
+
+	if (wrk->network_zerocopy_orphans->len > 0) {
+		li_event_timer_once(&wrk->network_zerocopy_timer, 1);
+	}
+}
+
+void li_network_zerocopy_worker_init(liWorker *wrk) {
+	wrk->network_zerocopy_orphans = g_ptr_array_new();
+	li_event_timer_init(&wrk->loop, "zerocopy completions", &wrk->network_zerocopy_timer, zerocopy_orphans_cb);
+	li_event_set_keep_loop_alive(&wrk->network_zerocopy_timer, FALSE);
+}
+
+void li_network_zerocopy_worker_clear(liWorker *wrk) {
+	guint i;
+
+	li_event_clear(&wrk->network_zerocopy_timer);
+
+	for (i = 0; i < wrk->network_zerocopy_orphans->len; i++) {
+		zerocopy_free(g_ptr_array_index(wrk->network_zerocopy_orphans, i));
+	}
+	g_ptr_array_free(wrk->network_zerocopy_orphans, TRUE);
+	wrk->network_zerocopy_orphans = NULL;
+}
+
+gboolean li_network_zerocopy_applies(liWorker *wrk, liIOStream *stream, liChunkQueue *cq) {
+	liChunk *c;
+
+	if (0 == wrk->srv->network_zerocopy_threshold || 0 == cq->length) return FALSE;
+	if (NULL != stream->zerocopy && stream->zerocopy->disabled) return FALSE;
+	if (stream->ktls_tx) return FALSE; /* the tls ulp rejects MSG_ZEROCOPY */
+
+	c = li_chunkqueue_first_chunk(cq);
+	return BUFFER_CHUNK == c->type && li_chunk_length(c) >= wrk->srv->network_zerocopy_threshold;
+}
+
+liNetworkStatus li_network_write_zerocopy(liIOStream *stream, liChunkQueue *cq, goffset *write_max, GError **err) {
+	int fd = li_event_io_fd(&stream->io_watcher);
+	liNetworkZeroCopy *zc = stream->zerocopy;
+	liChunk *c = li_chunkqueue_first_chunk(cq);
+	liBuffer *buf = c->data.buffer.buffer;
+	struct iovec iov;
+	struct msghdr msg;
+	goffset len;
+	ssize_t r;
+
+	if (NULL == zc) {
+		int val = 1;
+
+		zc = stream->zerocopy = g_slice_new0(liNetworkZeroCopy);
+		zc->fd = -1;
+		if (-1 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val))) {
+			zc->disabled = TRUE;
+			return li_network_write_writev(fd, cq, write_max, err);
+		}
+	} else if (!g_queue_is_empty(&zc->pending)) {
+		zerocopy_reap(zc, fd);
+	}
+
+	len = MIN(li_chunk_length(c), *write_max);
+	iov.iov_base = buf->addr + c->data.buffer.offset + c->offset;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	while (-1 == (r = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL))) {
+		switch (errno) {
+		case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+		case EWOULDBLOCK:
+#endif
+			return LI_NETWORK_STATUS_WAIT_FOR_EVENT;
+		case ENOBUFS:
+			/* optmem limit reached (too many pending completions): copy this time */
+			return li_network_backend_writev(fd, cq, write_max, err);
+		case ECONNRESET:
+		case EPIPE:
+		case ETIMEDOUT:
+			return LI_NETWORK_STATUS_CONNECTION_CLOSE;
+		case EINTR:
+			break; /* try again */
+		default:
+			g_set_error(err, LI_NETWORK_ERROR, 0, "li_network_write_zerocopy: oops, write to fd=%d failed: %s", fd, g_strerror(errno));
+			return LI_NETWORK_STATUS_FATAL_ERROR;
+		}
+	}
+
+	{
+		/* keep the buffer until the kernel is done with the pages */
+		zerocopy_ref *ref = g_slice_new(zerocopy_ref);
+		li_buffer_acquire(buf);
+		ref->buffer = buf;
+		ref->seq = zc->next_seq++;
+		g_queue_push_tail(&zc->pending, ref);
+	}
+
+	li_chunkqueue_skip(cq, r);
+	*write_max -= r;
+
+	return (r < len) ? LI_NETWORK_STATUS_WAIT_FOR_EVENT : LI_NETWORK_STATUS_SUCCESS;
+}
+
+void li_network_zerocopy_reap(liIOStream *stream) {
+	liNetworkZeroCopy *zc = stream->zerocopy;
+	int fd = li_event_io_fd(&stream->io_watcher);
+
+	if (NULL == zc || -1 == fd || g_queue_is_empty(&zc->pending)) return;
+
+	zerocopy_reap(zc, fd);
+}
+
+void li_network_zerocopy_release(liIOStream *stream) {
+	liNetworkZeroCopy *zc = stream->zerocopy;
+	int fd = li_event_io_fd(&stream->io_watcher);
+	liWorker *wrk;
+
+	if (NULL == zc) return;
+	stream->zerocopy = NULL;
+
+	if (-1 != fd && !g_queue_is_empty(&zc->pending)) zerocopy_reap(zc, fd);
+
+	if (-1 == fd || g_queue_is_empty(&zc->pending) || -1 == (zc->fd = dup(fd))) {
+		zerocopy_free(zc);
+		return;
+	}
+
+	/* the socket stays open (through the dup) until the kernel released all buffers */
+	wrk = li_worker_from_iostream(stream);
+	zc->orphaned_ts = li_cur_ts(wrk);
+	g_ptr_array_add(wrk->network_zerocopy_orphans, zc);
+	if (!li_event_active(&wrk->network_zerocopy_timer)) {
+		li_event_timer_once(&wrk->network_zerocopy_timer, 1);
+	}
+}
+
+#else
+
+void li_network_zerocopy_worker_init(liWorker *wrk) {
+	wrk->network_zerocopy_orphans = NULL;
+}
+
+void li_network_zerocopy_worker_clear(liWorker *wrk) {
+	UNUSED(wrk);
+}
+
+gboolean li_network_zerocopy_applies(liWorker *wrk, liIOStream *stream, liChunkQueue *cq) {
+	UNUSED(wrk); UNUSED(stream); UNUSED(cq);
+	return FALSE;
+}
+
+liNetworkStatus li_network_write_zerocopy(liIOStream *stream, liChunkQueue *cq, goffset *write_max, GError **err) {
+	return li_network_write_writev(li_event_io_fd(&stream->io_watcher), cq, write_max, err);
+}
+
+void li_network_zerocopy_reap(liIOStream *stream) {
+	UNUSED(stream);
+}
+
+void li_network_zerocopy_release(liIOStream *stream) {
+	UNUSED(stream);
+}
+
+#endif
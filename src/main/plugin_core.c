@@ -541,8 +541,20 @@ static liAction* core_index(liServer *srv, liWorker *wrk, liPlugin* p, liValue *
 }
 
 
+/* append from the memory cache entry if there is one, otherwise from the file */
+static void core_static_append(liChunkQueue *cq, liChunkFile *cf, liMemCacheEntry *mce, goffset start, goffset length) {
+	if (NULL != mce) {
+		li_buffer_acquire(mce->content);
+		li_chunkqueue_append_buffer2(cq, mce->content, start, length);
+	} else {
+		li_chunkqueue_append_chunkfile(cq, cf, start, length);
+	}
+}
+
 static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpointer *context) {
-	int fd = -1;
+	liChunkFile *cf = NULL;
+	liMemCache *mc = vr->wrk->srv->mem_cache;
+	liMemCacheEntry *mce = NULL;
 	struct stat st;
 	int err;
 	liHandlerResult res;
@@ -597,9 +609,32 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 		}
 	}
 
-	res = li_stat_cache_get(vr, vr->physical.path, &st, &err, &fd);
-	if (res == LI_HANDLER_WAIT_FOR_EVENT)
-		return res;
+	if (li_mem_cache_enabled(mc)) {
+		/* small hot files are served from memory without opening them */
+		res = li_stat_cache_get(vr, vr->physical.path, &st, &err, NULL);
+		if (res == LI_HANDLER_WAIT_FOR_EVENT)
+			return res;
+
+		if (res == LI_HANDLER_GO_ON && S_ISREG(st.st_mode)) {
+			if (NULL != (mce = li_mem_cache_get(mc, vr->physical.path, &st))) {
+				vr->wrk->stats.mem_cache_hits++;
+			} else {
+				res = li_stat_cache_get_file(vr, vr->physical.path, &st, &err, &cf);
+				if (res == LI_HANDLER_WAIT_FOR_EVENT)
+					return res;
+
+				if (res == LI_HANDLER_GO_ON && S_ISREG(st.st_mode) && st.st_size <= LI_MEM_CACHE_MAX_FILE_SIZE) {
+					vr->wrk->stats.mem_cache_misses++;
+					/* read in the background; this response is sent from the file */
+					li_mem_cache_fill(vr, mc, vr->physical.path, &st, cf);
+				}
+			}
+		}
+	} else {
+		res = li_stat_cache_get_file(vr, vr->physical.path, &st, &err, &cf);
+		if (res == LI_HANDLER_WAIT_FOR_EVENT)
+			return res;
+	}
 
 	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 		VR_DEBUG(vr, "try serving static file: '%s'", vr->physical.path->str);
@@ -608,9 +643,6 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 	if (res == LI_HANDLER_ERROR) {
 		/* open or fstat failed */
 
-		if (fd != -1)
-			close(fd);
-
 		if (no_fail) return LI_HANDLER_GO_ON;
 
 		if (!li_vrequest_handle_direct(vr)) {
@@ -634,17 +666,12 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 			return LI_HANDLER_GO_ON;
 		}
 	} else if (S_ISDIR(st.st_mode)) {
-		if (fd != -1)
-			close(fd);
 		return LI_HANDLER_GO_ON;
 	} else if (!S_ISREG(st.st_mode)) {
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "not a regular file: '%s'", vr->physical.path->str);
 		}
 
-		if (fd != -1)
-			close(fd);
-
 		if (no_fail) return LI_HANDLER_GO_ON;
 
 		if (!li_vrequest_handle_direct(vr)) {
@@ -657,24 +684,31 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 		gboolean cachable;
 		gboolean ranged_response = FALSE;
 		liHttpHeader *hh_range;
-		liChunkFile *cf;
 		static const GString default_mime_str = { CONST_STR_LEN("application/octet-stream"), 0 };
 
 		if (!li_vrequest_handle_direct(vr)) {
-			close(fd);
+			li_chunkfile_release(cf);
+			li_mem_cache_entry_release(mce);
 			return LI_HANDLER_ERROR;
 		}
 
-		li_etag_set_header(vr, &st, &cachable);
+		if (NULL != mce && mce->etag_flags == (guint) CORE_OPTION(LI_CORE_OPTION_ETAG_FLAGS).number) {
+			li_etag_set_header_strings(vr, mce->etag, mce->last_modified, &cachable);
+		} else {
+			li_etag_set_header(vr, &st, &cachable);
+		}
 		if (cachable) {
 			vr->response.http_status = 304;
-			close(fd);
+			li_chunkfile_release(cf);
+			li_mem_cache_entry_release(mce);
 			return LI_HANDLER_GO_ON;
 		}
 
-		cf = li_chunkfile_new(NULL, fd, FALSE);
-
-		mime_str = li_mimetype_get(vr, vr->physical.path);
+		if (NULL != mce && mce->mime_types == CORE_OPTIONPTR(LI_CORE_OPTION_MIME_TYPES).ptr) {
+			mime_str = mce->mime_type;
+		} else {
+			mime_str = li_mimetype_get(vr, vr->physical.path);
+		}
 		if (!mime_str) mime_str = &default_mime_str;
 
 		if (CORE_OPTION(LI_CORE_OPTION_STATIC_RANGE_REQUESTS).boolean) {
@@ -699,10 +733,10 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 							GString *subheader = g_string_sized_new(1023);
 							g_string_append_printf(subheader, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: %s\r\n\r\n", boundary, mime_str->str, vr->wrk->tmp_str->str);
 							li_chunkqueue_append_string(vr->direct_out, subheader);
-							li_chunkqueue_append_chunkfile(vr->direct_out, cf, rs.range_start, rs.range_length);
+							core_static_append(vr->direct_out, cf, mce, rs.range_start, rs.range_length);
 						} else {
 							li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Range"), GSTR_LEN(vr->wrk->tmp_str));
-							li_chunkqueue_append_chunkfile(vr->direct_out, cf, rs.range_start, rs.range_length);
+							core_static_append(vr->direct_out, cf, mce, rs.range_start, rs.range_length);
 						}
 						break;
 					case LI_PARSE_HTTP_RANGE_DONE:
@@ -742,10 +776,11 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 		if (!ranged_response) {
 			vr->response.http_status = 200;
 			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
-			li_chunkqueue_append_chunkfile(vr->direct_out, cf, 0, st.st_size);
+			core_static_append(vr->direct_out, cf, mce, 0, st.st_size);
 		}
 
 		li_chunkfile_release(cf);
+		li_mem_cache_entry_release(mce);
 	}
 
 	return LI_HANDLER_GO_ON;
@@ -1186,6 +1221,63 @@ fail:
 }
 
 
+static void core_listen_reuseport_prepare(liServer *srv, gpointer data, gboolean aborted) {
+	GString *str = data;
+
+	/* worker count is known now */
+	if (!aborted) li_angel_listen_reuseport(srv, str, srv->listen_cpu_steering);
+
+	g_string_free(str, TRUE);
+}
+
+static gboolean core_listen_reuseport(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (NULL == val) goto fail;
+
+	if (LI_VALUE_STRING == li_value_type(val)) {
+		li_server_register_prepare_cb(srv, core_listen_reuseport_prepare, g_string_new_len(GSTR_LEN(val->data.string)));
+	} else if (LI_VALUE_LIST == li_value_type(val)) {
+		LI_VALUE_FOREACH(ip, val);
+			if (LI_VALUE_STRING != li_value_type(ip)) goto fail;
+		LI_VALUE_END_FOREACH()
+		LI_VALUE_FOREACH(ip, val);
+			li_server_register_prepare_cb(srv, core_listen_reuseport_prepare, g_string_new_len(GSTR_LEN(ip->data.string)));
+		LI_VALUE_END_FOREACH()
+	} else {
+		goto fail;
+	}
+
+	return TRUE;
+
+fail:
+	ERROR(srv, "%s", "listen.reuseport expects a string or list of strings as parameter");
+	return FALSE;
+}
+
+static gboolean core_http3(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	return li_http3_setup(srv, val);
+}
+
+static gboolean core_listen_cpu_steering(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_BOOLEAN != li_value_type(val)) {
+		ERROR(srv, "%s", "listen.cpu_steering expects a boolean as parameter");
+		return FALSE;
+	}
+
+	srv->listen_cpu_steering = val->data.boolean;
+
+	return TRUE;
+}
+
 static gboolean core_workers(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	gint workers;
 	UNUSED(p); UNUSED(userdata);
@@ -1315,6 +1407,55 @@ static gboolean core_stat_cache_ttl(liServer *srv, liPlugin* p, liValue *val, gp
 	return TRUE;
 }
 
+static gboolean core_stat_cache_shared(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_BOOLEAN != li_value_type(val)) {
+		ERROR(srv, "%s", "stat_cache.shared expects a boolean as parameter");
+		return FALSE;
+	}
+
+	srv->stat_cache_shared_enabled = val->data.boolean;
+
+	return TRUE;
+}
+
+static gboolean core_stat_cache_fd_cache(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	guint limit;
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "%s", "stat_cache.fd_cache expects a positive number as parameter");
+		return FALSE;
+	}
+
+	limit = li_fd_cache_set_limit(srv->fd_cache, MIN(val->data.number, G_MAXUINT));
+	if (limit < val->data.number) {
+		WARNING(srv, "stat_cache.fd_cache: limited to %u entries by the number of available file descriptors", limit);
+	}
+
+	return TRUE;
+}
+
+static gboolean core_static_memory_cache(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "%s", "static.memory_cache expects a positive number (size in bytes) as parameter");
+		return FALSE;
+	}
+
+	li_mem_cache_set_limit(srv->mem_cache, val->data.number);
+
+	return TRUE;
+}
+
 static gboolean core_tasklet_pool_threads(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	UNUSED(p); UNUSED(userdata);
 
@@ -1331,6 +1472,58 @@ static gboolean core_tasklet_pool_threads(liServer *srv, liPlugin* p, liValue *v
 	return TRUE;
 }
 
+static gboolean core_network_backend(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	const gchar *backend;
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_STRING != li_value_type(val)) {
+		ERROR(srv, "%s", "network.backend expects a string as parameter");
+		return FALSE;
+	}
+
+	backend = val->data.string->str;
+	if (0 == strcmp(backend, "sendfile")) {
+		srv->network_backend = LI_NETWORK_BACKEND_SENDFILE;
+	} else if (0 == strcmp(backend, "writev")) {
+		srv->network_backend = LI_NETWORK_BACKEND_WRITEV;
+	} else if (0 == strcmp(backend, "io_uring")) {
+#ifdef HAVE_LIBURING
+		srv->network_backend = LI_NETWORK_BACKEND_IO_URING;
+#else
+		ERROR(srv, "%s", "network.backend: io_uring not supported (compiled without liburing)");
+		return FALSE;
+#endif
+	} else {
+		ERROR(srv, "network.backend: unknown backend '%s', expected \"sendfile\", \"writev\" or \"io_uring\"", backend);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean core_network_zerocopy_threshold(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "%s", "network.zerocopy_threshold expects a positive number as parameter");
+		return FALSE;
+	}
+
+#if !defined(LIGHTY_OS_LINUX) || !defined(SO_ZEROCOPY) || !defined(MSG_ZEROCOPY)
+	if (val->data.number > 0) {
+		WARNING(srv, "%s", "network.zerocopy_threshold: MSG_ZEROCOPY not supported on this platform, ignoring");
+	}
+#endif
+
+	srv->network_zerocopy_threshold = val->data.number;
+
+	return TRUE;
+}
+
 /*
  * OPTIONS
  */
@@ -2267,6 +2460,8 @@ static const liPluginOption options[] = {
 
 	{ "cgi.mangle_env_names", LI_VALUE_BOOLEAN, TRUE, NULL },
 
+	{ "http2.cleartext", LI_VALUE_BOOLEAN, FALSE, NULL },
+
 	{ NULL, 0, 0, NULL }
 };
 
@@ -2276,6 +2471,8 @@ static const liPluginOptionPtr optionptrs[] = {
 	{ "server.name", LI_VALUE_STRING, NULL, NULL, NULL },
 	{ "server.tag", LI_VALUE_STRING, PACKAGE_DESC, NULL, NULL },
 
+	{ "alt_svc", LI_VALUE_STRING, NULL, NULL, NULL },
+
 	{ "mime_types", LI_VALUE_LIST, NULL, core_option_mime_types_parse, core_option_mime_types_free },
 
 	{ NULL, 0, NULL, NULL, NULL }
@@ -2327,12 +2524,20 @@ static const liPluginAction actions[] = {
 
 static const liPluginSetup setups[] = {
 	{ "listen", core_listen, NULL },
+	{ "listen.reuseport", core_listen_reuseport, NULL },
+	{ "listen.cpu_steering", core_listen_cpu_steering, NULL },
+	{ "http3", core_http3, NULL },
 	{ "workers", core_workers, NULL },
 	{ "workers.cpu_affinity", core_workers_cpu_affinity, NULL },
 	{ "module_load", core_module_load, NULL },
 	{ "io.timeout", core_io_timeout, NULL },
 	{ "stat_cache.ttl", core_stat_cache_ttl, NULL },
+	{ "stat_cache.shared", core_stat_cache_shared, NULL },
+	{ "stat_cache.fd_cache", core_stat_cache_fd_cache, NULL },
+	{ "static.memory_cache", core_static_memory_cache, NULL },
 	{ "tasklet_pool.threads", core_tasklet_pool_threads, NULL },
+	{ "network.backend", core_network_backend, NULL },
+	{ "network.zerocopy_threshold", core_network_zerocopy_threshold, NULL },
 	{ "log", core_setup_log, NULL },
 	{ "log.timestamp", core_setup_log_timestamp, NULL },
 	{ "fetch.files_static", core_register_fetch_files_static, NULL },
@@ -2420,10 +2625,18 @@ static void plugin_core_prepare_worker_cpu_affinity(liServer *srv, liWorker *wrk
 }
 #endif
 
+static void plugin_core_prepare(liServer *srv, liPlugin *p) {
+	UNUSED(p);
+
+	/* the udp sockets for "http3" need the worker count */
+	li_http3_prepare(srv);
+}
+
 static void plugin_core_prepare_worker(liServer *srv, liPlugin *p, liWorker *wrk) {
 	UNUSED(p);
 
 	plugin_core_prepare_worker_cpu_affinity(srv, wrk);
+	wrk->http3 = li_http3_worker_new(wrk);
 }
 
 void li_plugin_core_init(liServer *srv, liPlugin *p, gpointer userdata) {
@@ -2435,5 +2648,6 @@ void li_plugin_core_init(liServer *srv, liPlugin *p, gpointer userdata) {
 	p->setups = setups;
 	p->angelcbs = angelcbs;
 
+	p->handle_prepare = plugin_core_prepare;
 	p->handle_prepare_worker = plugin_core_prepare_worker;
 }
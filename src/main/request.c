@@ -88,9 +88,9 @@ void li_request_copy(liRequest *dest, const liRequest *src) {
 }
 
 /* closes connection after response */
-static void bad_request(liConnection *con, int status) {
-	con->info.keep_alive = FALSE;
-	con->mainvr->response.http_status = status;
+static void bad_request(liVRequest *vr, int status) {
+	vr->coninfo->keep_alive = FALSE;
+	vr->response.http_status = status;
 }
 
 static gboolean request_parse_url(liVRequest *vr) {
@@ -117,12 +117,18 @@ static gboolean request_parse_url(liVRequest *vr) {
 }
 
 gboolean li_request_validate_header(liConnection *con) {
-	liRequest *req = &con->mainvr->request;
+	return li_request_validate_header_vr(con->mainvr, &con->expect_100_cont);
+}
+
+gboolean li_request_validate_header_vr(liVRequest *vr, gboolean *expect_100_cont) {
+	liRequest *req = &vr->request;
 	liHttpHeader *hh;
 	GList *l;
 	gboolean transfer_encoding_chunked = FALSE;
+	/* HTTP/2 frames the request body itself (END_STREAM), so the length doesn't need to be known in advance */
+	gboolean framed_body;
 
-	if (con->info.is_ssl) {
+	if (vr->coninfo->is_ssl) {
 		li_g_string_append_len(req->uri.scheme, CONST_STR_LEN("https"));
 	} else {
 		li_g_string_append_len(req->uri.scheme, CONST_STR_LEN("http"));
@@ -131,19 +137,22 @@ gboolean li_request_validate_header(liConnection *con) {
 	switch (req->http_version) {
 	case LI_HTTP_VERSION_1_0:
 		if (!li_http_header_is(req->headers, CONST_STR_LEN("connection"), CONST_STR_LEN("keep-alive")))
-			con->info.keep_alive = FALSE;
+			vr->coninfo->keep_alive = FALSE;
 		break;
 	case LI_HTTP_VERSION_1_1:
 		if (li_http_header_is(req->headers, CONST_STR_LEN("connection"), CONST_STR_LEN("close")))
-			con->info.keep_alive = FALSE;
+			vr->coninfo->keep_alive = FALSE;
+		break;
+	case LI_HTTP_VERSION_2:
+	case LI_HTTP_VERSION_3:
 		break;
 	case LI_HTTP_VERSION_UNSET:
-		bad_request(con, 505); /* Version not Supported */
+		bad_request(vr, 505); /* Version not Supported */
 		return FALSE;
 	}
 
 	if (req->uri.raw->len == 0) {
-		bad_request(con, 400); /* bad request */
+		bad_request(vr, 400); /* bad request */
 		return FALSE;
 	}
 
@@ -152,7 +161,7 @@ gboolean li_request_validate_header(liConnection *con) {
 	if (NULL != l) {
 		if (NULL != li_http_header_find_next(l, CONST_STR_LEN("host"))) {
 			/* more than one "host" header */
-			bad_request(con, 400); /* bad request */
+			bad_request(vr, 400); /* bad request */
 			return FALSE;
 		}
 
@@ -162,20 +171,20 @@ gboolean li_request_validate_header(liConnection *con) {
 	}
 
 	/* Need hostname in HTTP/1.1 */
-	if (req->uri.authority->len == 0 && req->http_version == LI_HTTP_VERSION_1_1) {
-		bad_request(con, 400); /* bad request */
+	if (req->uri.authority->len == 0 && req->http_version >= LI_HTTP_VERSION_1_1) {
+		bad_request(vr, 400); /* bad request */
 		return FALSE;
 	}
 
 	/* may override hostname */
-	if (!request_parse_url(con->mainvr)) {
-		bad_request(con, 400); /* bad request */
+	if (!request_parse_url(vr)) {
+		bad_request(vr, 400); /* bad request */
 		return FALSE;
 	}
 
 	if (req->uri.host->len == 0 && req->uri.authority->len != 0) {
 		if (!li_parse_hostname(&req->uri)) {
-			bad_request(con, 400); /* bad request */
+			bad_request(vr, 400); /* bad request */
 			return FALSE;
 		}
 	}
@@ -196,8 +205,8 @@ gboolean li_request_validate_header(liConnection *con) {
 
 		r = g_ascii_strtoll(val, &err, 10);
 		if (*err != '\0') {
-			_VR_DEBUG(con->srv, con->mainvr, "content-length is not a number: %s (Status: 400)", err);
-			bad_request(con, 400); /* bad request */
+			_VR_DEBUG(vr->wrk->srv, vr, "content-length is not a number: %s (Status: 400)", err);
+			bad_request(vr, 400); /* bad request */
 			return FALSE;
 		}
 
@@ -206,7 +215,7 @@ gboolean li_request_validate_header(liConnection *con) {
 			* and is a bad request
 			*/
 		if (r < 0) {
-			bad_request(con, 400); /* bad request */
+			bad_request(vr, 400); /* bad request */
 			return FALSE;
 		}
 
@@ -215,12 +224,12 @@ gboolean li_request_validate_header(liConnection *con) {
 			*/
 		if (r == G_MININT64 || r == G_MAXINT64) {
 			if (errno == ERANGE) {
-				bad_request(con, 413); /* Request Entity Too Large */
+				bad_request(vr, 413); /* Request Entity Too Large */
 				return FALSE;
 			}
 		}
 
-		con->mainvr->request.content_length = r;
+		req->content_length = r;
 	}
 
 	/* Transfer-Encoding: chunked */
@@ -234,41 +243,43 @@ gboolean li_request_validate_header(liConnection *con) {
 			} if (0 == g_ascii_strcasecmp( LI_HEADER_VALUE(hh), "chunked" )) {
 				if (transfer_encoding_chunked) {
 					/* The "chunked" transfer-coding MUST NOT be applied more than once to a message-body */
-					bad_request(con, 400); /* bad request */
+					bad_request(vr, 400); /* bad request */
 					return FALSE;
 				}
 				transfer_encoding_chunked = TRUE;
-				con->mainvr->request.content_length = -1;
+				req->content_length = -1;
 			} else {
 				/* we only support chunked transfer-encoding */
-				bad_request(con, 501); /* Unimplemented */
+				bad_request(vr, 501); /* Unimplemented */
 				return FALSE;
 			}
 		}
 	}
 
+	framed_body = transfer_encoding_chunked || LI_HTTP_VERSION_2 == req->http_version || LI_HTTP_VERSION_3 == req->http_version;
+
 	/* Expect: 100-continue */
 	l = li_http_header_find_first(req->headers, CONST_STR_LEN("expect"));
 	if (l) {
-		gboolean expect_100_cont = FALSE;
+		gboolean expect_100 = FALSE;
 
 		for ( ; l ; l = li_http_header_find_next(l, CONST_STR_LEN("expect")) ) {
 			hh = (liHttpHeader*) l->data;
 			if (0 == g_ascii_strcasecmp( LI_HEADER_VALUE(hh), "100-continue" )) {
-				expect_100_cont = TRUE;
+				expect_100 = TRUE;
 			} else {
 				/* we only support 100-continue */
-				bad_request(con, 417); /* Expectation Failed */
+				bad_request(vr, 417); /* Expectation Failed */
 				return FALSE;
 			}
 		}
 
-		if (expect_100_cont && req->http_version == LI_HTTP_VERSION_1_0) {
+		if (expect_100 && req->http_version == LI_HTTP_VERSION_1_0) {
 			/* only HTTP/1.1 clients can send us this header */
-			bad_request(con, 417); /* Expectation Failed */
+			bad_request(vr, 417); /* Expectation Failed */
 			return FALSE;
 		}
-		con->expect_100_cont = expect_100_cont;
+		*expect_100_cont = expect_100;
 	}
 
 	/* TODO: headers:
@@ -277,36 +288,36 @@ gboolean li_request_validate_header(liConnection *con) {
 	 * - Range (duplicate check)
 	 */
 
-	switch(con->mainvr->request.http_method) {
+	switch(req->http_method) {
 	case LI_HTTP_METHOD_GET:
 	case LI_HTTP_METHOD_HEAD:
 		/* content-length is forbidden for those */
-		if (con->mainvr->request.content_length > 0) {
-			VR_ERROR(con->mainvr, "%s", "GET/HEAD with content-length -> 400");
+		if (req->content_length > 0) {
+			VR_ERROR(vr, "%s", "GET/HEAD with content-length -> 400");
 
-			bad_request(con, 400); /* bad request */
+			bad_request(vr, 400); /* bad request */
 			return FALSE;
 		}
-		con->mainvr->request.content_length = 0;
+		req->content_length = 0;
 		break;
 	case LI_HTTP_METHOD_POST:
 		/* content-length or chunked encoding is required for them */
-		if (con->mainvr->request.content_length == -1 && !transfer_encoding_chunked) {
+		if (req->content_length == -1 && !framed_body) {
 			/* content-length is missing */
-			if (_CORE_OPTION(con->mainvr, LI_CORE_OPTION_STRICT_POST_CONTENT_LENGTH).boolean) {
-				VR_ERROR(con->mainvr, "%s", "POST-request, but content-length missing -> 411");
+			if (_CORE_OPTION(vr, LI_CORE_OPTION_STRICT_POST_CONTENT_LENGTH).boolean) {
+				VR_ERROR(vr, "%s", "POST-request, but content-length missing -> 411");
 
-				bad_request(con, 411); /* Length Required */
+				bad_request(vr, 411); /* Length Required */
 				return FALSE;
 			} else {
-				con->mainvr->request.content_length = 0;
+				req->content_length = 0;
 			}
 		}
 		break;
 	default:
 		/* they may have a content-length or use chunked encoding */
-		if (con->mainvr->request.content_length == -1 && !transfer_encoding_chunked)
-			con->mainvr->request.content_length = 0;
+		if (req->content_length == -1 && !framed_body)
+			req->content_length = 0;
 		break;
 	}
 
@@ -24,6 +24,12 @@ static int lua_request_attr_read_http_version(liRequest *req, lua_State *L) {
 	case LI_HTTP_VERSION_1_1:
 		lua_pushliteral(L, "HTTP/1.1");
 		break;
+	case LI_HTTP_VERSION_2:
+		lua_pushliteral(L, "HTTP/2.0");
+		break;
+	case LI_HTTP_VERSION_3:
+		lua_pushliteral(L, "HTTP/3.0");
+		break;
 	case LI_HTTP_VERSION_UNSET:
 	default:
 		lua_pushnil(L);
@@ -22,8 +22,6 @@ void li_response_clear(liResponse *resp) {
 	resp->transfer_encoding = LI_HTTP_TRANSFER_ENCODING_IDENTITY;
 }
 
-static void li_response_send_error_page(liVRequest *vr, liChunkQueue *response_body);
-
 void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueue *response_body, gboolean upgraded) {
 	GString *head;
 	gboolean have_real_body, response_complete;
@@ -111,7 +109,7 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 	{
 		liHttpHeader *header;
 		GList *iter;
-		gboolean have_date = FALSE, have_server = FALSE;
+		gboolean have_date = FALSE, have_server = FALSE, have_alt_svc = FALSE;
 
 		for (iter = g_queue_peek_head_link(&vr->response.headers->entries); iter; iter = g_list_next(iter)) {
 			header = (liHttpHeader*) iter->data;
@@ -121,6 +119,7 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 			li_g_string_append_len(head, CONST_STR_LEN("\r\n"));
 			if (!have_date && li_http_header_key_is(header, CONST_STR_LEN("date"))) have_date = TRUE;
 			if (!have_server && li_http_header_key_is(header, CONST_STR_LEN("server"))) have_server = TRUE;
+			if (!have_alt_svc && li_http_header_key_is(header, CONST_STR_LEN("alt-svc"))) have_alt_svc = TRUE;
 		}
 
 		if (!have_date) {
@@ -140,6 +139,16 @@ void li_response_send_headers(liVRequest *vr, liChunkQueue *raw_out, liChunkQueu
 				li_g_string_append_len(head, CONST_STR_LEN("\r\n"));
 			}
 		}
+
+		if (!have_alt_svc && !upgraded) {
+			GString *alt_svc = CORE_OPTIONPTR(LI_CORE_OPTION_ALT_SVC).string;
+
+			if (NULL != alt_svc && alt_svc->len) {
+				li_g_string_append_len(head, CONST_STR_LEN("Alt-Svc: "));
+				li_g_string_append_len(head, GSTR_LEN(alt_svc));
+				li_g_string_append_len(head, CONST_STR_LEN("\r\n"));
+			}
+		}
 	}
 
 	li_g_string_append_len(head, CONST_STR_LEN("\r\n"));
@@ -210,7 +219,7 @@ static gchar *li_response_error_description(guint status_code, guint *len) {
 	}
 }
 
-static void li_response_send_error_page(liVRequest *vr, liChunkQueue *response_body) {
+void li_response_send_error_page(liVRequest *vr, liChunkQueue *response_body) {
 	gchar status_code[3];
 	guint len;
 	gchar *str;
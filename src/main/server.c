@@ -16,13 +16,13 @@ static void li_server_stop(liServer *srv);
 static void state_ready_cb(liEventBase *watcher, int events);
 static void li_server_1sec_timer(liEventBase *watcher, int events);
 
-static liServerSocket* server_socket_new(liServer *srv, int fd) {
+static liServerSocket* server_socket_new(liEventLoop *loop, int fd) {
 	liServerSocket *sock = g_slice_new0(liServerSocket);
 
 	sock->local_addr = li_sockaddr_local_from_socket(fd);
 	sock->refcount = 1;
 	li_fd_no_block(fd);
-	li_event_io_init(&srv->main_worker->loop, "server socket", &sock->watcher, li_server_listen_cb, fd, LI_EV_READ);
+	li_event_io_init(loop, "server socket", &sock->watcher, li_server_listen_cb, fd, LI_EV_READ);
 	return sock;
 }
 
@@ -140,11 +140,16 @@ liServer* li_server_new(const gchar *module_dir, gboolean module_resident) {
 		}
 	}
 #endif
+	/* don't let cached files take more fds than a quarter of the limit */
+	srv->fd_cache = li_fd_cache_new(srv->max_connections);
+	srv->mem_cache = li_mem_cache_new();
+	srv->backend_health = li_backend_health_new();
 
 	srv->io_timeout = 300; /* default I/O timeout */
 	srv->keep_alive_queue_timeout = 5;
 	srv->stat_cache_ttl = 10.0; /* default stat cache ttl */
 	srv->tasklet_pool_threads = 4; /* default per-worker tasklet_pool threads */
+	srv->network_backend = LI_NETWORK_BACKEND_SENDFILE;
 
 	return srv;
 }
@@ -187,6 +192,8 @@ void li_server_free(liServer* srv) {
 	li_event_clear(&srv->sig_w_TERM);
 	li_event_clear(&srv->sig_w_PIPE);
 
+	li_stat_cache_shared_stop(srv->stat_cache_shared);
+
 	/* free all workers */
 	{
 		guint i;
@@ -204,6 +211,17 @@ void li_server_free(liServer* srv) {
 		g_array_free(srv->workers, TRUE);
 	}
 
+	li_http3_server_free(srv);
+
+	li_stat_cache_shared_free(srv->stat_cache_shared);
+	srv->stat_cache_shared = NULL;
+	li_fd_cache_free(srv->fd_cache);
+	srv->fd_cache = NULL;
+	li_mem_cache_free(srv->mem_cache);
+	srv->mem_cache = NULL;
+	li_backend_health_free(srv->backend_health);
+	srv->backend_health = NULL;
+
 	{
 		guint i; for (i = 0; i < srv->sockets->len; i++) {
 			liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
@@ -313,6 +331,7 @@ static void li_server_1sec_timer(liEventBase *watcher, int events) {
 
 			for (i = 0; i < srv->sockets->len; i++) {
 				liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+				if (NULL != sock->wrk) continue; /* worker sockets handle the limit themselves */
 				li_event_start(&sock->watcher);
 			}
 			srv->connection_limit_hit = FALSE;
@@ -374,6 +393,7 @@ static void server_connection_limit_hit(liServer *srv) {
 
 	for (i = 0; i < srv->sockets->len; i++) {
 		liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+		if (NULL != sock->wrk) continue;
 		li_event_stop(&sock->watcher);
 	}
 
@@ -381,73 +401,125 @@ static void server_connection_limit_hit(liServer *srv) {
 	li_event_start(&srv->srv_1sec_timer); /* check to re-enable again later */
 }
 
+/* max connections accepted per wakeup; the (level triggered) watcher fires again if more are pending */
+#define LI_SERVER_ACCEPT_BATCH 64
+
 static void li_server_listen_cb(liEventBase *watcher, int events) {
 	liServerSocket *sock = LI_CONTAINER_OF(li_event_io_from(watcher), liServerSocket, watcher);
 	liServer *srv = sock->srv;
-	int s;
-	liSocketAddress remote_addr;
+	/* SO_REUSEPORT: the kernel already picked the worker */
+	liWorker *ctx = (NULL != sock->wrk) ? sock->wrk : srv->main_worker;
+	guint worker_count = (NULL != sock->wrk) ? 1 : srv->worker_count;
+	GArray **batches = g_newa(GArray*, worker_count);
+	guint *loads = g_newa(guint, worker_count);
+	guint i, accepted = 0, srv_cur_load, srv_max_load;
+	gboolean limit_hit = FALSE, accept_failed = FALSE;
+	int s, err = 0;
 	liSockAddrStorage sa;
 	socklen_t l;
 	int fd = li_event_io_fd(li_event_io_from(watcher));
 	UNUSED(events);
 
-	for ( ;; ) {
-		liWorker *wrk;
-		guint i, min_load, srv_cur_load, srv_max_load;
+	srv_cur_load = g_atomic_int_get(&srv->connection_load);
+	srv_max_load = g_atomic_int_get(&srv->max_connections);
 
-		srv_cur_load = g_atomic_int_get(&srv->connection_load);
-		srv_max_load = g_atomic_int_get(&srv->max_connections);
-		if (srv_cur_load >= srv_max_load) {
-			server_connection_limit_hit(srv);
-			return;
+	/* snapshot the worker loads once per wakeup, account the new connections locally */
+	for (i = 0; i < worker_count; i++) {
+		liWorker *wrk = (NULL != sock->wrk) ? sock->wrk : g_array_index(srv->workers, liWorker*, i);
+		batches[i] = NULL;
+		loads[i] = g_atomic_int_get(&wrk->connection_load);
+	}
+
+	while (accepted < LI_SERVER_ACCEPT_BATCH) {
+		liWorkerNewCon nc;
+		guint target = 0;
+
+		if (srv_cur_load + accepted >= srv_max_load) {
+			limit_hit = TRUE;
+			break;
 		}
 
 		l = sizeof(sa);
 
 #ifdef HAVE_ACCEPT4
 		if (-1 == (s = accept4(fd, &sa.plain, &l, SOCK_NONBLOCK))) {
-			if (ENOSYS != errno) break;
+			if (ENOSYS != errno) goto accept_error;
 
 			/* fallback */
-			if (-1 == (s = accept(fd, &sa.plain, &l))) break;
+			if (-1 == (s = accept(fd, &sa.plain, &l))) goto accept_error;
 			li_fd_no_block(s); /* we don't fork, don't care about FD_CLOEXEC */
 		}
 #else
-		if (-1 == (s = accept(fd, &sa.plain, &l))) break;
+		if (-1 == (s = accept(fd, &sa.plain, &l))) goto accept_error;
 		li_fd_no_block(s); /* we don't fork, don't care about FD_CLOEXEC */
 #endif
 
-		wrk = srv->main_worker;
-		min_load = g_atomic_int_get(&wrk->connection_load);
-
 		if (l <= sizeof(sa)) {
-			remote_addr.addr_up.raw = g_slice_alloc(l);
-			remote_addr.len = l;
-			memcpy(remote_addr.addr_up.raw, &sa, l);
+			nc.remote_addr.addr_up.raw = g_slice_alloc(l);
+			nc.remote_addr.len = l;
+			memcpy(nc.remote_addr.addr_up.raw, &sa, l);
 		} else {
-			remote_addr = li_sockaddr_remote_from_socket(s);
+			nc.remote_addr = li_sockaddr_remote_from_socket(s);
 		}
+		nc.s = s;
+		nc.srv_sock = sock;
 
-		for (i = 1; i < srv->worker_count; i++) {
-			liWorker *wt = g_array_index(srv->workers, liWorker*, i);
-			guint load = g_atomic_int_get(&wt->connection_load);
-			if (load < min_load) {
-				wrk = wt;
-				min_load = load;
-			}
+		for (i = 1; i < worker_count; i++) {
+			if (loads[i] < loads[target]) target = i;
 		}
+		loads[target]++;
 
-		g_atomic_int_inc((gint*) &wrk->connection_load);
-		g_atomic_int_inc((gint*) &srv->connection_load);
+		if (NULL == batches[target]) {
+			batches[target] = g_array_sized_new(FALSE, FALSE, sizeof(liWorkerNewCon), 8);
+		}
+		g_array_append_val(batches[target], nc);
 		li_server_socket_acquire(sock);
-		li_worker_new_con(srv->main_worker, wrk, remote_addr, s, sock);
-	}
+		accepted++;
+		continue;
 
+accept_error:
 #ifdef _WIN32
-	errno = WSAGetLastError();
+		err = WSAGetLastError();
+#else
+		err = errno;
 #endif
+		accept_failed = TRUE;
+		break;
+	}
+
+	if (accepted > 0) {
+		li_tstamp ts_accepted = li_event_time();
+
+		ctx->stats.accept_wakeups++;
+		ctx->stats.accepted += accepted;
+		if (accepted > ctx->stats.accept_batch_max) ctx->stats.accept_batch_max = accepted;
+		li_stats_hist_add(ctx->stats.accept_batch_hist, accepted);
+
+		/* one queue push and wakeup per worker and batch */
+		g_atomic_int_add((gint*) &srv->connection_load, accepted);
+		for (i = 0; i < worker_count; i++) {
+			liWorker *wrk;
+
+			if (NULL == batches[i]) continue;
+
+			wrk = (NULL != sock->wrk) ? sock->wrk : g_array_index(srv->workers, liWorker*, i);
+			g_atomic_int_add((gint*) &wrk->connection_load, batches[i]->len);
+			li_worker_new_cons(ctx, wrk, batches[i], ts_accepted);
+		}
+	}
+
+	if (limit_hit) {
+		if (NULL != sock->wrk) {
+			li_worker_listen_limit_hit(sock->wrk);
+		} else {
+			server_connection_limit_hit(srv);
+		}
+		return;
+	}
+
+	if (!accept_failed) return; /* batch budget used up */
 
-	switch (errno) {
+	switch (err) {
 	case EAGAIN:
 #if EWOULDBLOCK != EAGAIN
 	case EWOULDBLOCK:
@@ -463,14 +535,14 @@ static void li_server_listen_cb(liEventBase *watcher, int events) {
 		/* TODO: disable accept callbacks? */
 		break;
 	default:
-		ERROR(srv, "accept failed on fd=%d with error: %s", fd, g_strerror(errno));
+		ERROR(srv, "accept failed on fd=%d with error: %s", fd, g_strerror(err));
 		break;
 	}
 }
 
 /* main worker only */
 liServerSocket* li_server_listen(liServer *srv, int fd) {
-	liServerSocket *sock = server_socket_new(srv, fd);
+	liServerSocket *sock = server_socket_new(&srv->main_worker->loop, fd);
 
 	sock->srv = srv;
 	g_ptr_array_add(srv->sockets, sock);
@@ -480,13 +552,42 @@ liServerSocket* li_server_listen(liServer *srv, int fd) {
 	return sock;
 }
 
+/* main worker only */
+liServerSocket* li_server_listen_worker(liServer *srv, liWorker *wrk, int fd) {
+	/* watcher gets attached to the worker loop in the worker context */
+	liServerSocket *sock = server_socket_new(NULL, fd);
+
+	sock->srv = srv;
+	sock->wrk = wrk;
+	g_ptr_array_add(srv->sockets, sock);
+
+	li_worker_listen_add(srv->main_worker, wrk, sock);
+
+	return sock;
+}
+
+static void server_workers_listen_update(liServer *srv, gboolean listening) {
+	guint i;
+
+	g_atomic_int_set(&srv->listening, listening);
+
+	for (i = 0; i < srv->worker_count; i++) {
+		liWorker *wrk;
+		wrk = g_array_index(srv->workers, liWorker*, i);
+		li_worker_listen_update(srv->main_worker, wrk);
+	}
+}
+
 static void li_server_start_listen(liServer *srv) {
 	guint i;
 
 	for (i = 0; i < srv->sockets->len; i++) {
 		liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+		if (NULL != sock->wrk) continue;
 		li_event_start(&sock->watcher);
 	}
+
+	server_workers_listen_update(srv, TRUE);
 }
 
 static void li_server_stop_listen(liServer *srv) {
@@ -494,9 +595,11 @@ static void li_server_stop_listen(liServer *srv) {
 
 	for (i = 0; i < srv->sockets->len; i++) {
 		liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+		if (NULL != sock->wrk) continue;
 		li_event_stop(&sock->watcher);
 	}
 	srv->connection_limit_hit = FALSE; /* reset flag */
+	server_workers_listen_update(srv, FALSE);
 
 	/* suspend all workers (close keep-alive connections) */
 	for (i = 0; i < srv->worker_count; i++) {
@@ -511,9 +614,11 @@ static void li_server_stop(liServer *srv) {
 
 	for (i = 0; i < srv->sockets->len; i++) {
 		liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+		if (NULL != sock->wrk) continue; /* stopped by li_worker_stop */
 		li_event_stop(&sock->watcher);
 	}
 	srv->connection_limit_hit = FALSE; /* reset flag */
+	g_atomic_int_set(&srv->listening, FALSE);
 
 	/* stop all workers */
 	for (i = 0; i < srv->worker_count; i++) {
@@ -4,11 +4,451 @@
 
 #include <lighttpd/plugin_core.h>
 
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+/* shared stat cache: number of lock stripes */
+#define STAT_CACHE_SHARDS 16
+/* changes to unwatched records (no inotify, symlinks) are only noticed after this time */
+#define STAT_CACHE_UNWATCHED_TTL 10.0
+
 static void stat_cache_delete_cb(liWaitQueue *wq, gpointer daa);
 
 static void stat_cache_entry_release(liStatCacheEntry *sce);
 static void stat_cache_entry_acquire(liStatCacheEntry *sce);
 
+typedef struct stat_cache_watch stat_cache_watch;
+struct stat_cache_watch {
+	int wd; /* -1 after the kernel dropped the watch (IN_IGNORED) */
+	GString *dir;
+	guint refcount; /* records using the watch; protected by watch_lock */
+};
+
+/* result of a stat() (or a directory listing) shared between all workers. immutable once published,
+ * apart from the invalidated flag */
+struct liStatCacheRecord {
+	gint refcount;
+	gint invalidated;
+	liStatCacheShared *shared;
+
+	liStatCacheEntryData data;
+	GArray *dirlist;
+
+	gint generation; /* shared->generation before the stat() */
+	stat_cache_watch *watch; /* NULL if changes can't be watched */
+	li_tstamp expires;
+};
+
+typedef struct stat_cache_shard stat_cache_shard;
+struct stat_cache_shard {
+	GMutex *lock;
+	/* map GString* path (rec->data.path) to liStatCacheRecord*, holding a reference */
+	GHashTable *entries;
+	GHashTable *dirlists;
+};
+
+struct liStatCacheShared {
+	liServer *srv;
+	gdouble ttl;
+
+	stat_cache_shard shards[STAT_CACHE_SHARDS];
+
+	/* incremented for every change event; records stat()ed before an event are not published */
+	gint generation;
+
+	GMutex *watch_lock;
+	GHashTable *watch_dirs; /* GString* dir -> stat_cache_watch* */
+	GHashTable *watch_fds;  /* wd -> stat_cache_watch* */
+	int inotify_fd;
+	liEventIO inotify_watcher;
+
+	liEventTimer sweep_timer;
+
+	/* only modified in the main worker */
+	guint64 invalidations;
+};
+
+static stat_cache_shard* stat_cache_shard_for(liStatCacheShared *shared, GString *path) {
+	return &shared->shards[g_string_hash(path) % STAT_CACHE_SHARDS];
+}
+
+static stat_cache_watch* stat_cache_watch_acquire(liStatCacheShared *shared, GString *dir) {
+#ifdef HAVE_SYS_INOTIFY_H
+	stat_cache_watch *w;
+	int wd;
+
+	if (-1 == shared->inotify_fd) return NULL;
+
+	g_mutex_lock(shared->watch_lock);
+
+	if (NULL != (w = g_hash_table_lookup(shared->watch_dirs, dir))) {
+		w->refcount++;
+		g_mutex_unlock(shared->watch_lock);
+		return w;
+	}
+
+	wd = inotify_add_watch(shared->inotify_fd, dir->str, IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+	/* same directory through another path (symlink): events would only be reported for the first path */
+	if (-1 == wd || NULL != g_hash_table_lookup(shared->watch_fds, GINT_TO_POINTER(wd))) {
+		g_mutex_unlock(shared->watch_lock);
+		return NULL;
+	}
+
+	w = g_slice_new0(stat_cache_watch);
+	w->wd = wd;
+	w->dir = g_string_new_len(GSTR_LEN(dir));
+	w->refcount = 1;
+	g_hash_table_insert(shared->watch_dirs, w->dir, w);
+	g_hash_table_insert(shared->watch_fds, GINT_TO_POINTER(wd), w);
+
+	g_mutex_unlock(shared->watch_lock);
+	return w;
+#else
+	UNUSED(shared); UNUSED(dir);
+	return NULL;
+#endif
+}
+
+static void stat_cache_watch_release(liStatCacheShared *shared, stat_cache_watch *w) {
+	g_mutex_lock(shared->watch_lock);
+
+	if (0 == --w->refcount) {
+		if (-1 != w->wd) {
+#ifdef HAVE_SYS_INOTIFY_H
+			inotify_rm_watch(shared->inotify_fd, w->wd);
+#endif
+			g_hash_table_remove(shared->watch_fds, GINT_TO_POINTER(w->wd));
+			g_hash_table_remove(shared->watch_dirs, w->dir);
+		}
+		g_string_free(w->dir, TRUE);
+		g_slice_free(stat_cache_watch, w);
+	}
+
+	g_mutex_unlock(shared->watch_lock);
+}
+
+static liStatCacheRecord* stat_cache_record_new(liStatCacheShared *shared, GString *path) {
+	liStatCacheRecord *rec = g_slice_new0(liStatCacheRecord);
+	rec->refcount = 1;
+	rec->shared = shared;
+	rec->data.path = g_string_new_len(GSTR_LEN(path));
+	return rec;
+}
+
+static void stat_cache_record_acquire(liStatCacheRecord *rec) {
+	LI_FORCE_ASSERT(g_atomic_int_get(&rec->refcount) > 0);
+	g_atomic_int_inc(&rec->refcount);
+}
+
+static void stat_cache_record_release(liStatCacheRecord *rec) {
+	guint i;
+
+	LI_FORCE_ASSERT(g_atomic_int_get(&rec->refcount) > 0);
+	if (!g_atomic_int_dec_and_test(&rec->refcount)) return;
+
+	if (NULL != rec->watch) stat_cache_watch_release(rec->shared, rec->watch);
+
+	g_string_free(rec->data.path, TRUE);
+	if (NULL != rec->dirlist) {
+		for (i = 0; i < rec->dirlist->len; i++) {
+			g_string_free(g_array_index(rec->dirlist, liStatCacheEntryData, i).path, TRUE);
+		}
+		g_array_free(rec->dirlist, TRUE);
+	}
+
+	g_slice_free(liStatCacheRecord, rec);
+}
+
+static gboolean stat_cache_record_valid(liStatCacheRecord *rec, li_tstamp now) {
+	return !g_atomic_int_get(&rec->invalidated) && rec->expires > now;
+}
+
+/* runs in the tasklet thread before the stat(): watch first, so no change after the stat() can be missed */
+static void stat_cache_record_prepare(liStatCacheRecord *rec, gboolean is_dir) {
+	GString *dir;
+
+	rec->generation = g_atomic_int_get(&rec->shared->generation);
+
+	if (is_dir) {
+		rec->watch = stat_cache_watch_acquire(rec->shared, rec->data.path);
+	} else {
+		gchar *sep = strrchr(rec->data.path->str, G_DIR_SEPARATOR);
+		if (NULL == sep) return;
+		dir = g_string_new_len(rec->data.path->str, MAX(1, sep - rec->data.path->str));
+		rec->watch = stat_cache_watch_acquire(rec->shared, dir);
+		g_string_free(dir, TRUE);
+	}
+}
+
+/* in the worker after the stat() finished */
+static void stat_cache_record_fill(liStatCacheRecord *rec, liStatCacheEntry *sce, li_tstamp now) {
+	liStatCacheShared *shared = rec->shared;
+
+	rec->data.st = sce->data.st;
+	rec->data.failed = sce->data.failed;
+	rec->data.err = sce->data.err;
+	rec->expires = now + ((!sce->unwatched && NULL != rec->watch) ? shared->ttl : MIN(shared->ttl, STAT_CACHE_UNWATCHED_TTL));
+}
+
+static void stat_cache_record_publish(liStatCacheRecord *rec, gboolean is_dir) {
+	liStatCacheShared *shared = rec->shared;
+	stat_cache_shard *shard = stat_cache_shard_for(shared, rec->data.path);
+	GHashTable *table = is_dir ? shard->dirlists : shard->entries;
+	liStatCacheRecord *old;
+
+	g_mutex_lock(shard->lock);
+	if (rec->generation != g_atomic_int_get(&shared->generation)) {
+		/* something changed while we were waiting for stat(): let the next lookup try again */
+		g_atomic_int_set(&rec->invalidated, TRUE);
+	} else {
+		if (NULL != (old = g_hash_table_lookup(table, rec->data.path))) {
+			g_atomic_int_set(&old->invalidated, TRUE);
+		}
+		stat_cache_record_acquire(rec);
+		g_hash_table_replace(table, rec->data.path, rec);
+	}
+	g_mutex_unlock(shard->lock);
+}
+
+/* returns a new reference */
+static liStatCacheRecord* stat_cache_shared_lookup(liStatCacheShared *shared, GString *path, gboolean is_dir, li_tstamp now) {
+	stat_cache_shard *shard = stat_cache_shard_for(shared, path);
+	liStatCacheRecord *rec;
+
+	g_mutex_lock(shard->lock);
+	rec = g_hash_table_lookup(is_dir ? shard->dirlists : shard->entries, path);
+	if (NULL != rec && stat_cache_record_valid(rec, now)) {
+		stat_cache_record_acquire(rec);
+	} else {
+		rec = NULL;
+	}
+	g_mutex_unlock(shard->lock);
+
+	return rec;
+}
+
+static void stat_cache_shared_invalidate(liStatCacheShared *shared, GHashTable *table, GMutex *lock, GString *path) {
+	liStatCacheRecord *rec;
+
+	g_mutex_lock(lock);
+	if (NULL != (rec = g_hash_table_lookup(table, path))) {
+		g_atomic_int_set(&rec->invalidated, TRUE);
+		g_hash_table_remove(table, path);
+		shared->invalidations++;
+	}
+	g_mutex_unlock(lock);
+}
+
+static void stat_cache_shared_invalidate_path(liStatCacheShared *shared, GString *path) {
+	stat_cache_shard *shard = stat_cache_shard_for(shared, path);
+	stat_cache_shared_invalidate(shared, shard->entries, shard->lock, path);
+	stat_cache_shared_invalidate(shared, shard->dirlists, shard->lock, path);
+	li_fd_cache_invalidate(shared->srv->fd_cache, path, FALSE);
+	li_mem_cache_invalidate(shared->srv->mem_cache, path, FALSE);
+}
+
+typedef struct {
+	liStatCacheShared *shared;
+	GString *prefix; /* NULL: everything */
+	li_tstamp now; /* remove expired records if prefix is NULL and now > 0 */
+} stat_cache_sweep_ctx;
+
+static gboolean stat_cache_sweep_cb(gpointer key, gpointer value, gpointer data) {
+	stat_cache_sweep_ctx *ctx = data;
+	liStatCacheRecord *rec = value;
+	GString *path = key;
+
+	if (NULL != ctx->prefix) {
+		if (!li_string_prefix(path, GSTR_LEN(ctx->prefix))) return FALSE;
+		if (path->len > ctx->prefix->len && G_DIR_SEPARATOR != path->str[ctx->prefix->len]) return FALSE;
+	} else if (ctx->now > 0) {
+		if (stat_cache_record_valid(rec, ctx->now)) return FALSE;
+		g_atomic_int_set(&rec->invalidated, TRUE);
+		return TRUE;
+	}
+
+	g_atomic_int_set(&rec->invalidated, TRUE);
+	ctx->shared->invalidations++;
+	return TRUE;
+}
+
+static void stat_cache_shared_sweep(liStatCacheShared *shared, GString *prefix, li_tstamp now) {
+	stat_cache_sweep_ctx ctx;
+	guint i;
+
+	ctx.shared = shared;
+	ctx.prefix = prefix;
+	ctx.now = now;
+
+	for (i = 0; i < STAT_CACHE_SHARDS; i++) {
+		stat_cache_shard *shard = &shared->shards[i];
+		g_mutex_lock(shard->lock);
+		g_hash_table_foreach_remove(shard->entries, stat_cache_sweep_cb, &ctx);
+		g_hash_table_foreach_remove(shard->dirlists, stat_cache_sweep_cb, &ctx);
+		g_mutex_unlock(shard->lock);
+	}
+
+	if (NULL != prefix) {
+		li_fd_cache_invalidate(shared->srv->fd_cache, prefix, TRUE);
+		li_mem_cache_invalidate(shared->srv->mem_cache, prefix, TRUE);
+	}
+}
+
+static void stat_cache_sweep_timer_cb(liEventBase *watcher, int events) {
+	liStatCacheShared *shared = LI_CONTAINER_OF(li_event_timer_from(watcher), liStatCacheShared, sweep_timer);
+	UNUSED(events);
+
+	stat_cache_shared_sweep(shared, NULL, li_event_now(li_event_get_loop(&shared->sweep_timer)));
+	li_event_timer_once(&shared->sweep_timer, shared->ttl);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void stat_cache_inotify_event(liStatCacheShared *shared, const struct inotify_event *ev, GString *path) {
+	stat_cache_watch *w;
+
+	if (0 != (ev->mask & IN_Q_OVERFLOW)) {
+		/* lost events: nothing can be trusted */
+		g_atomic_int_inc(&shared->generation);
+		stat_cache_shared_sweep(shared, NULL, 0);
+		return;
+	}
+
+	g_mutex_lock(shared->watch_lock);
+	w = g_hash_table_lookup(shared->watch_fds, GINT_TO_POINTER(ev->wd));
+	if (NULL == w) {
+		g_mutex_unlock(shared->watch_lock);
+		return;
+	}
+	g_string_assign(path, w->dir->str);
+	if (0 != (ev->mask & IN_IGNORED)) {
+		/* watch is gone; records still using it are invalidated below */
+		g_hash_table_remove(shared->watch_fds, GINT_TO_POINTER(w->wd));
+		g_hash_table_remove(shared->watch_dirs, w->dir);
+		w->wd = -1;
+	}
+	g_mutex_unlock(shared->watch_lock);
+
+	g_atomic_int_inc(&shared->generation);
+
+	if (0 != (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))) {
+		stat_cache_shared_sweep(shared, path, 0);
+		return;
+	}
+
+	/* the directory listing includes stat() info of all children */
+	stat_cache_shared_invalidate_path(shared, path);
+
+	if (ev->len > 0 && '\0' != ev->name[0]) {
+		if (0 == path->len || G_DIR_SEPARATOR != path->str[path->len-1]) g_string_append_c(path, G_DIR_SEPARATOR);
+		g_string_append(path, ev->name);
+		stat_cache_shared_invalidate_path(shared, path);
+	}
+}
+
+static void stat_cache_inotify_cb(liEventBase *watcher, int events) {
+	liStatCacheShared *shared = LI_CONTAINER_OF(li_event_io_from(watcher), liStatCacheShared, inotify_watcher);
+	guint64 raw[4096 / sizeof(guint64)]; /* aligned for struct inotify_event */
+	gchar *buf = (gchar*) raw;
+	GString *path = g_string_sized_new(255);
+	ssize_t len, i;
+	UNUSED(events);
+
+	while (0 < (len = read(shared->inotify_fd, buf, sizeof(raw)))) {
+		for (i = 0; i < len; ) {
+			const struct inotify_event *ev = (const struct inotify_event*) (buf + i);
+			stat_cache_inotify_event(shared, ev, path);
+			i += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+
+	if (-1 == len && EAGAIN != errno && EINTR != errno) {
+		ERROR(shared->srv, "stat cache: reading inotify events failed: %s", g_strerror(errno));
+	}
+
+	g_string_free(path, TRUE);
+}
+#endif
+
+liStatCacheShared* li_stat_cache_shared_new(liServer *srv, liEventLoop *loop, gdouble ttl) {
+	liStatCacheShared *shared;
+	guint i;
+
+	if (ttl <= 0) return NULL;
+
+	shared = g_slice_new0(liStatCacheShared);
+	shared->srv = srv;
+	shared->ttl = ttl;
+
+	for (i = 0; i < STAT_CACHE_SHARDS; i++) {
+		stat_cache_shard *shard = &shared->shards[i];
+		shard->lock = g_mutex_new();
+		shard->entries = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal, NULL, (GDestroyNotify)stat_cache_record_release);
+		shard->dirlists = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal, NULL, (GDestroyNotify)stat_cache_record_release);
+	}
+
+	shared->watch_lock = g_mutex_new();
+	shared->watch_dirs = g_hash_table_new((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal);
+	shared->watch_fds = g_hash_table_new(NULL, NULL);
+	shared->inotify_fd = -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (-1 == (shared->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC))) {
+		WARNING(srv, "stat cache: inotify not available, shared entries expire after %.0f seconds: %s",
+			MIN(ttl, STAT_CACHE_UNWATCHED_TTL), g_strerror(errno));
+	} else {
+		li_event_io_init(loop, "stat cache inotify", &shared->inotify_watcher, stat_cache_inotify_cb, shared->inotify_fd, LI_EV_READ);
+		li_event_set_keep_loop_alive(&shared->inotify_watcher, FALSE);
+		li_event_start(&shared->inotify_watcher);
+	}
+#endif
+
+	li_event_timer_init(loop, "stat cache sweep", &shared->sweep_timer, stat_cache_sweep_timer_cb);
+	li_event_set_keep_loop_alive(&shared->sweep_timer, FALSE);
+	li_event_timer_once(&shared->sweep_timer, ttl);
+
+	return shared;
+}
+
+void li_stat_cache_shared_stop(liStatCacheShared *shared) {
+	if (NULL == shared) return;
+
+	li_event_clear(&shared->sweep_timer);
+	if (-1 != shared->inotify_fd) li_event_clear(&shared->inotify_watcher);
+}
+
+void li_stat_cache_shared_free(liStatCacheShared *shared) {
+	guint i;
+
+	if (NULL == shared) return;
+
+	li_stat_cache_shared_stop(shared);
+
+	/* workers are gone; release the remaining records (and with them the watches) */
+	for (i = 0; i < STAT_CACHE_SHARDS; i++) {
+		stat_cache_shard *shard = &shared->shards[i];
+		g_hash_table_destroy(shard->entries);
+		g_hash_table_destroy(shard->dirlists);
+		g_mutex_free(shard->lock);
+	}
+
+	g_hash_table_destroy(shared->watch_dirs);
+	g_hash_table_destroy(shared->watch_fds);
+	g_mutex_free(shared->watch_lock);
+
+	if (-1 != shared->inotify_fd) close(shared->inotify_fd);
+
+	g_slice_free(liStatCacheShared, shared);
+}
+
+void li_stat_cache_shared_counters(liStatCacheShared *shared, guint64 *invalidations, guint *watches) {
+	*invalidations = shared->invalidations;
+	g_mutex_lock(shared->watch_lock);
+	*watches = g_hash_table_size(shared->watch_fds);
+	g_mutex_unlock(shared->watch_lock);
+}
+
 liStatCache* li_stat_cache_new(liWorker *wrk, gdouble ttl) {
 	liStatCache *sc;
 
@@ -21,7 +461,9 @@ liStatCache* li_stat_cache_new(liWorker *wrk, gdouble ttl) {
 	}
 
 	sc = g_slice_new0(liStatCache);
+	sc->wrk = wrk;
 	sc->ttl = ttl;
+	sc->shared = wrk->srv->stat_cache_shared;
 	sc->entries = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal, NULL, NULL);
 	sc->dirlists = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal, NULL, NULL);
 
@@ -81,8 +523,16 @@ static void stat_cache_finished(gpointer data) {
 	guint i;
 	liVRequest *vr;
 
-	if (sce->data.failed) {
-		if (NULL != sce->sc) sce->sc->errors++;
+	/* the record owns the dirlist from now on, the entry only borrows it */
+	if (NULL != sce->record) sce->record->dirlist = sce->dirlist;
+
+	if (NULL != sce->sc) {
+		if (sce->data.failed) sce->sc->wrk->stats.stat_cache_errors++;
+
+		if (NULL != sce->record) {
+			stat_cache_record_fill(sce->record, sce, li_cur_ts(sce->sc->wrk));
+			stat_cache_record_publish(sce->record, sce->type == STAT_CACHE_ENTRY_DIR);
+		}
 	}
 
 	/* queue pending vrequests */
@@ -98,6 +548,8 @@ static void stat_cache_finished(gpointer data) {
 static void stat_cache_run(gpointer data) {
 	liStatCacheEntry *sce = data;
 
+	if (NULL != sce->record) stat_cache_record_prepare(sce->record, sce->type == STAT_CACHE_ENTRY_DIR);
+
 	if (stat(sce->data.path->str, &sce->data.st) == -1) {
 		sce->data.failed = TRUE;
 		sce->data.err = errno;
@@ -105,6 +557,12 @@ static void stat_cache_run(gpointer data) {
 		sce->data.failed = FALSE;
 	}
 
+	if (NULL != sce->record && !sce->data.failed) {
+		/* changes to the target of a symlink are not reported in the directory of the link */
+		struct stat lst;
+		if (-1 == lstat(sce->data.path->str, &lst) || S_ISLNK(lst.st_mode)) sce->unwatched = TRUE;
+	}
+
 	if (!sce->data.failed && sce->type == STAT_CACHE_ENTRY_DIR) {
 		/* dirlisting */
 		DIR *dirp;
@@ -191,7 +649,10 @@ static void stat_cache_entry_free(liStatCacheEntry *sce) {
 	g_string_free(sce->data.path, TRUE);
 	g_ptr_array_free(sce->vrequests, TRUE);
 
-	if (NULL != sce->dirlist) {
+	if (NULL != sce->record) {
+		/* the record owns the dirlist */
+		stat_cache_record_release(sce->record);
+	} else if (NULL != sce->dirlist) {
 		for (i = 0; i < sce->dirlist->len; i++) {
 			g_string_free(g_array_index(sce->dirlist, liStatCacheEntryData, i).path, TRUE);
 		}
@@ -222,13 +683,54 @@ void li_stat_cache_entry_release(liVRequest *vr, liStatCacheEntry *sce) {
 	stat_cache_entry_release(sce);
 }
 
+/* worker cache lookup; with a shared cache entries of files that changed are dropped, and
+ * misses are looked up in the shared cache before stat()ing again */
+static liStatCacheEntry* stat_cache_lookup(liVRequest *vr, liStatCache *sc, GString *path, gboolean is_dir) {
+	GHashTable *table = is_dir ? sc->dirlists : sc->entries;
+	liStatCacheEntry *sce = g_hash_table_lookup(table, path);
+	liStatCacheRecord *rec;
+	li_tstamp now;
+
+	if (NULL == sc->shared) return sce;
+
+	now = li_cur_ts(vr->wrk);
+
+	if (NULL != sce && NULL != sce->record && g_atomic_int_get(&sce->state) == STAT_CACHE_ENTRY_FINISHED
+			&& !stat_cache_record_valid(sce->record, now)) {
+		vr->wrk->stats.stat_cache_invalidated++;
+		li_waitqueue_remove(&sc->delete_queue, &sce->queue_elem);
+		stat_cache_remove_from_cache(sc, sce);
+		sce = NULL;
+	}
+
+	if (NULL == sce && NULL != (rec = stat_cache_shared_lookup(sc->shared, path, is_dir, now))) {
+		/* another worker did the stat() already */
+		sce = stat_cache_entry_new(sc, path);
+		sce->type = is_dir ? STAT_CACHE_ENTRY_DIR : STAT_CACHE_ENTRY_SINGLE;
+		sce->state = STAT_CACHE_ENTRY_FINISHED;
+		sce->record = rec;
+		sce->data.st = rec->data.st;
+		sce->data.failed = rec->data.failed;
+		sce->data.err = rec->data.err;
+		sce->dirlist = rec->dirlist;
+
+		/* uses initial reference of sce */
+		li_waitqueue_push(&sc->delete_queue, &sce->queue_elem);
+		g_hash_table_insert(table, sce->data.path, sce);
+
+		vr->wrk->stats.stat_cache_shared_hits++;
+	}
+
+	return sce;
+}
+
 liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatCacheEntry **result) {
 	liStatCache *sc;
 	liStatCacheEntry *sce;
 	guint i;
 
 	sc = vr->wrk->stat_cache;
-	sce = g_hash_table_lookup(sc->dirlists, path);
+	sce = stat_cache_lookup(vr, sc, path, TRUE);
 
 	if (sce) {
 		/* cache hit, check state */
@@ -242,7 +744,7 @@ liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatC
 			return LI_HANDLER_WAIT_FOR_EVENT;
 		}
 
-		sc->hits++;
+		vr->wrk->stats.stat_cache_hits++;
 		*result = sce;
 		for (i = 0; i < vr->stat_cache_entries->len; i++) {
 			if (g_ptr_array_index(vr->stat_cache_entries, i) == sce)
@@ -254,6 +756,7 @@ liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatC
 		/* cache miss, allocate new entry */
 		sce = stat_cache_entry_new(sc, path);
 		sce->type = STAT_CACHE_ENTRY_DIR;
+		if (NULL != sc->shared) sce->record = stat_cache_record_new(sc->shared, path);
 
 		li_stat_cache_entry_acquire(vr, sce); /* assign sce to vr */
 
@@ -264,7 +767,7 @@ liHandlerResult li_stat_cache_get_dirlist(liVRequest *vr, GString *path, liStatC
 		sce->refcount++;
 		li_tasklet_push(vr->wrk->tasklets, stat_cache_run, stat_cache_finished, sce);
 
-		sc->misses++;
+		vr->wrk->stats.stat_cache_misses++;
 		return LI_HANDLER_WAIT_FOR_EVENT;
 	}
 }
@@ -279,7 +782,7 @@ static liHandlerResult stat_cache_get(liVRequest *vr, GString *path, struct stat
 		async = FALSE;
 
 	if (async) {
-		sce = g_hash_table_lookup(sc->entries, path);
+		sce = stat_cache_lookup(vr, sc, path, FALSE);
 
 		if (sce) {
 			/* cache hit, check state */
@@ -294,11 +797,22 @@ static liHandlerResult stat_cache_get(liVRequest *vr, GString *path, struct stat
 				return LI_HANDLER_WAIT_FOR_EVENT;
 			}
 
-			sc->hits++;
+			vr->wrk->stats.stat_cache_hits++;
+
+			if (NULL != sce->record && NULL == fd) {
+				/* watched for changes: the cached result is still valid */
+				if (sce->data.failed) {
+					*err = sce->data.err;
+					return LI_HANDLER_ERROR;
+				}
+				*st = sce->data.st;
+				return LI_HANDLER_GO_ON;
+			}
 		} else {
 			/* cache miss, allocate new entry */
 			sce = stat_cache_entry_new(sc, path);
 			sce->type = STAT_CACHE_ENTRY_SINGLE;
+			if (NULL != sc->shared) sce->record = stat_cache_record_new(sc->shared, path);
 
 			li_stat_cache_entry_acquire(vr, sce); /* assign sce to vr */
 
@@ -309,7 +823,7 @@ static liHandlerResult stat_cache_get(liVRequest *vr, GString *path, struct stat
 			sce->refcount++;
 			li_tasklet_push(vr->wrk->tasklets, stat_cache_run, stat_cache_finished, sce);
 
-			sc->misses++;
+			vr->wrk->stats.stat_cache_misses++;
 			return LI_HANDLER_WAIT_FOR_EVENT;
 		}
 	}
@@ -348,3 +862,70 @@ liHandlerResult li_stat_cache_get(liVRequest *vr, GString *path, struct stat *st
 liHandlerResult li_stat_cache_get_sync(liVRequest *vr, GString *path, struct stat *st, int *err, int *fd) {
 	return stat_cache_get(vr, path, st, err, fd, FALSE);
 }
+
+liHandlerResult li_stat_cache_get_file(liVRequest *vr, GString *path, struct stat *st, int *err, liChunkFile **cf) {
+	liFdCache *fdc = (NULL != vr) ? vr->wrk->srv->fd_cache : NULL;
+	liHandlerResult res;
+	struct stat fst;
+	int fd = -1;
+	gboolean retried = FALSE;
+
+	*cf = NULL;
+
+	if (!li_fd_cache_enabled(fdc)) {
+		res = stat_cache_get(vr, path, st, err, &fd, TRUE);
+		if (LI_HANDLER_GO_ON != res) return res;
+		if (S_ISREG(st->st_mode)) {
+			*cf = li_chunkfile_new(NULL, fd, FALSE);
+		} else {
+			close(fd);
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	/* stat info from the cache decides whether the cached fd is still the right file */
+	res = stat_cache_get(vr, path, st, err, NULL, TRUE);
+	if (LI_HANDLER_GO_ON != res || !S_ISREG(st->st_mode)) return res;
+
+	if (NULL != (*cf = li_fd_cache_get(fdc, path, st))) {
+		vr->wrk->stats.fd_cache_hits++;
+		return LI_HANDLER_GO_ON;
+	}
+	vr->wrk->stats.fd_cache_misses++;
+
+	while (-1 == (fd = open(path->str, O_RDONLY))) {
+		if (errno == EINTR)
+			continue;
+
+		if ((EMFILE == errno || ENFILE == errno) && !retried) {
+			/* make room by closing cached files */
+			li_fd_cache_shrink(fdc);
+			retried = TRUE;
+			continue;
+		}
+
+		*err = errno;
+		return LI_HANDLER_ERROR;
+	}
+	if (-1 == fstat(fd, &fst)) {
+		*err = errno;
+		close(fd);
+		return LI_HANDLER_ERROR;
+	}
+
+	*cf = li_chunkfile_new(NULL, fd, FALSE);
+
+	/* only cache the fd if the cached stat info describes it (otherwise it would never match anyway) */
+	if (S_ISREG(fst.st_mode) && st->st_dev == fst.st_dev && st->st_ino == fst.st_ino
+	    && st->st_size == fst.st_size && st->st_mtime == fst.st_mtime) {
+		li_fd_cache_put(fdc, path, *cf, &fst);
+	}
+	*st = fst;
+
+	if (!S_ISREG(st->st_mode)) {
+		li_chunkfile_release(*cf);
+		*cf = NULL;
+	}
+
+	return LI_HANDLER_GO_ON;
+}
@@ -326,6 +326,8 @@ static void iostream_destroy(liIOStream *iostream) {
 
 	iostream->cb(iostream, LI_IOSTREAM_DESTROY);
 
+	li_network_uring_detach(iostream, -1);
+	li_network_zerocopy_release(iostream);
 	fd = li_event_io_fd(&iostream->io_watcher);
 	if (-1 != fd) close(fd); /* usually this should be shutdown+closed somewhere else */
 	li_event_clear(&iostream->io_watcher);
@@ -366,7 +368,7 @@ static void iostream_in_cb(liStream *stream, liStreamEvent event) {
 		if (!iostream->throttled_in && !iostream->can_read && !iostream->in_closed) {
 			li_event_io_add_events(&iostream->io_watcher, LI_EV_READ);
 		}
-		if (!iostream->throttled_out && !iostream->can_write && !iostream->out_closed) {
+		if (!iostream->throttled_out && !iostream->can_write && !iostream->out_closed && NULL == iostream->uring_op) {
 			li_event_io_add_events(&iostream->io_watcher, LI_EV_WRITE);
 		}
 		break;
@@ -437,7 +439,7 @@ static void iostream_out_cb(liStream *stream, liStreamEvent event) {
 		if (!iostream->throttled_in && !iostream->can_read && !iostream->in_closed) {
 			li_event_io_add_events(&iostream->io_watcher, LI_EV_READ);
 		}
-		if (!iostream->throttled_out && !iostream->can_write && !iostream->out_closed) {
+		if (!iostream->throttled_out && !iostream->can_write && !iostream->out_closed && NULL == iostream->uring_op) {
 			li_event_io_add_events(&iostream->io_watcher, LI_EV_WRITE);
 		}
 		break;
@@ -470,7 +472,10 @@ static void iostream_io_cb(liEventBase *watcher, int events) {
 
 	li_event_io_rem_events(&iostream->io_watcher, LI_EV_WRITE | LI_EV_READ);
 
-	if (0 != (events & LI_EV_WRITE) && !iostream->can_write && iostream->stream_out.refcount > 0) {
+	/* MSG_ZEROCOPY completions on the error queue wake us up too */
+	li_network_zerocopy_reap(iostream);
+
+	if (0 != (events & LI_EV_WRITE) && !iostream->can_write && NULL == iostream->uring_op && iostream->stream_out.refcount > 0) {
 		iostream->can_write = TRUE;
 		do_write = TRUE;
 		li_stream_acquire(&iostream->stream_out); /* keep out stream alive during li_stream_again(&iostream->stream_in) */
@@ -526,6 +531,8 @@ int li_iostream_reset(liIOStream *iostream) {
 
 	fd = li_event_io_fd(&iostream->io_watcher);
 
+	li_network_uring_detach(iostream, -1);
+	li_network_zerocopy_release(iostream);
 	li_event_clear(&iostream->io_watcher);
 
 	if (NULL != iostream->write_timeout_queue) {
@@ -8,6 +8,8 @@ struct liStreamHttpResponse {
 	liStream stream;
 	liVRequest *vr;
 	gboolean keepalive, response_headers_finished, transfer_encoding_chunked, wait_for_close;
+	gboolean backend_close; /* backend announced it closes the connection after the response */
+	gboolean reusable; /* response complete and connection left in a clean state */
 	goffset content_length;
 	liFilterChunkedDecodeState chunked_decode_state;
 };
@@ -19,6 +21,7 @@ static void check_response_header(liStreamHttpResponse* shr) {
 	shr->transfer_encoding_chunked = FALSE;
 	/* if protocol doesn't support keep-alive just wait for stream end */
 	shr->wait_for_close = !shr->keepalive;
+	shr->backend_close = !shr->keepalive;
 	shr->content_length = -1;
 
 	/* Transfer-Encoding: chunked */
@@ -95,26 +98,38 @@ static void check_response_header(liStreamHttpResponse* shr) {
 		return;
 	}
 
-	if (!shr->transfer_encoding_chunked && shr->keepalive) {
-		/**
-		 * if protocol has HTTP "keepalive" concept and encoding isn't chunked,
-		 * we need to check for content-length or "connection: close" indications.
-		 * otherwise we won't know when the response is done
-		 */
-		liHttpHeader *hh;
-
+	if (shr->keepalive) {
 		switch (shr->parse_response_ctx.http_version) {
 		case LI_HTTP_VERSION_1_0:
 			if (!li_http_header_is(shr->vr->response.headers, CONST_STR_LEN("connection"), CONST_STR_LEN("keep-alive")))
-				shr->wait_for_close = TRUE;
+				shr->backend_close = TRUE;
 			break;
 		case LI_HTTP_VERSION_1_1:
 			if (li_http_header_is(shr->vr->response.headers, CONST_STR_LEN("connection"), CONST_STR_LEN("close")))
-				shr->wait_for_close = TRUE;
+				shr->backend_close = TRUE;
 			break;
+		case LI_HTTP_VERSION_2: /* not a HTTP/1 response */
+		case LI_HTTP_VERSION_3:
 		case LI_HTTP_VERSION_UNSET:
 			break;
 		}
+	}
+
+	if (shr->keepalive && (LI_HTTP_METHOD_HEAD == shr->vr->request.http_method
+			|| (resp->http_status >= 100 && resp->http_status < 200)
+			|| 204 == resp->http_status || 304 == resp->http_status)) {
+		/* responses without body, regardless of the framing headers */
+		shr->transfer_encoding_chunked = FALSE;
+		shr->content_length = 0;
+	} else if (!shr->transfer_encoding_chunked && shr->keepalive) {
+		/**
+		 * if protocol has HTTP "keepalive" concept and encoding isn't chunked,
+		 * we need to check for content-length or "connection: close" indications.
+		 * otherwise we won't know when the response is done
+		 */
+		liHttpHeader *hh;
+
+		if (shr->backend_close) shr->wait_for_close = TRUE;
 
 		/* content-length */
 		hh = li_http_header_lookup(shr->vr->response.headers, CONST_STR_LEN("content-length"));
@@ -174,6 +189,11 @@ static void check_response_header(liStreamHttpResponse* shr) {
 	return;
 }
 
+/* response body complete; call before disconnecting from the source */
+static void stream_http_response_done(liStreamHttpResponse* shr) {
+	shr->reusable = !shr->wait_for_close && !shr->backend_close && 0 == shr->stream.source->out->length;
+}
+
 static void stream_http_response_data(liStreamHttpResponse* shr) {
 	if (NULL == shr->stream.source) return;
 
@@ -206,6 +226,10 @@ static void stream_http_response_data(liStreamHttpResponse* shr) {
 			} else {
 				li_stream_reset(&shr->stream);
 			}
+		} else if (shr->stream.out->is_closed) {
+			/* last chunk seen */
+			stream_http_response_done(shr);
+			li_stream_disconnect(&shr->stream);
 		} else if (shr->stream.source->out->is_closed) {
 			li_stream_disconnect(&shr->stream);
 		}
@@ -224,6 +248,7 @@ static void stream_http_response_data(liStreamHttpResponse* shr) {
 		}
 		if (shr->content_length == 0) {
 			shr->stream.out->is_closed = TRUE;
+			stream_http_response_done(shr);
 			li_stream_disconnect(&shr->stream);
 		}
 	}
@@ -269,3 +294,8 @@ LI_API liStream* li_stream_http_response_handle(liStream *http_in, liVRequest *v
 	li_stream_connect(http_in, &shr->stream);
 	return &shr->stream;
 }
+
+gboolean li_stream_http_response_reusable(liStream *stream) {
+	liStreamHttpResponse *shr = LI_CONTAINER_OF(stream, liStreamHttpResponse, stream);
+	return shr->reusable;
+}
@@ -19,13 +19,17 @@ void li_stream_simple_socket_close(liIOStream *stream, gboolean aborted) {
 	}
 
 	if (aborted || stream->in_closed) {
+		/* pending io_uring write: the ring closes the socket when it is done */
+		gboolean handed_over = !aborted && li_network_uring_detach(stream, fd);
+
 		fd = li_iostream_reset(stream);
-		if (-1 != fd) {
+		if (-1 != fd && !handed_over) {
 			shutdown(fd, SHUT_RDWR);
 			close(fd);
 		}
 	} else {
 		liWorker *wrk = li_worker_from_iostream(stream);
+		li_network_zerocopy_release(stream);
 		li_event_clear(&stream->io_watcher); /* sets io_fd to -1 */
 
 		shutdown(fd, SHUT_WR);
@@ -99,6 +103,18 @@ static void stream_simple_socket_read(liIOStream *stream, liBuffer **buffer) {
 	}
 }
 
+#ifdef TCP_CORK
+static void stream_simple_socket_cork(liWorker *wrk, liIOStream *stream, int fd, gboolean cork) {
+	int val = cork ? 1 : 0;
+
+	if ((stream->corked ? TRUE : FALSE) == cork) return;
+
+	wrk->stats.cork_syscalls++;
+	if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val)) && cork) return;
+	stream->corked = cork;
+}
+#endif
+
 static void stream_simple_socket_write_throttle_notify(liThrottleState *state, gpointer data) {
 	liIOStream *stream = data;
 	UNUSED(state);
@@ -129,12 +145,43 @@ static void stream_simple_socket_write(liIOStream *stream) {
 			}
 		}
 
-		res = li_network_write(fd, raw_out, write_max, &err);
+#ifdef TCP_CORK
+		/* Linux: put a cork into the socket as we want to combine the write() calls if we really have
+		 * multiple chunks. the cork stays until a write drains the queue, so a response needing many
+		 * writes (waiting for the socket in between) only pays for one cork/uncork pair.
+		 */
+		if (raw_out->queue.length > 1) {
+			wrk->stats.cork_syscalls_baseline += 2;
+			if (NULL == wrk->network_uring || raw_out->length > LI_NETWORK_URING_SLOT_SIZE) {
+				stream_simple_socket_cork(wrk, stream, fd, TRUE);
+			}
+		}
+#endif
+		stream->pushed = FALSE;
+
+		if (li_network_zerocopy_applies(wrk, stream, raw_out)) {
+			res = li_network_write_zerocopy(stream, raw_out, &write_max, &err);
+		} else if (NULL != wrk->network_uring && li_network_uring_write(wrk->network_uring, stream, raw_out, write_max)) {
+			/* queued; wait for the completion before writing more */
+			stream->can_write = FALSE;
+			res = LI_NETWORK_STATUS_SUCCESS;
+		} else {
+			res = li_network_write(fd, raw_out, write_max, wrk->srv->network_backend, &err);
+		}
 
 		if (NULL != stream->throttle_out) {
 			li_throttle_update(stream->throttle_out, raw_out->bytes_out - current_out_bytes);
 		}
 
+#ifdef TCP_CORK
+		/* keep the cork over an empty queue if more data is coming and the owner flushes at the end of it */
+		if (stream->corked && 0 == raw_out->length && (raw_out->is_closed || !stream->cork_until_flush)) {
+			/* removing the cork sends the pending partial frame */
+			stream_simple_socket_cork(wrk, stream, fd, FALSE);
+			stream->pushed = TRUE;
+		}
+#endif
+
 		switch (res) {
 		case LI_NETWORK_STATUS_SUCCESS:
 			break;
@@ -152,7 +199,7 @@ static void stream_simple_socket_write(liIOStream *stream) {
 		}
 	}
 
-	if (0 == raw_out->length && raw_out->is_closed) {
+	if (0 == raw_out->length && raw_out->is_closed && NULL == stream->uring_op) {
 		fd = li_event_io_fd(&stream->io_watcher);
 		li_event_io_rem_events(&stream->io_watcher, LI_EV_WRITE);
 		if (-1 != fd) shutdown(fd, SHUT_WR);
@@ -187,12 +234,40 @@ void li_stream_simple_socket_io_cb_with_buffer(liIOStream *stream, liIOStreamEve
 void li_stream_simple_socket_flush(liIOStream *stream) {
 	int val = 1;
 	int fd = li_event_io_fd(&stream->io_watcher);
-	if (-1 != fd) {
-		/* setting TCP_NODELAY should flush the socket. if it fails it probably isn't a TCP socket,
-		 * so no need to disable TCP_NODELAY */
-		if (-1 != setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val))) {
-			val = 0;
-			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
-		}
+	liWorker *wrk = li_worker_from_iostream(stream);
+
+	if (-1 == fd) return;
+
+	wrk->stats.cork_syscalls_baseline += 2;
+
+	if (stream->pushed) {
+		/* the last write already uncorked an empty queue */
+		stream->pushed = FALSE;
+		return;
+	}
+
+#ifdef TCP_CORK
+	if (stream->corked) {
+		stream_simple_socket_cork(wrk, stream, fd, FALSE);
+		return;
+	}
+#endif
+
+	/* setting TCP_NODELAY should flush the socket. if it fails it probably isn't a TCP socket,
+	 * so no need to disable TCP_NODELAY */
+	wrk->stats.cork_syscalls++;
+	if (-1 != setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val))) {
+		val = 0;
+		wrk->stats.cork_syscalls++;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+	}
+}
+
+void li_stream_simple_socket_cork_until_flush(liIOStream *stream, gboolean until_flush) {
+	if ((stream->cork_until_flush ? TRUE : FALSE) == until_flush) return;
+	stream->cork_until_flush = until_flush;
+
+	if (!until_flush && stream->corked && (NULL == stream->stream_out.out || 0 == stream->stream_out.out->length)) {
+		li_stream_simple_socket_flush(stream);
 	}
 }
@@ -95,6 +95,11 @@ static void worker_close_idle_connections(liWorker *wrk) {
 		case LI_CON_STATE_KEEP_ALIVE:
 			li_connection_reset(con);
 			break;
+		case LI_CON_STATE_HTTP2:
+			/* GOAWAY; finish active streams */
+			li_connection_http2_shutdown(con);
+			li_connection_update_io_wait(con);
+			break;
 		default:
 			/* update if wrk->wait_for_stop_connections.active changed */
 			li_connection_update_io_wait(con);
@@ -159,6 +164,11 @@ static void li_worker_prepare_cb(liEventBase *watcher, int events) {
 		g_static_mutex_unlock(&srv->logs.write_queue_mutex);
 		li_event_async_send(&srv->logs.watcher);
 	}
+
+	/* submit writes queued in this loop iteration */
+	if (NULL != wrk->network_uring) {
+		li_network_uring_submit(wrk->network_uring);
+	}
 }
 
 /* stop worker watcher */
@@ -193,37 +203,121 @@ static void li_worker_exit_cb(liEventBase *watcher, int events) {
 	li_worker_exit(wrk, wrk);
 }
 
-typedef struct li_worker_new_con_data li_worker_new_con_data;
-struct li_worker_new_con_data {
-	liSocketAddress remote_addr;
-	int s;
-	liServerSocket *srv_sock;
+typedef struct li_worker_new_con_batch li_worker_new_con_batch;
+struct li_worker_new_con_batch {
+	GArray *cons; /* liWorkerNewCon */
+	li_tstamp ts_accepted;
 };
 
+static void worker_new_cons_start(liWorker *wrk, GArray *cons, li_tstamp ts_accepted) {
+	li_tstamp latency = li_event_time() - ts_accepted;
+	guint i;
+
+	for (i = 0; i < cons->len; i++) {
+		liWorkerNewCon *nc = &g_array_index(cons, liWorkerNewCon, i);
+		liConnection *con = worker_con_get(wrk);
+
+		li_stats_hist_add(wrk->stats.dispatch_latency_hist, latency > 0 ? (guint64) (latency * 1000000) : 0);
+		li_connection_start(con, nc->remote_addr, nc->s, nc->srv_sock);
+	}
+}
+
 /* new con watcher */
 void li_worker_new_con(liWorker *ctx, liWorker *wrk, liSocketAddress remote_addr, int s, liServerSocket *srv_sock) {
-	if (ctx == wrk) {
-		liConnection *con = worker_con_get(wrk);
+	GArray *cons = g_array_sized_new(FALSE, FALSE, sizeof(liWorkerNewCon), 1);
+	liWorkerNewCon nc;
+
+	nc.remote_addr = remote_addr;
+	nc.s = s;
+	nc.srv_sock = srv_sock;
+	g_array_append_val(cons, nc);
 
-		li_connection_start(con, remote_addr, s, srv_sock);
+	li_worker_new_cons(ctx, wrk, cons, li_event_time());
+}
+
+void li_worker_new_cons(liWorker *ctx, liWorker *wrk, GArray *cons, li_tstamp ts_accepted) {
+	if (ctx == wrk) {
+		worker_new_cons_start(wrk, cons, ts_accepted);
+		g_array_free(cons, TRUE);
 	} else {
-		li_worker_new_con_data *d = g_slice_new(li_worker_new_con_data);
-		d->remote_addr = remote_addr;
-		d->s = s;
-		d->srv_sock = srv_sock;
-		g_async_queue_push(wrk->new_con_queue, d);
+		li_worker_new_con_batch *b = g_slice_new(li_worker_new_con_batch);
+		b->cons = cons;
+		b->ts_accepted = ts_accepted;
+		g_async_queue_push(wrk->new_con_queue, b);
 		li_event_async_send(&wrk->new_con_watcher);
 	}
 }
 
 static void li_worker_new_con_cb(liEventBase *watcher, int events) {
 	liWorker *wrk = LI_CONTAINER_OF(li_event_async_from(watcher), liWorker, new_con_watcher);
-	li_worker_new_con_data *d;
+	li_worker_new_con_batch *b;
 	UNUSED(events);
 
-	while (NULL != (d = g_async_queue_try_pop(wrk->new_con_queue))) {
-		li_worker_new_con(wrk, wrk, d->remote_addr, d->s, d->srv_sock);
-		g_slice_free(li_worker_new_con_data, d);
+	while (NULL != (b = g_async_queue_try_pop(wrk->new_con_queue))) {
+		worker_new_cons_start(wrk, b->cons, b->ts_accepted);
+		g_array_free(b->cons, TRUE);
+		g_slice_free(li_worker_new_con_batch, b);
+	}
+}
+
+/* worker (SO_REUSEPORT) listening sockets */
+static void worker_listen_sync(liWorker *wrk) {
+	gboolean active = g_atomic_int_get(&wrk->srv->listening) && !wrk->listen_limit_hit;
+	guint i;
+
+	for (i = 0; i < wrk->listen_sockets->len; i++) {
+		liServerSocket *sock = g_ptr_array_index(wrk->listen_sockets, i);
+		if (active) {
+			li_event_start(&sock->watcher);
+		} else {
+			li_event_stop(&sock->watcher);
+		}
+	}
+}
+
+static void li_worker_listen_cb(liEventBase *watcher, int events) {
+	liWorker *wrk = LI_CONTAINER_OF(li_event_async_from(watcher), liWorker, listen_watcher);
+	liServerSocket *sock;
+	UNUSED(events);
+
+	while (NULL != (sock = g_async_queue_try_pop(wrk->listen_queue))) {
+		li_event_attach(&wrk->loop, &sock->watcher);
+		g_ptr_array_add(wrk->listen_sockets, sock);
+	}
+
+	worker_listen_sync(wrk);
+}
+
+void li_worker_listen_add(liWorker *ctx, liWorker *wrk, liServerSocket *sock) {
+	g_async_queue_push(wrk->listen_queue, sock);
+	li_worker_listen_update(ctx, wrk);
+}
+
+void li_worker_listen_update(liWorker *ctx, liWorker *wrk) {
+	if (ctx == wrk) {
+		li_worker_listen_cb(&wrk->listen_watcher.base, 0);
+	} else {
+		li_event_async_send(&wrk->listen_watcher);
+	}
+}
+
+void li_worker_listen_limit_hit(liWorker *wrk) {
+	wrk->listen_limit_hit = TRUE;
+	worker_listen_sync(wrk);
+	li_event_timer_once(&wrk->listen_limit_timer, 1); /* check to re-enable again later */
+}
+
+static void worker_listen_limit_cb(liEventBase *watcher, int events) {
+	liWorker *wrk = LI_CONTAINER_OF(li_event_timer_from(watcher), liWorker, listen_limit_timer);
+	guint srv_cur_load = g_atomic_int_get(&wrk->srv->connection_load);
+	guint srv_max_load = g_atomic_int_get(&wrk->srv->max_connections);
+	UNUSED(events);
+
+	if (srv_cur_load <= (srv_max_load - srv_max_load/8)) { /* cur_load <= 7/8 * max_load */
+		wrk->listen_limit_hit = FALSE;
+		worker_listen_sync(wrk);
+	} else {
+		li_event_timer_once(&wrk->listen_limit_timer, 1); /* keep trying */
 	}
 }
 
@@ -316,6 +410,12 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	li_event_async_init(&wrk->loop, "worker new connection", &wrk->new_con_watcher, li_worker_new_con_cb);
 	wrk->new_con_queue = g_async_queue_new();
 
+	li_event_async_init(&wrk->loop, "worker new listen socket", &wrk->listen_watcher, li_worker_listen_cb);
+	wrk->listen_queue = g_async_queue_new();
+	wrk->listen_sockets = g_ptr_array_new();
+	li_event_timer_init(&wrk->loop, "worker listen limit", &wrk->listen_limit_timer, worker_listen_limit_cb);
+	li_event_set_keep_loop_alive(&wrk->listen_limit_timer, FALSE);
+
 	li_event_timer_init(&wrk->loop, "worker stats update", &wrk->stats_watcher, worker_stats_watcher_cb);
 	li_event_set_keep_loop_alive(&wrk->stats_watcher, FALSE);
 	li_event_timer_once(&wrk->stats_watcher, 1);
@@ -332,6 +432,7 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	wrk->tasklets = li_tasklet_pool_new(&wrk->loop, srv->tasklet_pool_threads);
 
 	wrk->network_read_buf = NULL;
+	li_network_zerocopy_worker_init(wrk);
 
 	return wrk;
 }
@@ -360,6 +461,13 @@ struct ev_loop* li_worker_free(liWorker *wrk) {
 		g_array_free(wrk->connections, TRUE);
 	}
 
+	li_http3_worker_free(wrk->http3);
+	wrk->http3 = NULL;
+
+	li_network_uring_free(wrk->network_uring);
+	wrk->network_uring = NULL;
+	li_network_zerocopy_worker_clear(wrk);
+
 	{ /* free timestamps */
 		guint i;
 		for (i = 0; i < wrk->timestamps_gmt->len; i++) {
@@ -382,6 +490,14 @@ struct ev_loop* li_worker_free(liWorker *wrk) {
 	g_async_queue_unref(wrk->new_con_queue);
 	wrk->new_con_queue = NULL;
 
+	/* sockets are owned (and closed) by the server */
+	li_event_clear(&wrk->listen_watcher);
+	li_event_clear(&wrk->listen_limit_timer);
+	g_async_queue_unref(wrk->listen_queue);
+	wrk->listen_queue = NULL;
+	g_ptr_array_free(wrk->listen_sockets, TRUE);
+	wrk->listen_sockets = NULL;
+
 	li_event_clear(&wrk->stats_watcher);
 
 	li_collect_watcher_cb(&wrk->collect_watcher.base, 0);
@@ -426,10 +542,21 @@ void li_worker_run(liWorker *wrk) {
 		}
 	}
 
-	/* setup stat cache if necessary */
+	/* setup stat cache if necessary; the main worker runs first and watches the shared cache */
+	if (wrk == wrk->srv->main_worker && wrk->srv->stat_cache_ttl && wrk->srv->stat_cache_shared_enabled && !wrk->srv->stat_cache_shared)
+		wrk->srv->stat_cache_shared = li_stat_cache_shared_new(wrk->srv, &wrk->loop, wrk->srv->stat_cache_ttl);
 	if (wrk->srv->stat_cache_ttl && !wrk->stat_cache)
 		wrk->stat_cache = li_stat_cache_new(wrk, wrk->srv->stat_cache_ttl);
 
+	/* setup io_uring if necessary */
+	if (LI_NETWORK_BACKEND_IO_URING == wrk->srv->network_backend && !wrk->network_uring) {
+		GError *err = NULL;
+		if (NULL == (wrk->network_uring = li_network_uring_new(wrk, &err))) {
+			ERROR(wrk->srv, "worker #%u: couldn't setup io_uring, falling back to sendfile backend: %s", wrk->ndx+1, err->message);
+			g_error_free(err);
+		}
+	}
+
 	li_event_loop_run(&wrk->loop);
 }
 
@@ -439,12 +566,22 @@ void li_worker_stop(liWorker *context, liWorker *wrk) {
 
 		li_plugins_worker_stop(wrk);
 
+		/* aborts all HTTP/3 requests */
+		li_http3_worker_stop(wrk->http3);
+
 		li_event_stop(&wrk->worker_stop_watcher);
 		li_event_stop(&wrk->worker_stopping_watcher);
 		li_event_stop(&wrk->worker_suspend_watcher);
 
 		li_event_stop(&wrk->new_con_watcher);
 
+		li_event_stop(&wrk->listen_watcher);
+		li_event_stop(&wrk->listen_limit_timer);
+		for (i = 0; i < wrk->listen_sockets->len; i++) {
+			liServerSocket *sock = g_ptr_array_index(wrk->listen_sockets, i);
+			li_event_stop(&sock->watcher);
+		}
+
 		if (wrk->stat_cache)
 			li_waitqueue_stop(&wrk->stat_cache->delete_queue);
 		/* handle remaining new connections. there shouldn't be any, we'll kill them soon anyway */
@@ -478,6 +615,7 @@ void li_worker_stopping(liWorker *context, liWorker *wrk) {
 		li_waitqueue_set_delay(&wrk->io_timeout_queue, 3);
 
 		worker_close_idle_connections(wrk);
+		li_http3_worker_shutdown(wrk->http3);
 
 		li_worker_new_con_cb(&wrk->new_con_watcher.base, 0); /* handle remaining new connections */
 
@@ -500,8 +638,11 @@ void li_worker_suspend(liWorker *context, liWorker *wrk) {
 			liConnection *con = g_array_index(wrk->connections, liConnection*, i);
 			if (con->state == LI_CON_STATE_KEEP_ALIVE) {
 				li_connection_reset(con);
+			} else if (con->state == LI_CON_STATE_HTTP2) {
+				li_connection_http2_shutdown(con);
 			}
 		}
+		li_http3_worker_shutdown(wrk->http3);
 
 		li_worker_check_keepalive(wrk);
 
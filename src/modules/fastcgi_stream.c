@@ -58,9 +58,11 @@ struct liFastCGIBackendContext {
 
 	liStream fcgi_out, fcgi_in;
 
-	/* for now: no multiplexing, at most one connection */
+	/* no multiplexing, at most one connection */
 	liFastCGIBackendConnection_p *currentcon;
 	gboolean stdin_closed, stdout_closed, stderr_closed, request_done;
+	gboolean keepalive; /* request finished with FCGI_END_REQUEST after the complete request was sent */
+	gboolean stdin_presend; /* empty stdin was sent before the vrequest got connected; don't reopen it */
 
 	/* current record */
 	guint8 version;
@@ -73,9 +75,13 @@ struct liFastCGIBackendContext {
 
 struct liFastCGIBackendConnection_p {
 	liFastCGIBackendConnection public;
-	liFastCGIBackendContext *ctx;
+	liFastCGIBackendContext *ctx; /* NULL: connection got lost while waiting for the response */
 
 	liVRequest *vr;
+
+	/* a request on a keep-alive connection is sent before the vrequest gets connected, so it can be sent
+	 * again if the backend closed the connection without reading it */
+	gboolean connected, responding;
 };
 
 struct liFastCGIBackendPool_p {
@@ -230,7 +236,21 @@ static liBackendCallbacks backend_cbs = {
 	backend_free
 };
 
+/* whether the connection is in a clean state between requests */
+static gboolean fastcgi_can_reuse(liFastCGIBackendContext *ctx) {
+	liIOStream *iostream = ctx->iostream;
+
+	if (!ctx->keepalive || NULL == iostream) return FALSE;
+	if (-1 == li_event_io_fd(&iostream->io_watcher) || iostream->in_closed || iostream->out_closed || NULL != iostream->uring_op) return FALSE;
+	if (0 != ctx->remainingContent || 0 != ctx->remainingPadding) return FALSE;
+	if (ctx->fcgi_out.out->length > 0 || iostream->stream_out.out->length > 0 || iostream->stream_in.out->length > 0) return FALSE;
+
+	return TRUE;
+}
+
 static void fastcgi_check_put(liFastCGIBackendContext *ctx) {
+	gboolean closecon;
+
 	/* wait for li_fastcgi_backend_put() */
 	if (NULL != ctx->currentcon) return;
 	/* already inactive */
@@ -242,6 +262,7 @@ static void fastcgi_check_put(liFastCGIBackendContext *ctx) {
 	li_stream_disconnect_dest(&ctx->fcgi_in);
 
 	ctx->is_active = FALSE;
+	closecon = !fastcgi_can_reuse(ctx);
 
 	li_stream_set_cqlimit(NULL, &ctx->fcgi_in, NULL);
 	li_stream_set_cqlimit(&ctx->fcgi_out, NULL, NULL);
@@ -258,8 +279,8 @@ static void fastcgi_check_put(liFastCGIBackendContext *ctx) {
 	LI_FORCE_ASSERT(NULL == ctx->fcgi_in.out->limit);
 	LI_FORCE_ASSERT(NULL == ctx->fcgi_out.out->limit);
 
-	fcgi_debug("li_backend_put\n");
-	li_backend_put(ctx->wrk, ctx->pool->public.subpool, ctx->subcon, TRUE); /* disable keep-alive for now */
+	fcgi_debug("li_backend_put (closecon: %i)\n", (int) closecon);
+	li_backend_put(ctx->wrk, ctx->pool->public.subpool, ctx->subcon, closecon);
 }
 
 /* destroys ctx */
@@ -287,7 +308,14 @@ static void fastcgi_reset(liFastCGIBackendContext *ctx) {
 		li_stream_disconnect(&ctx->fcgi_out);
 		li_stream_disconnect_dest(&ctx->fcgi_in);
 
-		if (NULL != currentcon) {
+		if (NULL != currentcon && !currentcon->connected) {
+			/* vrequest is still waiting in li_fastcgi_backend_get(): send the request again */
+			fcgi_debug("keep-alive connection lost before response\n");
+			ctx->currentcon = NULL;
+			currentcon->ctx = NULL;
+			li_vrequest_joblist_append(currentcon->vr);
+			fastcgi_check_put(ctx);
+		} else if (NULL != currentcon) {
 			callbacks->reset_cb(currentcon->vr, &ctx->pool->public, &currentcon->public);
 		}
 	}
@@ -376,7 +404,7 @@ static void stream_send_begin(liChunkQueue *out, guint16 requestid) {
 	stream_build_fcgi_record(buf, FCGI_BEGIN_REQUEST, requestid, 8);
 	w = htons(FCGI_RESPONDER);
 	g_byte_array_append(buf, (const guint8*) &w, sizeof(w));
-	l_byte_array_append_c(buf, 0 /* FCGI_KEEP_CONN */); /* disabled keep-alive for now */
+	l_byte_array_append_c(buf, FCGI_KEEP_CONN);
 	append_padding(buf, 5);
 	li_chunkqueue_append_bytearr(out, buf);
 }
@@ -433,6 +461,7 @@ static void fastcgi_stream_out(liStream *stream, liStreamEvent event) {
 		if (NULL == stream->source) return;
 		if (NULL == stream->dest || ctx->stdin_closed) {
 			li_chunkqueue_skip_all(stream->source->out);
+			if (ctx->stdin_closed && stream->source->out->is_closed) li_stream_disconnect(stream);
 			return;
 		}
 		stream_send_chunks(stream->out, FCGI_STDIN, 1, stream->source->out);
@@ -445,6 +474,11 @@ static void fastcgi_stream_out(liStream *stream, liStreamEvent event) {
 		li_stream_notify(stream);
 		break;
 	case LI_STREAM_CONNECTED_SOURCE:
+		if (ctx->stdin_presend) {
+			/* empty request body was already sent */
+			ctx->stdin_presend = FALSE;
+			break;
+		}
 		/* support Connection: Upgrade by reopening stdin. not standard compliant,
 		 * but the backend asked for it :) */
 		ctx->stdin_closed = FALSE;
@@ -478,6 +512,28 @@ static void fastcgi_decode(liFastCGIBackendContext *ctx) {
 	in = ctx->iostream->stream_in.out;
 	wrk = li_worker_from_iostream(ctx->iostream);
 
+	if (!ctx->is_active) {
+		/* idle keep-alive connection: the backend isn't supposed to send anything */
+		if (0 < in->length || in->is_closed) {
+			fcgi_debug("idle connection closed by backend\n");
+			fastcgi_reset(ctx);
+		}
+		return;
+	}
+
+	if (NULL != ctx->currentcon && !ctx->currentcon->connected) {
+		/* keep the response until li_fastcgi_backend_get() connected the vrequest */
+		if (0 < in->length) {
+			if (!ctx->currentcon->responding) {
+				ctx->currentcon->responding = TRUE;
+				li_vrequest_joblist_append(ctx->currentcon->vr);
+			}
+		} else if (in->is_closed) {
+			fastcgi_reset(ctx);
+		}
+		return;
+	}
+
 	while (NULL != ctx->iostream && 0 < in->length) {
 		gboolean newdata = FALSE;
 
@@ -536,6 +592,8 @@ static void fastcgi_decode(liFastCGIBackendContext *ctx) {
 						return;
 					}
 
+					/* if stdin is still open the rest of the request body can't be sent anymore */
+					ctx->keepalive = ctx->stdin_closed;
 					ctx->stdin_closed = TRUE;
 					ctx->stdout_closed = TRUE;
 					ctx->stderr_closed = TRUE;
@@ -642,7 +700,10 @@ static void fastcgi_stream_in(liStream *stream, liStreamEvent event) {
 		fastcgi_decode(ctx);
 		break;
 	case LI_STREAM_DISCONNECTED_SOURCE:
-		if (!ctx->request_done) {
+		if (!ctx->is_active) {
+			fcgi_debug("idle connection lost\n");
+			fastcgi_reset(ctx);
+		} else if (!ctx->request_done) {
 			fcgi_debug("fastcgi backend closed connection before request was finished\n");
 			fastcgi_reset(ctx);
 		}
@@ -687,6 +748,52 @@ void li_fastcgi_backend_pool_free(liFastCGIBackendPool *bpool) {
 	li_backend_pool_free(bpool->subpool);
 }
 
+/* 1: data available, 0: nothing to read yet, -1: connection closed or failed */
+static int fastcgi_connection_peek(liFastCGIBackendContext *ctx) {
+	char c;
+	ssize_t r;
+
+	if (NULL == ctx->iostream) return -1;
+
+	do {
+		r = recv(li_event_io_fd(&ctx->iostream->io_watcher), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	} while (-1 == r && EINTR == errno);
+
+	if (r > 0) return 1;
+	if (-1 == r && (EAGAIN == errno || EWOULDBLOCK == errno)) return 0;
+	return -1;
+}
+
+/* requests which can be sent again if the backend closed the connection without a response */
+static gboolean fastcgi_request_retryable(liVRequest *vr) {
+	if (0 != vr->request.content_length) return FALSE;
+
+	switch (vr->request.http_method) {
+	case LI_HTTP_METHOD_GET:
+	case LI_HTTP_METHOD_HEAD:
+	case LI_HTTP_METHOD_OPTIONS:
+	case LI_HTTP_METHOD_PUT:
+	case LI_HTTP_METHOD_DELETE:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void fastcgi_connect_vrequest(liVRequest *vr, liFastCGIBackendConnection_p *con) {
+	liFastCGIBackendContext *ctx = con->ctx;
+	liStream *http_out;
+
+	con->connected = TRUE;
+
+	http_out = li_stream_http_response_handle(&ctx->fcgi_in, vr, TRUE, TRUE, FALSE);
+
+	li_vrequest_handle_indirect(vr, NULL);
+	li_vrequest_indirect_connect(vr, &ctx->fcgi_out, http_out);
+
+	li_stream_release(http_out);
+}
+
 liBackendResult li_fastcgi_backend_get(liVRequest *vr, liFastCGIBackendPool *bpool, liFastCGIBackendConnection **pbcon, liFastCGIBackendWait **pbwait) {
 	liFastCGIBackendPool_p *pool = LI_CONTAINER_OF(bpool, liFastCGIBackendPool_p, public);
 	liBackendConnection *subcon = NULL;
@@ -695,13 +802,43 @@ liBackendResult li_fastcgi_backend_get(liVRequest *vr, liFastCGIBackendPool *bpo
 
 	fcgi_debug("li_fastcgi_backend_get\n");
 
-	res = li_backend_get(vr, pool->public.subpool, &subcon, &subwait);
-	*pbwait = (liFastCGIBackendWait*) subwait;
+	if (NULL != *pbcon) {
+		liFastCGIBackendConnection_p *con = LI_CONTAINER_OF(*pbcon, liFastCGIBackendConnection_p, public);
+
+		LI_FORCE_ASSERT(!con->connected && vr == con->vr);
+
+		if (NULL != con->ctx) {
+			if (!con->responding) return LI_BACKEND_WAIT;
+
+			fcgi_debug("li_fastcgi_backend_get: backend is responding\n");
+			fastcgi_connect_vrequest(vr, con);
+			/* decode the buffered response */
+			li_stream_again(&con->ctx->fcgi_in);
+			return LI_BACKEND_SUCCESS;
+		}
+
+		/* backend closed the keep-alive connection before it saw the request; try again */
+		g_slice_free(liFastCGIBackendConnection_p, con);
+		*pbcon = NULL;
+	}
+
+	for (;;) {
+		res = li_backend_get(vr, pool->public.subpool, &subcon, &subwait);
+		*pbwait = (liFastCGIBackendWait*) subwait;
+
+		if (NULL == subcon || 0 == li_backend_connection_requests(subcon)) break;
+
+		/* keep-alive connection: the backend might have closed it while it was idle */
+		if (0 == fastcgi_connection_peek(subcon->data)) break;
+
+		fcgi_debug("li_fastcgi_backend_get: idle connection closed by backend\n");
+		li_backend_put(vr->wrk, pool->public.subpool, subcon, TRUE);
+		subcon = NULL;
+	}
 
 	if (subcon != NULL) {
 		liFastCGIBackendConnection_p *con = g_slice_new0(liFastCGIBackendConnection_p);
 		liFastCGIBackendContext *ctx = subcon->data;
-		liStream *http_out;
 
 		LI_FORCE_ASSERT(NULL != ctx);
 		LI_FORCE_ASSERT(LI_BACKEND_SUCCESS == res);
@@ -730,18 +867,23 @@ liBackendResult li_fastcgi_backend_get(liVRequest *vr, liFastCGIBackendPool *bpo
 		LI_FORCE_ASSERT(ctx->iostream->stream_out.source == &ctx->fcgi_out);
 
 		ctx->stdin_closed = ctx->stdout_closed = ctx->stderr_closed = ctx->request_done = FALSE;
+		ctx->keepalive = ctx->stdin_presend = FALSE;
 		li_chunkqueue_reset(ctx->fcgi_in.out);
 
 		stream_send_begin(ctx->fcgi_out.out, 1);
 		fastcgi_send_env(vr, ctx->fcgi_out.out, 1);
-		li_stream_notify_later(&ctx->fcgi_out);
-
-		http_out = li_stream_http_response_handle(&ctx->fcgi_in, vr, TRUE, TRUE, FALSE);
 
-		li_vrequest_handle_indirect(vr, NULL);
-		li_vrequest_indirect_connect(vr, &ctx->fcgi_out, http_out);
+		if (0 != li_backend_connection_requests(subcon) && fastcgi_request_retryable(vr)) {
+			/* the backend can still close the connection before it gets the request; send the
+			 * complete request and wait for the response, so it can be sent again on another connection */
+			ctx->stdin_closed = ctx->stdin_presend = TRUE;
+			stream_send_fcgi_record(ctx->fcgi_out.out, FCGI_STDIN, 1, 0);
+			li_stream_notify_later(&ctx->fcgi_out);
+			return LI_BACKEND_WAIT;
+		}
 
-		li_stream_release(http_out);
+		li_stream_notify_later(&ctx->fcgi_out);
+		fastcgi_connect_vrequest(vr, con);
 	} else {
 		*pbcon = NULL;
 		LI_FORCE_ASSERT(LI_BACKEND_SUCCESS != res);
@@ -773,3 +915,17 @@ void li_fastcgi_backend_put(liFastCGIBackendConnection *bcon) {
 
 	fastcgi_check_put(ctx);
 }
+
+void li_fastcgi_backend_response_wait_stop(liFastCGIBackendConnection **pbcon) {
+	liFastCGIBackendConnection_p *con = LI_CONTAINER_OF(*pbcon, liFastCGIBackendConnection_p, public);
+	*pbcon = NULL;
+
+	LI_FORCE_ASSERT(!con->connected);
+
+	if (NULL == con->ctx) {
+		g_slice_free(liFastCGIBackendConnection_p, con);
+	} else {
+		/* the response is never read: ctx->keepalive is FALSE, the connection gets closed */
+		li_fastcgi_backend_put(&con->public);
+	}
+}
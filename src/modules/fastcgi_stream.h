@@ -46,8 +46,14 @@ struct liFastCGIBackendConfig {
 LI_API liFastCGIBackendPool* li_fastcgi_backend_pool_new(const liFastCGIBackendConfig *config);
 LI_API void li_fastcgi_backend_pool_free(liFastCGIBackendPool *bpool);
 
+/* *pbcon and *pbwait must be NULL for the first call. a request without body on a keep-alive connection
+ * returns LI_BACKEND_WAIT with *pbcon != NULL until the backend starts responding; if the backend closed
+ * the connection before, the next call sends the request again on another connection.
+ */
 LI_API liBackendResult li_fastcgi_backend_get(liVRequest *vr, liFastCGIBackendPool *bpool, liFastCGIBackendConnection **pbcon, liFastCGIBackendWait **pbwait);
 LI_API void li_fastcgi_backend_wait_stop(liVRequest *vr, liFastCGIBackendPool *bpool, liFastCGIBackendWait **pbwait);
+/* drop a connection li_fastcgi_backend_get() returned with LI_BACKEND_WAIT */
+LI_API void li_fastcgi_backend_response_wait_stop(liFastCGIBackendConnection **pbcon);
 
 /* only call from reset or end_request callbacks */
 LI_API void li_fastcgi_backend_put(liFastCGIBackendConnection *bcon);
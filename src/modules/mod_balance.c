@@ -1,6 +1,14 @@
 /*
  * mod_balance - balance between different backends
  *
+ * While all backends are alive and there is no backlog, backends get selected without taking the balancer lock
+ * (load and state are read atomically); the lock is only needed for state changes and the backlog.
+ *
+ * Backends can be checked actively (TCP connect, HTTP GET, FastCGI FCGI_GET_VALUES) from the event loop of the
+ * worker which created the balancer; a backend is taken out after "fall" failed checks and only gets requests
+ * again after "rise" good checks, with the share of its traffic ramping up during "slow_start" seconds.
+ * The results are registered in srv->backend_health (listed by mod_status).
+ *
  * Author:
  *     Copyright (c) 2009-2010 Stefan Bühler
  */
@@ -26,18 +34,52 @@ typedef enum {
 
 typedef enum {
 	BM_SQF,
-	BM_ROUNDROBIN
+	BM_ROUNDROBIN,
+	BM_P2C,
+	BM_EWMA,
+	BM_HASH
 } balancer_method;
 
+#define BALANCER_MAX_WEIGHT 1000
+/* smoothing factor for the response time average: new = old + (sample - old) / 2^BALANCER_EWMA_SHIFT */
+#define BALANCER_EWMA_SHIFT 3
+/* virtual nodes per weight unit on the consistent hash ring */
+#define BALANCER_RING_POINTS 160
+/* wake of backends which were taken out by their health check: only the check revives them */
+#define BALANCER_WAKE_NEVER 1e300
+/* slow start: traffic share in per mille */
+#define BALANCER_RAMP_FULL 1000
+#define BALANCER_RAMP_MIN 50
+
+#define HEALTH_CHECK_INTERVAL 5
+#define HEALTH_CHECK_TIMEOUT 2
+#define HEALTH_CHECK_RISE 2
+#define HEALTH_CHECK_FALL 3
+/* max length of the HTTP status line */
+#define HEALTH_CHECK_RESPONSE_MAX 1024
+
+typedef enum {
+	HC_TCP, /* also used for scgi:// */
+	HC_HTTP,
+	HC_FASTCGI
+} health_check_type;
+
 typedef struct backend backend;
 typedef struct balancer balancer;
 typedef struct bcontext bcontext;
+typedef struct ring_point ring_point;
+typedef struct health_check health_check;
 
 struct backend {
 	liAction *act;
-	guint load;
-	backend_state state;
+	guint weight;
+	gint load; /* atomic */
+	gint state; /* backend_state; modified with the balancer lock, atomic read */
+	gint ewma; /* atomic; average response time in microseconds */
+	gint ramp; /* atomic; slow start: share of the normal traffic in per mille */
 	li_tstamp wake;
+
+	health_check *check; /* NULL: no active checks */
 };
 
 struct balancer {
@@ -45,9 +87,17 @@ struct balancer {
 
 	GMutex *lock; /* balancer functions with "_" prefix need to be called with the lock being locked */
 	GArray *backends;
-	balancer_state state;
+	gint state; /* balancer_state; modified with the lock, atomic read */
 	balancer_method method;
-	gint next_ndx;
+	gint sleeping; /* atomic; number of backends which are not BE_ALIVE */
+	gint ramping; /* atomic; number of backends in slow start */
+
+	GArray *schedule; /* backend indices in smooth weighted round-robin order, each index "weight" times */
+	gint next_pos; /* atomic; round-robin position in schedule */
+	gint rand_state; /* atomic */
+
+	liPattern *hash_pattern; /* BM_HASH: request key */
+	GArray *ring; /* BM_HASH: ring_point entries sorted by point */
 
 	li_tstamp wake;
 
@@ -62,8 +112,45 @@ struct balancer {
 	liPlugin *p;
 };
 
+struct ring_point {
+	guint32 point;
+	guint ndx; /* backend */
+};
+
+/* all fields but passive_down are only used in the event loop of b->wrk */
+struct health_check {
+	balancer *b;
+	guint ndx; /* backend */
+
+	health_check_type type;
+	liSocketAddress addr;
+	GString *request; /* sent after connecting; empty for connect-only checks */
+	liBackendHealthEntry *entry;
+
+	li_tstamp interval, timeout, slow_start;
+	guint rise, fall;
+
+	liEventTimer timer; /* next check, or the timeout of the running check */
+	liEventIO watcher; /* fd -1: no check running */
+	gboolean connected;
+	gsize sent;
+	GString *response;
+
+	gboolean down;
+	guint successes, failures; /* consecutive */
+	li_tstamp up_since;
+	gint passive_down; /* atomic; set if a request failed on the backend */
+};
+
+/* FCGI_GET_VALUES record (request id 0) asking for FCGI_MPXS_CONNS; answered with FCGI_GET_VALUES_RESULT */
+static const gchar health_check_fcgi_get_values[] =
+	"\x01\x09\x00\x00\x00\x11\x07\x00"
+	"\x0f\x00" "FCGI_MPXS_CONNS"
+	"\x00\x00\x00\x00\x00\x00\x00";
+
 struct bcontext { /* context for a balancer in a vrequest */
 	gint selected; /* selected backend */
+	li_tstamp ts_selected;
 
 	GList backlog_link;
 	liJobRef *ref;
@@ -72,12 +159,17 @@ struct bcontext { /* context for a balancer in a vrequest */
 
 static void balancer_timer_cb(liEventBase *watcher, int events);
 static void balancer_async_cb(liEventBase *watcher, int events);
+static void health_check_timer_cb(liEventBase *watcher, int events);
+static void health_check_io_cb(liEventBase *watcher, int events);
+static void health_check_free(liServer *srv, health_check *hc);
 
 static balancer* balancer_new(liWorker *wrk, liPlugin *p, balancer_method method) {
 	balancer *b = g_slice_new0(balancer);
 	b->wrk = wrk;
 	b->lock = g_mutex_new();
 	b->backends = g_array_new(FALSE, TRUE, sizeof(backend));
+	b->schedule = g_array_new(FALSE, FALSE, sizeof(guint));
+	b->ring = g_array_new(FALSE, FALSE, sizeof(ring_point));
 	b->method = method;
 	b->state = BAL_ALIVE;
 	b->p = p;
@@ -103,46 +195,498 @@ static void balancer_free(liServer *srv, balancer *b) {
 	for (i = 0; i < b->backends->len; i++) {
 		backend *be = &g_array_index(b->backends, backend, i);
 		li_action_release(srv, be->act);
+		if (NULL != be->check) health_check_free(srv, be->check);
 	}
 	g_array_free(b->backends, TRUE);
+	g_array_free(b->schedule, TRUE);
+	g_array_free(b->ring, TRUE);
+	if (NULL != b->hash_pattern) li_pattern_free(b->hash_pattern);
 	g_slice_free(balancer, b);
 }
 
+/* returns the old value */
+static gint balancer_atomic_fetch_add(gint *atomic, gint val) {
+#ifdef GLIB_VERSION_2_30
+	return g_atomic_int_add(atomic, val);
+#else
+	return g_atomic_int_exchange_and_add(atomic, val);
+#endif
+}
+
+/* murmur3 32-bit finalizer */
+static guint32 balancer_hash32(guint32 x) {
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+	return x;
+}
+
+static guint32 balancer_random(balancer *b) {
+	/* weyl sequence through a hash */
+	return balancer_hash32((guint32) balancer_atomic_fetch_add(&b->rand_state, (gint) 0x9E3779B9u));
+}
+
+/* uniform in [0, n): rejects the lowest (2^32 mod n) values, which would make "% n" biased */
+static guint balancer_random_range(balancer *b, guint n) {
+	guint32 threshold = ((guint32) 0 - n) % n;
+	guint32 r;
+
+	do {
+		r = balancer_random(b);
+	} while (r < threshold);
+
+	return r % n;
+}
+
+/* order: like nginx' smooth weighted round-robin, so heavy backends don't get their requests in bursts */
+static void balancer_build_schedule(balancer *b) {
+	guint i, n, total = 0;
+	gint *current = g_new0(gint, b->backends->len);
+
+	for (i = 0; i < b->backends->len; i++) {
+		total += g_array_index(b->backends, backend, i).weight;
+	}
+
+	g_array_set_size(b->schedule, 0);
+	for (n = 0; n < total; n++) {
+		guint best = 0;
+		for (i = 0; i < b->backends->len; i++) {
+			current[i] += g_array_index(b->backends, backend, i).weight;
+			if (current[i] > current[best]) best = i;
+		}
+		current[best] -= total;
+		g_array_append_val(b->schedule, best);
+	}
+
+	g_free(current);
+}
+
+/* target: "tcp://ADDR", "scgi://ADDR" (only connects), "http://ADDR/path" or "fastcgi://ADDR" */
+static health_check* health_check_new(balancer *b, liServer *srv, GString *target, guint ndx) {
+	health_check *hc;
+	health_check_type type;
+	const gchar *addr_start, *path = NULL;
+	guint default_port = 0;
+	GString *addr_str;
+	liSocketAddress addr;
+
+	if (g_str_has_prefix(target->str, "tcp://")) {
+		type = HC_TCP;
+		addr_start = target->str + sizeof("tcp://") - 1;
+	} else if (g_str_has_prefix(target->str, "scgi://")) {
+		type = HC_TCP;
+		addr_start = target->str + sizeof("scgi://") - 1;
+	} else if (g_str_has_prefix(target->str, "http://")) {
+		type = HC_HTTP;
+		addr_start = target->str + sizeof("http://") - 1;
+		default_port = 80;
+		if (!g_str_has_prefix(addr_start, "unix:")) path = strchr(addr_start, '/');
+	} else if (g_str_has_prefix(target->str, "fastcgi://")) {
+		type = HC_FASTCGI;
+		addr_start = target->str + sizeof("fastcgi://") - 1;
+	} else {
+		ERROR(srv, "unknown health check '%s' at entry %u of list, expected tcp://, http://, fastcgi:// or scgi://", target->str, ndx);
+		return NULL;
+	}
+
+	addr_str = (NULL != path) ? g_string_new_len(addr_start, path - addr_start) : g_string_new(addr_start);
+	addr = li_sockaddr_from_string(addr_str, default_port);
+	if (NULL == addr.addr_up.raw) {
+		ERROR(srv, "invalid health check address '%s' at entry %u of list", addr_str->str, ndx);
+		g_string_free(addr_str, TRUE);
+		return NULL;
+	}
+
+	hc = g_slice_new0(health_check);
+	hc->b = b;
+	hc->ndx = ndx;
+	hc->type = type;
+	hc->addr = addr;
+	hc->request = g_string_sized_new(0);
+	hc->response = g_string_sized_new(0);
+
+	switch (type) {
+	case HC_TCP:
+		break;
+	case HC_HTTP:
+		g_string_append_printf(hc->request, "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: lighttpd2 health check\r\n\r\n",
+			NULL != path ? path : "/", g_str_has_prefix(addr_start, "unix:") ? "localhost" : addr_str->str);
+		break;
+	case HC_FASTCGI:
+		g_string_append_len(hc->request, health_check_fcgi_get_values, sizeof(health_check_fcgi_get_values) - 1);
+		break;
+	}
+	g_string_free(addr_str, TRUE);
+
+	hc->interval = HEALTH_CHECK_INTERVAL;
+	hc->timeout = HEALTH_CHECK_TIMEOUT;
+	hc->rise = HEALTH_CHECK_RISE;
+	hc->fall = HEALTH_CHECK_FALL;
+
+	hc->entry = li_backend_health_register(srv->backend_health, target->str);
+
+	li_event_timer_init(&b->wrk->loop, "balancer health check", &hc->timer, health_check_timer_cb);
+	li_event_set_keep_loop_alive(&hc->timer, FALSE);
+	li_event_io_init(&b->wrk->loop, "balancer health check", &hc->watcher, health_check_io_cb, -1, LI_EV_WRITE);
+	li_event_set_keep_loop_alive(&hc->watcher, FALSE);
+
+	return hc;
+}
+
+static void health_check_free(liServer *srv, health_check *hc) {
+	int fd = li_event_io_fd(&hc->watcher);
+
+	li_event_clear(&hc->timer);
+	li_event_clear(&hc->watcher);
+	if (-1 != fd) close(fd);
+
+	li_backend_health_unregister(srv->backend_health, hc->entry);
+	li_sockaddr_clear(&hc->addr);
+	g_string_free(hc->request, TRUE);
+	g_string_free(hc->response, TRUE);
+	g_slice_free(health_check, hc);
+}
+
+/* backend option names */
+static const GString
+	bon_weight = { CONST_STR_LEN("weight"), 0 },
+	bon_check = { CONST_STR_LEN("check"), 0 },
+	bon_interval = { CONST_STR_LEN("interval"), 0 },
+	bon_timeout = { CONST_STR_LEN("timeout"), 0 },
+	bon_rise = { CONST_STR_LEN("rise"), 0 },
+	bon_fall = { CONST_STR_LEN("fall"), 0 },
+	bon_slow_start = { CONST_STR_LEN("slow_start"), 0 };
+
+/* options: "weight", "check" (see health_check_new), "interval", "timeout", "rise", "fall" and "slow_start" */
+static gboolean balancer_backend_options(balancer *b, liServer *srv, backend *be, liValue *options, guint ndx) {
+	GString *check = NULL;
+	gint64 weight = 1, interval = HEALTH_CHECK_INTERVAL, timeout = HEALTH_CHECK_TIMEOUT;
+	gint64 rise = HEALTH_CHECK_RISE, fall = HEALTH_CHECK_FALL, slow_start = 0;
+
+	if (NULL == (options = li_value_to_key_value_list(options))) {
+		ERROR(srv, "expected key-value list as backend options at entry %u of list", ndx);
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, options)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *entryKeyStr;
+		gint64 *number;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "backend options at entry %u of list don't take default keys", ndx);
+			return FALSE;
+		}
+		entryKeyStr = entryKey->data.string; /* keys are either NONE or STRING */
+
+		if (g_string_equal(entryKeyStr, &bon_check)) {
+			if (LI_VALUE_STRING != li_value_type(entryValue)) {
+				ERROR(srv, "backend option 'check' at entry %u of list expects a string as parameter", ndx);
+				return FALSE;
+			}
+			check = entryValue->data.string;
+			continue;
+		} else if (g_string_equal(entryKeyStr, &bon_weight)) {
+			number = &weight;
+		} else if (g_string_equal(entryKeyStr, &bon_interval)) {
+			number = &interval;
+		} else if (g_string_equal(entryKeyStr, &bon_timeout)) {
+			number = &timeout;
+		} else if (g_string_equal(entryKeyStr, &bon_rise)) {
+			number = &rise;
+		} else if (g_string_equal(entryKeyStr, &bon_fall)) {
+			number = &fall;
+		} else if (g_string_equal(entryKeyStr, &bon_slow_start)) {
+			number = &slow_start;
+		} else {
+			ERROR(srv, "unknown backend option '%s' at entry %u of list", entryKeyStr->str, ndx);
+			return FALSE;
+		}
+
+		if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0) {
+			ERROR(srv, "backend option '%s' at entry %u of list expects a non-negative number as parameter", entryKeyStr->str, ndx);
+			return FALSE;
+		}
+		*number = entryValue->data.number;
+	LI_VALUE_END_FOREACH()
+
+	if (weight < 1 || weight > BALANCER_MAX_WEIGHT) {
+		ERROR(srv, "weight at entry %u of list must be between 1 and %i", ndx, BALANCER_MAX_WEIGHT);
+		return FALSE;
+	}
+	be->weight = weight;
+
+	if (NULL == check) return TRUE;
+
+	if (interval < 1 || timeout < 1 || rise < 1 || fall < 1) {
+		ERROR(srv, "health check interval, timeout, rise and fall at entry %u of list must be positive", ndx);
+		return FALSE;
+	}
+	if (NULL == (be->check = health_check_new(b, srv, check, ndx))) return FALSE;
+	be->check->interval = interval;
+	be->check->timeout = MIN(timeout, interval);
+	be->check->rise = rise;
+	be->check->fall = fall;
+	be->check->slow_start = slow_start;
+
+	return TRUE;
+}
+
+/* entry is either an action, a (action, weight) pair or a (action, options) pair */
+static gboolean balancer_add_backend(balancer *b, liServer *srv, liValue *val, guint ndx) {
+	backend be;
+	liValue *options = NULL;
+
+	memset(&be, 0, sizeof(be));
+	be.weight = 1;
+	be.state = BE_ALIVE;
+	be.ramp = BALANCER_RAMP_FULL;
+
+	if (LI_VALUE_LIST == li_value_type(val)) {
+		if (!li_value_list_has_len(val, 2) || LI_VALUE_ACTION != li_value_list_type_at(val, 0)
+				|| (LI_VALUE_NUMBER != li_value_list_type_at(val, 1) && LI_VALUE_LIST != li_value_list_type_at(val, 1))) {
+			ERROR(srv, "expected action, (action, weight) or (action, options) pair at entry %u of list", ndx);
+			return FALSE;
+		}
+		options = li_value_list_at(val, 1);
+		val = li_value_list_at(val, 0);
+
+		if (LI_VALUE_NUMBER == li_value_type(options)) {
+			if (options->data.number < 1 || options->data.number > BALANCER_MAX_WEIGHT) {
+				ERROR(srv, "weight at entry %u of list must be between 1 and %i", ndx, BALANCER_MAX_WEIGHT);
+				return FALSE;
+			}
+			be.weight = options->data.number;
+		} else if (!balancer_backend_options(b, srv, &be, options, ndx)) {
+			return FALSE;
+		}
+	} else if (LI_VALUE_ACTION != li_value_type(val)) {
+		ERROR(srv, "expected action at entry %u of list, got %s", ndx, li_value_type_string(val));
+		return FALSE;
+	}
+
+	LI_FORCE_ASSERT(srv == val->data.val_action.srv);
+	be.act = val->data.val_action.action;
+	li_action_acquire(be.act);
+	g_array_append_val(b->backends, be);
+
+	/* first check right away */
+	if (NULL != be.check) li_event_timer_once(&be.check->timer, 0);
+
+	return TRUE;
+}
+
+static gint ring_point_cmp(gconstpointer a, gconstpointer b) {
+	const ring_point *pa = a, *pb = b;
+	if (pa->point != pb->point) return pa->point < pb->point ? -1 : 1;
+	return (gint) pa->ndx - (gint) pb->ndx;
+}
+
+/* the points of a backend only depend on its position in the list, so appending a backend
+ * (or removing the last one) only moves the keys which map to its points */
+static void balancer_build_ring(balancer *b) {
+	guint i, j;
+
+	g_array_set_size(b->ring, 0);
+	for (i = 0; i < b->backends->len; i++) {
+		guint points = BALANCER_RING_POINTS * g_array_index(b->backends, backend, i).weight;
+		for (j = 0; j < points; j++) {
+			ring_point rp;
+			rp.point = balancer_hash32(balancer_hash32(i + 1) ^ (j * 0x9E3779B1u));
+			rp.ndx = i;
+			g_array_append_val(b->ring, rp);
+		}
+	}
+	g_array_sort(b->ring, ring_point_cmp);
+}
+
 static gboolean balancer_fill_backends(balancer *b, liServer *srv, liValue *val) {
 	val = li_value_get_single_argument(val);
 
 	if (LI_VALUE_ACTION == li_value_type(val)) {
-		backend be;
-		be.act = val->data.val_action.action;
-		be.load = 0; be.state = BE_ALIVE; be.wake = 0;
-		LI_FORCE_ASSERT(srv == val->data.val_action.srv);
-		li_action_acquire(be.act);
-		g_array_append_val(b->backends, be);
-		return TRUE;
+		if (!balancer_add_backend(b, srv, val, 0)) return FALSE;
 	} else if (LI_VALUE_LIST == li_value_type(val)) {
 		if (li_value_list_has_len(val, 0)) {
 			ERROR(srv, "%s", "expected non-empty list");
 			return FALSE;
 		}
 		LI_VALUE_FOREACH(oa, val)
-			if (LI_VALUE_ACTION != li_value_type(oa)) {
-				ERROR(srv, "expected action at entry %u of list, got %s", _oa_i, li_value_type_string(oa));
-				return FALSE;
-			}
-			LI_FORCE_ASSERT(srv == oa->data.val_action.srv);
-			{
-				backend be;
-				be.act = oa->data.val_action.action;
-				be.load = 0; be.state = BE_ALIVE; be.wake = 0;
-				li_action_acquire(be.act);
-				g_array_append_val(b->backends, be);
-			}
+			if (!balancer_add_backend(b, srv, oa, _oa_i)) return FALSE;
 		LI_VALUE_END_FOREACH()
-		return TRUE;
 	} else {
 		ERROR(srv, "expected list, got %s", li_value_type_string(val));
 		return FALSE;
 	}
+
+	balancer_build_schedule(b);
+	return TRUE;
+}
+
+/* modifying the state requires the lock */
+static void _backend_set_state(balancer *b, backend *be, backend_state state) {
+	gint old = g_atomic_int_get(&be->state);
+
+	if (old == (gint) state) return;
+	if (BE_ALIVE == old) g_atomic_int_inc(&b->sleeping);
+	if (BE_ALIVE == state) g_atomic_int_add(&b->sleeping, -1);
+	g_atomic_int_set(&be->state, state);
+}
+
+static gboolean backend_is_alive(backend *be) {
+	return BE_ALIVE == g_atomic_int_get(&be->state);
+}
+
+/* alive, and during slow start only for the ramp share of the requests */
+static gboolean backend_usable(balancer *b, backend *be, gboolean ramp) {
+	gint r;
+
+	if (!backend_is_alive(be)) return FALSE;
+	if (!ramp || (r = g_atomic_int_get(&be->ramp)) >= BALANCER_RAMP_FULL) return TRUE;
+	return balancer_random(b) % BALANCER_RAMP_FULL < (guint32) r;
+}
+
+/* TRUE if a has less load per weight than b */
+static gboolean backend_less_loaded(backend *a, backend *b) {
+	return (guint64) g_atomic_int_get(&a->load) * b->weight < (guint64) g_atomic_int_get(&b->load) * a->weight;
+}
+
+/* expected time to handle another request */
+static double backend_latency_cost(backend *be) {
+	return (g_atomic_int_get(&be->ewma) + 1.0) * (g_atomic_int_get(&be->load) + 1) / be->weight;
+}
+
+static void backend_update_latency(backend *be, li_tstamp duration) {
+	gint sample = (gint) MIN(duration * 1e6, (double) G_MAXINT / 2);
+	gint old, new;
+
+	do {
+		old = g_atomic_int_get(&be->ewma);
+		new = (0 == old) ? sample : old + ((sample - old) >> BALANCER_EWMA_SHIFT);
+		if (new <= 0) new = 1;
+	} while (!g_atomic_int_compare_and_exchange(&be->ewma, old, new));
+}
+
+/* first alive backend on the ring, starting at the position of the request key */
+static gint balancer_choose_hash(balancer *b, liVRequest *vr, gboolean ramp) {
+	GString *key = vr->wrk->tmp_str;
+	GMatchInfo *match_info = NULL;
+	guint32 h;
+	guint lo = 0, hi = b->ring->len, i;
+
+	if (vr->action_stack.regex_stack->len) {
+		GArray *rs = vr->action_stack.regex_stack;
+		match_info = g_array_index(rs, liActionRegexStackElement, rs->len - 1).match_info;
+	}
+
+	g_string_truncate(key, 0);
+	li_pattern_eval(vr, key, b->hash_pattern, NULL, NULL, li_pattern_regex_cb, match_info);
+	h = balancer_hash32(g_string_hash(key));
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		if (g_array_index(b->ring, ring_point, mid).point < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	/* fail over to the next ring members */
+	for (i = 0; i < b->ring->len; i++) {
+		guint ndx = g_array_index(b->ring, ring_point, (lo + i) % b->ring->len).ndx;
+		if (backend_usable(b, &g_array_index(b->backends, backend, ndx), ramp)) return ndx;
+	}
+
+	return -1;
+}
+
+/* picks a usable backend with the configured method; only reads the backend states. returns -1 if there is none */
+static gint balancer_choose_method(balancer *b, liVRequest *vr, gboolean ramp) {
+	gint be_ndx = -1;
+	guint i, j, len = b->backends->len;
+	backend *be;
+
+	switch (b->method) {
+	case BM_SQF:
+		for (i = 0; i < len; i++) {
+			be = &g_array_index(b->backends, backend, i);
+			if (!backend_usable(b, be, ramp)) continue;
+
+			if (-1 == be_ndx || backend_less_loaded(be, &g_array_index(b->backends, backend, be_ndx))) {
+				be_ndx = i;
+			}
+		}
+		break;
+	case BM_ROUNDROBIN:
+		j = (guint) balancer_atomic_fetch_add(&b->next_pos, 1);
+		for (i = 0; i < b->schedule->len; i++) {
+			guint ndx = g_array_index(b->schedule, guint, (j + i) % b->schedule->len);
+			if (!backend_usable(b, &g_array_index(b->backends, backend, ndx), ramp)) continue;
+
+			be_ndx = ndx;
+			break; /* use first alive backend */
+		}
+		break;
+	case BM_P2C:
+		{
+			/* power of two choices: sampling from the schedule picks backends proportional to their weight */
+			guint c1 = g_array_index(b->schedule, guint, balancer_random_range(b, b->schedule->len));
+			guint c2 = g_array_index(b->schedule, guint, balancer_random_range(b, b->schedule->len));
+			backend *be1 = &g_array_index(b->backends, backend, c1);
+			backend *be2 = &g_array_index(b->backends, backend, c2);
+			gboolean usable1 = backend_usable(b, be1, ramp), usable2 = backend_usable(b, be2, ramp);
+
+			if (usable1 && usable2) {
+				be_ndx = backend_less_loaded(be2, be1) ? c2 : c1;
+			} else if (usable1) {
+				be_ndx = c1;
+			} else if (usable2) {
+				be_ndx = c2;
+			} else {
+				/* both not usable: take the first usable one */
+				for (i = 0; i < len; i++) {
+					if (!backend_usable(b, &g_array_index(b->backends, backend, (c1 + i) % len), ramp)) continue;
+					be_ndx = (c1 + i) % len;
+					break;
+				}
+			}
+		}
+		break;
+	case BM_EWMA:
+		{
+			double cost = 0;
+
+			for (i = 0; i < len; i++) {
+				double c;
+				be = &g_array_index(b->backends, backend, i);
+				if (!backend_usable(b, be, ramp)) continue;
+
+				c = backend_latency_cost(be);
+				if (-1 == be_ndx || c < cost) {
+					be_ndx = i;
+					cost = c;
+				}
+			}
+		}
+		break;
+	case BM_HASH:
+		be_ndx = balancer_choose_hash(b, vr, ramp);
+		break;
+	}
+
+	return be_ndx;
+}
+
+/* backends in slow start only get a part of the requests - unless there is no other alive backend */
+static gint balancer_choose(balancer *b, liVRequest *vr) {
+	gint be_ndx;
+
+	if (g_atomic_int_get(&b->ramping) > 0 && -1 != (be_ndx = balancer_choose_method(b, vr, TRUE))) return be_ndx;
+
+	return balancer_choose_method(b, vr, FALSE);
 }
 
 static void _balancer_context_backlog_unlink(balancer *b, bcontext *bc) {
@@ -207,7 +751,7 @@ static gboolean _balancer_backlog_schedule(liWorker *wrk, balancer *b) {
 
 		if (NULL == it) {
 			/* backlog done */
-			b->state = BAL_ALIVE;
+			g_atomic_int_set(&b->state, BAL_ALIVE);
 			b->backlog_reactivate_now = 0;
 			b->wake = 0;
 
@@ -255,24 +799,251 @@ static void balancer_async_cb(liEventBase *watcher, int events) {
 	g_mutex_unlock(b->lock);
 }
 
+static void health_check_set_ramp(balancer *b, backend *be, gint ramp) {
+	gint old = g_atomic_int_get(&be->ramp);
+
+	if (old == ramp) return;
+	if (old >= BALANCER_RAMP_FULL) g_atomic_int_inc(&b->ramping);
+	if (ramp >= BALANCER_RAMP_FULL) g_atomic_int_add(&b->ramping, -1);
+	g_atomic_int_set(&be->ramp, ramp);
+}
+
+/* may destroy the balancer (and hc) */
+static void health_check_update_backend(health_check *hc) {
+	balancer *b = hc->b;
+	backend *be = &g_array_index(b->backends, backend, hc->ndx);
+
+	g_mutex_lock(b->lock);
+
+	if (hc->down) {
+		be->wake = BALANCER_WAKE_NEVER;
+		_backend_set_state(b, be, BE_DOWN);
+	} else {
+		be->wake = 0;
+		_backend_set_state(b, be, BE_ALIVE);
+		b->backlog_reactivate_now++;
+		if (!_balancer_backlog_schedule(b->wrk, b)) return;
+	}
+
+	g_mutex_unlock(b->lock);
+}
+
+/* closes the check connection, applies rise/fall and schedules the next check. may destroy hc */
+static void health_check_done(health_check *hc, gboolean ok, const gchar *error) {
+	balancer *b = hc->b;
+	li_tstamp now = li_cur_ts(b->wrk);
+	int fd = li_event_io_fd(&hc->watcher);
+	gboolean was_down = hc->down;
+	gint ramp = BALANCER_RAMP_FULL;
+
+	if (-1 != fd) {
+		li_event_io_set_fd(&hc->watcher, -1);
+		close(fd);
+	}
+
+	if (g_atomic_int_compare_and_exchange(&hc->passive_down, 1, 0)) {
+		/* a request failed and took the backend out: it has to pass "rise" checks again */
+		hc->down = TRUE;
+		hc->successes = 0;
+	}
+
+	if (ok) {
+		hc->failures = 0;
+		if (hc->down && ++hc->successes >= hc->rise) {
+			hc->down = FALSE;
+			hc->up_since = now;
+		}
+	} else {
+		hc->successes = 0;
+		if (!hc->down && ++hc->failures >= hc->fall) hc->down = TRUE;
+	}
+
+	if (!hc->down && hc->slow_start > 0 && now - hc->up_since < hc->slow_start) {
+		ramp = MAX(BALANCER_RAMP_MIN, (gint) (BALANCER_RAMP_FULL * (now - hc->up_since) / hc->slow_start));
+	}
+	health_check_set_ramp(b, &g_array_index(b->backends, backend, hc->ndx), ramp);
+
+	li_backend_health_report(b->wrk->srv->backend_health, hc->entry,
+		hc->down ? LI_BACKEND_HEALTH_DOWN : LI_BACKEND_HEALTH_UP, ok, error, now);
+
+	li_event_timer_once(&hc->timer, hc->interval);
+
+	if (was_down != hc->down) health_check_update_backend(hc);
+}
+
+/* 1: healthy, 0: needs more data, -1: failed */
+static gint health_check_parse_response(health_check *hc, const gchar **error) {
+	GString *r = hc->response;
+	guint status;
+
+	switch (hc->type) {
+	case HC_TCP:
+		return 1;
+	case HC_HTTP:
+		if (NULL == memchr(r->str, '\n', r->len)) {
+			if (r->len < HEALTH_CHECK_RESPONSE_MAX) return 0;
+			*error = "HTTP status line too long";
+			return -1;
+		}
+		if (r->len < 13 || !li_string_prefix(r, CONST_STR_LEN("HTTP/1.")) || ' ' != r->str[8]
+				|| !g_ascii_isdigit(r->str[9]) || !g_ascii_isdigit(r->str[10]) || !g_ascii_isdigit(r->str[11])) {
+			*error = "invalid HTTP response";
+			return -1;
+		}
+		status = (r->str[9] - '0') * 100 + (r->str[10] - '0') * 10 + (r->str[11] - '0');
+		if (status < 200 || status >= 400) {
+			GString *tmp = hc->b->wrk->tmp_str;
+			g_string_printf(tmp, "HTTP status %u", status);
+			*error = tmp->str;
+			return -1;
+		}
+		return 1;
+	case HC_FASTCGI:
+		if (r->len < 8) return 0;
+		if (1 != r->str[0] || 10 /* FCGI_GET_VALUES_RESULT */ != r->str[1]) {
+			*error = "invalid FastCGI response";
+			return -1;
+		}
+		return 1;
+	}
+
+	return -1;
+}
+
+static void health_check_start(health_check *hc) {
+	int fd;
+
+	do {
+		fd = socket(hc->addr.addr_up.plain->sa_family, SOCK_STREAM, 0);
+	} while (-1 == fd && errno == EINTR);
+	if (-1 == fd) {
+		health_check_done(hc, FALSE, g_strerror(errno));
+		return;
+	}
+	li_fd_init(fd);
+
+	if (-1 == connect(fd, hc->addr.addr_up.plain, hc->addr.len)) {
+		switch (errno) {
+		case EINPROGRESS:
+		case EALREADY:
+		case EINTR:
+			break;
+		default:
+			{
+				int err = errno;
+				close(fd);
+				health_check_done(hc, FALSE, g_strerror(err));
+			}
+			return;
+		}
+	}
+
+	hc->connected = FALSE;
+	hc->sent = 0;
+	g_string_truncate(hc->response, 0);
+
+	li_event_io_set_fd(&hc->watcher, fd);
+	li_event_io_set_events(&hc->watcher, LI_EV_WRITE);
+	li_event_start(&hc->watcher);
+
+	li_event_timer_once(&hc->timer, hc->timeout);
+}
+
+static void health_check_timer_cb(liEventBase *watcher, int events) {
+	health_check *hc = LI_CONTAINER_OF(li_event_timer_from(watcher), health_check, timer);
+	UNUSED(events);
+
+	if (-1 != li_event_io_fd(&hc->watcher)) {
+		health_check_done(hc, FALSE, "timeout");
+	} else {
+		health_check_start(hc);
+	}
+}
+
+static void health_check_io_cb(liEventBase *watcher, int events) {
+	health_check *hc = LI_CONTAINER_OF(li_event_io_from(watcher), health_check, watcher);
+	int fd = li_event_io_fd(&hc->watcher);
+	const gchar *error = "connection closed";
+	gchar buf[512];
+	ssize_t r;
+	gint res;
+	UNUSED(events);
+
+	if (!hc->connected) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*) &err, &len)) err = errno;
+		if (0 != err) {
+			health_check_done(hc, FALSE, g_strerror(err));
+			return;
+		}
+		hc->connected = TRUE;
+
+		if (0 == hc->request->len) {
+			health_check_done(hc, TRUE, NULL);
+			return;
+		}
+	}
+
+	if (hc->sent < hc->request->len) {
+		r = write(fd, hc->request->str + hc->sent, hc->request->len - hc->sent);
+		if (-1 == r) {
+			if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) return;
+			health_check_done(hc, FALSE, g_strerror(errno));
+			return;
+		}
+		hc->sent += r;
+		if (hc->sent == hc->request->len) li_event_io_set_events(&hc->watcher, LI_EV_READ);
+		return;
+	}
+
+	r = read(fd, buf, sizeof(buf));
+	if (-1 == r) {
+		if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) return;
+		health_check_done(hc, FALSE, g_strerror(errno));
+		return;
+	}
+	g_string_append_len(hc->response, buf, r);
+
+	res = health_check_parse_response(hc, &error);
+	if (0 == res && 0 == r) res = -1;
+	if (0 != res) health_check_done(hc, 1 == res, error);
+}
+
 static void balancer_context_free(liVRequest *vr, balancer *b, gpointer *context, gboolean success) {
 	bcontext *bc = *context;
 
 	if (!bc) return;
 	*context = NULL;
 
+	if (bc->selected >= 0) {
+		/* a context with a selected backend isn't in the backlog */
+		backend *be = &g_array_index(b->backends, backend, bc->selected);
+
+		if (success) backend_update_latency(be, li_cur_ts(vr->wrk) - bc->ts_selected);
+
+		if (!success || (backend_is_alive(be) && BAL_ALIVE == g_atomic_int_get(&b->state))) {
+			/* nothing to reactivate */
+			g_atomic_int_add(&be->load, -1);
+			g_slice_free(bcontext, bc);
+			return;
+		}
+	}
+
 	g_mutex_lock(b->lock);
 
 	_balancer_context_backlog_unlink(b, bc);
 
 	if (bc->selected >= 0) {
 		backend *be = &g_array_index(b->backends, backend, bc->selected);
-		be->load--;
+		g_atomic_int_add(&be->load, -1);
 		bc->selected = -1;
 
-		if (success) {
-			/* reactivate it (if not alive), as it obviously isn't completely down */
-			be->state = BE_ALIVE;
+		if (success && be->wake < BALANCER_WAKE_NEVER) {
+			/* reactivate it (if not alive), as it obviously isn't completely down
+			 * (unless its health check took it out) */
+			_backend_set_state(b, be, BE_ALIVE);
 			b->backlog_reactivate_now++;
 			_balancer_backlog_schedule(vr->wrk, b);
 		}
@@ -283,8 +1054,8 @@ static void balancer_context_free(liVRequest *vr, balancer *b, gpointer *context
 	g_slice_free(bcontext, bc);
 }
 
-
-static void _balancer_context_select_backend(balancer *b, gpointer *context, gint ndx) {
+/* doesn't need the lock if the context isn't in the backlog */
+static void _balancer_context_select_backend(balancer *b, liVRequest *vr, gpointer *context, gint ndx) {
 	bcontext *bc = *context;
 
 	if (NULL == bc) {
@@ -296,29 +1067,37 @@ static void _balancer_context_select_backend(balancer *b, gpointer *context, gin
 
 	if (bc->selected >= 0) {
 		backend *be = &g_array_index(b->backends, backend, bc->selected);
-		be->load--;
+		g_atomic_int_add(&be->load, -1);
 	}
 
 	bc->selected = ndx;
 
 	if (bc->selected >= 0) {
 		backend *be = &g_array_index(b->backends, backend, bc->selected);
-		be->load++;
-		b->next_ndx = ndx + 1;
+		g_atomic_int_inc(&be->load);
+		bc->ts_selected = li_cur_ts(vr->wrk);
 	}
 }
 
 static liHandlerResult balancer_act_select(liVRequest *vr, gboolean backlog_provided, gpointer param, gpointer *context) {
 	balancer *b = param;
 	bcontext *bc = *context;
-	gint be_ndx, load;
-	guint i, j;
+	gint be_ndx;
+	guint i;
 	backend *be;
 	li_tstamp now = li_cur_ts(vr->wrk);
 	gboolean all_dead = TRUE;
 	gboolean debug = _OPTION(vr, b->p, 0).boolean;
 
-	be_ndx = -1;
+	if ((NULL == bc || (-1 == bc->selected && NULL == bc->backlog_link.data))
+			&& BAL_ALIVE == g_atomic_int_get(&b->state) && 0 == g_atomic_int_get(&b->sleeping)) {
+		/* fast path: all backends alive, no backlog */
+		be_ndx = balancer_choose(b, vr);
+		if (-1 != be_ndx) {
+			_balancer_context_select_backend(b, vr, context, be_ndx);
+			goto selected;
+		}
+	}
 
 	g_mutex_lock(b->lock);
 
@@ -354,45 +1133,20 @@ static liHandlerResult balancer_act_select(liVRequest *vr, gboolean backlog_prov
 		return LI_HANDLER_GO_ON;
 	}
 
-	switch (b->method) {
-	case BM_SQF:
-		load = -1;
-
-		for (i = 0; i < b->backends->len; i++) {
-			be = &g_array_index(b->backends, backend, i);
-
-			if (now >= be->wake) be->state = BE_ALIVE;
-			if (be->state != BE_DOWN) all_dead = FALSE;
-			if (be->state != BE_ALIVE) continue;
-
-			if (load == -1 || load > (gint) be->load) {
-				be_ndx = i;
-				load = be->load;
-			}
-		}
-
-		break;
-	case BM_ROUNDROBIN:
-		for (j = 0; j < b->backends->len; j++) {
-			i = (b->next_ndx + j) % b->backends->len;
-			be = &g_array_index(b->backends, backend, i);
-
-			if (now >= be->wake) be->state = BE_ALIVE;
-			if (be->state != BE_DOWN) all_dead = FALSE;
-			if (be->state != BE_ALIVE) continue;
-
-			be_ndx = i;
-			break; /* use first alive backend */
-		}
+	for (i = 0; i < b->backends->len; i++) {
+		be = &g_array_index(b->backends, backend, i);
 
-		break;
+		if (now >= be->wake) _backend_set_state(b, be, BE_ALIVE);
+		if (g_atomic_int_get(&be->state) != BE_DOWN) all_dead = FALSE;
 	}
 
+	be_ndx = balancer_choose(b, vr);
+
 	if (-1 == be_ndx) {
 		/* Couldn't find active backend */
 
 		if (b->state == BAL_ALIVE) {
-			b->state = all_dead ? BAL_DOWN : BAL_OVERLOADED;
+			g_atomic_int_set(&b->state, all_dead ? BAL_DOWN : BAL_OVERLOADED);
 			b->wake = li_cur_ts(vr->wrk) + 10;
 
 			for (i = 0; i < b->backends->len; i++) {
@@ -425,11 +1179,13 @@ static liHandlerResult balancer_act_select(liVRequest *vr, gboolean backlog_prov
 		return LI_HANDLER_GO_ON;
 	}
 
-	_balancer_context_select_backend(b, context, be_ndx);
-	be = &g_array_index(b->backends, backend, be_ndx);
+	_balancer_context_select_backend(b, vr, context, be_ndx);
 
 	g_mutex_unlock(b->lock);
 
+selected:
+	be = &g_array_index(b->backends, backend, be_ndx);
+
 	if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean){
 		VR_DEBUG(vr, "balancer select: %i", be_ndx);
 	}
@@ -454,18 +1210,24 @@ static liHandlerResult balancer_act_fallback(liVRequest *vr, gboolean backlog_pr
 
 	g_mutex_lock(b->lock);
 
-	_balancer_context_select_backend(b, context, -1);
+	_balancer_context_select_backend(b, vr, context, -1);
 
-	if (error == LI_BACKEND_OVERLOAD || be->load > 0) {
+	if (error == LI_BACKEND_OVERLOAD || g_atomic_int_get(&be->load) > 0) {
 		/* long timeout for overload - we will enable the backend anyway if another request finishes */
 		if (be->state == BE_ALIVE) be->wake = li_cur_ts(vr->wrk) + 5.0;
 
-		if (be->state != BE_DOWN) be->state = BE_OVERLOADED;
+		if (be->state != BE_DOWN) _backend_set_state(b, be, BE_OVERLOADED);
+	} else if (NULL != be->check) {
+		/* the health check decides when to retry */
+		be->wake = BALANCER_WAKE_NEVER;
+		g_atomic_int_set(&be->check->passive_down, 1);
+
+		_backend_set_state(b, be, BE_DOWN);
 	} else {
 		/* short timeout for dead backends - lets retry soon */
 		be->wake = li_cur_ts(vr->wrk) + 1.0;
 
-		be->state = BE_DOWN;
+		_backend_set_state(b, be, BE_DOWN);
 	}
 
 
@@ -522,6 +1284,30 @@ static liAction* balancer_create(liServer *srv, liWorker *wrk, liPlugin* p, liVa
 	return li_action_new_balancer(balancer_act_select, balancer_act_fallback, balancer_act_finished, balancer_act_free, b, TRUE);
 }
 
+static liAction* balancer_hash_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	balancer *b;
+	UNUSED(userdata);
+
+	if (LI_VALUE_LIST != li_value_type(val) || !li_value_list_has_len(val, 2) || LI_VALUE_STRING != li_value_list_type_at(val, 0)) {
+		ERROR(srv, "%s", "balance.hash expects a key pattern and the actions as parameters");
+		return NULL;
+	}
+
+	b = balancer_new(wrk, p, BM_HASH);
+	if (NULL == (b->hash_pattern = li_pattern_new(srv, li_value_list_at(val, 0)->data.string->str))) {
+		ERROR(srv, "%s", "balance.hash: failed to parse key pattern");
+		balancer_free(srv, b);
+		return NULL;
+	}
+	if (!balancer_fill_backends(b, srv, li_value_list_at(val, 1))) {
+		balancer_free(srv, b);
+		return NULL;
+	}
+	balancer_build_ring(b);
+
+	return li_action_new_balancer(balancer_act_select, balancer_act_fallback, balancer_act_finished, balancer_act_free, b, TRUE);
+}
+
 static const liPluginOption options[] = {
 	{ "balance.debug", LI_VALUE_BOOLEAN, FALSE, NULL },
 
@@ -531,6 +1317,9 @@ static const liPluginOption options[] = {
 static const liPluginAction actions[] = {
 	{ "balance.rr", balancer_create, GINT_TO_POINTER(BM_ROUNDROBIN) },
 	{ "balance.sqf", balancer_create, GINT_TO_POINTER(BM_SQF) },
+	{ "balance.p2c", balancer_create, GINT_TO_POINTER(BM_P2C) },
+	{ "balance.ewma", balancer_create, GINT_TO_POINTER(BM_EWMA) },
+	{ "balance.hash", balancer_hash_create, NULL },
 	{ NULL, NULL, NULL }
 };
 
@@ -1,8 +1,8 @@
 /*
  * mod_cache_disk_etag - cache generated content on disk if etag header is set
  *
- * Todo:
- *  - use stat cache
+ * With a size or file limit the cache files of a directory are tracked in an in-memory index (filled by a
+ * background scan at startup); the least recently used files are removed in a tasklet if a limit is exceeded.
  *
  * Author:
  *     Copyright (c) 2009 Stefan Bühler
@@ -17,25 +17,301 @@
 LI_API gboolean mod_cache_disk_etag_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_cache_disk_etag_free(liModules *mods, liModule *mod);
 
+typedef struct cache_etag_entry cache_etag_entry;
+struct cache_etag_entry {
+	GString *filename;
+	goffset size;
+	time_t last_access;
+	GList lru_link; /* head: most recently used */
+};
+
+/* one per cache directory with limits, shared by all actions using the directory */
+typedef struct cache_etag_index cache_etag_index;
+struct cache_etag_index {
+	gint refcount;
+	GString *path;
+	goffset max_size; /* 0: unlimited */
+	guint max_files; /* 0: unlimited */
+
+	GMutex *lock;
+	GHashTable *entries; /* GString* filename (entry->filename) -> cache_etag_entry* */
+	GQueue lru;
+	goffset size;
+
+	GThread *scan_thread;
+	gint scan_stop; /* atomic access */
+};
+
+/* plugin data; actions are also created at runtime in the workers (lua.handler) */
+typedef struct cache_etag_indexes cache_etag_indexes;
+struct cache_etag_indexes {
+	GMutex *lock;
+	GHashTable *table; /* GString* path (idx->path) -> cache_etag_index* */
+};
+
 typedef struct cache_etag_context cache_etag_context;
 struct cache_etag_context {
 	GString *path;
+	cache_etag_index *index; /* NULL if there are no limits */
 };
 
 typedef struct cache_etag_file cache_etag_file;
 struct cache_etag_file {
 	GString *filename, *tmpfilename;
 	int fd;
+	goffset written;
+	liWorker *wrk;
+	cache_etag_index *index;
 /* cache hit */
 	int hit_fd;
 	goffset hit_length;
 };
 
-static cache_etag_file* cache_etag_file_create(GString *filename) {
+/* cache.disk.etag option names */
+static const GString
+	con_path = { CONST_STR_LEN("path"), 0 },
+	con_max_size = { CONST_STR_LEN("max-size"), 0 },
+	con_max_files = { CONST_STR_LEN("max-files"), 0 }
+;
+
+/**********************************************************************************/
+
+static void cache_etag_entry_free(cache_etag_entry *e) {
+	if (NULL != e->filename) g_string_free(e->filename, TRUE);
+	g_slice_free(cache_etag_entry, e);
+}
+
+/* needs idx->lock */
+static void cache_etag_index_remove(cache_etag_index *idx, cache_etag_entry *e) {
+	g_queue_unlink(&idx->lru, &e->lru_link);
+	g_hash_table_remove(idx->entries, e->filename);
+	idx->size -= e->size;
+}
+
+/* needs idx->lock; moves the filenames of evicted entries to victims */
+static void cache_etag_index_evict(cache_etag_index *idx, GPtrArray *victims) {
+	while (NULL != idx->lru.tail
+			&& ((idx->max_size > 0 && idx->size > idx->max_size) || (idx->max_files > 0 && idx->lru.length > idx->max_files))) {
+		cache_etag_entry *e = idx->lru.tail->data;
+		cache_etag_index_remove(idx, e);
+		g_ptr_array_add(victims, e->filename);
+		e->filename = NULL;
+		cache_etag_entry_free(e);
+	}
+}
+
+static void cache_etag_unlink_run(gpointer data) {
+	GPtrArray *victims = data;
+	guint i;
+
+	for (i = 0; i < victims->len; i++) {
+		GString *filename = g_ptr_array_index(victims, i);
+		unlink(filename->str);
+	}
+}
+
+static void cache_etag_unlink_finished(gpointer data) {
+	GPtrArray *victims = data;
+	guint i;
+
+	for (i = 0; i < victims->len; i++) {
+		g_string_free(g_ptr_array_index(victims, i), TRUE);
+	}
+	g_ptr_array_free(victims, TRUE);
+}
+
+/* marks filename as most recently used and evicts other files if the limits are exceeded
+ * a hit only refreshes an existing entry: if the entry is missing the file was evicted (or the scan
+ * didn't get to it yet, and will add it) */
+static void cache_etag_index_update(liWorker *wrk, cache_etag_index *idx, GString *filename, goffset size, gboolean hit) {
+	cache_etag_entry *e;
+	GPtrArray *victims = g_ptr_array_new();
+
+	g_mutex_lock(idx->lock);
+	if (NULL != (e = g_hash_table_lookup(idx->entries, filename))) {
+		idx->size += size - e->size;
+		e->size = size;
+		g_queue_unlink(&idx->lru, &e->lru_link);
+	} else if (hit) {
+		g_mutex_unlock(idx->lock);
+		g_ptr_array_free(victims, TRUE);
+		return;
+	} else {
+		e = g_slice_new0(cache_etag_entry);
+		e->filename = g_string_new_len(GSTR_LEN(filename));
+		e->size = size;
+		e->lru_link.data = e;
+		g_hash_table_insert(idx->entries, e->filename, e);
+		idx->size += size;
+	}
+	e->last_access = (time_t) li_cur_ts(wrk);
+	g_queue_push_head_link(&idx->lru, &e->lru_link);
+	cache_etag_index_evict(idx, victims);
+	g_mutex_unlock(idx->lock);
+
+	if (0 == victims->len) {
+		g_ptr_array_free(victims, TRUE);
+		return;
+	}
+
+	wrk->stats.disk_cache_evictions += victims->len;
+	/* unlink() can block; don't do it in the event loop */
+	li_tasklet_push(wrk->tasklets, cache_etag_unlink_run, cache_etag_unlink_finished, victims);
+}
+
+/* the file is gone (evicted or removed externally) */
+static void cache_etag_index_drop(cache_etag_index *idx, GString *filename) {
+	cache_etag_entry *e;
+
+	g_mutex_lock(idx->lock);
+	if (NULL != (e = g_hash_table_lookup(idx->entries, filename))) {
+		cache_etag_index_remove(idx, e);
+		cache_etag_entry_free(e);
+	}
+	g_mutex_unlock(idx->lock);
+}
+
+/* "<cache file>-XXXXXX" from mkstemp() in cache_etag_file_start(), still being written; cache files end in
+ * "-<base64 etag>", which has no '-' and a length divisible by 4 (and a '/' in it starts a new name) */
+static gboolean cache_etag_is_tmpfile(const gchar *name) {
+	const gchar *suffix = strrchr(name, '-');
+	return NULL != suffix && 7 == strlen(suffix);
+}
+
+/* dir is modified while scanning, but restored on return */
+static void cache_etag_scan_dir(cache_etag_index *idx, GString *dir, GPtrArray *found) {
+	GDir *d;
+	const gchar *name;
+	gsize dirlen = dir->len;
+	struct stat st;
+
+	if (NULL == (d = g_dir_open(dir->str, 0, NULL))) return;
+
+	while (!g_atomic_int_get(&idx->scan_stop) && NULL != (name = g_dir_read_name(d))) {
+		g_string_truncate(dir, dirlen);
+		li_g_string_append_len(dir, CONST_STR_LEN("/"));
+		g_string_append(dir, name);
+
+		if (-1 == lstat(dir->str, &st)) continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			cache_etag_scan_dir(idx, dir, found);
+		} else if (S_ISREG(st.st_mode) && !cache_etag_is_tmpfile(name)) {
+			/* temporary files are added by cache_etag_index_update() once they are complete */
+			cache_etag_entry *e = g_slice_new0(cache_etag_entry);
+			e->filename = g_string_new_len(GSTR_LEN(dir));
+			e->size = st.st_size;
+			e->last_access = MAX(st.st_atime, st.st_mtime); /* atime might not be updated (noatime) */
+			e->lru_link.data = e;
+			g_ptr_array_add(found, e);
+		}
+	}
+
+	g_string_truncate(dir, dirlen);
+	g_dir_close(d);
+}
+
+static gint cache_etag_entry_cmp_recent(gconstpointer a, gconstpointer b) {
+	const cache_etag_entry *ea = *(cache_etag_entry* const*) a, *eb = *(cache_etag_entry* const*) b;
+	return (ea->last_access > eb->last_access) ? -1 : (ea->last_access < eb->last_access);
+}
+
+/* rebuilds the index from the files on disk; entries added by requests meanwhile are newer and stay in front */
+static gpointer cache_etag_scan_thread(gpointer data) {
+	cache_etag_index *idx = data;
+	GString *dir = g_string_new_len(GSTR_LEN(idx->path));
+	GPtrArray *found = g_ptr_array_new(), *victims = g_ptr_array_new();
+	guint i;
+
+	cache_etag_scan_dir(idx, dir, found);
+	g_string_free(dir, TRUE);
+
+	g_ptr_array_sort(found, cache_etag_entry_cmp_recent);
+
+	g_mutex_lock(idx->lock);
+	for (i = 0; i < found->len; i++) {
+		cache_etag_entry *e = g_ptr_array_index(found, i);
+		if (NULL != g_hash_table_lookup(idx->entries, e->filename)) {
+			cache_etag_entry_free(e);
+			continue;
+		}
+		g_hash_table_insert(idx->entries, e->filename, e);
+		g_queue_push_tail_link(&idx->lru, &e->lru_link);
+		idx->size += e->size;
+	}
+	cache_etag_index_evict(idx, victims);
+	g_mutex_unlock(idx->lock);
+	g_ptr_array_free(found, TRUE);
+
+	cache_etag_unlink_run(victims);
+	cache_etag_unlink_finished(victims);
+
+	return NULL;
+}
+
+static void cache_etag_index_start_scan(liServer *srv, cache_etag_index *idx) {
+	GError *err = NULL;
+
+	if (NULL != idx->scan_thread) return;
+
+	if (NULL == (idx->scan_thread = g_thread_create(cache_etag_scan_thread, idx, TRUE, &err))) {
+		ERROR(srv, "couldn't start scan of cache directory '%s': %s", idx->path->str, err->message);
+		g_error_free(err);
+	}
+}
+
+static cache_etag_index* cache_etag_index_new(GString *path, goffset max_size, guint max_files) {
+	cache_etag_index *idx = g_slice_new0(cache_etag_index);
+
+	idx->refcount = 1;
+	idx->path = g_string_new_len(GSTR_LEN(path));
+	idx->max_size = max_size;
+	idx->max_files = max_files;
+	idx->lock = g_mutex_new();
+	idx->entries = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&idx->lru);
+
+	return idx;
+}
+
+static void cache_etag_index_acquire(cache_etag_index *idx) {
+	LI_FORCE_ASSERT(g_atomic_int_get(&idx->refcount) > 0);
+	g_atomic_int_inc(&idx->refcount);
+}
+
+static void cache_etag_index_release(cache_etag_index *idx) {
+	if (NULL == idx) return;
+	LI_FORCE_ASSERT(g_atomic_int_get(&idx->refcount) > 0);
+	if (!g_atomic_int_dec_and_test(&idx->refcount)) return;
+
+	if (NULL != idx->scan_thread) {
+		g_atomic_int_set(&idx->scan_stop, 1);
+		g_thread_join(idx->scan_thread);
+	}
+
+	while (NULL != idx->lru.tail) {
+		cache_etag_entry *e = idx->lru.tail->data;
+		cache_etag_index_remove(idx, e);
+		cache_etag_entry_free(e);
+	}
+	g_hash_table_destroy(idx->entries);
+	g_mutex_free(idx->lock);
+	g_string_free(idx->path, TRUE);
+	g_slice_free(cache_etag_index, idx);
+}
+
+/**********************************************************************************/
+
+static cache_etag_file* cache_etag_file_create(liVRequest *vr, cache_etag_context *ctx, GString *filename) {
 	cache_etag_file *cfile = g_slice_new0(cache_etag_file);
 	cfile->filename = filename;
 	cfile->fd = -1;
 	cfile->hit_fd = -1;
+	cfile->wrk = vr->wrk;
+	if (NULL != ctx->index) {
+		cache_etag_index_acquire(ctx->index);
+		cfile->index = ctx->index;
+	}
 	return cfile;
 }
 
@@ -98,6 +374,7 @@ static void cache_etag_file_free(cache_etag_file *cfile) {
 		g_string_free(cfile->tmpfilename, TRUE);
 		cfile->tmpfilename = NULL;
 	}
+	cache_etag_index_release(cfile->index);
 	g_slice_free(cache_etag_file, cfile);
 }
 
@@ -107,6 +384,8 @@ static void cache_etag_file_finish(liVRequest *vr, cache_etag_file *cfile) {
 	if (-1 == rename(cfile->tmpfilename->str, cfile->filename->str)) {
 		VR_ERROR(vr, "Couldn't move temporary cache file '%s': '%s'", cfile->tmpfilename->str, g_strerror(errno));
 		unlink(cfile->tmpfilename->str);
+	} else if (NULL != cfile->index) {
+		cache_etag_index_update(cfile->wrk, cfile->index, cfile->filename, cfile->written, FALSE);
 	}
 	cache_etag_file_free(cfile);
 }
@@ -176,6 +455,7 @@ static liHandlerResult cache_etag_filter_miss(liVRequest *vr, liFilter *f) {
 				goto forward;
 			}
 		} else {
+			cfile->written += res;
 			if (!f->out->is_closed) {
 				li_chunkqueue_steal_len(f->out, f->in, res);
 			} else {
@@ -253,7 +533,7 @@ static liHandlerResult cache_etag_handle(liVRequest *vr, gpointer param, gpointe
 		}
 		etag = (liHttpHeader*) etag_entry->data;
 
-		cfile = cache_etag_file_create(createFileName(vr, ctx->path, etag));
+		cfile = cache_etag_file_create(vr, ctx, createFileName(vr, ctx->path, etag));
 		*context = cfile;
 	}
 
@@ -269,6 +549,16 @@ static liHandlerResult cache_etag_handle(liVRequest *vr, gpointer param, gpointe
 			return LI_HANDLER_GO_ON; /* no caching */
 		}
 		cfile->hit_fd = fd;
+		vr->wrk->stats.disk_cache_hits++;
+		if (NULL != ctx->index) {
+			struct stat fd_st;
+			/* the stat cache may be older than an eviction; the open fd still works, but don't track a deleted file */
+			if (-1 == fstat(fd, &fd_st) || 0 == fd_st.st_nlink) {
+				cache_etag_index_drop(ctx->index, cfile->filename);
+			} else {
+				cache_etag_index_update(vr->wrk, ctx->index, cfile->filename, st.st_size, TRUE);
+			}
+		}
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "cache hit for '%s'", vr->request.uri.path->str);
 		}
@@ -288,6 +578,8 @@ static liHandlerResult cache_etag_handle(liVRequest *vr, gpointer param, gpointe
 		return LI_HANDLER_GO_ON;
 	}
 
+	vr->wrk->stats.disk_cache_misses++;
+	if (NULL != ctx->index) cache_etag_index_drop(ctx->index, cfile->filename);
 	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 		VR_DEBUG(vr, "cache miss for '%s'", vr->request.uri.path->str);
 	}
@@ -308,23 +600,120 @@ static void cache_etag_free(liServer *srv, gpointer param) {
 	cache_etag_context *ctx = (cache_etag_context*) param;
 	UNUSED(srv);
 
+	cache_etag_index_release(ctx->index);
 	g_string_free(ctx->path, TRUE);
 	g_slice_free(cache_etag_context, ctx);
 }
 
+static gboolean cache_etag_parse_options(liServer *srv, liValue *val, liValue **path, goffset *max_size, guint *max_files) {
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "cache.disk.etag expects a string or a key-value list as parameter");
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *entryKeyStr;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "cache.disk.etag doesn't take default keys");
+			return FALSE;
+		}
+		entryKeyStr = entryKey->data.string; /* keys are either NONE or STRING */
+
+		if (g_string_equal(entryKeyStr, &con_path)) {
+			if (LI_VALUE_STRING != li_value_type(entryValue)) {
+				ERROR(srv, "cache.disk.etag option '%s' expects string as parameter", entryKeyStr->str);
+				return FALSE;
+			}
+			if (NULL != *path) {
+				ERROR(srv, "duplicate cache.disk.etag option '%s'", entryKeyStr->str);
+				return FALSE;
+			}
+			*path = entryValue;
+		} else if (g_string_equal(entryKeyStr, &con_max_size)) {
+			if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number <= 0) {
+				ERROR(srv, "cache.disk.etag option '%s' expects positive integer as parameter", entryKeyStr->str);
+				return FALSE;
+			}
+			if (0 != *max_size) {
+				ERROR(srv, "duplicate cache.disk.etag option '%s'", entryKeyStr->str);
+				return FALSE;
+			}
+			*max_size = entryValue->data.number;
+		} else if (g_string_equal(entryKeyStr, &con_max_files)) {
+			if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number <= 0 || entryValue->data.number > G_MAXUINT) {
+				ERROR(srv, "cache.disk.etag option '%s' expects positive integer as parameter", entryKeyStr->str);
+				return FALSE;
+			}
+			if (0 != *max_files) {
+				ERROR(srv, "duplicate cache.disk.etag option '%s'", entryKeyStr->str);
+				return FALSE;
+			}
+			*max_files = entryValue->data.number;
+		} else {
+			ERROR(srv, "unknown option for cache.disk.etag '%s'", entryKeyStr->str);
+			return FALSE;
+		}
+	LI_VALUE_END_FOREACH()
+
+	if (NULL == *path) {
+		ERROR(srv, "%s", "cache.disk.etag: missing option 'path'");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static liAction* cache_etag_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	cache_etag_indexes *indexes = p->data;
 	cache_etag_context *ctx;
-	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
+	liValue *path = NULL;
+	goffset max_size = 0;
+	guint max_files = 0;
+	UNUSED(wrk); UNUSED(userdata);
 
 	val = li_value_get_single_argument(val);
 
-	if (LI_VALUE_STRING != li_value_type(val)) {
-		ERROR(srv, "%s", "cache.disk.etag expects a string as parameter");
-		return FALSE;
+	if (LI_VALUE_STRING == li_value_type(val)) {
+		path = val;
+	} else if (!cache_etag_parse_options(srv, val, &path, &max_size, &max_files)) {
+		return NULL;
 	}
 
 	ctx = g_slice_new0(cache_etag_context);
-	ctx->path = li_value_extract_string(val);
+	ctx->path = li_value_extract_string(path);
+
+	if (0 != max_size || 0 != max_files) {
+		gboolean init = (LI_SERVER_INIT == g_atomic_int_get(&srv->state));
+		cache_etag_index *idx;
+
+		g_mutex_lock(indexes->lock);
+		idx = g_hash_table_lookup(indexes->table, ctx->path);
+
+		if (NULL != idx && (idx->max_size != max_size || idx->max_files != max_files)) {
+			if (init) {
+				g_mutex_unlock(indexes->lock);
+				ERROR(srv, "cache.disk.etag: different limits for cache directory '%s'", ctx->path->str);
+				cache_etag_free(srv, ctx);
+				return NULL;
+			}
+			/* config loaded at runtime (lua.handler reload) with new limits: new actions get a new index,
+			 * the old one stays with the old actions until they are freed */
+			idx = NULL;
+		}
+
+		if (NULL == idx) {
+			idx = cache_etag_index_new(ctx->path, max_size, max_files);
+			g_hash_table_replace(indexes->table, idx->path, idx); /* reference for the table */
+			if (!init) cache_etag_index_start_scan(srv, idx);
+		}
+
+		cache_etag_index_acquire(idx);
+		ctx->index = idx;
+		g_mutex_unlock(indexes->lock);
+	}
 
 	return li_action_new_function(cache_etag_handle, cache_etag_cleanup, cache_etag_free, ctx);
 }
@@ -342,12 +731,45 @@ static const liPluginSetup setups[] = {
 	{ NULL, NULL, NULL }
 };
 
+static void plugin_prepare(liServer *srv, liPlugin *p) {
+	cache_etag_indexes *indexes = p->data;
+	GHashTableIter iter;
+	gpointer idx;
+
+	g_mutex_lock(indexes->lock);
+	g_hash_table_iter_init(&iter, indexes->table);
+	while (g_hash_table_iter_next(&iter, NULL, &idx)) {
+		cache_etag_index_start_scan(srv, idx);
+	}
+	g_mutex_unlock(indexes->lock);
+}
+
+static void plugin_free(liServer *srv, liPlugin *p) {
+	cache_etag_indexes *indexes = p->data;
+	UNUSED(srv);
+
+	g_hash_table_destroy(indexes->table);
+	g_mutex_free(indexes->lock);
+	g_slice_free(cache_etag_indexes, indexes);
+	p->data = NULL;
+}
+
 static void plugin_init(liServer *srv, liPlugin *p, gpointer userdata) {
+	cache_etag_indexes *indexes;
 	UNUSED(srv); UNUSED(userdata);
 
+	indexes = g_slice_new0(cache_etag_indexes);
+	indexes->lock = g_mutex_new();
+	indexes->table = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal,
+		NULL, (GDestroyNotify) cache_etag_index_release);
+	p->data = indexes;
+
 	p->options = options;
 	p->actions = actions;
 	p->setups = setups;
+
+	p->free = plugin_free;
+	p->handle_prepare = plugin_prepare;
 }
 
 gboolean mod_cache_disk_etag_init(liModules *mods, liModule *mod) {
@@ -0,0 +1,1362 @@
+/*
+ * mod_cache_http - shared cache for backend responses
+ *
+ * cache.http.lookup (before the backend) serves fresh responses from the cache. On a miss the request becomes the
+ * "fill" for its key: cache.http.store (after the backend) stores its response, and concurrent requests for the
+ * same key wait for that response instead of sending their own backend requests (request collapsing).
+ *
+ * Bodies up to memory-max-object are kept in memory, bigger ones in unlinked temporary files in disk-path (if
+ * configured); both tiers are limited by size and drop the least recently used responses first.
+ * Freshness is taken from Cache-Control (s-maxage, max-age) or Expires; responses without explicit freshness,
+ * with Set-Cookie or "Vary: *" aren't stored. The Vary header names are remembered per base key (the "key"
+ * pattern), and the values of these request headers are appended to the base key.
+ *
+ * Expired responses are kept until they are replaced or evicted: during the stale-while-revalidate window they are
+ * still served while one background subrequest (running the main action again) refreshes them, and during the
+ * stale-if-error window they replace 5xx responses of the backend, or are served if the backend action wrapped by
+ * cache.http.backend fails (e.g. all backends of a balancer are down).
+ */
+
+#include <lighttpd/base.h>
+#include <lighttpd/pattern.h>
+#include <lighttpd/plugin_core.h>
+
+#include <fcntl.h>
+
+LI_API gboolean mod_cache_http_init(liModules *mods, liModule *mod);
+LI_API gboolean mod_cache_http_free(liModules *mods, liModule *mod);
+
+typedef struct http_cache http_cache;
+typedef struct http_cache_vary http_cache_vary;
+typedef struct http_cache_object http_cache_object;
+typedef struct http_cache_fill http_cache_fill;
+
+/* Vary header names of the last response stored for a base key */
+struct http_cache_vary {
+	GString *base;
+	GString *headers; /* lowercase names, each followed by ',' */
+	guint objects; /* cached responses using it */
+};
+
+struct http_cache_object {
+	gint refcount;
+	GString *key;
+
+	gint status;
+	GString *headers; /* "<name>: <value>\n" for each stored header */
+	li_tstamp date; /* when the response was generated (now - Age when it was stored) */
+	li_tstamp expires;
+	li_tstamp stale_revalidate, stale_error; /* end of the stale-while-revalidate / stale-if-error windows */
+
+	goffset size;
+	liBuffer *body; /* memory tier */
+	liChunkFile *file; /* disk tier: unlinked temporary file */
+
+	/* protected by the cache lock */
+	http_cache_vary *vary;
+	GQueue *lru; /* NULL if not in the cache */
+	GList lru_link;
+};
+
+typedef enum {
+	HTTP_CACHE_FILL_STORED,
+	HTTP_CACHE_FILL_PASS, /* nothing was stored: waiters send their own backend requests */
+	HTTP_CACHE_FILL_STALE /* backend failed, stale response was served: waiters get it too */
+} http_cache_fill_result;
+
+/* backend request for a key which isn't cached (or a refresh); concurrent requests for the key wait for it */
+struct http_cache_fill {
+	guint refcount; /* protected by the cache lock */
+	GString *key, *base;
+	http_cache_object *stale; /* expired response within its stale-if-error window, or NULL */
+	GPtrArray *waiters; /* liJobRef* */
+	gboolean done;
+	http_cache_fill_result result;
+};
+
+struct http_cache {
+	GMutex *lock;
+	GHashTable *objects; /* GString* key (object->key) -> http_cache_object*, holding a reference */
+	GHashTable *vary; /* GString* base key (vary->base) -> http_cache_vary* */
+	GHashTable *fills; /* GString* key (fill->key) -> http_cache_fill*, only while not done */
+
+	GQueue mem_lru, disk_lru; /* head: most recently used */
+	goffset mem_limit, mem_used, mem_max_object;
+	GString *disk_path; /* NULL: memory only */
+	goffset disk_limit, disk_used;
+};
+
+typedef struct http_cache_ctx http_cache_ctx;
+struct http_cache_ctx {
+	http_cache *cache;
+	liPlugin *p;
+	liPattern *key; /* cache.http.lookup */
+	gint64 stale_while_revalidate, stale_if_error; /* cache.http.store: defaults in seconds */
+	liAction *backend; /* cache.http.backend */
+};
+
+/* state of the filter collecting the response body */
+typedef struct http_cache_store http_cache_store;
+struct http_cache_store {
+	http_cache *cache;
+	http_cache_fill *fill;
+	http_cache_object *obj;
+	GString *vary;
+	liBuffer *buf; /* body while it fits into memory */
+	int fd; /* body on disk */
+};
+
+/* cache.http option names */
+static const GString
+	hon_key = { CONST_STR_LEN("key"), 0 },
+	hon_memory_size = { CONST_STR_LEN("memory-size"), 0 },
+	hon_memory_max_object = { CONST_STR_LEN("memory-max-object"), 0 },
+	hon_disk_path = { CONST_STR_LEN("disk-path"), 0 },
+	hon_disk_size = { CONST_STR_LEN("disk-size"), 0 },
+	hon_stale_while_revalidate = { CONST_STR_LEN("stale-while-revalidate"), 0 },
+	hon_stale_if_error = { CONST_STR_LEN("stale-if-error"), 0 }
+;
+
+/* connection specific or regenerated for every response */
+static const GString http_cache_skip_headers[] = {
+	{ CONST_STR_LEN("Age"), 0 },
+	{ CONST_STR_LEN("Connection"), 0 },
+	{ CONST_STR_LEN("Content-Length"), 0 },
+	{ CONST_STR_LEN("Date"), 0 },
+	{ CONST_STR_LEN("Keep-Alive"), 0 },
+	{ CONST_STR_LEN("Proxy-Authenticate"), 0 },
+	{ CONST_STR_LEN("Proxy-Connection"), 0 },
+	{ CONST_STR_LEN("TE"), 0 },
+	{ CONST_STR_LEN("Trailer"), 0 },
+	{ CONST_STR_LEN("Transfer-Encoding"), 0 },
+	{ CONST_STR_LEN("Upgrade"), 0 },
+	{ NULL, 0, 0 }
+};
+
+/**********************************************************************************/
+
+static void http_cache_object_release(http_cache_object *obj) {
+	if (NULL == obj) return;
+	LI_FORCE_ASSERT(g_atomic_int_get(&obj->refcount) > 0);
+	if (!g_atomic_int_dec_and_test(&obj->refcount)) return;
+
+	g_string_free(obj->key, TRUE);
+	if (NULL != obj->headers) g_string_free(obj->headers, TRUE);
+	if (NULL != obj->body) li_buffer_release(obj->body);
+	li_chunkfile_release(obj->file);
+	g_slice_free(http_cache_object, obj);
+}
+
+/* memory tier: everything; disk tier: only the file */
+static goffset http_cache_object_charge(http_cache_object *obj) {
+	return NULL != obj->file ? obj->size : obj->size + obj->key->len + obj->headers->len;
+}
+
+/* needs cache->lock */
+static void http_cache_remove(http_cache *cache, http_cache_object *obj) {
+	g_queue_unlink(obj->lru, &obj->lru_link);
+	if (obj->lru == &cache->disk_lru) {
+		cache->disk_used -= http_cache_object_charge(obj);
+	} else {
+		cache->mem_used -= http_cache_object_charge(obj);
+	}
+	obj->lru = NULL;
+
+	if (0 == --obj->vary->objects) {
+		g_hash_table_remove(cache->vary, obj->vary->base);
+		g_string_free(obj->vary->base, TRUE);
+		g_string_free(obj->vary->headers, TRUE);
+		g_slice_free(http_cache_vary, obj->vary);
+	}
+	obj->vary = NULL;
+
+	g_hash_table_remove(cache->objects, obj->key);
+	http_cache_object_release(obj);
+}
+
+/* needs cache->lock */
+static void http_cache_evict(http_cache *cache) {
+	while (cache->mem_used > cache->mem_limit && NULL != cache->mem_lru.tail) {
+		http_cache_remove(cache, cache->mem_lru.tail->data);
+	}
+	while (cache->disk_used > cache->disk_limit && NULL != cache->disk_lru.tail) {
+		http_cache_remove(cache, cache->disk_lru.tail->data);
+	}
+}
+
+/* takes over the reference of obj */
+static void http_cache_insert(http_cache *cache, http_cache_object *obj, GString *base, GString *vary_headers) {
+	http_cache_object *old;
+	http_cache_vary *vary;
+
+	g_mutex_lock(cache->lock);
+
+	if (NULL != (old = g_hash_table_lookup(cache->objects, obj->key))) http_cache_remove(cache, old);
+
+	if (NULL == (vary = g_hash_table_lookup(cache->vary, base))) {
+		vary = g_slice_new0(http_cache_vary);
+		vary->base = g_string_new_len(GSTR_LEN(base));
+		vary->headers = g_string_new_len(GSTR_LEN(vary_headers));
+		g_hash_table_insert(cache->vary, vary->base, vary);
+	} else if (!g_string_equal(vary->headers, vary_headers)) {
+		/* responses stored with the old header names can't be found anymore; they get evicted eventually */
+		g_string_truncate(vary->headers, 0);
+		li_g_string_append_len(vary->headers, GSTR_LEN(vary_headers));
+	}
+	vary->objects++;
+	obj->vary = vary;
+
+	g_hash_table_insert(cache->objects, obj->key, obj);
+	obj->lru = (NULL != obj->file) ? &cache->disk_lru : &cache->mem_lru;
+	obj->lru_link.data = obj;
+	g_queue_push_head_link(obj->lru, &obj->lru_link);
+	if (NULL != obj->file) {
+		cache->disk_used += http_cache_object_charge(obj);
+	} else {
+		cache->mem_used += http_cache_object_charge(obj);
+	}
+
+	http_cache_evict(cache);
+
+	g_mutex_unlock(cache->lock);
+}
+
+static http_cache* http_cache_new(void) {
+	http_cache *cache = g_slice_new0(http_cache);
+
+	cache->lock = g_mutex_new();
+	cache->objects = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	cache->vary = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	cache->fills = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&cache->mem_lru);
+	g_queue_init(&cache->disk_lru);
+
+	cache->mem_limit = 64*1024*1024;
+	cache->mem_max_object = 1024*1024;
+	cache->disk_limit = 1024*1024*1024;
+
+	return cache;
+}
+
+static void http_cache_free(http_cache *cache) {
+	while (NULL != cache->mem_lru.tail) http_cache_remove(cache, cache->mem_lru.tail->data);
+	while (NULL != cache->disk_lru.tail) http_cache_remove(cache, cache->disk_lru.tail->data);
+	g_hash_table_destroy(cache->objects);
+	g_hash_table_destroy(cache->vary);
+	g_hash_table_destroy(cache->fills);
+	if (NULL != cache->disk_path) g_string_free(cache->disk_path, TRUE);
+	g_mutex_free(cache->lock);
+	g_slice_free(http_cache, cache);
+}
+
+/**********************************************************************************/
+
+/* needs cache->lock; returns a new fill (with a reference for the caller) for the key */
+static http_cache_fill* http_cache_fill_new(http_cache *cache, GString *key, GString *base, http_cache_object *old, li_tstamp now) {
+	http_cache_fill *fill = g_slice_new0(http_cache_fill);
+
+	fill->refcount = 1;
+	fill->key = g_string_new_len(GSTR_LEN(key));
+	fill->base = g_string_new_len(GSTR_LEN(base));
+	fill->waiters = g_ptr_array_new();
+	if (NULL != old && old->stale_error > now) {
+		g_atomic_int_inc(&old->refcount);
+		fill->stale = old;
+	}
+	g_hash_table_insert(cache->fills, fill->key, fill);
+
+	return fill;
+}
+
+/* wakes up the waiting requests (once) */
+static void http_cache_fill_done(http_cache *cache, http_cache_fill *fill, http_cache_fill_result result) {
+	guint i;
+
+	g_mutex_lock(cache->lock);
+	if (!fill->done) {
+		fill->done = TRUE;
+		fill->result = result;
+		g_hash_table_remove(cache->fills, fill->key);
+
+		for (i = 0; i < fill->waiters->len; i++) {
+			liJobRef *ref = g_ptr_array_index(fill->waiters, i);
+			li_job_async(ref);
+			li_job_ref_release(ref);
+		}
+		g_ptr_array_set_size(fill->waiters, 0);
+	}
+	g_mutex_unlock(cache->lock);
+}
+
+static void http_cache_fill_release(http_cache *cache, http_cache_fill *fill) {
+	gboolean last;
+
+	g_mutex_lock(cache->lock);
+	LI_FORCE_ASSERT(fill->refcount > 0);
+	last = (0 == --fill->refcount);
+	g_mutex_unlock(cache->lock);
+
+	if (!last) return;
+
+	LI_FORCE_ASSERT(fill->done);
+	http_cache_object_release(fill->stale);
+	g_ptr_array_free(fill->waiters, TRUE);
+	g_string_free(fill->key, TRUE);
+	g_string_free(fill->base, TRUE);
+	g_slice_free(http_cache_fill, fill);
+}
+
+/* for the request fetching the response */
+static void http_cache_fill_finish(http_cache *cache, http_cache_fill *fill, http_cache_fill_result result) {
+	http_cache_fill_done(cache, fill, result);
+	http_cache_fill_release(cache, fill);
+}
+
+/**********************************************************************************/
+
+static void http_cache_build_base(GString *dest, http_cache_ctx *ctx, liVRequest *vr) {
+	GMatchInfo *match_info = NULL;
+
+	if (vr->action_stack.regex_stack->len) {
+		GArray *rs = vr->action_stack.regex_stack;
+		match_info = g_array_index(rs, liActionRegexStackElement, rs->len - 1).match_info;
+	}
+
+	g_string_truncate(dest, 0);
+	li_pattern_eval(vr, dest, ctx->key, NULL, NULL, li_pattern_regex_cb, match_info);
+}
+
+/* base key, followed by the values of the request headers named in vary_headers */
+static void http_cache_build_key(GString *dest, liVRequest *vr, GString *base, GString *vary_headers) {
+	GString *tmp = vr->wrk->tmp_str;
+	const gchar *name, *end;
+
+	g_string_truncate(dest, 0);
+	li_g_string_append_len(dest, GSTR_LEN(base));
+
+	for (name = vary_headers->str; '\0' != *name; name = end + 1) {
+		end = strchr(name, ',');
+		li_http_header_get_all(tmp, vr->request.headers, name, end - name);
+		li_g_string_append_len(dest, CONST_STR_LEN("\n"));
+		li_g_string_append_len(dest, GSTR_LEN(tmp));
+	}
+}
+
+static gboolean http_cache_request_no_cache(liVRequest *vr) {
+	liHttpHeaderTokenizer t;
+	GString *token = vr->wrk->tmp_str;
+
+	li_http_header_tokenizer_start(&t, vr->request.headers, CONST_STR_LEN("Cache-Control"));
+	while (li_http_header_tokenizer_next(&t, token)) {
+		if (li_strncase_equal(token, CONST_STR_LEN("no-cache"))) return TRUE;
+	}
+
+	return li_http_header_is(vr->request.headers, CONST_STR_LEN("pragma"), CONST_STR_LEN("no-cache"));
+}
+
+static gboolean http_cache_parse_date(liHttpHeader *h, time_t *t) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (NULL == strptime(LI_HEADER_VALUE(h), "%a, %d %b %Y %H:%M:%S GMT", &tm)) return FALSE;
+	*t = timegm(&tm);
+
+	return TRUE;
+}
+
+/* returns FALSE if the response must not be stored; otherwise fills date, expires and the Vary header names.
+ * swr and sie (stale-while-revalidate / stale-if-error seconds) are overwritten if the response specifies them */
+static gboolean http_cache_response_cacheable(liVRequest *vr, li_tstamp now, li_tstamp *date, li_tstamp *expires, gint64 *swr, gint64 *sie, GString *vary) {
+	liHttpHeaderTokenizer t;
+	GString *token = vr->wrk->tmp_str;
+	liHttpHeader *h, *hexpires;
+	gint64 max_age = -1, s_maxage = -1;
+	time_t t_date, t_expires;
+
+	switch (vr->response.http_status) {
+	case 200: case 203: case 204: case 300: case 301: case 404: case 410:
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (NULL != li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Set-Cookie"))) return FALSE;
+
+	li_http_header_tokenizer_start(&t, vr->response.headers, CONST_STR_LEN("Cache-Control"));
+	while (li_http_header_tokenizer_next(&t, token)) {
+		if (li_strncase_equal(token, CONST_STR_LEN("no-store"))
+				|| li_strncase_equal(token, CONST_STR_LEN("no-cache"))
+				|| li_strncase_equal(token, CONST_STR_LEN("private"))) {
+			return FALSE;
+		} else if (0 == g_ascii_strncasecmp(token->str, CONST_STR_LEN("s-maxage="))) {
+			s_maxage = g_ascii_strtoll(token->str + sizeof("s-maxage=") - 1, NULL, 10);
+		} else if (0 == g_ascii_strncasecmp(token->str, CONST_STR_LEN("max-age="))) {
+			max_age = g_ascii_strtoll(token->str + sizeof("max-age=") - 1, NULL, 10);
+		} else if (0 == g_ascii_strncasecmp(token->str, CONST_STR_LEN("stale-while-revalidate="))) {
+			*swr = g_ascii_strtoll(token->str + sizeof("stale-while-revalidate=") - 1, NULL, 10);
+		} else if (0 == g_ascii_strncasecmp(token->str, CONST_STR_LEN("stale-if-error="))) {
+			*sie = g_ascii_strtoll(token->str + sizeof("stale-if-error=") - 1, NULL, 10);
+		}
+	}
+
+	*date = now;
+	if (NULL != (h = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Age")))) {
+		gint64 age = g_ascii_strtoll(LI_HEADER_VALUE(h), NULL, 10);
+		if (age > 0) *date = now - age;
+	}
+
+	if (s_maxage >= 0) {
+		*expires = *date + s_maxage;
+	} else if (max_age >= 0) {
+		*expires = *date + max_age;
+	} else if (NULL != (hexpires = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Expires")))) {
+		/* relative to the Date of the response, so the clocks don't need to be in sync */
+		if (!http_cache_parse_date(hexpires, &t_expires)) return FALSE;
+		h = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Date"));
+		if (NULL == h || !http_cache_parse_date(h, &t_date)) t_date = (time_t) now;
+		*expires = *date + (t_expires - t_date);
+	} else {
+		/* no heuristic freshness */
+		return FALSE;
+	}
+
+	if (*expires <= now) return FALSE;
+
+	g_string_truncate(vary, 0);
+	li_http_header_tokenizer_start(&t, vr->response.headers, CONST_STR_LEN("Vary"));
+	while (li_http_header_tokenizer_next(&t, token)) {
+		if (0 == token->len) continue;
+		if (li_strncase_equal(token, CONST_STR_LEN("*"))) return FALSE;
+		g_string_ascii_down(token);
+		li_g_string_append_len(vary, GSTR_LEN(token));
+		li_g_string_append_len(vary, CONST_STR_LEN(","));
+	}
+
+	return TRUE;
+}
+
+static GString* http_cache_serialize_headers(liVRequest *vr) {
+	GString *headers = g_string_sized_new(255);
+	GList *l;
+	guint i;
+
+	for (l = g_queue_peek_head_link(&vr->response.headers->entries); NULL != l; l = g_list_next(l)) {
+		liHttpHeader *h = (liHttpHeader*) l->data;
+
+		for (i = 0; NULL != http_cache_skip_headers[i].str; i++) {
+			if (li_http_header_key_is(h, GSTR_LEN(&http_cache_skip_headers[i]))) break;
+		}
+		if (NULL != http_cache_skip_headers[i].str) continue;
+		if (NULL != memchr(h->data->str, '\n', h->data->len)) continue;
+
+		/* h->data is "<name>: <value>" already */
+		li_g_string_append_len(headers, GSTR_LEN(h->data));
+		li_g_string_append_len(headers, CONST_STR_LEN("\n"));
+	}
+
+	return headers;
+}
+
+static void http_cache_serve_headers(liVRequest *vr, http_cache_object *obj, li_tstamp now) {
+	const gchar *s, *end, *eol, *colon;
+
+	vr->response.http_status = obj->status;
+	for (s = obj->headers->str, end = s + obj->headers->len; s < end; s = eol + 1) {
+		eol = memchr(s, '\n', end - s);
+		colon = memchr(s, ':', eol - s);
+		li_http_header_insert(vr->response.headers, s, colon - s, colon + 2, eol - (colon + 2));
+	}
+
+	g_string_truncate(vr->wrk->tmp_str, 0);
+	li_string_append_int(vr->wrk->tmp_str, (gint64) MAX(now - obj->date, 0));
+	li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Age"), GSTR_LEN(vr->wrk->tmp_str));
+}
+
+/* body is sent from the cached buffer/file, without copying */
+static void http_cache_append_body(liChunkQueue *cq, http_cache_object *obj) {
+	if (NULL != obj->body) {
+		li_buffer_acquire(obj->body);
+		li_chunkqueue_append_buffer2(cq, obj->body, 0, obj->size);
+	} else if (NULL != obj->file) {
+		li_chunkqueue_append_chunkfile(cq, obj->file, 0, obj->size);
+	}
+}
+
+static void http_cache_serve(liVRequest *vr, http_cache_object *obj, li_tstamp now) {
+	http_cache_serve_headers(vr, obj, now);
+
+	if (200 == obj->status && li_http_response_handle_cachable(vr)) {
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "%s", "cache.http.lookup: etag handling => 304 Not Modified");
+		}
+		vr->response.http_status = 304;
+		return;
+	}
+
+	http_cache_append_body(vr->direct_out, obj);
+}
+
+/**********************************************************************************/
+
+/* background subrequest refreshing a stale response; runs srv->mainaction with a copy of the request
+ * (without conditional, Range and credential headers) */
+typedef struct http_cache_refresh http_cache_refresh;
+struct http_cache_refresh {
+	liWorker *wrk;
+	liConInfo coninfo;
+	liVRequest *vr;
+	liJob finish_job; /* frees the subrequest outside of its callbacks */
+};
+
+/* coninfo.resp of the refresh: drops the response body */
+typedef struct http_cache_refresh_drain http_cache_refresh_drain;
+struct http_cache_refresh_drain {
+	liStream stream;
+	http_cache_refresh *refresh; /* NULL after the refresh was freed */
+};
+
+static void http_cache_refresh_done(http_cache_refresh *refresh) {
+	if (NULL == refresh) return;
+	li_job_later(&refresh->wrk->loop.jobqueue, &refresh->finish_job);
+}
+
+static void http_cache_refresh_finish_cb(liJob *job) {
+	http_cache_refresh *refresh = LI_CONTAINER_OF(job, http_cache_refresh, finish_job);
+	http_cache_refresh_drain *drain = LI_CONTAINER_OF(refresh->coninfo.resp, http_cache_refresh_drain, stream);
+
+	drain->refresh = NULL;
+
+	/* finishes the fill in vrclose if the response wasn't stored */
+	li_vrequest_free(refresh->vr);
+	refresh->vr = NULL;
+
+	li_stream_safe_reset_and_release(&refresh->coninfo.req);
+	li_stream_safe_reset_and_release(&refresh->coninfo.resp);
+
+	li_sockaddr_clear(&refresh->coninfo.remote_addr);
+	li_sockaddr_clear(&refresh->coninfo.local_addr);
+	g_string_free(refresh->coninfo.remote_addr_str, TRUE);
+	g_string_free(refresh->coninfo.local_addr_str, TRUE);
+
+	li_job_clear(&refresh->finish_job);
+	g_slice_free(http_cache_refresh, refresh);
+}
+
+static void http_cache_refresh_drain_cb(liStream *stream, liStreamEvent event) {
+	http_cache_refresh_drain *drain = LI_CONTAINER_OF(stream, http_cache_refresh_drain, stream);
+
+	switch (event) {
+	case LI_STREAM_NEW_DATA:
+		if (NULL == stream->source) return;
+		li_chunkqueue_skip_all(stream->source->out);
+		if (stream->source->out->is_closed) {
+			li_stream_disconnect(stream);
+			http_cache_refresh_done(drain->refresh);
+		}
+		break;
+	case LI_STREAM_DISCONNECTED_SOURCE:
+		http_cache_refresh_done(drain->refresh);
+		break;
+	case LI_STREAM_DESTROY:
+		g_slice_free(http_cache_refresh_drain, drain);
+		break;
+	default:
+		break;
+	}
+}
+
+static void http_cache_refresh_error(liVRequest *vr) {
+	http_cache_refresh_done(LI_CONTAINER_OF(vr->coninfo, http_cache_refresh, coninfo));
+}
+
+static liThrottleState* http_cache_refresh_throttle(liVRequest *vr) {
+	UNUSED(vr);
+	return NULL;
+}
+
+static void http_cache_refresh_upgrade(liVRequest *vr, liStream *backend_drain, liStream *backend_source) {
+	UNUSED(backend_drain); UNUSED(backend_source);
+	http_cache_refresh_error(vr);
+}
+
+static const liConCallbacks http_cache_refresh_callbacks = {
+	http_cache_refresh_error,
+	http_cache_refresh_throttle,
+	http_cache_refresh_throttle,
+	http_cache_refresh_upgrade
+};
+
+/* takes over the fill reference */
+static void http_cache_refresh_start(liVRequest *vr, liPlugin *p, http_cache_fill *fill) {
+	liWorker *wrk = vr->wrk;
+	http_cache_refresh *refresh = g_slice_new0(http_cache_refresh);
+	http_cache_refresh_drain *drain = g_slice_new0(http_cache_refresh_drain);
+	liVRequest *subvr;
+
+	li_stream_init(&drain->stream, &wrk->loop, http_cache_refresh_drain_cb);
+	drain->refresh = refresh;
+
+	refresh->wrk = wrk;
+	refresh->coninfo.callbacks = &http_cache_refresh_callbacks;
+	refresh->coninfo.remote_addr = li_sockaddr_dup(vr->coninfo->remote_addr);
+	refresh->coninfo.local_addr = li_sockaddr_dup(vr->coninfo->local_addr);
+	refresh->coninfo.remote_addr_str = g_string_new_len(GSTR_LEN(vr->coninfo->remote_addr_str));
+	refresh->coninfo.local_addr_str = g_string_new_len(GSTR_LEN(vr->coninfo->local_addr_str));
+	refresh->coninfo.is_ssl = vr->coninfo->is_ssl;
+	refresh->coninfo.keep_alive = FALSE;
+	refresh->coninfo.req = li_stream_null_new(&wrk->loop);
+	refresh->coninfo.resp = &drain->stream;
+
+	li_job_init(&refresh->finish_job, http_cache_refresh_finish_cb);
+
+	refresh->vr = subvr = li_vrequest_new(wrk, &refresh->coninfo);
+	li_vrequest_start(subvr);
+	li_request_copy(&subvr->request, &vr->request);
+	subvr->request.content_length = 0;
+
+	/* fetch the complete response */
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("If-None-Match"));
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("If-Modified-Since"));
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("Range"));
+
+	/* the response is shared: don't send the credentials of the client which happened to hit the stale response
+	 * (a response depending on them is either not cacheable, or keyed by them with Vary) */
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("Cookie"));
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("Authorization"));
+	li_http_header_remove(subvr->request.headers, CONST_STR_LEN("Proxy-Authorization"));
+
+	g_ptr_array_index(subvr->plugin_ctx, p->id) = fill;
+
+	li_action_enter(subvr, wrk->srv->mainaction);
+	li_vrequest_handle_request_headers(subvr);
+}
+
+/**********************************************************************************/
+
+static liHandlerResult http_cache_handle_lookup(liVRequest *vr, gpointer param, gpointer *context) {
+	http_cache_ctx *ctx = param;
+	http_cache *cache = ctx->cache;
+	http_cache_fill *fill = *context, *refresh = NULL;
+	http_cache_object *obj;
+	http_cache_vary *vary;
+	GString *base, *key;
+	gboolean debug = CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean;
+	gboolean stale_ok = FALSE;
+	li_tstamp now = li_cur_ts(vr->wrk);
+
+	if (&http_cache_refresh_callbacks == vr->coninfo->callbacks) {
+		/* background refresh: already has its fill */
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (NULL != fill) {
+		/* waiting for another request fetching the response */
+		gboolean done;
+		http_cache_fill_result result;
+
+		g_mutex_lock(cache->lock);
+		done = fill->done;
+		result = fill->result;
+		g_mutex_unlock(cache->lock);
+
+		if (!done) return LI_HANDLER_WAIT_FOR_EVENT;
+
+		*context = NULL;
+		http_cache_fill_release(cache, fill);
+
+		if (HTTP_CACHE_FILL_PASS == result) {
+			if (debug) {
+				VR_DEBUG(vr, "%s", "cache.http.lookup: response wasn't stored, passing request to backend");
+			}
+			return LI_HANDLER_GO_ON;
+		}
+		/* look again */
+		stale_ok = (HTTP_CACHE_FILL_STALE == result);
+	}
+
+	if (li_vrequest_is_handled(vr)) {
+		if (debug) {
+			VR_DEBUG(vr, "%s", "cache.http.lookup: request already handled");
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (NULL != (fill = g_ptr_array_index(vr->plugin_ctx, ctx->p->id))) {
+		/* looked up twice; don't let the request wait for itself */
+		g_ptr_array_index(vr->plugin_ctx, ctx->p->id) = NULL;
+		http_cache_fill_finish(cache, fill, HTTP_CACHE_FILL_PASS);
+	}
+
+	if (LI_HTTP_METHOD_GET != vr->request.http_method && LI_HTTP_METHOD_HEAD != vr->request.http_method) return LI_HANDLER_GO_ON;
+	if (NULL != li_http_header_lookup(vr->request.headers, CONST_STR_LEN("Authorization"))) return LI_HANDLER_GO_ON;
+
+	base = g_string_sized_new(127);
+	key = g_string_sized_new(127);
+	http_cache_build_base(base, ctx, vr);
+
+	g_mutex_lock(cache->lock);
+
+	if (NULL != (vary = g_hash_table_lookup(cache->vary, base))) {
+		http_cache_build_key(key, vr, base, vary->headers);
+	} else {
+		li_g_string_append_len(key, GSTR_LEN(base));
+	}
+
+	obj = g_hash_table_lookup(cache->objects, key);
+	if (NULL != obj && !http_cache_request_no_cache(vr)) {
+		if (obj->expires > now) {
+			if (debug) {
+				VR_DEBUG(vr, "cache.http.lookup: hit for '%s'", base->str);
+			}
+			goto hit;
+		}
+
+		if (obj->stale_revalidate > now) {
+			/* only one refresh at a time; HEAD responses don't have a body to store */
+			if (LI_HTTP_METHOD_GET == vr->request.http_method && NULL == g_hash_table_lookup(cache->fills, key)) {
+				refresh = http_cache_fill_new(cache, key, base, obj, now);
+			}
+			if (debug) {
+				VR_DEBUG(vr, "cache.http.lookup: stale hit for '%s'%s", base->str, NULL != refresh ? ", refreshing" : "");
+			}
+			goto hit;
+		}
+
+		if (stale_ok && obj->stale_error > now) {
+			if (debug) {
+				VR_DEBUG(vr, "cache.http.lookup: backend failed, stale hit for '%s'", base->str);
+			}
+			goto hit;
+		}
+	}
+
+	if (LI_HTTP_METHOD_HEAD == vr->request.http_method
+			|| NULL != li_http_header_lookup(vr->request.headers, CONST_STR_LEN("Range"))) {
+		/* the backend response won't be a complete body to store */
+		g_mutex_unlock(cache->lock);
+		goto out;
+	}
+
+	if (NULL != (fill = g_hash_table_lookup(cache->fills, key))) {
+		fill->refcount++;
+		g_ptr_array_add(fill->waiters, li_vrequest_get_ref(vr));
+		g_mutex_unlock(cache->lock);
+
+		if (debug) {
+			VR_DEBUG(vr, "cache.http.lookup: waiting for pending backend request for '%s'", base->str);
+		}
+		*context = fill;
+		goto out_wait;
+	}
+
+	fill = http_cache_fill_new(cache, key, base, obj, now);
+
+	g_mutex_unlock(cache->lock);
+
+	if (debug) {
+		VR_DEBUG(vr, "cache.http.lookup: miss for '%s'", base->str);
+	}
+
+	g_ptr_array_index(vr->plugin_ctx, ctx->p->id) = fill;
+
+	/* the response is stored for all clients, so fetch the complete response */
+	li_http_header_remove(vr->request.headers, CONST_STR_LEN("If-None-Match"));
+	li_http_header_remove(vr->request.headers, CONST_STR_LEN("If-Modified-Since"));
+
+	goto out;
+
+hit:
+	g_atomic_int_inc(&obj->refcount);
+	g_queue_unlink(obj->lru, &obj->lru_link);
+	g_queue_push_head_link(obj->lru, &obj->lru_link);
+	g_mutex_unlock(cache->lock);
+
+	if (NULL != refresh) http_cache_refresh_start(vr, ctx->p, refresh);
+
+	if (li_vrequest_handle_direct(vr)) http_cache_serve(vr, obj, now);
+	http_cache_object_release(obj);
+
+out:
+	g_string_free(base, TRUE);
+	g_string_free(key, TRUE);
+	return LI_HANDLER_GO_ON;
+
+out_wait:
+	g_string_free(base, TRUE);
+	g_string_free(key, TRUE);
+	return LI_HANDLER_WAIT_FOR_EVENT;
+}
+
+static liHandlerResult http_cache_lookup_free(liVRequest *vr, gpointer param, gpointer context) {
+	http_cache_ctx *ctx = param;
+	UNUSED(vr);
+
+	http_cache_fill_release(ctx->cache, context);
+
+	return LI_HANDLER_GO_ON;
+}
+
+static void http_cache_store_free(http_cache_store *store) {
+	if (NULL != store->fill) http_cache_fill_finish(store->cache, store->fill, HTTP_CACHE_FILL_PASS);
+	http_cache_object_release(store->obj);
+	if (NULL != store->buf) li_buffer_release(store->buf);
+	if (-1 != store->fd) close(store->fd);
+	g_string_free(store->vary, TRUE);
+	g_slice_free(http_cache_store, store);
+}
+
+static int http_cache_tempfile(http_cache *cache) {
+	GString *name = g_string_sized_new(cache->disk_path->len + 16);
+	int fd;
+
+	li_g_string_append_len(name, GSTR_LEN(cache->disk_path));
+	li_g_string_append_len(name, CONST_STR_LEN("/cache-XXXXXX"));
+
+	if (-1 != (fd = mkstemp(name->str))) {
+		/* only reachable through the fd; the space is freed with the last reference */
+		unlink(name->str);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	g_string_free(name, TRUE);
+	return fd;
+}
+
+static gboolean http_cache_write(int fd, const char *data, gsize len) {
+	while (len > 0) {
+		ssize_t r = write(fd, data, len);
+		if (-1 == r) {
+			if (EINTR == errno) continue;
+			return FALSE;
+		}
+		data += r;
+		len -= r;
+	}
+	return TRUE;
+}
+
+/* returns FALSE if the body gets too big or can't be written */
+static gboolean http_cache_store_append(liVRequest *vr, http_cache_store *store, const char *data, gsize len) {
+	http_cache *cache = store->cache;
+	goffset size = store->obj->size + len;
+
+	if (-1 == store->fd) {
+		if (size <= (goffset) store->buf->alloc_size) {
+			memcpy(store->buf->addr + store->buf->used, data, len);
+			store->buf->used += len;
+			store->obj->size = size;
+			return TRUE;
+		}
+
+		if (size <= cache->mem_max_object) {
+			/* Content-Length was wrong */
+			liBuffer *buf = li_buffer_new_slice(cache->mem_max_object);
+			memcpy(buf->addr, store->buf->addr, store->buf->used);
+			buf->used = store->buf->used;
+			li_buffer_release(store->buf);
+			store->buf = buf;
+			return http_cache_store_append(vr, store, data, len);
+		}
+
+		/* move to disk */
+		if (NULL == cache->disk_path || size > cache->disk_limit) return FALSE;
+		if (-1 == (store->fd = http_cache_tempfile(cache))) {
+			if (NULL != vr) VR_ERROR(vr, "cache.http.store: couldn't create temporary file in '%s': %s", cache->disk_path->str, g_strerror(errno));
+			return FALSE;
+		}
+		if (!http_cache_write(store->fd, store->buf->addr, store->buf->used)) goto write_failed;
+		li_buffer_release(store->buf);
+		store->buf = NULL;
+	}
+
+	if (size > cache->disk_limit) return FALSE;
+	if (!http_cache_write(store->fd, data, len)) goto write_failed;
+	store->obj->size = size;
+	return TRUE;
+
+write_failed:
+	if (NULL != vr) VR_ERROR(vr, "cache.http.store: couldn't write temporary file: %s", g_strerror(errno));
+	return FALSE;
+}
+
+static void http_cache_store_finish(http_cache_store *store) {
+	http_cache_object *obj = store->obj;
+
+	store->obj = NULL;
+	if (-1 != store->fd) {
+		obj->file = li_chunkfile_new(NULL, store->fd, FALSE);
+		store->fd = -1;
+	} else {
+		obj->body = store->buf;
+		store->buf = NULL;
+	}
+
+	http_cache_insert(store->cache, obj, store->fill->base, store->vary);
+	http_cache_fill_finish(store->cache, store->fill, HTTP_CACHE_FILL_STORED);
+	store->fill = NULL;
+
+	http_cache_store_free(store);
+}
+
+static void http_cache_store_filter_free(liVRequest *vr, liFilter *f) {
+	http_cache_store *store = f->param;
+	UNUSED(vr);
+
+	if (NULL == store) return;
+	f->param = NULL;
+
+	http_cache_store_free(store);
+}
+
+static liHandlerResult http_cache_store_filter(liVRequest *vr, liFilter *f) {
+	http_cache_store *store = f->param;
+
+	if (NULL == f->in) {
+		http_cache_store_filter_free(vr, f);
+		/* didn't handle f->in->is_closed? abort forwarding */
+		if (!f->out->is_closed) li_stream_reset(&f->stream);
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (NULL == store) goto forward;
+
+	while (0 < f->in->length) {
+		char *data;
+		off_t len;
+		liChunkIter ci;
+		liHandlerResult res;
+		GError *err = NULL;
+
+		ci = li_chunkqueue_iter(f->in);
+
+		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(ci, 0, 64*1024, &data, &len, &err))) {
+			if (NULL != err) {
+				if (NULL != vr) VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
+				g_error_free(err);
+			}
+			return res;
+		}
+
+		if (!http_cache_store_append(vr, store, data, len)) {
+			if (NULL != vr && CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+				VR_DEBUG(vr, "%s", "cache.http.store: response too big, not storing it");
+			}
+			http_cache_store_filter_free(vr, f);
+			goto forward;
+		}
+
+		if (!f->out->is_closed) {
+			li_chunkqueue_steal_len(f->out, f->in, len);
+		} else {
+			li_chunkqueue_skip(f->in, len);
+		}
+	}
+
+	if (f->in->is_closed) {
+		f->out->is_closed = TRUE;
+		f->param = NULL;
+		http_cache_store_finish(store);
+	}
+
+	return LI_HANDLER_GO_ON;
+
+forward:
+	if (f->out->is_closed) {
+		li_chunkqueue_skip_all(f->in);
+		li_stream_disconnect(&f->stream);
+	} else {
+		li_chunkqueue_steal_all(f->out, f->in);
+		if (f->in->is_closed) f->out->is_closed = f->in->is_closed;
+	}
+	return LI_HANDLER_GO_ON;
+}
+
+static void http_cache_stale_filter_free(liVRequest *vr, liFilter *f) {
+	UNUSED(vr);
+
+	http_cache_object_release(f->param);
+	f->param = NULL;
+}
+
+/* replaces the body of the backend with the stale response */
+static liHandlerResult http_cache_stale_filter(liVRequest *vr, liFilter *f) {
+	http_cache_object *obj = f->param;
+	UNUSED(vr);
+
+	if (NULL != obj) {
+		f->param = NULL;
+		if (!f->out->is_closed) {
+			http_cache_append_body(f->out, obj);
+			f->out->is_closed = TRUE;
+		}
+		http_cache_object_release(obj);
+	}
+
+	if (NULL != f->in) {
+		li_chunkqueue_skip_all(f->in);
+		li_stream_disconnect(&f->stream);
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
+static liHandlerResult http_cache_handle_store(liVRequest *vr, gpointer param, gpointer *context) {
+	http_cache_ctx *ctx = param;
+	http_cache *cache = ctx->cache;
+	http_cache_fill *fill = g_ptr_array_index(vr->plugin_ctx, ctx->p->id);
+	http_cache_store *store;
+	http_cache_object *obj;
+	liHttpHeader *hlength;
+	li_tstamp date, expires, now = li_cur_ts(vr->wrk);
+	gint64 swr = ctx->stale_while_revalidate, sie = ctx->stale_if_error;
+	gsize bufsize = cache->mem_max_object;
+	GString *vary;
+	UNUSED(context);
+
+	if (NULL == fill) return LI_HANDLER_GO_ON; /* no cache miss to fill */
+
+	LI_VREQUEST_WAIT_FOR_RESPONSE_HEADERS(vr);
+
+	g_ptr_array_index(vr->plugin_ctx, ctx->p->id) = NULL;
+
+	switch (vr->response.http_status) {
+	case 500: case 502: case 503: case 504:
+		if (NULL == fill->stale || fill->stale->stale_error <= now) break;
+
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "cache.http.store: backend returned %i, using stale response for '%s'", vr->response.http_status, fill->base->str);
+		}
+		g_atomic_int_inc(&fill->stale->refcount);
+		if (NULL == li_vrequest_add_filter_out(vr, http_cache_stale_filter, http_cache_stale_filter_free, NULL, fill->stale)) {
+			http_cache_object_release(fill->stale);
+			break;
+		}
+		li_http_headers_reset(vr->response.headers);
+		http_cache_serve_headers(vr, fill->stale, now);
+		http_cache_fill_finish(cache, fill, HTTP_CACHE_FILL_STALE);
+		return LI_HANDLER_GO_ON;
+	}
+
+	vary = g_string_sized_new(31);
+	if (!http_cache_response_cacheable(vr, now, &date, &expires, &swr, &sie, vary)) {
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "cache.http.store: response for '%s' not cacheable", fill->base->str);
+		}
+		g_string_free(vary, TRUE);
+		http_cache_fill_finish(cache, fill, HTTP_CACHE_FILL_PASS);
+		return LI_HANDLER_GO_ON;
+	}
+
+	obj = g_slice_new0(http_cache_object);
+	obj->refcount = 1;
+	obj->key = g_string_sized_new(fill->base->len + 31);
+	http_cache_build_key(obj->key, vr, fill->base, vary);
+	obj->status = vr->response.http_status;
+	obj->headers = http_cache_serialize_headers(vr);
+	obj->date = date;
+	obj->expires = expires;
+	obj->stale_revalidate = expires + MAX(swr, 0);
+	obj->stale_error = expires + MAX(sie, 0);
+
+	if (NULL != (hlength = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Content-Length")))) {
+		gint64 length = g_ascii_strtoll(LI_HEADER_VALUE(hlength), NULL, 10);
+		if (length >= 0 && length < (gint64) bufsize) bufsize = MAX(length, 1);
+	}
+
+	store = g_slice_new0(http_cache_store);
+	store->cache = cache;
+	store->fill = fill;
+	store->obj = obj;
+	store->vary = vary;
+	store->buf = li_buffer_new_slice(MAX(bufsize, 1));
+	store->fd = -1;
+
+	if (NULL == li_vrequest_add_filter_out(vr, http_cache_store_filter, http_cache_store_filter_free, NULL, store)) {
+		http_cache_store_free(store);
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
+static void http_cache_ctx_free(liServer *srv, gpointer param) {
+	http_cache_ctx *ctx = param;
+
+	li_pattern_free(ctx->key);
+	if (NULL != ctx->backend) li_action_release(srv, ctx->backend);
+	g_slice_free(http_cache_ctx, ctx);
+}
+
+static liAction* http_cache_lookup_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	http_cache_ctx *ctx;
+	const gchar *key = "%{req.scheme}://%{req.host}%{req.raw_path}";
+	UNUSED(wrk); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NONE != li_value_type(val)) {
+		if (NULL == (val = li_value_to_key_value_list(val))) {
+			ERROR(srv, "%s", "cache.http.lookup expects an optional key-value list as parameter");
+			return NULL;
+		}
+
+		LI_VALUE_FOREACH(entry, val)
+			liValue *entryKey = li_value_list_at(entry, 0);
+			liValue *entryValue = li_value_list_at(entry, 1);
+
+			if (LI_VALUE_STRING != li_value_type(entryKey)) {
+				ERROR(srv, "%s", "cache.http.lookup doesn't take default keys");
+				return NULL;
+			}
+
+			if (g_string_equal(entryKey->data.string, &hon_key)) {
+				if (LI_VALUE_STRING != li_value_type(entryValue)) {
+					ERROR(srv, "cache.http.lookup option '%s' expects string as parameter", entryKey->data.string->str);
+					return NULL;
+				}
+				key = entryValue->data.string->str;
+			} else {
+				ERROR(srv, "unknown option for cache.http.lookup '%s'", entryKey->data.string->str);
+				return NULL;
+			}
+		LI_VALUE_END_FOREACH()
+	}
+
+	ctx = g_slice_new0(http_cache_ctx);
+	ctx->cache = p->data;
+	ctx->p = p;
+	if (NULL == (ctx->key = li_pattern_new(srv, key))) {
+		ERROR(srv, "cache.http.lookup: couldn't parse pattern for key '%s'", key);
+		http_cache_ctx_free(srv, ctx);
+		return NULL;
+	}
+
+	return li_action_new_function(http_cache_handle_lookup, http_cache_lookup_free, http_cache_ctx_free, ctx);
+}
+
+static liAction* http_cache_store_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	http_cache_ctx *ctx;
+	gint64 stale_while_revalidate = 0, stale_if_error = 0;
+	UNUSED(wrk); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NONE != li_value_type(val)) {
+		if (NULL == (val = li_value_to_key_value_list(val))) {
+			ERROR(srv, "%s", "cache.http.store expects an optional key-value list as parameter");
+			return NULL;
+		}
+
+		LI_VALUE_FOREACH(entry, val)
+			liValue *entryKey = li_value_list_at(entry, 0);
+			liValue *entryValue = li_value_list_at(entry, 1);
+
+			if (LI_VALUE_STRING != li_value_type(entryKey)) {
+				ERROR(srv, "%s", "cache.http.store doesn't take default keys");
+				return NULL;
+			}
+
+			if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0) {
+				ERROR(srv, "cache.http.store option '%s' expects non-negative integer as parameter", entryKey->data.string->str);
+				return NULL;
+			}
+
+			if (g_string_equal(entryKey->data.string, &hon_stale_while_revalidate)) {
+				stale_while_revalidate = entryValue->data.number;
+			} else if (g_string_equal(entryKey->data.string, &hon_stale_if_error)) {
+				stale_if_error = entryValue->data.number;
+			} else {
+				ERROR(srv, "unknown option for cache.http.store '%s'", entryKey->data.string->str);
+				return NULL;
+			}
+		LI_VALUE_END_FOREACH()
+	}
+
+	ctx = g_slice_new0(http_cache_ctx);
+	ctx->cache = p->data;
+	ctx->p = p;
+	ctx->stale_while_revalidate = stale_while_revalidate;
+	ctx->stale_if_error = stale_if_error;
+
+	return li_action_new_function(http_cache_handle_store, NULL, http_cache_ctx_free, ctx);
+}
+
+static liHandlerResult http_cache_backend_select(liVRequest *vr, gboolean backlog_provided, gpointer param, gpointer *context) {
+	http_cache_ctx *ctx = param;
+	UNUSED(backlog_provided); UNUSED(context);
+
+	li_action_enter(vr, ctx->backend);
+
+	return LI_HANDLER_GO_ON;
+}
+
+static liHandlerResult http_cache_backend_fallback(liVRequest *vr, gboolean backlog_provided, gpointer param, gpointer *context, liBackendError error) {
+	http_cache_ctx *ctx = param;
+	http_cache_fill *fill = g_ptr_array_index(vr->plugin_ctx, ctx->p->id);
+	li_tstamp now = li_cur_ts(vr->wrk);
+	UNUSED(backlog_provided); UNUSED(context);
+
+	if (NULL != fill && NULL != fill->stale && fill->stale->stale_error > now && li_vrequest_handle_direct(vr)) {
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "cache.http.backend: backend failed (error: %i), using stale response for '%s'", error, fill->base->str);
+		}
+		g_ptr_array_index(vr->plugin_ctx, ctx->p->id) = NULL;
+		http_cache_serve_headers(vr, fill->stale, now);
+		http_cache_append_body(vr->direct_out, fill->stale);
+		http_cache_fill_finish(ctx->cache, fill, HTTP_CACHE_FILL_STALE);
+		return LI_HANDLER_GO_ON;
+	}
+
+	/* nothing to serve: pass the error on (to the next balancer, or a 503 response) */
+	li_vrequest_backend_error(vr, error);
+
+	return LI_HANDLER_GO_ON;
+}
+
+static liHandlerResult http_cache_backend_finished(liVRequest *vr, gpointer param, gpointer context) {
+	UNUSED(vr); UNUSED(param); UNUSED(context);
+
+	return LI_HANDLER_GO_ON;
+}
+
+static liAction* http_cache_backend_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	http_cache_ctx *ctx;
+	UNUSED(wrk); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_ACTION != li_value_type(val)) {
+		ERROR(srv, "%s", "cache.http.backend expects an action as parameter");
+		return NULL;
+	}
+
+	ctx = g_slice_new0(http_cache_ctx);
+	ctx->cache = p->data;
+	ctx->p = p;
+	ctx->backend = li_value_extract_action(val);
+
+	/* "provides a backlog": failing balancers inside pass their errors to the fallback */
+	return li_action_new_balancer(http_cache_backend_select, http_cache_backend_fallback, http_cache_backend_finished, http_cache_ctx_free, ctx, TRUE);
+}
+
+static gboolean http_cache_setup_storage(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	http_cache *cache = p->data;
+	UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (NULL == (val = li_value_to_key_value_list(val))) {
+		ERROR(srv, "%s", "cache.http.storage expects a key-value list as parameter");
+		return FALSE;
+	}
+
+	g_mutex_lock(cache->lock);
+
+	LI_VALUE_FOREACH(entry, val)
+		liValue *entryKey = li_value_list_at(entry, 0);
+		liValue *entryValue = li_value_list_at(entry, 1);
+		GString *entryKeyStr;
+
+		if (LI_VALUE_STRING != li_value_type(entryKey)) {
+			ERROR(srv, "%s", "cache.http.storage doesn't take default keys");
+			goto option_failed;
+		}
+		entryKeyStr = entryKey->data.string; /* keys are either NONE or STRING */
+
+		if (g_string_equal(entryKeyStr, &hon_disk_path)) {
+			if (LI_VALUE_STRING != li_value_type(entryValue)) {
+				ERROR(srv, "cache.http.storage option '%s' expects string as parameter", entryKeyStr->str);
+				goto option_failed;
+			}
+			if (!g_file_test(entryValue->data.string->str, G_FILE_TEST_IS_DIR)) {
+				ERROR(srv, "cache.http.storage: '%s' is not a directory", entryValue->data.string->str);
+				goto option_failed;
+			}
+			if (NULL != cache->disk_path) g_string_free(cache->disk_path, TRUE);
+			cache->disk_path = li_value_extract_string(entryValue);
+			continue;
+		}
+
+		if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0) {
+			ERROR(srv, "cache.http.storage option '%s' expects non-negative integer as parameter", entryKeyStr->str);
+			goto option_failed;
+		}
+
+		if (g_string_equal(entryKeyStr, &hon_memory_size)) {
+			cache->mem_limit = entryValue->data.number;
+		} else if (g_string_equal(entryKeyStr, &hon_memory_max_object)) {
+			cache->mem_max_object = entryValue->data.number;
+		} else if (g_string_equal(entryKeyStr, &hon_disk_size)) {
+			cache->disk_limit = entryValue->data.number;
+		} else {
+			ERROR(srv, "unknown option for cache.http.storage '%s'", entryKeyStr->str);
+			goto option_failed;
+		}
+	LI_VALUE_END_FOREACH()
+
+	http_cache_evict(cache);
+	g_mutex_unlock(cache->lock);
+	return TRUE;
+
+option_failed:
+	g_mutex_unlock(cache->lock);
+	return FALSE;
+}
+
+static const liPluginOption options[] = {
+	{ NULL, 0, 0, NULL }
+};
+
+static const liPluginAction actions[] = {
+	{ "cache.http.lookup", http_cache_lookup_create, NULL },
+	{ "cache.http.store", http_cache_store_create, NULL },
+	{ "cache.http.backend", http_cache_backend_create, NULL },
+	{ NULL, NULL, NULL }
+};
+
+static const liPluginSetup setups[] = {
+	{ "cache.http.storage", http_cache_setup_storage, NULL },
+	{ NULL, NULL, NULL }
+};
+
+/* request ended before its response was stored */
+static void http_cache_vrclose(liVRequest *vr, liPlugin *p) {
+	http_cache_fill *fill = g_ptr_array_index(vr->plugin_ctx, p->id);
+
+	if (NULL == fill) return;
+	g_ptr_array_index(vr->plugin_ctx, p->id) = NULL;
+
+	http_cache_fill_finish(p->data, fill, HTTP_CACHE_FILL_PASS);
+}
+
+static void plugin_cache_http_free(liServer *srv, liPlugin *p) {
+	UNUSED(srv);
+
+	http_cache_free(p->data);
+}
+
+static void plugin_init(liServer *srv, liPlugin *p, gpointer userdata) {
+	UNUSED(srv); UNUSED(userdata);
+
+	p->options = options;
+	p->actions = actions;
+	p->setups = setups;
+	p->free = plugin_cache_http_free;
+	p->handle_vrclose = http_cache_vrclose;
+
+	p->data = http_cache_new();
+}
+
+gboolean mod_cache_http_init(liModules *mods, liModule *mod) {
+	MODULE_VERSION_CHECK(mods);
+
+	mod->config = li_plugin_register(mods->main, "mod_cache_http", plugin_init, NULL);
+
+	return mod->config != NULL;
+}
+
+gboolean mod_cache_http_free(liModules *mods, liModule *mod) {
+	if (mod->config)
+		li_plugin_free(mods->main, mod->config);
+
+	return TRUE;
+}
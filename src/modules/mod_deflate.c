@@ -1,6 +1,9 @@
 /*
  * mod_deflate - compress content on the fly
  *
+ * Also serves precompressed files (foo.js.gz, foo.js.br, foo.js.zst) and keeps
+ * compressed responses in memory to reuse them for the next request.
+ *
  * Author:
  *     Copyright (c) 2009 Stefan Bühler
  *     Copyright (c) 2010 Thomas Porzelt
@@ -20,6 +23,8 @@ LI_API gboolean mod_deflate_free(liModules *mods, liModule *mod);
 #define ENCODING_NAME_COMPRESS   "compress"
 #define ENCODING_NAME_BZIP2      "bzip2"
 #define ENCODING_NAME_X_BZIP2    "x-bzip2"
+#define ENCODING_NAME_BR         "br"
+#define ENCODING_NAME_ZSTD       "zstd"
 
 typedef enum {
 	ENCODING_IDENTITY,
@@ -28,7 +33,9 @@ typedef enum {
 	ENCODING_GZIP,
 	ENCODING_X_GZIP,
 	ENCODING_DEFLATE,
-	ENCODING_COMPRESS
+	ENCODING_COMPRESS,
+	ENCODING_BR,
+	ENCODING_ZSTD
 } encodings;
 
 static const char* encoding_names[] = {
@@ -39,6 +46,8 @@ static const char* encoding_names[] = {
 	"x-gzip",
 	"deflate",
 	"compress",
+	"br",
+	"zstd",
 	NULL
 };
 
@@ -49,13 +58,96 @@ static const guint encoding_available_mask = 0
 #ifdef HAVE_ZLIB
 	| (1 << ENCODING_GZIP) | (1 << ENCODING_X_GZIP) | (1 << ENCODING_DEFLATE)
 #endif
+#ifdef HAVE_BROTLI
+	| (1 << ENCODING_BR)
+#endif
+#ifdef HAVE_ZSTD
+	| (1 << ENCODING_ZSTD)
+#endif
 ;
 
+#define ENCODING_COUNT (ENCODING_ZSTD + 1)
+
+/* used if the client accepts several encodings with the same q-value */
+static const encodings encoding_preference[] = {
+	ENCODING_ZSTD,
+	ENCODING_BR,
+	ENCODING_BZIP2,
+	ENCODING_X_BZIP2,
+	ENCODING_GZIP,
+	ENCODING_X_GZIP,
+	ENCODING_DEFLATE,
+};
+
+/* precompressed siblings, in order of preference */
+typedef struct {
+	encodings encoding;
+	const gchar *suffix;
+} precompressed_suffix;
+
+static const precompressed_suffix precompressed_suffixes[] = {
+	{ ENCODING_BR, ".br" },
+	{ ENCODING_ZSTD, ".zst" },
+	{ ENCODING_GZIP, ".gz" },
+};
+
+static const guint precompressed_available_mask = (1 << ENCODING_BR) | (1 << ENCODING_ZSTD) | (1 << ENCODING_GZIP);
+
+typedef struct deflate_precompressed_config deflate_precompressed_config;
+struct deflate_precompressed_config {
+	liPlugin *p;
+	guint allowed_encodings;
+};
+
 typedef struct deflate_config deflate_config;
 struct deflate_config {
 	liPlugin *p;
 	guint allowed_encodings;
 	guint blocksize, output_buffer, compression_level;
+	guint offload_threshold; /* compress in the tasklet pool from this size on; 0: never */
+};
+
+/* memory cache for compressed responses, keyed by the (modified) etag, compression level and url */
+typedef struct deflate_cache_entry deflate_cache_entry;
+struct deflate_cache_entry {
+	GString *key;
+	liBuffer *data;
+	GList lru_link;
+};
+
+typedef struct deflate_cache deflate_cache;
+struct deflate_cache {
+	GMutex *lock;
+	GHashTable *entries; /* GString* key (entry->key) -> deflate_cache_entry* */
+	GQueue lru; /* head: most recently used */
+	goffset limit, used;
+};
+
+/* state of the filter collecting compressed output for the cache */
+typedef struct deflate_cache_store deflate_cache_store;
+struct deflate_cache_store {
+	deflate_cache *cache;
+	GString *key;
+	GByteArray *data; /* NULL if the output got too big */
+};
+
+/**********************************************************************************/
+
+/* encoders compress a stream of blocks into a chunkqueue; the generic filter below feeds them */
+
+typedef enum {
+	DEFLATE_OP_PROCESS,
+	DEFLATE_OP_FLUSH, /* write all pending output; more input follows */
+	DEFLATE_OP_FINISH /* last input */
+} deflate_op;
+
+typedef struct deflate_encoder deflate_encoder;
+struct deflate_encoder {
+	/* compresses len bytes and appends the output to out; returns FALSE and sets error on failure.
+	 * may run in a tasklet thread, so it must not touch anything but its own context and out.
+	 */
+	gboolean (*compress)(gpointer ctx, liChunkQueue *out, deflate_op op, const char *data, gsize len, GString *error);
+	void (*free)(gpointer ctx);
 };
 
 /**********************************************************************************/
@@ -79,15 +171,14 @@ static const unsigned char gzip_header[] = {
 
 typedef struct deflate_context_zlib deflate_context_zlib;
 struct deflate_context_zlib {
-	deflate_config conf;
-
 	z_stream z;
 	GByteArray *buf;
 	gboolean is_gzip, gzip_header;
 	unsigned long crc;
 };
 
-static void deflate_context_zlib_free(deflate_context_zlib *ctx) {
+static void deflate_context_zlib_free(gpointer param) {
+	deflate_context_zlib *ctx = param;
 	z_stream *z;
 	if (!ctx) return;
 
@@ -106,8 +197,6 @@ static deflate_context_zlib* deflate_context_zlib_create(liVRequest *vr, deflate
 	guint window_size = -MAX_WBITS; /* suppress zlib-header */
 	guint mem_level = 8;
 
-	ctx->conf = *conf;
-
 	z->zalloc = Z_NULL;
 	z->zfree = Z_NULL;
 	z->opaque = Z_NULL;
@@ -138,50 +227,28 @@ static deflate_context_zlib* deflate_context_zlib_create(liVRequest *vr, deflate
 	return ctx;
 }
 
-static void deflate_filter_zlib_free(liVRequest *vr, liFilter *f) {
-	deflate_context_zlib *ctx = (deflate_context_zlib*) f->param;
-	UNUSED(vr);
+static void deflate_zlib_flush_buf(deflate_context_zlib *ctx, liChunkQueue *out) {
+	z_stream *z = &ctx->z;
 
-	deflate_context_zlib_free(ctx);
+	if (0 < ctx->buf->len - z->avail_out) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - z->avail_out);
+		z->next_out = ctx->buf->data;
+		z->avail_out = ctx->buf->len;
+	}
 }
 
-static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
-	deflate_context_zlib *ctx = (deflate_context_zlib*) f->param;
-	const off_t blocksize = ctx->conf.blocksize;
-	const off_t max_compress = 4 * blocksize;
-	gboolean debug = (NULL != vr) && _OPTION(vr, ctx->conf.p, 0).boolean;
+static gboolean deflate_zlib_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, GString *error) {
+	deflate_context_zlib *ctx = param;
 	z_stream *z = &ctx->z;
-	off_t l = 0;
-	liHandlerResult res;
 	int rc;
 
-	if (NULL == f->in) {
-		f->out->is_closed = TRUE;
-		return LI_HANDLER_GO_ON;
-	}
-
-	if (f->in->is_closed && 0 == f->in->length && f->out->is_closed) {
-		/* nothing to do anymore */
-		return LI_HANDLER_GO_ON;
-	}
-
-	if (f->out->is_closed) {
-		li_chunkqueue_skip_all(f->in);
-		li_stream_disconnect(&f->stream);
-		if (debug) {
-			VR_DEBUG(vr, "deflate out stream closed: in: %i, out : %i", (int) z->total_in, (int) z->total_out);
-		}
-		return LI_HANDLER_GO_ON;
-	}
-
 	if (ctx->is_gzip && !ctx->gzip_header) {
 		ctx->gzip_header = TRUE;
 
 		/* as the buffer is unused it really should be big enough */
 		if (z->avail_out < sizeof(gzip_header)) {
-			f->out->is_closed = TRUE;
-			VR_ERROR(vr, "deflate error: %s", z->msg);
-			return LI_HANDLER_ERROR;
+			g_string_assign(error, "deflate error: output buffer too small for gzip header");
+			return FALSE;
 		}
 
 		/* copy gzip header into output buffer */
@@ -193,64 +260,47 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 		z->avail_out -= sizeof(gzip_header);
 	}
 
-	while (l < max_compress) {
-		char *data;
-		off_t len;
-		liChunkIter ci;
-		GError *err = NULL;
-
-		if (0 == f->in->length) break;
+	if (ctx->is_gzip && len > 0) {
+		ctx->crc = crc32(ctx->crc, (const unsigned char*) data, len);
+	}
 
-		ci = li_chunkqueue_iter(f->in);
+	z->next_in = (unsigned char*) data;
+	z->avail_in = len;
 
-		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(ci, 0, blocksize, &data, &len, &err))) {
-			if (NULL != err) {
-				if (NULL != vr) VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
-				g_error_free(err);
-			}
-			return res;
-		}
-
-		if (ctx->is_gzip) {
-			ctx->crc = crc32(ctx->crc, (unsigned char*) data, len);
+	while (z->avail_in > 0) {
+		if (Z_OK != deflate(z, Z_NO_FLUSH)) {
+			g_string_printf(error, "deflate error: %s", z->msg);
+			return FALSE;
 		}
 
-		z->next_in = (unsigned char*) data;
-		z->avail_in = len;
+		if (0 == z->avail_out) deflate_zlib_flush_buf(ctx, out);
+	}
 
+	switch (op) {
+	case DEFLATE_OP_PROCESS:
+		break;
+	case DEFLATE_OP_FLUSH:
+		/* deflate must be called again as long as it fills the complete buffer */
 		do {
-			if (Z_OK != deflate(z, Z_NO_FLUSH)) {
-				f->out->is_closed = TRUE;
-				if (NULL != vr) VR_ERROR(vr, "deflate error: %s", z->msg);
-				return LI_HANDLER_ERROR;
-			}
-
-			if(z->avail_out == 0 || z->avail_in > 0) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-				z->next_out = ctx->buf->data;
-				z->avail_out = ctx->buf->len;
+			deflate_zlib_flush_buf(ctx, out);
+			rc = deflate(z, Z_SYNC_FLUSH);
+			if (rc != Z_OK && rc != Z_STREAM_END) {
+				g_string_printf(error, "deflate error: %s", z->msg);
+				return FALSE;
 			}
-		} while (z->avail_in > 0);
-
-		li_chunkqueue_skip(f->in, len);
-		l += len;
-	}
-
-	if (0 == f->in->length && f->in->is_closed) {
+		} while (0 == z->avail_out);
+		deflate_zlib_flush_buf(ctx, out);
+		break;
+	case DEFLATE_OP_FINISH:
 		do {
 			rc = deflate(z, Z_FINISH);
 			if (rc != Z_OK && rc != Z_STREAM_END) {
-				f->out->is_closed = TRUE;
-				if (NULL != vr) VR_ERROR(vr, "deflate error: %s", z->msg);
-				return LI_HANDLER_ERROR;
+				g_string_printf(error, "deflate error: %s", z->msg);
+				return FALSE;
 			}
 
 			/* flush every time until done */
-			if (0 < ctx->buf->len - z->avail_out) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-				z->next_out = ctx->buf->data;
-				z->avail_out = ctx->buf->len;
-			}
+			deflate_zlib_flush_buf(ctx, out);
 		} while (rc != Z_STREAM_END);
 
 		if (ctx->is_gzip) {
@@ -267,33 +317,15 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 			c[7] = (z->total_in >> 24) & 0xff;
 
 			/* append footer to write_queue */
-			li_chunkqueue_append_mem(f->out, c, 8);
-		}
-
-		if (debug) {
-			VR_DEBUG(vr, "deflate finished: in: %i, out : %i", (int) z->total_in, (int) z->total_out);
-		}
-
-		f->out->is_closed = TRUE;
-	}
-
-	if (l > 0 && 0 == f->in->length && !f->in->is_closed) { /* flush z_stream */
-		rc = deflate(z, Z_SYNC_FLUSH);
-		if (rc != Z_OK && rc != Z_STREAM_END) {
-			if (NULL != vr) VR_ERROR(vr, "deflate error: %s", z->msg);
-			return LI_HANDLER_ERROR;
+			li_chunkqueue_append_mem(out, c, 8);
 		}
+		break;
 	}
 
-	/* flush output buffer if there is no more data pending */
-	if (0 == f->in->length && 0 < ctx->buf->len - z->avail_out) {
-		li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-		z->next_out = ctx->buf->data;
-		z->avail_out = ctx->buf->len;
-	}
-
-	return 0 == f->in->length ? LI_HANDLER_GO_ON : LI_HANDLER_COMEBACK;
+	return TRUE;
 }
+
+static const deflate_encoder deflate_encoder_zlib = { deflate_zlib_compress, deflate_context_zlib_free };
 #endif /* HAVE_ZLIB */
 
 /**********************************************************************************/
@@ -307,13 +339,12 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 
 typedef struct deflate_context_bzip2 deflate_context_bzip2;
 struct deflate_context_bzip2 {
-	deflate_config conf;
-
 	bz_stream bz;
 	GByteArray *buf;
 };
 
-static void deflate_context_bzip2_free(deflate_context_bzip2 *ctx) {
+static void deflate_context_bzip2_free(gpointer param) {
+	deflate_context_bzip2 *ctx = param;
 	bz_stream *bz;
 	if (!ctx) return;
 
@@ -330,8 +361,6 @@ static deflate_context_bzip2* deflate_context_bzip2_create(liVRequest *vr, defla
 	bz_stream *bz = &ctx->bz;
 	guint compression_level = conf->compression_level;
 
-	ctx->conf = *conf;
-
 	bz->bzalloc = NULL;
 	bz->bzfree = NULL;
 	bz->opaque = NULL;
@@ -340,41 +369,454 @@ static deflate_context_bzip2* deflate_context_bzip2_create(liVRequest *vr, defla
 	bz->total_out_lo32 = 0;
 	bz->total_out_hi32 = 0;
 
-	if (BZ_OK != BZ2_bzCompressInit(bz, compression_level /* blocksize */, 0 /* no output */, 30 /* workFactor: default */)) {
-		VR_ERROR(vr, "%s", "Couldn't init bz_stream");
-		g_slice_free(deflate_context_bzip2, ctx);
-		return NULL;
+	if (BZ_OK != BZ2_bzCompressInit(bz, compression_level /* blocksize */, 0 /* no output */, 30 /* workFactor: default */)) {
+		VR_ERROR(vr, "%s", "Couldn't init bz_stream");
+		g_slice_free(deflate_context_bzip2, ctx);
+		return NULL;
+	}
+
+	ctx->buf = g_byte_array_new();
+	g_byte_array_set_size(ctx->buf, conf->output_buffer);
+
+	bz->next_out = (char*) ctx->buf->data;
+	bz->avail_out = ctx->buf->len;
+
+	return ctx;
+}
+
+static void deflate_bzip2_flush_buf(deflate_context_bzip2 *ctx, liChunkQueue *out) {
+	bz_stream *bz = &ctx->bz;
+
+	if (0 < ctx->buf->len - bz->avail_out) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - bz->avail_out);
+		bz->next_out = (char*) ctx->buf->data;
+		bz->avail_out = ctx->buf->len;
+	}
+}
+
+static gboolean deflate_bzip2_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, GString *error) {
+	deflate_context_bzip2 *ctx = param;
+	bz_stream *bz = &ctx->bz;
+	int rc;
+
+	bz->next_in = (char*) data;
+	bz->avail_in = len;
+
+	if (DEFLATE_OP_FINISH == op) {
+		do {
+			rc = BZ2_bzCompress(bz, BZ_FINISH);
+			if (rc != BZ_RUN_OK && rc != BZ_STREAM_END && rc != BZ_FINISH_OK) {
+				g_string_printf(error, "BZ2_bzCompress error: rc = %i", rc);
+				return FALSE;
+			}
+
+			/* flush every time until done */
+			deflate_bzip2_flush_buf(ctx, out);
+		} while (rc == BZ_RUN_OK || rc == BZ_FINISH_OK);
+
+		return TRUE;
+	}
+
+	while (bz->avail_in > 0) {
+		rc = BZ2_bzCompress(bz, BZ_RUN);
+		if (rc != BZ_RUN_OK) {
+			g_string_printf(error, "BZ2_bzCompress error: rc = %i", rc);
+			return FALSE;
+		}
+
+		if (0 == bz->avail_out) deflate_bzip2_flush_buf(ctx, out);
+	}
+
+	/* BZ_FLUSH would end the current block; only hand out what we already have */
+	if (DEFLATE_OP_FLUSH == op) deflate_bzip2_flush_buf(ctx, out);
+
+	return TRUE;
+}
+
+static const deflate_encoder deflate_encoder_bzip2 = { deflate_bzip2_compress, deflate_context_bzip2_free };
+#endif /* HAVE_BZIP */
+
+/**********************************************************************************/
+
+#ifdef HAVE_BROTLI
+
+# include <brotli/encode.h>
+
+typedef struct deflate_context_brotli deflate_context_brotli;
+struct deflate_context_brotli {
+	BrotliEncoderState *state;
+	GByteArray *buf;
+	uint8_t *next_out;
+	size_t avail_out;
+};
+
+static void deflate_context_brotli_free(gpointer param) {
+	deflate_context_brotli *ctx = param;
+	if (!ctx) return;
+
+	BrotliEncoderDestroyInstance(ctx->state);
+
+	g_byte_array_free(ctx->buf, TRUE);
+
+	g_slice_free(deflate_context_brotli, ctx);
+}
+
+static deflate_context_brotli* deflate_context_brotli_create(liVRequest *vr, deflate_config *conf) {
+	deflate_context_brotli *ctx;
+	BrotliEncoderState *state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+
+	if (NULL == state) {
+		VR_ERROR(vr, "%s", "Couldn't create brotli encoder");
+		return NULL;
+	}
+
+	/* quality goes up to 11, but everything above 9 is far too slow for on the fly compression */
+	if (!BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, conf->compression_level)) {
+		VR_ERROR(vr, "%s", "Couldn't set brotli quality");
+		BrotliEncoderDestroyInstance(state);
+		return NULL;
+	}
+
+	ctx = g_slice_new0(deflate_context_brotli);
+	ctx->state = state;
+
+	ctx->buf = g_byte_array_new();
+	g_byte_array_set_size(ctx->buf, conf->output_buffer);
+
+	ctx->next_out = ctx->buf->data;
+	ctx->avail_out = ctx->buf->len;
+
+	return ctx;
+}
+
+static void deflate_brotli_flush_buf(deflate_context_brotli *ctx, liChunkQueue *out) {
+	if (ctx->avail_out < ctx->buf->len) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - ctx->avail_out);
+		ctx->next_out = ctx->buf->data;
+		ctx->avail_out = ctx->buf->len;
+	}
+}
+
+static gboolean deflate_brotli_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, GString *error) {
+	deflate_context_brotli *ctx = param;
+	const uint8_t *next_in = (const uint8_t*) data;
+	size_t avail_in = len;
+	BrotliEncoderOperation bop;
+
+	switch (op) {
+	case DEFLATE_OP_FLUSH: bop = BROTLI_OPERATION_FLUSH; break;
+	case DEFLATE_OP_FINISH: bop = BROTLI_OPERATION_FINISH; break;
+	default: bop = BROTLI_OPERATION_PROCESS; break;
+	}
+
+	/* for FLUSH and FINISH run until the encoder has no pending output left */
+	do {
+		if (!BrotliEncoderCompressStream(ctx->state, bop, &avail_in, &next_in, &ctx->avail_out, &ctx->next_out, NULL)) {
+			g_string_assign(error, "brotli encoder error");
+			return FALSE;
+		}
+
+		if (0 == ctx->avail_out) deflate_brotli_flush_buf(ctx, out);
+	} while (avail_in > 0 || BrotliEncoderHasMoreOutput(ctx->state)
+		|| (BROTLI_OPERATION_FINISH == bop && !BrotliEncoderIsFinished(ctx->state)));
+
+	if (DEFLATE_OP_PROCESS != op) deflate_brotli_flush_buf(ctx, out);
+
+	return TRUE;
+}
+
+static const deflate_encoder deflate_encoder_brotli = { deflate_brotli_compress, deflate_context_brotli_free };
+#endif /* HAVE_BROTLI */
+
+/**********************************************************************************/
+
+#ifdef HAVE_ZSTD
+
+# include <zstd.h>
+
+typedef struct deflate_context_zstd deflate_context_zstd;
+struct deflate_context_zstd {
+	ZSTD_CCtx *cctx;
+	GByteArray *buf;
+	ZSTD_outBuffer out;
+};
+
+static void deflate_context_zstd_free(gpointer param) {
+	deflate_context_zstd *ctx = param;
+	if (!ctx) return;
+
+	ZSTD_freeCCtx(ctx->cctx);
+
+	g_byte_array_free(ctx->buf, TRUE);
+
+	g_slice_free(deflate_context_zstd, ctx);
+}
+
+static deflate_context_zstd* deflate_context_zstd_create(liVRequest *vr, deflate_config *conf) {
+	deflate_context_zstd *ctx;
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	size_t rc;
+
+	if (NULL == cctx) {
+		VR_ERROR(vr, "%s", "Couldn't create zstd context");
+		return NULL;
+	}
+
+	if (ZSTD_isError(rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, conf->compression_level))) {
+		VR_ERROR(vr, "Couldn't set zstd compression level: %s", ZSTD_getErrorName(rc));
+		ZSTD_freeCCtx(cctx);
+		return NULL;
+	}
+
+	ctx = g_slice_new0(deflate_context_zstd);
+	ctx->cctx = cctx;
+
+	ctx->buf = g_byte_array_new();
+	g_byte_array_set_size(ctx->buf, conf->output_buffer);
+
+	ctx->out.dst = ctx->buf->data;
+	ctx->out.size = ctx->buf->len;
+	ctx->out.pos = 0;
+
+	return ctx;
+}
+
+static void deflate_zstd_flush_buf(deflate_context_zstd *ctx, liChunkQueue *out) {
+	if (ctx->out.pos > 0) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->out.pos);
+		ctx->out.pos = 0;
+	}
+}
+
+static gboolean deflate_zstd_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, GString *error) {
+	deflate_context_zstd *ctx = param;
+	ZSTD_EndDirective mode;
+	ZSTD_inBuffer in;
+	size_t remaining;
+
+	switch (op) {
+	case DEFLATE_OP_FLUSH: mode = ZSTD_e_flush; break;
+	case DEFLATE_OP_FINISH: mode = ZSTD_e_end; break;
+	default: mode = ZSTD_e_continue; break;
+	}
+
+	in.src = data;
+	in.size = len;
+	in.pos = 0;
+
+	/* for ZSTD_e_flush and ZSTD_e_end run until the frame is flushed / complete */
+	do {
+		remaining = ZSTD_compressStream2(ctx->cctx, &ctx->out, &in, mode);
+		if (ZSTD_isError(remaining)) {
+			g_string_printf(error, "zstd encoder error: %s", ZSTD_getErrorName(remaining));
+			return FALSE;
+		}
+
+		if (ctx->out.pos == ctx->out.size) deflate_zstd_flush_buf(ctx, out);
+	} while (in.pos < in.size || (ZSTD_e_continue != mode && 0 != remaining));
+
+	if (DEFLATE_OP_PROCESS != op) deflate_zstd_flush_buf(ctx, out);
+
+	return TRUE;
+}
+
+static const deflate_encoder deflate_encoder_zstd = { deflate_zstd_compress, deflate_context_zstd_free };
+#endif /* HAVE_ZSTD */
+
+/**********************************************************************************/
+
+/* compressing in a tasklet: the encoder state is sequential, so there is at most one job per
+ * response; it takes up to DEFLATE_OFFLOAD_BLOCKS blocks, which also bounds the memory in flight */
+#define DEFLATE_OFFLOAD_BLOCKS 4
+
+typedef struct deflate_filter_context deflate_filter_context;
+struct deflate_filter_context {
+	deflate_config conf;
+
+	const deflate_encoder *encoder;
+	gpointer encoder_ctx;
+	guint64 total_in;
+
+	liTaskletPool *tasklets;
+	gboolean offload; /* sticky: once a response was big enough, all further blocks go to the tasklet pool */
+	gboolean job_running, failed;
+	gboolean in_closed; /* f->in is gone after the source got disconnected; remember whether it was closed */
+	GString *error;
+};
+
+typedef struct deflate_offload_job deflate_offload_job;
+struct deflate_offload_job {
+	liFilter *f; /* keeps a reference to the filter stream, so f->param stays alive */
+	GByteArray *data;
+	deflate_op op;
+	liChunkQueue *out; /* private until the job is finished */
+	gboolean ok;
+};
+
+static deflate_filter_context* deflate_filter_context_new(liVRequest *vr, deflate_config *conf, const deflate_encoder *encoder, gpointer encoder_ctx) {
+	deflate_filter_context *ctx = g_slice_new0(deflate_filter_context);
+	liHttpHeader *hh_length;
+
+	ctx->conf = *conf;
+	ctx->encoder = encoder;
+	ctx->encoder_ctx = encoder_ctx;
+	ctx->tasklets = vr->wrk->tasklets;
+	ctx->error = g_string_sized_new(0);
+
+	/* don't wait for the first blocks if we already know the response is big */
+	if (0 != conf->offload_threshold && NULL != (hh_length = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("content-length")))) {
+		gint64 length = g_ascii_strtoll(LI_HEADER_VALUE(hh_length), NULL, 10);
+		if (length >= (gint64) conf->offload_threshold) ctx->offload = TRUE;
+	}
+
+	return ctx;
+}
+
+static void deflate_filter_context_free(deflate_filter_context *ctx) {
+	ctx->encoder->free(ctx->encoder_ctx);
+	g_string_free(ctx->error, TRUE);
+	g_slice_free(deflate_filter_context, ctx);
+}
+
+static void deflate_filter_encode_free(liVRequest *vr, liFilter *f) {
+	UNUSED(vr);
+
+	deflate_filter_context_free(f->param);
+}
+
+static void deflate_offload_run(gpointer data) {
+	deflate_offload_job *job = data;
+	deflate_filter_context *ctx = job->f->param;
+
+	job->ok = ctx->encoder->compress(ctx->encoder_ctx, job->out, job->op, (const char*) job->data->data, job->data->len, ctx->error);
+}
+
+static void deflate_offload_finished(gpointer data) {
+	deflate_offload_job *job = data;
+	liFilter *f = job->f;
+	deflate_filter_context *ctx = f->param;
+
+	ctx->job_running = FALSE;
+
+	if (!job->ok) {
+		ctx->failed = TRUE;
+	} else if (!f->out->is_closed) {
+		li_chunkqueue_steal_all(f->out, job->out);
+		if (DEFLATE_OP_FINISH == job->op) {
+			f->out->is_closed = TRUE;
+			if (NULL != f->vr && _OPTION(f->vr, ctx->conf.p, 0).boolean) {
+				VR_DEBUG(f->vr, "deflate finished: in: %" G_GUINT64_FORMAT ", out : %" G_GOFFSET_FORMAT, ctx->total_in, f->out->bytes_in);
+			}
+		}
+		li_stream_notify(&f->stream);
+	}
+
+	/* continue with the next block (or report the error) */
+	li_stream_again(&f->stream);
+
+	li_chunkqueue_free(job->out);
+	g_byte_array_free(job->data, TRUE);
+	g_slice_free(deflate_offload_job, job);
+	li_stream_release(&f->stream);
+}
+
+/* copies the next blocks into a job for the tasklet pool */
+static liHandlerResult deflate_offload(liVRequest *vr, liFilter *f) {
+	deflate_filter_context *ctx = f->param;
+	const off_t blocksize = ctx->conf.blocksize;
+	deflate_offload_job *job = g_slice_new0(deflate_offload_job);
+	liHandlerResult res = LI_HANDLER_GO_ON;
+
+	job->data = g_byte_array_sized_new(MIN(f->in->length, DEFLATE_OFFLOAD_BLOCKS * blocksize));
+
+	while (job->data->len < DEFLATE_OFFLOAD_BLOCKS * blocksize && f->in->length > 0) {
+		char *data;
+		off_t len;
+		GError *err = NULL;
+
+		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(li_chunkqueue_iter(f->in), 0, blocksize, &data, &len, &err))) {
+			if (NULL != err) {
+				if (NULL != vr) VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
+				g_error_free(err);
+			}
+			break;
+		}
+
+		g_byte_array_append(job->data, (guint8*) data, len);
+		li_chunkqueue_skip(f->in, len);
+	}
+
+	if (LI_HANDLER_ERROR == res || (LI_HANDLER_GO_ON != res && 0 == job->data->len)) {
+		g_byte_array_free(job->data, TRUE);
+		g_slice_free(deflate_offload_job, job);
+		return res;
 	}
 
-	ctx->buf = g_byte_array_new();
-	g_byte_array_set_size(ctx->buf, conf->output_buffer);
+	if (0 == f->in->length && f->in->is_closed) {
+		job->op = DEFLATE_OP_FINISH;
+	} else if (0 == f->in->length) {
+		job->op = DEFLATE_OP_FLUSH;
+	} else {
+		job->op = DEFLATE_OP_PROCESS;
+	}
 
-	bz->next_out = (char*) ctx->buf->data;
-	bz->avail_out = ctx->buf->len;
+	ctx->total_in += job->data->len;
+	ctx->job_running = TRUE;
 
-	return ctx;
+	li_stream_acquire(&f->stream);
+	job->f = f;
+	job->out = li_chunkqueue_new();
+	li_tasklet_push(ctx->tasklets, deflate_offload_run, deflate_offload_finished, job);
+
+	return LI_HANDLER_WAIT_FOR_EVENT;
 }
 
-static void deflate_filter_bzip2_free(liVRequest *vr, liFilter *f) {
-	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) f->param;
-	UNUSED(vr);
+static liHandlerResult deflate_filter_finish(liVRequest *vr, liFilter *f) {
+	deflate_filter_context *ctx = f->param;
+
+	if (!ctx->encoder->compress(ctx->encoder_ctx, f->out, DEFLATE_OP_FINISH, NULL, 0, ctx->error)) {
+		f->out->is_closed = TRUE;
+		if (NULL != vr) VR_ERROR(vr, "%s", ctx->error->str);
+		return LI_HANDLER_ERROR;
+	}
+
+	if (NULL != vr && _OPTION(vr, ctx->conf.p, 0).boolean) {
+		VR_DEBUG(vr, "deflate finished: in: %" G_GUINT64_FORMAT ", out : %" G_GOFFSET_FORMAT, ctx->total_in, f->out->bytes_in);
+	}
 
-	deflate_context_bzip2_free(ctx);
+	f->out->is_closed = TRUE;
+	return LI_HANDLER_GO_ON;
 }
 
-static liHandlerResult deflate_filter_bzip2(liVRequest *vr, liFilter *f) {
-	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) f->param;
+static liHandlerResult deflate_filter_encode(liVRequest *vr, liFilter *f) {
+	deflate_filter_context *ctx = f->param;
 	const off_t blocksize = ctx->conf.blocksize;
 	const off_t max_compress = 4 * blocksize;
 	gboolean debug = (NULL != vr) && _OPTION(vr, ctx->conf.p, 0).boolean;
-	bz_stream *bz = &ctx->bz;
 	off_t l = 0;
 	liHandlerResult res;
-	int rc;
+
+	/* the filter disconnects a closed and empty source after this call; a running job
+	 * still needs to know it has to finish the stream afterwards */
+	if (NULL != f->in && f->in->is_closed) ctx->in_closed = TRUE;
+
+	if (ctx->job_running) {
+		/* deflate_offload_finished triggers the next call */
+		return LI_HANDLER_WAIT_FOR_EVENT;
+	}
+
+	if (ctx->failed) {
+		if (NULL != vr) VR_ERROR(vr, "%s", ctx->error->str);
+		f->out->is_closed = TRUE;
+		return LI_HANDLER_ERROR;
+	}
 
 	if (NULL == f->in) {
-		/* didn't handle f->in->is_closed? abort forwarding */
-		if (!f->out->is_closed) li_stream_reset(&f->stream);
+		if (f->out->is_closed) return LI_HANDLER_GO_ON;
+		/* input closed while an offloaded job had all of it */
+		if (ctx->in_closed) return deflate_filter_finish(vr, f);
+		/* source was reset: abort forwarding */
+		li_stream_reset(&f->stream);
 		return LI_HANDLER_GO_ON;
 	}
 
@@ -387,11 +829,17 @@ static liHandlerResult deflate_filter_bzip2(liVRequest *vr, liFilter *f) {
 		li_chunkqueue_skip_all(f->in);
 		li_stream_disconnect(&f->stream);
 		if (debug) {
-			VR_DEBUG(vr, "deflate out stream closed: in: %i, out : %i", (int) bz->total_in_lo32, (int) bz->total_out_lo32);
+			VR_DEBUG(vr, "deflate out stream closed: in: %" G_GUINT64_FORMAT ", out : %" G_GOFFSET_FORMAT, ctx->total_in, f->out->bytes_in);
 		}
 		return LI_HANDLER_GO_ON;
 	}
 
+	if (0 != ctx->conf.offload_threshold && (ctx->offload || f->in->length >= (goffset) ctx->conf.offload_threshold)) {
+		ctx->offload = TRUE;
+		if (f->in->length > 0 || f->in->is_closed) return deflate_offload(vr, f);
+		return LI_HANDLER_GO_ON;
+	}
+
 	while (l < max_compress) {
 		char *data;
 		off_t len;
@@ -410,62 +858,29 @@ static liHandlerResult deflate_filter_bzip2(liVRequest *vr, liFilter *f) {
 			return res;
 		}
 
-		bz->next_in = data;
-		bz->avail_in = len;
-
-		do {
-			rc = BZ2_bzCompress(bz, BZ_RUN);
-			if (rc != BZ_RUN_OK) {
-				f->out->is_closed = TRUE;
-				if (NULL != vr) VR_ERROR(vr, "BZ2_bzCompress error: rc = %i", rc);
-				return LI_HANDLER_ERROR;
-			}
-
-			if(bz->avail_out == 0 || bz->avail_in > 0) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-				bz->next_out = (char*) ctx->buf->data;
-				bz->avail_out = ctx->buf->len;
-			}
-		} while (bz->avail_in > 0);
+		if (!ctx->encoder->compress(ctx->encoder_ctx, f->out, DEFLATE_OP_PROCESS, data, len, ctx->error)) {
+			f->out->is_closed = TRUE;
+			if (NULL != vr) VR_ERROR(vr, "%s", ctx->error->str);
+			return LI_HANDLER_ERROR;
+		}
 
 		li_chunkqueue_skip(f->in, len);
+		ctx->total_in += len;
 		l += len;
 	}
 
 	if (0 == f->in->length && f->in->is_closed) {
-		do {
-			rc = BZ2_bzCompress(bz, BZ_FINISH);
-			if (rc != BZ_RUN_OK && rc != BZ_STREAM_END && rc != BZ_FINISH_OK) {
-				f->out->is_closed = TRUE;
-				if (NULL != vr) VR_ERROR(vr, "BZ2_bzCompress error: rc = %i", rc);
-				return LI_HANDLER_ERROR;
-			}
-
-			/* flush every time until done */
-			if (0 < ctx->buf->len - bz->avail_out) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-				bz->next_out = (char*) ctx->buf->data;
-				bz->avail_out = ctx->buf->len;
-			}
-		} while (rc == BZ_RUN_OK || rc == BZ_FINISH_OK);
-
-		if (debug) {
-			VR_DEBUG(vr, "deflate finished: in: %i, out : %i", (int) bz->total_in_lo32, (int) bz->total_out_lo32);
+		return deflate_filter_finish(vr, f);
+	} else if (l > 0 && 0 == f->in->length) {
+		/* no more data pending: flush encoder */
+		if (!ctx->encoder->compress(ctx->encoder_ctx, f->out, DEFLATE_OP_FLUSH, NULL, 0, ctx->error)) {
+			if (NULL != vr) VR_ERROR(vr, "%s", ctx->error->str);
+			return LI_HANDLER_ERROR;
 		}
-
-		f->out->is_closed = TRUE;
-	}
-
-	/* flush output buffer if there is no more data pending */
-	if (0 == f->in->length && 0 < ctx->buf->len - bz->avail_out) {
-		li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-		bz->next_out = (char*) ctx->buf->data;
-		bz->avail_out = ctx->buf->len;
 	}
 
 	return 0 == f->in->length ? LI_HANDLER_GO_ON : LI_HANDLER_COMEBACK;
 }
-#endif /* HAVE_BZIP */
 
 static liHandlerResult deflate_filter_null(liVRequest *vr, liFilter *f) {
 	UNUSED(vr);
@@ -478,6 +893,160 @@ static liHandlerResult deflate_filter_null(liVRequest *vr, liFilter *f) {
 
 /**********************************************************************************/
 
+static void deflate_cache_entry_free(deflate_cache_entry *entry) {
+	li_buffer_release(entry->data);
+	g_string_free(entry->key, TRUE);
+	g_slice_free(deflate_cache_entry, entry);
+}
+
+/* needs cache->lock */
+static void deflate_cache_remove(deflate_cache *cache, deflate_cache_entry *entry) {
+	g_queue_unlink(&cache->lru, &entry->lru_link);
+	g_hash_table_remove(cache->entries, entry->key);
+	cache->used -= entry->data->used;
+	deflate_cache_entry_free(entry);
+}
+
+static deflate_cache* deflate_cache_new(void) {
+	deflate_cache *cache = g_slice_new0(deflate_cache);
+	cache->lock = g_mutex_new();
+	cache->entries = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&cache->lru);
+	return cache;
+}
+
+static void deflate_cache_free(deflate_cache *cache) {
+	while (NULL != cache->lru.tail) deflate_cache_remove(cache, cache->lru.tail->data);
+	g_hash_table_destroy(cache->entries);
+	g_mutex_free(cache->lock);
+	g_slice_free(deflate_cache, cache);
+}
+
+/* single entries may only use a small part of the cache */
+static goffset deflate_cache_max_entry(deflate_cache *cache) {
+	return cache->limit / 8;
+}
+
+/* returns a new reference or NULL */
+static liBuffer* deflate_cache_get(deflate_cache *cache, GString *key) {
+	deflate_cache_entry *entry;
+	liBuffer *data = NULL;
+
+	g_mutex_lock(cache->lock);
+	if (NULL != (entry = g_hash_table_lookup(cache->entries, key))) {
+		data = entry->data;
+		li_buffer_acquire(data);
+		g_queue_unlink(&cache->lru, &entry->lru_link);
+		g_queue_push_head_link(&cache->lru, &entry->lru_link);
+	}
+	g_mutex_unlock(cache->lock);
+
+	return data;
+}
+
+static void deflate_cache_put(deflate_cache *cache, GString *key, GByteArray *content) {
+	deflate_cache_entry *entry;
+	liBuffer *data;
+
+	if (0 == content->len) return;
+
+	data = li_buffer_new_slice(content->len);
+	memcpy(data->addr, content->data, content->len);
+	data->used = content->len;
+
+	g_mutex_lock(cache->lock);
+	if ((goffset) data->used > deflate_cache_max_entry(cache)) {
+		g_mutex_unlock(cache->lock);
+		li_buffer_release(data);
+		return;
+	}
+	if (NULL != (entry = g_hash_table_lookup(cache->entries, key))) {
+		deflate_cache_remove(cache, entry);
+	}
+	while (cache->used + (goffset) data->used > cache->limit) {
+		deflate_cache_remove(cache, cache->lru.tail->data);
+	}
+
+	entry = g_slice_new0(deflate_cache_entry);
+	entry->key = g_string_new_len(GSTR_LEN(key));
+	entry->data = data;
+	entry->lru_link.data = entry;
+	g_queue_push_head_link(&cache->lru, &entry->lru_link);
+	g_hash_table_insert(cache->entries, entry->key, entry);
+	cache->used += data->used;
+	g_mutex_unlock(cache->lock);
+}
+
+static void deflate_cache_store_release(deflate_cache_store *store) {
+	g_string_free(store->key, TRUE);
+	if (NULL != store->data) g_byte_array_free(store->data, TRUE);
+	g_slice_free(deflate_cache_store, store);
+}
+
+static void deflate_filter_cache_store_free(liVRequest *vr, liFilter *f) {
+	UNUSED(vr);
+
+	deflate_cache_store_release(f->param);
+}
+
+/* forwards the compressed output and keeps a copy, which is put into the cache when complete */
+static liHandlerResult deflate_filter_cache_store(liVRequest *vr, liFilter *f) {
+	deflate_cache_store *store = f->param;
+
+	if (NULL == f->in) {
+		/* incomplete; abort forwarding */
+		if (!f->out->is_closed) li_stream_reset(&f->stream);
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (f->out->is_closed) {
+		li_chunkqueue_skip_all(f->in);
+		li_stream_disconnect(&f->stream);
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (NULL != store->data && f->in->length > 0) {
+		if ((goffset) store->data->len + f->in->length > deflate_cache_max_entry(store->cache)) {
+			g_byte_array_free(store->data, TRUE);
+			store->data = NULL;
+		} else {
+			liChunkIter ci = li_chunkqueue_iter(f->in);
+			do {
+				goffset chunk_len = li_chunkiter_length(ci), chunk_off = 0;
+
+				while (chunk_off < chunk_len) {
+					char *data;
+					off_t data_len;
+					GError *err = NULL;
+
+					if (LI_HANDLER_GO_ON != li_chunkiter_read(ci, chunk_off, chunk_len - chunk_off, &data, &data_len, &err)) {
+						if (NULL != err) {
+							if (NULL != vr) VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
+							g_error_free(err);
+						}
+						return LI_HANDLER_ERROR;
+					}
+					g_byte_array_append(store->data, (guint8*) data, data_len);
+					chunk_off += data_len;
+				}
+			} while (li_chunkiter_next(&ci));
+		}
+	}
+
+	li_chunkqueue_steal_all(f->out, f->in);
+
+	if (f->in->is_closed) {
+		f->out->is_closed = TRUE;
+		if (NULL != store->data) {
+			deflate_cache_put(store->cache, store->key, store->data);
+			g_byte_array_free(store->data, TRUE);
+			store->data = NULL;
+		}
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
 /* returns TRUE if handled with 304, FALSE otherwise */
 static gboolean cached_handle_etag(liVRequest *vr, gboolean debug, liHttpHeader *hh_etag, const char* enc_name) {
 	GString *s = vr->wrk->tmp_str;
@@ -506,20 +1075,126 @@ static guint header_to_encoding_mask(const gchar *s) {
 	guint encoding_mask = 0, i;
 
 	for (i = 1; encoding_names[i]; i++) {
-		const gchar *p = strstr(s, encoding_names[i]);
-		if (NULL != p && (p == s || p[-1] == ' ' || p[-1] == ',')) {
-			encoding_mask |= 1 << i;
+		const gchar *p;
+		gsize len = strlen(encoding_names[i]);
+
+		/* match whole tokens only: "gzip" not in "x-gzip", "br" not in "brotli" */
+		for (p = strstr(s, encoding_names[i]); NULL != p; p = strstr(p + 1, encoding_names[i])) {
+			if ((p == s || p[-1] == ' ' || p[-1] == ',')
+			    && ('\0' == p[len] || ',' == p[len] || ';' == p[len] || ' ' == p[len])) {
+				encoding_mask |= 1 << i;
+				break;
+			}
 		}
 	}
 
 	return encoding_mask;
 }
 
+/* parses a qvalue ("0.5", "1", "0.001") into thousandths */
+static guint parse_qvalue(const gchar *s) {
+	guint q, digits;
+
+	if ('0' == *s) q = 0;
+	else if ('1' == *s) q = 1000;
+	else return 1000; /* invalid, ignore */
+
+	if ('.' == *++s) {
+		for (s++, digits = 100; digits > 0 && g_ascii_isdigit(*s); s++, digits /= 10) {
+			q += (*s - '0') * digits;
+		}
+	}
+
+	return MIN(q, 1000);
+}
+
+/* q-values (in thousandths) of all encodings from the Accept-Encoding headers; 0 means not acceptable */
+static void request_encoding_qvalues(liVRequest *vr, guint qvalues[ENCODING_COUNT]) {
+	GList *hh_encoding_entry;
+	guint i, wildcard = 0;
+	gboolean listed[ENCODING_COUNT];
+
+	for (i = 0; i < ENCODING_COUNT; i++) {
+		qvalues[i] = 0;
+		listed[i] = FALSE;
+	}
+
+	hh_encoding_entry = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("accept-encoding"));
+	while (hh_encoding_entry) {
+		liHttpHeader *hh_encoding = (liHttpHeader*) hh_encoding_entry->data;
+		const gchar *s = LI_HEADER_VALUE(hh_encoding);
+
+		while ('\0' != *s) {
+			const gchar *name;
+			gsize name_len;
+			guint q = 1000;
+
+			while (' ' == *s || '\t' == *s || ',' == *s) s++;
+			if ('\0' == *s) break;
+
+			name = s;
+			while ('\0' != *s && ',' != *s && ';' != *s && ' ' != *s && '\t' != *s) s++;
+			name_len = s - name;
+
+			/* parameters */
+			while ('\0' != *s && ',' != *s) {
+				if (';' == *s++) {
+					while (' ' == *s || '\t' == *s) s++;
+					if (('q' == s[0] || 'Q' == s[0]) && '=' == s[1]) q = parse_qvalue(s + 2);
+				}
+			}
+
+			if (1 == name_len && '*' == name[0]) {
+				wildcard = q;
+				continue;
+			}
+
+			for (i = 1; i < ENCODING_COUNT; i++) {
+				if (strlen(encoding_names[i]) == name_len && 0 == g_ascii_strncasecmp(name, encoding_names[i], name_len)) {
+					qvalues[i] = q;
+					listed[i] = TRUE;
+				}
+			}
+		}
+
+		hh_encoding_entry = li_http_header_find_next(hh_encoding_entry, CONST_STR_LEN("accept-encoding"));
+	}
+
+	/* "*" applies to all encodings not listed explicitly */
+	for (i = 1; i < ENCODING_COUNT; i++) {
+		if (!listed[i]) qvalues[i] = wildcard;
+	}
+}
+
+/* NULL if the response can't be cached */
+static GString* deflate_cache_key(liVRequest *vr, deflate_config *config, liHttpHeader *hh_etag) {
+	deflate_cache *cache = config->p->data;
+	GString *key;
+
+	if (0 == cache->limit || NULL == hh_etag || 200 != vr->response.http_status) return NULL;
+
+	/* the etag already includes the encoding (see cached_handle_etag) */
+	key = g_string_sized_new(127);
+	li_string_append_int(key, config->compression_level);
+	g_string_append_c(key, ' ');
+	li_g_string_append_len(key, LI_HEADER_VALUE_LEN(hh_etag));
+	g_string_append_c(key, ' ');
+	li_g_string_append_len(key, GSTR_LEN(vr->request.uri.host));
+	li_g_string_append_len(key, GSTR_LEN(vr->request.uri.path));
+	if (vr->request.uri.query->len > 0) {
+		g_string_append_c(key, '?');
+		li_g_string_append_len(key, GSTR_LEN(vr->request.uri.query));
+	}
+
+	return key;
+}
+
 static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *context) {
 	deflate_config *config = (deflate_config*) param;
-	GList *hh_encoding_entry, *hh_etag_entry;
-	liHttpHeader *hh_encoding, *hh_etag = NULL;
-	guint encoding_mask = 0, i;
+	GList *hh_etag_entry;
+	liHttpHeader *hh_etag = NULL;
+	guint encoding_mask, i, j;
+	guint qvalues[ENCODING_COUNT];
 	gboolean debug = _OPTION(vr, config->p, 0).boolean;
 	gboolean is_head_request = (vr->request.http_method == LI_HTTP_METHOD_HEAD);
 
@@ -560,11 +1235,10 @@ static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *
 	/* announce that we have looked for accept-encoding */
 	li_http_header_append(vr->response.headers, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
 
-	hh_encoding_entry = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("accept-encoding"));
-	while (hh_encoding_entry) {
-		hh_encoding = (liHttpHeader*) hh_encoding_entry->data;
-		encoding_mask |= header_to_encoding_mask(LI_HEADER_VALUE(hh_encoding));
-		hh_encoding_entry = li_http_header_find_next(hh_encoding_entry, CONST_STR_LEN("accept-encoding"));
+	request_encoding_qvalues(vr, qvalues);
+
+	for (encoding_mask = 0, i = 1; i < ENCODING_COUNT; i++) {
+		if (qvalues[i] > 0) encoding_mask |= 1 << i;
 	}
 
 	if (0 == encoding_mask)
@@ -578,8 +1252,11 @@ static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *
 		return LI_HANDLER_GO_ON; /* no common encoding found */
 	}
 
-	/* find best encoding (first in list) */
-	for (i = 1; 0 == (encoding_mask & (1 << i)) ; i++) ;
+	/* find best encoding: highest q-value, ties broken by our preference */
+	for (i = 0, j = 0; j < G_N_ELEMENTS(encoding_preference); j++) {
+		encodings enc = encoding_preference[j];
+		if (0 != (encoding_mask & (1 << enc)) && (0 == i || qvalues[enc] > qvalues[i])) i = enc;
+	}
 
 	hh_etag_entry = li_http_header_find_first(vr->response.headers, CONST_STR_LEN("etag"));
 	if (hh_etag_entry) {
@@ -598,50 +1275,98 @@ static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *
 
 	switch ((encodings) i) {
 	case ENCODING_IDENTITY:
+	case ENCODING_COMPRESS:
 		return LI_HANDLER_GO_ON;
-	case ENCODING_BZIP2:
-	case ENCODING_X_BZIP2:
-#ifdef HAVE_BZIP
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_bzip2 *ctx;
-			ctx = deflate_context_bzip2_create(vr, config);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_bzip2, deflate_filter_bzip2_free, NULL, ctx);
-		}
+	default:
 		break;
-#endif
-		return LI_HANDLER_GO_ON;
-	case ENCODING_GZIP:
-	case ENCODING_X_GZIP:
-#ifdef HAVE_ZLIB
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_zlib *ctx;
-			ctx = deflate_context_zlib_create(vr, config, TRUE);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_zlib, deflate_filter_zlib_free, NULL, ctx);
+	}
+
+	if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
+
+	if (!is_head_request) {
+		gboolean compressing = FALSE;
+		const deflate_encoder *encoder = NULL;
+		gpointer encoder_ctx = NULL;
+		GString *cache_key = deflate_cache_key(vr, config, hh_etag);
+		liBuffer *cached = (NULL != cache_key) ? deflate_cache_get(config->p->data, cache_key) : NULL;
+
+		if (NULL != cached) {
+			/* reuse the result of an earlier compression */
+			liFilter *f = li_vrequest_add_filter_out(vr, deflate_filter_null, NULL, NULL, NULL);
+
+			g_string_free(cache_key, TRUE);
+			if (NULL == f) {
+				li_buffer_release(cached);
+				return LI_HANDLER_GO_ON;
+			}
+			if (debug) {
+				VR_DEBUG(vr, "deflate: using cached %s response", encoding_names[i]);
+			}
+
+			li_http_header_insert(vr->response.headers, CONST_STR_LEN("Content-Encoding"), encoding_names[i], strlen(encoding_names[i]));
+			li_http_header_remove(vr->response.headers, CONST_STR_LEN("content-length"));
+			li_chunkqueue_append_buffer(f->out, cached);
+			f->out->is_closed = TRUE;
+			return LI_HANDLER_GO_ON;
 		}
-		break;
+
+		switch ((encodings) i) {
+#ifdef HAVE_BZIP
+		case ENCODING_BZIP2:
+		case ENCODING_X_BZIP2:
+			encoder = &deflate_encoder_bzip2;
+			encoder_ctx = deflate_context_bzip2_create(vr, config);
+			break;
 #endif
-		return LI_HANDLER_GO_ON;
-	case ENCODING_DEFLATE:
 #ifdef HAVE_ZLIB
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_zlib *ctx;
-			ctx = deflate_context_zlib_create(vr, config, FALSE);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_zlib, deflate_filter_zlib_free, NULL, ctx);
-		}
-		break;
+		case ENCODING_GZIP:
+		case ENCODING_X_GZIP:
+		case ENCODING_DEFLATE:
+			encoder = &deflate_encoder_zlib;
+			encoder_ctx = deflate_context_zlib_create(vr, config, ENCODING_DEFLATE != i);
+			break;
 #endif
-		return LI_HANDLER_GO_ON;
-	case ENCODING_COMPRESS:
-		return LI_HANDLER_GO_ON;
-	}
+#ifdef HAVE_BROTLI
+		case ENCODING_BR:
+			encoder = &deflate_encoder_brotli;
+			encoder_ctx = deflate_context_brotli_create(vr, config);
+			break;
+#endif
+#ifdef HAVE_ZSTD
+		case ENCODING_ZSTD:
+			encoder = &deflate_encoder_zstd;
+			encoder_ctx = deflate_context_zstd_create(vr, config);
+			break;
+#endif
+		default:
+			break;
+		}
+
+		if (NULL != encoder_ctx) {
+			deflate_filter_context *ctx = deflate_filter_context_new(vr, config, encoder, encoder_ctx);
+			if (NULL != li_vrequest_add_filter_out(vr, deflate_filter_encode, deflate_filter_encode_free, NULL, ctx)) {
+				compressing = TRUE;
+			} else {
+				deflate_filter_context_free(ctx);
+			}
+		}
 
-	if (is_head_request) {
+		if (!compressing) {
+			if (NULL != cache_key) g_string_free(cache_key, TRUE);
+			return LI_HANDLER_GO_ON;
+		}
+
+		if (NULL != cache_key) {
+			/* keep a copy of the compressed output for the next request */
+			deflate_cache_store *store = g_slice_new0(deflate_cache_store);
+			store->cache = config->p->data;
+			store->key = cache_key;
+			store->data = g_byte_array_new();
+			if (NULL == li_vrequest_add_filter_out(vr, deflate_filter_cache_store, deflate_filter_cache_store_free, NULL, store)) {
+				deflate_cache_store_release(store);
+			}
+		}
+	} else {
 		/* kill content so response.c doesn't send wrong content-length */
 		liFilter *f = li_vrequest_add_filter_out(vr, deflate_filter_null, NULL, NULL, NULL);
 		f->out->is_closed = TRUE;
@@ -653,6 +1378,142 @@ static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *
 	return LI_HANDLER_GO_ON;
 }
 
+static liHandlerResult deflate_precompressed_handle(liVRequest *vr, gpointer param, gpointer *context) {
+	deflate_precompressed_config *config = param;
+	gboolean debug = _OPTION(vr, config->p, 0).boolean;
+	guint qvalues[ENCODING_COUNT];
+	guint order[G_N_ELEMENTS(precompressed_suffixes)], n = 0, i, k;
+	struct stat st, st_variant;
+	int err;
+	liHandlerResult res;
+	GString *variant;
+
+	UNUSED(context);
+
+	if (li_vrequest_is_handled(vr)) return LI_HANDLER_GO_ON;
+
+	if (LI_HTTP_METHOD_GET != vr->request.http_method && LI_HTTP_METHOD_HEAD != vr->request.http_method) return LI_HANDLER_GO_ON;
+
+	if (0 == vr->physical.path->len || '/' == vr->physical.path->str[vr->physical.path->len-1]) return LI_HANDLER_GO_ON;
+
+	/* candidates by q-value; equal q-values keep the order of precompressed_suffixes */
+	request_encoding_qvalues(vr, qvalues);
+	for (i = 0; i < G_N_ELEMENTS(precompressed_suffixes); i++) {
+		encodings enc = precompressed_suffixes[i].encoding;
+		if (0 == (config->allowed_encodings & (1 << enc)) || 0 == qvalues[enc]) continue;
+		for (k = n; k > 0 && qvalues[precompressed_suffixes[order[k-1]].encoding] < qvalues[enc]; k--) order[k] = order[k-1];
+		order[k] = i;
+		n++;
+	}
+	if (0 == n) return LI_HANDLER_GO_ON;
+
+	/* errors are left to the handler of the uncompressed file */
+	res = li_stat_cache_get(vr, vr->physical.path, &st, &err, NULL);
+	if (LI_HANDLER_GO_ON != res || !S_ISREG(st.st_mode)) {
+		return (LI_HANDLER_WAIT_FOR_EVENT == res) ? res : LI_HANDLER_GO_ON;
+	}
+
+	variant = g_string_sized_new(vr->physical.path->len + 4);
+
+	for (k = 0; k < n; k++) {
+		const precompressed_suffix *ps = &precompressed_suffixes[order[k]];
+		const gchar *enc_name = encoding_names[ps->encoding];
+		const GString *mime_str;
+		liChunkFile *cf = NULL;
+		gboolean cachable;
+
+		g_string_assign(variant, vr->physical.path->str);
+		g_string_append(variant, ps->suffix);
+
+		res = li_stat_cache_get(vr, variant, &st_variant, &err, NULL);
+		if (LI_HANDLER_WAIT_FOR_EVENT == res) goto out;
+		if (LI_HANDLER_GO_ON != res || !S_ISREG(st_variant.st_mode)) continue;
+
+		if (st_variant.st_mtime < st.st_mtime) {
+			if (debug) {
+				VR_DEBUG(vr, "deflate: ignoring outdated precompressed file '%s'", variant->str);
+			}
+			continue;
+		}
+
+		res = li_stat_cache_get_file(vr, variant, &st_variant, &err, &cf);
+		if (LI_HANDLER_WAIT_FOR_EVENT == res) goto out;
+		if (LI_HANDLER_GO_ON != res || NULL == cf) continue;
+
+		if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "deflate: serving precompressed file '%s'", variant->str);
+		}
+
+		if (!li_vrequest_handle_direct(vr)) {
+			li_chunkfile_release(cf);
+			res = LI_HANDLER_ERROR;
+			goto out;
+		}
+
+		li_http_header_append(vr->response.headers, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
+
+		/* the etag of the compressed file differs from the one of the uncompressed file */
+		li_etag_set_header(vr, &st_variant, &cachable);
+		if (cachable) {
+			vr->response.http_status = 304;
+			li_chunkfile_release(cf);
+			res = LI_HANDLER_GO_ON;
+			goto out;
+		}
+
+		mime_str = li_mimetype_get(vr, vr->physical.path);
+		if (NULL != mime_str) {
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
+		} else {
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/octet-stream"));
+		}
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Encoding"), enc_name, strlen(enc_name));
+
+		vr->response.http_status = 200;
+		li_chunkqueue_append_chunkfile(vr->direct_out, cf, 0, st_variant.st_size);
+		li_chunkfile_release(cf);
+		break;
+	}
+
+	res = LI_HANDLER_GO_ON;
+
+out:
+	g_string_free(variant, TRUE);
+	return res;
+}
+
+static void deflate_precompressed_free(liServer *srv, gpointer param) {
+	UNUSED(srv);
+
+	g_slice_free(deflate_precompressed_config, param);
+}
+
+static liAction* deflate_precompressed_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	deflate_precompressed_config *config;
+	guint allowed_encodings = precompressed_available_mask;
+	UNUSED(wrk); UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (NULL != val) {
+		if (LI_VALUE_STRING != li_value_type(val)) {
+			ERROR(srv, "%s", "deflate.precompressed expects an optional string (list of encodings) as parameter");
+			return NULL;
+		}
+		allowed_encodings = header_to_encoding_mask(val->data.string->str) & precompressed_available_mask;
+		if (0 == allowed_encodings) {
+			ERROR(srv, "deflate.precompressed: no supported encoding in '%s' (supported: br, zstd, gzip)", val->data.string->str);
+			return NULL;
+		}
+	}
+
+	config = g_slice_new0(deflate_precompressed_config);
+	config->p = p;
+	config->allowed_encodings = allowed_encodings;
+
+	return li_action_new_function(deflate_precompressed_handle, NULL, deflate_precompressed_free, config);
+}
+
 static void deflate_free(liServer *srv, gpointer param) {
 	deflate_config *conf = (deflate_config*) param;
 	UNUSED(srv);
@@ -665,7 +1526,8 @@ static const GString
 	don_encodings = { CONST_STR_LEN("encodings"), 0 },
 	don_blocksize = { CONST_STR_LEN("blocksize"), 0 },
 	don_outputbuffer = { CONST_STR_LEN("output-buffer"), 0 },
-	don_compression_level = { CONST_STR_LEN("compression-level"), 0 }
+	don_compression_level = { CONST_STR_LEN("compression-level"), 0 },
+	don_offload_threshold = { CONST_STR_LEN("offload-threshold"), 0 }
 ;
 
 static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
@@ -674,7 +1536,8 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 		have_encodings_parameter = FALSE,
 		have_blocksize_parameter = FALSE,
 		have_outputbuffer_parameter = FALSE,
-		have_compression_level_parameter = FALSE;
+		have_compression_level_parameter = FALSE,
+		have_offload_threshold_parameter = FALSE;
 	UNUSED(wrk); UNUSED(userdata);
 
 	val = li_value_get_single_argument(val);
@@ -690,6 +1553,7 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 	conf->blocksize = 16*1024;
 	conf->output_buffer = 4*1024;
 	conf->compression_level = 1;
+	conf->offload_threshold = 256*1024;
 
 	LI_VALUE_FOREACH(entry, val)
 		liValue *entryKey = li_value_list_at(entry, 0);
@@ -746,6 +1610,17 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 			}
 			have_compression_level_parameter = TRUE;
 			conf->compression_level = entryValue->data.number;
+		} else if (g_string_equal(entryKeyStr, &don_offload_threshold)) {
+			if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number < 0 || entryValue->data.number > G_MAXUINT) {
+				ERROR(srv, "deflate option '%s' expects non-negative integer as parameter", entryKeyStr->str);
+				goto option_failed;
+			}
+			if (have_offload_threshold_parameter) {
+				ERROR(srv, "duplicate deflate option '%s'", entryKeyStr->str);
+				goto option_failed;
+			}
+			have_offload_threshold_parameter = TRUE;
+			conf->offload_threshold = entryValue->data.number;
 		} else {
 			ERROR(srv, "unknown option for deflate '%s'", entryKeyStr->str);
 			goto option_failed;
@@ -765,22 +1640,52 @@ static const liPluginOption options[] = {
 	{ NULL, 0, 0, NULL }
 };
 
+static gboolean deflate_setup_cache_size(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	deflate_cache *cache = p->data;
+	UNUSED(userdata);
+
+	val = li_value_get_single_argument(val);
+
+	if (LI_VALUE_NUMBER != li_value_type(val) || val->data.number < 0) {
+		ERROR(srv, "%s", "deflate.cache_size expects a non-negative number (size in bytes, 0 disables the cache) as parameter");
+		return FALSE;
+	}
+
+	g_mutex_lock(cache->lock);
+	cache->limit = val->data.number;
+	while (cache->used > cache->limit) deflate_cache_remove(cache, cache->lru.tail->data);
+	g_mutex_unlock(cache->lock);
+
+	return TRUE;
+}
+
 static const liPluginAction actions[] = {
 	{ "deflate", deflate_create, NULL },
+	{ "deflate.precompressed", deflate_precompressed_create, NULL },
 	{ NULL, NULL, NULL }
 };
 
 static const liPluginSetup setups[] = {
+	{ "deflate.cache_size", deflate_setup_cache_size, NULL },
 	{ NULL, NULL, NULL }
 };
 
 
+static void plugin_deflate_free(liServer *srv, liPlugin *p) {
+	UNUSED(srv);
+
+	deflate_cache_free(p->data);
+}
+
 static void plugin_init(liServer *srv, liPlugin *p, gpointer userdata) {
 	UNUSED(srv); UNUSED(userdata);
 
 	p->options = options;
 	p->actions = actions;
 	p->setups = setups;
+	p->free = plugin_deflate_free;
+
+	p->data = deflate_cache_new();
 }
 
 gboolean mod_deflate_init(liModules *mods, liModule *mod) {
@@ -2,7 +2,6 @@
  * mod_fastcgi - connect to fastcgi backends for generating response content
  *
  * Todo:
- *     - reuse fastcgi connections (keepalive)
  *     - option for alternative doc-root?
  *
  * Author:
@@ -34,6 +33,13 @@ struct fastcgi_context {
 	GString *socket_str;
 };
 
+typedef struct fastcgi_request fastcgi_request;
+
+struct fastcgi_request {
+	liFastCGIBackendWait *bwait;
+	liFastCGIBackendConnection *bcon; /* request sent, waiting for the response */
+};
+
 static void fastcgi_context_release(fastcgi_context *ctx) {
 	if (!ctx) return;
 	LI_FORCE_ASSERT(g_atomic_int_get(&ctx->refcount) > 0);
@@ -86,12 +92,22 @@ static const liFastCGIBackendCallbacks fcgi_callbacks = {
 };
 
 
+static void fastcgi_request_free(liVRequest *vr, fastcgi_context *ctx, fastcgi_request *freq) {
+	if (NULL != freq->bwait) {
+		li_fastcgi_backend_wait_stop(vr, ctx->pool, &freq->bwait);
+	}
+	if (NULL != freq->bcon) {
+		li_fastcgi_backend_response_wait_stop(&freq->bcon);
+	}
+	g_slice_free(fastcgi_request, freq);
+}
+
 static liHandlerResult fastcgi_handle_abort(liVRequest *vr, gpointer param, gpointer context) {
 	fastcgi_context *ctx = (fastcgi_context*) param;
-	liFastCGIBackendWait *bwait = context;
+	fastcgi_request *freq = context;
 
-	if (bwait != NULL) {
-		li_fastcgi_backend_wait_stop(vr, ctx->pool, &bwait);
+	if (freq != NULL) {
+		fastcgi_request_free(vr, ctx, freq);
 	}
 
 	return LI_HANDLER_GO_ON;
@@ -99,7 +115,7 @@ static liHandlerResult fastcgi_handle_abort(liVRequest *vr, gpointer param, gpoi
 
 static liHandlerResult fastcgi_handle(liVRequest *vr, gpointer param, gpointer *context) {
 	fastcgi_context *ctx = (fastcgi_context*) param;
-	liFastCGIBackendWait *bwait = *context;
+	fastcgi_request *freq = *context;
 	liFastCGIBackendConnection *bcon;
 	liBackendResult bres;
 
@@ -107,21 +123,32 @@ static liHandlerResult fastcgi_handle(liVRequest *vr, gpointer param, gpointer *
 
 	LI_VREQUEST_WAIT_FOR_REQUEST_BODY(vr);
 
-	bres = li_fastcgi_backend_get(vr, ctx->pool, &bcon, &bwait);
-	*context = bwait;
+	if (NULL == freq) {
+		freq = g_slice_new0(fastcgi_request);
+		*context = freq;
+	}
+
+	bres = li_fastcgi_backend_get(vr, ctx->pool, &freq->bcon, &freq->bwait);
 	switch (bres) {
 	case LI_BACKEND_SUCCESS:
-		LI_FORCE_ASSERT(NULL == bwait);
-		LI_FORCE_ASSERT(NULL != bcon);
+		LI_FORCE_ASSERT(NULL == freq->bwait);
+		LI_FORCE_ASSERT(NULL != freq->bcon);
 		break;
 	case LI_BACKEND_WAIT:
-		LI_FORCE_ASSERT(NULL != bwait);
+		LI_FORCE_ASSERT(NULL != freq->bwait || NULL != freq->bcon);
 		return LI_HANDLER_WAIT_FOR_EVENT;
 	case LI_BACKEND_TIMEOUT:
+		*context = NULL;
+		fastcgi_request_free(vr, ctx, freq);
 		li_vrequest_backend_dead(vr);
 		return LI_HANDLER_GO_ON;
 	}
 
+	bcon = freq->bcon;
+	freq->bcon = NULL;
+	*context = NULL;
+	fastcgi_request_free(vr, ctx, freq);
+
 	fastcgi_context_acquire(ctx);
 
 	bcon->data = ctx;
@@ -24,7 +24,7 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 	gboolean cachable;
 	struct stat st;
 	int err;
-	int fd = -1;
+	liChunkFile *cf = NULL;
 
 	UNUSED(context);
 	UNUSED(param);
@@ -32,7 +32,7 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 	if (li_vrequest_is_handled(vr))
 		return LI_HANDLER_GO_ON;
 
-	res = li_stat_cache_get(vr, vr->physical.path, &st, &err, &fd);
+	res = li_stat_cache_get_file(vr, vr->physical.path, &st, &err, &cf);
 
 	if (res == LI_HANDLER_WAIT_FOR_EVENT)
 		return res;
@@ -40,9 +40,6 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 	if (res == LI_HANDLER_ERROR) {
 		/* open or fstat failed */
 
-		if (fd != -1)
-			close(fd);
-
 		if (!li_vrequest_handle_direct(vr))
 			return LI_HANDLER_ERROR;
 
@@ -63,23 +60,15 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 			return LI_HANDLER_GO_ON;
 		}
 	} else if (S_ISDIR(st.st_mode)) {
-		if (fd != -1)
-			close(fd);
-
 		return LI_HANDLER_GO_ON;
 	} else if (!S_ISREG(st.st_mode)) {
-		if (fd != -1)
-			close(fd);
-
 		if (!li_vrequest_handle_direct(vr))
 			return LI_HANDLER_ERROR;
 
 		vr->response.http_status = 403;
 	} else {
-		liChunkFile *cf;
-
 		if (!li_vrequest_handle_direct(vr)) {
-			close(fd);
+			li_chunkfile_release(cf);
 			return LI_HANDLER_ERROR;
 		}
 
@@ -100,7 +89,7 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 		li_etag_set_header(vr, &st, &cachable);
 		if (cachable) {
 			vr->response.http_status = 304;
-			close(fd);
+			li_chunkfile_release(cf);
 			return LI_HANDLER_GO_ON;
 		}
 
@@ -114,7 +103,6 @@ static liHandlerResult flv(liVRequest *vr, gpointer param, gpointer *context) {
 		if (pos != 0)
 			li_chunkqueue_append_mem(vr->direct_out, CONST_STR_LEN("FLV\x1\x1\0\0\0\x9\0\0\0\x9"));
 
-		cf = li_chunkfile_new(NULL, fd, FALSE);
 		li_chunkqueue_append_chunkfile(vr->direct_out, cf, pos, st.st_size - pos);
 		li_chunkfile_release(cf);
 	}
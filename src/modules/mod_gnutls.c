@@ -82,6 +82,7 @@ struct mod_context {
 	GString *pin;
 
 	unsigned int protect_against_beast:1;
+	unsigned int http2:1; /* offer "h2" with ALPN */
 };
 
 #ifdef USE_SNI
@@ -346,6 +347,9 @@ static void tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 
 	li_connection_simple_tcp(&conctx->con, stream, &conctx->simple_socket_state, event);
 
+	/* HTTP/1 responses get flushed below; upgraded and HTTP/2 connections don't know where a response ends */
+	li_stream_simple_socket_cork_until_flush(stream, NULL != conctx->con && conctx->con->state < LI_CON_STATE_UPGRADED);
+
 	if (NULL != conctx->con && conctx->con->out_has_all_data
 	    && (NULL == stream->stream_out.out || 0 == stream->stream_out.out->length)
 	    && li_streams_empty(conctx->con->con_sock.raw_out, NULL)) {
@@ -372,8 +376,19 @@ static void handshake_cb(liGnuTLSFilter *f, gpointer data, liStream *plain_sourc
 	UNUSED(f);
 
 	if (NULL != con) {
+#ifdef GNUTLS_ALPN_MAND
+		gnutls_datum_t alpn;
+#endif
+
 		li_stream_connect(plain_source, con->con_sock.raw_in);
 		li_stream_connect(con->con_sock.raw_out, plain_drain);
+
+#ifdef GNUTLS_ALPN_MAND
+		if (GNUTLS_E_SUCCESS == gnutls_alpn_get_selected_protocol(conctx->session, &alpn)
+		    && 2 == alpn.size && 0 == memcmp(alpn.data, "h2", 2) && LI_CON_STATE_REQUEST_START == con->state) {
+			li_connection_http2_start(con);
+		}
+#endif
 	} else {
 		li_stream_reset(plain_source);
 		li_stream_reset(plain_drain);
@@ -586,8 +601,15 @@ static gboolean mod_gnutls_con_new(liConnection *con, int fd) {
 
 #ifdef GNUTLS_ALPN_MAND
 	{
-		static const gnutls_datum_t proto_http1 = { (unsigned char*) CONST_STR_LEN("http/1.1") };
-		gnutls_alpn_set_protocols(session, &proto_http1, 1, 0);
+		static const gnutls_datum_t protos[] = {
+			{ (unsigned char*) CONST_STR_LEN("h2") },
+			{ (unsigned char*) CONST_STR_LEN("http/1.1") }
+		};
+		if (ctx->http2) {
+			gnutls_alpn_set_protocols(session, protos, 2, GNUTLS_ALPN_SERVER_PRECEDENCE);
+		} else {
+			gnutls_alpn_set_protocols(session, &protos[1], 1, 0);
+		}
 	}
 #endif
 
@@ -749,12 +771,14 @@ static gboolean gnutls_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 	gboolean have_pemfile_parameter = FALSE;
 	gboolean have_protect_beast_parameter = FALSE;
 	gboolean have_session_db_size_parameter = FALSE;
+	gboolean have_http2_parameter = FALSE;
 	const char *priority = NULL, *dh_params_file = NULL;
 #ifdef USE_SNI
 	const char *sni_backend = NULL;
 	liValue *sni_fallback_pemfile = NULL;
 #endif
 	gboolean protect_against_beast = FALSE;
+	gboolean http2 = FALSE;
 	gint64 session_db_size = 256;
 #if defined(HAVE_PIN)
 	liValue *pin = NULL;
@@ -846,6 +870,23 @@ static gboolean gnutls_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 			}
 			have_session_db_size_parameter = TRUE;
 			session_db_size = entryValue->data.number;
+		} else if (g_str_equal(entryKeyStr->str, "http2")) {
+			if (LI_VALUE_BOOLEAN != li_value_type(entryValue)) {
+				ERROR(srv, "%s", "gnutls http2 expects a boolean as parameter");
+				return FALSE;
+			}
+			if (have_http2_parameter) {
+				ERROR(srv, "gnutls unexpected duplicate parameter %s", entryKeyStr->str);
+				return FALSE;
+			}
+			have_http2_parameter = TRUE;
+			http2 = entryValue->data.boolean;
+#ifndef GNUTLS_ALPN_MAND
+			if (http2) {
+				ERROR(srv, "%s", "mod_gnutls: http2 not supported; compile with gnutls >= 3.2.0 (ALPN)");
+				return FALSE;
+			}
+#endif
 #ifdef USE_SNI
 		} else if (g_str_equal(entryKeyStr->str, "sni-backend")) {
 			if (LI_VALUE_STRING != li_value_type(entryValue)) {
@@ -891,6 +932,7 @@ static gboolean gnutls_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 	if (!(ctx = mod_gnutls_context_new(srv))) return FALSE;
 
 	ctx->protect_against_beast = protect_against_beast;
+	ctx->http2 = http2;
 
 #if defined(HAVE_PIN)
 	ctx->pin = li_value_extract_string(pin);
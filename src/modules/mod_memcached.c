@@ -1,8 +1,8 @@
 /*
  * mod_memcached - cache content on memcached servers
  *
- * Todo:
- *  - store/lookup headers too
+ * With "headers" => true the status and a selected set of response headers are stored in front of the body
+ * (see mc_store_headers), and the item is marked with MC_FLAG_HEADERS.
  *
  * Author:
  *     Copyright (c) 2010 Stefan Bühler
@@ -26,8 +26,9 @@ struct memcached_ctx {
 	int refcount;
 	liServer *srv;
 
-	liMemcachedCon **worker_client_ctx;
-	liSocketAddress addr;
+	liMemcachedCluster **worker_client_ctx;
+	GArray *addrs; /* liSocketAddress */
+	guint connections; /* per server and worker */
 	liPattern *pattern;
 	guint flags;
 	li_tstamp ttl;
@@ -48,6 +49,7 @@ struct memcached_config {
 typedef struct {
 	liMemcachedRequest *req;
 	liBuffer *buffer;
+	guint32 flags;
 	liVRequest *vr;
 } memcache_request;
 
@@ -59,6 +61,7 @@ typedef struct {
 /* memcache option names */
 static const GString
 	mon_server = { CONST_STR_LEN("server"), 0 },
+	mon_connections = { CONST_STR_LEN("connections"), 0 },
 	mon_flags = { CONST_STR_LEN("flags"), 0 },
 	mon_ttl = { CONST_STR_LEN("ttl"), 0 },
 	mon_maxsize = { CONST_STR_LEN("maxsize"), 0 },
@@ -66,11 +69,61 @@ static const GString
 	mon_key = { CONST_STR_LEN("key"), 0 }
 ;
 
+/* item flag for the serialized response format:
+ *   "<status>\n", one "<name>: <value>\n" line per stored header, an empty line "\n", then the body
+ */
+#define MC_FLAG_HEADERS 0x80000000u
+
+/* response headers stored with "headers" => true; all others are either specific to the original response
+ * (Set-Cookie, Date, ...), connection specific or regenerated anyway (Content-Length)
+ */
+static const GString mc_stored_headers[] = {
+	{ CONST_STR_LEN("Cache-Control"), 0 },
+	{ CONST_STR_LEN("Content-Disposition"), 0 },
+	{ CONST_STR_LEN("Content-Language"), 0 },
+	{ CONST_STR_LEN("Content-Location"), 0 },
+	{ CONST_STR_LEN("Content-Type"), 0 },
+	{ CONST_STR_LEN("ETag"), 0 },
+	{ CONST_STR_LEN("Expires"), 0 },
+	{ CONST_STR_LEN("Last-Modified"), 0 },
+	{ CONST_STR_LEN("Link"), 0 },
+	{ CONST_STR_LEN("Vary"), 0 },
+	{ NULL, 0, 0 }
+};
+
 static void mc_ctx_acquire(memcached_ctx* ctx) {
 	LI_FORCE_ASSERT(g_atomic_int_get(&ctx->refcount) > 0);
 	g_atomic_int_inc(&ctx->refcount);
 }
 
+/* server is a socket address or a list of them */
+static gboolean mc_ctx_parse_servers(liServer *srv, memcached_ctx *ctx, liValue *val, const char *actname) {
+	if (LI_VALUE_STRING == li_value_type(val)) {
+		liSocketAddress addr = li_sockaddr_from_string(val->data.string, 11211);
+		if (NULL == addr.addr_up.raw) {
+			ERROR(srv, "invalid socket address: '%s'", val->data.string->str);
+			return FALSE;
+		}
+		g_array_append_val(ctx->addrs, addr);
+		return TRUE;
+	}
+
+	if (LI_VALUE_LIST != li_value_type(val) || li_value_list_has_len(val, 0)) {
+		ERROR(srv, "%s option 'server' expects string or non-empty list of strings as parameter", actname);
+		return FALSE;
+	}
+
+	LI_VALUE_FOREACH(entry, val)
+		if (LI_VALUE_STRING != li_value_type(entry)) {
+			ERROR(srv, "%s option 'server' expects string or non-empty list of strings as parameter", actname);
+			return FALSE;
+		}
+		if (!mc_ctx_parse_servers(srv, ctx, entry, actname)) return FALSE;
+	LI_VALUE_END_FOREACH()
+
+	return TRUE;
+}
+
 /* not every context has srv ready, extract from context instead */
 static void mc_ctx_release(liServer *_srv, gpointer param) {
 	memcached_ctx *ctx = param;
@@ -86,12 +139,15 @@ static void mc_ctx_release(liServer *_srv, gpointer param) {
 
 	if (ctx->worker_client_ctx) {
 		for (i = 0; i < srv->worker_count; i++) {
-			li_memcached_con_release(ctx->worker_client_ctx[i]);
+			li_memcached_cluster_free(ctx->worker_client_ctx[i]);
 		}
-		g_slice_free1(sizeof(liMemcachedCon*) * srv->worker_count, ctx->worker_client_ctx);
+		g_slice_free1(sizeof(liMemcachedCluster*) * srv->worker_count, ctx->worker_client_ctx);
 	}
 
-	li_sockaddr_clear(&ctx->addr);
+	for (i = 0; i < ctx->addrs->len; i++) {
+		li_sockaddr_clear(&g_array_index(ctx->addrs, liSocketAddress, i));
+	}
+	g_array_free(ctx->addrs, TRUE);
 
 	li_pattern_free(ctx->pattern);
 
@@ -114,6 +170,7 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config,
 	GString def_server = li_const_gstring(CONST_STR_LEN("127.0.0.1:11211"));
 	gboolean
 		have_server_parameter = FALSE,
+		have_connections_parameter = FALSE,
 		have_flags_parameter = FALSE,
 		have_ttl_parameter = FALSE,
 		have_maxsize_parameter = FALSE,
@@ -125,7 +182,8 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config,
 	ctx->refcount = 1;
 	ctx->p = p;
 
-	ctx->addr = li_sockaddr_from_string(&def_server, 11211);
+	ctx->addrs = g_array_new(FALSE, FALSE, sizeof(liSocketAddress));
+	ctx->connections = 2;
 
 	ctx->pattern = li_pattern_new(srv, "%{req.path}");
 
@@ -146,21 +204,23 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config,
 		entryKeyStr = entryKey->data.string; /* keys are either NONE or STRING */
 
 		if (g_string_equal(entryKeyStr, &mon_server)) {
-			if (LI_VALUE_STRING != li_value_type(entryValue)) {
-				ERROR(srv, "%s option '%s' expects string as parameter", actname, entryKeyStr->str);
-				goto option_failed;
-			}
 			if (have_server_parameter) {
 				ERROR(srv, "duplicate %s option '%s'", actname, entryKeyStr->str);
 				goto option_failed;
 			}
 			have_server_parameter = TRUE;
-			li_sockaddr_clear(&ctx->addr);
-			ctx->addr = li_sockaddr_from_string(entryValue->data.string, 11211);
-			if (NULL == ctx->addr.addr_up.raw) {
-				ERROR(srv, "invalid socket address: '%s'", entryValue->data.string->str);
+			if (!mc_ctx_parse_servers(srv, ctx, entryValue, actname)) goto option_failed;
+		} else if (g_string_equal(entryKeyStr, &mon_connections)) {
+			if (LI_VALUE_NUMBER != li_value_type(entryValue) || entryValue->data.number <= 0 || entryValue->data.number > 64) {
+				ERROR(srv, "%s option '%s' expects integer between 1 and 64 as parameter", actname, entryKeyStr->str);
+				goto option_failed;
+			}
+			if (have_connections_parameter) {
+				ERROR(srv, "duplicate %s option '%s'", actname, entryKeyStr->str);
 				goto option_failed;
 			}
+			have_connections_parameter = TRUE;
+			ctx->connections = entryValue->data.number;
 		} else if (g_string_equal(entryKeyStr, &mon_key)) {
 			if (LI_VALUE_STRING != li_value_type(entryValue)) {
 				ERROR(srv, "%s option '%s' expects string as parameter", actname, entryKeyStr->str);
@@ -221,18 +281,24 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config,
 			}
 			have_headers_parameter = TRUE;
 			ctx->headers = entryValue->data.boolean;
-			if (ctx->headers) {
-				ERROR(srv, "%s: lookup/storing headers not supported yet", actname);
-				goto option_failed;
-			}
 		} else {
 			ERROR(srv, "unknown option for %s '%s'", actname, entryKeyStr->str);
 			goto option_failed;
 		}
 	LI_VALUE_END_FOREACH()
 
+	if (ctx->headers && 0 != (ctx->flags & MC_FLAG_HEADERS)) {
+		ERROR(srv, "%s: flag 0x%x is reserved for storing headers", actname, MC_FLAG_HEADERS);
+		goto option_failed;
+	}
+
+	if (0 == ctx->addrs->len) {
+		liSocketAddress addr = li_sockaddr_from_string(&def_server, 11211);
+		g_array_append_val(ctx->addrs, addr);
+	}
+
 	if (LI_SERVER_INIT != g_atomic_int_get(&srv->state)) {
-		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCon*) * srv->worker_count);
+		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCluster*) * srv->worker_count);
 	} else {
 		ctx->mconf_link.data = ctx;
 		g_queue_push_tail_link(&mconf->prepare_ctx, &ctx->mconf_link);
@@ -259,15 +325,81 @@ static void mc_ctx_build_key(GString *dest, memcached_ctx *ctx, liVRequest *vr)
 	li_memcached_mutate_key(dest);
 }
 
-static liMemcachedCon* mc_ctx_prepare(memcached_ctx *ctx, liWorker *wrk) {
-	liMemcachedCon *con = ctx->worker_client_ctx[wrk->ndx];
+static liMemcachedCluster* mc_ctx_prepare(memcached_ctx *ctx, liWorker *wrk) {
+	liMemcachedCluster *cluster = ctx->worker_client_ctx[wrk->ndx];
+
+	if (!cluster) {
+		cluster = li_memcached_cluster_new(&wrk->loop, (liSocketAddress*) ctx->addrs->data, ctx->addrs->len, ctx->connections);
+		ctx->worker_client_ctx[wrk->ndx] = cluster;
+	}
+
+	return cluster;
+}
+
+static gboolean mc_buffer_append(liBuffer *buf, const gchar *data, gsize len) {
+	if (len > buf->alloc_size - buf->used) return FALSE;
+	memcpy(buf->addr + buf->used, data, len);
+	buf->used += len;
+	return TRUE;
+}
+
+/* writes status and stored headers in the MC_FLAG_HEADERS format; returns FALSE if they don't fit into buf */
+static gboolean mc_store_headers(liVRequest *vr, liBuffer *buf) {
+	gint st = vr->response.http_status;
+	gchar status[4];
+	GList *l;
+	guint i;
+
+	status[0] = '0' + (st / 100) % 10;
+	status[1] = '0' + (st / 10) % 10;
+	status[2] = '0' + st % 10;
+	status[3] = '\n';
+	if (!mc_buffer_append(buf, status, sizeof(status))) return FALSE;
+
+	for (l = g_queue_peek_head_link(&vr->response.headers->entries); NULL != l; l = g_list_next(l)) {
+		liHttpHeader *h = (liHttpHeader*) l->data;
+
+		for (i = 0; NULL != mc_stored_headers[i].str; i++) {
+			if (li_http_header_key_is(h, GSTR_LEN(&mc_stored_headers[i]))) break;
+		}
+		if (NULL == mc_stored_headers[i].str) continue;
+		if (NULL != memchr(h->data->str, '\n', h->data->len)) continue; /* can't be represented */
+
+		/* h->data is "<name>: <value>" already */
+		if (!mc_buffer_append(buf, GSTR_LEN(h->data)) || !mc_buffer_append(buf, CONST_STR_LEN("\n"))) return FALSE;
+	}
+
+	return mc_buffer_append(buf, CONST_STR_LEN("\n"));
+}
+
+/* validates the MC_FLAG_HEADERS format; returns the offset of the body, or 0 if buf is invalid */
+static gsize mc_parse_headers(liBuffer *buf, guint *status) {
+	const gchar *s = buf->addr, *end = buf->addr + buf->used, *eol, *colon;
 
-	if (!con) {
-		con = li_memcached_con_new(&wrk->loop, ctx->addr);
-		ctx->worker_client_ctx[wrk->ndx] = con;
+	if (buf->used < 5 || !g_ascii_isdigit(s[0]) || !g_ascii_isdigit(s[1]) || !g_ascii_isdigit(s[2]) || '\n' != s[3]) return 0;
+	*status = (s[0] - '0') * 100 + (s[1] - '0') * 10 + (s[2] - '0');
+	if (*status < 200) return 0;
+
+	for (s += 4; s < end; s = eol + 1) {
+		if (NULL == (eol = memchr(s, '\n', end - s))) return 0;
+		if (eol == s) return eol + 1 - buf->addr; /* empty line: end of headers */
+
+		colon = memchr(s, ':', eol - s);
+		if (NULL == colon || colon == s || eol - colon < 2 || ' ' != colon[1]) return 0;
 	}
 
-	return con;
+	return 0;
+}
+
+/* adds the headers validated by mc_parse_headers */
+static void mc_restore_headers(liVRequest *vr, liBuffer *buf, gsize body_offset) {
+	const gchar *s = buf->addr + 4, *end = buf->addr + body_offset - 1, *eol, *colon;
+
+	for ( ; s < end; s = eol + 1) {
+		eol = memchr(s, '\n', end - s);
+		colon = memchr(s, ':', eol - s);
+		li_http_header_insert(vr->response.headers, s, colon - s, colon + 2, eol - (colon + 2));
+	}
 }
 
 static void memcache_callback(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
@@ -286,6 +418,7 @@ static void memcache_callback(liMemcachedRequest *request, liMemcachedResult res
 	case LI_MEMCACHED_OK: /* STORED, VALUE, DELETED */
 		/* steal buffer */
 		req->buffer = item->data;
+		req->flags = item->flags;
 		item->data = NULL;
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "memcached.lookup: key '%s' found, flags = %u", item->key->str, (guint) item->flags);
@@ -325,9 +458,18 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 
 		liBuffer *buf = req->buffer;
 		const GString *mime_str;
+		gsize body_offset = 0;
+		guint status = 200;
+		gboolean restore;
 
 		if (NULL != req->req) return LI_HANDLER_WAIT_FOR_EVENT; /* not done yet */
 
+		if (NULL != buf && 0 != (req->flags & MC_FLAG_HEADERS) && 0 == (body_offset = mc_parse_headers(buf, &status))) {
+			VR_ERROR(vr, "%s", "memcached.lookup: invalid stored response, ignoring it");
+			li_buffer_release(buf);
+			buf = NULL;
+		}
+
 		g_slice_free(memcache_request, req);
 		*context = NULL;
 
@@ -349,19 +491,37 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 			VR_DEBUG(vr, "%s", "memcached.lookup: key found, handling request");
 		}
 
-		li_chunkqueue_append_buffer(vr->direct_out, buf);
+		/* without "headers" => true a stored header block is skipped */
+		restore = ctx->headers && 0 != body_offset;
 
 		vr->response.http_status = 200;
+		if (restore) {
+			vr->response.http_status = status;
+			mc_restore_headers(vr, buf, body_offset);
+		}
+
+		if (!restore || NULL == li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Content-Type"))) {
+			mime_str = li_mimetype_get(vr, vr->request.uri.path);
+			if (!mime_str) mime_str = &default_mime_str;
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
+		}
 
-		mime_str = li_mimetype_get(vr, vr->request.uri.path);
-		if (!mime_str) mime_str = &default_mime_str;
-		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), GSTR_LEN(mime_str));
+		if (restore && 200 == vr->response.http_status && li_http_response_handle_cachable(vr)) {
+			if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+				VR_DEBUG(vr, "%s", "memcached.lookup: etag handling => 304 Not Modified");
+			}
+			vr->response.http_status = 304;
+			li_buffer_release(buf);
+		} else {
+			/* body is sent from the item buffer, without copying */
+			li_chunkqueue_append_buffer2(vr->direct_out, buf, body_offset, buf->used - body_offset);
+		}
 
 		/* hit */
 		if (ctx->act_found) li_action_enter(vr, ctx->act_found);
 		return LI_HANDLER_GO_ON;
 	} else {
-		liMemcachedCon *con;
+		liMemcachedCluster *cluster;
 		GError *err = NULL;
 
 		if (li_vrequest_is_handled(vr)) {
@@ -371,7 +531,7 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 			return LI_HANDLER_GO_ON;
 		}
 
-		con = mc_ctx_prepare(ctx, vr->wrk);
+		cluster = mc_ctx_prepare(ctx, vr->wrk);
 		mc_ctx_build_key(vr->wrk->tmp_str, ctx, vr);
 
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
@@ -379,7 +539,7 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 		}
 
 		req = g_slice_new0(memcache_request);
-		req->req = li_memcached_get(con, vr->wrk->tmp_str, memcache_callback, req, &err);
+		req->req = li_memcached_cluster_get(cluster, vr->wrk->tmp_str, memcache_callback, req, &err);
 
 		if (NULL == req->req) {
 			if (NULL != err) {
@@ -495,7 +655,7 @@ static liHandlerResult memcache_store_filter(liVRequest *vr, liFilter *f) {
 	if (f->in->is_closed) {
 		/* finally: store response in memcached */
 
-		liMemcachedCon *con;
+		liMemcachedCluster *cluster;
 		GError *err = NULL;
 		liMemcachedRequest *req;
 		memcached_ctx *ctx = mf->ctx;
@@ -504,14 +664,14 @@ static liHandlerResult memcache_store_filter(liVRequest *vr, liFilter *f) {
 
 		f->out->is_closed = TRUE;
 
-		con = mc_ctx_prepare(ctx, vr->wrk);
+		cluster = mc_ctx_prepare(ctx, vr->wrk);
 		mc_ctx_build_key(vr->wrk->tmp_str, ctx, vr);
 
 		if (NULL != vr && CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "memcached.store: storing response for key '%s'", vr->wrk->tmp_str->str);
 		}
 
-		req = li_memcached_set(con, vr->wrk->tmp_str, ctx->flags, ctx->ttl, mf->buf, NULL, NULL, &err);
+		req = li_memcached_cluster_set(cluster, vr->wrk->tmp_str, ctx->flags | (ctx->headers ? MC_FLAG_HEADERS : 0), ctx->ttl, mf->buf, NULL, NULL, &err);
 		memcache_store_filter_free(vr, f);
 
 		if (NULL == req) {
@@ -542,16 +702,34 @@ forward:
 static liHandlerResult mc_handle_store(liVRequest *vr, gpointer param, gpointer *context) {
 	memcached_ctx *ctx = param;
 	memcache_filter *mf;
+	liBuffer *buf;
 	UNUSED(context);
 
 	LI_VREQUEST_WAIT_FOR_RESPONSE_HEADERS(vr);
 
 	if (vr->response.http_status != 200) return LI_HANDLER_GO_ON;
 
+	/* the encoding depends on the Accept-Encoding of this request, which isn't part of the key */
+	if (NULL != li_http_header_lookup(vr->response.headers, CONST_STR_LEN("Content-Encoding"))) {
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "%s", "memcached.store: response has a Content-Encoding, not storing");
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	buf = li_buffer_new(ctx->maxsize);
+	if (ctx->headers && !mc_store_headers(vr, buf)) {
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "%s", "memcached.store: headers don't fit into maxsize, not storing");
+		}
+		li_buffer_release(buf);
+		return LI_HANDLER_GO_ON;
+	}
+
 	mf = g_slice_new0(memcache_filter);
 	mf->ctx = ctx;
 	mc_ctx_acquire(ctx);
-	mf->buf = li_buffer_new(ctx->maxsize);
+	mf->buf = buf;
 
 	li_vrequest_add_filter_out(vr, memcache_store_filter, memcache_store_filter_free, NULL, mf);
 
@@ -1146,7 +1324,7 @@ static void memcached_prepare(liServer *srv, liPlugin *p) {
 
 	while (NULL != (conf_link = g_queue_pop_head_link(&mconf->prepare_ctx))) {
 		ctx = conf_link->data;
-		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCon*) * srv->worker_count);
+		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCluster*) * srv->worker_count);
 		conf_link->data = NULL;
 	}
 }
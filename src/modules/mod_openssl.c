@@ -49,8 +49,12 @@ struct openssl_context {
 	gint refcount;
 
 	SSL_CTX *ssl_ctx;
+	gboolean ktls; /* hand encryption of outgoing data to the kernel */
 };
 
+/* ALPN protocols in order of preference */
+static const unsigned char openssl_alpn_protos[] = "\x02h2\x08http/1.1";
+
 enum {
 	SE_CLIENT      = 0x1,
 	SE_CLIENT_CERT = 0x2,
@@ -94,6 +98,9 @@ static void tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 
 	li_connection_simple_tcp(&conctx->con, stream, &conctx->simple_socket_state, event);
 
+	/* HTTP/1 responses get flushed below; upgraded and HTTP/2 connections don't know where a response ends */
+	li_stream_simple_socket_cork_until_flush(stream, NULL != conctx->con && conctx->con->state < LI_CON_STATE_UPGRADED);
+
 	if (NULL != conctx->con && conctx->con->out_has_all_data
 	    && (NULL == stream->stream_out.out || 0 == stream->stream_out.out->length)
 	    && li_streams_empty(conctx->con->con_sock.raw_out, NULL)) {
@@ -117,11 +124,22 @@ static void tcp_io_cb(liIOStream *stream, liIOStreamEvent event) {
 static void handshake_cb(liOpenSSLFilter *f, gpointer data, liStream *plain_source, liStream *plain_drain) {
 	openssl_connection_ctx *conctx = data;
 	liConnection *con = conctx->con;
-	UNUSED(f);
 
 	if (NULL != con) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		const unsigned char *alpn = NULL;
+		unsigned int alpn_len = 0;
+#endif
+
 		li_stream_connect(plain_source, con->con_sock.raw_in);
 		li_stream_connect(con->con_sock.raw_out, plain_drain);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		SSL_get0_alpn_selected(li_openssl_filter_ssl(f), &alpn, &alpn_len);
+		if (2 == alpn_len && 0 == memcmp(alpn, "h2", 2) && LI_CON_STATE_REQUEST_START == con->state) {
+			li_connection_http2_start(con);
+		}
+#endif
 	} else {
 		li_stream_reset(plain_source);
 		li_stream_reset(plain_drain);
@@ -215,6 +233,8 @@ static gboolean openssl_con_new(liConnection *con, int fd) {
 		return FALSE;
 	}
 
+	if (ctx->ktls) li_openssl_filter_enable_ktls(conctx->ssl_filter, conctx->sock_stream);
+
 	conctx->con = con;
 	con->con_sock.data = conctx;
 	con->con_sock.callbacks = &openssl_tcp_cbs;
@@ -498,6 +518,19 @@ static gboolean openssl_options_set_string(uint64_t *options, GString *s) {
 
 static int openssl_verify_any_cb(int ok, X509_STORE_CTX *ctx) { UNUSED(ok); UNUSED(ctx); return 1; }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+/* only registered with "http2" enabled */
+static int openssl_alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+	UNUSED(ssl); UNUSED(arg);
+
+	if (OPENSSL_NPN_NEGOTIATED != SSL_select_next_proto((unsigned char**) out, outlen,
+			openssl_alpn_protos, sizeof(openssl_alpn_protos) - 1, in, inlen)) {
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+	return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
 static gboolean creds_add_pemfile(liServer *srv, openssl_context *ctx, liValue *pemfile) {
 	const char *keyfile = NULL;
 	const char *certfile = NULL;
@@ -592,7 +625,11 @@ static gboolean openssl_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 		have_verify_depth_parameter = FALSE,
 		have_verify_any_parameter = FALSE,
 		have_verify_require_parameter = FALSE,
-		have_pemfile_parameter = FALSE;
+		have_pemfile_parameter = FALSE,
+		have_ktls_parameter = FALSE,
+		ktls = FALSE,
+		have_http2_parameter = FALSE,
+		http2 = FALSE;
 	const char
 		*ciphers = NULL, *ca_file = NULL, *client_ca_file = NULL, *dh_params_file = NULL, *ecdh_curve = NULL;
 	uint64_t
@@ -755,6 +792,42 @@ static gboolean openssl_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 				return FALSE;
 			}
 			client_ca_file = entryValue->data.string->str;
+		} else if (g_str_equal(entryKeyStr->str, "ktls")) {
+			if (LI_VALUE_BOOLEAN != li_value_type(entryValue)) {
+				ERROR(srv, "%s", "openssl ktls expects a boolean as parameter");
+				return FALSE;
+			}
+			if (have_ktls_parameter) {
+				ERROR(srv, "openssl unexpected duplicate parameter %s", entryKeyStr->str);
+				return FALSE;
+			}
+			have_ktls_parameter = TRUE;
+			ktls = entryValue->data.boolean;
+#ifndef LI_OPENSSL_KTLS
+			if (ktls) {
+				ERROR(srv, "%s", "openssl ktls not supported (needs linux and openssl >= 3.0 with ktls support)");
+				return FALSE;
+			}
+#else
+			if (ktls) options |= SSL_OP_ENABLE_KTLS;
+#endif
+		} else if (g_str_equal(entryKeyStr->str, "http2")) {
+			if (LI_VALUE_BOOLEAN != li_value_type(entryValue)) {
+				ERROR(srv, "%s", "openssl http2 expects a boolean as parameter");
+				return FALSE;
+			}
+			if (have_http2_parameter) {
+				ERROR(srv, "openssl unexpected duplicate parameter %s", entryKeyStr->str);
+				return FALSE;
+			}
+			have_http2_parameter = TRUE;
+			http2 = entryValue->data.boolean;
+#if OPENSSL_VERSION_NUMBER < 0x10002000L
+			if (http2) {
+				ERROR(srv, "%s", "openssl http2 not supported (needs openssl >= 1.0.2 for ALPN)");
+				return FALSE;
+			}
+#endif
 		} else {
 			ERROR(srv, "invalid parameter for openssl: %s", entryKeyStr->str);
 			return FALSE;
@@ -773,6 +846,7 @@ static gboolean openssl_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 	}
 
 	ctx = mod_openssl_context_new();
+	ctx->ktls = ktls;
 
 	if (NULL == (ctx->ssl_ctx = SSL_CTX_new(SSLv23_server_method()))) {
 		ERROR(srv, "SSL_CTX_new: %s", ERR_error_string(ERR_get_error(), NULL));
@@ -842,6 +916,12 @@ static gboolean openssl_setup(liServer *srv, liPlugin* p, liValue *val, gpointer
 		SSL_CTX_set_client_CA_list(ctx->ssl_ctx, client_ca_list);
 	}
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	if (http2) {
+		SSL_CTX_set_alpn_select_cb(ctx->ssl_ctx, openssl_alpn_select_cb, NULL);
+	}
+#endif
+
 	SSL_CTX_set_default_read_ahead(ctx->ssl_ctx, 1);
 	SSL_CTX_set_mode(ctx->ssl_ctx, SSL_CTX_get_mode(ctx->ssl_ctx) | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
@@ -1,8 +1,8 @@
 /*
  * mod_proxy - connect to HTTP backends for generating response content
  *
- * TODO:
- *     - keep-alive connections
+ * Backend connections are kept alive and reused if the response was framed by
+ * Content-Length or chunked encoding and the backend didn't ask to close it.
  *
  * Author:
  *     Copyright (c) 2013 Stefan Bühler
@@ -20,6 +20,7 @@ LI_API gboolean mod_proxy_free(liModules *mods, liModule *mod);
 
 typedef struct proxy_connection proxy_connection;
 typedef struct proxy_context proxy_context;
+typedef struct proxy_request proxy_request;
 
 struct proxy_context {
 	gint refcount;
@@ -32,8 +33,20 @@ struct proxy_context {
 
 struct proxy_connection {
 	proxy_context *ctx;
-	liBackendConnection *bcon;
+	liBackendConnection *bcon; /* NULL after the connection was put back into the pool */
 	liBuffer *simple_socket_buffer;
+	liStream *http_out;
+};
+
+/* action context while looking for a backend connection */
+struct proxy_request {
+	liVRequest *vr;
+	liBackendWait *bwait;
+
+	/* reused connection the request header was already sent on; waiting for the first response byte,
+	 * the request gets retried on another connection if the backend closed it instead */
+	liBackendConnection *bcon;
+	liChunkQueue *head; /* the part of the request header which wasn't sent yet */
 };
 
 /**********************************************************************************/
@@ -51,10 +64,10 @@ static void proxy_send_headers(liVRequest *vr, liChunkQueue *out) {
 	li_g_string_append_len(head, GSTR_LEN(vr->request.uri.raw_path));
 
 	switch (vr->request.http_version) {
+	case LI_HTTP_VERSION_3: /* backends get HTTP/1.1 */
+	case LI_HTTP_VERSION_2:
 	case LI_HTTP_VERSION_1_1:
 		li_g_string_append_len(head, CONST_STR_LEN(" HTTP/1.1\r\n"));
-		/* although we understand keep-alive signalling we don't reuse connection, so tell backend */
-		li_g_string_append_len(head, CONST_STR_LEN("Connection: close\r\n"));
 		break;
 	case LI_HTTP_VERSION_1_0:
 	default:
@@ -138,7 +151,7 @@ static proxy_context* proxy_context_new(liServer *srv, GString *dest_socket) {
 	config->connect_timeout = 5;
 	config->wait_timeout = 5;
 	config->disable_time = 0;
-	config->max_requests = 1;
+	config->max_requests = 100;
 	config->watch_for_close = TRUE;
 
 	ctx = g_slice_new0(proxy_context);
@@ -165,6 +178,20 @@ static void proxy_context_acquire(proxy_context *ctx) {
 }
 
 
+/* whether the connection can be put back into the pool after the response body was read */
+static gboolean proxy_connection_reusable(liIOStream *stream, proxy_connection *con) {
+	liStream *request_in = stream->stream_out.source;
+
+	if (NULL == con->bcon || NULL == con->http_out) return FALSE;
+	if (-1 == li_event_io_fd(&stream->io_watcher) || stream->in_closed || stream->out_closed || NULL != stream->uring_op) return FALSE;
+
+	/* the request must have been sent completely, and the backend must not have sent more than the response */
+	if (NULL == request_in || !request_in->out->is_closed || request_in->out->length > 0) return FALSE;
+	if (stream->stream_out.out->length > 0 || stream->stream_in.out->length > 0) return FALSE;
+
+	return li_stream_http_response_reusable(con->http_out);
+}
+
 static void proxy_io_cb(liIOStream *stream, liIOStreamEvent event) {
 	proxy_connection *con = stream->data;
 	liWorker *wrk = li_worker_from_iostream(stream);
@@ -172,13 +199,29 @@ static void proxy_io_cb(liIOStream *stream, liIOStreamEvent event) {
 	li_stream_simple_socket_io_cb_with_buffer(stream, event, &con->simple_socket_buffer);
 
 	switch (event) {
+	case LI_IOSTREAM_DISCONNECTED_DEST:
+		if (proxy_connection_reusable(stream, con)) {
+			/* response complete: keep the fd in bcon->watcher and hand it back to the pool */
+			liBackendConnection *bcon = con->bcon;
+
+			li_iostream_acquire(stream);
+			li_iostream_reset(stream);
+			con->bcon = NULL;
+			li_backend_put(wrk, con->ctx->pool, bcon, FALSE);
+			li_iostream_release(stream);
+			return;
+		}
+		break;
 	case LI_IOSTREAM_DESTROY:
 		li_stream_simple_socket_close(stream, FALSE);
-		li_event_io_set_fd(&con->bcon->watcher, -1);
 
-		li_backend_put(wrk, con->ctx->pool, con->bcon, TRUE);
-		con->bcon = NULL;
+		if (NULL != con->bcon) {
+			li_event_io_set_fd(&con->bcon->watcher, -1);
+			li_backend_put(wrk, con->ctx->pool, con->bcon, TRUE);
+			con->bcon = NULL;
+		}
 
+		li_stream_safe_release(&con->http_out);
 		proxy_context_release(con->ctx);
 		g_slice_free(proxy_connection, con);
 
@@ -195,7 +238,8 @@ static void proxy_io_cb(liIOStream *stream, liIOStreamEvent event) {
 	}
 }
 
-static void proxy_connection_new(liVRequest *vr, liBackendConnection *bcon, proxy_context *ctx) {
+/* pending_head: rest of the request header if sending it already started; NULL: send the complete header */
+static void proxy_connection_new(liVRequest *vr, liBackendConnection *bcon, proxy_context *ctx, liChunkQueue *pending_head) {
 	proxy_connection* scon = g_slice_new0(proxy_connection);
 	liIOStream *iostream;
 	liStream *outplug;
@@ -211,10 +255,16 @@ static void proxy_connection_new(liVRequest *vr, liBackendConnection *bcon, prox
 
 	li_stream_connect(outplug, &iostream->stream_out);
 
-	proxy_send_headers(vr, outplug->out);
+	if (NULL == pending_head) {
+		proxy_send_headers(vr, outplug->out);
+	} else {
+		li_chunkqueue_steal_all(outplug->out, pending_head);
+	}
 	li_stream_notify_later(outplug);
 
 	http_out = li_stream_http_response_handle(&iostream->stream_in, vr, TRUE, FALSE, TRUE);
+	li_stream_acquire(http_out);
+	scon->http_out = http_out;
 
 	li_vrequest_handle_indirect(vr, NULL);
 	li_vrequest_indirect_connect(vr, outplug, http_out);
@@ -226,22 +276,86 @@ static void proxy_connection_new(liVRequest *vr, liBackendConnection *bcon, prox
 
 /**********************************************************************************/
 
+/* 1: data available, 0: nothing to read yet, -1: connection closed or failed */
+static int proxy_connection_peek(liBackendConnection *bcon) {
+	char c;
+	ssize_t r;
+
+	do {
+		r = recv(li_event_io_fd(&bcon->watcher), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	} while (-1 == r && EINTR == errno);
+
+	if (r > 0) return 1;
+	if (-1 == r && (EAGAIN == errno || EWOULDBLOCK == errno)) return 0;
+	return -1;
+}
+
+/* requests which can be sent again if the backend closed the connection without a response */
+static gboolean proxy_request_retryable(liVRequest *vr) {
+	if (0 != vr->request.content_length) return FALSE;
+
+	switch (vr->request.http_method) {
+	case LI_HTTP_METHOD_GET:
+	case LI_HTTP_METHOD_HEAD:
+	case LI_HTTP_METHOD_OPTIONS:
+	case LI_HTTP_METHOD_PUT:
+	case LI_HTTP_METHOD_DELETE:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void proxy_response_wait_cb(liEventBase *watcher, int events) {
+	liEventIO *iowatcher = li_event_io_from(watcher);
+	liBackendConnection *bcon = LI_CONTAINER_OF(iowatcher, liBackendConnection, watcher);
+	proxy_request *preq = bcon->data;
+	UNUSED(events);
+
+	li_event_stop(iowatcher);
+	li_vrequest_joblist_append(preq->vr);
+}
+
+static void proxy_response_wait_stop(proxy_request *preq) {
+	liBackendConnection *bcon = preq->bcon;
+
+	li_event_stop(&bcon->watcher);
+	li_event_set_callback(&bcon->watcher, NULL);
+	bcon->data = NULL;
+	preq->bcon = NULL;
+}
+
+static void proxy_request_free(liVRequest *vr, proxy_context *ctx, proxy_request *preq) {
+	if (NULL != preq->bwait) {
+		li_backend_wait_stop(vr, ctx->pool, &preq->bwait);
+	}
+	if (NULL != preq->bcon) {
+		/* request was sent, but nobody reads the response */
+		liBackendConnection *bcon = preq->bcon;
+		proxy_response_wait_stop(preq);
+		li_backend_put(vr->wrk, ctx->pool, bcon, TRUE);
+	}
+	if (NULL != preq->head) {
+		li_chunkqueue_free(preq->head);
+	}
+	g_slice_free(proxy_request, preq);
+}
+
 static liHandlerResult proxy_handle_abort(liVRequest *vr, gpointer param, gpointer context) {
 	proxy_context *ctx = (proxy_context*) param;
-	liBackendWait *bwait = context;
+	proxy_request *preq = context;
 
-	if (bwait != NULL) {
-		li_backend_wait_stop(vr, ctx->pool, &bwait);
+	if (preq != NULL) {
+		proxy_request_free(vr, ctx, preq);
 	}
 
 	return LI_HANDLER_GO_ON;
 }
 
 static liHandlerResult proxy_handle(liVRequest *vr, gpointer param, gpointer *context) {
-	liBackendWait *bwait = (liBackendWait*) *context;
+	proxy_request *preq = (proxy_request*) *context;
 	liBackendConnection *bcon = NULL;
 	proxy_context *ctx = (proxy_context*) param;
-	liBackendResult bres;
 
 	if (li_vrequest_is_handled(vr)) return LI_HANDLER_GO_ON;
 
@@ -252,22 +366,96 @@ static liHandlerResult proxy_handle(liVRequest *vr, gpointer param, gpointer *co
 		return LI_HANDLER_ERROR;
 	}
 
-	bres = li_backend_get(vr, ctx->pool, &bcon, &bwait);
-	*context = bwait;
-	switch (bres) {
-	case LI_BACKEND_SUCCESS:
-		LI_FORCE_ASSERT(NULL == bwait);
-		LI_FORCE_ASSERT(NULL != bcon);
-		break;
-	case LI_BACKEND_WAIT:
-		LI_FORCE_ASSERT(NULL != bwait);
-		return LI_HANDLER_WAIT_FOR_EVENT;
-	case LI_BACKEND_TIMEOUT:
-		li_vrequest_backend_dead(vr);
-		return LI_HANDLER_GO_ON;
+	if (NULL == preq) {
+		preq = g_slice_new0(proxy_request);
+		preq->vr = vr;
+		*context = preq;
+	}
+
+	for (;;) {
+		if (NULL != preq->bcon) {
+			bcon = preq->bcon;
+			switch (proxy_connection_peek(bcon)) {
+			case 1:
+				/* backend is responding */
+				proxy_response_wait_stop(preq);
+				goto connected;
+			case 0:
+				li_event_start(&bcon->watcher);
+				return LI_HANDLER_WAIT_FOR_EVENT;
+			default:
+				/* backend closed the keep-alive connection before it saw the request; try again */
+				proxy_response_wait_stop(preq);
+				li_backend_put(vr->wrk, ctx->pool, bcon, TRUE);
+				bcon = NULL;
+				li_chunkqueue_free(preq->head);
+				preq->head = NULL;
+				continue;
+			}
+		}
+
+		switch (li_backend_get(vr, ctx->pool, &bcon, &preq->bwait)) {
+		case LI_BACKEND_SUCCESS:
+			LI_FORCE_ASSERT(NULL == preq->bwait);
+			LI_FORCE_ASSERT(NULL != bcon);
+			break;
+		case LI_BACKEND_WAIT:
+			LI_FORCE_ASSERT(NULL != preq->bwait);
+			return LI_HANDLER_WAIT_FOR_EVENT;
+		case LI_BACKEND_TIMEOUT:
+			*context = NULL;
+			proxy_request_free(vr, ctx, preq);
+			li_vrequest_backend_dead(vr);
+			return LI_HANDLER_GO_ON;
+		}
+
+		/* new connection */
+		if (0 == li_backend_connection_requests(bcon)) goto connected;
+
+		/* keep-alive connection: the backend might have closed it while it was idle */
+		if (0 != proxy_connection_peek(bcon)) {
+			li_backend_put(vr->wrk, ctx->pool, bcon, TRUE);
+			bcon = NULL;
+			continue;
+		}
+
+		if (!proxy_request_retryable(vr)) goto connected;
+
+		/* the backend can still close the connection before it gets the request; send the request header ourselves
+		 * and wait for the response, so it can be sent again on another connection */
+		{
+			goffset write_max;
+			GError *err = NULL;
+			liNetworkStatus res;
+
+			preq->head = li_chunkqueue_new();
+			proxy_send_headers(vr, preq->head);
+			write_max = preq->head->length;
+			res = li_network_backend_write(li_event_io_fd(&bcon->watcher), preq->head, &write_max, &err);
+			if (NULL != err) g_error_free(err);
+
+			if (LI_NETWORK_STATUS_SUCCESS != res && LI_NETWORK_STATUS_WAIT_FOR_EVENT != res) {
+				li_backend_put(vr->wrk, ctx->pool, bcon, TRUE);
+				bcon = NULL;
+				li_chunkqueue_free(preq->head);
+				preq->head = NULL;
+				continue;
+			}
+
+			/* can't wait for the response before the header was sent completely; give up on retrying */
+			if (preq->head->length > 0) goto connected;
+		}
+
+		preq->bcon = bcon;
+		bcon->data = preq;
+		li_event_set_callback(&bcon->watcher, proxy_response_wait_cb);
+		li_event_io_set_events(&bcon->watcher, LI_EV_READ);
 	}
 
-	proxy_connection_new(vr, bcon, ctx);
+connected:
+	*context = NULL;
+	proxy_connection_new(vr, bcon, ctx, preq->head);
+	proxy_request_free(vr, ctx, preq);
 	return LI_HANDLER_GO_ON;
 }
 
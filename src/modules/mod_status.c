@@ -22,14 +22,14 @@
 LI_API gboolean mod_status_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_status_free(liModules *mods, liModule *mod);
 
-static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count);
-static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count);
+static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count, GArray *listen_queues);
+static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count, GArray *listen_queues);
 static GString *status_info_auto(liVRequest *vr, guint uptime, liStatistics *totals, guint *connection_count);
 static liHandlerResult status_info_runtime(liVRequest *vr, liPlugin *p);
 static gint str_comp(gconstpointer a, gconstpointer b);
 
 /* auto format constants */
-static gchar liConnectionState_short[LI_CON_STATE_LAST+2] = "_cKqrhwu";
+static gchar liConnectionState_short[LI_CON_STATE_LAST+2] = "_cKqrhwu2";
 
 /* html snippet constants */
 static const gchar html_header[] =
@@ -154,6 +154,7 @@ static const gchar html_connections_sum[] =
 	"				<th style=\"width: 100px;\">write response</th>\n"
 	"				<th style=\"width: 100px;\">keep-alive</th>\n"
 	"				<th style=\"width: 100px;\">upgraded</th>\n"
+	"				<th style=\"width: 100px;\">http2</th>\n"
 	"			</tr>\n"
 	"			<tr>\n"
 	"				<td>%u</td>\n"
@@ -163,6 +164,7 @@ static const gchar html_connections_sum[] =
 	"				<td>%u</td>\n"
 	"				<td>%u</td>\n"
 	"				<td>%u</td>\n"
+	"				<td>%u</td>\n"
 	"			</tr>\n"
 	"		</table>\n";
 static const gchar html_status_codes[] =
@@ -183,6 +185,144 @@ static const gchar html_status_codes[] =
 	"			</tr>\n"
 	"		</table>\n";
 
+static const gchar html_accept[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\">accepted</th>\n"
+	"				<th style=\"width: 100px;\">wakeups</th>\n"
+	"				<th style=\"width: 100px;\">avg batch</th>\n"
+	"				<th style=\"width: 100px;\">max batch</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%.2f</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_cork[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 175px;\">cork/flush syscalls</th>\n"
+	"				<th style=\"width: 175px;\">syscalls saved</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_stat_cache[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\">hits</th>\n"
+	"				<th style=\"width: 100px;\">shared hits</th>\n"
+	"				<th style=\"width: 100px;\">misses</th>\n"
+	"				<th style=\"width: 100px;\">errors</th>\n"
+	"				<th style=\"width: 100px;\">invalidated</th>\n"
+	"				<th style=\"width: 100px;\">watches</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%u</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_fd_cache[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\">fd hits</th>\n"
+	"				<th style=\"width: 100px;\">fd misses</th>\n"
+	"				<th style=\"width: 100px;\">open fds</th>\n"
+	"				<th style=\"width: 100px;\">evictions</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_mem_cache[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\">memory hits</th>\n"
+	"				<th style=\"width: 100px;\">memory misses</th>\n"
+	"				<th style=\"width: 100px;\">files</th>\n"
+	"				<th style=\"width: 100px;\">size</th>\n"
+	"				<th style=\"width: 100px;\">rejected</th>\n"
+	"				<th style=\"width: 100px;\">evictions</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_disk_cache[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\">disk hits</th>\n"
+	"				<th style=\"width: 100px;\">disk misses</th>\n"
+	"				<th style=\"width: 100px;\">evictions</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_listen_overflows[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 175px;\">listen overflows (system)</th>\n"
+	"				<th style=\"width: 175px;\">listen drops (system)</th>\n"
+	"			</tr>\n"
+	"			<tr>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"			</tr>\n"
+	"		</table>\n";
+static const gchar html_listen_queue_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 175px;\">Socket</th>\n"
+	"				<th style=\"width: 100px;\">Worker</th>\n"
+	"				<th style=\"width: 100px;\">queued</th>\n"
+	"				<th style=\"width: 100px;\">backlog</th>\n"
+	"			</tr>\n";
+static const gchar html_listen_queue_row[] =
+	"			<tr>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%i</td>\n"
+	"				<td>%u</td>\n"
+	"				<td>%u</td>\n"
+	"			</tr>\n";
+static const gchar html_backend_health_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 250px;\">Check</th>\n"
+	"				<th style=\"width: 100px;\">state</th>\n"
+	"				<th style=\"width: 100px;\">since</th>\n"
+	"				<th style=\"width: 100px;\">checks</th>\n"
+	"				<th style=\"width: 100px;\">failed</th>\n"
+	"				<th>last error</th>\n"
+	"			</tr>\n";
+static const gchar html_backend_health_row[] =
+	"			<tr>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"			</tr>\n";
+
 static const gchar html_connections_th[] =
 	"		<table cellspacing=\"0\">\n"
 	"			<tr>\n"
@@ -336,6 +476,8 @@ typedef struct mod_status_con_data mod_status_con_data;
 
 typedef struct mod_status_job mod_status_job;
 
+typedef struct mod_status_listen_data mod_status_listen_data;
+
 struct mod_status_con_data {
 	guint worker_ndx;
 	liConnectionState state;
@@ -353,11 +495,18 @@ struct mod_status_con_data {
 	guint64 bytes_out_5s_diff;
 };
 
+struct mod_status_listen_data {
+	GString *addr_str;
+	guint worker_ndx; /* 0: main worker, otherwise worker number of a reuseport socket */
+	guint queued, backlog;
+};
+
 struct mod_status_wrk_data {
 	guint worker_ndx;
 	liStatistics stats;
 	GArray *connections;
 	guint connection_count[LI_CON_STATE_LAST+1];
+	GArray *listen_queues; /* only collected in the main worker, which owns srv->sockets */
 };
 
 struct mod_status_job {
@@ -368,6 +517,8 @@ struct mod_status_job {
 };
 
 
+static gboolean status_listen_queue(liServerSocket *sock, guint *queued, guint *backlog);
+
 /* the CollectFunc */
 static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 	mod_status_wrk_data *sd = g_slice_new0(mod_status_wrk_data);
@@ -410,9 +561,50 @@ static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 
 		sd->connection_count[c->state]++;
 	}
+
+	if (wrk == wrk->srv->main_worker) {
+		liServer *srv = wrk->srv;
+
+		sd->listen_queues = g_array_sized_new(FALSE, TRUE, sizeof(mod_status_listen_data), srv->sockets->len);
+		for (guint i = 0; i < srv->sockets->len; i++) {
+			liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
+			mod_status_listen_data ld;
+
+			if (!status_listen_queue(sock, &ld.queued, &ld.backlog)) continue;
+
+			ld.addr_str = li_sockaddr_to_string(sock->local_addr, NULL, TRUE);
+			ld.worker_ndx = NULL != sock->wrk ? sock->wrk->ndx + 1 : 0;
+			g_array_append_val(sd->listen_queues, ld);
+		}
+	}
+
 	return sd;
 }
 
+static void status_wrk_data_free(mod_status_wrk_data *sd) {
+	guint j;
+
+	for (j = 0; j < sd->connections->len; j++) {
+		mod_status_con_data *cd = &g_array_index(sd->connections, mod_status_con_data, j);
+
+		g_string_free(cd->remote_addr_str, TRUE);
+		g_string_free(cd->local_addr_str, TRUE);
+		g_string_free(cd->host, TRUE);
+		g_string_free(cd->path, TRUE);
+		g_string_free(cd->query, TRUE);
+	}
+	g_array_free(sd->connections, TRUE);
+
+	if (NULL != sd->listen_queues) {
+		for (j = 0; j < sd->listen_queues->len; j++) {
+			g_string_free(g_array_index(sd->listen_queues, mod_status_listen_data, j).addr_str, TRUE);
+		}
+		g_array_free(sd->listen_queues, TRUE);
+	}
+
+	g_slice_free(mod_status_wrk_data, sd);
+}
+
 /* the CollectCallback */
 static void status_collect_cb(liWorker *wrk, gpointer cbdata, gpointer fdata, GPtrArray *result, gboolean complete) {
 	guint i, j;
@@ -427,19 +619,7 @@ static void status_collect_cb(liWorker *wrk, gpointer cbdata, gpointer fdata, GP
 	if (!complete) {
 		/* someone called li_collect_break, so we don't need any vrequest handling here. just free the result data */
 		for (i = 0; i < result->len; i++) {
-			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
-			for (j = 0; j < sd->connections->len; j++) {
-				mod_status_con_data *cd = &g_array_index(sd->connections, mod_status_con_data, j);
-
-				g_string_free(cd->remote_addr_str, TRUE);
-				g_string_free(cd->local_addr_str, TRUE);
-				g_string_free(cd->host, TRUE);
-				g_string_free(cd->path, TRUE);
-				g_string_free(cd->query, TRUE);
-			}
-
-			g_array_free(sd->connections, TRUE);
-			g_slice_free(mod_status_wrk_data, sd);
+			status_wrk_data_free(g_ptr_array_index(result, i));
 		}
 
 		g_slice_free(mod_status_job, job);
@@ -451,6 +631,7 @@ static void status_collect_cb(liWorker *wrk, gpointer cbdata, gpointer fdata, GP
 		guint uptime, len;
 		guint total_connections = 0;
 		guint connection_count[LI_CON_STATE_LAST+1] = {0};
+		GArray *listen_queues = NULL;
 
 		liStatistics totals = {
 			G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0), G_GUINT64_CONSTANT(0),
@@ -493,20 +674,46 @@ static void status_collect_cb(liWorker *wrk, gpointer cbdata, gpointer fdata, GP
 			totals.peak.requests += sd->stats.peak.requests;
 			totals.peak.active_cons += sd->stats.peak.active_cons;
 
+			totals.accept_wakeups += sd->stats.accept_wakeups;
+			totals.accepted += sd->stats.accepted;
+			totals.accept_batch_max = MAX(totals.accept_batch_max, sd->stats.accept_batch_max);
+			for (j = 0; j < LI_STATS_HIST_SIZE; ++j) {
+				totals.accept_batch_hist[j] += sd->stats.accept_batch_hist[j];
+				totals.dispatch_latency_hist[j] += sd->stats.dispatch_latency_hist[j];
+			}
+
+			totals.cork_syscalls += sd->stats.cork_syscalls;
+			totals.cork_syscalls_baseline += sd->stats.cork_syscalls_baseline;
+
+			totals.stat_cache_hits += sd->stats.stat_cache_hits;
+			totals.stat_cache_shared_hits += sd->stats.stat_cache_shared_hits;
+			totals.stat_cache_misses += sd->stats.stat_cache_misses;
+			totals.stat_cache_errors += sd->stats.stat_cache_errors;
+			totals.stat_cache_invalidated += sd->stats.stat_cache_invalidated;
+			totals.fd_cache_hits += sd->stats.fd_cache_hits;
+			totals.fd_cache_misses += sd->stats.fd_cache_misses;
+			totals.mem_cache_hits += sd->stats.mem_cache_hits;
+			totals.mem_cache_misses += sd->stats.mem_cache_misses;
+			totals.disk_cache_hits += sd->stats.disk_cache_hits;
+			totals.disk_cache_misses += sd->stats.disk_cache_misses;
+			totals.disk_cache_evictions += sd->stats.disk_cache_evictions;
+
 			for (j = 0; j <= LI_CON_STATE_LAST; ++j) {
 				connection_count[j] += sd->connection_count[j];
 			}
+
+			if (NULL != sd->listen_queues) listen_queues = sd->listen_queues;
 		}
 
 		if (li_querystring_find(vr->request.uri.query, CONST_STR_LEN("format"), &val, &len) && strncmp(val, "plain", len) == 0) {
 			/* show plain text page */
-			html = status_info_plain(vr, uptime, &totals, total_connections, &connection_count[0]);
+			html = status_info_plain(vr, uptime, &totals, total_connections, &connection_count[0], listen_queues);
 		} else if (li_strncase_equal(vr->request.uri.query, CONST_STR_LEN("auto"))) {
 			/* show auto text page */
 			html = status_info_auto(vr, uptime, &totals, &connection_count[0]);
 		} else {
 			/* show full html page */
-			html = status_info_full(vr, p, short_info, result, uptime, &totals, total_connections, &connection_count[0]);
+			html = status_info_full(vr, p, short_info, result, uptime, &totals, total_connections, &connection_count[0], listen_queues);
 		}
 
 		LI_FORCE_ASSERT(li_vrequest_handle_direct(vr));
@@ -516,25 +723,208 @@ static void status_collect_cb(liWorker *wrk, gpointer cbdata, gpointer fdata, GP
 
 		/* free stats */
 		for (i = 0; i < result->len; i++) {
-			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
+			status_wrk_data_free(g_ptr_array_index(result, i));
+		}
+	}
+}
 
-			for (j = 0; j < sd->connections->len; j++) {
-				mod_status_con_data *cd = &g_array_index(sd->connections, mod_status_con_data, j);
+/* TcpExt ListenOverflows/ListenDrops (linux only) */
+static gboolean status_listen_overflows(guint64 *overflows, guint64 *drops) {
+	gchar *contents = NULL;
+	gchar **lines, **names = NULL, **values = NULL;
+	gboolean found = FALSE;
+	guint i;
+
+	if (!g_file_get_contents("/proc/net/netstat", &contents, NULL, NULL)) return FALSE;
+
+	lines = g_strsplit(contents, "\n", 0);
+	for (i = 0; NULL != lines[i] && NULL != lines[i+1]; i++) {
+		if (g_str_has_prefix(lines[i], "TcpExt:") && g_str_has_prefix(lines[i+1], "TcpExt:")) {
+			names = g_strsplit(lines[i], " ", 0);
+			values = g_strsplit(lines[i+1], " ", 0);
+			break;
+		}
+	}
 
-				g_string_free(cd->remote_addr_str, TRUE);
-				g_string_free(cd->local_addr_str, TRUE);
-				g_string_free(cd->host, TRUE);
-				g_string_free(cd->path, TRUE);
-				g_string_free(cd->query, TRUE);
+	if (NULL != names) {
+		*overflows = *drops = 0;
+		for (i = 1; NULL != names[i] && NULL != values[i]; i++) {
+			if (0 == strcmp(names[i], "ListenOverflows")) {
+				*overflows = g_ascii_strtoull(values[i], NULL, 10);
+				found = TRUE;
+			} else if (0 == strcmp(names[i], "ListenDrops")) {
+				*drops = g_ascii_strtoull(values[i], NULL, 10);
 			}
+		}
+		g_strfreev(names);
+		g_strfreev(values);
+	}
+
+	g_strfreev(lines);
+	g_free(contents);
+
+	return found;
+}
 
-			g_array_free(sd->connections, TRUE);
-			g_slice_free(mod_status_wrk_data, sd);
+/* current accept queue length and backlog of a listening socket (linux only) */
+static gboolean status_listen_queue(liServerSocket *sock, guint *queued, guint *backlog) {
+#if defined(LIGHTY_OS_LINUX) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	if (AF_INET != sock->local_addr.addr_up.plain->sa_family
+#ifdef HAVE_IPV6
+		&& AF_INET6 != sock->local_addr.addr_up.plain->sa_family
+#endif
+		) return FALSE;
+
+	if (0 != getsockopt(li_event_io_fd(&sock->watcher), IPPROTO_TCP, TCP_INFO, &ti, &len)) return FALSE;
+
+	/* for listening sockets linux reports the queue in unacked and the backlog in sacked */
+	*queued = ti.tcpi_unacked;
+	*backlog = ti.tcpi_sacked;
+	return TRUE;
+#else
+	UNUSED(sock); UNUSED(queued); UNUSED(backlog);
+	return FALSE;
+#endif
+}
+
+static void status_hist_append_labels(GString *html, const gchar *unit) {
+	guint i;
+
+	for (i = 0; i < LI_STATS_HIST_SIZE; i++) {
+		if (0 == i) {
+			g_string_append_printf(html, "				<th>0-1%s</th>\n", unit);
+		} else if (LI_STATS_HIST_SIZE - 1 == i) {
+			g_string_append_printf(html, "				<th>%u+%s</th>\n", 1u << i, unit);
+		} else {
+			g_string_append_printf(html, "				<th>%u-%u%s</th>\n", 1u << i, (2u << i) - 1, unit);
 		}
 	}
 }
 
-static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count) {
+typedef struct {
+	GString *html;
+	li_tstamp now;
+} status_backend_health_data;
+
+static void status_backend_health_html_cb(liBackendHealthEntry *entry, gpointer data) {
+	status_backend_health_data *d = data;
+	GString *name = g_string_sized_new(entry->name->len);
+	GString *error = g_string_sized_new(entry->last_error->len);
+	GString *since = g_string_sized_new(15);
+
+	li_string_encode_append(entry->name->str, name, LI_ENCODING_HTML);
+	li_string_encode_append(entry->last_error->str, error, LI_ENCODING_HTML);
+	if (LI_BACKEND_HEALTH_UNKNOWN == entry->state) {
+		g_string_assign(since, "-");
+	} else {
+		li_counter_format((guint64)(d->now - entry->since), COUNTER_TIME, since);
+	}
+
+	g_string_append_printf(d->html, html_backend_health_row, name->str, li_backend_health_state_string(entry->state),
+		since->str, entry->checks, entry->failed_checks, error->str);
+
+	g_string_free(name, TRUE);
+	g_string_free(error, TRUE);
+	g_string_free(since, TRUE);
+}
+
+static void status_backend_health_plain_cb(liBackendHealthEntry *entry, gpointer data) {
+	GString *html = data;
+
+	li_g_string_append_len(html, CONST_STR_LEN("\nbackend_health: "));
+	li_g_string_append_len(html, GSTR_LEN(entry->name));
+	li_g_string_append_len(html, CONST_STR_LEN(" "));
+	g_string_append(html, li_backend_health_state_string(entry->state));
+	li_g_string_append_len(html, CONST_STR_LEN(" "));
+	li_string_append_int(html, entry->checks);
+	li_g_string_append_len(html, CONST_STR_LEN(" "));
+	li_string_append_int(html, entry->failed_checks);
+}
+
+static void status_info_accept_html(GString *html, liServer *srv, liStatistics *totals, GArray *listen_queues) {
+	guint64 overflows = 0, drops = 0;
+	gboolean have_overflows = status_listen_overflows(&overflows, &drops);
+	guint i;
+
+	li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Accept</strong> (sum)</div>\n"));
+	g_string_append_printf(html, html_accept,
+		totals->accepted, totals->accept_wakeups,
+		totals->accept_wakeups ? (double) totals->accepted / totals->accept_wakeups : 0.0,
+		totals->accept_batch_max
+	);
+	if (have_overflows) {
+		g_string_append_printf(html, html_listen_overflows, overflows, drops);
+	}
+
+	li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Accept batch sizes</strong> (connections per wakeup)</div>\n"));
+	li_g_string_append_len(html, CONST_STR_LEN("		<table cellspacing=\"0\">\n			<tr>\n"));
+	status_hist_append_labels(html, "");
+	li_g_string_append_len(html, CONST_STR_LEN("			</tr>\n			<tr>\n"));
+	for (i = 0; i < LI_STATS_HIST_SIZE; i++) {
+		g_string_append_printf(html, "				<td>%" G_GUINT64_FORMAT "</td>\n", totals->accept_batch_hist[i]);
+	}
+	li_g_string_append_len(html, CONST_STR_LEN("			</tr>\n		</table>\n"));
+
+	li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Dispatch latency</strong> (accept to connection start)</div>\n"));
+	li_g_string_append_len(html, CONST_STR_LEN("		<table cellspacing=\"0\">\n			<tr>\n"));
+	status_hist_append_labels(html, "&micro;s");
+	li_g_string_append_len(html, CONST_STR_LEN("			</tr>\n			<tr>\n"));
+	for (i = 0; i < LI_STATS_HIST_SIZE; i++) {
+		g_string_append_printf(html, "				<td>%" G_GUINT64_FORMAT "</td>\n", totals->dispatch_latency_hist[i]);
+	}
+	li_g_string_append_len(html, CONST_STR_LEN("			</tr>\n		</table>\n"));
+
+	li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Write coalescing</strong> (TCP_CORK)</div>\n"));
+	g_string_append_printf(html, html_cork, totals->cork_syscalls,
+		(gint64) totals->cork_syscalls_baseline - (gint64) totals->cork_syscalls);
+
+	{
+		guint64 invalidations = 0;
+		guint watches = 0;
+		if (NULL != srv->stat_cache_shared) li_stat_cache_shared_counters(srv->stat_cache_shared, &invalidations, &watches);
+		li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Stat cache</strong></div>\n"));
+		g_string_append_printf(html, html_stat_cache, totals->stat_cache_hits, totals->stat_cache_shared_hits,
+			totals->stat_cache_misses, totals->stat_cache_errors, invalidations, watches);
+	}
+
+	if (li_fd_cache_enabled(srv->fd_cache)) {
+		guint entries;
+		guint64 evictions;
+		li_fd_cache_counters(srv->fd_cache, &entries, &evictions);
+		g_string_append_printf(html, html_fd_cache, totals->fd_cache_hits, totals->fd_cache_misses, entries, evictions);
+	}
+
+	if (li_mem_cache_enabled(srv->mem_cache)) {
+		guint entries;
+		goffset size;
+		guint64 rejected, evictions;
+		GString *size_str;
+		li_mem_cache_counters(srv->mem_cache, &entries, &size, &rejected, &evictions);
+		size_str = li_counter_format(size, COUNTER_BYTES, NULL);
+		g_string_append_printf(html, html_mem_cache, totals->mem_cache_hits, totals->mem_cache_misses,
+			entries, size_str->str, rejected, evictions);
+		g_string_free(size_str, TRUE);
+	}
+
+	if (0 != totals->disk_cache_hits + totals->disk_cache_misses) {
+		g_string_append_printf(html, html_disk_cache, totals->disk_cache_hits, totals->disk_cache_misses,
+			totals->disk_cache_evictions);
+	}
+
+	li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Listen queues</strong></div>\n"));
+	li_g_string_append_len(html, CONST_STR_LEN(html_listen_queue_th));
+	for (i = 0; NULL != listen_queues && i < listen_queues->len; i++) {
+		mod_status_listen_data *ld = &g_array_index(listen_queues, mod_status_listen_data, i);
+
+		g_string_append_printf(html, html_listen_queue_row, ld->addr_str->str, ld->worker_ndx, ld->queued, ld->backlog);
+	}
+	li_g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+}
+
+static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count, GArray *listen_queues) {
 	GString *html, *css, *count_req, *count_bin, *count_bout, *count_mem, *tmpstr;
 	gchar *val;
 	guint i, j, len;
@@ -720,7 +1110,8 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 		connection_count[LI_CON_STATE_DEAD] + connection_count[LI_CON_STATE_CLOSE],
 		connection_count[LI_CON_STATE_REQUEST_START], connection_count[LI_CON_STATE_READ_REQUEST_HEADER],
 		connection_count[LI_CON_STATE_HANDLE_MAINVR], connection_count[LI_CON_STATE_WRITE],
-		connection_count[LI_CON_STATE_KEEP_ALIVE], connection_count[LI_CON_STATE_UPGRADED]
+		connection_count[LI_CON_STATE_KEEP_ALIVE], connection_count[LI_CON_STATE_UPGRADED],
+		connection_count[LI_CON_STATE_HTTP2]
 	);
 
 	/* response status codes */
@@ -729,6 +1120,22 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 		mod_status_response_codes[2], mod_status_response_codes[3], mod_status_response_codes[4]
 	);
 
+	status_info_accept_html(html, vr->wrk->srv, totals, listen_queues);
+
+	{
+		status_backend_health_data d;
+		d.html = g_string_sized_new(0);
+		d.now = li_cur_ts(vr->wrk);
+		li_backend_health_foreach(vr->wrk->srv->backend_health, status_backend_health_html_cb, &d);
+		if (d.html->len > 0) {
+			li_g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Backend health</strong></div>\n"));
+			li_g_string_append_len(html, CONST_STR_LEN(html_backend_health_th));
+			li_g_string_append_len(html, GSTR_LEN(d.html));
+			li_g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+		}
+		g_string_free(d.html, TRUE);
+	}
+
 
 	/* list connections */
 	if (!short_info) {
@@ -808,8 +1215,9 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 	return html;
 }
 
-static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count) {
+static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count, GArray *listen_queues) {
 	GString *html;
+	guint i;
 
 	html = g_string_sized_new(1024 - 1);
 
@@ -857,6 +1265,8 @@ static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *to
 	li_string_append_int(html, connection_count[LI_CON_STATE_KEEP_ALIVE]);
 	li_g_string_append_len(html, CONST_STR_LEN("\nconnection_state_upgraded: "));
 	li_string_append_int(html, connection_count[LI_CON_STATE_UPGRADED]);
+	li_g_string_append_len(html, CONST_STR_LEN("\nconnection_state_http2: "));
+	li_string_append_int(html, connection_count[LI_CON_STATE_HTTP2]);
 	/* status cpdes */
 	li_g_string_append_len(html, CONST_STR_LEN("\n\n# Status Codes (since start)\nstatus_1xx: "));
 	li_string_append_int(html, mod_status_response_codes[0]);
@@ -868,6 +1278,111 @@ static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *to
 	li_string_append_int(html, mod_status_response_codes[3]);
 	li_g_string_append_len(html, CONST_STR_LEN("\nstatus_5xx: "));
 	li_string_append_int(html, mod_status_response_codes[4]);
+	/* accept */
+	li_g_string_append_len(html, CONST_STR_LEN("\n\n# Accept (since start)\naccepted: "));
+	li_string_append_int(html, totals->accepted);
+	li_g_string_append_len(html, CONST_STR_LEN("\naccept_wakeups: "));
+	li_string_append_int(html, totals->accept_wakeups);
+	li_g_string_append_len(html, CONST_STR_LEN("\naccept_batch_max: "));
+	li_string_append_int(html, totals->accept_batch_max);
+	li_g_string_append_len(html, CONST_STR_LEN("\naccept_batch_hist:"));
+	for (i = 0; i < LI_STATS_HIST_SIZE; i++) {
+		g_string_append_c(html, ' ');
+		li_string_append_int(html, totals->accept_batch_hist[i]);
+	}
+	li_g_string_append_len(html, CONST_STR_LEN("\ndispatch_latency_us_hist:"));
+	for (i = 0; i < LI_STATS_HIST_SIZE; i++) {
+		g_string_append_c(html, ' ');
+		li_string_append_int(html, totals->dispatch_latency_hist[i]);
+	}
+	li_g_string_append_len(html, CONST_STR_LEN("\ncork_syscalls: "));
+	li_string_append_int(html, totals->cork_syscalls);
+	li_g_string_append_len(html, CONST_STR_LEN("\ncork_syscalls_saved: "));
+	li_string_append_int(html, (gint64) totals->cork_syscalls_baseline - (gint64) totals->cork_syscalls);
+	/* stat cache */
+	li_g_string_append_len(html, CONST_STR_LEN("\n\n# Stat Cache (since start)\nstat_cache_hits: "));
+	li_string_append_int(html, totals->stat_cache_hits);
+	li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_shared_hits: "));
+	li_string_append_int(html, totals->stat_cache_shared_hits);
+	li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_misses: "));
+	li_string_append_int(html, totals->stat_cache_misses);
+	li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_errors: "));
+	li_string_append_int(html, totals->stat_cache_errors);
+	{
+		liServer *srv = vr->wrk->srv;
+		guint64 invalidations = 0;
+		guint watches = 0;
+		if (NULL != srv->stat_cache_shared) li_stat_cache_shared_counters(srv->stat_cache_shared, &invalidations, &watches);
+		li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_invalidations: "));
+		li_string_append_int(html, invalidations);
+		li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_worker_invalidations: "));
+		li_string_append_int(html, totals->stat_cache_invalidated);
+		li_g_string_append_len(html, CONST_STR_LEN("\nstat_cache_watches: "));
+		li_string_append_int(html, watches);
+	}
+	if (li_fd_cache_enabled(vr->wrk->srv->fd_cache)) {
+		guint entries;
+		guint64 evictions;
+		li_fd_cache_counters(vr->wrk->srv->fd_cache, &entries, &evictions);
+		li_g_string_append_len(html, CONST_STR_LEN("\nfd_cache_hits: "));
+		li_string_append_int(html, totals->fd_cache_hits);
+		li_g_string_append_len(html, CONST_STR_LEN("\nfd_cache_misses: "));
+		li_string_append_int(html, totals->fd_cache_misses);
+		li_g_string_append_len(html, CONST_STR_LEN("\nfd_cache_entries: "));
+		li_string_append_int(html, entries);
+		li_g_string_append_len(html, CONST_STR_LEN("\nfd_cache_evictions: "));
+		li_string_append_int(html, evictions);
+	}
+	if (li_mem_cache_enabled(vr->wrk->srv->mem_cache)) {
+		guint entries;
+		goffset size;
+		guint64 rejected, evictions;
+		li_mem_cache_counters(vr->wrk->srv->mem_cache, &entries, &size, &rejected, &evictions);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_hits: "));
+		li_string_append_int(html, totals->mem_cache_hits);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_misses: "));
+		li_string_append_int(html, totals->mem_cache_misses);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_entries: "));
+		li_string_append_int(html, entries);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_bytes: "));
+		li_string_append_int(html, size);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_rejected: "));
+		li_string_append_int(html, rejected);
+		li_g_string_append_len(html, CONST_STR_LEN("\nmem_cache_evictions: "));
+		li_string_append_int(html, evictions);
+	}
+	if (0 != totals->disk_cache_hits + totals->disk_cache_misses) {
+		li_g_string_append_len(html, CONST_STR_LEN("\ndisk_cache_hits: "));
+		li_string_append_int(html, totals->disk_cache_hits);
+		li_g_string_append_len(html, CONST_STR_LEN("\ndisk_cache_misses: "));
+		li_string_append_int(html, totals->disk_cache_misses);
+		li_g_string_append_len(html, CONST_STR_LEN("\ndisk_cache_evictions: "));
+		li_string_append_int(html, totals->disk_cache_evictions);
+	}
+	{
+		guint64 overflows, drops;
+		if (status_listen_overflows(&overflows, &drops)) {
+			li_g_string_append_len(html, CONST_STR_LEN("\nlisten_overflows: "));
+			li_string_append_int(html, overflows);
+			li_g_string_append_len(html, CONST_STR_LEN("\nlisten_drops: "));
+			li_string_append_int(html, drops);
+		}
+	}
+	/* "listen_queue: <socket> <worker (0: main)> <queued> <backlog>" */
+	for (i = 0; NULL != listen_queues && i < listen_queues->len; i++) {
+		mod_status_listen_data *ld = &g_array_index(listen_queues, mod_status_listen_data, i);
+
+		li_g_string_append_len(html, CONST_STR_LEN("\nlisten_queue: "));
+		li_g_string_append_len(html, GSTR_LEN(ld->addr_str));
+		li_g_string_append_len(html, CONST_STR_LEN(" "));
+		li_string_append_int(html, ld->worker_ndx);
+		li_g_string_append_len(html, CONST_STR_LEN(" "));
+		li_string_append_int(html, ld->queued);
+		li_g_string_append_len(html, CONST_STR_LEN(" "));
+		li_string_append_int(html, ld->backlog);
+	}
+	/* "backend_health: <check> <state> <checks> <failed checks>" */
+	li_backend_health_foreach(vr->wrk->srv->backend_health, status_backend_health_plain_cb, html);
 
 	li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("text/plain"));
 
@@ -6,6 +6,7 @@
 #include <openssl/rand.h>
 
 
+
 struct liOpenSSLFilter {
 	int refcount;
 	const liOpenSSLFilterCallbacks *callbacks;
@@ -28,8 +29,51 @@ struct liOpenSSLFilter {
 	unsigned int client_initiated_renegotiation:1;
 	unsigned int closing:1, aborted:1;
 	unsigned int write_wants_read:1;
+	unsigned int ktls_tx:1; /* the kernel encrypts outgoing data; SSL_write() must not be used anymore */
+
+#ifdef LI_OPENSSL_KTLS
+	liIOStream *ktls_stream; /* socket openssl writes to directly until the handshake is done; NULL if not wanted (anymore) */
+#endif
 };
 
+#ifdef LI_OPENSSL_KTLS
+static void ktls_disable(liOpenSSLFilter *f) {
+	if (NULL != f->ktls_stream) {
+		li_iostream_release(f->ktls_stream);
+		f->ktls_stream = NULL;
+	}
+}
+
+/* openssl installs the keys in the kernel itself, but only on a socket BIO: write the handshake directly
+ * to the socket (nothing else is queued for it yet). the server flight fits into the empty socket buffer;
+ * SSL_ERROR_WANT_WRITE aborts the handshake (see do_handle_error)
+ */
+static void ktls_start(liOpenSSLFilter *f) {
+	BIO *sock_bio;
+	int fd = li_event_io_fd(&f->ktls_stream->io_watcher);
+
+	if (-1 == fd || NULL == (sock_bio = BIO_new_socket(fd, BIO_NOCLOSE))) {
+		ktls_disable(f);
+		return;
+	}
+	SSL_set0_wbio(f->ssl, sock_bio); /* drops one of the two references SSL_set_bio took on f->bio */
+}
+
+/* handshake done: either the kernel encrypts from now on, or everything goes through the chunkqueue BIO again */
+static void ktls_handshake_done(liOpenSSLFilter *f) {
+	if (BIO_get_ktls_send(SSL_get_wbio(f->ssl))) {
+		f->ktls_stream->ktls_tx = TRUE;
+		f->ktls_tx = TRUE;
+	} else {
+		_DEBUG(f->srv, f->wrk, f->log_context, "%s", "kernel TLS not available for this connection");
+		BIO_up_ref(f->bio);
+		SSL_set0_wbio(f->ssl, f->bio);
+	}
+	ktls_disable(f);
+}
+#endif
+
+
 #define BIO_TYPE_LI_STREAM (127|BIO_TYPE_SOURCE_SINK)
 
 static int stream_bio_write(BIO *bio, const char *buf, int len) {
@@ -42,6 +86,8 @@ static int stream_bio_write(BIO *bio, const char *buf, int len) {
 	cq = f->crypt_source.out;
 	if (cq->is_closed) return -1;
 
+	if (f->ktls_tx) return -1; /* would get encrypted again by the kernel */
+
 	li_chunkqueue_append_mem(cq, buf, len);
 	li_stream_notify_later(&f->crypt_source);
 
@@ -161,6 +207,10 @@ static void f_close_ssl(liOpenSSLFilter *f) {
 		li_stream_disconnect(&f->plain_drain); /* app -> plain in */
 		li_stream_disconnect_dest(&f->plain_source); /* plain out -> app */
 
+#ifdef LI_OPENSSL_KTLS
+		ktls_disable(f);
+#endif
+
 		f->log_context = NULL;
 		if (NULL != f->callbacks && NULL != f->callbacks->closed_cb) {
 			f->callbacks->closed_cb(f, f->callback_data);
@@ -212,11 +262,12 @@ static void do_handle_error(liOpenSSLFilter *f, const char *sslfunc, int r, gboo
 	case SSL_ERROR_WANT_READ:
 		if (writing) f->write_wants_read = TRUE;
 		break;
-	/*
 	case SSL_ERROR_WANT_WRITE:
-		we buffer all writes, can't happen! - handle as fatal error below
+		/* we buffer all writes; only the socket BIO used for the kernel TLS handshake can't take
+		 * everything. not worth waiting for the socket: the first flight fits into its buffer */
+		_DEBUG(f->srv, f->wrk, f->log_context, "%s: socket not writable during kernel TLS handshake", sslfunc);
+		f_abort_ssl(f);
 		break;
-	*/
 	case SSL_ERROR_SYSCALL:
 		/**
 			* man SSL_get_error()
@@ -281,6 +332,9 @@ static gboolean do_ssl_handshake(liOpenSSLFilter *f, gboolean writing) {
 	int r = SSL_do_handshake(f->ssl);
 	if (1 == r) {
 		f->initial_handshaked_finished = 1;
+#ifdef LI_OPENSSL_KTLS
+		if (NULL != f->ktls_stream) ktls_handshake_done(f);
+#endif
 		li_stream_acquire(&f->plain_source);
 		li_stream_acquire(&f->plain_drain);
 		f->callbacks->handshake_cb(f, f->callback_data, &f->plain_source, &f->plain_drain);
@@ -347,8 +401,8 @@ static void do_ssl_read(liOpenSSLFilter *f) {
 			do_handle_error(f, "SSL_read", r, FALSE);
 			goto out;
 		} else if (r == 0) {
-			/* clean shutdown? */
-			r = SSL_shutdown(f->ssl);
+			/* clean shutdown? (with kernel TLS openssl would send close_notify directly, ahead of data still queued for the socket) */
+			r = f->ktls_tx ? 0 : SSL_shutdown(f->ssl);
 			switch (r) {
 			case 0: /* don't care about bidirectional shutdown */
 			case 1: /* bidirectional shutdown finished */
@@ -392,6 +446,27 @@ out:
 	f_release(f);
 }
 
+/* the kernel encrypts everything written to the socket now: pass plain data through */
+static void do_ktls_write(liOpenSSLFilter *f) {
+	liChunkQueue *cq = f->plain_drain.out;
+
+	/* files don't count for the limit and are sent with sendfile() */
+	while (0 < cq->length && (FILE_CHUNK == li_chunkqueue_first_chunk(cq)->type
+			|| 0 != li_chunkqueue_limit_available(f->crypt_source.out))) {
+		li_chunkqueue_steal_chunk(f->crypt_source.out, cq);
+	}
+	li_stream_notify_later(&f->crypt_source);
+
+	if (cq->is_closed && 0 == cq->length) {
+		/* no close_notify: openssl would write it directly to the socket, maybe before data still queued there */
+		f->plain_source.out->is_closed = TRUE;
+		f->crypt_source.out->is_closed = TRUE;
+		f->crypt_drain.out->is_closed = TRUE;
+		li_stream_disconnect(&f->crypt_source); /* plain in -> crypt out */
+		f_close_ssl(f);
+	}
+}
+
 static void do_ssl_write(liOpenSSLFilter *f) {
 	const ssize_t blocksize = 16*1024; /* 16k */
 	char *block_data;
@@ -417,6 +492,11 @@ static void do_ssl_write(liOpenSSLFilter *f) {
 		goto out;
 	}
 
+	if (f->ktls_tx) {
+		do_ktls_write(f);
+		goto out;
+	}
+
 	do {
 		GError *err = NULL;
 		liChunkIter ci;
@@ -663,6 +743,7 @@ liOpenSSLFilter* li_openssl_filter_new(
 	f->client_initiated_renegotiation = 0;
 	f->closing = f->aborted = 0;
 	f->write_wants_read = 0;
+	f->ktls_tx = 0;
 
 	li_stream_init(&f->crypt_source, loop, stream_crypt_source_cb);
 	li_stream_init(&f->crypt_drain, loop, stream_crypt_drain_cb);
@@ -710,3 +791,14 @@ void li_openssl_filter_free(liOpenSSLFilter *f) {
 SSL* li_openssl_filter_ssl(liOpenSSLFilter *f) {
 	return f->ssl;
 }
+
+void li_openssl_filter_enable_ktls(liOpenSSLFilter *f, liIOStream *sock_stream) {
+#ifdef LI_OPENSSL_KTLS
+	LI_FORCE_ASSERT(NULL == f->ktls_stream && !f->initial_handshaked_finished);
+	li_iostream_acquire(sock_stream);
+	f->ktls_stream = sock_stream;
+	ktls_start(f);
+#else
+	UNUSED(f); UNUSED(sock_stream);
+#endif
+}
@@ -5,6 +5,12 @@
 
 #include <openssl/ssl.h>
 
+/* kernel TLS: openssl >= 3.0 installs the keys on a socket BIO (SSL_OP_ENABLE_KTLS), BIO_get_ktls_send() tells whether it worked */
+#if defined(LIGHTY_OS_LINUX) && OPENSSL_VERSION_NUMBER >= 0x30000000L \
+	&& !defined(OPENSSL_NO_KTLS) && defined(SSL_OP_ENABLE_KTLS)
+# define LI_OPENSSL_KTLS
+#endif
+
 typedef struct liOpenSSLFilter liOpenSSLFilter;
 
 typedef void (*liOpenSSLFilterHandshakeCB)(liOpenSSLFilter *f, gpointer data, liStream *plain_source, liStream *plain_drain);
@@ -26,4 +32,10 @@ LI_API void li_openssl_filter_free(liOpenSSLFilter *f);
 
 LI_API SSL* li_openssl_filter_ssl(liOpenSSLFilter *f);
 
+/* let the kernel encrypt outgoing data after the handshake (so files can be sent with sendfile()).
+ * openssl writes the handshake directly to the socket of sock_stream; call before anything else is written.
+ * needs SSL_OP_ENABLE_KTLS in the SSL_CTX; does nothing without LI_OPENSSL_KTLS.
+ */
+LI_API void li_openssl_filter_enable_ktls(liOpenSSLFilter *f, liIOStream *sock_stream);
+
 #endif
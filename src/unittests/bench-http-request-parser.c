@@ -0,0 +1,90 @@
+
+#include <lighttpd/base.h>
+#include <lighttpd/http_request_parser.h>
+
+/* compares the ragel request parser with the fast path (for each scanner the cpu supports) */
+
+#define ITERATIONS 200000
+
+static const gchar request_small[] =
+	"GET / HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"\r\n";
+
+static const gchar request_browser[] =
+	"GET /static/css/main.css?v=20231016 HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"Connection: keep-alive\r\n"
+	"sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+	"sec-ch-ua-mobile: ?0\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+	"sec-ch-ua-platform: \"Linux\"\r\n"
+	"Accept: text/css,*/*;q=0.1\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Dest: style\r\n"
+	"Referer: https://www.example.com/blog/2023/10/some-article-with-a-long-name.html\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+	"Cookie: session=2b1f4e0c9a7d4c2e8f6a1b3c5d7e9f01; _ga=GA1.2.1234567890.1697443200; theme=dark\r\n"
+	"If-None-Match: \"5f3c2a-1b2e-60a7c3d4e5f60\"\r\n"
+	"If-Modified-Since: Mon, 16 Oct 2023 08:00:00 GMT\r\n"
+	"\r\n";
+
+static void bench(const gchar *name, const gchar *header, gsize len, liHttpRequestScanImpl impl) {
+	liRequest req;
+	liHttpRequestCtx http_req_ctx;
+	liChunkQueue* cq = li_chunkqueue_new();
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	guint i;
+
+	if (!li_http_request_scan_select(impl)) {
+		g_print("%-8s %-8s not supported\n", name, li_http_request_scan_name(impl));
+		goto out;
+	}
+
+	li_request_init(&req);
+	li_http_request_parser_init(&http_req_ctx, &req, cq);
+
+	g_timer_start(timer);
+	for (i = 0; i < ITERATIONS; i++) {
+		li_chunkqueue_append_mem(cq, header, len);
+		if (LI_HANDLER_GO_ON != li_http_request_parse(NULL, &http_req_ctx)) g_error("parsing request failed");
+		li_http_request_parser_reset(&http_req_ctx);
+		li_request_reset(&req);
+	}
+	g_timer_stop(timer);
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_print("%-8s %-8s %8.1f ns/request %8.1f MB/s\n", name, li_http_request_scan_name(impl),
+		elapsed * 1e9 / ITERATIONS, (gdouble) len * ITERATIONS / elapsed / 1e6);
+
+	li_http_request_parser_clear(&http_req_ctx);
+	li_request_clear(&req);
+
+out:
+	g_timer_destroy(timer);
+	li_chunkqueue_free(cq);
+}
+
+int main(int argc, char **argv) {
+	static const liHttpRequestScanImpl impls[] = {
+		LI_HTTP_REQUEST_SCAN_NONE,
+		LI_HTTP_REQUEST_SCAN_SCALAR,
+		LI_HTTP_REQUEST_SCAN_SSE42,
+		LI_HTTP_REQUEST_SCAN_AVX2,
+	};
+	guint i;
+	UNUSED(argc); UNUSED(argv);
+
+	for (i = 0; i < G_N_ELEMENTS(impls); i++) {
+		bench("small", CONST_STR_LEN(request_small), impls[i]);
+	}
+	for (i = 0; i < G_N_ELEMENTS(impls); i++) {
+		bench("browser", CONST_STR_LEN(request_browser), impls[i]);
+	}
+
+	li_http_request_scan_select(LI_HTTP_REQUEST_SCAN_AUTO);
+	return 0;
+}
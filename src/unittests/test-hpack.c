@@ -0,0 +1,182 @@
+
+#include <lighttpd/base.h>
+
+static GByteArray* hex_decode(const gchar *hex) {
+	GByteArray *a = g_byte_array_new();
+
+	while ('\0' != *hex) {
+		guint8 c;
+		if (' ' == *hex) { hex++; continue; }
+		c = (g_ascii_xdigit_value(hex[0]) << 4) | g_ascii_xdigit_value(hex[1]);
+		g_byte_array_append(a, &c, 1);
+		hex += 2;
+	}
+
+	return a;
+}
+
+static void collect_header(gpointer data, const gchar *name, gsize namelen, const gchar *value, gsize valuelen) {
+	GString *headers = data;
+	g_string_append_len(headers, name, namelen);
+	g_string_append_len(headers, CONST_STR_LEN(": "));
+	g_string_append_len(headers, value, valuelen);
+	g_string_append_c(headers, '\n');
+}
+
+static void decode_check(liHPackTable *table, const gchar *hex, const gchar *expected, gsize table_size) {
+	GByteArray *block = hex_decode(hex);
+	GString *headers = g_string_sized_new(0);
+
+	g_assert(li_hpack_decode(table, block->data, block->len, collect_header, headers));
+	g_assert_cmpstr(headers->str, ==, expected);
+	g_assert_cmpuint(table->size, ==, table_size);
+
+	g_string_free(headers, TRUE);
+	g_byte_array_free(block, TRUE);
+}
+
+static gboolean decode_fails(const gchar *hex) {
+	liHPackTable table;
+	GByteArray *block = hex_decode(hex);
+	GString *headers = g_string_sized_new(0);
+	gboolean result;
+
+	li_hpack_table_init(&table, LI_HPACK_DEFAULT_TABLE_SIZE);
+	result = !li_hpack_decode(&table, block->data, block->len, collect_header, headers);
+	li_hpack_table_clear(&table);
+
+	g_string_free(headers, TRUE);
+	g_byte_array_free(block, TRUE);
+	return result;
+}
+
+#define REQUEST_1 ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+#define REQUEST_2 REQUEST_1 "cache-control: no-cache\n"
+#define REQUEST_3 ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"
+
+/* RFC 7541, C.3 */
+static void test_decode_requests(void) {
+	liHPackTable table;
+
+	li_hpack_table_init(&table, LI_HPACK_DEFAULT_TABLE_SIZE);
+	decode_check(&table, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", REQUEST_1, 57);
+	decode_check(&table, "8286 84be 5808 6e6f 2d63 6163 6865", REQUEST_2, 110);
+	decode_check(&table, "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", REQUEST_3, 164);
+	li_hpack_table_clear(&table);
+}
+
+/* RFC 7541, C.4 */
+static void test_decode_requests_huffman(void) {
+	liHPackTable table;
+
+	li_hpack_table_init(&table, LI_HPACK_DEFAULT_TABLE_SIZE);
+	decode_check(&table, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", REQUEST_1, 57);
+	decode_check(&table, "8286 84be 5886 a8eb 1064 9cbf", REQUEST_2, 110);
+	decode_check(&table, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", REQUEST_3, 164);
+	li_hpack_table_clear(&table);
+}
+
+/* RFC 7541, C.6: responses with eviction from a 256 byte table */
+static void test_decode_responses_eviction(void) {
+	liHPackTable table;
+
+	li_hpack_table_init(&table, 256);
+	decode_check(&table,
+		"4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+		":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n",
+		222);
+	decode_check(&table, "4883 640e ffc1 c0bf",
+		":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n",
+		222);
+	decode_check(&table,
+		"88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+		":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\nlocation: https://www.example.com\ncontent-encoding: gzip\nset-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n",
+		215);
+	g_assert_cmpuint(table.used, ==, 3);
+	li_hpack_table_clear(&table);
+}
+
+static void test_decode_errors(void) {
+	g_assert(decode_fails("80")); /* index 0 */
+	g_assert(decode_fails("be")); /* empty dynamic table */
+	g_assert(decode_fails("3fe21f")); /* size update above the limit */
+	g_assert(decode_fails("82 20")); /* size update after a header */
+	g_assert(decode_fails("400a 6375")); /* truncated string */
+	g_assert(decode_fails("ff ff ff ff ff 0f")); /* integer overflow */
+}
+
+static void test_encode_roundtrip(void) {
+	liHPackTable encoder, decoder;
+	guint i;
+
+	li_hpack_table_init(&encoder, LI_HPACK_DEFAULT_TABLE_SIZE);
+	li_hpack_table_init(&decoder, LI_HPACK_DEFAULT_TABLE_SIZE);
+	li_hpack_table_set_max_size(&encoder, 128); /* forces a size update and evictions */
+
+	for (i = 0; i < 32; i++) {
+		GByteArray *block = g_byte_array_new();
+		GString *headers = g_string_sized_new(0);
+		gchar *value = g_strdup_printf("value-%u", i % 5);
+		gchar *expected = g_strdup_printf(":status: 200\nx-custom: %s\ndate: Mon, 21 Oct 2013 20:13:22 GMT\nserver: lighttpd\n", value);
+
+		li_hpack_encode_start(&encoder, block);
+		li_hpack_encode(&encoder, block, CONST_STR_LEN(":status"), CONST_STR_LEN("200"));
+		li_hpack_encode(&encoder, block, CONST_STR_LEN("x-custom"), value, strlen(value));
+		li_hpack_encode(&encoder, block, CONST_STR_LEN("date"), CONST_STR_LEN("Mon, 21 Oct 2013 20:13:22 GMT"));
+		li_hpack_encode(&encoder, block, CONST_STR_LEN("server"), CONST_STR_LEN("lighttpd"));
+
+		g_assert(li_hpack_decode(&decoder, block->data, block->len, collect_header, headers));
+		g_assert_cmpstr(headers->str, ==, expected);
+		g_assert_cmpuint(encoder.size, ==, decoder.size);
+		g_assert_cmpuint(encoder.used, ==, decoder.used);
+		g_assert_cmpuint(encoder.size, <=, 128);
+
+		g_free(expected);
+		g_free(value);
+		g_string_free(headers, TRUE);
+		g_byte_array_free(block, TRUE);
+	}
+
+	li_hpack_table_clear(&encoder);
+	li_hpack_table_clear(&decoder);
+}
+
+static void test_huffman(void) {
+	guchar all[256];
+	GByteArray *encoded = g_byte_array_new();
+	GString *decoded = g_string_sized_new(0);
+	guint i;
+
+	for (i = 0; i < 256; i++) all[i] = i;
+	li_hpack_huffman_encode(encoded, all, 256);
+	g_assert_cmpuint(encoded->len, ==, li_hpack_huffman_encoded_length(all, 256));
+	g_assert(li_hpack_huffman_decode(decoded, encoded->data, encoded->len));
+	g_assert_cmpuint(decoded->len, ==, 256);
+	g_assert(0 == memcmp(decoded->str, all, 256));
+
+	/* "0" is 00000, padded with ones */
+	g_string_truncate(decoded, 0);
+	g_assert(li_hpack_huffman_decode(decoded, (const guchar*) "\x07", 1));
+	g_assert_cmpstr(decoded->str, ==, "0");
+
+	/* padding with zeroes, padding longer than 7 bits, EOS */
+	g_assert(!li_hpack_huffman_decode(decoded, (const guchar*) "\x00", 1));
+	g_assert(!li_hpack_huffman_decode(decoded, (const guchar*) "\x07\xff", 2));
+	g_assert(!li_hpack_huffman_decode(decoded, (const guchar*) "\xff\xff\xff\xff", 4));
+
+	g_string_free(decoded, TRUE);
+	g_byte_array_free(encoded, TRUE);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/hpack/decode/requests", test_decode_requests);
+	g_test_add_func("/hpack/decode/requests_huffman", test_decode_requests_huffman);
+	g_test_add_func("/hpack/decode/responses_eviction", test_decode_responses_eviction);
+	g_test_add_func("/hpack/decode/errors", test_decode_errors);
+	g_test_add_func("/hpack/encode/roundtrip", test_encode_roundtrip);
+	g_test_add_func("/hpack/huffman", test_huffman);
+
+	return g_test_run();
+}
@@ -52,11 +52,109 @@ static void test_lf_newlines(void) {
 	li_request_clear(&req);
 }
 
+static const liHttpRequestScanImpl scan_impls[] = {
+	LI_HTTP_REQUEST_SCAN_NONE,
+	LI_HTTP_REQUEST_SCAN_SCALAR,
+	LI_HTTP_REQUEST_SCAN_SSE42,
+	LI_HTTP_REQUEST_SCAN_AVX2,
+};
+
+/* parse header (split into chunks at the '|' characters) and dump the result */
+static liHandlerResult parse_request(const gchar *header, GString *result, goffset *remaining) {
+	liRequest req;
+	liHttpRequestCtx http_req_ctx;
+	liChunkQueue* cq = li_chunkqueue_new();
+	liHandlerResult res;
+	gchar **parts, **part;
+	GList *l;
+
+	parts = g_strsplit(header, "|", -1);
+	for (part = parts; NULL != *part; part++) {
+		li_chunkqueue_append_mem(cq, *part, strlen(*part));
+	}
+	g_strfreev(parts);
+
+	li_request_init(&req);
+	li_http_request_parser_init(&http_req_ctx, &req, cq);
+
+	res = li_http_request_parse(NULL, &http_req_ctx);
+
+	g_string_printf(result, "%s %s %i\n", req.http_method_str->str, req.uri.raw->str, req.http_version);
+	for (l = g_queue_peek_head_link(&req.headers->entries); l; l = g_list_next(l)) {
+		liHttpHeader *h = (liHttpHeader*) l->data;
+		g_string_append_printf(result, "[%s]\n", h->data->str);
+	}
+	*remaining = cq->length;
+
+	li_chunkqueue_free(cq);
+	li_http_request_parser_clear(&http_req_ctx);
+	li_request_clear(&req);
+
+	return res;
+}
+
+/* all scanner implementations (and the ragel parser alone) have to produce the same result */
+static void check_request(const gchar *header, liHandlerResult expected_res) {
+	GString *expected = g_string_sized_new(0), *result = g_string_sized_new(0);
+	goffset expected_remaining, remaining;
+	guint i;
+
+	g_assert(li_http_request_scan_select(LI_HTTP_REQUEST_SCAN_NONE));
+	g_assert_cmpint(parse_request(header, expected, &expected_remaining), ==, expected_res);
+
+	for (i = 1; i < G_N_ELEMENTS(scan_impls); i++) {
+		if (!li_http_request_scan_select(scan_impls[i])) continue; /* not supported by this cpu */
+		g_assert_cmpint(parse_request(header, result, &remaining), ==, expected_res);
+		if (LI_HANDLER_GO_ON != expected_res) continue;
+		g_assert_cmpstr(result->str, ==, expected->str);
+		g_assert_cmpint(remaining, ==, expected_remaining);
+	}
+
+	li_http_request_scan_select(LI_HTTP_REQUEST_SCAN_AUTO);
+	g_string_free(expected, TRUE);
+	g_string_free(result, TRUE);
+}
+
+static void test_fast_path(void) {
+	check_request(
+		"GET /index.html?x=1 HTTP/1.1\r\n"
+		"Host: www.example.com\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0 Safari/537.36\r\n"
+		"Accept:  text/html,application/xhtml+xml,*/*;q=0.8  \r\n"
+		"X-Empty:\r\n"
+		"X-Tab:\ta\t \r\n"
+		"sec-ch-ua: \"Chromium\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+		"If-None-Match: \"a\\\"b\"\r\n"
+		"\r\n"
+		"body", LI_HANDLER_GO_ON);
+	check_request("\r\n\nPOST /upload HTTP/1.0\nContent-Length: 4\n\nbody", LI_HANDLER_GO_ON);
+	check_request("GET * HTTP/2.10\r\n\r\n", LI_HANDLER_GO_ON);
+}
+
+static void test_fast_path_fallback(void) {
+	/* fragmented */
+	check_request("GET / HTTP/1.1\r\nHo|st: www.example.com\r\n\r\n", LI_HANDLER_GO_ON);
+	check_request("GET / HTTP/1.1\r|\nHost: www.example.com\r\n\r|\n", LI_HANDLER_GO_ON);
+	/* continuation lines, line breaks in quoted strings */
+	check_request("GET / HTTP/1.1\r\nX-Long: a\r\n  b\r\n\r\n", LI_HANDLER_GO_ON);
+	check_request("GET / HTTP/1.1\r\nX-Quoted: \"a\r\n b\"\r\n\r\n", LI_HANDLER_GO_ON);
+	/* incomplete */
+	check_request("GET / HTTP/1.1\r\nHost: www.example.com\r\n", LI_HANDLER_WAIT_FOR_EVENT);
+	/* invalid */
+	check_request("GET / HTTP/1.1\r\nBad Key: x\r\n\r\n", LI_HANDLER_ERROR);
+	check_request("GET / HTTP/1.1\r\nX: \"unterminated\r\n\r\n", LI_HANDLER_ERROR);
+	check_request("GET / HTTP/1.1\r\nX: a\rb\r\n\r\n", LI_HANDLER_ERROR);
+	check_request("GET  / HTTP/1.1\r\n\r\n", LI_HANDLER_ERROR);
+	check_request("G(T / HTTP/1.1\r\n\r\n", LI_HANDLER_ERROR);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/http-request-parser/crlf_newlines", test_crlf_newlines);
 	g_test_add_func("/http-request-parser/lf_newlines", test_lf_newlines);
+	g_test_add_func("/http-request-parser/fast_path", test_fast_path);
+	g_test_add_func("/http-request-parser/fast_path_fallback", test_fast_path_fallback);
 
 	return g_test_run();
 }
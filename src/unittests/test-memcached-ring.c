@@ -0,0 +1,147 @@
+
+#include <lighttpd/base.h>
+#include <lighttpd/memcached.h>
+
+#define KEYS 1000
+
+static const char *const servers[] = { "127.0.0.1:11211", "127.0.0.2:11211", "127.0.0.3:11211", "127.0.0.4:11211" };
+
+/* the ring lookup doesn't need an event loop; connections are only created for requests */
+static liMemcachedCluster* ring_new(const guint *order, guint count) {
+	liSocketAddress addrs[G_N_ELEMENTS(servers)];
+	liMemcachedCluster *cluster;
+	guint i;
+
+	g_assert_cmpuint(count, <=, G_N_ELEMENTS(servers));
+
+	for (i = 0; i < count; i++) {
+		GString *s = g_string_new(servers[order[i]]);
+		addrs[i] = li_sockaddr_from_string(s, 11211);
+		g_assert(NULL != addrs[i].addr_up.raw);
+		g_string_free(s, TRUE);
+	}
+
+	cluster = li_memcached_cluster_new(NULL, addrs, count, 1);
+
+	for (i = 0; i < count; i++) {
+		li_sockaddr_clear(&addrs[i]);
+	}
+
+	return cluster;
+}
+
+/* server (index into servers) for each key */
+static void ring_map(liMemcachedCluster *cluster, const guint *order, const gboolean *down, guint *map) {
+	GString *key = g_string_sized_new(15);
+	guint i;
+
+	for (i = 0; i < KEYS; i++) {
+		g_string_printf(key, "key%u", i);
+		map[i] = order[li_memcached_cluster_lookup(cluster, key, down)];
+	}
+
+	g_string_free(key, TRUE);
+}
+
+static void test_ring_stable(void) {
+	static const guint order[] = { 0, 1, 2 };
+	guint first[KEYS], second[KEYS], counts[3] = { 0, 0, 0 };
+	liMemcachedCluster *cluster = ring_new(order, 3);
+	guint i;
+
+	ring_map(cluster, order, NULL, first);
+	ring_map(cluster, order, NULL, second);
+
+	for (i = 0; i < KEYS; i++) {
+		g_assert_cmpuint(first[i], ==, second[i]);
+		counts[first[i]]++;
+	}
+
+	/* 160 points per server: every server gets roughly a third */
+	for (i = 0; i < 3; i++) {
+		g_assert_cmpuint(counts[i], >, KEYS / 5);
+		g_assert_cmpuint(counts[i], <, KEYS / 2);
+	}
+
+	li_memcached_cluster_free(cluster);
+}
+
+static void test_ring_order(void) {
+	static const guint order1[] = { 0, 1, 2 }, order2[] = { 2, 0, 1 };
+	guint map1[KEYS], map2[KEYS];
+	liMemcachedCluster *cluster1 = ring_new(order1, 3), *cluster2 = ring_new(order2, 3);
+	guint i;
+
+	ring_map(cluster1, order1, NULL, map1);
+	ring_map(cluster2, order2, NULL, map2);
+
+	/* positions only depend on the address, not on the order in the config */
+	for (i = 0; i < KEYS; i++) {
+		g_assert_cmpuint(map1[i], ==, map2[i]);
+	}
+
+	li_memcached_cluster_free(cluster1);
+	li_memcached_cluster_free(cluster2);
+}
+
+static void test_ring_add(void) {
+	static const guint order[] = { 0, 1, 2, 3 };
+	guint map3[KEYS], map4[KEYS], moved = 0;
+	liMemcachedCluster *cluster3 = ring_new(order, 3), *cluster4 = ring_new(order, 4);
+	guint i;
+
+	ring_map(cluster3, order, NULL, map3);
+	ring_map(cluster4, order, NULL, map4);
+
+	/* only keys taken over by the new server move */
+	for (i = 0; i < KEYS; i++) {
+		if (map3[i] != map4[i]) {
+			g_assert_cmpuint(map4[i], ==, 3);
+			moved++;
+		}
+	}
+	g_assert_cmpuint(moved, >, 0);
+	g_assert_cmpuint(moved, <, KEYS / 2);
+
+	li_memcached_cluster_free(cluster3);
+	li_memcached_cluster_free(cluster4);
+}
+
+static void test_ring_down(void) {
+	static const guint order[] = { 0, 1, 2 };
+	static const gboolean down1[] = { FALSE, TRUE, FALSE }, all_down[] = { TRUE, TRUE, TRUE };
+	guint up[KEYS], failover[KEYS], owner[KEYS], moved = 0;
+	liMemcachedCluster *cluster = ring_new(order, 3);
+	guint i;
+
+	ring_map(cluster, order, NULL, up);
+	ring_map(cluster, order, down1, failover);
+	ring_map(cluster, order, all_down, owner);
+
+	for (i = 0; i < KEYS; i++) {
+		if (1 == up[i]) {
+			/* keys of the failed server go to the next servers on the ring */
+			g_assert_cmpuint(failover[i], !=, 1);
+			moved++;
+		} else {
+			/* all other keys stay */
+			g_assert_cmpuint(failover[i], ==, up[i]);
+		}
+		/* if all servers are down the owner is tried */
+		g_assert_cmpuint(owner[i], ==, up[i]);
+	}
+	g_assert_cmpuint(moved, >, 0);
+
+	li_memcached_cluster_free(cluster);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/memcached-ring/stable", test_ring_stable);
+	g_test_add_func("/memcached-ring/order", test_ring_order);
+	g_test_add_func("/memcached-ring/add", test_ring_add);
+	g_test_add_func("/memcached-ring/down", test_ring_down);
+
+	return g_test_run();
+}
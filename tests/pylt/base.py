@@ -76,6 +76,9 @@ class Env:
     force_cleanup: bool = False
     port: int = 0
     tests: list[str] = dataclasses.field(default_factory=list)
+    features: list[str] = dataclasses.field(default_factory=list)
+    network_backend: str = ''
+    zerocopy_threshold: int = 0
     sourcedir: str = ''
     contribdir: str = ''
     debugRequests: bool = False
@@ -305,12 +308,12 @@ class TestBase(metaclass=_TestBaseMeta):
         self.tests.remove_dir(dirname)
 
     # public
-    def prepare_vhost_file(self, fname: str, content: str, mode: int = 0o644) -> str:
+    def prepare_vhost_file(self, fname: str, content: typing.Union[str, bytes], mode: int = 0o644) -> str:
         """remembers which files have been prepared and removes them on cleanup; returns absolute pathname"""
         fname = os.path.join('www', 'vhosts', self.vhost, fname)
         return self.prepare_file(fname, content, mode=mode)
 
-    def prepare_file(self, fname: str, content: str, mode: int = 0o644) -> str:
+    def prepare_file(self, fname: str, content: typing.Union[str, bytes], mode: int = 0o644) -> str:
         """remembers which files have been prepared and removes them on cleanup; returns absolute pathname"""
         self._test_cleanup_files.append(fname)
         return self.tests.install_file(fname, content, mode=mode)
@@ -466,6 +469,16 @@ class Tests:
         errorlog = self.install_file("log/error.log", "")
         errorconfig = self.env.debug and " " or f"""log [ default => "file:{errorlog}" ];"""
         accesslog = self.install_file("log/access.log", "")
+        # udp, same port as the gnutls listener
+        http3config = ""
+        if "http3" in self.env.features:
+            http3config = f"""http3 [ "listen" => "127.0.0.2:{self.env.port + 1}", "pemfile" => var.ssldir + "/server_test1.ssl.pem" ];"""
+        # run the whole suite with another write path
+        networkconfig = ""
+        if self.env.network_backend:
+            networkconfig += f"""network.backend "{self.env.network_backend}";"""
+        if self.env.zerocopy_threshold > 0:
+            networkconfig += f"""network.zerocopy_threshold {self.env.zerocopy_threshold};"""
         self.config = textwrap.dedent(fr"""
             global var.contribdir = "{self.env.contribdir}";
             global var.ssldir = "{self.env.sourcedir}/tests/ca";
@@ -486,6 +499,7 @@ class Tests:
                 ];
 
                 listen "127.0.0.2:{self.env.port}";
+                listen.reuseport "127.0.0.2:" + cast(string)({self.env.port} + 7);
                 gnutls [
                     "listen" => "127.0.0.2:" + cast(string)({self.env.port} + 1),
                     "pemfile" => var.ssldir + "/server_test1.ssl.pem",
@@ -496,6 +510,8 @@ class Tests:
                     "pemfile" => var.ssldir + "/server_test1.ssl.pem",
                     "ca-file" => var.ssldir + "/intermediate.crt",
                 ];
+                {http3config}
+                {networkconfig}
 
                 log [ default => "stderr" ];
 
@@ -517,6 +533,9 @@ class Tests:
 
                 io.timeout 300;
                 stat_cache.ttl 10;
+                stat_cache.shared true;
+                stat_cache.fd_cache 64;
+                static.memory_cache 1mbyte;
             }}
 
             proxy_protocol.trust;
@@ -582,6 +601,8 @@ class Tests:
 
         gnutlsport = self.env.port + 1
         opensslport = self.env.port + 2
+        ktlsport = self.env.port + 4
+        reuseportport = self.env.port + 7
         self.env.angelconf = self.install_file(
             "conf/angel.conf",
             textwrap.dedent(f"""
@@ -594,6 +615,7 @@ class Tests:
 
                 allow_listen "127.0.0.2:{self.env.port}";
                 allow_listen ["127.0.0.2:{gnutlsport}", "127.0.0.2:{opensslport}"];
+                allow_listen ["127.0.0.2:{ktlsport}", "127.0.0.2:{reuseportport}"];
             """),
         )
 
@@ -700,12 +722,12 @@ class Tests:
 
     ## helpers for prepare/cleanup
 
-    def _preparefile(self, fname: str, content: str, mode: int = 0o644) -> None:
+    def _preparefile(self, fname: str, content: typing.Union[str, bytes], mode: int = 0o644) -> None:
         if fname in self.prepared_files:
             raise Exception(f"File {fname!r} already exists!")
         else:
             path = os.path.join(self.env.dir, fname)
-            f = open(path, "w")
+            f = open(path, isinstance(content, bytes) and "wb" or "w")
             f.write(content)
             f.close()
             os.chmod(path, mode)
@@ -737,7 +759,7 @@ class Tests:
             except Exception as e:
                 eprint(f"Couldn't delete directory {dirname!r}: {e}")
 
-    def install_file(self, fname: str, content: str, mode: int = 0o644) -> str:
+    def install_file(self, fname: str, content: typing.Union[str, bytes], mode: int = 0o644) -> str:
         """Add file to tmpdir. Needs call to remove_file later to clean it up."""
         path = list(filter(lambda x: x != '', fname.split('/')))
         for i in range(1, len(path)):
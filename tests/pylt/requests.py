@@ -10,6 +10,16 @@ import zlib
 
 import pycurl
 
+# optional, only needed to decode br / zstd responses
+try:
+    import brotli
+except ImportError:
+    brotli = None
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
 from pylt.base import log, TestBase, Tests
 
 
@@ -45,11 +55,11 @@ class Response:
             if not line:
                 raise Exception('First line must not be empty')
             self.first_line = line
+            # HTTP/2 status lines have no reason phrase
             parts = line.split(maxsplit=2)
-            if len(parts) != 3:
+            if len(parts) < 2:
                 raise Exception(f'Invalid first line {line!r}')
-            _version, code, _reason = parts
-            self.code = int(code)
+            self.code = int(parts[1])
         elif not line:
             if self.code == 100:
                 if self._debug_requests:
@@ -91,6 +101,14 @@ class Response:
         self.body_decoded = data.decode()
         return self.body_decoded
 
+    @staticmethod
+    def can_decode(method: str) -> bool:
+        if 'br' == method:
+            return not brotli is None
+        elif 'zstd' == method:
+            return not zstandard is None
+        return method in ('x-gzip', 'gzip', 'deflate', 'x-bzip2', 'bzip2')
+
     @staticmethod
     def _decode(method: str, data: bytes) -> bytes:
         if 'x-gzip' == method or 'gzip' == method:
@@ -104,6 +122,11 @@ class Response:
             raise CurlRequestException(f"Unsupported content-encoding {method}")
         elif 'x-bzip2' == method or 'bzip2' == method:
             return bz2.decompress(data)
+        elif 'br' == method and not brotli is None:
+            return brotli.decompress(data)
+        elif 'zstd' == method and not zstandard is None:
+            # streamed frames don't contain the content size
+            return zstandard.ZstdDecompressor().decompressobj().decompress(data)
         else:
             raise CurlRequestException(f"Unsupported content-encoding {method}")
 
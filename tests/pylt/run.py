@@ -54,6 +54,24 @@ def parse_args() -> optparse.Values:
         "--plugindir",
         help="Path to plugin directory (required)",
     )
+    parser.add_option(
+        "--feature",
+        help="Optional feature lighttpd was built with (can be given multiple times)",
+        action="append",
+        dest="features",
+        default=[],
+    )
+    parser.add_option(
+        "--network-backend",
+        help="Run the tests with this network.backend (default: lighttpd default)",
+        default="",
+    )
+    parser.add_option(
+        "--zerocopy-threshold",
+        help="Run the tests with this network.zerocopy_threshold (default: 0 = off)",
+        default=0,
+        type="int",
+    )
     parser.add_option(
         "-k", "--no-cleanup",
         help="Keep temporary files, no cleanup",
@@ -150,6 +168,9 @@ def setup_env() -> Env:
     env.force_cleanup = options.force_cleanup
     env.port = find_port(options.port)
     env.tests = options.tests
+    env.features = options.features
+    env.network_backend = options.network_backend
+    env.zerocopy_threshold = options.zerocopy_threshold
     env.sourcedir = os.path.dirname(os.path.dirname(os.path.abspath(os.path.dirname(__file__))))
     env.contribdir = os.path.join(env.sourcedir, "contrib")
     env.debugRequests = options.debug_requests
@@ -0,0 +1,73 @@
+# -*- coding: utf-8 -*-
+
+import os
+import shutil
+import time
+
+import pycurl
+
+from pylt.base import ModuleTest, TestBase
+
+
+# max-files 3: the fourth file evicts the least recently used one, which isn't the oldest after a hit
+class TestEvictLRU(TestBase):
+    no_docroot = True
+
+    def prepare_test(self) -> None:
+        self.cachedir = self.tests.install_dir(os.path.join("tmp", "cache_etag_lru"))
+        self.config = f"""
+header.add "ETag" => "\\"lru\\"";
+respond 200 => "%{{req.path}}";
+cache.disk.etag [ "path" => "{self.cachedir}", "max-files" => 3 ];
+"""
+
+    def fetch(self, curl: pycurl.Curl, path: str) -> None:
+        curl.setopt(pycurl.URL, f"http://127.0.0.2:{self.tests.env.port}{path}")
+        curl.perform()
+        if curl.getinfo(pycurl.RESPONSE_CODE) != 200:
+            raise Exception(f"Request {path!r} failed with status {curl.getinfo(pycurl.RESPONSE_CODE)}")
+        # files are added to the index after the response was written completely
+        time.sleep(0.2)
+
+    # cache files are named "<path>-<base64 etag>"
+    def cached(self) -> set[str]:
+        try:
+            names = os.listdir(os.path.join(self.cachedir, "lru"))
+        except FileNotFoundError:
+            return set()
+        return {name.split("-", 1)[0] for name in names}
+
+    def run_test(self) -> bool:
+        curl = pycurl.Curl()
+        try:
+            curl.setopt(pycurl.HTTPHEADER, [f"Host: {self.vhost}"])
+            curl.setopt(pycurl.NOSIGNAL, 1)
+            curl.setopt(pycurl.TIMEOUT, 2)
+            curl.setopt(pycurl.WRITEFUNCTION, lambda data: None)
+
+            for name in ("a", "b", "c"):
+                self.fetch(curl, f"/lru/{name}")
+            if self.cached() != {"a", "b", "c"}:
+                raise Exception(f"Unexpected cache files {sorted(self.cached())!r}")
+
+            # "b" is the least recently used one now
+            self.fetch(curl, "/lru/a")
+            self.fetch(curl, "/lru/d")
+        finally:
+            curl.close()
+
+        # files are removed in the background
+        deadline = time.monotonic() + 5
+        while self.cached() != {"a", "c", "d"}:
+            if time.monotonic() > deadline:
+                raise Exception(f"Unexpected cache files after eviction {sorted(self.cached())!r}")
+            time.sleep(0.1)
+        return True
+
+    def cleanup_test(self) -> None:
+        shutil.rmtree(os.path.join(self.cachedir, "lru"), ignore_errors=True)
+        self.tests.remove_dir(os.path.join("tmp", "cache_etag_lru"))
+
+
+class Test(ModuleTest):
+    pass
@@ -0,0 +1,179 @@
+# -*- coding: utf-8 -*-
+
+import time
+
+from pylt import base
+from pylt.requests import CurlRequest
+
+
+class TestStore1(CurlRequest):
+    URL = "/cached?first"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestLookup1(CurlRequest):
+    URL = "/cached?second"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Cache-Control", "max-age=60")]
+
+    def run_test(self) -> bool:
+        # the response is only stored after its body was sent completely
+        time.sleep(0.2)
+        return super().run_test()
+
+
+class TestStore2(CurlRequest):
+    URL = "/private?first"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestLookup2(CurlRequest):
+    URL = "/private?second"
+    EXPECT_RESPONSE_BODY = "second"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(0.2)
+        return super().run_test()
+
+
+class TestStaleStore(CurlRequest):
+    URL = "/swr?first"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestStaleLookup(CurlRequest):
+    URL = "/swr?second"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        # wait until the response expired; this request starts the refresh
+        time.sleep(1.5)
+        return super().run_test()
+
+
+class TestStaleRefreshed(CurlRequest):
+    URL = "/swr?third"
+    EXPECT_RESPONSE_BODY = "second"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(0.2)
+        return super().run_test()
+
+
+class TestStaleCookieStore(CurlRequest):
+    URL = "/swr-cookie"
+    REQUEST_HEADERS = ["Cookie: c=first"]
+    EXPECT_RESPONSE_BODY = "cookie: c=first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestStaleCookieLookup(CurlRequest):
+    # the refresh started by this request must not send the client's cookie
+    URL = "/swr-cookie"
+    REQUEST_HEADERS = ["Cookie: c=second"]
+    EXPECT_RESPONSE_BODY = "cookie: c=first"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(1.5)
+        return super().run_test()
+
+
+class TestStaleCookieRefreshed(CurlRequest):
+    URL = "/swr-cookie"
+    REQUEST_HEADERS = ["Cookie: c=third"]
+    EXPECT_RESPONSE_BODY = "cookie: "
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(0.2)
+        return super().run_test()
+
+
+class TestStaleErrorStore(CurlRequest):
+    URL = "/sie?first"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestStaleErrorStatus(CurlRequest):
+    # the backend answers with 503 after the response expired
+    URL = "/sie?error"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(1.5)
+        return super().run_test()
+
+
+class TestStaleErrorBackendStore(CurlRequest):
+    URL = "/sie-backend?first"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestStaleErrorBackendFailed(CurlRequest):
+    # the backend can't be reached after the response expired
+    URL = "/sie-backend?error"
+    EXPECT_RESPONSE_BODY = "first"
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        time.sleep(1.5)
+        return super().run_test()
+
+
+class TestStaleErrorBackendNoStale(CurlRequest):
+    # nothing stored: the backend error is passed on
+    URL = "/sie-backend-empty?error"
+    EXPECT_RESPONSE_CODE = 503
+
+
+class Test(base.ModuleTest):
+    config = """
+cache_http;
+"""
+
+    def __init__(self, *, tests: base.Tests) -> None:
+        super().__init__(tests=tests)
+
+        self.plain_config = f"""
+setup {{ module_load ["mod_cache_http", "mod_proxy"]; }}
+
+cache_http = {{
+    cache.http.lookup ( "key" => "%{{req.path}}" );
+    if req.path == "/private" {{
+        header.add "Cache-Control" => "private";
+    }} else if req.path == "/swr" or req.path == "/swr-cookie" {{
+        header.add "Cache-Control" => "max-age=1, stale-while-revalidate=60";
+    }} else if req.path == "/sie" or req.path == "/sie-backend" or req.path == "/sie-backend-empty" {{
+        header.add "Cache-Control" => "max-age=1, stale-if-error=60";
+    }} else {{
+        header.add "Cache-Control" => "max-age=60";
+    }}
+    if req.path == "/sie-backend" or req.path == "/sie-backend-empty" {{
+        cache.http.backend {{
+            if req.query == "error" {{
+                proxy "unix:{self.tests.env.dir}/cache-http-no-backend.sock";
+            }} else {{
+                respond 200 => "%{{req.query}}";
+            }}
+        }};
+    }} else if req.path == "/sie" and req.query == "error" {{
+        respond 503 => "error";
+    }} else if req.path == "/swr-cookie" {{
+        respond 200 => "cookie: %{{req.header[Cookie]}}";
+    }} else {{
+        respond 200 => "%{{req.query}}";
+    }}
+    cache.http.store;
+}};
+"""
@@ -0,0 +1,66 @@
+# -*- coding: utf-8 -*-
+
+import socket
+import time
+
+from pylt.base import ModuleTest, TestBase
+from pylt.requests import TEST_TXT
+
+
+def _read_response(tcp_con: socket.socket, buf: bytes) -> tuple[bytes, bytes, bytes]:
+    while b'\r\n\r\n' not in buf:
+        chunk = tcp_con.recv(4096)
+        if not chunk:
+            raise Exception(f"Connection closed while reading response headers: {buf!r}")
+        buf += chunk
+    head, buf = buf.split(b'\r\n\r\n', 1)
+    length = None
+    for line in head.split(b'\r\n')[1:]:
+        key, value = line.split(b':', 1)
+        if key.strip().lower() == b'content-length':
+            length = int(value.strip())
+    if length is None:
+        raise Exception(f"Response without Content-Length: {head!r}")
+    while len(buf) < length:
+        chunk = tcp_con.recv(4096)
+        if not chunk:
+            raise Exception("Connection closed while reading response body")
+        buf += chunk
+    return head, buf[:length], buf[length:]
+
+
+class TestKeepAliveUncorked(TestBase):
+    # headers and file are two chunks, so the response is written corked; on a keep-alive
+    # connection the queue isn't closed, the end of the response must still remove the cork
+    # instead of leaving the last partial frame to the 200ms TCP_CORK timeout.
+    def run_test(self) -> bool:
+        req = f"GET /test.txt HTTP/1.1\r\nHost: {self.vhost}\r\n\r\n".encode()
+        slow = []
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as tcp_con:
+            tcp_con.settimeout(5)
+            tcp_con.connect(('127.0.0.2', self.tests.env.port))
+            buf = b''
+            for i in range(3):
+                start = time.monotonic()
+                tcp_con.sendall(req)
+                head, body, buf = _read_response(tcp_con, buf)
+                elapsed = time.monotonic() - start
+                if not head.startswith(b'HTTP/1.1 200'):
+                    raise Exception(f"Unexpected response {head!r}")
+                if body.decode() != TEST_TXT:
+                    raise Exception(f"Unexpected body {body!r}")
+                if elapsed >= 0.19:
+                    slow.append(elapsed)
+        # timing is meaningless when running under valgrind/strace/truss
+        if self.tests.env.valgrind or self.tests.env.strace or self.tests.env.truss:
+            return True
+        # the first request might be slow for other reasons (stat cache)
+        if len(slow) > 1:
+            raise Exception(f"Responses on a keep-alive connection took {slow!r} seconds; cork not removed?")
+        return True
+
+
+class Test(ModuleTest):
+    config = """
+defaultaction;
+"""
@@ -1,7 +1,13 @@
 # -*- coding: utf-8 -*-
 
-from pylt.base import ModuleTest
-from pylt.requests import CurlRequest, TEST_TXT
+import gzip
+import os
+import socketserver
+import threading
+import time
+
+from pylt.base import ModuleTest, Tests
+from pylt.requests import CurlRequest, Response, TEST_TXT
 
 
 class DeflateRequest(CurlRequest):
@@ -45,6 +51,47 @@ class TestXBzip2(DeflateRequest):
     ACCEPT_ENCODING = 'x-bzip2'
 
 
+class OptionalDeflateRequest(DeflateRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    FEATURE: str
+
+    def run_test(self) -> bool:
+        if not self.FEATURE in self.tests.env.features:
+            self.todo = True
+            return self.MissingFeature(self.FEATURE)
+        if not Response.can_decode(self.ACCEPT_ENCODING):
+            self.todo = True
+            return self.MissingFeature(f"python module to decode {self.ACCEPT_ENCODING}")
+        return super().run_test()
+
+
+class TestBrotli(OptionalDeflateRequest):
+    ACCEPT_ENCODING = 'br'
+    FEATURE = 'brotli'
+
+
+class TestZstd(OptionalDeflateRequest):
+    ACCEPT_ENCODING = 'zstd'
+    FEATURE = 'zstd'
+
+
+# highest q-value wins over the server preference (gzip before deflate)
+class TestQValue(DeflateRequest):
+    ACCEPT_ENCODING = 'gzip;q=0.5, deflate'
+
+    def prepare_test(self) -> None:
+        self.EXPECT_RESPONSE_HEADERS = [("Vary", "Accept-Encoding"), ("Content-Encoding", "deflate")]
+
+
+# q=0 excludes an encoding, even the preferred one
+class TestQValueExclude(DeflateRequest):
+    ACCEPT_ENCODING = 'gzip;q=0, deflate;q=0.5'
+
+    def prepare_test(self) -> None:
+        self.EXPECT_RESPONSE_HEADERS = [("Vary", "Accept-Encoding"), ("Content-Encoding", "deflate")]
+
+
 class TestDisableDeflate(CurlRequest):
     URL = "/test.txt?nodeflate"
     EXPECT_RESPONSE_BODY = TEST_TXT
@@ -53,10 +100,174 @@ class TestDisableDeflate(CurlRequest):
     EXPECT_RESPONSE_HEADERS = [("Content-Encoding", None)]
 
 
+PRECOMPRESSED_TXT = "precompressed\n"
+# not real brotli data; the variant is served as it is
+PRECOMPRESSED_BR = b"precompressed br\n"
+
+
+class PrecompressedRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    URL = "/test.txt"
+    EXPECT_RESPONSE_CODE = 200
+    config = """
+deflate.precompressed;
+static;
+"""
+
+    def prepare_test(self) -> None:
+        self.prepare_vhost_file("test.txt", TEST_TXT)
+        # mtime 0 in the gzip header, as Response expects it
+        self.gz_file = self.prepare_vhost_file("test.txt.gz", gzip.compress(PRECOMPRESSED_TXT.encode(), mtime=0))
+
+
+class TestPrecompressedGzip(PrecompressedRequest):
+    ACCEPT_ENCODING = "gzip"
+    EXPECT_RESPONSE_BODY = PRECOMPRESSED_TXT
+    EXPECT_RESPONSE_HEADERS = [
+        ("Content-Encoding", "gzip"),
+        ("Content-Type", "text/plain; charset=utf-8"),
+        ("Vary", "Accept-Encoding"),
+    ]
+
+
+# the uncompressed file still gets compressed by the global do_deflate
+class TestPrecompressedNotAccepted(PrecompressedRequest):
+    ACCEPT_ENCODING = "deflate"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+
+
+class TestPrecompressedOutdated(PrecompressedRequest):
+    ACCEPT_ENCODING = "gzip"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+
+    def prepare_test(self) -> None:
+        super().prepare_test()
+        # older than test.txt: must be ignored
+        old = time.time() - 3600
+        os.utime(self.gz_file, (old, old))
+
+
+# br is preferred, but the client wants gzip more
+class TestPrecompressedQValue(PrecompressedRequest):
+    ACCEPT_ENCODING = "gzip, br;q=0.5"
+    EXPECT_RESPONSE_BODY = PRECOMPRESSED_TXT
+    EXPECT_RESPONSE_HEADERS = [("Content-Encoding", "gzip")]
+
+    def prepare_test(self) -> None:
+        super().prepare_test()
+        self.prepare_vhost_file("test.txt.br", PRECOMPRESSED_BR)
+
+
+# same q-value: server preference (br first)
+class TestPrecompressedPreference(PrecompressedRequest):
+    ACCEPT_ENCODING = "gzip, br"
+    EXPECT_RESPONSE_HEADERS = [("Content-Encoding", "br")]
+
+    def prepare_test(self) -> None:
+        super().prepare_test()
+        self.prepare_vhost_file("test.txt.br", PRECOMPRESSED_BR)
+
+    def CheckResponse(self) -> bool:
+        if self.response.body_raw.getvalue() != PRECOMPRESSED_BR:
+            raise Exception("Unexpected response body")
+        return True
+
+
+class TestCompressedCache(CurlRequest):
+    URL = "/test.txt"
+    ACCEPT_ENCODING = "gzip"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Encoding", "gzip")]
+    plain_config = """
+setup { deflate.cache_size 1mbyte; }
+"""
+    config = """
+static;
+deflate;
+"""
+
+    def prepare_test(self) -> None:
+        self.prepare_vhost_file("test.txt", TEST_TXT)
+
+    def run_test(self) -> bool:
+        # the first request compresses the file; the result is stored before the response is complete
+        if not super().run_test():
+            return False
+        # different content with the same ETag (inode, mtime, size): only the
+        # cached compressed response still has the old content
+        fname = os.path.join(self.vhostdir, "test.txt")
+        st = os.stat(fname)
+        with open(fname, "r+") as f:
+            f.write(TEST_TXT.upper())
+        os.utime(fname, ns=(st.st_atime_ns, st.st_mtime_ns))
+        self.response = Response(_debug_requests=self.tests.env.debugRequests)
+        return super().run_test()
+
+
+# more than the default offload-threshold (256 KiB)
+SLOW_BODY = "".join(f"line {i:08}: slow backend response\n" for i in range(12000))
+SLOW_CHUNK = 64*1024
+
+
+class SlowBackendHandler(socketserver.StreamRequestHandler):
+    def handle(self) -> None:
+        # read request line and headers; GET has no body
+        while self.rfile.readline().strip():
+            pass
+        # no Content-Length: the response ends with the connection, while jobs are still running
+        self.wfile.write(b"HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n")
+        body = SLOW_BODY.encode()
+        for pos in range(0, len(body), SLOW_CHUNK):
+            self.wfile.write(body[pos:pos+SLOW_CHUNK])
+            self.wfile.flush()
+            time.sleep(0.02)
+
+
+class SlowBackend(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+
+    def __init__(self, *, tests: Tests) -> None:
+        self.port = tests.env.port + 5
+        super().__init__(('127.0.0.2', self.port), SlowBackendHandler)
+
+        self.listen_thread = threading.Thread(
+            target=self.serve_forever,
+            name=f"SlowBackend-{self.port}",
+        )
+        self.listen_thread.daemon = True
+        self.listen_thread.start()
+
+
+# compressed in the tasklet pool; the source closes while the last job is running,
+# the stream still must be finished properly
+class TestOffloadSlowBackend(CurlRequest):
+    URL = "/slow"
+    ACCEPT_ENCODING = "gzip"
+    EXPECT_RESPONSE_BODY = SLOW_BODY
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Encoding", "gzip")]
+    no_docroot = True
+
+    def prepare_test(self) -> None:
+        self.config = f"""
+proxy "127.0.0.2:{self.tests.env.port + 5}";
+deflate;
+"""
+
+
 class Test(ModuleTest):
     def prepare_test(self) -> None:
+        self.slow_backend = SlowBackend(tests=self.tests)
+        self.plain_config = """
+setup { module_load "mod_proxy"; }
+"""
         # deflate is enabled global too; force it here anyway
         self.config = """
 defaultaction;
 if req.query == "nodeflate" { req_header.remove "Accept-Encoding"; } static; do_deflate;
 """
+
+    def cleanup_test(self) -> None:
+        self.slow_backend.shutdown()
@@ -0,0 +1,109 @@
+# -*- coding: utf-8 -*-
+
+import socket
+import struct
+
+import pycurl
+
+from pylt.base import ModuleTest, TestBase
+from pylt.requests import CurlRequest, TEST_TXT
+
+
+def _curl_has_http2() -> bool:
+    return bool(pycurl.version_info()[4] & pycurl.VERSION_HTTP2) and hasattr(pycurl, 'CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE')
+
+
+class Http2Request(CurlRequest):
+    _NO_REGISTER = True  # only for metaclass
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        curl.setopt(pycurl.HTTP_VERSION, pycurl.CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE)
+
+    def run_test(self) -> bool:
+        if not _curl_has_http2():
+            self.todo = True
+            return self.MissingFeature("HTTP/2 support in libcurl")
+        return super().run_test()
+
+    def CheckResponse(self) -> bool:
+        if not self.response.first_line.startswith("HTTP/2"):
+            raise Exception(f"Expected a HTTP/2 response, got {self.response.first_line!r}")
+        return True
+
+
+class TestSimple(Http2Request):
+    URL = "/test.txt"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Type", "text/plain; charset=utf-8")]
+
+
+class TestNotFound(Http2Request):
+    URL = "/not-existing.txt"
+    EXPECT_RESPONSE_CODE = 404
+
+
+class TestPost(Http2Request):
+    URL = "/"
+    POST = b"Hello World!"
+    EXPECT_RESPONSE_BODY = "12"
+    EXPECT_RESPONSE_CODE = 200
+    config = """
+respond 200 => "%{req.header[Content-Length]}";
+"""
+
+
+def _frame(frame_type: int, flags: int, stream_id: int, payload: bytes = b'') -> bytes:
+    return struct.pack('>I', len(payload))[1:] + struct.pack('>BBI', frame_type, flags, stream_id) + payload
+
+
+class TestRapidReset(TestBase):
+    # opening streams and resetting them right away gets the connection closed with ENHANCE_YOUR_CALM
+    def run_test(self) -> bool:
+        authority = self.vhost.encode()
+        # :method GET, :scheme http, :path / (static table), :authority (literal without indexing)
+        block = b'\x82\x86\x84\x01' + bytes([len(authority)]) + authority
+        req = b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + _frame(0x4, 0, 0)
+        for i in range(500):
+            stream_id = 2 * i + 1
+            req += _frame(0x1, 0x5, stream_id, block)  # HEADERS, END_STREAM | END_HEADERS
+            req += _frame(0x3, 0, stream_id, struct.pack('>I', 0x8))  # RST_STREAM, CANCEL
+
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as tcp_con:
+            tcp_con.settimeout(2)
+            tcp_con.connect(('127.0.0.2', self.tests.env.port))
+            try:
+                tcp_con.sendall(req)
+            except (BrokenPipeError, ConnectionResetError):
+                pass  # the server might close the connection before everything was sent
+
+            response = b''
+            while True:
+                try:
+                    chunk = tcp_con.recv(4096)
+                except ConnectionResetError:
+                    break
+                if not chunk:
+                    break
+                response += chunk
+
+        while len(response) >= 9:
+            length = int.from_bytes(response[0:3], 'big')
+            frame_type = response[3]
+            payload = response[9:9 + length]
+            response = response[9 + length:]
+            if 0x7 == frame_type and len(payload) >= 8:
+                error = struct.unpack('>I', payload[4:8])[0]
+                if 0xb != error:
+                    raise Exception(f"Unexpected GOAWAY error code {error:#x} (wanted ENHANCE_YOUR_CALM)")
+                return True
+        raise Exception("Connection wasn't closed with a GOAWAY")
+
+
+class Test(ModuleTest):
+    config = """
+defaultaction;
+"""
+    plain_config = """
+setup { http2.cleartext true; }
+"""
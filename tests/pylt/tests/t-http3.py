@@ -0,0 +1,120 @@
+# -*- coding: utf-8 -*-
+
+import os
+import socket
+import typing
+
+import pycurl
+
+from pylt.base import TestBase
+from pylt.requests import CurlRequest, TEST_TXT
+
+
+FEATURE = "http3"
+
+
+def _curl_has_http3() -> bool:
+    return bool(pycurl.version_info()[4] & getattr(pycurl, 'VERSION_HTTP3', 0)) and hasattr(pycurl, 'CURL_HTTP_VERSION_3ONLY')
+
+
+class Http3Request(CurlRequest):
+    _NO_REGISTER = True  # only for metaclass
+
+    # the http3 listener shares the port number with the gnutls listener
+    PORT_OFFSET = 1
+    SCHEME = "https"
+    vhost = "test1.ssl.test"
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        curl.setopt(pycurl.HTTP_VERSION, pycurl.CURL_HTTP_VERSION_3ONLY)
+
+    def run_test(self) -> bool:
+        if not FEATURE in self.tests.env.features:
+            self.todo = True
+            return self.MissingFeature(FEATURE)
+        if not _curl_has_http3():
+            self.todo = True
+            return self.MissingFeature("HTTP/3 support in libcurl")
+        return super().run_test()
+
+    def CheckResponse(self) -> bool:
+        if not self.response.first_line.startswith("HTTP/3"):
+            raise Exception(f"Expected a HTTP/3 response, got {self.response.first_line!r}")
+        return True
+
+
+class TestSimple(Http3Request):
+    URL = "/test.txt"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Type", "text/plain; charset=utf-8")]
+
+
+class TestNotFound(Http3Request):
+    URL = "/not-existing.txt"
+    EXPECT_RESPONSE_CODE = 404
+
+
+class TestPost(Http3Request):
+    URL = "/"
+    POST = b"Hello World!"
+    EXPECT_RESPONSE_BODY = "12"
+    EXPECT_RESPONSE_CODE = 200
+    config = """
+respond 200 => "%{req.header[Content-Length]}";
+"""
+
+
+class TestAltSvc(CurlRequest):
+    # TLS responses advertise the listener
+    PORT_OFFSET = 1
+    SCHEME = "https"
+    URL = "/test.txt"
+    EXPECT_RESPONSE_CODE = 200
+    vhost = "test1.ssl.test"
+
+    def run_test(self) -> bool:
+        if not FEATURE in self.tests.env.features:
+            self.todo = True
+            return self.MissingFeature(FEATURE)
+        return super().run_test()
+
+    def CheckResponse(self) -> bool:
+        expected = f'h3=":{self.port}"; ma=86400'
+        alt_svc = self.response.headers.get("alt-svc", None)
+        if alt_svc != expected:
+            raise Exception(f"Unexpected Alt-Svc header {alt_svc!r} (wanted {expected!r})")
+        return True
+
+
+class TestStatelessReset(TestBase):
+    # short header packets for unknown connection ids get a stateless reset, which is smaller than the packet;
+    # packets too small to be from one of our connections are not answered
+    no_docroot = True
+
+    def send(self, udp: socket.socket, length: int) -> typing.Optional[bytes]:
+        # short header (fixed bit set), 18 bytes connection id, then "protected" garbage
+        udp.sendto(bytes([0x40]) + os.urandom(length - 1), ('127.0.0.2', self.tests.env.port + 1))
+        try:
+            return udp.recv(2048)
+        except socket.timeout:
+            return None
+
+    def run_test(self) -> bool:
+        if not FEATURE in self.tests.env.features:
+            self.todo = True
+            return self.MissingFeature(FEATURE)
+        with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as udp:
+            udp.settimeout(1)
+            reset = self.send(udp, 100)
+            if reset is None:
+                raise Exception("No stateless reset for an unknown connection id")
+            if not 1 + 5 + 16 <= len(reset) <= 43 or (reset[0] & 0xc0) != 0x40:
+                raise Exception(f"Unexpected stateless reset {reset!r}")
+            reset = self.send(udp, 40)
+            if reset is None or len(reset) >= 40:
+                raise Exception(f"Stateless reset not smaller than the packet: {reset!r}")
+            reset = self.send(udp, 30)
+            if reset is not None:
+                raise Exception(f"Stateless reset for a packet too small for a connection: {reset!r}")
+        return True
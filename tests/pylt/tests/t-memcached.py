@@ -4,6 +4,8 @@ import socket
 import os
 import time
 
+import pycurl
+
 from pylt import base
 from pylt.requests import CurlRequest
 from pylt.service import Service
@@ -53,15 +55,102 @@ class TestLookup1(CurlRequest):
         return super().run_test()
 
 
+class TestHeadersStore(CurlRequest):
+    URL = "/headers"
+    EXPECT_RESPONSE_BODY = "Hello Headers!"
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("X-Memcached-Hit", "false")]
+
+
+# status and selected headers are replayed, others are not
+class TestHeadersLookup(CurlRequest):
+    URL = "/headers"
+    EXPECT_RESPONSE_BODY = "Hello Headers!"
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [
+        ("X-Memcached-Hit", "true"),
+        ("Cache-Control", "max-age=60"),
+        ("ETag", '"mc-test"'),
+        ("X-Not-Stored", None),
+    ]
+    # deflate would change the ETag
+    ACCEPT_ENCODING = None
+
+    def run_test(self) -> bool:
+        time.sleep(0.2)
+        return super().run_test()
+
+
+class TestHeadersNotModified(CurlRequest):
+    URL = "/headers"
+    REQUEST_HEADERS = ['If-None-Match: "mc-test"']
+    EXPECT_RESPONSE_BODY = ""
+    EXPECT_RESPONSE_CODE = 304
+    EXPECT_RESPONSE_HEADERS = [("X-Memcached-Hit", "true"), ("ETag", '"mc-test"')]
+    ACCEPT_ENCODING = None
+
+
+CLUSTER_KEYS = 20
+
+
+# cluster with the first server down: its keys fail over to the running server, the dead server is
+# skipped during its backoff, and every stored key is found again on the same server
+class TestClusterServerDown(CurlRequest):
+    URL = "/cluster/key0"
+    EXPECT_RESPONSE_BODY = "Hello Cluster!"
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("X-Memcached-Hit", "true")]
+
+    def fetch_hit(self, curl: pycurl.Curl, path: str) -> str:
+        hit = ""
+
+        def header(line: bytes) -> None:
+            nonlocal hit
+            key, _, value = line.decode().partition(":")
+            if key.strip().lower() == "x-memcached-hit":
+                hit = value.strip()
+
+        curl.setopt(pycurl.URL, self.curl_url[:-len(self.URL)] + path)
+        curl.setopt(pycurl.HEADERFUNCTION, header)
+        curl.setopt(pycurl.WRITEFUNCTION, lambda data: None)
+        curl.perform()
+        if curl.getinfo(pycurl.RESPONSE_CODE) != 200:
+            raise Exception(f"Request {path!r} failed with status {curl.getinfo(pycurl.RESPONSE_CODE)}")
+        return hit
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        for i in range(CLUSTER_KEYS):
+            hit = self.fetch_hit(curl, f"/cluster/key{i}")
+            if hit != "false":
+                raise Exception(f"Unexpected X-Memcached-Hit {hit!r} when storing key {i}")
+        # stores are sent after the requests are finished
+        time.sleep(0.2)
+        for i in range(1, CLUSTER_KEYS):
+            hit = self.fetch_hit(curl, f"/cluster/key{i}")
+            if hit != "true":
+                raise Exception(f"Key {i} not found again in cluster: X-Memcached-Hit {hit!r}")
+        curl.setopt(pycurl.URL, self.curl_url)
+        curl.setopt(pycurl.WRITEFUNCTION, self.response.body_raw.write)
+        curl.setopt(pycurl.HEADERFUNCTION, self.response.recv_header_line)
+
+
 class Test(base.ModuleTest):
     config = """
-memcache;
+if req.path == "/headers" {
+    memcache_headers;
+} else if req.path =^ "/cluster/" {
+    memcache_cluster;
+} else {
+    memcache;
+}
 """
 
     def __init__(self, *, tests: base.Tests) -> None:
         super().__init__(tests=tests)
 
         memcached = Memcached(tests=self.tests)
+        # no server listens on this socket
+        cluster_down = os.path.join(self.tests.env.dir, "tmp", "sockets", "memcached-down.sock")
         self.plain_config = f"""
 setup {{ module_load "mod_memcached"; }}
 
@@ -74,5 +163,28 @@ memcache = {{
             memcached.store ( "server" => "unix:{memcached.sockfile}" );
         }});
 }};
+
+memcache_headers = {{
+    memcached.lookup (( "server" => "unix:{memcached.sockfile}", "headers" => true ), {{
+            header.add "X-Memcached-Hit" => "true";
+        }}, {{
+            header.add "X-Memcached-Hit" => "false";
+            header.add "X-Not-Stored" => "1";
+            header.add "Cache-Control" => "max-age=60";
+            header.add "ETag" => "\\"mc-test\\"";
+            respond 200 => "Hello Headers!";
+            memcached.store ( "server" => "unix:{memcached.sockfile}", "headers" => true );
+        }});
+}};
+
+memcache_cluster = {{
+    memcached.lookup (( "server" => ( "unix:{cluster_down}", "unix:{memcached.sockfile}" ) ), {{
+            header.add "X-Memcached-Hit" => "true";
+        }}, {{
+            header.add "X-Memcached-Hit" => "false";
+            respond 200 => "Hello Cluster!";
+            memcached.store ( "server" => ( "unix:{cluster_down}", "unix:{memcached.sockfile}" ) );
+        }});
+}};
 """
         self.tests.add_service(memcached)
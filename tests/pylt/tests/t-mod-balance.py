@@ -0,0 +1,246 @@
+# -*- coding: utf-8 -*-
+
+import collections
+import io
+import os
+import socketserver
+import threading
+import time
+
+import pycurl
+
+from pylt.base import ModuleTest, TestBase
+from pylt.requests import CurlRequest
+
+
+class BalanceRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    URL = "/0"
+    EXPECT_RESPONSE_CODE = 200
+    no_docroot = True
+    # number of requests on one client connection; the last one is the checked response
+    REQUESTS = 40
+
+    def request_path(self, i: int) -> str:
+        return f"/{i}"
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        base_url = self.curl_url[:-len(self.URL)]
+        self.bodies: list[str] = []
+        curl.setopt(pycurl.HEADERFUNCTION, lambda line: None)
+        for i in range(self.REQUESTS - 1):
+            body = io.BytesIO()
+            curl.setopt(pycurl.URL, base_url + self.request_path(i))
+            curl.setopt(pycurl.WRITEFUNCTION, body.write)
+            curl.perform()
+            if curl.getinfo(pycurl.RESPONSE_CODE) != 200:
+                raise Exception(f"Request {i} failed with status {curl.getinfo(pycurl.RESPONSE_CODE)}")
+            self.bodies.append(body.getvalue().decode())
+        self.curl_url = base_url + self.request_path(self.REQUESTS - 1)
+        curl.setopt(pycurl.URL, self.curl_url)
+        curl.setopt(pycurl.WRITEFUNCTION, self.response.body_raw.write)
+        curl.setopt(pycurl.HEADERFUNCTION, self.response.recv_header_line)
+
+    def CheckResponse(self) -> bool:
+        self.bodies.append(self.response.body)
+        return self.check_bodies(self.bodies)
+
+    def check_bodies(self, bodies: list[str]) -> bool:
+        raise NotImplementedError()
+
+
+# smooth weighted round-robin: exactly 3 of 4 requests go to "a"
+class TestWeightedRoundRobin(BalanceRequest):
+    config = """
+balance.rr (({ respond 200 => "a"; }, 3), { respond 200 => "b"; });
+"""
+
+    def check_bodies(self, bodies: list[str]) -> bool:
+        counts = collections.Counter(bodies)
+        if counts != {"a": 30, "b": 10}:
+            raise Exception(f"Unexpected distribution {dict(counts)!r}")
+        return True
+
+
+# power of two choices samples by weight; the backends are idle, so the first choice wins
+class TestWeightedP2C(BalanceRequest):
+    REQUESTS = 200
+    config = """
+balance.p2c (({ respond 200 => "a"; }, [ "weight" => 3 ]), { respond 200 => "b"; });
+"""
+
+    def check_bodies(self, bodies: list[str]) -> bool:
+        counts = collections.Counter(bodies)
+        if set(counts) != {"a", "b"}:
+            raise Exception(f"Unexpected responses {dict(counts)!r}")
+        # expected 150 +- 6
+        if not 120 <= counts["a"] <= 180:
+            raise Exception(f"Unexpected distribution {dict(counts)!r}")
+        return True
+
+
+HASH_KEYS = 20
+
+
+# the same key always goes to the same backend
+class TestHashStable(BalanceRequest):
+    config = """
+balance.hash "%{req.path}", ({ respond 200 => "a"; }, { respond 200 => "b"; }, { respond 200 => "c"; });
+"""
+
+    def request_path(self, i: int) -> str:
+        return f"/key{i % HASH_KEYS}"
+
+    def check_bodies(self, bodies: list[str]) -> bool:
+        if bodies[:HASH_KEYS] != bodies[HASH_KEYS:]:
+            raise Exception(f"Keys moved between backends: {bodies[:HASH_KEYS]!r} != {bodies[HASH_KEYS:]!r}")
+        if len(set(bodies)) < 2:
+            raise Exception(f"All keys on one backend: {bodies!r}")
+        return True
+
+
+# same ring with the second backend down: only its keys move, to the other backends
+class TestHashFailover(BalanceRequest):
+    def prepare_test(self) -> None:
+        self.config = f"""
+if req.query == "down" {{
+    balance.hash "%{{req.path}}", ({{ respond 200 => "a"; }}, {{ proxy "unix:{self.tests.env.dir}/balance-no-backend.sock"; }}, {{ respond 200 => "c"; }});
+}} else {{
+    balance.hash "%{{req.path}}", ({{ respond 200 => "a"; }}, {{ respond 200 => "b"; }}, {{ respond 200 => "c"; }});
+}}
+"""
+
+    def request_path(self, i: int) -> str:
+        if i < HASH_KEYS:
+            return f"/key{i}"
+        return f"/key{i - HASH_KEYS}?down"
+
+    def check_bodies(self, bodies: list[str]) -> bool:
+        healthy, down = bodies[:HASH_KEYS], bodies[HASH_KEYS:]
+        if "b" not in healthy:
+            raise Exception(f"No key on the second backend: {healthy!r}")
+        for key, (before, after) in enumerate(zip(healthy, down)):
+            if before == "b":
+                if after not in ("a", "c"):
+                    raise Exception(f"Key {key} didn't fail over: {after!r}")
+            elif before != after:
+                raise Exception(f"Key {key} moved from {before!r} to {after!r}")
+        return True
+
+
+class HealthBackendHandler(socketserver.BaseRequestHandler):
+    def handle(self) -> None:
+        # tcp:// checks only connect
+        pass
+
+
+class HealthBackend(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    def __init__(self, *, sockfile: str) -> None:
+        self.sockfile = sockfile
+        super().__init__(sockfile, HealthBackendHandler)
+
+        self.listen_thread = threading.Thread(
+            target=self.serve_forever,
+            name="HealthBackend",
+        )
+        self.listen_thread.daemon = True
+        self.listen_thread.start()
+
+    def stop(self) -> None:
+        self.shutdown()
+        self.server_close()
+        try:
+            os.remove(self.sockfile)
+        except FileNotFoundError:
+            pass
+
+
+# fall/rise of a tcp check as shown by mod_status, and the slow start afterwards
+class TestHealthCheck(TestBase):
+    no_docroot = True
+
+    def prepare_test(self) -> None:
+        self.sockfile = os.path.join(self.tests.env.dir, "balance-health.sock")
+        self.check = f"tcp://unix:{self.sockfile}"
+        self.backend = HealthBackend(sockfile=self.sockfile)
+        self.config = f"""
+if req.path == "/status" {{
+    status.info;
+}} else {{
+    balance.rr (
+        ({{ respond 200 => "a"; }}, [ "check" => "{self.check}", "interval" => 1, "fall" => 2, "rise" => 2, "slow_start" => 60 ]),
+        {{ respond 200 => "b"; }}
+    );
+}}
+"""
+
+    def fetch(self, curl: pycurl.Curl, path: str) -> str:
+        body = io.BytesIO()
+        curl.setopt(pycurl.URL, f"http://127.0.0.2:{self.tests.env.port}{path}")
+        curl.setopt(pycurl.WRITEFUNCTION, body.write)
+        curl.perform()
+        if curl.getinfo(pycurl.RESPONSE_CODE) != 200:
+            raise Exception(f"Request {path!r} failed with status {curl.getinfo(pycurl.RESPONSE_CODE)}")
+        return body.getvalue().decode()
+
+    # "backend_health: <check> <state> <checks> <failed checks>"
+    def health(self, curl: pycurl.Curl) -> tuple[str, int, int]:
+        for line in self.fetch(curl, "/status?format=plain").splitlines():
+            fields = line.split()
+            if len(fields) == 5 and fields[0] == "backend_health:" and fields[1] == self.check:
+                return fields[2], int(fields[3]), int(fields[4])
+        raise Exception(f"Health check {self.check!r} not listed by mod_status")
+
+    def wait_for_state(self, curl: pycurl.Curl, state: str) -> tuple[str, int, int]:
+        deadline = time.monotonic() + 10
+        while True:
+            health = self.health(curl)
+            if health[0] == state:
+                return health
+            if time.monotonic() > deadline:
+                raise Exception(f"Health check didn't get {state!r}: {health!r}")
+            time.sleep(0.2)
+
+    def distribution(self, curl: pycurl.Curl, requests: int) -> collections.Counter:
+        return collections.Counter(self.fetch(curl, "/") for _ in range(requests))
+
+    def run_test(self) -> bool:
+        curl = pycurl.Curl()
+        try:
+            curl.setopt(pycurl.HTTPHEADER, [f"Host: {self.vhost}"])
+            curl.setopt(pycurl.NOSIGNAL, 1)
+            curl.setopt(pycurl.TIMEOUT, 2)
+
+            self.wait_for_state(curl, "up")
+            counts = self.distribution(curl, 20)
+            if counts != {"a": 10, "b": 10}:
+                raise Exception(f"Unexpected distribution with healthy backend: {dict(counts)!r}")
+
+            # fall: taken out after two failed checks
+            self.backend.stop()
+            _, checks, failed = self.wait_for_state(curl, "down")
+            if failed < 2:
+                raise Exception(f"Backend down after {failed} failed checks (of {checks})")
+            counts = self.distribution(curl, 20)
+            if counts != {"b": 20}:
+                raise Exception(f"Unexpected distribution with backend down: {dict(counts)!r}")
+
+            # rise: back after two good checks, but only with 5% of its share during slow start
+            self.backend = HealthBackend(sockfile=self.sockfile)
+            self.wait_for_state(curl, "up")
+            counts = self.distribution(curl, 40)
+            if counts["a"] > 8:
+                raise Exception(f"Unexpected distribution during slow start: {dict(counts)!r}")
+        finally:
+            curl.close()
+        return True
+
+    def cleanup_test(self) -> None:
+        self.backend.stop()
+
+
+class Test(ModuleTest):
+    plain_config = """
+setup { module_load ["mod_balance", "mod_proxy", "mod_status"]; }
+"""
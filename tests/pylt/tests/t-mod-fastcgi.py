@@ -0,0 +1,149 @@
+# -*- coding: utf-8 -*-
+
+import io
+import itertools
+import os
+import socketserver
+import struct
+import threading
+import time
+
+import pycurl
+
+from pylt.base import ModuleTest
+from pylt.fastcgi import Type, unpack_name_value_pairs
+from pylt.requests import CurlRequest
+
+
+_connection_ids = itertools.count(1)
+
+
+class FastCGIBackendHandler(socketserver.StreamRequestHandler):
+    def read_record(self) -> tuple[int, bytes]:
+        hdr = self.rfile.read(8)
+        if len(hdr) < 8:
+            raise EOFError()
+        _version, rec_type, _req_id, data_len, pad_len = struct.unpack('>BBHHBx', hdr)
+        data = self.rfile.read(data_len + pad_len)
+        if len(data) < data_len + pad_len:
+            raise EOFError()
+        return rec_type, data[:data_len]
+
+    def write_record(self, rec_type: int, data: bytes) -> None:
+        pad_len = (8 - (len(data) % 8)) % 8
+        self.wfile.write(struct.pack('>BBHHBx', 1, rec_type, 1, len(data), pad_len) + data + b'\0' * pad_len)
+
+    def handle(self) -> None:
+        conid = next(_connection_ids)
+        drop_next = False
+        try:
+            while True:
+                rec_type, _ = self.read_record()
+                if drop_next:
+                    # simulate a backend closing an idle connection just when the next request arrives
+                    return
+                if rec_type != Type.BEGIN_REQUEST:
+                    return
+                params = b''
+                while True:
+                    rec_type, data = self.read_record()
+                    if rec_type == Type.PARAMS and not data:
+                        break
+                    params += data
+                while True:
+                    rec_type, data = self.read_record()
+                    if rec_type == Type.STDIN and not data:
+                        break
+                uri = dict(unpack_name_value_pairs(params)).get(b'REQUEST_URI', b'').decode()
+                drop_next = uri.startswith("/reuse/drop")
+                # identify the backend connection
+                body = str(conid).encode()
+                self.write_record(Type.STDOUT, b"Status: 200\r\nContent-Type: text/plain\r\n\r\n" + body)
+                self.write_record(Type.STDOUT, b'')
+                self.write_record(Type.END_REQUEST, struct.pack('>IBxxx', 0, 0))
+                self.wfile.flush()
+                if uri.startswith("/reuse/close"):
+                    return
+        except EOFError:
+            return
+
+
+class FastCGIBackend(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    def __init__(self, *, sockfile: str) -> None:
+        self.sockfile = sockfile
+        super().__init__(self.sockfile, FastCGIBackendHandler)
+
+        self.listen_thread = threading.Thread(
+            target=self.serve_forever,
+            name="FastCGIBackend",
+        )
+        self.listen_thread.daemon = True
+        self.listen_thread.start()
+
+
+class BackendReuseRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    EXPECT_RESPONSE_CODE = 200
+    no_docroot = True
+    # whether the second request should use the same backend connection as the first
+    EXPECT_SAME_CONNECTION: bool
+
+    def prepare_test(self) -> None:
+        # own fastcgi action: a backend pool without idle connections from other tests
+        self.config = f"""
+fastcgi "unix:{self.tests.env.dir}/tmp/sockets/fastcgi-backend.sock";
+"""
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        # first request on the same client connection (i.e. the same worker and backend pool)
+        self.first_body = io.BytesIO()
+        curl.setopt(pycurl.WRITEFUNCTION, self.first_body.write)
+        curl.setopt(pycurl.HEADERFUNCTION, lambda line: None)
+        curl.perform()
+        # give the backend connection time to get back into the pool
+        time.sleep(0.1)
+        curl.setopt(pycurl.WRITEFUNCTION, self.response.body_raw.write)
+        curl.setopt(pycurl.HEADERFUNCTION, self.response.recv_header_line)
+
+    def CheckResponse(self) -> bool:
+        first = self.first_body.getvalue().decode()
+        if (first == self.response.body) != self.EXPECT_SAME_CONNECTION:
+            raise Exception(f"Unexpected backend connection {self.response.body!r} (first request: {first!r})")
+        return True
+
+
+# FCGI_KEEP_CONN: backend connection is kept alive and reused
+class TestBackendReuse(BackendReuseRequest):
+    URL = "/reuse"
+    EXPECT_SAME_CONNECTION = True
+
+
+# backend closed idle connection: must not be used again
+class TestBackendReuseClosed(BackendReuseRequest):
+    URL = "/reuse/close"
+    EXPECT_SAME_CONNECTION = False
+
+
+# backend closes reused connection without response: request is sent again on a new connection
+class TestBackendReuseRetry(BackendReuseRequest):
+    URL = "/reuse/drop"
+    EXPECT_SAME_CONNECTION = False
+
+
+class Test(ModuleTest):
+    def prepare_test(self) -> None:
+        sockdir = self.tests.install_dir(os.path.join("tmp", "sockets"))
+        self.fastcgi_backend = FastCGIBackend(sockfile=os.path.join(sockdir, "fastcgi-backend.sock"))
+        self.plain_config = """
+setup { module_load "mod_fastcgi"; }
+"""
+
+    def cleanup_test(self) -> None:
+        self.fastcgi_backend.shutdown()
+        self.fastcgi_backend.server_close()
+        try:
+            os.remove(self.fastcgi_backend.sockfile)
+        except FileNotFoundError:
+            pass
+        self.tests.remove_dir(os.path.join("tmp", "sockets"))
@@ -1,7 +1,11 @@
 # -*- coding: utf-8 -*-
 
+import io
 import socketserver
 import threading
+import time
+
+import pycurl
 
 from pylt.base import Tests, ModuleTest
 from pylt.requests import CurlRequest, TEST_TXT
@@ -10,8 +14,12 @@ from pylt.requests import CurlRequest, TEST_TXT
 class HttpBackendHandler(socketserver.StreamRequestHandler):
     def handle(self) -> None:
         keepalive = True
+        drop_next = False
         while True:
             reqline_full = self.rfile.readline().decode().rstrip()
+            if drop_next:
+                # simulate a backend closing an idle connection just when the next request arrives
+                return
             # eprint("Request line: " + repr(reqline))
             reqline = reqline_full.split(' ', 3)
             if len(reqline) != 3 or reqline[0].upper() != 'GET':
@@ -54,6 +62,10 @@ class HttpBackendHandler(socketserver.StreamRequestHandler):
 
             # send response
             resp_body = reqline[1].encode()
+            if reqline[1].startswith("/reuse"):
+                # identify the backend connection
+                resp_body = str(self.client_address[1]).encode()
+                drop_next = reqline[1].startswith("/reuse/drop")
             clen = f"Content-Length: {len(resp_body)}\r\n".encode()
             ka = b""
             if keepalive != keepalive_default:
@@ -64,7 +76,7 @@ class HttpBackendHandler(socketserver.StreamRequestHandler):
             resp = b"HTTP/1.1 200 OK\r\n" + ka + clen + b"\r\n" + resp_body
             # eprint("Backend response: " + repr(resp_body))
             self.wfile.write(resp)
-            if not keepalive:
+            if not keepalive or reqline[1].startswith("/reuse/close"):
                 return
 
 
@@ -161,6 +173,56 @@ backend_proxy;
 """
 
 
+class BackendReuseRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    EXPECT_RESPONSE_CODE = 200
+    no_docroot = True
+    # whether the second request should use the same backend connection as the first
+    EXPECT_SAME_CONNECTION: bool
+
+    def prepare_test(self) -> None:
+        # own proxy action: a backend pool without idle connections from other tests
+        self.config = f"""
+proxy "127.0.0.2:{self.tests.env.port + 3}";
+"""
+
+    def prepare_curl_request(self, curl: pycurl.Curl) -> None:
+        # first request on the same client connection (i.e. the same worker and backend pool)
+        self.first_body = io.BytesIO()
+        curl.setopt(pycurl.WRITEFUNCTION, self.first_body.write)
+        curl.setopt(pycurl.HEADERFUNCTION, lambda line: None)
+        curl.perform()
+        # give the backend connection time to get back into the pool
+        time.sleep(0.1)
+        curl.setopt(pycurl.WRITEFUNCTION, self.response.body_raw.write)
+        curl.setopt(pycurl.HEADERFUNCTION, self.response.recv_header_line)
+
+    def CheckResponse(self) -> bool:
+        first = self.first_body.getvalue().decode()
+        if (first == self.response.body) != self.EXPECT_SAME_CONNECTION:
+            raise Exception(f"Unexpected backend connection {self.response.body!r} (first request: {first!r})")
+        return True
+
+
+# backend connection is kept alive and reused
+class TestBackendReuse(BackendReuseRequest):
+    URL = "/reuse"
+    EXPECT_SAME_CONNECTION = True
+
+
+# backend closed idle connection: must not be used again
+class TestBackendReuseClosed(BackendReuseRequest):
+    URL = "/reuse/close"
+    EXPECT_SAME_CONNECTION = False
+
+
+# backend closes reused connection without response: request is retried on a new connection
+class TestBackendReuseRetry(BackendReuseRequest):
+    URL = "/reuse/drop"
+    EXPECT_SAME_CONNECTION = False
+
+
 class Test(ModuleTest):
     def prepare_test(self) -> None:
         self.http_backend = HttpBackend(tests=self.tests)
@@ -0,0 +1,53 @@
+# -*- coding: utf-8 -*-
+
+import sys
+
+from pylt.base import ModuleTest
+from pylt.requests import CurlRequest
+
+
+class PlainStatusRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    URL = "/?format=plain"
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Type", "text/plain")]
+
+    def status_lines(self, key: str) -> list[list[str]]:
+        prefix = f"{key}: "
+        return [line[len(prefix):].split(' ') for line in self.response.body.splitlines() if line.startswith(prefix)]
+
+
+class TestListenQueue(PlainStatusRequest):
+    # the main worker snapshots the listen queues; plain format shows them like the html page
+    def CheckResponse(self) -> bool:
+        if not sys.platform.startswith('linux'):
+            return True
+        socket = f"127.0.0.2:{self.tests.env.port}"
+        queues = [q for q in self.status_lines("listen_queue") if q[0] == socket]
+        if len(queues) != 1:
+            raise Exception(f"Expected one listen_queue line for {socket}, got {queues!r}")
+        if queues[0][1] != "0":
+            raise Exception(f"Expected {socket} to be handled by the main worker, got {queues[0]!r}")
+        return True
+
+
+class TestReuseportSockets(PlainStatusRequest):
+    # listen.reuseport in the base config: one socket per worker, accepting in that worker
+    PORT_OFFSET = 7
+
+    def CheckResponse(self) -> bool:
+        if not sys.platform.startswith('linux'):
+            return True
+        socket = f"127.0.0.2:{self.tests.env.port + 7}"
+        workers = sorted(q[1] for q in self.status_lines("listen_queue") if q[0] == socket)
+        if workers != ["1", "2"]:
+            raise Exception(f"Expected one socket per worker for {socket}, got workers {workers!r}")
+        return True
+
+
+class Test(ModuleTest):
+    config = """
+setup { module_load "mod_status"; }
+status.info;
+"""
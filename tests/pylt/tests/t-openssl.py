@@ -2,6 +2,7 @@
 
 import ipaddress
 import struct
+from pylt.base import ModuleTest
 from pylt.requests import CurlRequest, TEST_TXT
 
 
@@ -46,3 +47,60 @@ class TestProxyProtV2(CurlRequest):
     config = """
 respond "%{req.remoteip}";
 """
+
+
+KTLS_FEATURE = "ktls"
+
+
+class KtlsRequest(CurlRequest):
+    _NO_REGISTER = True  # used in metaclass
+
+    # openssl listener with "ktls" => true (see Test below); the kernel might still refuse
+    # (no "tls" module), then the connection keeps using openssl - the response must be the same
+    PORT_OFFSET = 4
+    SCHEME = "https"
+    vhost = "test1.ssl.test"
+
+    def run_test(self) -> bool:
+        if not KTLS_FEATURE in self.tests.env.features:
+            self.todo = True
+            return self.MissingFeature(KTLS_FEATURE)
+        return super().run_test()
+
+
+class TestKtlsFile(KtlsRequest):
+    URL = "/test.txt"
+    EXPECT_RESPONSE_BODY = TEST_TXT
+    EXPECT_RESPONSE_CODE = 200
+    EXPECT_RESPONSE_HEADERS = [("Content-Type", "text/plain; charset=utf-8")]
+
+
+class TestKtlsNotFound(KtlsRequest):
+    URL = "/not-existing.txt"
+    EXPECT_RESPONSE_CODE = 404
+
+
+class TestKtlsPost(KtlsRequest):
+    URL = "/"
+    POST = b"Hello World!"
+    EXPECT_RESPONSE_BODY = "12"
+    EXPECT_RESPONSE_CODE = 200
+    vhost = ""  # own vhost for the config
+    config = """
+respond 200 => "%{req.header[Content-Length]}";
+"""
+
+
+class Test(ModuleTest):
+    def prepare_test(self) -> None:
+        if KTLS_FEATURE in self.tests.env.features:
+            self.plain_config = f"""
+setup {{
+    openssl [
+        "listen" => "127.0.0.2:{self.tests.env.port + 4}",
+        "pemfile" => var.ssldir + "/server_test1.ssl.pem",
+        "ca-file" => var.ssldir + "/intermediate.crt",
+        "ktls" => true,
+    ];
+}}
+"""
@@ -0,0 +1,98 @@
+# -*- coding: utf-8 -*-
+
+import os
+import sys
+
+from pylt.base import ModuleTest
+from pylt.requests import CurlRequest
+
+
+# same size: only inotify (stat_cache.shared in the base config) can tell the
+# change apart within stat_cache.ttl (10 seconds); mtime might not change either
+CONTENT_1 = "first version\n"
+CONTENT_2 = "other version\n"
+
+
+class TestInplaceBefore(CurlRequest):
+    URL = "/inplace.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_1
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestInplaceAfter(CurlRequest):
+    # the next request after writing the file has to see the new content
+    URL = "/inplace.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_2
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        if not sys.platform.startswith('linux'):
+            self.todo = True
+            return self.MissingFeature("inotify")
+        with open(os.path.join(self.vhostdir, "inplace.txt"), "w") as f:
+            f.write(CONTENT_2)
+        return super().run_test()
+
+
+class TestReplacedBefore(CurlRequest):
+    URL = "/replaced.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_1
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestReplacedAfter(CurlRequest):
+    # new inode: the fd cache (stat_cache.fd_cache in the base config) must not
+    # keep sending the old file it still has open
+    URL = "/replaced.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_2
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        if not sys.platform.startswith('linux'):
+            self.todo = True
+            return self.MissingFeature("inotify")
+        fname = os.path.join(self.vhostdir, "replaced.txt")
+        with open(fname + ".new", "w") as f:
+            f.write(CONTENT_2)
+        os.replace(fname + ".new", fname)
+        return super().run_test()
+
+
+class TestMemCacheMiss(CurlRequest):
+    # static.memory_cache in the base config: the miss reads the file in the background
+    URL = "/memory.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_1
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestMemCacheHit(CurlRequest):
+    # might still be a miss if the background read isn't done yet; same content either way
+    URL = "/memory.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_1
+    EXPECT_RESPONSE_CODE = 200
+
+
+class TestMemCacheAfter(CurlRequest):
+    # same size, probably same second: the cached entry must not be used anymore
+    URL = "/memory.txt"
+    EXPECT_RESPONSE_BODY = CONTENT_2
+    EXPECT_RESPONSE_CODE = 200
+
+    def run_test(self) -> bool:
+        if not sys.platform.startswith('linux'):
+            self.todo = True
+            return self.MissingFeature("inotify")
+        with open(os.path.join(self.vhostdir, "memory.txt"), "w") as f:
+            f.write(CONTENT_2)
+        return super().run_test()
+
+
+class Test(ModuleTest):
+    config = """
+static;
+"""
+
+    def prepare_test(self) -> None:
+        self.prepare_vhost_file("inplace.txt", CONTENT_1)
+        self.prepare_vhost_file("replaced.txt", CONTENT_1)
+        self.prepare_vhost_file("memory.txt", CONTENT_1)